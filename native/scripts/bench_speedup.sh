@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Compare ubodoom_bench reports demo by demo against the first one:
+#
+#   ./native/scripts/bench_speedup.sh bench-O2.json bench-release.json bench-pgo.json
+#
+# Prints each report's timedemo fps per demo and its speedup over the first
+# report (make bench-profiles writes and compares these three).
+
+if [[ $# -lt 2 ]]; then
+  echo "usage: $0 <base.json> <other.json> [...]"
+  exit 2
+fi
+
+# "<demo> <fps>" for every demo that finished
+demo_fps() {
+  grep -o '"demo": "[^"]*", "ok": true, [^}]*"fps": [0-9.]*' "$1" \
+    | sed 's/"demo": "\([^"]*\)".*"fps": \([0-9.]*\)/\1 \2/'
+}
+
+BASE="$1"
+demo_fps "${BASE}" > /tmp/bench_speedup.$$
+trap 'rm -f /tmp/bench_speedup.$$' EXIT
+
+printf '%-24s %-8s %10s %9s\n' report demo fps speedup
+for report in "$@"; do
+  demo_fps "${report}" | awk -v name="$(basename "${report}")" -v base=/tmp/bench_speedup.$$ '
+    BEGIN { while ((getline line < base) > 0) { split(line, f, " "); ref[f[1]] = f[2] } }
+    {
+      s = ($1 in ref && ref[$1] > 0) ? sprintf("%.3fx", $2 / ref[$1]) : "-"
+      printf "%-24s %-8s %10.2f %9s\n", name, $1, $2, s
+      if ($1 in ref && ref[$1] > 0) { sum += log($2 / ref[$1]); n++ }
+    }
+    END { if (n) printf "%-24s %-8s %10s %8.3fx\n", name, "geomean", "", exp(sum / n) }'
+done
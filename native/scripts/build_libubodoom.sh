@@ -3,6 +3,7 @@ set -euo pipefail
 
 ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
 DOOM_DIR="${ROOT_DIR}/third_party/DOOM-master/linuxdoom-1.10"
+SNDSERV_DIR="${ROOT_DIR}/third_party/DOOM-master/sndserv"
 OUT_DIR="${ROOT_DIR}/native/out"
 
 mkdir -p "${OUT_DIR}"
@@ -16,8 +17,27 @@ fi
 # Source files are pre-patched directly in third_party/
 cd "${DOOM_DIR}"
 
+# PROFILE=release BOARD=pi4 ./native/scripts/build_libubodoom.sh picks a
+# Makefile build profile (see the Makefile); the default is the plain -O2 build.
 echo "Building libubodoom.so..."
-make libubodoom.so
+make libubodoom.so ${PROFILE:+PROFILE="${PROFILE}"} ${BOARD:+BOARD="${BOARD}"}
 
 cp -v "${DOOM_DIR}/libubodoom.so" "${OUT_DIR}/libubodoom.so"
 echo "OK: ${OUT_DIR}/libubodoom.so"
+
+# Optional CPython extension for DoomLib's hot path; without it (no
+# python3-dev) DoomLib uses ctypes for everything.
+PYTHON="${PYTHON:-python3}"
+if "${PYTHON}" -c 'import sysconfig, os, sys; sys.exit(not os.path.exists(os.path.join(sysconfig.get_paths()["include"], "Python.h")))' 2>/dev/null; then
+  echo "Building _ubodoom..."
+  make pymodule PYTHON="${PYTHON}" ${PROFILE:+PROFILE="${PROFILE}"} ${BOARD:+BOARD="${BOARD}"}
+  cp -v "${DOOM_DIR}"/_ubodoom*.so "${OUT_DIR}/"
+else
+  echo "Skipping _ubodoom (no Python.h for ${PYTHON}; install python3-dev)"
+fi
+
+# Optional out-of-process mixer (UBO_DOOM_SNDSERV)
+echo "Building sndserver..."
+make -C "${SNDSERV_DIR}"
+cp -v "${SNDSERV_DIR}/linux/sndserver" "${OUT_DIR}/sndserver"
+echo "OK: ${OUT_DIR}/sndserver"
@@ -7,7 +7,7 @@ set -euo pipefail
 # No local compiler or cross-toolchain needed.
 #
 # Prerequisites on the remote device:
-#   sudo apt install build-essential libasound2-dev
+#   sudo apt install build-essential libasound2-dev zlib1g-dev
 #
 # Usage:
 #   ./native/scripts/build_on_device.sh <user@host> [remote_base]
@@ -16,10 +16,15 @@ set -euo pipefail
 #   user@host     SSH target (e.g. debian@ubo-rd)
 #   remote_base   Base directory on device (default: $HOME)
 #
+# Environment:
+#   PROFILE       Makefile build profile (default: release; empty = plain -O2)
+#   BOARD         pi3, pi4, pi5 or native (default: read from the device tree)
+#   PGO_IWAD      IWAD on the device; if set, `make pgo` trains on its demos
+#
 # What it does:
-#   1. Checks that gcc, make and libasound2-dev are present on the device.
+#   1. Checks that gcc, make, libasound2-dev and zlib1g-dev are present on the device.
 #   2. Rsyncs third_party/DOOM-master/linuxdoom-1.10 to ~/doom-build/ on the device.
-#   3. Runs `make libubodoom.so` on the device.
+#   3. Runs `make libubodoom.so` (or `make pgo`) on the device.
 #   4. Copies the resulting .so to <remote_base>/doom/libubodoom.so.
 #   5. Rsyncs ubo_service/070-doom to <remote_base>/ubo_services/070-doom.
 #
@@ -31,6 +36,9 @@ if [[ $# -lt 1 ]]; then
 fi
 
 REMOTE="$1"
+PROFILE="${PROFILE-release}"
+BOARD="${BOARD-}"
+PGO_IWAD="${PGO_IWAD:-}"
 
 ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
 DOOM_SRC="${ROOT_DIR}/third_party/DOOM-master/linuxdoom-1.10"
@@ -56,12 +64,15 @@ command -v make >/dev/null 2>&1 || missing+=(make)
 if ! dpkg -s libasound2-dev >/dev/null 2>&1; then
   missing+=(libasound2-dev)
 fi
+if ! dpkg -s zlib1g-dev >/dev/null 2>&1; then
+  missing+=(zlib1g-dev)
+fi
 if [[ ${#missing[@]} -gt 0 ]]; then
   echo "ERROR: missing packages on device: ${missing[*]}"
-  echo "Fix with: sudo apt install build-essential libasound2-dev"
+  echo "Fix with: sudo apt install build-essential libasound2-dev zlib1g-dev"
   exit 1
 fi
-echo "    gcc, make, libasound2-dev — OK"
+echo "    gcc, make, libasound2-dev, zlib1g-dev — OK"
 ENDSSH
 
 # ── 2. Sync sources ─────────────────────────────────────────────────────────────
@@ -71,11 +82,29 @@ ssh "${REMOTE}" "mkdir -p '${REMOTE_BUILD_DIR}'"
 rsync -av --delete "${DOOM_SRC}/" "${REMOTE}:${REMOTE_BUILD_DIR}/"
 
 # ── 3. Build ────────────────────────────────────────────────────────────────────
+if [[ -z "${BOARD}" ]]; then
+  MODEL=$(ssh "${REMOTE}" "tr -d '\\0' < /proc/device-tree/model 2>/dev/null || true")
+  case "${MODEL}" in
+    *"Raspberry Pi 5"*) BOARD=pi5 ;;
+    *"Raspberry Pi 4"*|*"Compute Module 4"*) BOARD=pi4 ;;
+    *"Raspberry Pi 3"*|*"Zero 2"*) BOARD=pi3 ;;
+    *) BOARD=native ;;
+  esac
+  echo ""
+  echo "    Board       : ${BOARD} (${MODEL:-unknown model})"
+fi
+MAKE_ARGS="PROFILE=${PROFILE} BOARD=${BOARD}"
+if [[ -n "${PGO_IWAD}" ]]; then
+  MAKE_TARGET="pgo IWAD='${PGO_IWAD}'"
+else
+  MAKE_TARGET="libubodoom.so"
+fi
+
 echo ""
-echo "==> Building libubodoom.so on ${REMOTE} ..."
+echo "==> Building libubodoom.so on ${REMOTE} (${MAKE_ARGS}) ..."
 # Remove stale object files (e.g. from a previous x86_64 build on developer host)
 # before building natively on the device.
-ssh "${REMOTE}" "cd '${REMOTE_BUILD_DIR}' && rm -rf linux/ && make libubodoom.so"
+ssh "${REMOTE}" "cd '${REMOTE_BUILD_DIR}' && rm -rf linux/ pgo-data/ && make -j\$(nproc) ${MAKE_ARGS} ${MAKE_TARGET}"
 
 # ── 4. Install .so ──────────────────────────────────────────────────────────────
 echo ""
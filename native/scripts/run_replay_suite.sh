@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Replay the demos in native/replay/demos.txt through the headless engine,
+# check their final state hashes and write the tics/s and fps baseline:
+#
+#   ./native/scripts/run_replay_suite.sh ~/doom/doom2.wad [ubodoom_replay flags]
+#
+# -update records the current tics/hashes into the manifest (e.g. after adding
+# a demo); -norender skips the fps pass.
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
+DOOM_DIR="${ROOT_DIR}/third_party/DOOM-master/linuxdoom-1.10"
+OUT_DIR="${ROOT_DIR}/native/out"
+MANIFEST="${ROOT_DIR}/native/replay/demos.txt"
+IWAD="${1:-${UBO_DOOM_IWAD:-}}"
+
+if [[ -z "${IWAD}" || ! -f "${IWAD}" ]]; then
+  echo "usage: $0 <iwad> [-update] [-norender]  (or set UBO_DOOM_IWAD)"
+  exit 2
+fi
+shift || true
+
+mkdir -p "${OUT_DIR}"
+make -C "${DOOM_DIR}" ubodoom_replay
+
+echo "Replaying ${MANIFEST} with ${IWAD}..."
+"${DOOM_DIR}/ubodoom_replay" "$@" -o "${OUT_DIR}/replay-baseline.json" "${IWAD}" "${MANIFEST}"
+echo "OK: ${OUT_DIR}/replay-baseline.json"
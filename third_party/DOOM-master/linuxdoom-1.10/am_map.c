@@ -24,6 +24,8 @@
 static const char rcsid[] = "$Id: am_map.c,v 1.4 1997/02/03 21:24:33 b1 Exp $";
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 
 #include "z_zone.h"
@@ -289,6 +291,20 @@ static cheatseq_t cheat_amap = { cheat_amap_seq, 0 };
 
 static boolean stopped = true;
 
+//
+// UBO: the background, grid and walls are kept in amlayer and only
+// redrawn when the window moves or zooms, or a line changes colour
+// (newly mapped, a moving floor, a cheat).  Otherwise each frame starts
+// from a copy of the layer and only the arrows, things and marks are
+// drawn over it.
+//
+static byte	amlayer[SCREENWIDTH*SCREENHEIGHT];
+static byte*	amcolors;	// colour each line was drawn in, 0 = not drawn
+static int	amnumcolors;
+static boolean	amlayervalid;
+static fixed_t	amlayer_x, amlayer_y, amlayer_scale;
+static int	amlayer_w, amlayer_h, amlayer_grid, amlayer_level;
+
 extern boolean viewactive;
 //extern byte screens[][SCREENWIDTH*SCREENHEIGHT];
 
@@ -462,6 +478,7 @@ void AM_initVariables(void)
 
     automapactive = true;
     fb = screens[0];
+    amlayervalid = false;
 
     f_oldloc.x = MAXINT;
     amclock = 0;
@@ -539,8 +556,8 @@ void AM_LevelInit(void)
     leveljuststarted = 0;
 
     f_x = f_y = 0;
-    f_w = finit_width;
-    f_h = finit_height;
+    f_w = V_SCALEX(finit_width);
+    f_h = V_SCALEY(finit_height);
 
     AM_clearMarks();
 
@@ -622,12 +639,27 @@ AM_Responder
 
     rc = false;
 
-    if (!automapactive)
+    if (automapoverlay)
+    {
+	// UBO: the overlay only takes its own key; the rest play on
+	if (ev->type == ev_keydown && ev->data1 == AM_ENDKEY)
+	{
+	    automapoverlay = false;
+	    rc = true;
+	}
+    }
+
+    else if (!automapactive)
     {
 	if (ev->type == ev_keydown && ev->data1 == AM_STARTKEY)
 	{
-	    AM_Start ();
-	    viewactive = false;
+	    if (amoverlay)
+		automapoverlay = true;
+	    else
+	    {
+		AM_Start ();
+		viewactive = false;
+	    }
 	    rc = true;
 	}
     }
@@ -832,7 +864,13 @@ void AM_Ticker (void)
 //
 void AM_clearFB(int color)
 {
-    memset(fb, color, f_w*f_h);
+    int y;
+
+    if (f_w == SCREENWIDTH)
+	memset(fb, color, f_w*f_h);
+    else
+	for (y=0 ; y<f_h ; y++)
+	    memset(fb + y*SCREENWIDTH, color, f_w);
 }
 
 
@@ -1001,7 +1039,31 @@ AM_drawFline
 	return;
     }
 
-#define PUTDOT(xx,yy,cc) fb[(yy)*f_w+(xx)]=(cc)
+#define PUTDOT(xx,yy,cc) fb[(yy)*SCREENWIDTH+(xx)]=(cc)
+
+    // UBO: most walls and all grid lines are axis-aligned; fill those
+    // as a run or a column instead of stepping the error term.
+    if (fl->a.y == fl->b.y)
+    {
+	x = fl->a.x < fl->b.x ? fl->a.x : fl->b.x;
+	dx = fl->a.x < fl->b.x ? fl->b.x - fl->a.x : fl->a.x - fl->b.x;
+	memset(fb + fl->a.y*SCREENWIDTH + x, color, dx+1);
+	return;
+    }
+    if (fl->a.x == fl->b.x)
+    {
+	byte* dest;
+
+	y = fl->a.y < fl->b.y ? fl->a.y : fl->b.y;
+	dy = fl->a.y < fl->b.y ? fl->b.y - fl->a.y : fl->a.y - fl->b.y;
+	dest = fb + y*SCREENWIDTH + fl->a.x;
+	do
+	{
+	    *dest = color;
+	    dest += SCREENWIDTH;
+	} while (dy--);
+	return;
+    }
 
     dx = fl->b.x - fl->a.x;
     ax = 2 * (dx<0 ? -dx : dx);
@@ -1111,9 +1173,96 @@ void AM_drawGrid(int color)
 }
 
 //
-// Determines visible lines, draws them.
+// Colour a line is drawn in, 0 if it is not drawn.
 // This is LineDef based, not LineSeg based.
 //
+static int AM_lineColor(line_t* line)
+{
+    if (cheating || (line->flags & ML_MAPPED))
+    {
+	if ((line->flags & LINE_NEVERSEE) && !cheating)
+	    return 0;
+	if (!line->backsector)
+	    return WALLCOLORS+lightlev;
+	if (line->special == 39)
+	    return WALLCOLORS+WALLRANGE/2; // teleporters
+	if (line->flags & ML_SECRET) // secret door
+	    return cheating ? SECRETWALLCOLORS + lightlev : WALLCOLORS+lightlev;
+	if (line->backsector->floorheight
+	    != line->frontsector->floorheight)
+	    return FDWALLCOLORS + lightlev; // floor level change
+	if (line->backsector->ceilingheight
+	    != line->frontsector->ceilingheight)
+	    return CDWALLCOLORS+lightlev; // ceiling level change
+	if (cheating)
+	    return TSWALLCOLORS+lightlev;
+	return 0;
+    }
+    if (plr->powers[pw_allmap] && !(line->flags & LINE_NEVERSEE))
+	return GRAYS+3;
+    return 0;
+}
+
+//
+// Recolour the lines; true if the layer has to be drawn again.
+//
+static boolean AM_layerStale(void)
+{
+    boolean	stale;
+    int		i, color;
+
+    stale = !amlayervalid
+	|| m_x != amlayer_x || m_y != amlayer_y
+	|| scale_mtof != amlayer_scale
+	|| f_w != amlayer_w || f_h != amlayer_h
+	|| grid != amlayer_grid || levelstarttic != amlayer_level;
+
+    if (numlines > amnumcolors)
+    {
+	amcolors = realloc(amcolors, numlines);
+	if (!amcolors)
+	    I_Error ("AM_layerStale: no memory for %i lines", numlines);
+	amnumcolors = numlines;
+	stale = true;
+    }
+    for (i=0;i<numlines;i++)
+    {
+	color = AM_lineColor(&lines[i]);
+	if (color != amcolors[i])
+	{
+	    amcolors[i] = color;
+	    stale = true;
+	}
+    }
+
+    amlayervalid = true;
+    amlayer_x = m_x;
+    amlayer_y = m_y;
+    amlayer_scale = scale_mtof;
+    amlayer_w = f_w;
+    amlayer_h = f_h;
+    amlayer_grid = grid;
+    amlayer_level = levelstarttic;
+    return stale;
+}
+
+//
+// Copy the first f_h rows of f_w pixels from src to dest.
+//
+static void AM_copyLayer(byte* dest, byte* src)
+{
+    int y;
+
+    if (f_w == SCREENWIDTH)
+	memcpy(dest, src, f_w*f_h);
+    else
+	for (y=0 ; y<f_h ; y++)
+	    memcpy(dest + y*SCREENWIDTH, src + y*SCREENWIDTH, f_w);
+}
+
+//
+// Draws the visible lines in the colours AM_layerStale picked.
+//
 void AM_drawWalls(void)
 {
     int i;
@@ -1121,46 +1270,13 @@ void AM_drawWalls(void)
 
     for (i=0;i<numlines;i++)
     {
+	if (!amcolors[i])
+	    continue;
 	l.a.x = lines[i].v1->x;
 	l.a.y = lines[i].v1->y;
 	l.b.x = lines[i].v2->x;
 	l.b.y = lines[i].v2->y;
-	if (cheating || (lines[i].flags & ML_MAPPED))
-	{
-	    if ((lines[i].flags & LINE_NEVERSEE) && !cheating)
-		continue;
-	    if (!lines[i].backsector)
-	    {
-		AM_drawMline(&l, WALLCOLORS+lightlev);
-	    }
-	    else
-	    {
-		if (lines[i].special == 39)
-		{ // teleporters
-		    AM_drawMline(&l, WALLCOLORS+WALLRANGE/2);
-		}
-		else if (lines[i].flags & ML_SECRET) // secret door
-		{
-		    if (cheating) AM_drawMline(&l, SECRETWALLCOLORS + lightlev);
-		    else AM_drawMline(&l, WALLCOLORS+lightlev);
-		}
-		else if (lines[i].backsector->floorheight
-			   != lines[i].frontsector->floorheight) {
-		    AM_drawMline(&l, FDWALLCOLORS + lightlev); // floor level change
-		}
-		else if (lines[i].backsector->ceilingheight
-			   != lines[i].frontsector->ceilingheight) {
-		    AM_drawMline(&l, CDWALLCOLORS+lightlev); // ceiling level change
-		}
-		else if (cheating) {
-		    AM_drawMline(&l, TSWALLCOLORS+lightlev);
-		}
-	    }
-	}
-	else if (plr->powers[pw_allmap])
-	{
-	    if (!(lines[i].flags & LINE_NEVERSEE)) AM_drawMline(&l, GRAYS+3);
-	}
+	AM_drawMline(&l, amcolors[i]);
     }
 }
 
@@ -1317,7 +1433,7 @@ void AM_drawMarks(void)
 	    fx = CXMTOF(markpoints[i].x);
 	    fy = CYMTOF(markpoints[i].y);
 	    if (fx >= f_x && fx <= f_w - w && fy >= f_y && fy <= f_h - h)
-		V_DrawPatch(fx, fy, FB, marknums[i]);
+		V_DrawPatch(V_UNSCALEX(fx), V_UNSCALEY(fy), FB, marknums[i]);
 	}
     }
 
@@ -1325,7 +1441,7 @@ void AM_drawMarks(void)
 
 void AM_drawCrosshair(int color)
 {
-    fb[(f_w*(f_h+1))/2] = color; // single point for now
+    fb[(f_h/2)*SCREENWIDTH+f_w/2] = color; // single point for now
 
 }
 
@@ -1333,10 +1449,16 @@ void AM_Drawer (void)
 {
     if (!automapactive) return;
 
-    AM_clearFB(BACKGROUND);
-    if (grid)
-	AM_drawGrid(GRIDCOLORS);
-    AM_drawWalls();
+    if (AM_layerStale())
+    {
+	AM_clearFB(BACKGROUND);
+	if (grid)
+	    AM_drawGrid(GRIDCOLORS);
+	AM_drawWalls();
+	AM_copyLayer(amlayer, fb);
+    }
+    else
+	AM_copyLayer(fb, amlayer);
     AM_drawPlayers();
     if (cheating==2)
 	AM_drawThings(THINGCOLORS, THINGRANGE);
@@ -1347,3 +1469,298 @@ void AM_Drawer (void)
     V_MarkRect(f_x, f_y, f_w, f_h);
 
 }
+
+
+
+//
+// UBO: AUTOMAP OVERLAY
+// With amoverlay set the map key lays a window of the automap over
+// the 3D view instead of replacing it.  Runs of collinear one-sided
+// walls are drawn as one line (amosegs, built once a level), only the
+// runs touching the blockmap cells under the window are looked at, and
+// their clipped screen lines are kept until the player moves or the
+// view window changes.  Each frame then only recolours and draws them
+// over the view, with the player arrow on top.
+//
+int		amoverlay;
+boolean		automapoverlay;
+
+// map units across the overlay
+#define AMO_SPAN	(1600*FRACUNIT)
+
+typedef struct
+{
+    mline_t	ml;
+    int		first;		// its lines: amolines[first..first+count)
+    int		count;
+} amoseg_t;
+
+typedef struct
+{
+    fline_t	fl;
+    int		seg;
+} amodraw_t;
+
+// The automap's window: the full map's, or the overlay's swapped in.
+typedef struct
+{
+    byte*	fb;
+    int		f_w, f_h;
+    fixed_t	m_x, m_y, m_x2, m_y2, m_w, m_h;
+    fixed_t	scale_mtof, scale_ftom;
+    player_t*	plr;
+} amwindow_t;
+
+static amoseg_t*	amosegs;
+static int		amonumsegs;
+static int*		amolines;	// line numbers, run by run
+static int*		amolineseg;	// line -> its run
+static int*		amosegstamp;
+static int		amostamp;
+static int		amo_level = -1;
+static int		amo_numlines;
+
+static amodraw_t*	amodraws;
+static int		amonumdraws;
+static int		amomaxdraws;
+static boolean		amo_valid;
+static fixed_t		amo_x, amo_y;
+
+static amwindow_t	amowin;
+
+
+static void AM_swapWindow(amwindow_t* w)
+{
+    amwindow_t	t;
+
+    t.fb = fb; t.f_w = f_w; t.f_h = f_h;
+    t.m_x = m_x; t.m_y = m_y; t.m_x2 = m_x2; t.m_y2 = m_y2;
+    t.m_w = m_w; t.m_h = m_h;
+    t.scale_mtof = scale_mtof; t.scale_ftom = scale_ftom;
+    t.plr = plr;
+
+    fb = w->fb; f_w = w->f_w; f_h = w->f_h;
+    m_x = w->m_x; m_y = w->m_y; m_x2 = w->m_x2; m_y2 = w->m_y2;
+    m_w = w->m_w; m_h = w->m_h;
+    scale_mtof = w->scale_mtof; scale_ftom = w->scale_ftom;
+    plr = w->plr;
+
+    *w = t;
+}
+
+
+//
+// A plain one-sided wall: drawn in the same colour as its neighbours
+// whenever one of them is, so a straight run can be one line.
+//
+static boolean AM_mergeable(line_t* line)
+{
+    return !line->backsector && !line->special
+	&& !(line->flags & (ML_SECRET|LINE_NEVERSEE));
+}
+
+//
+// b carries straight on from a, in the same direction.
+//
+static boolean AM_continues(line_t* a, line_t* b)
+{
+    long long	ax = (a->dx>>FRACBITS), ay = (a->dy>>FRACBITS);
+    long long	bx = (b->dx>>FRACBITS), by = (b->dy>>FRACBITS);
+
+    return a->v2 == b->v1 && ax*by == ay*bx && ax*bx + ay*by > 0;
+}
+
+
+//
+// Groups the level's lines into runs.
+//
+static void AM_buildOverlaySegs(void)
+{
+    int*	vertout;	// the mergeable line leaving a vertex, -2 two
+    int*	vertin;		// the one arriving
+    int		i, v, l, n;
+    line_t*	line;
+    amoseg_t*	seg;
+
+    amosegs = realloc(amosegs, numlines*sizeof(*amosegs));
+    amolines = realloc(amolines, numlines*sizeof(*amolines));
+    amolineseg = realloc(amolineseg, numlines*sizeof(*amolineseg));
+    amosegstamp = realloc(amosegstamp, numlines*sizeof(*amosegstamp));
+    vertout = malloc(numvertexes*sizeof(*vertout));
+    vertin = malloc(numvertexes*sizeof(*vertin));
+    if (!amosegs || !amolines || !amolineseg || !amosegstamp
+	|| !vertout || !vertin)
+	I_Error ("AM_buildOverlaySegs: no memory for %i lines", numlines);
+
+    for (v=0 ; v<numvertexes ; v++)
+	vertout[v] = vertin[v] = -1;
+    for (i=0, line=lines ; i<numlines ; i++, line++)
+    {
+	amolineseg[i] = -1;
+	amosegstamp[i] = 0;
+	if (!AM_mergeable(line))
+	    continue;
+	v = line->v1 - vertexes;
+	vertout[v] = vertout[v] == -1 ? i : -2;
+	v = line->v2 - vertexes;
+	vertin[v] = vertin[v] == -1 ? i : -2;
+    }
+
+    // a run starts at every line nothing carries straight on into
+    amonumsegs = n = 0;
+    for (i=0, line=lines ; i<numlines ; i++, line++)
+    {
+	if (AM_mergeable(line))
+	{
+	    v = line->v1 - vertexes;
+	    l = vertin[v];
+	    if (l >= 0 && vertout[v] == i && AM_continues(&lines[l], line))
+		continue;
+	}
+	seg = &amosegs[amonumsegs];
+	seg->first = n;
+	seg->ml.a.x = line->v1->x;
+	seg->ml.a.y = line->v1->y;
+	for (l = i ; ; )
+	{
+	    amolines[n++] = l;
+	    amolineseg[l] = amonumsegs;
+	    if (!AM_mergeable(&lines[l]))
+		break;
+	    v = lines[l].v2 - vertexes;
+	    if (vertout[v] < 0 || vertin[v] != l
+		|| amolineseg[vertout[v]] != -1
+		|| !AM_continues(&lines[l], &lines[vertout[v]]))
+		break;
+	    l = vertout[v];
+	}
+	seg->ml.b.x = lines[l].v2->x;
+	seg->ml.b.y = lines[l].v2->y;
+	seg->count = n - seg->first;
+	amonumsegs++;
+    }
+
+    free(vertout);
+    free(vertin);
+    amo_level = levelstarttic;
+    amo_numlines = numlines;
+    amo_valid = false;
+}
+
+
+//
+// A run's colour: its first mapped line's, so a wall shows once any
+// of it has been seen.
+//
+static int AM_segColor(amoseg_t* seg)
+{
+    int	i;
+
+    for (i=0 ; i<seg->count ; i++)
+	if (lines[amolines[seg->first+i]].flags & ML_MAPPED)
+	    return AM_lineColor(&lines[amolines[seg->first+i]]);
+    return AM_lineColor(&lines[amolines[seg->first]]);
+}
+
+
+//
+// Clips the runs in the blockmap cells under the window to it; the
+// window's state is swapped in.
+//
+static void AM_cullOverlay(void)
+{
+    int		bx, by, bx1, by1, bx2, by2;
+    int*	list;
+    int*	end;
+    int		s;
+    fline_t	fl;
+
+    amostamp++;
+    amonumdraws = 0;
+
+    bx1 = (m_x - bmaporgx)>>MAPBLOCKSHIFT;
+    bx2 = (m_x2 - bmaporgx)>>MAPBLOCKSHIFT;
+    by1 = (m_y - bmaporgy)>>MAPBLOCKSHIFT;
+    by2 = (m_y2 - bmaporgy)>>MAPBLOCKSHIFT;
+    if (bx1 < 0) bx1 = 0;
+    if (by1 < 0) by1 = 0;
+    if (bx2 >= bmapwidth) bx2 = bmapwidth-1;
+    if (by2 >= bmapheight) by2 = bmapheight-1;
+
+    for (by=by1 ; by<=by2 ; by++)
+	for (bx=bx1 ; bx<=bx2 ; bx++)
+	{
+	    list = blockmaplines + blockmap[by*bmapwidth+bx];
+	    end = blockmaplines + blockmap[by*bmapwidth+bx+1];
+	    for ( ; list < end ; list++)
+	    {
+		s = amolineseg[*list];
+		if (amosegstamp[s] == amostamp)
+		    continue;
+		amosegstamp[s] = amostamp;
+		if (!AM_clipMline(&amosegs[s].ml, &fl))
+		    continue;
+		if (amonumdraws == amomaxdraws)
+		    amodraws = I_GrowArray (amodraws, &amomaxdraws,
+					    sizeof(*amodraws), 256,
+					    "automap overlay lines");
+		amodraws[amonumdraws].fl = fl;
+		amodraws[amonumdraws].seg = s;
+		amonumdraws++;
+	    }
+	}
+}
+
+
+//
+// Draws the overlay over the view window; D_Display, after the view.
+//
+void AM_DrawOverlay(void)
+{
+    player_t*	p = &players[displayplayer];
+    byte*	dest = screens[0] + viewwindowy*SCREENWIDTH + viewwindowx;
+    int		color;
+    int		i;
+
+    if (!p->mo)
+	return;
+    if (levelstarttic != amo_level || numlines != amo_numlines)
+	AM_buildOverlaySegs();
+
+    if (!amo_valid || p->mo->x != amo_x || p->mo->y != amo_y
+	|| amowin.fb != dest || amowin.f_w != scaledviewwidth
+	|| amowin.f_h != viewheight)
+    {
+	amowin.fb = dest;
+	amowin.f_w = scaledviewwidth;
+	amowin.f_h = viewheight;
+	amowin.scale_mtof = FixedDiv(scaledviewwidth<<FRACBITS, AMO_SPAN);
+	amowin.scale_ftom = FixedDiv(FRACUNIT, amowin.scale_mtof);
+	amowin.m_w = FixedMul(scaledviewwidth<<FRACBITS, amowin.scale_ftom);
+	amowin.m_h = FixedMul(viewheight<<FRACBITS, amowin.scale_ftom);
+	amowin.m_x = p->mo->x - amowin.m_w/2;
+	amowin.m_y = p->mo->y - amowin.m_h/2;
+	amowin.m_x2 = amowin.m_x + amowin.m_w;
+	amowin.m_y2 = amowin.m_y + amowin.m_h;
+	amo_x = p->mo->x;
+	amo_y = p->mo->y;
+
+	amowin.plr = p;
+	AM_swapWindow(&amowin);
+	AM_cullOverlay();
+	AM_swapWindow(&amowin);
+	amo_valid = true;
+    }
+
+    amowin.plr = p;
+    AM_swapWindow(&amowin);
+    for (i=0 ; i<amonumdraws ; i++)
+    {
+	color = AM_segColor(&amosegs[amodraws[i].seg]);
+	if (color)
+	    AM_drawFline(&amodraws[i].fl, color);
+    }
+    AM_drawPlayers();
+    AM_swapWindow(&amowin);
+}
+
@@ -42,6 +42,13 @@ void AM_Drawer (void);
 // if the level is completed while it is up.
 void AM_Stop (void);
 
+// UBO: amoverlay (UBO_DOOM_AUTOMAP_OVERLAY) makes the map key toggle
+// automapoverlay instead: the view stays up and D_Display draws the
+// map around the player over it with AM_DrawOverlay.
+extern int	amoverlay;
+extern boolean	automapoverlay;
+void AM_DrawOverlay (void);
+
 
 
 #endif
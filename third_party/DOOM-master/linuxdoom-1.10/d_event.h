@@ -61,7 +61,8 @@ typedef enum
     ga_completed,
     ga_victory,
     ga_worlddone,
-    ga_screenshot
+    ga_screenshot,
+    ga_spectate		// UBO: start the session a mirrored game sent
 } gameaction_t;
 
 
@@ -40,6 +40,7 @@ static const char rcsid[] = "$Id: d_main.c,v 1.8 1997/02/03 22:45:09 b1 Exp $";
 #include <fcntl.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #endif
 
 
@@ -63,6 +64,7 @@ static const char rcsid[] = "$Id: d_main.c,v 1.8 1997/02/03 22:45:09 b1 Exp $";
 #include "m_menu.h"
 
 #include "i_system.h"
+#include "i_trace.h"
 #include "i_sound.h"
 #include "i_video.h"
 
@@ -79,6 +81,8 @@ static const char rcsid[] = "$Id: d_main.c,v 1.8 1997/02/03 22:45:09 b1 Exp $";
 
 #include "d_main.h"
 
+#include "doom_api.h"
+
 //
 // D-DoomLoop()
 // Not a globally visible function,
@@ -189,6 +193,122 @@ void D_ProcessEvents (void)
 
 // wipegamestate can be set to -1 to force a wipe on the next draw
 gamestate_t     wipegamestate = GS_DEMOSCREEN;
+
+// UBO: in library mode the melt runs a step per D_Display call
+int		wipescreens = 1;	// UBO_DOOM_WIPE; 0 = cut straight over
+static boolean	wipeactive;
+static int	wipelasttic;
+
+//
+// D_WipeStep
+// Melt on by the tics since the last frame.  The game keeps ticking
+// under it, as it does when D_DoomLoop catches up after a vanilla wipe.
+//
+static void D_WipeStep (void)
+{
+    int		tics;
+
+    UBO_TRACE_BEGIN ("wipe");
+    tics = gametic - wipelasttic;
+    if (tics < 1)
+	tics = 1;
+    wipelasttic = gametic;
+    wipeactive = !wipe_ScreenWipe(wipe_Melt
+				  , 0, 0, SCREENWIDTH, SCREENHEIGHT, tics);
+    I_UpdateNoBlit ();
+    M_Drawer ();                            // menu is drawn even on top of wipes
+    sbarclean = false;
+    framestatic = false;
+    I_FinishUpdate ();
+    UBO_TRACE_END ();
+}
+
+
+//
+// D_DrawLoading
+// UBO: while a staged level load runs (G_ContinueLoadLevel) there is no
+//  level to draw.  The last frame stays up with a progress bar over its
+//  lower part; the wipe into the level then melts both away.
+//
+#define LOADBAR_FRAME	(256-47)	// the automap's WHITE
+#define LOADBAR_FILL	(256-5*16)	// and REDS
+
+static void D_DrawLoading (void)
+{
+    int		w = screenwidth / 2;
+    int		h = screenheight / 25;
+    int		x0 = (screenwidth - w) / 2;
+    int		y0 = screenheight * 7 / 8 - h / 2;
+    int		done;
+    int		y;
+    byte*	row;
+
+    I_Direct565ToIndex ();		// the last frame's view, if that went out as RGB565
+    done = P_SetupProgress () * (w - 4) / 100;
+    if (done < 0)
+	done = 0;
+    for (y = 0 ; y < h ; y++)
+    {
+	row = screens[0] + (y0 + y) * SCREENWIDTH + x0;
+	if (y == 0 || y == h-1)
+	{
+	    memset (row, LOADBAR_FRAME, w);
+	    continue;
+	}
+	row[0] = row[w-1] = LOADBAR_FRAME;
+	row[1] = row[w-2] = 0;
+	if (y == 1 || y == h-2)
+	{
+	    memset (row + 1, 0, w - 2);
+	    continue;
+	}
+	memset (row + 2, LOADBAR_FILL, done);
+	memset (row + 2 + done, 0, w - 4 - done);
+    }
+    sbarclean = false;
+    framestatic = false;
+    I_FinishUpdate ();
+}
+
+
+//
+// D_ScreenStatic
+// True if screens[0] is what the last frame showed.  Only screens that
+//  tend to sit still (menu, pause, intermission, finale, title pages)
+//  are compared; anything else drops the copy.
+//
+static byte	lastscreen[SCREENWIDTH*SCREENHEIGHT];
+static boolean	lastscreenvalid;
+
+static boolean D_ScreenStatic (void)
+{
+    if (!ubo_video_skipstatic
+	|| (gamestate == GS_LEVEL && !menuactive && !paused))
+    {
+	lastscreenvalid = false;
+	return false;
+    }
+    if (lastscreenvalid
+	&& !memcmp (lastscreen, screens[0], sizeof(lastscreen)))
+	return true;
+    memcpy (lastscreen, screens[0], sizeof(lastscreen));
+    lastscreenvalid = true;
+    return false;
+}
+
+
+//
+// D_Idle
+// True while the screen only changes when a key is pressed: the menu
+//  over a paused game or a title page, the pause screen, a title page.
+//  Attract demos, wipes and netgames keep running at full rate.
+//
+boolean D_Idle (void)
+{
+    if (netgame || demoplayback || wipeactive)
+	return false;
+    return menuactive || paused || gamestate == GS_DEMOSCREEN;
+}
 extern  boolean setsizeneeded;
 extern  int             showMessages;
 void R_ExecuteSetViewSize (void);
@@ -211,6 +331,26 @@ void D_Display (void)
 
     if (nodrawers)
 	return;                    // for comparative timing / profiling
+
+    // UBO: doom_set_direct565.  A plain view of a level with nothing
+    //  over it but HUD messages can be drawn straight into RGB565.
+    R_SetView565 (direct565 && gamestate == GS_LEVEL && gametic
+		  && gamestate == wipegamestate && !levelloading
+		  && !wipeactive && !automapactive && !automapoverlay
+		  && !menuactive
+		  && !paused && I_Direct565Frame ());
+
+    if (levelloading)
+    {
+	D_DrawLoading ();
+	return;
+    }
+
+    if (wipeactive)
+    {
+	D_WipeStep ();
+	return;
+    }
 		
     redrawsbar = false;
     
@@ -226,6 +366,7 @@ void D_Display (void)
     if (gamestate != wipegamestate)
     {
 	wipe = true;
+	I_Direct565ToIndex ();
 	wipe_StartScreen(0, 0, SCREENWIDTH, SCREENHEIGHT);
     }
     else
@@ -242,12 +383,14 @@ void D_Display (void)
 	    break;
 	if (automapactive)
 	    AM_Drawer ();
-	if (wipe || (viewheight != 200 && fullscreen) )
+	if (wipe || (viewheight != screenheight && fullscreen) )
 	    redrawsbar = true;
 	if (inhelpscreensstate && !inhelpscreens)
 	    redrawsbar = true;              // just put away the help screen
-	ST_Drawer (viewheight == 200, redrawsbar );
-	fullscreen = viewheight == 200;
+	UBO_PROF_BEGIN(UBO_PROF_STATUSBAR);
+	ST_Drawer (viewheight == screenheight, redrawsbar );
+	UBO_PROF_END(UBO_PROF_STATUSBAR);
+	fullscreen = viewheight == screenheight;
 	break;
 
       case GS_INTERMISSION:
@@ -270,6 +413,9 @@ void D_Display (void)
     if (gamestate == GS_LEVEL && !automapactive && gametic)
 	R_RenderPlayerView (&players[displayplayer]);
 
+    if (gamestate == GS_LEVEL && automapoverlay && !automapactive && gametic)
+	AM_DrawOverlay ();
+
     if (gamestate == GS_LEVEL && gametic)
 	HU_Drawer ();
     
@@ -285,7 +431,7 @@ void D_Display (void)
     }
 
     // see if the border needs to be updated to the screen
-    if (gamestate == GS_LEVEL && !automapactive && scaledviewwidth != 320)
+    if (gamestate == GS_LEVEL && !automapactive && scaledviewwidth != screenwidth)
     {
 	if (menuactive || menuactivestate || !viewactivestate)
 	    borderdrawcount = 3;
@@ -308,8 +454,8 @@ void D_Display (void)
 	if (automapactive)
 	    y = 4;
 	else
-	    y = viewwindowy+4;
-	V_DrawPatchDirect(viewwindowx+(scaledviewwidth-68)/2,
+	    y = V_UNSCALEY(viewwindowy)+4;
+	V_DrawPatchDirect(V_UNSCALEX(viewwindowx+scaledviewwidth/2)-34,
 			  y,0,W_CacheLumpName ("M_PAUSE", PU_CACHE));
     }
 
@@ -317,6 +463,13 @@ void D_Display (void)
     // menus go directly to the screen
     M_Drawer ();          // menu is drawn even on top of everything
 
+    // the status bar rows only change if ST_Drawer changed something,
+    //  the view or a menu covered them or the screen is wiping
+    sbarclean = gamestate == GS_LEVEL && gametic && !wipe
+		&& (viewheight != screenheight || automapactive)
+		&& !st_changed && !menuactive;
+    framestatic = !wipe && D_ScreenStatic ();
+
     // In library mode, skip NetUpdate: it would advance maketic ahead of
     // gametic, causing G_Ticker to read stale ticcmds that don't contain
     // the current frame's inputs.
@@ -331,14 +484,22 @@ void D_Display (void)
 	return;
     }
 
-    // In library mode, skip the wipe spin-wait entirely: it busy-loops on
-    // I_GetTime() and blocks the Kivy main thread for ~1 second per
-    // gamestate transition, which prevents button events from being processed
-    // and delays key_up past the point where G_BuildTiccmd can see the key.
+    // In library mode, don't spin here: the wait busy-loops on I_GetTime()
+    // and blocks the Kivy main thread for ~1 second per gamestate
+    // transition, which prevents button events from being processed and
+    // delays key_up past the point where G_BuildTiccmd can see the key.
+    // Start the melt and let the following frames carry it on.
     if (ubo_library_mode)
     {
-	// Just blit; the wipe visual is skipped.
-	I_FinishUpdate ();
+	if (!wipescreens)
+	{
+	    I_FinishUpdate ();
+	    return;
+	}
+	wipe_EndScreen(0, 0, SCREENWIDTH, SCREENHEIGHT);
+	wipelasttic = gametic - 1;
+	wipeactive = true;
+	D_WipeStep ();
 	return;
     }
 
@@ -347,6 +508,7 @@ void D_Display (void)
 
     wipestart = I_GetTime () - 1;
 
+    UBO_TRACE_BEGIN ("wipe");
     do
     {
 	do
@@ -361,6 +523,7 @@ void D_Display (void)
 	M_Drawer ();                            // menu is drawn even on top of wipes
 	I_FinishUpdate ();                      // page flip or blit buffer
     } while (!done);
+    UBO_TRACE_END ();
 }
 
 
@@ -850,12 +1013,31 @@ void FindResponseFile (void)
 //
 // D_DoomMain
 //
-void D_DoomMain (void)
+// UBO: in steps, so doom_init_step() can show progress and time each
+//  subsystem.  D_StartDoomMain reads the command line; D_ContinueDoomMain
+//  then runs the init phases one at a time until one has taken it past
+//  budget_us (0 = all at once) and returns true once the game is set up.
+//  initphaseus[] holds what each phase took, -1 until it has run.
+//
+static char*	initphasenames[NUMINITPHASES] =
+{
+    "V_Init", "M_LoadDefaults", "Z_Init", "W_Init", "M_Init", "R_InitData",
+    "R_Init", "P_Init", "I_Init", "D_CheckNetGame", "S_Init", "HU_Init",
+    "ST_Init", "start"
+};
+int		initphaseus[NUMINITPHASES];
+static int	initphase = -1;
+
+void D_StartDoomMain (void)
 {
     int             p;
     char                    file[256];
 
     FindResponseFile ();
+
+    // UBO: a melt cut short by doom_reset() held blocks of the old zone
+    wipeactive = false;
+    wipe_Abort ();
 	
     IdentifyVersion ();
 	
@@ -1063,169 +1245,261 @@ void D_DoomMain (void)
 	}
 	autostart = true;
     }
-    
-    // init subsystems
-    printf ("V_Init: allocate screens.\n");
-    V_Init ();
 
-    printf ("M_LoadDefaults: Load system defaults.\n");
-    M_LoadDefaults ();              // load before initing other systems
-
-    printf ("Z_Init: Init zone memory allocation daemon. \n");
-    Z_Init ();
+    for (p=0 ; p<NUMINITPHASES ; p++)
+	initphaseus[p] = -1;
+    initphase = 0;
+}
 
-    printf ("W_Init: Init WADfiles.\n");
-    W_InitMultipleFiles (wadfiles);
-    
+static void D_InitPhase (int phase)
+{
+    int             p;
+    char                    file[256];
 
-    // Check for -file in shareware
-    if (modifiedgame)
+    switch (phase)
     {
-	// These are the lumps that will be checked in IWAD,
-	// if any one is not present, execution will be aborted.
-	char name[23][8]=
+      case 0:
+	printf ("V_Init: allocate screens.\n");
+	V_Init ();
+	break;
+
+      case 1:
+	printf ("M_LoadDefaults: Load system defaults.\n");
+	M_LoadDefaults ();              // load before initing other systems
+	break;
+
+      case 2:
+	printf ("Z_Init: Init zone memory allocation daemon. \n");
+	Z_Init ();
+	break;
+
+      case 3:
+	printf ("W_Init: Init WADfiles.\n");
+	W_InitMultipleFiles (wadfiles);
+
+
+	// Check for -file in shareware
+	if (modifiedgame)
 	{
-	    "e2m1","e2m2","e2m3","e2m4","e2m5","e2m6","e2m7","e2m8","e2m9",
-	    "e3m1","e3m3","e3m3","e3m4","e3m5","e3m6","e3m7","e3m8","e3m9",
-	    "dphoof","bfgga0","heada1","cybra1","spida1d1"
-	};
-	int i;
-	
-	if ( gamemode == shareware)
-	    I_Error("\nYou cannot -file with the shareware "
-		    "version. Register!");
-
-	// Check for fake IWAD with right name,
-	// but w/o all the lumps of the registered version. 
-	if (gamemode == registered)
-	    for (i = 0;i < 23; i++)
-		if (W_CheckNumForName(name[i])<0)
-		    I_Error("\nThis is not the registered version.");
-    }
-    
-    // Iff additonal PWAD files are used, print modified banner
-    if (modifiedgame)
-    {
-	/*m*/printf (
-	    "===========================================================================\n"
-	    "ATTENTION:  This version of DOOM has been modified.  If you would like to\n"
-	    "get a copy of the original game, call 1-800-IDGAMES or see the readme file.\n"
-	    "        You will not receive technical support for modified games.\n"
-	    "                      press enter to continue\n"
-	    "===========================================================================\n"
+	    // These are the lumps that will be checked in IWAD,
+	    // if any one is not present, execution will be aborted.
+	    char name[23][8]=
+	    {
+		"e2m1","e2m2","e2m3","e2m4","e2m5","e2m6","e2m7","e2m8","e2m9",
+		"e3m1","e3m3","e3m3","e3m4","e3m5","e3m6","e3m7","e3m8","e3m9",
+		"dphoof","bfgga0","heada1","cybra1","spida1d1"
+	    };
+	    int i;
+
+	    if ( gamemode == shareware)
+		I_Error("\nYou cannot -file with the shareware "
+	    	    "version. Register!");
+
+	    // Check for fake IWAD with right name,
+	    // but w/o all the lumps of the registered version. 
+	    if (gamemode == registered)
+		for (i = 0;i < 23; i++)
+	    	if (W_CheckNumForName(name[i])<0)
+	    	    I_Error("\nThis is not the registered version.");
+	}
+
+	// Iff additonal PWAD files are used, print modified banner
+	if (modifiedgame)
+	{
+	    /*m*/printf (
+		"===========================================================================\n"
+		"ATTENTION:  This version of DOOM has been modified.  If you would like to\n"
+		"get a copy of the original game, call 1-800-IDGAMES or see the readme file.\n"
+		"        You will not receive technical support for modified games.\n"
+		"                      press enter to continue\n"
+		"===========================================================================\n"
+		);
+	    // UBO: no one at a console in library mode (doom_add_pwad);
+	    // waiting on stdin would hang doom_init()
+	}
+
+
+	// Check and print which version is executed.
+	switch ( gamemode )
+	{
+	  case shareware:
+	  case indetermined:
+	    printf (
+		"===========================================================================\n"
+		"                                Shareware!\n"
+		"===========================================================================\n"
 	    );
-	getchar ();
-    }
-	
+	    break;
+	  case registered:
+	  case retail:
+	  case commercial:
+	    printf (
+		"===========================================================================\n"
+		"                 Commercial product - do not distribute!\n"
+		"         Please report software piracy to the SPA: 1-800-388-PIR8\n"
+		"===========================================================================\n"
+	    );
+	    break;
 
-    // Check and print which version is executed.
-    switch ( gamemode )
-    {
-      case shareware:
-      case indetermined:
-	printf (
-	    "===========================================================================\n"
-	    "                                Shareware!\n"
-	    "===========================================================================\n"
-	);
+	  default:
+	    // Ouch.
+	    break;
+	}
 	break;
-      case registered:
-      case retail:
-      case commercial:
-	printf (
-	    "===========================================================================\n"
-	    "                 Commercial product - do not distribute!\n"
-	    "         Please report software piracy to the SPA: 1-800-388-PIR8\n"
-	    "===========================================================================\n"
-	);
+
+      case 4:
+	printf ("M_Init: Init miscellaneous info.\n");
+	M_Init ();
 	break;
-	
-      default:
-	// Ouch.
+
+      case 5:
+	// UBO: a phase of its own, as the texture and sprite tables are
+	//  most of R_Init and what the startup cache saves
+	printf ("R_Init: Init DOOM refresh daemon - ");
+	R_InitData ();
+	printf ("\nR_InitData");
 	break;
-    }
 
-    printf ("M_Init: Init miscellaneous info.\n");
-    M_Init ();
+      case 6:
+	R_Init ();
+	break;
 
-    printf ("R_Init: Init DOOM refresh daemon - ");
-    R_Init ();
+      case 7:
+	printf ("\nP_Init: Init Playloop state.\n");
+	P_Init ();
+	break;
 
-    printf ("\nP_Init: Init Playloop state.\n");
-    P_Init ();
+      case 8:
+	printf ("I_Init: Setting up machine state.\n");
+	I_Init ();
+	break;
 
-    printf ("I_Init: Setting up machine state.\n");
-    I_Init ();
+      case 9:
+	printf ("D_CheckNetGame: Checking network game status.\n");
+	D_CheckNetGame ();
+	break;
 
-    printf ("D_CheckNetGame: Checking network game status.\n");
-    D_CheckNetGame ();
+      case 10:
+	printf ("S_Init: Setting up sound.\n");
+	S_Init (snd_SfxVolume /* *8 */, snd_MusicVolume /* *8*/ );
+	break;
 
-    printf ("S_Init: Setting up sound.\n");
-    S_Init (snd_SfxVolume /* *8 */, snd_MusicVolume /* *8*/ );
+      case 11:
+	printf ("HU_Init: Setting up heads up display.\n");
+	HU_Init ();
+	break;
 
-    printf ("HU_Init: Setting up heads up display.\n");
-    HU_Init ();
+      case 12:
+	printf ("ST_Init: Init status bar.\n");
+	ST_Init ();
+	break;
 
-    printf ("ST_Init: Init status bar.\n");
-    ST_Init ();
+      case 13:
+	// check for a driver that wants intermission stats
+	p = M_CheckParm ("-statcopy");
+	if (p && p<myargc-1)
+	{
+	    // for statistics driver
+	    extern  void*	statcopy;                            
 
-    // check for a driver that wants intermission stats
-    p = M_CheckParm ("-statcopy");
-    if (p && p<myargc-1)
-    {
-	// for statistics driver
-	extern  void*	statcopy;                            
+	    statcopy = (void*)atoi(myargv[p+1]);
+	    printf ("External statistics registered.\n");
+	}
 
-	statcopy = (void*)atoi(myargv[p+1]);
-	printf ("External statistics registered.\n");
-    }
-    
-    // start the apropriate game based on parms
-    p = M_CheckParm ("-record");
+	// start the apropriate game based on parms
+	p = M_CheckParm ("-record");
 
-    if (p && p < myargc-1)
-    {
-	G_RecordDemo (myargv[p+1]);
-	autostart = true;
-    }
-	
-    p = M_CheckParm ("-playdemo");
-    if (p && p < myargc-1)
-    {
-	singledemo = true;              // quit after one demo
-	G_DeferedPlayDemo (myargv[p+1]);
-	if (ubo_library_mode) return;
-	D_DoomLoop ();  // never returns
-    }
-	
-    p = M_CheckParm ("-timedemo");
-    if (p && p < myargc-1)
-    {
-	G_TimeDemo (myargv[p+1]);
-	if (ubo_library_mode) return;
-	D_DoomLoop ();  // never returns
+	if (p && p < myargc-1)
+	{
+	    G_RecordDemo (myargv[p+1]);
+	    autostart = true;
+	}
+
+	p = M_CheckParm ("-playdemo");
+	if (p && p < myargc-1)
+	{
+	    singledemo = true;              // quit after one demo
+	    G_DeferedPlayDemo (myargv[p+1]);
+	    break;
+	}
+
+	p = M_CheckParm ("-timedemo");
+	if (p && p < myargc-1)
+	{
+	    G_TimeDemo (myargv[p+1]);
+	    break;
+	}
+
+	p = M_CheckParm ("-loadgame");
+	if (p && p < myargc-1)
+	{
+	    if (M_CheckParm("-cdrom"))
+		sprintf(file, "c:\\doomdata\\"SAVEGAMENAME"%c.dsg",myargv[p+1][0]);
+	    else
+		sprintf(file, SAVEGAMENAME"%c.dsg",myargv[p+1][0]);
+	    G_LoadGame (file);
+	}
+
+
+	if ( gameaction != ga_loadgame )
+	{
+	    if (autostart || netgame)
+		G_InitNew (startskill, startepisode, startmap);
+	    else
+		D_StartTitle ();                // start up intro loop
+
+	}
+	break;
     }
-	
-    p = M_CheckParm ("-loadgame");
-    if (p && p < myargc-1)
+}
+
+
+boolean D_ContinueDoomMain (int budget_us)
+{
+    struct timespec	start;
+    struct timespec	t0;
+    struct timespec	t1;
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    while (initphase >= 0 && initphase < NUMINITPHASES)
     {
-	if (M_CheckParm("-cdrom"))
-	    sprintf(file, "c:\\doomdata\\"SAVEGAMENAME"%c.dsg",myargv[p+1][0]);
-	else
-	    sprintf(file, SAVEGAMENAME"%c.dsg",myargv[p+1][0]);
-	G_LoadGame (file);
+	clock_gettime (CLOCK_MONOTONIC, &t0);
+	UBO_TRACE_BEGIN (initphasenames[initphase]);
+	D_InitPhase (initphase);
+	UBO_TRACE_END ();
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	initphaseus[initphase] = (t1.tv_sec - t0.tv_sec) * 1000000
+	    + (t1.tv_nsec - t0.tv_nsec) / 1000;
+	initphase++;
+	if (budget_us <= 0 || initphase == NUMINITPHASES)
+	    continue;
+	if ((t1.tv_sec - start.tv_sec) * 1000000
+	    + (t1.tv_nsec - start.tv_nsec) / 1000 >= budget_us)
+	    return false;
     }
-	
+    initphase = -1;
+    return true;
+}
 
-    if ( gameaction != ga_loadgame )
-    {
-	if (autostart || netgame)
-	    G_InitNew (startskill, startepisode, startmap);
-	else
-	    D_StartTitle ();                // start up intro loop
 
-    }
+int D_InitProgress (void)
+{
+    return initphase < 0 ? -1 : initphase * 100 / NUMINITPHASES;
+}
+
 
+char* D_InitPhaseName (int phase)
+{
+    if (phase < 0 || phase >= NUMINITPHASES)
+	return NULL;
+    return initphasenames[phase];
+}
+
+
+void D_DoomMain (void)
+{
+    D_StartDoomMain ();
+    D_ContinueDoomMain (0);
     if (ubo_library_mode) return;
     D_DoomLoop ();  // never returns
 }
@@ -48,6 +48,17 @@ void D_AddFile (char *file);
 //
 void D_DoomMain (void);
 
+// UBO: D_DoomMain in steps (doom_init_begin / doom_init_step).
+//  D_ContinueDoomMain runs init phases until one has taken it past
+//  budget_us (0 = all) and returns true when done; D_InitProgress is
+//  percent done, -1 with no init under way.
+#define NUMINITPHASES		14
+extern int	initphaseus[NUMINITPHASES];	// -1 until the phase has run
+void D_StartDoomMain (void);
+boolean D_ContinueDoomMain (int budget_us);
+int D_InitProgress (void);
+char* D_InitPhaseName (int phase);
+
 // Called by IO functions when input is detected.
 void D_PostEvent (event_t* ev);
 
@@ -61,4 +72,8 @@ void D_PageDrawer (void);
 void D_AdvanceDemo (void);
 void D_StartTitle (void);
 
+// UBO: the menu, pause or a title page is up and nothing on it moves
+// by itself; doom_run_async() drops to UBO_DOOM_IDLE_HZ.
+boolean D_Idle (void);
+
 #endif
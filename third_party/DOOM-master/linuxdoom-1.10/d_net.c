@@ -74,6 +74,13 @@ int		skiptics;
 int		ticdup;		
 int		maxsend;	// BACKUPTICS/(2*ticdup)-1
 
+// Library mode: seconds D_ArbitrateNetStart waits for the other
+// nodes before doom_init gives up (there is no ESC to press).
+int		netstarttimeout = 30;
+static int	netstartdeadline;
+
+extern int	ubo_library_mode;	// set by doom_api when embedded
+
 
 void D_ProcessEvents (void); 
 void G_BuildTiccmd (ticcmd_t *cmd); 
@@ -365,14 +372,56 @@ void GetPackets (void)
 //
 int      gametime;
 
+//
+// NetSendTics
+// Sends every node the local tics it has not acknowledged yet.
+//
+void NetSendTics (void)
+{
+    int				i,j;
+    int				realstart;
+
+    netbuffer->player = consoleplayer;
+    for (i=0 ; i<doomcom->numnodes ; i++)
+	if (nodeingame[i])
+	{
+	    netbuffer->starttic = realstart = resendto[i];
+	    netbuffer->numtics = maketic - realstart;
+	    if (netbuffer->numtics > BACKUPTICS)
+		I_Error ("NetUpdate: netbuffer->numtics > BACKUPTICS");
+
+	    resendto[i] = maketic - doomcom->extratics;
+
+	    for (j=0 ; j< netbuffer->numtics ; j++)
+		netbuffer->cmds[j] = 
+		    localcmds[(realstart+j)%BACKUPTICS];
+					
+	    if (remoteresend[i])
+	    {
+		netbuffer->retransmitfrom = nettics[i];
+		HSendPacket (i, NCMD_RETRANSMIT);
+	    }
+	    else
+	    {
+		netbuffer->retransmitfrom = 0;
+		HSendPacket (i, 0);
+	    }
+	}
+    I_FlushNetwork ();
+}
+
 void NetUpdate (void)
 {
     int             nowtime;
     int             newtics;
-    int				i,j;
-    int				realstart;
+    int				i;
     int				gameticdiv;
     
+    // In a library mode netgame doom_tick makes the commands and sends
+    // them (D_NetTryTics); calls from the renderer only read packets.
+    if (ubo_library_mode && netgame)
+	goto listen;
+
     // check time
     nowtime = I_GetTime ()/ticdup;
     newtics = nowtime - gametime;
@@ -414,31 +463,7 @@ void NetUpdate (void)
 	return;         // singletic update is syncronous
     
     // send the packet to the other nodes
-    for (i=0 ; i<doomcom->numnodes ; i++)
-	if (nodeingame[i])
-	{
-	    netbuffer->starttic = realstart = resendto[i];
-	    netbuffer->numtics = maketic - realstart;
-	    if (netbuffer->numtics > BACKUPTICS)
-		I_Error ("NetUpdate: netbuffer->numtics > BACKUPTICS");
-
-	    resendto[i] = maketic - doomcom->extratics;
-
-	    for (j=0 ; j< netbuffer->numtics ; j++)
-		netbuffer->cmds[j] = 
-		    localcmds[(realstart+j)%BACKUPTICS];
-					
-	    if (remoteresend[i])
-	    {
-		netbuffer->retransmitfrom = nettics[i];
-		HSendPacket (i, NCMD_RETRANSMIT);
-	    }
-	    else
-	    {
-		netbuffer->retransmitfrom = 0;
-		HSendPacket (i, 0);
-	    }
-	}
+    NetSendTics ();
     
     // listen for other packets
   listen:
@@ -455,6 +480,15 @@ void CheckAbort (void)
     event_t *ev;
     int		stoptic;
 	
+    if (ubo_library_mode)
+    {
+	// doom_init runs on the host's thread: nap instead of spinning
+	if (I_GetTime () > netstartdeadline)
+	    I_Error ("Network game synchronization timed out.");
+	I_WaitVBL (4);
+	return;
+    }
+
     stoptic = I_GetTime () + 2; 
     while (I_GetTime() < stoptic) 
 	I_StartTic (); 
@@ -480,6 +514,7 @@ void D_ArbitrateNetStart (void)
 	
     autostart = true;
     memset (gotinfo,0,sizeof(gotinfo));
+    netstartdeadline = I_GetTime () + netstarttimeout*TICRATE;
 	
     if (doomcom->consoleplayer)
     {
@@ -617,12 +652,73 @@ void D_QuitNetGame (void)
 	for (j=1 ; j<doomcom->numnodes ; j++)
 	    if (nodeingame[j])
 		HSendPacket (j, NCMD_EXIT);
+	I_FlushNetwork ();
 	I_WaitVBL (1);
     }
 }
 
 
 
+//
+// D_NetLocalCmd
+// Library mode: where this tic's console player command goes, or NULL
+// when this node should not make one.  That is when its backup is
+// full, or when it is more than NETLEAD tics ahead of the slowest
+// other node (it started first, or its clock runs fast), so it does
+// not carry a permanent lag in front of everyone else's commands.
+//
+#define NETLEAD		3
+
+ticcmd_t* D_NetLocalCmd (void)
+{
+    int		i;
+    int		lowtic;
+
+    if (maketic - gametic/ticdup >= BACKUPTICS/2-1)
+	return NULL;
+
+    lowtic = MAXINT;
+    for (i=1 ; i<doomcom->numnodes ; i++)
+	if (nodeingame[i] && nettics[i] < lowtic)
+	    lowtic = nettics[i];
+    if (lowtic != MAXINT && maketic - lowtic > NETLEAD)
+	return NULL;
+
+    return &localcmds[maketic%BACKUPTICS];
+}
+
+
+//
+// D_NetTryTics
+// Library mode replacement for TryRunTics, called once per doom_tick
+// after D_NetLocalCmd's command (if any) went into localcmds: sends it,
+// reads what arrived and returns how many game tics every node has sent
+// commands for, at most two so a node that fell behind catches up
+// without a stall.  It never waits; 0 means the others are late.
+//
+int D_NetTryTics (void)
+{
+    int		i;
+    int		lowtic;
+    int		counts;
+
+    NetSendTics ();
+    GetPackets ();
+
+    lowtic = MAXINT;
+    for (i=0 ; i<doomcom->numnodes ; i++)
+	if (nodeingame[i] && nettics[i] < lowtic)
+	    lowtic = nettics[i];
+
+    counts = lowtic - gametic/ticdup;
+    if (counts > 2)
+	counts = 2;
+    if (counts < 0)
+	counts = 0;
+    return counts;
+}
+
+
 //
 // TryRunTics
 //
@@ -138,6 +138,13 @@ void D_QuitNetGame (void);
 //? how many ticks to run?
 void TryRunTics (void);
 
+// Library mode netgame: slot for this tic's local command (NULL = skip
+// it), then send, listen and return how many tics can run now.
+ticcmd_t* D_NetLocalCmd (void);
+int D_NetTryTics (void);
+
+extern int netstarttimeout;
+
 
 #endif
 
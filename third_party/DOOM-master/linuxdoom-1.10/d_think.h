@@ -61,12 +61,18 @@ typedef actionf_t  think_t;
 
 
 // Doubly linked list of actors.
+// UBO: rprev/rnext are the run list P_RunThinkers walks: the same
+//  order, less the mobjs parked while they have nothing to do (rnext
+//  NULL, see p_tick.c).  Savegames hold the vanilla three words.
 typedef struct thinker_s
 {
     struct thinker_s*	prev;
     struct thinker_s*	next;
     think_t		function;
     
+    struct thinker_s*	rprev;
+    struct thinker_s*	rnext;
+
 } thinker_t;
 
 
@@ -7,18 +7,50 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <execinfo.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "doomdef.h"
 #include "doomstat.h"
 #include "d_event.h"
 #include "doomkeys.h"
 #include "d_main.h"
+#include "am_map.h"
 #include "d_net.h"
 #include "m_argv.h"
+#include "m_misc.h"
+#include "m_random.h"
+#include "p_saveg.h"
+#include "p_mobj.h"
+#include "p_tick.h"
 #include "i_system.h"
+#include "i_governor.h"
+#include "i_log.h"
+#include "i_memory.h"
+#include "i_spectate.h"
+#include "i_thread.h"
+#include "i_trace.h"
+#include "i_net.h"
 #include "i_sound.h"
 #include "i_video.h"
 #include "s_sound.h"
+#include "d_items.h"
+#include "g_game.h"
+#include "p_setup.h"
+#include "w_wad.h"
+#include "r_data.h"
+#include "r_things.h"
+#include "r_draw.h"
+#include "r_main.h"
+#include "r_segs.h"
+#include "v_video.h"
+#include "z_zone.h"
 
 // D_DoomLoop checks advancedemo each iteration; since we drive ticks manually
 // we need to mirror that check ourselves.
@@ -38,6 +70,33 @@ void G_Ticker(void);
 void M_Ticker(void);
 void D_Display(void);
 
+// Pool peaks kept by r_plane.c, r_bsp.c, r_things.c, p_maputl.c, p_map.c.
+extern int visplanepeak;
+extern int drawsegpeak;
+extern int visspritepeak;
+extern int interceptpeak;
+extern int spechitpeak;
+
+// p_sight.c: reuse P_CheckSight results until something moves, and trace
+// the tic's likely checks on sightthreads threads first.
+extern int sightcache;
+extern int sightthreads;
+void P_ShutdownSightThreads(void);
+
+// p_setup.c: map lump conversion shared with loadthreads-1 workers.
+extern int loadthreads;
+void P_ShutdownLoadThreads(void);
+// ...and maps their derived data (blockmap, sector lines, REJECT) from levelcache.
+extern char* levelcache;
+void P_FreeLevelCache(void);
+
+// p_tick.c (p_local.h clashes with unistd.h).
+void P_InitThinkers(void);
+
+// p_map.c: P_ChangeSector only re-clips things that reach the moving sector.
+extern int sectorclip;
+extern int wipescreens;
+
 // Input state exported by g_game.c.
 extern boolean gamekeydown[256];
 extern int key_up;
@@ -45,32 +104,158 @@ extern int key_down;
 
 int ubo_library_mode = 0;
 
+// Set while doom_prewarm() runs D_DoomMain: I_Init leaves the sound device shut.
+int ubo_prewarming = 0;
+
 // Jump buffer used by I_Error in library mode to avoid calling exit().
 jmp_buf ubo_error_jmp;
 int ubo_error_jmp_valid = 0;
 
-// Filled by i_video_ubo.c via extern.
-uint8_t ubo_rgba[320 * 200 * 4];
+// Filled by i_video_ubo.c via extern.  Aligned for the vector stores.
+uint8_t ubo_rgba[320 * 200 * 4] __attribute__((aligned(16)));
+uint8_t ubo_index8[320 * 200] __attribute__((aligned(16)));
+
+int ubo_video_simd = 1;
+int ubo_video_sbarcache = 1;
+int ubo_video_bordercache = 1;
+int ubo_video_skipstatic = 1;
+int ubo_sfx_prefetch = 1;
+
+// RGB565 frame ring (triple buffer).  Ownership of the three slots is split
+// between the engine (g_frame_back), the consumer (g_frame_front) and the
+// shared hand-over slot (g_frame_mid).  Slots only change owner through an
+// atomic exchange of g_frame_mid, so neither side ever waits on the other;
+// UBO_FRAME_FRESH marks a hand-over slot the consumer has not picked up yet.
+#define UBO_FRAME_PIXELS (UBO_LCD_WIDTH * UBO_LCD_HEIGHT)
+#define UBO_FRAME_FRESH  0x4
+
+static uint16_t g_frame_ring[UBO_FRAME_RING][UBO_FRAME_PIXELS];
+static uint32_t g_frame_ring_seq[UBO_FRAME_RING];
+// Static regions of each slot (status bar, view border bands): their LCD
+// rows and a generation that only moves when the region's pixels change
+// (0 = not tracked).
+static int g_frame_ring_static_y0[UBO_FRAME_RING][UBO_STATIC_REGIONS];
+static int g_frame_ring_static_y1[UBO_FRAME_RING][UBO_STATIC_REGIONS];
+static uint32_t g_frame_ring_static[UBO_FRAME_RING][UBO_STATIC_REGIONS];
+static uint32_t g_frame_static_gen[UBO_STATIC_REGIONS];
+static int g_frame_ring_layout[UBO_FRAME_RING];   // orientation each slot was drawn with
+static int g_frame_back = 0;               // engine-owned
+static int g_frame_front = 1;              // consumer-owned
+static atomic_int g_frame_mid = 2;         // slot index | UBO_FRAME_FRESH
+static atomic_uint g_frame_seq = 0;
+static int g_frame_held = 0;
+static uint32_t g_frame_acquired_seq = 0;
+static atomic_int g_frame_wanted = 0;     // set by doom_invalidate_dirty()
+
+static ubo_output_format_t g_output_format = UBO_OUTPUT_RGBA8888;
+static ubo_scale_filter_t g_scale_filter = UBO_SCALE_NEAREST;
+static int g_lcd_orientation = UBO_ROTATE_0;   // rotation | mirror << 2
+
+// Last RGB565 frame a consumer of dirty rects was given, and the static
+// region generations in it.
+typedef struct ubo_dirty_ref_s {
+    uint16_t prev[UBO_LCD_WIDTH * UBO_LCD_HEIGHT];
+    int valid;
+    uint32_t gen[UBO_STATIC_REGIONS];
+} ubo_dirty_ref_t;
+
+static ubo_dirty_ref_t g_dirty_lcd;        // doom_get_dirty_rects()'s
+static ubo_dirty_ref_t g_dirty_cb;         // the frame callback's
+
+// doom_set_frame_callback(); g_frame_cb_lock is held while it runs, so
+// clearing it waits for a call in flight.
+#define UBO_FRAME_CB_RECTS 16
+static pthread_mutex_t g_frame_cb_lock = PTHREAD_MUTEX_INITIALIZER;
+static ubo_frame_callback_t g_frame_cb = NULL;
+static void* g_frame_cb_user = NULL;
+static ubo_rect_t g_frame_cb_rects[UBO_FRAME_CB_RECTS];
+static uint32_t g_frame_shown = 0;         // the RGBA frames' seq
+static int g_frame_published = 0;          // slot of the last ubo_frame_publish()
+
+// Dirty bands separated by fewer clean rows than this are sent as one
+// rectangle; each render_block costs a window-address command on the ST7789.
+#define UBO_DIRTY_MERGE_GAP 8
+
+static int g_inited = 0;  // 0=not started, 1=ok, -1=failed, 2=doom_init_begin() ran
+// Loaded by doom_prewarm(); sound, frame shm and capture wait for doom_init().
+static int g_prewarmed = 0;
+// The init under way is doom_prewarm()'s.
+static int g_init_prewarm = 0;
+// doom_prewarm() runs on a background thread while the app may call doom_init().
+static pthread_mutex_t g_init_lock = PTHREAD_MUTEX_INITIALIZER;
+// Between doom_suspend() and doom_resume(): caches dropped, sound device closed.
+static int g_suspended = 0;
+
+static void doom_resume_locked(void);
 
-static int g_inited = 0;  // 0=not started, 1=ok, -1=failed
+// doom_set_zone_limits(); -1 = take UBO_DOOM_ZONE_MB / UBO_DOOM_ZONE_MAX_MB.
+static int g_zone_base_mb = -1;
+static int g_zone_max_mb = -1;
+// doom_set_memory_budget(); -1 = take UBO_DOOM_MEMORY_MB.
+static int g_memory_mb = -1;
 
 // Signal-based crash catch — catches SIGSEGV/SIGBUS during doom_init so that
 // a crash in R_Init* (or anywhere else in D_DoomMain) is converted to a clean
 // -1 return rather than killing the host process (ubo_app).
 static sigjmp_buf g_crash_jmp;
 static volatile sig_atomic_t g_crash_jmp_valid = 0;
+// Thread that armed g_crash_jmp.  With doom_run_async() the engine runs on its
+// own pthread, and a jump buffer must only be used by the thread that set it.
+static pthread_t g_crash_thread;
+
+static volatile sig_atomic_t g_crash_sig = 0;
+
+// Where the last crash happened, for ubo_status_t (crash_*).
+static int g_crash_cause = 0;       // signal number, -1 = I_Error, 0 = none
+static int g_crash_gametic;
+static int g_crash_gamestate;
+static int g_crash_episode;
+static int g_crash_map;
+static uint32_t g_crash_count;
+static uint32_t g_reset_count;
+
+static void doom_arm_crash_jmp(void)
+{
+    g_crash_thread = pthread_self();
+    g_crash_jmp_valid = 1;
+}
+
+// The tick arms g_crash_jmp with sigsetjmp(..., 0), which makes no
+// sigprocmask call; the handler runs with its signal blocked, so the
+// recovery branch unblocks SIGSEGV/SIGBUS itself after the jump out.
+static void doom_unblock_crash_signals(void)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGSEGV);
+    sigaddset(&set, SIGBUS);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+}
+
+static void doom_note_crash(int cause)
+{
+    g_crash_cause = cause;
+    g_crash_count++;
+    g_crash_gametic = gametic;
+    g_crash_gamestate = gamestate;
+    g_crash_episode = gameepisode;
+    g_crash_map = gamemap;
+}
 
 static void doom_crash_handler(int sig)
 {
     // Print a backtrace before longjmping — this is async-signal-safe enough
     // for debugging purposes (backtrace/backtrace_symbols_fd use no malloc).
+    // Lines still in the log ring go out first, so they come before it.
     void *bt[32];
     int n = backtrace(bt, 32);
+    I_LogFlush();
     fprintf(stderr, "[doom] SIGNAL %d — backtrace (%d frames):\n", sig, n);
     backtrace_symbols_fd(bt, n, 2);  // fd 2 = stderr
     fflush(stderr);
-    (void)sig;
-    if (g_crash_jmp_valid) {
+    g_crash_sig = sig;
+    if (g_crash_jmp_valid && pthread_equal(pthread_self(), g_crash_thread)) {
         g_crash_jmp_valid = 0;
         siglongjmp(g_crash_jmp, 1);
     }
@@ -79,274 +264,2991 @@ static void doom_crash_handler(int sig)
     raise(sig);
 }
 
-// Keep argv storage alive for the lifetime of the process.
-static char* g_argv[16];
+// Keep argv storage alive until the next doom_init() builds it again
+// (M_CheckParm reads it during play); g_argv_copies owns the strdup'd words.
+static char* g_argv[64];
 static int g_argc = 0;
 static char g_prog[] = "ubodoom";
+static char* g_argv_copies[4];
 
-static int map_ubo_key(ubo_key_t key)
+// doom_add_pwad's list, handed to the next doom_init() as -file words;
+// with the IWAD and a demo lump this stays within MAXWADFILES.
+#define UBO_MAX_PWADS 16
+static char* g_pwads[UBO_MAX_PWADS];
+static int g_num_pwads = 0;
+
+// Input from the host goes through a lock-free bounded MPSC ring
+// (producers: any host thread, e.g. the keypad callback and the UI thread;
+// consumer: whichever thread runs the tic) because D_PostEvent's own
+// events[] ring is not safe across threads.  A producer claims the slot at
+// `head` with a CAS, fills it and publishes it through the slot's turn
+// counter: on the pass over the ring starting at index b it is b while the
+// slot is free and b + 1 once filled, and the consumer frees it for the next
+// pass.  Counters wrap cleanly since the ring size divides 2^32.  Every
+// event is stamped with the CLOCK_MONOTONIC time it was posted, so the tic
+// can report how long input waited for it.
+#define UBO_INPUT_QUEUE 64   // power of two
+
+typedef struct ubo_input_slot_s {
+    atomic_uint turn;
+    ubo_event_t ev;
+    uint64_t posted_us;
+} ubo_input_slot_t;
+
+static ubo_input_slot_t g_input_q[UBO_INPUT_QUEUE];
+static atomic_uint g_input_head = 0;   // next slot to claim, producers
+static unsigned g_input_tail = 0;      // next slot to take, consumer only
+static atomic_int g_input_pending = 0; // posted and not yet taken
+static uint32_t g_input_lag_us = 0;    // posted-to-sampled wait of the newest one taken
+static uint64_t g_input_taken_us = 0;  // I_GetTimeUs() the tic thread last took one at
+static atomic_int g_idle_sleeping = 0; // doom_idle_wait() is in FUTEX_WAIT on g_input_pending
+
+#define UBO_INPUT_TURN(i) ((i) & ~(unsigned)(UBO_INPUT_QUEUE - 1))
+
+static uint64_t ubo_now_us(void)
 {
-    switch (key)
-    {
-        case UBO_KEY_UP: return KEY_UPARROW;
-        case UBO_KEY_DOWN: return KEY_DOWNARROW;
-        case UBO_KEY_LEFT: return KEY_LEFTARROW;
-        case UBO_KEY_RIGHT: return KEY_RIGHTARROW;
-        case UBO_KEY_FIRE: return KEY_RCTRL;
-        case UBO_KEY_USE: return ' ';
-        case UBO_KEY_ESCAPE: return KEY_ESCAPE;
-        case UBO_KEY_MENU_SELECT: return KEY_ENTER;
-        default: return 0;
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)(ts.tv_nsec / 1000);
 }
 
-int doom_init(const char* iwad_path)
+// Returns 1 if queued, 0 if the ring was full.
+static int ubo_input_push(const ubo_event_t* ev)
 {
-    const char* launch_cwd;
-    const char* config_path;
-
-    if (g_inited == 1) return 0;
-    if (g_inited == -1) return -1;  /* previous init failed; DOOM globals are dirty */
-    if (!iwad_path) return -1;
-
-    ubo_library_mode = 1;
+    unsigned head = atomic_load_explicit(&g_input_head, memory_order_relaxed);
+    ubo_input_slot_t* slot;
 
-    launch_cwd = getenv("UBO_DOOM_CWD");
-    config_path = getenv("UBO_DOOM_CONFIG");
+    for (;;) {
+        unsigned turn;
 
-    if (launch_cwd && launch_cwd[0] != '\0') {
-        if (chdir(launch_cwd) != 0) {
-            fprintf(stderr, "[doom] failed to chdir to UBO_DOOM_CWD=%s\n", launch_cwd);
-            g_inited = -1;
-            return -1;
+        slot = &g_input_q[head & (UBO_INPUT_QUEUE - 1)];
+        turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+        if (turn == UBO_INPUT_TURN(head)) {
+            if (atomic_compare_exchange_weak_explicit(&g_input_head, &head, head + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if ((int)(turn - UBO_INPUT_TURN(head)) < 0) {
+            UBO_LOG(UBO_LOG_INFO, "[doom] input queue full, event dropped\n");
+            return 0;
+        } else {
+            head = atomic_load_explicit(&g_input_head, memory_order_relaxed);
         }
     }
+    slot->ev = *ev;
+    slot->posted_us = ubo_now_us();
+    atomic_store_explicit(&slot->turn, UBO_INPUT_TURN(head) + 1, memory_order_release);
+    atomic_fetch_add(&g_input_pending, 1);
+    if (atomic_load(&g_idle_sleeping))
+        syscall(SYS_futex, &g_input_pending, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    return 1;
+}
 
-    // Build a minimal argv: [ubodoom, -iwad, <path>]
-    // Zone heap size is controlled by mb_used in m_misc.c defaults (set to 32 MB).
-    g_argc = 0;
-    g_argv[g_argc++] = g_prog;
-    g_argv[g_argc++] = (char*)"-iwad";
-    g_argv[g_argc++] = strdup(iwad_path);
-    if (config_path && config_path[0] != '\0') {
-        g_argv[g_argc++] = (char*)"-config";
-        g_argv[g_argc++] = strdup(config_path);
-    }
+// Consumer: the next filled slot, or NULL.  Release it with ubo_input_pop().
+static const ubo_input_slot_t* ubo_input_peek(void)
+{
+    ubo_input_slot_t* slot = &g_input_q[g_input_tail & (UBO_INPUT_QUEUE - 1)];
 
-    myargc = g_argc;
-    myargv = g_argv;
+    if (atomic_load_explicit(&slot->turn, memory_order_acquire) != UBO_INPUT_TURN(g_input_tail) + 1)
+        return NULL;
+    return slot;
+}
 
-    // Install crash handlers for SIGSEGV and SIGBUS so that a crash inside
-    // D_DoomMain (e.g. in R_GenerateLookup with a bad WAD texture) is caught
-    // and returned as -1 instead of killing the host process.
-    struct sigaction sa, sa_old_segv, sa_old_bus;
-    sa.sa_handler = doom_crash_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESETHAND;  // auto-restore default after first delivery
-    sigaction(SIGSEGV, &sa, &sa_old_segv);
-    sigaction(SIGBUS,  &sa, &sa_old_bus);
+static void ubo_input_pop(void)
+{
+    ubo_input_slot_t* slot = &g_input_q[g_input_tail & (UBO_INPUT_QUEUE - 1)];
 
-    g_crash_jmp_valid = 1;
-    if (sigsetjmp(g_crash_jmp, 1) != 0) {
-        // SIGSEGV or SIGBUS during init — restore handlers and abort cleanly.
-        g_crash_jmp_valid = 0;
-        ubo_error_jmp_valid = 0;
-        sigaction(SIGSEGV, &sa_old_segv, NULL);
-        sigaction(SIGBUS,  &sa_old_bus,  NULL);
-        g_inited = -1;
-        fprintf(stderr, "[doom] doom_init aborted via signal (SIGSEGV/SIGBUS)\n");
-        return -1;
-    }
+    atomic_store_explicit(&slot->turn, UBO_INPUT_TURN(g_input_tail) + UBO_INPUT_QUEUE, memory_order_release);
+    g_input_tail++;
+    atomic_fetch_sub_explicit(&g_input_pending, 1, memory_order_relaxed);
+}
 
-    // Catch I_Error calls (which would otherwise call exit()) via longjmp.
-    ubo_error_jmp_valid = 1;
-    if (setjmp(ubo_error_jmp) != 0) {
-        // I_Error fired during init — abort cleanly without killing the process.
-        g_crash_jmp_valid = 0;
-        ubo_error_jmp_valid = 0;
-        sigaction(SIGSEGV, &sa_old_segv, NULL);
-        sigaction(SIGBUS,  &sa_old_bus,  NULL);
-        g_inited = -1;
-        fprintf(stderr, "[doom] doom_init aborted via I_Error longjmp\n");
-        return -1;
-    }
+// Idle mode (UBO_DOOM_IDLE_HZ, 0 = off): while D_Idle() holds and no input
+// came for UBO_IDLE_GRACE_US, doom_run_async() wakes at about g_idle_hz and
+// runs the tics due since in one go, drawing only the last.  Stepping
+// through the menu stays at the full rate until the grace runs out.
+static int g_idle_hz = 10;
+#define UBO_IDLE_GRACE_US 1000000u
 
-    // D_DoomMain will call I_Init(), initialize sound/video, and then return (because ubo_library_mode=1).
-    D_DoomMain();
+static int ubo_idle(void)
+{
+    return g_idle_hz > 0 && g_inited == 1 && D_Idle ()
+        && (uint64_t)I_GetTimeUs() - g_input_taken_us >= UBO_IDLE_GRACE_US;
+}
 
-    // In the original program, I_InitGraphics() is called at the start of D_DoomLoop().
-    // Our i_video_ubo backend doesn't need it, but keeping the call preserves expected init sequencing.
-    I_InitGraphics();
+// Per-key hold state, owned by the tic thread:
+//   > 0  auto-release countdown in tics (from ubo_event_t.hold_tics)
+//   -1   explicitly held until a matching key-up
+//    0   not held
+#define UBO_HOLD_EXPLICIT -1
+#define UBO_KEY_SLOTS 16
 
-    g_crash_jmp_valid = 0;
-    ubo_error_jmp_valid = 0;
-    sigaction(SIGSEGV, &sa_old_segv, NULL);
-    sigaction(SIGBUS,  &sa_old_bus,  NULL);
-    g_inited = 1;
+static int g_key_hold[UBO_KEY_SLOTS];
 
-    // Re-install the crash handler permanently (without SA_RESETHAND) so that
-    // SIGSEGV/SIGBUS during doom_tick are also caught instead of killing ubo_app.
-    sa.sa_flags = 0;  // persistent, not one-shot
-    sigaction(SIGSEGV, &sa, NULL);
-    sigaction(SIGBUS,  &sa, NULL);
+// Native tick scheduler (doom_run_async).  State changes are reported back
+// through a second SPSC ring (producer: scheduler thread, consumer: host).
+#define UBO_STATE_QUEUE 32   // power of two
 
-    // In library mode we drive ticks manually (singletics path), so set the
-    // singletics flag.  This makes every NetUpdate() call in the engine
-    // (r_main.c, d_main.c, d_net.c) return immediately, preventing the
-    // "netbuffer->numtics > BACKUPTICS" I_Error after ~12 rendered frames.
-    extern boolean singletics;
-    singletics = true;
+static ubo_state_event_t g_state_q[UBO_STATE_QUEUE];
+static atomic_uint g_state_head = 0;
+static atomic_uint g_state_tail = 0;
+static ubo_state_event_t g_state_last;
+static int g_state_last_valid = 0;
 
-    // Force key bindings to known-good values after M_LoadDefaults has run
-    // (as part of D_DoomMain above).  This overrides any stale/zeroed entries
-    // in ~/.doomrc such as key_right=0 and key_left=0 which would break turning.
-    // Also locks key_fire to KEY_RCTRL — KEY_ENTER is stolen by HU_MSGREFRESH
-    // (hu_stuff.h) and would be eaten before reaching G_Responder.
-    extern int key_fire, key_right, key_left, key_up, key_down, key_speed;
-    key_fire  = KEY_RCTRL;
-    key_right = KEY_RIGHTARROW;
-    key_left  = KEY_LEFTARROW;
-    key_up    = KEY_UPARROW;
-    key_down  = KEY_DOWNARROW;
-    // Disable run modifier: the UBO controller has no shift key.
-    // Setting key_speed=0 means gamekeydown[0] is checked; key 0 is never
-    // sent by doom_key_down(), so speed is always 0 (walk, forwardmove[0]=25).
-    key_speed = 0;
+// doom_advance() catch-up (UBO_DOOM_CATCHUP, doom_set_catchup): a call runs
+// at most g_catchup_tics tics, and the accumulator keeps up to
+// g_catchup_backlog more tics of wall time owed for the calls after it.
+// Time beyond that is dropped rather than fast-forwarded.
+static int g_catchup_tics = UBO_ADVANCE_MAX_TICS;
+static int g_catchup_backlog = TICRATE;
+static uint64_t g_advance_us = 0;       // wall time not turned into tics yet
+static uint32_t g_catchup_dropped = 0;  // tics dropped since the library was loaded
+static int g_advance_loaded = 0;        // a tic loaded a level: its wait is not owed
 
-    return 0;
+// Live status snapshot (doom_get_status_ptr), written only by the tic thread.
+static ubo_status_t g_status;
+
+static uint32_t ubo_span_us(const struct timespec* t0, const struct timespec* t1)
+{
+    return (uint32_t)((t1->tv_sec - t0->tv_sec) * 1000000L + (t1->tv_nsec - t0->tv_nsec) / 1000);
 }
 
-void doom_tick(void)
+static uint32_t ubo_elapsed_us(const struct timespec* t0)
 {
-    if (g_inited != 1) return;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return ubo_span_us(t0, &t1);
+}
 
-    // Arm the crash jump so SIGSEGV/SIGBUS and I_Error during the tick are
-    // caught here rather than killing the host process (ubo_app).
-    ubo_error_jmp_valid = 1;
-    g_crash_jmp_valid = 1;
+// Deadline tracking (ubo_status_t deadline_* and worst_*), tic thread only.
+// doom_async_main() sets g_tic_due_ns around each tic it runs; 0 means the
+// host drives the tics and the deadline is one tic after the tic started.
+typedef struct ubo_deadline_s {
+    uint32_t tics;
+    uint32_t misses;
+    uint32_t tic_us;
+    uint32_t sim_us;
+    uint32_t render_us;
+    uint32_t sound_us;
+    uint32_t gametic;
+    int gamestate;
+    int episode;
+    int map;
+} ubo_deadline_t;
 
-    if (sigsetjmp(g_crash_jmp, 1) != 0) {
-        // SIGSEGV or SIGBUS mid-tick.
-        g_crash_jmp_valid = 0;
-        ubo_error_jmp_valid = 0;
-        g_inited = -1;
-        fprintf(stderr, "[doom] doom_tick aborted via signal (SIGSEGV/SIGBUS)\n");
+static ubo_deadline_t g_deadline;
+static int64_t g_tic_due_ns = 0;
+static atomic_int g_deadline_want_reset = 0;
+
+static int64_t ubo_ts_ns(const struct timespec* ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+// t0 .. sim .. render .. end: the tic's phases as doom_run_tic() ran them.
+static void ubo_deadline_tic(const struct timespec* t0, const struct timespec* sim,
+                             const struct timespec* render, const struct timespec* end)
+{
+    int64_t due_ns = g_tic_due_ns ? g_tic_due_ns : ubo_ts_ns(t0) + 1000000000LL / TICRATE;
+    uint32_t tic_us = ubo_span_us(t0, end);
+
+    if (atomic_exchange(&g_deadline_want_reset, 0))
+        memset(&g_deadline, 0, sizeof(g_deadline));
+    g_deadline.tics++;
+    if (ubo_ts_ns(end) > due_ns) {
+        g_deadline.misses++;
+        UBO_LOG(UBO_LOG_DEBUG, "[doom] tic %d missed its deadline by %lld us "
+                "(sim %u, render %u, sound %u us)\n", gametic,
+                (long long)(ubo_ts_ns(end) - due_ns) / 1000, ubo_span_us(t0, sim),
+                ubo_span_us(sim, render), ubo_span_us(render, end));
+    }
+    if (tic_us <= g_deadline.tic_us)
         return;
+    g_deadline.tic_us = tic_us;
+    g_deadline.sim_us = ubo_span_us(t0, sim);
+    g_deadline.render_us = ubo_span_us(sim, render);
+    g_deadline.sound_us = ubo_span_us(render, end);
+    g_deadline.gametic = (uint32_t)gametic;
+    g_deadline.gamestate = (int)gamestate;
+    g_deadline.episode = gamestate == GS_LEVEL ? gameepisode : 0;
+    g_deadline.map = gamestate == GS_LEVEL ? gamemap : 0;
+}
+
+static void ubo_status_update(uint32_t tic_us)
+{
+    volatile ubo_status_t* st = &g_status;
+    player_t* p = &players[consoleplayer];
+    ubo_audio_stats_t audio;
+    zonestats_t zone;
+    int alive = g_inited == 1;
+    int in_level = alive && gamestate == GS_LEVEL && p->mo;
+
+    st->version++;
+    atomic_thread_fence(memory_order_release);
+
+    st->alive = alive;
+    st->gamestate = alive ? (int)gamestate : -1;
+    st->menuactive = alive && menuactive ? 1 : 0;
+    st->paused = alive && paused ? 1 : 0;
+    st->automapactive = alive && automapactive ? 1 : 0;
+    st->gametic = (uint32_t)gametic;
+    st->frame_seq = doom_get_frame_seq();
+    st->health = in_level ? p->health : 0;
+    st->armor = in_level ? p->armorpoints : 0;
+    st->ready_weapon = in_level ? (int)p->readyweapon : 0;
+    if (in_level && weaponinfo[p->readyweapon].ammo != am_noammo)
+        st->ready_ammo = p->ammo[weaponinfo[p->readyweapon].ammo];
+    else
+        st->ready_ammo = -1;
+    st->last_tic_us = tic_us;
+    ubo_audio_stats(&audio);
+    st->audio_underruns = audio.underruns;
+    st->audio_mix_us = audio.mix_us;
+    st->input_lag_us = g_input_lag_us;
+    st->crash_cause = g_crash_cause;
+    st->crash_gametic = (uint32_t)g_crash_gametic;
+    st->crash_gamestate = g_crash_gamestate;
+    st->crash_episode = g_crash_episode;
+    st->crash_map = g_crash_map;
+    st->deadline_tics = g_deadline.tics;
+    st->deadline_misses = g_deadline.misses;
+    st->worst_tic_us = g_deadline.tic_us;
+    st->worst_sim_us = g_deadline.sim_us;
+    st->worst_render_us = g_deadline.render_us;
+    st->worst_sound_us = g_deadline.sound_us;
+    st->worst_gametic = g_deadline.gametic;
+    st->worst_gamestate = g_deadline.gamestate;
+    st->worst_episode = g_deadline.episode;
+    st->worst_map = g_deadline.map;
+    st->episode = alive && gamestate == GS_LEVEL ? gameepisode : 0;
+    st->map = alive && gamestate == GS_LEVEL ? gamemap : 0;
+    st->quality_level = I_GovernorLevel();
+    st->frame_load_pct = I_GovernorLoad();
+    st->cpu_temp_mc = I_GovernorTemp();
+    st->idle = ubo_idle();
+    st->catchup_backlog_tics = (uint32_t)(g_advance_us / (1000000u / TICRATE));
+    st->catchup_dropped_tics = g_catchup_dropped;
+    st->load_pct = P_SetupProgress();
+    if (alive) {
+        Z_ZoneCounters(&zone);
+        st->zone_size = zone.size;
+        st->zone_used = zone.used;
+        st->zone_high_water = zone.highwater;
+        st->zone_purges = (uint32_t)zone.purges;
     }
+    st->level_loads = levelloads;
+    st->last_load_us = lastloadus;
+    st->max_load_us = maxloadus;
+    st->crash_count = g_crash_count;
+    st->reset_count = g_reset_count;
 
-    if (setjmp(ubo_error_jmp) != 0) {
-        // I_Error mid-tick (e.g. Z_Malloc failure during level load).
-        g_crash_jmp_valid = 0;
-        ubo_error_jmp_valid = 0;
-        g_inited = -1;
-        fprintf(stderr, "[doom] doom_tick aborted via I_Error\n");
+    atomic_thread_fence(memory_order_release);
+    st->version++;
+}
+
+// Frame profiler (UBO_DOOM_PROFILE).  Probes accumulate into g_prof on the
+// tic thread; doom_run_tic() publishes it to g_profile under a seqlock once
+// per tic.  Enable/reset requests from other threads are applied at the next
+// tic boundary so a probe never straddles a state change.
+int ubo_prof_enabled = 0;
+
+static ubo_profile_t g_prof;
+static ubo_profile_t g_profile;
+static struct timespec g_prof_t0[UBO_PROF_NUM_STAGES];
+static uint64_t g_prof_window_us[UBO_PROF_NUM_STAGES];
+static uint32_t g_prof_window_calls[UBO_PROF_NUM_STAGES];
+static atomic_int g_prof_want_enabled = 0;
+static atomic_int g_prof_want_reset = 0;
+
+// Log a one-line summary this often while profiling (once a minute at 35 Hz).
+#define UBO_PROF_LOG_TICS (TICRATE * 60)
+
+void ubo_prof_begin(ubo_prof_stage_t stage)
+{
+    if (ubo_trace_enabled)
+        I_TraceBegin(doom_prof_stage_name(stage));
+    if (ubo_prof_enabled)
+        clock_gettime(CLOCK_MONOTONIC, &g_prof_t0[stage]);
+}
+
+void ubo_prof_end(ubo_prof_stage_t stage)
+{
+    ubo_prof_stat_t* st = &g_prof.stage[stage];
+    uint32_t us;
+    int bucket;
+    int i;
+
+    if (ubo_trace_enabled)
+        I_TraceEnd();
+    if (!ubo_prof_enabled)
         return;
-    }
 
-    // One "outer loop" iteration of D_DoomLoop(), singletics path.
-    // This mirrors d_main.c's singletics branch exactly: run 1 tic per
-    // doom_tick call with no spin-waits, so the Kivy main thread is never
-    // blocked waiting for real-time tics to accumulate.
-    I_StartFrame();
-    I_StartTic();
-    D_ProcessEvents();
-    {
-        ticcmd_t* cmd = &netcmds[consoleplayer][maketic%BACKUPTICS];
-        G_BuildTiccmd(cmd);
+    us = ubo_elapsed_us(&g_prof_t0[stage]);
+    bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= UBO_PROF_BUCKETS)
+        bucket = UBO_PROF_BUCKETS - 1;
 
-        // UBO movement experiment: force fixed forward values for UP/DOWN.
-        // This intentionally overrides any forward component produced inside
-        // G_BuildTiccmd (keyboard accel, mouse, joystick) so we can test
-        // deterministic movement magnitudes on hardware.
-        if (gamekeydown[key_up] && !gamekeydown[key_down]) {
-            cmd->forwardmove = 25;
-        } else if (gamekeydown[key_down] && !gamekeydown[key_up]) {
-            cmd->forwardmove = -25;
-        } else if (gamekeydown[key_up] && gamekeydown[key_down]) {
-            cmd->forwardmove = 0;
-        }
+    st->calls++;
+    st->last_us = us;
+    st->total_us += us;
+    st->hist[bucket]++;
+    if (us > st->max_us)
+        st->max_us = us;
+
+    g_prof_window_us[stage] += us;
+    if (++g_prof_window_calls[stage] >= UBO_PROF_WINDOW) {
+        g_prof_window_us[stage] /= 2;
+        g_prof_window_calls[stage] /= 2;
+        st->max_us /= 2;
+        for (i = 0; i < UBO_PROF_BUCKETS; i++)
+            st->hist[i] /= 2;
     }
-    if (advancedemo)
-        D_DoAdvanceDemo();
-    M_Ticker();
-    G_Ticker();
-    gametic++;
-    maketic++;
+    st->avg_us = (uint32_t)(g_prof_window_us[stage] / g_prof_window_calls[stage]);
+}
 
-    // Position-based audio update.
-    if (players[consoleplayer].mo)
-        S_UpdateSounds(players[consoleplayer].mo);
-    else
-        S_UpdateSounds(NULL);
+static void ubo_prof_clear(void)
+{
+    memset(&g_prof, 0, sizeof(g_prof));
+    memset(g_prof_window_us, 0, sizeof(g_prof_window_us));
+    memset(g_prof_window_calls, 0, sizeof(g_prof_window_calls));
+}
 
-    D_Display();
+static void ubo_prof_publish(void)
+{
+    volatile ubo_profile_t* pub = &g_profile;
+    uint32_t version = pub->version;
 
-    I_UpdateSound();
-    I_SubmitSound();
+    g_prof.enabled = ubo_prof_enabled;
 
-    g_crash_jmp_valid = 0;
-    ubo_error_jmp_valid = 0;
+    pub->version = version + 1;
+    atomic_thread_fence(memory_order_release);
+    memcpy((void*)&pub->enabled, &g_prof.enabled,
+           sizeof(g_prof) - offsetof(ubo_profile_t, enabled));
+    atomic_thread_fence(memory_order_release);
+    pub->version = version + 2;
 }
 
-void doom_shutdown(void)
+const char* doom_prof_stage_name(int stage)
 {
-    if (!g_inited) return;
+    static const char* names[UBO_PROF_NUM_STAGES] = {
+        "tic", "ticker", "bsp", "planes", "masked", "sprite_sort",
+        "statusbar", "finish_update", "update_sound", "submit_sound",
+    };
+    if (stage < 0 || stage >= UBO_PROF_NUM_STAGES) return NULL;
+    return names[stage];
+}
 
-    // Do NOT call I_Quit() (it exits the process). Just shut down sound.
-    I_ShutdownSound();
-    g_inited = 0;
+static void ubo_prof_log(void)
+{
+    ubo_audio_stats_t audio;
+    char line[640];
+    int len = 0;
+    int i;
+
+    for (i = 0; i < UBO_PROF_NUM_STAGES && len < (int)sizeof(line); i++)
+        len += snprintf(line + len, sizeof(line) - len, " %s=%u/%u",
+                        doom_prof_stage_name(i), g_prof.stage[i].avg_us,
+                        g_prof.stage[i].max_us);
+    UBO_LOG(UBO_LOG_INFO, "[doom] profile avg/max us:%s\n", line);
+
+    ubo_audio_stats(&audio);
+    if (audio.active && audio.rate > 0)
+        UBO_LOG(UBO_LOG_INFO,
+                "[doom] audio: %u underruns, %u errors, %u overruns, delay %d/%d ms, "
+                "ring %d/%d ms, lead %d ms\n",
+                audio.underruns, audio.errors, audio.overruns,
+                audio.delay_frames * 1000 / audio.rate, audio.delay_max * 1000 / audio.rate,
+                audio.ring_frames * 1000 / audio.rate, audio.ring_max * 1000 / audio.rate,
+                audio.lead_frames * 1000 / audio.rate);
 }
 
-void doom_key_down(ubo_key_t key)
+// Apply pending enable/reset requests; called before the tic's first probe.
+static void ubo_prof_tic_begin(void)
 {
-    int doom_key = map_ubo_key(key);
-    event_t ev;
-    fprintf(stderr, "[doom] key_down ubo=%d doom=0x%02x\n", (int)key, doom_key);
-    ev.type = ev_keydown;
-    ev.data1 = doom_key;
-    ev.data2 = 0;
-    ev.data3 = 0;
-    D_PostEvent(&ev);
+    int want = atomic_load(&g_prof_want_enabled);
+
+    if (atomic_exchange(&g_prof_want_reset, 0))
+        ubo_prof_clear();
+    if (want != ubo_prof_enabled) {
+        ubo_prof_enabled = want;
+        ubo_prof_publish();
+    }
+    UBO_PROF_BEGIN(UBO_PROF_TIC);
 }
 
-void doom_key_up(ubo_key_t key)
+static void ubo_prof_tic_end(void)
 {
-    int doom_key = map_ubo_key(key);
-    event_t ev;
-    fprintf(stderr, "[doom] key_up   ubo=%d doom=0x%02x\n", (int)key, doom_key);
-    ev.type = ev_keyup;
-    ev.data1 = doom_key;
-    ev.data2 = 0;
-    ev.data3 = 0;
-    D_PostEvent(&ev);
+    UBO_PROF_END(UBO_PROF_TIC);
+    if (!ubo_prof_enabled) return;
+    g_prof.tics++;
+    ubo_prof_publish();
+    if (g_prof.tics % UBO_PROF_LOG_TICS == 0)
+        ubo_prof_log();
 }
 
-const uint8_t* doom_get_rgba_ptr(void) { return ubo_rgba; }
-int doom_get_rgba_width(void) { return 320; }
-int doom_get_rgba_height(void) { return 200; }
-int doom_is_alive(void) { return g_inited == 1; }
-int doom_get_gamestate(void) { return (int)gamestate; }
-int doom_get_menuactive(void) { return menuactive ? 1 : 0; }
+// Zone profiler (UBO_DOOM_ZONE_PROFILE): switched at the tic boundary, as the
+// zone is only touched from the tic thread; a sample line every
+// g_zone_sample_every tics above 1.
+static atomic_int g_zone_want_profile = 0;
+static int g_zone_sample_every;
+static int g_zone_sample_tics;
 
-void doom_reset(void)
+static void ubo_zone_tic(void)
 {
-    // Allow doom_init() to run again after a mid-tick crash.
-    // The old zone heap leaks but all other globals will be re-initialised
-    // by the next D_DoomMain() call.
-    g_inited = 0;
-    ubo_error_jmp_valid = 0;
-    g_crash_jmp_valid = 0;
+    int every = atomic_load(&g_zone_want_profile);
 
-    // Clear the WAD file list so D_AddFile() starts from index 0 on the next
-    // init — without this, each re-init appends the IWAD again and again,
-    // causing duplicate lump registrations.
-    memset(wadfiles, 0, sizeof(wadfiles));
+    if (every != g_zone_sample_every) {
+        Z_SetProfile(every > 0);
+        g_zone_sample_every = every;
+        g_zone_sample_tics = 0;
+    }
+    if (every > 1 && ++g_zone_sample_tics >= every) {
+        Z_ProfileLog();
+        g_zone_sample_tics = 0;
+    }
+}
 
-    // Reset tic counters to avoid NetUpdate: netbuffer->numtics > BACKUPTICS.
-    // gametic and maketic carry over from the crashed session and cause the
-    // net tic buffer difference check to immediately fire on the next run.
-    gametic = 0;
-    maketic = 0;
+// doom_rewind() / doom_snapshot_save() / doom_snapshot_load(), applied by the
+// tic thread before G_Ticker.  g_want_quick: 1 = save, 2 = load.
+static atomic_int g_want_rewind = 0;
+static atomic_int g_want_quick = 0;
+
+// doom_demo_record() / doom_demo_play() / doom_demo_stop(), applied the same
+// way.  g_want_demo: 1 = record g_demo_path, 2 = play it, 3 = stop.
+static char g_demo_path[256];
+static atomic_int g_want_demo = 0;
+
+static pthread_t g_async_thread;
+static atomic_int g_async_running = 0;
+static atomic_int g_async_stop = 0;
+static int g_async_hz = TICRATE;
+static int g_input_early_ms = 8;      // UBO_DOOM_INPUT_EARLY_MS, see doom_async_wait
+
+static void ubo_state_post_if_changed(void)
+{
+    ubo_state_event_t ev;
+    unsigned head, tail;
+
+    ev.alive = g_inited == 1;
+    ev.gamestate = ev.alive ? (int)gamestate : -1;
+    ev.menuactive = ev.alive && menuactive ? 1 : 0;
+    ev.gametic = (uint32_t)gametic;
+
+    if (g_state_last_valid
+        && ev.alive == g_state_last.alive
+        && ev.gamestate == g_state_last.gamestate
+        && ev.menuactive == g_state_last.menuactive)
+        return;
+
+    head = atomic_load_explicit(&g_state_head, memory_order_relaxed);
+    tail = atomic_load_explicit(&g_state_tail, memory_order_acquire);
+    if (head - tail >= UBO_STATE_QUEUE)
+        return;  // host stopped polling; it will still see the latest state once it drains
+
+    g_state_q[head & (UBO_STATE_QUEUE - 1)] = ev;
+    atomic_store_explicit(&g_state_head, head + 1, memory_order_release);
+    g_state_last = ev;
+    g_state_last_valid = 1;
+}
+
+// Typed game events (doom_poll_game_events).  Another SPSC ring, producer
+// whichever thread runs the tic, and an eventfd the host can wait on: each
+// tic that posts adds to its count, doom_poll_game_events reads it back to
+// zero before draining.  What the events report is found by comparing the
+// engine state after a tic with what the last one left, so the engine
+// files need no hooks.  The fd is made once and lives as long as the process,
+// so a host event loop can keep watching it across doom_shutdown/doom_init.
+#define UBO_GAME_EVENT_QUEUE 64   // power of two
+
+static ubo_game_event_t g_game_ev_q[UBO_GAME_EVENT_QUEUE];
+static atomic_uint g_game_ev_head = 0;
+static atomic_uint g_game_ev_tail = 0;
+static pthread_once_t g_game_ev_once = PTHREAD_ONCE_INIT;
+static int g_game_ev_fd = -1;
+
+typedef struct {
+    int valid;
+    int gamestate;
+    int menuactive;
+    int levelstarttic;
+    int playerstate;
+    unsigned save_seq;
+} ubo_game_seen_t;
+
+static ubo_game_seen_t g_game_seen;
+
+static void ubo_game_event_open(void)
+{
+    g_game_ev_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_game_ev_fd < 0)
+        UBO_LOG(UBO_LOG_ERROR, "[doom] eventfd: %s\n", strerror(errno));
+}
+
+// Queues one event; returns 1 if it was queued.  The host stopped draining
+// when the ring is full: newer events are dropped, the older ones kept.
+static int ubo_game_event_queue(int type, int data0, int data1)
+{
+    unsigned head = atomic_load_explicit(&g_game_ev_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&g_game_ev_tail, memory_order_acquire);
+    ubo_game_event_t* ev;
+
+    if (head - tail >= UBO_GAME_EVENT_QUEUE)
+        return 0;
+    ev = &g_game_ev_q[head & (UBO_GAME_EVENT_QUEUE - 1)];
+    ev->type = type;
+    ev->data0 = data0;
+    ev->data1 = data1;
+    ev->gametic = (uint32_t)gametic;
+    atomic_store_explicit(&g_game_ev_head, head + 1, memory_order_release);
+    return 1;
+}
+
+static void ubo_game_event_signal(int posted)
+{
+    uint64_t one = 1;
+
+    if (posted && g_game_ev_fd >= 0 && write(g_game_ev_fd, &one, sizeof(one)) < 0) {
+        // EAGAIN: the count is at its maximum, the fd is readable anyway
+    }
+}
+
+// After every tic (not while doom_simulate fast-forwards): what changed.
+static void ubo_game_events_tic(void)
+{
+    ubo_game_seen_t now;
+    ubo_game_seen_t* was = &g_game_seen;
+    int posted = 0;
+
+    pthread_once(&g_game_ev_once, ubo_game_event_open);
+    now.valid = 1;
+    now.gamestate = (int)gamestate;
+    now.menuactive = menuactive ? 1 : 0;
+    now.levelstarttic = levelstarttic;
+    now.playerstate = gamestate == GS_LEVEL ? (int)players[consoleplayer].playerstate : PST_LIVE;
+    M_WriteStatus(&now.save_seq);
+
+    if (!was->valid) {
+        // first tic of a session: report where it starts
+        was->gamestate = -1;
+        was->menuactive = 0;
+        was->levelstarttic = now.levelstarttic - 1;
+        was->playerstate = PST_LIVE;
+        was->save_seq = now.save_seq;
+    }
+    if (was->gamestate == GS_LEVEL && now.gamestate != GS_LEVEL)
+        posted |= ubo_game_event_queue(UBO_GAME_EVENT_LEVEL_EXIT, now.gamestate, 0);
+    if (now.gamestate == GS_LEVEL
+        && (was->gamestate != GS_LEVEL || was->levelstarttic != now.levelstarttic))
+        posted |= ubo_game_event_queue(UBO_GAME_EVENT_LEVEL_START, gameepisode, gamemap);
+    if (now.gamestate == GS_INTERMISSION && was->gamestate != GS_INTERMISSION)
+        posted |= ubo_game_event_queue(UBO_GAME_EVENT_INTERMISSION, gameepisode, gamemap);
+    if (now.menuactive != was->menuactive)
+        posted |= ubo_game_event_queue(now.menuactive ? UBO_GAME_EVENT_MENU_OPEN
+                                                      : UBO_GAME_EVENT_MENU_CLOSE, 0, 0);
+    if (now.playerstate == PST_DEAD && was->playerstate != PST_DEAD)
+        posted |= ubo_game_event_queue(UBO_GAME_EVENT_PLAYER_DEATH, consoleplayer, 0);
+    if (now.save_seq != was->save_seq)
+        posted |= ubo_game_event_queue(UBO_GAME_EVENT_SAVE_DONE,
+                                       M_WriteStatus(NULL) != M_WRITE_FAILED, 0);
+    *was = now;
+    ubo_game_event_signal(posted);
+}
+
+// The tic was cut short by a crash; cause as in ubo_status_t.crash_cause.
+static void ubo_game_event_died(int cause)
+{
+    pthread_once(&g_game_ev_once, ubo_game_event_open);
+    ubo_game_event_signal(ubo_game_event_queue(UBO_GAME_EVENT_ENGINE_DIED, cause, 0));
+    g_game_seen.valid = 0;
+}
+
+static int map_ubo_key(ubo_key_t key)
+{
+    switch (key)
+    {
+        case UBO_KEY_UP: return KEY_UPARROW;
+        case UBO_KEY_DOWN: return KEY_DOWNARROW;
+        case UBO_KEY_LEFT: return KEY_LEFTARROW;
+        case UBO_KEY_RIGHT: return KEY_RIGHTARROW;
+        case UBO_KEY_FIRE: return KEY_RCTRL;
+        case UBO_KEY_USE: return ' ';
+        case UBO_KEY_ESCAPE: return KEY_ESCAPE;
+        case UBO_KEY_MENU_SELECT: return KEY_ENTER;
+        case UBO_KEY_MAP: return KEY_TAB;
+        default: return 0;
+    }
+}
+
+static void ubo_post_key(ubo_key_t key, int down)
+{
+    event_t ev;
+
+    ev.type = down ? ev_keydown : ev_keyup;
+    ev.data1 = map_ubo_key(key);
+    ev.data2 = 0;
+    ev.data3 = 0;
+    UBO_LOG(UBO_LOG_DEBUG, "[doom] key_%s ubo=%d doom=0x%02x\n",
+            down ? "down" : "up  ", (int)key, ev.data1);
+    D_PostEvent(&ev);
+}
+
+static void ubo_release_key(int key)
+{
+    if (g_key_hold[key] != 0) {
+        ubo_post_key((ubo_key_t)key, 0);
+        g_key_hold[key] = 0;
+    }
+}
+
+static void ubo_apply_event(const ubo_event_t* ev)
+{
+    int key = ev->key;
+
+    if (key == UBO_KEY_NONE) {
+        // Release-all marker from doom_release_all_keys().
+        for (int k = 1; k < UBO_KEY_SLOTS; k++)
+            ubo_release_key(k);
+        return;
+    }
+    if (key < 0 || key >= UBO_KEY_SLOTS || !map_ubo_key((ubo_key_t)key))
+        return;
+
+    if (ev->hold_tics > 0) {
+        // Tap: cancel the opposite movement direction immediately so a
+        // lingering countdown can't leave UP and DOWN both in gamekeydown.
+        if (key == UBO_KEY_UP)
+            ubo_release_key(UBO_KEY_DOWN);
+        else if (key == UBO_KEY_DOWN)
+            ubo_release_key(UBO_KEY_UP);
+        if (g_key_hold[key] == 0)
+            ubo_post_key((ubo_key_t)key, 1);
+        if (g_key_hold[key] != UBO_HOLD_EXPLICIT)
+            g_key_hold[key] = ev->hold_tics;  // (re)set countdown
+    } else if (ev->down) {
+        if (g_key_hold[key] == 0)
+            ubo_post_key((ubo_key_t)key, 1);
+        g_key_hold[key] = UBO_HOLD_EXPLICIT;
+    } else {
+        // Explicit key-up always goes through, even for keys we don't think
+        // are held, so the host can clear stale gamekeydown[] state.
+        ubo_post_key((ubo_key_t)key, 0);
+        g_key_hold[key] = 0;
+    }
+}
+
+// Called right before D_ProcessEvents and G_BuildTiccmd, as late in the tic
+// as input can still reach this tic's ticcmd: apply queued host input, then
+// count down tapped keys and release the ones that expired, so their key-up
+// is handled on this same tic.
+
+static void ubo_input_drain(void)
+{
+    const ubo_input_slot_t* slot;
+    uint64_t now = 0;
+
+    while ((slot = ubo_input_peek()) != NULL) {
+        if (!now) {
+            now = ubo_now_us();
+            g_input_taken_us = (uint64_t)I_GetTimeUs();
+        }
+        g_input_lag_us = now > slot->posted_us ? (uint32_t)(now - slot->posted_us) : 0;
+        ubo_apply_event(&slot->ev);
+        ubo_input_pop();
+    }
+
+    for (int k = 1; k < UBO_KEY_SLOTS; k++) {
+        if (g_key_hold[k] > 0 && --g_key_hold[k] == 0)
+            ubo_post_key((ubo_key_t)k, 0);
+    }
+}
+
+// What doom_init() opens beyond the engine itself: the outputs that have a
+// device or another process behind them.
+static void doom_start_outputs(void)
+{
+    I_FrameShmStart();
+    if (getenv("UBO_DOOM_CAPTURE"))
+        doom_capture_start(getenv("UBO_DOOM_CAPTURE"));
+    if (getenv("UBO_DOOM_STREAM"))
+        doom_stream_start(getenv("UBO_DOOM_STREAM"));
+    if (getenv("UBO_DOOM_MIRROR"))
+        doom_mirror_start(getenv("UBO_DOOM_MIRROR"));
+    if (getenv("UBO_DOOM_SPECTATE"))
+        doom_spectate_start(getenv("UBO_DOOM_SPECTATE"));
+    if (getenv("UBO_DOOM_HDMI"))
+        doom_hdmi_open(getenv("UBO_DOOM_HDMI"));
+}
+
+// Where cold start went: each D_DoomMain phase's time, one line at INFO.
+static void doom_log_init_phases(void)
+{
+    char line[512];
+    int len = 0;
+    int total = 0;
+
+    for (int i = 0; i < NUMINITPHASES && len < (int)sizeof(line); i++) {
+        total += initphaseus[i];
+        len += snprintf(line + len, sizeof(line) - len, " %s %d.%d", D_InitPhaseName(i),
+                        initphaseus[i] / 1000, initphaseus[i] / 100 % 10);
+    }
+    UBO_LOG(UBO_LOG_INFO, "[doom] init phases (ms):%s, total %d.%d\n", line,
+            total / 1000, total / 100 % 10);
+}
+
+// The part of doom_init() before the engine runs: settings from the
+// environment and the argv D_DoomMain reads.
+static int doom_init_prepare(const char* iwad_path)
+{
+    const char* launch_cwd;
+    const char* config_path;
+    int memory_mb;
+
+    ubo_library_mode = 1;
+
+    {
+        const char* log_level = getenv("UBO_DOOM_LOG_LEVEL");
+        if (log_level && log_level[0] != '\0')
+            ubo_log_level = atoi(log_level);
+    }
+    // Diagnostics collect in the log ring from here on (doom_read_log).
+    I_LogStart();
+
+    {
+        const char* profile = getenv("UBO_DOOM_PROFILE");
+        if (profile && profile[0] != '\0')
+            doom_set_profile_enabled(atoi(profile));
+    }
+
+    {
+        // Before D_DoomMain, so start-up allocations are charged too.
+        const char* zprof = getenv("UBO_DOOM_ZONE_PROFILE");
+        if (zprof && zprof[0] != '\0') {
+            doom_set_zone_profile(atoi(zprof));
+            g_zone_sample_every = atomic_load(&g_zone_want_profile);
+            Z_SetProfile(g_zone_sample_every > 0);
+        }
+    }
+
+    {
+        const char* trace = getenv("UBO_DOOM_TRACE");
+        if (trace && trace[0] != '\0')
+            doom_set_trace_enabled(atoi(trace));
+    }
+
+    {
+        // Serve lumps straight from an mmap of the WAD (on unless "0").
+        const char* wad_mmap_env = getenv("UBO_DOOM_WAD_MMAP");
+        wad_mmap = !(wad_mmap_env && wad_mmap_env[0] == '0');
+    }
+
+    {
+        // NEON/SSE2 pixel conversion and spans when the CPU has it (on unless "0").
+        const char* simd_env = getenv("UBO_DOOM_SIMD");
+        ubo_video_simd = !(simd_env && simd_env[0] == '0');
+        simdspans = ubo_video_simd && I_CpuHasSimd();
+    }
+
+    {
+        // Reuse the converted status bar rows while the bar is unchanged (on unless "0").
+        const char* sbar_env = getenv("UBO_DOOM_STATUSBAR_CACHE");
+        ubo_video_sbarcache = !(sbar_env && sbar_env[0] == '0');
+    }
+
+    {
+        // Reuse the converted view border rows while the border is unchanged (on unless "0").
+        const char* border_env = getenv("UBO_DOOM_BORDER_CACHE");
+        ubo_video_bordercache = !(border_env && border_env[0] == '0');
+    }
+
+    {
+        // Don't convert or publish a frame identical to the last (on unless "0").
+        const char* static_env = getenv("UBO_DOOM_SKIP_STATIC");
+        ubo_video_skipstatic = !(static_env && static_env[0] == '0');
+    }
+
+    {
+        // Page the level's sound lumps in with its graphics (on unless "0").
+        const char* sfx_env = getenv("UBO_DOOM_SFX_PREFETCH");
+        ubo_sfx_prefetch = !(sfx_env && sfx_env[0] == '0');
+    }
+
+    {
+        // Draw the view, status bar and menus at the LCD's 240x150 (off unless "1").
+        const char* lcdres_env = getenv("UBO_DOOM_LCD_RES");
+        int lcdres = lcdres_env && lcdres_env[0] == '1';
+        screenwidth = lcdres ? UBO_LCD_WIDTH : SCREENWIDTH;
+        screenheight = lcdres ? UBO_LCD_ACTIVE_HEIGHT : SCREENHEIGHT;
+    }
+
+    {
+        // Turn the RGB565 frame to how the panel is mounted (degrees clockwise,
+        // then "1" mirrors).
+        const char* rot_env = getenv("UBO_DOOM_LCD_ROTATION");
+        const char* mirror_env = getenv("UBO_DOOM_LCD_MIRROR");
+        int degrees = rot_env && rot_env[0] ? atoi(rot_env) : 0;
+
+        if ((rot_env && rot_env[0]) || (mirror_env && mirror_env[0])) {
+            if (degrees % 90 || degrees < 0 || degrees > 270) {
+                UBO_LOG(UBO_LOG_ERROR, "[doom] UBO_DOOM_LCD_ROTATION=%s: expected 0, 90, 180 or 270\n",
+                        rot_env);
+                degrees = 0;
+            }
+            doom_set_lcd_orientation((ubo_rotation_t)(degrees / 90),
+                                     mirror_env && mirror_env[0] == '1');
+        }
+    }
+
+    {
+        // Column-quad wall/sprite drawing (on unless "0").
+        const char* quads_env = getenv("UBO_DOOM_COLUMN_QUADS");
+        colquads = !(quads_env && quads_env[0] == '0');
+    }
+
+    {
+        // Column-major 3D view buffer (off unless "1").
+        const char* trans_env = getenv("UBO_DOOM_TRANSPOSED_VIEW");
+        transview = trans_env && trans_env[0] == '1';
+    }
+
+    {
+        // 3D view drawn straight into RGB565 (off unless "1").
+        const char* direct_env = getenv("UBO_DOOM_DIRECT565");
+        direct565 = direct_env && direct_env[0] == '1';
+    }
+
+    {
+        // Vertical view strips drawn in parallel (1 = one thread, the default).
+        const char* threads_env = getenv("UBO_DOOM_RENDER_THREADS");
+        renderthreads = (threads_env && threads_env[0] != '\0') ? atoi(threads_env) : 1;
+    }
+
+    {
+        // Slab allocation for small level objects (on unless "0").
+        const char* slabs_env = getenv("UBO_DOOM_ZONE_SLABS");
+        zoneslabs = !(slabs_env && slabs_env[0] == '0');
+    }
+
+    {
+        // Zone compaction at each level load (on unless "0").
+        const char* compact_env = getenv("UBO_DOOM_ZONE_COMPACT");
+        zonecompact = !(compact_env && compact_env[0] == '0');
+    }
+
+    {
+        // Level geometry from a bump arena outside the zone (on unless "0").
+        const char* arena_env = getenv("UBO_DOOM_LEVEL_ARENA");
+        zonearena = !(arena_env && arena_env[0] == '0');
+    }
+
+    {
+        // Cached P_CheckSight results (on unless "0").
+        const char* sight_env = getenv("UBO_DOOM_SIGHT_CACHE");
+        sightcache = !(sight_env && sight_env[0] == '0');
+    }
+
+    {
+        // Monster sight checks traced in parallel ahead of the thinkers (1 = off, the default).
+        const char* sthreads_env = getenv("UBO_DOOM_SIGHT_THREADS");
+        sightthreads = (sthreads_env && sthreads_env[0] != '\0') ? atoi(sthreads_env) : 1;
+    }
+
+    {
+        // Map lumps converted on this many threads at level load (1 = off, the default).
+        const char* lthreads_env = getenv("UBO_DOOM_LOAD_THREADS");
+        loadthreads = (lthreads_env && lthreads_env[0] != '\0') ? atoi(lthreads_env) : 1;
+    }
+
+    {
+        // Seconds of once-a-second rewind snapshots kept in memory (0 = off).
+        const char* rewind_env = getenv("UBO_DOOM_REWIND_SECONDS");
+        if (rewind_env && rewind_env[0] != '\0')
+            rewindseconds = atoi(rewind_env);
+    }
+
+    {
+        // Savegames written by an I/O thread via a temp file (on unless "0").
+        const char* asave_env = getenv("UBO_DOOM_ASYNC_SAVE");
+        asyncwrites = !(asave_env && asave_env[0] == '0');
+    }
+
+    {
+        // Savegames written zlib packed; loading reads either kind (on unless "0").
+        const char* compress_env = getenv("UBO_DOOM_SAVE_COMPRESS");
+        savecompress = !(compress_env && compress_env[0] == '0');
+    }
+
+    {
+        // Moving sectors skip blockbox things clear of their lines (on unless "0").
+        const char* clip_env = getenv("UBO_DOOM_SECTOR_CLIP");
+        sectorclip = !(clip_env && clip_env[0] == '0');
+    }
+
+    {
+        // Wipe, sound pitch etc. draw from their own random streams (on unless "0").
+        const char* streams_env = getenv("UBO_DOOM_RANDOM_STREAMS");
+        randomstreams = !(streams_env && streams_env[0] == '0');
+    }
+
+    {
+        // Start an async tic up to this many ms early when input is waiting.
+        const char* early_env = getenv("UBO_DOOM_INPUT_EARLY_MS");
+        if (early_env && early_env[0] != '\0')
+            g_input_early_ms = atoi(early_env) > 0 ? atoi(early_env) : 0;
+    }
+
+    {
+        // Wake rate of doom_run_async() in the menu, paused or on a title page.
+        const char* idle_env = getenv("UBO_DOOM_IDLE_HZ");
+        if (idle_env && idle_env[0] != '\0')
+            g_idle_hz = atoi(idle_env) > 0 ? atoi(idle_env) : 0;
+    }
+
+    {
+        // doom_advance() catch-up, "TICS[:BACKLOG]" (default "4:35").
+        const char* catchup_env = getenv("UBO_DOOM_CATCHUP");
+        if (catchup_env && catchup_env[0] != '\0') {
+            char* end;
+            long tics = strtol(catchup_env, &end, 10);
+            long backlog = g_catchup_backlog;
+
+            if (*end == ':')
+                backlog = strtol(end + 1, &end, 10);
+            if (*end || doom_set_catchup((int)tics, (int)backlog) < 0)
+                UBO_LOG(UBO_LOG_ERROR, "[doom] UBO_DOOM_CATCHUP=%s: expected TICS[:BACKLOG], "
+                        "1..%d and 0..%d\n", catchup_env, UBO_CATCHUP_MAX_TICS,
+                        UBO_CATCHUP_MAX_BACKLOG);
+        }
+    }
+
+    {
+        // Level loads in steps, at most this many ms per tic (0 = in one go).
+        const char* budget_env = getenv("UBO_DOOM_LOAD_BUDGET_MS");
+        levelloadbudget = UBO_LOAD_BUDGET_MS * 1000;
+        if (budget_env && budget_env[0] != '\0') {
+            char* end;
+            long ms = strtol(budget_env, &end, 10);
+
+            if (*end || doom_set_load_budget((int)ms) < 0)
+                UBO_LOG(UBO_LOG_ERROR, "[doom] UBO_DOOM_LOAD_BUDGET_MS=%s: expected 0..%d\n",
+                        budget_env, UBO_LOAD_MAX_BUDGET_MS);
+        }
+    }
+
+    {
+        // Draw doom_advance() frames between the last two tics (on unless "0").
+        const char* interp_env = getenv("UBO_DOOM_INTERPOLATE");
+        interpolation = !(interp_env && interp_env[0] == '0');
+    }
+
+    {
+        // Screen melt between game states, a step per frame (on unless "0").
+        const char* wipe_env = getenv("UBO_DOOM_WIPE");
+        wipescreens = !(wipe_env && wipe_env[0] == '0');
+    }
+
+    {
+        // The map key lays the automap over the view (off unless "1").
+        const char* overlay_env = getenv("UBO_DOOM_AUTOMAP_OVERLAY");
+        amoverlay = overlay_env && overlay_env[0] == '1';
+    }
+
+    {
+        // Shed quality under load or heat (on unless "0"), see i_governor.h.
+        const char* gov_env = getenv("UBO_DOOM_GOVERNOR");
+        const char* temp_env = getenv("UBO_DOOM_GOVERNOR_TEMP");
+        I_GovernorInit(!(gov_env && gov_env[0] == '0'), temp_env ? atoi(temp_env) : 0);
+    }
+
+    // CPU affinity and scheduling class per thread class, see i_thread.h.
+    I_ThreadPolicyFromEnv();
+
+    {
+        // Engine memory budget in MB (0 = none, the default), see i_memory.h.
+        const char* mem_env = getenv("UBO_DOOM_MEMORY_MB");
+        memory_mb = g_memory_mb;
+        if (memory_mb < 0)
+            memory_mb = (mem_env && mem_env[0] != '\0') ? atoi(mem_env) : 0;
+        if (memory_mb < 0) memory_mb = 0;
+        if (memory_mb > 2047) memory_mb = 2047;
+        I_MemoryInit(memory_mb);
+    }
+
+    {
+        // Under a budget the zone defaults to an eighth of it, growing to a
+        // quarter, and the composite and pk3 caches to a thirty-second; what is set
+        // explicitly is kept.
+        const char* base_env = getenv("UBO_DOOM_ZONE_MB");
+        const char* max_env = getenv("UBO_DOOM_ZONE_MAX_MB");
+        int base_mb = g_zone_base_mb;
+        int max_mb = g_zone_max_mb;
+
+        if (base_mb < 0)
+            base_mb = (base_env && base_env[0] != '\0') ? atoi(base_env)
+                      : memory_mb ? memory_mb / 8 : 32;
+        if (base_mb < 4) base_mb = 4;
+        if (max_mb < 0)
+            max_mb = (max_env && max_env[0] != '\0') ? atoi(max_env)
+                     : memory_mb && memory_mb / 4 > base_mb ? memory_mb / 4 : base_mb * 2;
+        if (max_mb > 1024) max_mb = 1024;
+        zonesize = base_mb * 1024 * 1024;
+        zonemaxsize = max_mb > base_mb ? max_mb * 1024 * 1024 : 0;
+    }
+
+    {
+        // Zone on huge pages, faulted in at init (off unless "1"), and
+        // locked in RAM (off unless "1"; implies the mapping).
+        const char* zmap_env = getenv("UBO_DOOM_ZONE_MMAP");
+        const char* zlock_env = getenv("UBO_DOOM_ZONE_MLOCK");
+        zonemmap = zmap_env && zmap_env[0] == '1';
+        zonemlock = zlock_env && zlock_env[0] == '1';
+    }
+
+    {
+        // Composite texture cache budget in MB (default 4).
+        const char* comp_env = getenv("UBO_DOOM_COMPOSITE_MB");
+        int comp_mb = (comp_env && comp_env[0] != '\0') ? atoi(comp_env)
+                      : memory_mb ? memory_mb / 32 : 4;
+
+        if (comp_mb < 1) comp_mb = 1;
+        if (comp_mb > 256) comp_mb = 256;
+        compositelimit = comp_mb * 1024 * 1024;
+    }
+
+    {
+        // Inflated .pk3/.zip members kept outside the zone, in MB (default 2).
+        const char* pk3_env = getenv("UBO_DOOM_PK3_CACHE_MB");
+        int pk3_mb = (pk3_env && pk3_env[0] != '\0') ? atoi(pk3_env)
+                     : memory_mb ? memory_mb / 32 : 2;
+
+        if (pk3_mb < 0) pk3_mb = 0;
+        if (pk3_mb > 256) pk3_mb = 256;
+        zipcachelimit = pk3_mb * 1024 * 1024;
+    }
+
+    {
+        // Seconds a netgame start waits for the other players (default 30).
+        const char* timeout_env = getenv("UBO_DOOM_NET_TIMEOUT");
+        if (timeout_env && timeout_env[0] != '\0')
+            netstarttimeout = atoi(timeout_env);
+        if (netstarttimeout < 1) netstarttimeout = 1;
+    }
+
+    launch_cwd = getenv("UBO_DOOM_CWD");
+    config_path = getenv("UBO_DOOM_CONFIG");
+
+    {
+        // Startup cache of R_InitData tables next to the config file
+        // (UBO_DOOM_RCACHE=0 disables it).
+        static char rcache_path[1024];
+        const char* rcache_env = getenv("UBO_DOOM_RCACHE");
+
+        rdatacache = NULL;
+        if (config_path && config_path[0] != '\0' && !(rcache_env && rcache_env[0] == '0')) {
+            const char* slash = strrchr(config_path, '/');
+            int dirlen = slash ? (int)(slash - config_path) + 1 : 0;
+            snprintf(rcache_path, sizeof(rcache_path), "%.*subodoom.rcache", dirlen, config_path);
+            rdatacache = rcache_path;
+        }
+    }
+
+    {
+        // Per-map cache of derived level data in a directory next to the
+        // config file (UBO_DOOM_LEVEL_CACHE=0 disables it).
+        static char lcache_path[1024];
+        const char* lcache_env = getenv("UBO_DOOM_LEVEL_CACHE");
+
+        levelcache = NULL;
+        if (config_path && config_path[0] != '\0' && !(lcache_env && lcache_env[0] == '0')) {
+            const char* slash = strrchr(config_path, '/');
+            int dirlen = slash ? (int)(slash - config_path) + 1 : 0;
+            snprintf(lcache_path, sizeof(lcache_path), "%.*subodoom.lcache", dirlen, config_path);
+            levelcache = lcache_path;
+        }
+    }
+
+    {
+        // Per-map lump access order, read ahead on the next load of the
+        // map, in a directory next to the config file (UBO_DOOM_LUMP_PROFILE=0
+        // disables it).
+        static char lprof_path[1024];
+        const char* lprof_env = getenv("UBO_DOOM_LUMP_PROFILE");
+
+        lumpprofile = NULL;
+        if (config_path && config_path[0] != '\0' && !(lprof_env && lprof_env[0] == '0')) {
+            const char* slash = strrchr(config_path, '/');
+            int dirlen = slash ? (int)(slash - config_path) + 1 : 0;
+            snprintf(lprof_path, sizeof(lprof_path), "%.*subodoom.lprof", dirlen, config_path);
+            lumpprofile = lprof_path;
+        }
+    }
+
+    {
+        // Crash journal: ticcmds of the last UBO_DOOM_JOURNAL_MINUTES (default
+        // 10, 0 = off), written as a demo next to the config file (else in
+        // the working directory) when a tic crashes.
+        static char journal_path[1024];
+        const char* journal_env = getenv("UBO_DOOM_JOURNAL_MINUTES");
+
+        if (journal_env && journal_env[0] != '\0')
+            journalminutes = atoi(journal_env);
+        journalfile = NULL;
+        if (journalminutes > 0) {
+            const char* slash = config_path ? strrchr(config_path, '/') : NULL;
+            int dirlen = slash ? (int)(slash - config_path) + 1 : 0;
+            snprintf(journal_path, sizeof(journal_path), "%.*subodoom-crash.lmp", dirlen,
+                     config_path ? config_path : "");
+            journalfile = journal_path;
+        }
+    }
+
+    if (launch_cwd && launch_cwd[0] != '\0') {
+        if (chdir(launch_cwd) != 0) {
+            UBO_LOG(UBO_LOG_ERROR, "[doom] failed to chdir to UBO_DOOM_CWD=%s\n", launch_cwd);
+            g_inited = -1;
+            return -1;
+        }
+    }
+
+    // Build a minimal argv: [ubodoom, -iwad, <path>]
+    // Zone heap size comes from zonesize/zonemaxsize above, not mb_used.
+    for (int i = 0; i < 4; i++) {
+        free(g_argv_copies[i]);
+        g_argv_copies[i] = NULL;
+    }
+    g_argc = 0;
+    g_argv[g_argc++] = g_prog;
+    g_argv[g_argc++] = (char*)"-iwad";
+    g_argv[g_argc++] = g_argv_copies[0] = strdup(iwad_path);
+    if (config_path && config_path[0] != '\0') {
+        g_argv[g_argc++] = (char*)"-config";
+        g_argv[g_argc++] = g_argv_copies[1] = strdup(config_path);
+    }
+    {
+        // doom_add_pwad's files, then UBO_DOOM_PWADS="a.wad:b.pk3": -file
+        // loads them in that order, each overriding the lumps before it.
+        const char* pwad_env = getenv("UBO_DOOM_PWADS");
+        int first = g_argc;
+
+        g_argv[g_argc++] = (char*)"-file";
+        for (int i = 0; i < g_num_pwads; i++)
+            g_argv[g_argc++] = g_pwads[i];
+        if (pwad_env && pwad_env[0] != '\0') {
+            char* words = g_argv_copies[3] = strdup(pwad_env);
+            char* word;
+
+            for (word = strtok(words, ":"); word; word = strtok(NULL, ":")) {
+                if (word[0] == '-' || g_argc - first > UBO_MAX_PWADS) {
+                    UBO_LOG(UBO_LOG_ERROR, "[doom] UBO_DOOM_PWADS: skipping %s\n", word);
+                    continue;
+                }
+                g_argv[g_argc++] = word;
+            }
+        }
+        if (g_argc == first + 1)
+            g_argc = first;
+    }
+    {
+        // UBO_DOOM_NET="<player> <host[:port]>... [options]" becomes the
+        // engine's -net arguments, e.g. "2 192.168.1.20 -deathmatch".
+        const char* net_env = getenv("UBO_DOOM_NET");
+        if (net_env && net_env[0] != '\0') {
+            char* words = g_argv_copies[2] = strdup(net_env);
+            char* word;
+
+            g_argv[g_argc++] = (char*)"-net";
+            for (word = strtok(words, " \t"); word && g_argc < (int)(sizeof(g_argv) / sizeof(g_argv[0])) - 1;
+                 word = strtok(NULL, " \t"))
+                g_argv[g_argc++] = word;
+        }
+    }
+    g_argv[g_argc] = NULL;
+
+    myargc = g_argc;
+    myargv = g_argv;
+    return 0;
+}
+
+// doom_init()'s crash-guarded half: D_StartDoomMain when start is set, then
+// D_DoomMain's phases until budget_us is spent (0 = all, -1 = none).  The
+// percent done while phases remain, 100 once the engine is up, -1 if it
+// crashed or hit I_Error.
+static int doom_init_run(int start, int budget_us)
+{
+    int done;
+
+    // Install crash handlers for SIGSEGV and SIGBUS so that a crash inside
+    // D_DoomMain (e.g. in R_GenerateLookup with a bad WAD texture) is caught
+    // and returned as -1 instead of killing the host process.
+    struct sigaction sa, sa_old_segv, sa_old_bus;
+    sa.sa_handler = doom_crash_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESETHAND;  // auto-restore default after first delivery
+    sigaction(SIGSEGV, &sa, &sa_old_segv);
+    sigaction(SIGBUS,  &sa, &sa_old_bus);
+
+    doom_arm_crash_jmp();
+    if (sigsetjmp(g_crash_jmp, 1) != 0) {
+        // SIGSEGV or SIGBUS during init — restore handlers and abort cleanly.
+        g_crash_jmp_valid = 0;
+        ubo_error_jmp_valid = 0;
+        sigaction(SIGSEGV, &sa_old_segv, NULL);
+        sigaction(SIGBUS,  &sa_old_bus,  NULL);
+        g_inited = -1;
+        ubo_prewarming = 0;
+        doom_note_crash(g_crash_sig);
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_init aborted via signal (SIGSEGV/SIGBUS)\n");
+        return -1;
+    }
+
+    // Catch I_Error calls (which would otherwise call exit()) via longjmp.
+    ubo_error_jmp_valid = 1;
+    if (setjmp(ubo_error_jmp) != 0) {
+        // I_Error fired during init — abort cleanly without killing the process.
+        g_crash_jmp_valid = 0;
+        ubo_error_jmp_valid = 0;
+        sigaction(SIGSEGV, &sa_old_segv, NULL);
+        sigaction(SIGBUS,  &sa_old_bus,  NULL);
+        g_inited = -1;
+        ubo_prewarming = 0;
+        doom_note_crash(-1);
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_init aborted via I_Error longjmp\n");
+        return -1;
+    }
+
+    // D_DoomMain's phases call I_Init(), initialize sound/video, and then
+    // return (because ubo_library_mode=1).
+    ubo_prewarming = g_init_prewarm;
+    if (start) {
+        D_StartDoomMain();
+        g_inited = 2;
+    }
+    done = budget_us >= 0 && D_ContinueDoomMain(budget_us);
+    ubo_prewarming = 0;
+    if (!done) {
+        g_crash_jmp_valid = 0;
+        ubo_error_jmp_valid = 0;
+        sigaction(SIGSEGV, &sa_old_segv, NULL);
+        sigaction(SIGBUS,  &sa_old_bus,  NULL);
+        return D_InitProgress();
+    }
+
+    // In the original program, I_InitGraphics() is called at the start of D_DoomLoop().
+    // Our i_video_ubo backend doesn't need it, but keeping the call preserves expected init sequencing.
+    I_InitGraphics();
+    g_prewarmed = g_init_prewarm;
+    if (!g_init_prewarm)
+        doom_start_outputs();
+
+    g_crash_jmp_valid = 0;
+    ubo_error_jmp_valid = 0;
+    sigaction(SIGSEGV, &sa_old_segv, NULL);
+    sigaction(SIGBUS,  &sa_old_bus,  NULL);
+    g_inited = 1;
+
+    // Re-install the crash handler permanently (without SA_RESETHAND) so that
+    // SIGSEGV/SIGBUS during doom_tick are also caught instead of killing ubo_app.
+    sa.sa_flags = 0;  // persistent, not one-shot
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS,  &sa, NULL);
+
+    // In library mode we drive ticks manually (singletics path), so set the
+    // singletics flag.  This makes every NetUpdate() call in the engine
+    // (r_main.c, d_main.c, d_net.c) return immediately, preventing the
+    // "netbuffer->numtics > BACKUPTICS" I_Error after ~12 rendered frames.
+    extern boolean singletics;
+    singletics = true;
+
+    // Force key bindings to known-good values after M_LoadDefaults has run
+    // (as part of D_DoomMain above).  This overrides any stale/zeroed entries
+    // in ~/.doomrc such as key_right=0 and key_left=0 which would break turning.
+    // Also locks key_fire to KEY_RCTRL — KEY_ENTER is stolen by HU_MSGREFRESH
+    // (hu_stuff.h) and would be eaten before reaching G_Responder.
+    // A binding the host set with doom_set_config is its to choose.
+    extern int key_fire, key_right, key_left, key_up, key_down, key_speed;
+#define FORCE_KEY(var, value) if (!M_ConfigIsSet(#var)) var = (value)
+    FORCE_KEY(key_fire, KEY_RCTRL);
+    FORCE_KEY(key_right, KEY_RIGHTARROW);
+    FORCE_KEY(key_left, KEY_LEFTARROW);
+    FORCE_KEY(key_up, KEY_UPARROW);
+    FORCE_KEY(key_down, KEY_DOWNARROW);
+    // Disable run modifier: the UBO controller has no shift key.
+    // Setting key_speed=0 means gamekeydown[0] is checked; key 0 is never
+    // sent by doom_key_down(), so speed is always 0 (walk, forwardmove[0]=25).
+    FORCE_KEY(key_speed, 0);
+#undef FORCE_KEY
+
+    memset(&g_deadline, 0, sizeof(g_deadline));
+    atomic_store(&g_deadline_want_reset, 0);
+    ubo_status_update(0);
+    doom_log_init_phases();
+    return 100;
+}
+
+static int doom_init_locked(const char* iwad_path, int prewarm)
+{
+    if (g_inited == 1) {
+        if (!prewarm)
+            doom_resume_locked();
+        if (g_prewarmed && !prewarm) {
+            // Finish a prewarmed engine: the part I_Init skipped, then the sinks.
+            I_InitSound();
+            g_prewarmed = 0;
+            doom_start_outputs();
+            UBO_LOG(UBO_LOG_INFO, "[doom] doom_init: using the prewarmed engine\n");
+        }
+        return 0;
+    }
+    if (g_inited == -1) return -1;  /* previous init failed; DOOM globals are dirty */
+    if (g_inited == 2)              /* doom_init_begin() ran; finish the phases */
+        return doom_init_run(0, 0) < 0 ? -1 : 0;
+    if (!iwad_path) return -1;
+
+    if (doom_init_prepare(iwad_path) < 0) return -1;
+    g_init_prewarm = prewarm;
+    return doom_init_run(1, 0) < 0 ? -1 : 0;
+}
+
+int doom_init(const char* iwad_path)
+{
+    int rc;
+
+    pthread_mutex_lock(&g_init_lock);
+    rc = doom_init_locked(iwad_path, 0);
+    pthread_mutex_unlock(&g_init_lock);
+    return rc;
+}
+
+int doom_init_begin(const char* iwad_path)
+{
+    int rc;
+
+    pthread_mutex_lock(&g_init_lock);
+    if (g_inited == 1 || g_inited == -1)
+        rc = doom_init_locked(iwad_path, 0);
+    else if (g_inited == 2)
+        rc = 0;
+    else if (!iwad_path || doom_init_prepare(iwad_path) < 0)
+        rc = -1;
+    else {
+        g_init_prewarm = 0;
+        rc = doom_init_run(1, -1) < 0 ? -1 : 0;
+    }
+    pthread_mutex_unlock(&g_init_lock);
+    return rc;
+}
+
+int doom_init_step(int budget_ms)
+{
+    int rc;
+
+    pthread_mutex_lock(&g_init_lock);
+    if (g_inited == 1)
+        rc = 100;
+    else if (g_inited != 2)
+        rc = -1;
+    else
+        rc = doom_init_run(0, budget_ms > 0 ? budget_ms * 1000 : 0);
+    pthread_mutex_unlock(&g_init_lock);
+    return rc;
+}
+
+const char* doom_init_phase_name(int phase) { return D_InitPhaseName(phase); }
+
+int doom_init_phase_us(int phase)
+{
+    if (phase < 0 || phase >= NUMINITPHASES) return -1;
+    return initphaseus[phase];
+}
+
+int doom_prewarm(const char* iwad_path)
+{
+    const char* net_env = getenv("UBO_DOOM_NET");
+    int rc;
+
+    // A netgame start waits for the other players; leave that to doom_init().
+    if (net_env && net_env[0] != '\0') return -1;
+    pthread_mutex_lock(&g_init_lock);
+    rc = doom_init_locked(iwad_path, 1);
+    pthread_mutex_unlock(&g_init_lock);
+    return rc;
+}
+
+int doom_is_prewarmed(void) { return g_inited == 1 && g_prewarmed; }
+
+int doom_suspend(void)
+{
+    zonestats_t before;
+    int composites;
+    int released;
+
+    pthread_mutex_lock(&g_init_lock);
+    if (g_inited != 1 || atomic_load(&g_async_running)) {
+        pthread_mutex_unlock(&g_init_lock);
+        return -1;
+    }
+    if (g_suspended) {
+        pthread_mutex_unlock(&g_init_lock);
+        return 0;
+    }
+
+    // Nothing plays or starts while away; I_SuspendSound drops the effects.
+    S_SetQuiet(true);
+    S_StopSounds();
+    I_SuspendSound();
+
+    // Everything below is rebuilt or paged back in on first use.
+    composites = compositebytes;
+    Z_ZoneStats(&before);
+    released = I_MemoryRelease(MEM_RELEASE_ALL);
+    g_suspended = 1;
+    pthread_mutex_unlock(&g_init_lock);
+
+    UBO_LOG(UBO_LOG_INFO, "[doom] doom_suspend: %d KB cache purged, %d KB of zone and %d KB of "
+            "composites released\n", before.purgable / 1024, released / 1024, composites / 1024);
+    return 0;
+}
+
+static void doom_resume_locked(void)
+{
+    if (!g_suspended)
+        return;
+    I_ResumeSound();
+    S_SetQuiet(false);
+    g_suspended = 0;
+    // The host's display was someone else's in the meantime.
+    doom_invalidate_dirty();
+    UBO_LOG(UBO_LOG_INFO, "[doom] doom_resume\n");
+}
+
+int doom_resume(void)
+{
+    pthread_mutex_lock(&g_init_lock);
+    if (g_inited != 1) {
+        pthread_mutex_unlock(&g_init_lock);
+        return -1;
+    }
+    doom_resume_locked();
+    pthread_mutex_unlock(&g_init_lock);
+    return 0;
+}
+
+int doom_is_suspended(void) { return g_inited == 1 && g_suspended; }
+
+// Render every Nth simulated tic in doom_tick() and the async scheduler.
+static int g_render_divisor = 1;
+static unsigned g_sim_tics = 0;
+
+// Simulation half of a tic: input, menu/game tickers, positional sound.
+// Set while doom_simulate() runs tics headless.
+static int g_simulating = 0;
+
+// One game tic: the title loop, queued demo requests, M_Ticker and G_Ticker.
+static void doom_game_tic(void)
+{
+    if (advancedemo)
+        D_DoAdvanceDemo();
+    {
+        // After the title loop step a demo that just ended queued, which
+        // would otherwise cancel a new one.
+        int demo = atomic_exchange(&g_want_demo, 0);
+        if (demo == 1 && !G_RecordDemoFile(g_demo_path))
+            UBO_LOG(UBO_LOG_INFO, "[doom] demo: already recording or playing\n");
+        else if (demo == 2 && !G_PlayDemoFile(g_demo_path))
+            UBO_LOG(UBO_LOG_INFO, "[doom] demo: already recording or playing\n");
+        else if (demo == 3 && (demorecording || demoplayback))
+            G_CheckDemoStatus();
+    }
+    M_Ticker();
+    UBO_PROF_BEGIN(UBO_PROF_TICKER);
+    G_Ticker();
+    UBO_PROF_END(UBO_PROF_TICKER);
+    // a staged level load cut the tic short: it runs again once it's done
+    if (!levelloading)
+        gametic++;
+}
+
+// Consecutive doom_tick calls a netgame has been waiting for other players.
+static int g_net_wait = 0;
+
+// doom_set_ticcmd: replaces the ticcmd the keys build while g_bot_cmd_on.
+static ubo_ticcmd_t g_bot_cmd;
+static int g_bot_cmd_on = 0;
+
+void doom_set_ticcmd(const ubo_ticcmd_t* cmd)
+{
+    g_bot_cmd_on = cmd != NULL;
+    if (cmd)
+        g_bot_cmd = *cmd;
+}
+
+static void ubo_apply_bot_cmd(ticcmd_t* cmd)
+{
+    cmd->forwardmove = g_bot_cmd.forwardmove;
+    cmd->sidemove = g_bot_cmd.sidemove;
+    cmd->angleturn = g_bot_cmd.angleturn;
+    cmd->buttons = g_bot_cmd.buttons & (BT_ATTACK | BT_USE);
+    if (g_bot_cmd.weapon >= 1 && g_bot_cmd.weapon <= (BT_WEAPONMASK >> BT_WEAPONSHIFT) + 1)
+        cmd->buttons |= BT_CHANGE | ((g_bot_cmd.weapon - 1) << BT_WEAPONSHIFT);
+}
+
+static void doom_sim_tic(void)
+{
+    ticcmd_t* cmd;
+    int netnode;
+
+    // While a level loads in steps the tics only build it; input waits
+    // in its queue until the level is there to take it.
+    if (levelloading && !G_ContinueLoadLevel())
+        return;
+    I_StartTic();
+    ubo_input_drain();
+    D_ProcessEvents();
+
+    // In a netgame the command goes to the other nodes first and a tic
+    // only runs once all of them have sent theirs (D_NetTryTics).  A
+    // spectator of one has its tics from i_spectate instead.
+    netnode = netgame && !spectating;
+    cmd = netnode ? D_NetLocalCmd() : &netcmds[consoleplayer][maketic%BACKUPTICS];
+    if (cmd) {
+        G_BuildTiccmd(cmd);
+
+        // UBO movement experiment: force fixed forward values for UP/DOWN.
+        // This intentionally overrides any forward component produced inside
+        // G_BuildTiccmd (keyboard accel, mouse, joystick) so we can test
+        // deterministic movement magnitudes on hardware.
+        if (gamekeydown[key_up] && !gamekeydown[key_down]) {
+            cmd->forwardmove = 25;
+        } else if (gamekeydown[key_down] && !gamekeydown[key_up]) {
+            cmd->forwardmove = -25;
+        } else if (gamekeydown[key_up] && gamekeydown[key_down]) {
+            cmd->forwardmove = 0;
+        }
+        if (g_bot_cmd_on)
+            ubo_apply_bot_cmd(cmd);
+    }
+    {
+        // Rewind / memory quick slot requests, queued by other threads.
+        int rewind = atomic_exchange(&g_want_rewind, 0);
+        int quick = atomic_exchange(&g_want_quick, 0);
+        if (rewind > 0 && !G_Rewind(rewind))
+            UBO_LOG(UBO_LOG_INFO, "[doom] rewind: no snapshot to go back to\n");
+        if (quick == 1 && !G_QuickSnapshot())
+            UBO_LOG(UBO_LOG_INFO, "[doom] quick snapshot: not in a level\n");
+        else if (quick == 2 && !G_QuickRestore())
+            UBO_LOG(UBO_LOG_INFO, "[doom] quick restore: nothing saved\n");
+    }
+    if (netnode) {
+        int tics;
+
+        if (cmd)
+            maketic++;
+        tics = D_NetTryTics();
+        if (!tics) {
+            if (++g_net_wait == 2 * TICRATE)
+                UBO_LOG(UBO_LOG_INFO, "[doom] netgame: waiting for the other players\n");
+        } else {
+            if (g_net_wait >= 2 * TICRATE)
+                UBO_LOG(UBO_LOG_INFO, "[doom] netgame: resumed after %d tics\n", g_net_wait);
+            g_net_wait = 0;
+        }
+        while (tics-- > 0)
+            doom_game_tic();
+    } else {
+        doom_game_tic();
+        if (!levelloading)
+            maketic++;
+    }
+
+    // Position-based audio update (none while doom_simulate runs).
+    if (g_simulating)
+        return;
+    if (players[consoleplayer].mo)
+        S_UpdateSounds(players[consoleplayer].mo);
+    else
+        S_UpdateSounds(NULL);
+}
+
+// doom_set_aux_buffers: a request is packed into g_aux_want (mask, then
+// the index size) and taken by the next tic, so the renderer pointers only
+// change between frames.
+#define UBO_AUX_ALL (UBO_AUX_INDEX | UBO_AUX_DEPTH | UBO_AUX_LABELS)
+
+static atomic_int g_aux_want = -1;
+static int g_aux_mask = 0;
+static int g_aux_index_w = 80;
+static int g_aux_index_h = 50;
+static uint8_t g_aux_index[SCREENWIDTH * SCREENHEIGHT];
+static uint16_t g_aux_depth[SCREENWIDTH];
+static uint8_t g_aux_labels[SCREENWIDTH * SCREENHEIGHT];
+static ubo_aux_frame_t g_aux_frame;
+
+void doom_set_aux_buffers(int mask, int index_width, int index_height)
+{
+    if (index_width <= 0 || index_width > SCREENWIDTH)
+        index_width = 0;
+    if (index_height <= 0 || index_height > SCREENHEIGHT)
+        index_height = 0;
+    atomic_store(&g_aux_want, (mask & UBO_AUX_ALL) | index_width << 3 | index_height << 12);
+}
+
+static void ubo_aux_take(void)
+{
+    int want = atomic_exchange(&g_aux_want, -1);
+
+    if (want < 0)
+        return;
+    g_aux_mask = want & UBO_AUX_ALL;
+    if ((want >> 3) & 511)
+        g_aux_index_w = (want >> 3) & 511;
+    if (want >> 12)
+        g_aux_index_h = want >> 12;
+    rdepth = g_aux_mask & UBO_AUX_DEPTH ? g_aux_depth : NULL;
+    rlabels = g_aux_mask & UBO_AUX_LABELS ? g_aux_labels : NULL;
+    g_aux_frame.mask = 0;
+}
+
+// After D_Display: sample the index frame and note where the view was.
+static void ubo_aux_publish(int drew_view)
+{
+    ubo_aux_frame_t* f = &g_aux_frame;
+    int x, y;
+
+    if (g_aux_mask & UBO_AUX_INDEX) {
+        for (y = 0; y < g_aux_index_h; y++) {
+            const byte* src = screens[0] + ((2 * y + 1) * screenheight / (2 * g_aux_index_h)) * SCREENWIDTH;
+            uint8_t* dst = g_aux_index + y * g_aux_index_w;
+
+            for (x = 0; x < g_aux_index_w; x++)
+                dst[x] = src[(2 * x + 1) * screenwidth / (2 * g_aux_index_w)];
+        }
+    }
+    f->seq++;
+    f->mask = g_aux_mask;
+    f->index = g_aux_mask & UBO_AUX_INDEX ? g_aux_index : NULL;
+    f->index_width = g_aux_index_w;
+    f->index_height = g_aux_index_h;
+    f->view_x = viewwindowx;
+    f->view_y = viewwindowy;
+    f->view_width = drew_view ? viewwidth : 0;
+    f->view_height = drew_view ? viewheight : 0;
+    f->view_detail = detailshift;
+    f->depth = rdepth;
+    f->labels = rlabels;
+    f->label_stride = SCREENWIDTH;
+}
+
+int ubo_aux_wants_index(void)
+{
+    return (g_aux_mask & UBO_AUX_INDEX) != 0;
+}
+
+int doom_get_aux_frame(ubo_aux_frame_t* out)
+{
+    if (g_inited != 1 || !g_aux_frame.mask || !out)
+        return -1;
+    *out = g_aux_frame;
+    return 0;
+}
+
+// The tics a spectator has beyond the next few run on top of the one it
+// was asked for, quietly when it is far behind (joining a game under way).
+static void doom_spectate_catchup(void)
+{
+    int extra = I_SpectateCatchup();
+    int quiet = extra > 1 && !g_simulating;
+
+    if (quiet)
+        S_SetQuiet(true);
+    while (extra-- > 0 && g_inited == 1 && !levelloading && I_SpectateReady())
+        doom_sim_tic();
+    if (quiet)
+        S_SetQuiet(false);
+}
+
+static void doom_run_tic(int run_sim, int render)
+{
+    struct timespec t0, t_sim, t_render, t_end;
+    int levelstart = levelstarttic;
+    int loading = levelloading;
+
+    if (g_inited != 1) return;
+    I_ThreadPoll(UBO_THREAD_TIC);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ubo_prof_tic_begin();
+    ubo_zone_tic();
+
+    // Arm the crash jump so SIGSEGV/SIGBUS and I_Error during the tick are
+    // caught here rather than killing the host process (ubo_app).  The
+    // handler stays installed from doom_init; neither jump buffer saves the
+    // signal mask, so arming them costs no syscall.
+    ubo_error_jmp_valid = 1;
+    doom_arm_crash_jmp();
+
+    if (sigsetjmp(g_crash_jmp, 0) != 0) {
+        // SIGSEGV or SIGBUS mid-tick.
+        doom_unblock_crash_signals();
+        g_crash_jmp_valid = 0;
+        ubo_error_jmp_valid = 0;
+        g_inited = -1;
+        doom_note_crash(g_crash_sig);
+        ubo_status_update(ubo_elapsed_us(&t0));
+        ubo_game_event_died(g_crash_cause);
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_tick aborted via signal (SIGSEGV/SIGBUS)\n");
+        G_WriteJournal();
+        return;
+    }
+
+    if (setjmp(ubo_error_jmp) != 0) {
+        // I_Error mid-tick (e.g. Z_Malloc failure during level load).
+        g_crash_jmp_valid = 0;
+        ubo_error_jmp_valid = 0;
+        g_inited = -1;
+        doom_note_crash(-1);
+        ubo_status_update(ubo_elapsed_us(&t0));
+        ubo_game_event_died(g_crash_cause);
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_tick aborted via I_Error\n");
+        G_WriteJournal();
+        return;
+    }
+
+    // One "outer loop" iteration of D_DoomLoop(), singletics path.
+    // This mirrors d_main.c's singletics branch exactly: run 1 tic per
+    // doom_tick call with no spin-waits, so the Kivy main thread is never
+    // blocked waiting for real-time tics to accumulate.
+    I_StartFrame();
+    // A spectator holds until the game it mirrors sends the next tic.
+    I_SpectatePoll();
+    if (run_sim && !levelloading && !I_SpectateReady())
+        run_sim = 0;
+    if (run_sim) {
+        doom_sim_tic();
+        doom_spectate_catchup();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_sim);
+
+    // Skipping D_Display on some tics is what D_DoomLoop does whenever
+    // TryRunTics runs more than one tic per frame, so its wipe/border state
+    // tracking copes with it.  The governor drops more of them at level 3.
+    ubo_aux_take();
+    if (render && I_GovernorKeepFrame()) {
+        int frames = framecount;
+
+        D_Display();
+        if (g_aux_mask)
+            ubo_aux_publish(framecount != frames);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_render);
+
+    // Mixing/submission stays on every sim tic so audio never starves.
+    if (run_sim && !g_simulating)
+    {
+        UBO_PROF_BEGIN(UBO_PROF_UPDATE_SOUND);
+        I_UpdateSound();
+        UBO_PROF_END(UBO_PROF_UPDATE_SOUND);
+        UBO_PROF_BEGIN(UBO_PROF_SUBMIT_SOUND);
+        I_SubmitSound();
+        UBO_PROF_END(UBO_PROF_SUBMIT_SOUND);
+    }
+
+    g_crash_jmp_valid = 0;
+    ubo_error_jmp_valid = 0;
+
+    ubo_prof_tic_end();
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    loading |= levelloading || levelstarttic != levelstart;
+    if (!g_simulating && !loading) {
+        ubo_deadline_tic(&t0, &t_sim, &t_render, &t_end);
+        // Under virtual time the tic cost nothing as far as anything that
+        // changes the game's look goes, so the governor stays reproducible.
+        I_GovernorTic(virtualtime ? 0 : ubo_span_us(&t0, &t_end), run_sim);
+        I_MemoryTic(run_sim);
+    } else if (loading) {
+        g_advance_loaded = 1;
+    }
+    ubo_status_update(ubo_span_us(&t0, &t_end));
+    // level events once the level is complete
+    if (!g_simulating && !levelloading)
+        ubo_game_events_tic();
+    if (run_sim)
+        I_AdvanceTime(0, 1);
+}
+
+void doom_tick(void)
+{
+    // While the native scheduler owns the engine, host-driven ticks would
+    // race with it; ignore them.
+    if (atomic_load(&g_async_running)) return;
+    doom_run_tic(1, (g_sim_tics++ % (unsigned)g_render_divisor) == 0);
+}
+
+void doom_tick_ex(int run_sim, int render)
+{
+    if (atomic_load(&g_async_running)) return;
+    doom_run_tic(run_sim, render);
+}
+
+int doom_set_catchup(int max_tics, int backlog_tics)
+{
+    if (max_tics < 1 || max_tics > UBO_CATCHUP_MAX_TICS
+        || backlog_tics < 0 || backlog_tics > UBO_CATCHUP_MAX_BACKLOG)
+        return -1;
+    g_catchup_tics = max_tics;
+    g_catchup_backlog = backlog_tics;
+    return 0;
+}
+
+int doom_set_load_budget(int budget_ms)
+{
+    if (budget_ms < 0 || budget_ms > UBO_LOAD_MAX_BUDGET_MS)
+        return -1;
+    levelloadbudget = budget_ms * 1000;
+    return 0;
+}
+
+int doom_advance(uint32_t elapsed_us, int render)
+{
+    const uint32_t tic_us = 1000000u / TICRATE;
+    uint64_t cap;
+    int tics;
+
+    if (atomic_load(&g_async_running)) return -1;
+    if (g_inited != 1) return 0;
+
+    // Whatever the tics this call runs still leave owed beyond the
+    // backlog is dropped, as is the time a level load just took.
+    if (g_advance_loaded) {
+        g_advance_loaded = 0;
+        g_advance_us %= tic_us;
+        elapsed_us = 0;
+    }
+    cap = (uint64_t)(g_catchup_tics + g_catchup_backlog + 1) * tic_us - 1;
+    g_advance_us += elapsed_us;
+    if (g_advance_us > cap) {
+        g_catchup_dropped += (uint32_t)((g_advance_us - cap) / tic_us);
+        g_advance_us = cap;
+    }
+    tics = (int)(g_advance_us / tic_us);
+    if (tics > g_catchup_tics)
+        tics = g_catchup_tics;
+    g_advance_us -= (uint64_t)tics * tic_us;
+
+    // The frame lands g_advance_us into the tic after the last one run;
+    // draw it that far from the tic before the last to the last.  Still
+    // behind, it shows the last tic as it is.
+    interpfrac = interpolation && g_advance_us < tic_us
+        ? (fixed_t)((g_advance_us << FRACBITS) / tic_us)
+        : FRACUNIT;
+    for (int i = 0; i < tics; i++)
+        doom_run_tic(1, render && i == tics - 1);
+    if (render && tics == 0)
+        doom_run_tic(0, 1);
+    interpfrac = FRACUNIT;
+    return tics;
+}
+
+void doom_set_interpolation(int enabled) { interpolation = enabled != 0; }
+int doom_get_interpolation(void) { return interpolation; }
+
+int doom_set_time_source(ubo_time_source_t source)
+{
+    if (source != UBO_TIME_MONOTONIC && source != UBO_TIME_VIRTUAL)
+        return -1;
+    if (atomic_load(&g_async_running)) return -1;
+    I_SetVirtualTime(source == UBO_TIME_VIRTUAL);
+    return 0;
+}
+
+ubo_time_source_t doom_get_time_source(void)
+{
+    return virtualtime ? UBO_TIME_VIRTUAL : UBO_TIME_MONOTONIC;
+}
+
+int doom_advance_time(uint32_t us)
+{
+    if (!virtualtime || atomic_load(&g_async_running)) return -1;
+    I_AdvanceTime(us, 0);
+    return 0;
+}
+
+uint64_t doom_get_time_us(void) { return (uint64_t)I_GetTimeUs(); }
+
+uint32_t doom_state_hash(void)
+{
+    return P_StateHash();
+}
+
+uint32_t doom_get_frame_hash(void)
+{
+    uint32_t h = 2166136261u;
+    const byte* row;
+    int x, y;
+
+    if (g_inited != 1 || !screens[0])
+        return 0;
+    I_Direct565ToIndex();
+    for (y = 0; y < screenheight; y++) {
+        row = screens[0] + y * SCREENWIDTH;
+        for (x = 0; x < screenwidth; x++)
+            h = (h ^ row[x]) * 16777619u;
+    }
+    return h;
+}
+
+int doom_simulate(int tics, uint32_t* hashes)
+{
+    int n;
+    int budget;
+
+    // A netgame can't run ahead of the other players.
+    if (g_inited != 1 || atomic_load(&g_async_running) || netgame) return -1;
+
+    g_simulating = 1;
+    budget = levelloadbudget;
+    levelloadbudget = 0;
+    S_SetQuiet(true);
+    for (n = 0; n < tics && g_inited == 1; n++) {
+        doom_run_tic(1, 0);
+        if (g_inited != 1)
+            break;
+        if (hashes)
+            hashes[n] = doom_state_hash();
+    }
+    if (g_inited == 1)
+        S_SetQuiet(false);
+    levelloadbudget = budget;
+    g_simulating = 0;
+    return n;
+}
+
+void doom_set_render_divisor(int divisor) { g_render_divisor = divisor > 0 ? divisor : 1; }
+int doom_get_render_divisor(void) { return g_render_divisor; }
+
+void doom_set_quality_level(int level) { I_GovernorPin(level); }
+int doom_get_quality_level(void) { return I_GovernorLevel(); }
+
+int doom_set_thread_policy(ubo_thread_t thread, uint64_t cpus, int priority)
+{
+    return I_ThreadSetPolicy((int)thread, cpus, priority);
+}
+
+static void timespec_add_ns(struct timespec* ts, long ns)
+{
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= 1000000000L) {
+        ts->tv_nsec -= 1000000000L;
+        ts->tv_sec++;
+    }
+    while (ts->tv_nsec < 0) {
+        ts->tv_nsec += 1000000000L;
+        ts->tv_sec--;
+    }
+}
+
+static long timespec_diff_ns(const struct timespec* a, const struct timespec* b)
+{
+    return (long)(a->tv_sec - b->tv_sec) * 1000000000L + (a->tv_nsec - b->tv_nsec);
+}
+
+// Sleep until the tic deadline.  Within early_ns of it the scheduler naps in
+// 1 ms steps instead and starts the tic as soon as input is waiting, so a
+// key press is sampled up to early_ns sooner.  The deadlines themselves
+// don't move, so the next tic just waits that much longer and the tic rate
+// stays the same.
+static void doom_async_wait(const struct timespec* deadline, long early_ns)
+{
+    struct timespec wake = *deadline, now;
+    long left;
+
+    if (early_ns > 0) {
+        timespec_add_ns(&wake, -early_ns);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+            ;
+        for (;;) {
+            if (atomic_load_explicit(&g_input_pending, memory_order_acquire) > 0)
+                return;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left = timespec_diff_ns(deadline, &now);
+            if (left <= 0)
+                return;
+            wake = now;
+            timespec_add_ns(&wake, left < 1000000L ? left : 1000000L);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+                ;
+        }
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR)
+        ;
+}
+
+// Idle mode's sleep: block until the deadline or until input is posted,
+// whichever comes first.  Returns 1 when input woke it.
+static int doom_idle_wait(const struct timespec* deadline)
+{
+    int woke = 0;
+    int rc;
+
+    atomic_store(&g_idle_sleeping, 1);
+    for (;;) {
+        if (atomic_load(&g_input_pending) > 0 || atomic_load(&g_async_stop)) {
+            woke = 1;
+            break;
+        }
+        rc = (int)syscall(SYS_futex, &g_input_pending, FUTEX_WAIT_BITSET_PRIVATE, 0,
+                          deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+        if (rc < 0 && errno == ETIMEDOUT)
+            break;
+    }
+    atomic_store(&g_idle_sleeping, 0);
+    return woke;
+}
+
+static void* doom_async_main(void* arg)
+{
+    const long period_ns = 1000000000L / g_async_hz;
+    long early_ns = (long)g_input_early_ms * 1000000L;
+    struct timespec next, now;
+    int idle = 0;
+    int batch = 1;
+    int tics;
+
+    if (early_ns > period_ns / 2)
+        early_ns = period_ns / 2;
+    if (g_idle_hz > 0 && g_idle_hz < g_async_hz)
+        batch = g_async_hz / g_idle_hz;
+    if (batch > UBO_ADVANCE_MAX_TICS)
+        batch = UBO_ADVANCE_MAX_TICS;
+
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!atomic_load(&g_async_stop))
+    {
+        // Idle, the tics due over the batch run back to back and only the
+        // last is drawn; the frame it draws is due when the batch ends.
+        tics = idle ? batch : 1;
+        g_tic_due_ns = (int64_t)next.tv_sec * 1000000000LL + next.tv_nsec + tics * period_ns;
+        for (int i = 0; i < tics && g_inited == 1; i++) {
+            int render = (g_sim_tics++ % (unsigned)g_render_divisor) == 0;
+            doom_run_tic(1, idle ? i == tics - 1 : render);
+        }
+        g_tic_due_ns = 0;
+        ubo_state_post_if_changed();
+        if (g_inited != 1)
+            break;  // engine died; the host sees alive=0 in the state queue
+
+        // Absolute deadlines: sleep overshoot does not accumulate as drift.
+        // If we fall far behind (e.g. a level load), resync rather than
+        // running a burst of catch-up tics.
+        timespec_add_ns(&next, tics * period_ns);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timespec_diff_ns(&now, &next) > 4 * period_ns)
+            next = now;
+        idle = ubo_idle();
+        if (virtualtime) {
+            // Virtual time has no wall clock to keep up with: each tic
+            // moved it on, so the next one is due at once.
+            next = now;
+        } else if (!idle) {
+            doom_async_wait(&next, early_ns);
+        } else if (doom_idle_wait(&next)) {
+            // A key press runs its tic now and leaves idle mode (the
+            // grace starts when the tic takes it); the schedule restarts
+            // from here.
+            clock_gettime(CLOCK_MONOTONIC, &next);
+            idle = 0;
+        }
+    }
+    return NULL;
+}
+
+int doom_run_async(int hz)
+{
+    if (g_inited != 1) return -1;
+    if (atomic_load(&g_async_running)) return 0;
+
+    g_async_hz = hz > 0 ? hz : TICRATE;
+    g_state_last_valid = 0;  // report the current state as the first event
+    atomic_store(&g_async_stop, 0);
+    atomic_store(&g_async_running, 1);
+    if (pthread_create(&g_async_thread, NULL, doom_async_main, NULL) != 0) {
+        atomic_store(&g_async_running, 0);
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_run_async: pthread_create failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+void doom_stop_async(void)
+{
+    if (!atomic_load(&g_async_running)) return;
+
+    atomic_store(&g_async_stop, 1);
+    if (atomic_load(&g_idle_sleeping))
+        syscall(SYS_futex, &g_input_pending, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    pthread_join(g_async_thread, NULL);
+    atomic_store(&g_async_running, 0);
+}
+
+int doom_is_async(void) { return atomic_load(&g_async_running); }
+
+int doom_game_event_fd(void)
+{
+    pthread_once(&g_game_ev_once, ubo_game_event_open);
+    return g_game_ev_fd;
+}
+
+int doom_poll_game_events(ubo_game_event_t* out, int max)
+{
+    unsigned tail = atomic_load_explicit(&g_game_ev_tail, memory_order_relaxed);
+    unsigned head;
+    uint64_t count;
+    int n = 0;
+
+    if (!out) return 0;
+    // Clear the fd before draining: an event posted after this read makes
+    // it readable again, at worst for a drain that finds nothing.
+    pthread_once(&g_game_ev_once, ubo_game_event_open);
+    if (g_game_ev_fd >= 0 && read(g_game_ev_fd, &count, sizeof(count)) < 0) {
+        // EAGAIN: nothing was signalled since the last drain
+    }
+    head = atomic_load_explicit(&g_game_ev_head, memory_order_acquire);
+    while (tail != head && n < max) {
+        out[n++] = g_game_ev_q[tail & (UBO_GAME_EVENT_QUEUE - 1)];
+        tail++;
+    }
+    atomic_store_explicit(&g_game_ev_tail, tail, memory_order_release);
+    // out was too small for all of them: stay readable for the rest
+    ubo_game_event_signal(tail != head);
+    return n;
+}
+
+int doom_poll_state_events(ubo_state_event_t* out, int max)
+{
+    unsigned tail = atomic_load_explicit(&g_state_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&g_state_head, memory_order_acquire);
+    int n = 0;
+
+    if (!out) return 0;
+    while (tail != head && n < max) {
+        out[n++] = g_state_q[tail & (UBO_STATE_QUEUE - 1)];
+        tail++;
+    }
+    atomic_store_explicit(&g_state_tail, tail, memory_order_release);
+    return n;
+}
+
+// Session state D_DoomMain builds on rather than sets: cleared so the next
+// doom_init() starts like the first one.
+static void doom_clear_session(void)
+{
+    // the next session's first tic reports where it starts
+    g_game_seen.valid = 0;
+    // a mirrored session ends with the engine; doom_init starts it again
+    doom_spectate_stop();
+
+    // Clear the WAD file list so D_AddFile() starts from index 0 on the next
+    // init — without this, each re-init appends the IWAD again and again,
+    // causing duplicate lump registrations.  D_AddFile malloc'd the names.
+    for (int i = 0; i < MAXWADFILES; i++)
+        free(wadfiles[i]);
+    memset(wadfiles, 0, sizeof(wadfiles));
+
+    // Reset tic counters to avoid NetUpdate: netbuffer->numtics > BACKUPTICS.
+    // gametic and maketic carry over from the last session and cause the
+    // net tic buffer difference check to immediately fire on the next run.
+    gametic = 0;
+    maketic = 0;
+
+    // The thinkers lived in the zone; nothing may walk them before a level loads.
+    P_InitThinkers();
+    gamestate = GS_DEMOSCREEN;
+    gameaction = ga_nothing;
+    loadinggame = false;
+
+    ubo_status_update(0);
+
+    // Held keys belong to the last session.
+    memset(g_key_hold, 0, sizeof(g_key_hold));
+}
+
+void doom_shutdown(void)
+{
+    doom_stop_async();
+    doom_lcd_close();
+    if (!g_inited) return;
+    doom_capture_stop();
+    doom_stream_stop();
+    I_ShutdownSpectate();
+    doom_hdmi_close();
+    I_FrameShmStop();
+
+    // Do NOT call I_Quit() (it exits the process). Just shut down sound,
+    // after telling the other players in a netgame that we left.
+    D_QuitNetGame();
+    I_ShutdownNetwork();
+    I_ShutdownSound();
+    I_ShutdownMusic();
+    W_CancelPrefetch();
+    // Close a recording with its end marker so it plays back cleanly.
+    if (demorecording)
+        G_CheckDemoStatus();
+    M_FinishWrites();
+    M_FinishScreenShots();
+    R_FreeComposites();
+    R_FreeSpriteData();
+    R_FreeDataCache();
+    R_ShutdownRenderThreads();
+    P_ShutdownSightThreads();
+    P_ShutdownLoadThreads();
+    P_FreeLevelCache();
+    G_FreeSnapshots();
+    V_Shutdown();
+    I_ShutdownGraphics();
+    // Every lump pointer goes with the WADs and the zone.
+    W_Shutdown();
+    Z_Shutdown();
+    doom_clear_session();
+    g_inited = 0;
+    g_prewarmed = 0;
+    g_suspended = 0;
+    I_LogStop();
+}
+
+void doom_key_down(ubo_key_t key)
+{
+    ubo_event_t ev = { (int)key, 1, 0 };
+    ubo_input_push(&ev);
+}
+
+void doom_key_up(ubo_key_t key)
+{
+    ubo_event_t ev = { (int)key, 0, 0 };
+    ubo_input_push(&ev);
+}
+
+int doom_post_events(const ubo_event_t* evs, int n)
+{
+    int i;
+
+    if (!evs) return 0;
+    for (i = 0; i < n; i++) {
+        if (!ubo_input_push(&evs[i]))
+            break;
+    }
+    return i;
+}
+
+void doom_release_all_keys(void)
+{
+    ubo_event_t ev = { UBO_KEY_NONE, 0, 0 };
+    ubo_input_push(&ev);
+}
+
+void doom_set_log_level(int level) { ubo_log_level = level; }
+int doom_get_log_level(void) { return ubo_log_level; }
+int doom_read_log(char* buf, int size) { return buf && size > 0 ? I_LogRead(buf, size) : 0; }
+
+const uint8_t* doom_get_rgba_ptr(void) { return ubo_rgba; }
+int doom_get_rgba_width(void) { return screenwidth; }
+int doom_get_rgba_height(void) { return screenheight; }
+int doom_is_alive(void) { return g_inited == 1; }
+
+void doom_set_output_format(ubo_output_format_t fmt)
+{
+    switch (fmt)
+    {
+        case UBO_OUTPUT_RGBA8888:
+        case UBO_OUTPUT_RGB565_BE:
+        case UBO_OUTPUT_INDEX8:
+            if (fmt != g_output_format)
+            {
+                // RGB565 frame was not kept up to date
+                g_dirty_lcd.valid = 0;
+                g_dirty_cb.valid = 0;
+            }
+            g_output_format = fmt;
+            break;
+        default:
+            UBO_LOG(UBO_LOG_ERROR, "[doom] doom_set_output_format: unknown format %d ignored\n", (int)fmt);
+            break;
+    }
+}
+
+ubo_output_format_t doom_get_output_format(void) { return g_output_format; }
+uint16_t* ubo_frame_begin(int layout)
+{
+    if (g_frame_ring_layout[g_frame_back] != layout)
+    {
+        memset(g_frame_ring[g_frame_back], 0, sizeof(g_frame_ring[0]));
+        g_frame_ring_layout[g_frame_back] = layout;
+    }
+    return g_frame_ring[g_frame_back];
+}
+
+void ubo_frame_static(int region, int y0, int y1, int changed)
+{
+    if (y0 < 0 || y1 <= y0)
+    {
+        g_frame_ring_static[g_frame_back][region] = 0;
+        return;
+    }
+    if (changed || g_frame_static_gen[region] == 0)
+        if (++g_frame_static_gen[region] == 0)
+            g_frame_static_gen[region] = 1;
+    g_frame_ring_static_y0[g_frame_back][region] = y0;
+    g_frame_ring_static_y1[g_frame_back][region] = y1;
+    g_frame_ring_static[g_frame_back][region] = g_frame_static_gen[region];
+}
+
+void ubo_frame_publish(void)
+{
+    unsigned seq = atomic_load_explicit(&g_frame_seq, memory_order_relaxed) + 1;
+
+    g_frame_ring_seq[g_frame_back] = seq;
+    g_frame_published = g_frame_back;
+    // Release: pixel + seq writes become visible before the slot does.
+    g_frame_back = atomic_exchange_explicit(&g_frame_mid, g_frame_back | UBO_FRAME_FRESH,
+                                            memory_order_acq_rel) & ~UBO_FRAME_FRESH;
+    atomic_store_explicit(&g_frame_seq, seq, memory_order_release);
+    ubo_lcd_notify();
+}
+
+int ubo_frame_wanted(void)
+{
+    return atomic_exchange_explicit(&g_frame_wanted, 0, memory_order_acq_rel);
+}
+
+// Consumer side: take over the hand-over slot if the engine published since
+// the last swap.  Returns the slot the consumer now owns.
+static int ubo_frame_refresh(void)
+{
+    if (atomic_load_explicit(&g_frame_mid, memory_order_acquire) & UBO_FRAME_FRESH)
+        g_frame_front = atomic_exchange_explicit(&g_frame_mid, g_frame_front,
+                                                 memory_order_acq_rel) & ~UBO_FRAME_FRESH;
+    return g_frame_front;
+}
+
+int doom_acquire_frame(ubo_frame_t* out)
+{
+    int slot;
+
+    if (!out) return -1;
+    if (g_frame_held) return -1;
+
+    slot = ubo_frame_refresh();
+    if (g_frame_ring_seq[slot] == 0 || g_frame_ring_seq[slot] == g_frame_acquired_seq)
+        return 0;
+
+    g_frame_acquired_seq = g_frame_ring_seq[slot];
+    g_frame_held = 1;
+    out->data = (const uint8_t*)g_frame_ring[slot];
+    out->size = (int)sizeof(g_frame_ring[slot]);
+    out->width = UBO_LCD_WIDTH;
+    out->height = UBO_LCD_HEIGHT;
+    out->seq = g_frame_acquired_seq;
+    return 1;
+}
+
+void doom_release_frame(void) { g_frame_held = 0; }
+
+uint32_t doom_get_frame_seq(void)
+{
+    return atomic_load_explicit(&g_frame_seq, memory_order_acquire);
+}
+
+// The legacy pointer/copy/dirty helpers below act on the consumer slot too,
+// so they never race with the engine writing the next frame.  They must not
+// be mixed with an outstanding doom_acquire_frame() from another thread.
+static int ubo_frame_consumer_slot(void)
+{
+    return g_frame_held ? g_frame_front : ubo_frame_refresh();
+}
+
+const uint8_t* doom_get_rgb565_ptr(void)
+{
+    return (const uint8_t*)g_frame_ring[ubo_frame_consumer_slot()];
+}
+
+int doom_get_rgb565_size(void) { return (int)sizeof(g_frame_ring[0]); }
+
+int doom_copy_rgb565(uint8_t* dst, int dst_size)
+{
+    return doom_copy_frame_into(dst, dst_size, UBO_OUTPUT_RGB565_BE);
+}
+
+int doom_copy_frame_into(void* dst, int dst_size, ubo_output_format_t fmt)
+{
+    const void* src;
+    int size;
+
+    switch (fmt)
+    {
+        case UBO_OUTPUT_RGBA8888:
+            src = ubo_rgba;
+            size = screenwidth * screenheight * 4;
+            break;
+        case UBO_OUTPUT_RGB565_BE:
+            src = doom_get_rgb565_ptr();
+            size = (int)sizeof(g_frame_ring[0]);
+            break;
+        case UBO_OUTPUT_INDEX8:
+            src = ubo_index8;
+            size = screenwidth * screenheight;
+            break;
+        default:
+            return -1;
+    }
+    if (!dst || dst_size < size) return -1;
+    memcpy(dst, src, (size_t)size);
+    return size;
+}
+
+void doom_set_scale_filter(ubo_scale_filter_t filter)
+{
+    switch (filter)
+    {
+        case UBO_SCALE_NEAREST:
+        case UBO_SCALE_AREA2:
+        case UBO_SCALE_BOX:
+            g_scale_filter = filter;
+            break;
+        default:
+            UBO_LOG(UBO_LOG_ERROR, "[doom] doom_set_scale_filter: unknown filter %d ignored\n", (int)filter);
+            break;
+    }
+}
+
+ubo_scale_filter_t doom_get_scale_filter(void) { return g_scale_filter; }
+
+void doom_set_lcd_orientation(ubo_rotation_t rotation, int mirror)
+{
+    switch (rotation)
+    {
+        case UBO_ROTATE_0:
+        case UBO_ROTATE_90:
+        case UBO_ROTATE_180:
+        case UBO_ROTATE_270:
+            g_lcd_orientation = (int)rotation | (mirror ? 4 : 0);
+            break;
+        default:
+            UBO_LOG(UBO_LOG_ERROR, "[doom] doom_set_lcd_orientation: unknown rotation %d ignored\n", (int)rotation);
+            break;
+    }
+}
+
+ubo_rotation_t doom_get_lcd_rotation(void) { return (ubo_rotation_t)(g_lcd_orientation & 3); }
+int doom_get_lcd_mirror(void) { return (g_lcd_orientation >> 2) & 1; }
+
+void doom_set_direct565(int enabled) { direct565 = enabled != 0; }
+int doom_get_direct565(void) { return direct565; }
+
+void doom_invalidate_dirty(void)
+{
+    g_dirty_lcd.valid = 0;
+    g_dirty_cb.valid = 0;
+    atomic_store_explicit(&g_frame_wanted, 1, memory_order_release);
+}
+
+// The row bands of ring slot `slot` that differ from ref's frame, which
+// then becomes a copy of it.
+static int ubo_dirty_bands(ubo_dirty_ref_t* ref, int slot, ubo_rect_t* out, int max)
+{
+    const int row_bytes = UBO_LCD_WIDTH * (int)sizeof(uint16_t);
+    const uint16_t* frame = g_frame_ring[slot];
+    const uint32_t* gen = g_frame_ring_static[slot];
+    int skip_y0[UBO_STATIC_REGIONS];
+    int skip_y1[UBO_STATIC_REGIONS];
+    int n = 0;
+    int band_start = -1;
+    int band_end = -1;
+
+    if (!ref->valid)
+    {
+        memcpy(ref->prev, frame, sizeof(ref->prev));
+        ref->valid = 1;
+        memcpy(ref->gen, gen, sizeof(ref->gen));
+        out[0].x0 = 0;
+        out[0].y0 = 0;
+        out[0].x1 = UBO_LCD_WIDTH - 1;
+        out[0].y1 = UBO_LCD_HEIGHT - 1;
+        return 1;
+    }
+
+    // A region with the same generation as in the reference: its rows
+    // match it.
+    for (int r = 0; r < UBO_STATIC_REGIONS; r++)
+    {
+        skip_y0[r] = skip_y1[r] = UBO_LCD_HEIGHT;
+        if (gen[r] && gen[r] == ref->gen[r])
+        {
+            skip_y0[r] = g_frame_ring_static_y0[slot][r];
+            skip_y1[r] = g_frame_ring_static_y1[slot][r];
+        }
+        ref->gen[r] = gen[r];
+    }
+
+    for (int y = 0; y < UBO_LCD_HEIGHT; y++)
+    {
+        const uint16_t* cur = frame + y * UBO_LCD_WIDTH;
+        uint16_t* prev = ref->prev + y * UBO_LCD_WIDTH;
+        int r;
+
+        for (r = 0; r < UBO_STATIC_REGIONS; r++)
+            if (y >= skip_y0[r] && y < skip_y1[r])
+                break;
+        if (r < UBO_STATIC_REGIONS)
+            continue;
+        if (memcmp(cur, prev, row_bytes) == 0)
+            continue;
+        memcpy(prev, cur, row_bytes);
+
+        if (band_start >= 0 && y - band_end > UBO_DIRTY_MERGE_GAP)
+        {
+            if (n < max - 1)
+            {
+                out[n].x0 = 0;
+                out[n].y0 = band_start;
+                out[n].x1 = UBO_LCD_WIDTH - 1;
+                out[n].y1 = band_end;
+                n++;
+                band_start = y;
+            }
+            // else: out of slots, keep extending the last band.
+        }
+        if (band_start < 0)
+            band_start = y;
+        band_end = y;
+    }
+
+    if (band_start >= 0)
+    {
+        out[n].x0 = 0;
+        out[n].y0 = band_start;
+        out[n].x1 = UBO_LCD_WIDTH - 1;
+        out[n].y1 = band_end;
+        n++;
+    }
+    return n;
+}
+
+int doom_get_dirty_rects(ubo_rect_t* out, int max)
+{
+    if (!out || max <= 0) return 0;
+    return ubo_dirty_bands(&g_dirty_lcd, ubo_frame_consumer_slot(), out, max);
+}
+
+void doom_set_frame_callback(ubo_frame_callback_t fn, void* user)
+{
+    pthread_mutex_lock(&g_frame_cb_lock);
+    g_frame_cb = fn;
+    g_frame_cb_user = user;
+    g_dirty_cb.valid = 0;   // a new sink starts from the whole frame
+    pthread_mutex_unlock(&g_frame_cb_lock);
+}
+
+void ubo_frame_done(int format)
+{
+    ubo_frame_info_t info;
+
+    g_frame_shown++;
+    if (!g_frame_cb)
+        return;
+
+    pthread_mutex_lock(&g_frame_cb_lock);
+    if (g_frame_cb)
+    {
+        info.format = (ubo_output_format_t)format;
+        info.rects = g_frame_cb_rects;
+        if (format == UBO_OUTPUT_RGB565_BE)
+        {
+            // The engine gets this slot back at the next publish at the
+            // earliest, after the callback has returned.
+            info.data = (const uint8_t*)g_frame_ring[g_frame_published];
+            info.width = UBO_LCD_WIDTH;
+            info.height = UBO_LCD_HEIGHT;
+            info.stride = UBO_LCD_WIDTH * (int)sizeof(uint16_t);
+            info.seq = g_frame_ring_seq[g_frame_published];
+            info.num_rects = ubo_dirty_bands(&g_dirty_cb, g_frame_published,
+                                             g_frame_cb_rects, UBO_FRAME_CB_RECTS);
+        }
+        else
+        {
+            int index8 = format == UBO_OUTPUT_INDEX8;
+
+            info.data = index8 ? ubo_index8 : ubo_rgba;
+            info.width = screenwidth;
+            info.height = screenheight;
+            info.stride = index8 ? screenwidth : screenwidth * 4;
+            info.seq = g_frame_shown;
+            info.num_rects = 1;
+            g_frame_cb_rects[0].x0 = 0;
+            g_frame_cb_rects[0].y0 = 0;
+            g_frame_cb_rects[0].x1 = screenwidth - 1;
+            g_frame_cb_rects[0].y1 = screenheight - 1;
+        }
+        g_frame_cb(&info, g_frame_cb_user);
+    }
+    pthread_mutex_unlock(&g_frame_cb_lock);
+}
+// Timedemo state: written on the tic thread by ubo_timedemo_done().
+static int g_timedemo_active = 0;
+static int g_timedemo_done = 0;
+static int g_timedemo_gametic0 = 0;
+static ubo_timedemo_t g_timedemo;
+
+int doom_timedemo(const char* demo, int blit)
+{
+    static char name[9];
+
+    if (g_inited != 1 || !demo) return -1;
+    strncpy(name, demo, 8);
+    name[8] = '\0';
+    if (W_CheckNumForName(name) < 0) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_timedemo: no lump %s\n", name);
+        return -1;
+    }
+
+    // A pending D_DoAdvanceDemo would reset gameaction before the demo starts.
+    advancedemo = false;
+    G_TimeDemo(name);
+    // G_TimeDemo reads -nodraw/-noblit from argv; we have neither.
+    nodrawers = false;
+    noblit = !blit;
+
+    memset(&g_timedemo, 0, sizeof(g_timedemo));
+    g_timedemo_gametic0 = gametic;
+    g_timedemo_done = 0;
+    g_timedemo_active = 1;
+    return 0;
+}
+
+void ubo_timedemo_done(int realtics)
+{
+    if (!g_timedemo_active) return;
+    g_timedemo.gametics = (uint32_t)(gametic - g_timedemo_gametic0);
+    g_timedemo.realtics = (uint32_t)realtics;
+    g_timedemo_active = 0;
+    g_timedemo_done = 1;
+    noblit = false;
+}
+
+int doom_timedemo_result(ubo_timedemo_t* out)
+{
+    if (!g_timedemo_done) return 0;
+    if (out) *out = g_timedemo;
+    return 1;
+}
+
+int doom_get_gamestate(void) { return (int)gamestate; }
+int doom_get_menuactive(void) { return menuactive ? 1 : 0; }
+
+void doom_get_status(ubo_status_t* out)
+{
+    const volatile ubo_status_t* st = &g_status;
+    uint32_t v0, v1;
+
+    if (!out) return;
+    do {
+        v0 = st->version;
+        atomic_thread_fence(memory_order_acquire);
+        memcpy(out, (const void*)st, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        v1 = st->version;
+    } while ((v0 & 1) || v0 != v1);
+}
+
+const ubo_status_t* doom_get_status_ptr(void) { return &g_status; }
+
+void doom_reset_deadline_stats(void) { atomic_store(&g_deadline_want_reset, 1); }
+
+int doom_get_zone_stats(ubo_zone_stats_t* out)
+{
+    zonestats_t zs;
+
+    if (!out || g_inited != 1) return -1;
+    Z_ZoneStats(&zs);
+    out->size = zs.size;
+    out->free = zs.free;
+    out->free_blocks = zs.freeblocks;
+    out->largest_free = zs.largestfree;
+    out->purgable = zs.purgable;
+    out->slabs = zs.slabs;
+    out->slab_used = zs.slabused;
+    out->slab_free = zs.slabfree;
+    out->arena_size = zs.arenasize;
+    out->arena_used = zs.arenaused;
+    return 0;
+}
+
+void doom_set_zone_profile(int every)
+{
+    atomic_store(&g_zone_want_profile, every > 0 ? every : 0);
+}
+
+int doom_zone_report(char* buf, int size)
+{
+    if (g_inited != 1 || size < 0 || (size && !buf)) return -1;
+    return Z_ProfileReport(buf, size);
+}
+
+int doom_zone_dump(const char* path)
+{
+    FILE* f;
+
+    if (g_inited != 1 || !path) return -1;
+    f = fopen(path, "w");
+    if (!f) return -1;
+    Z_FileDumpHeap(f);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void doom_set_zone_limits(int base_mb, int max_mb)
+{
+    g_zone_base_mb = base_mb;
+    g_zone_max_mb = max_mb;
+}
+
+void doom_set_memory_budget(int mb)
+{
+    g_memory_mb = mb;
+}
+
+int doom_add_pwad(const char* path)
+{
+    if (g_inited > 0) return -1;
+    if (!path) {
+        while (g_num_pwads > 0)
+            free(g_pwads[--g_num_pwads]);
+        return 0;
+    }
+    // -file takes words up to the next option, so no leading '-'
+    if (path[0] == '\0' || path[0] == '-' || access(path, R_OK) != 0
+        || g_num_pwads == UBO_MAX_PWADS)
+        return -1;
+    g_pwads[g_num_pwads] = strdup(path);
+    if (!g_pwads[g_num_pwads]) return -1;
+    return ++g_num_pwads;
+}
+
+int doom_set_config(const char* key, const char* value)
+{
+    if (g_inited > 0) return -1;
+    return M_SetConfig(key, value) ? 0 : -1;
+}
+
+int doom_get_config(const char* key, char* buf, int size)
+{
+    if (!key || !buf || size <= 0) return -1;
+    return M_GetConfig(key, buf, size);
+}
+
+int doom_get_memstats(ubo_memstats_t* out)
+{
+    zonestats_t zs;
+    memreport_t mr;
+
+    if (!out || g_inited != 1) return -1;
+    Z_ZoneStats(&zs);
+    out->zone_bytes = zs.size;
+    out->max_bytes = zonemaxsize > zs.size ? zonemaxsize : zs.size;
+    out->zones = zs.zones;
+    out->used = zs.used;
+    out->high_water = zs.highwater;
+    out->purges = zs.purges;
+    out->largest_free = zs.largestfree;
+    out->free = zs.free;
+    I_MemoryReport(&mr);
+    out->budget = mr.budget;
+    out->footprint = mr.footprint;
+    out->zone_resident = mr.zone;
+    out->wad_resident = mr.wad;
+    out->composite_bytes = mr.composites;
+    out->arena_bytes = mr.arena;
+    out->process_rss = mr.process;
+    out->trims = mr.trims;
+    return 0;
+}
+
+int doom_get_composite_stats(ubo_composite_stats_t* out)
+{
+    if (!out || g_inited != 1) return -1;
+    out->textures = numcomposites;
+    out->bytes = compositebytes;
+    out->limit = compositelimit;
+    out->hits = compositehits;
+    out->misses = compositemisses;
+    out->prebuilt = compositeprebuilt;
+    out->evictions = compositeevictions;
+    return 0;
+}
+
+int doom_get_audio_stats(ubo_audio_stats_t* out)
+{
+    if (!out || g_inited != 1) return -1;
+    ubo_audio_stats(out);
+    return 0;
+}
+
+void doom_reset_audio_stats(void)
+{
+    ubo_audio_stats_reset();
+}
+
+int doom_get_pool_stats(ubo_pool_stats_t* out)
+{
+    if (!out || g_inited != 1) return -1;
+    out->visplanes = visplanepeak;
+    out->drawsegs = drawsegpeak;
+    out->vissprites = visspritepeak;
+    out->intercepts = interceptpeak;
+    out->spechits = spechitpeak;
+    return 0;
+}
+
+void doom_get_profile(ubo_profile_t* out)
+{
+    const volatile ubo_profile_t* pub = &g_profile;
+    uint32_t v0, v1;
+
+    if (!out) return;
+    do {
+        v0 = pub->version;
+        atomic_thread_fence(memory_order_acquire);
+        memcpy(out, (const void*)pub, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        v1 = pub->version;
+    } while ((v0 & 1) || v0 != v1);
+}
+
+void doom_set_profile_enabled(int enabled)
+{
+    atomic_store(&g_prof_want_enabled, enabled ? 1 : 0);
+}
+
+void doom_reset_profile(void) { atomic_store(&g_prof_want_reset, 1); }
+
+void doom_set_trace_enabled(int events) { I_TraceSetEnabled(events); }
+
+int doom_trace_dump(const char* path)
+{
+    int written;
+
+    if (!path)
+        return -1;
+    written = I_TraceDump(path);
+    if (written < 0)
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_trace_dump: can't write %s\n", path);
+    else
+        UBO_LOG(UBO_LOG_INFO, "[doom] doom_trace_dump: %d events to %s\n", written, path);
+    return written;
+}
+
+int doom_get_save_status(uint32_t* seq)
+{
+    unsigned done;
+    int state = M_WriteStatus(&done);
+
+    if (seq) *seq = done;
+    return state;
+}
+
+int doom_screenshot(const char* path, int lcd)
+{
+    if (g_inited != 1 || !path || !*path) return -1;
+    if (M_ScreenShotStatus(NULL) == M_WRITE_BUSY) return -1;
+    return I_RequestScreenShot(path, lcd != 0) ? 0 : -1;
+}
+
+int doom_get_screenshot_status(uint32_t* seq)
+{
+    unsigned done;
+    int state = M_ScreenShotStatus(&done);
+
+    if (seq) *seq = done;
+    return state;
+}
+
+int doom_rewind(int seconds)
+{
+    if (g_inited != 1 || seconds <= 0) return -1;
+    atomic_store(&g_want_rewind, seconds);
+    return 0;
+}
+
+int doom_snapshot_save(void)
+{
+    if (g_inited != 1) return -1;
+    atomic_store(&g_want_quick, 1);
+    return 0;
+}
+
+int doom_snapshot_load(void)
+{
+    if (g_inited != 1) return -1;
+    atomic_store(&g_want_quick, 2);
+    return 0;
+}
+
+static int doom_demo_request(const char* path, int want)
+{
+    if (g_inited != 1 || !path || !path[0]
+        || strlen(path) >= sizeof(g_demo_path))
+        return -1;
+    // M_MapFile gives up with I_Error on a missing file; catch it here.
+    if (want == 2 && access(path, R_OK) != 0)
+        return -1;
+    strcpy(g_demo_path, path);
+    atomic_store(&g_want_demo, want);
+    return 0;
+}
+
+int doom_demo_record(const char* path)
+{
+    return doom_demo_request(path, 1);
+}
+
+int doom_demo_play(const char* path)
+{
+    return doom_demo_request(path, 2);
+}
+
+int doom_demo_stop(void)
+{
+    if (g_inited != 1) return -1;
+    atomic_store(&g_want_demo, 3);
+    return 0;
+}
+
+int doom_get_demo_state(void)
+{
+    if (g_inited != 1) return 0;
+    return demorecording ? 1 : demoplayback ? 2 : 0;
+}
+
+void doom_reset(void)
+{
+    // Allow doom_init() to run again after a mid-tick crash.
+    // Z_Init() in the next D_DoomMain() clears and reuses the zone (and drops
+    // any chained zones); all other globals are re-initialised there too.
+    doom_stop_async();
+    // The composite worker reads texture tables the next Z_Init frees.
+    R_FreeComposites();
+    R_FreeSpriteData();
+    // Snapshots belong to the crashed session; a save in flight still lands.
+    G_ClearSnapshots();
+    M_FinishWrites();
+    M_FinishScreenShots();
+    g_inited = 0;
+    g_prewarmed = 0;
+    g_suspended = 0;
+    g_reset_count++;
+    ubo_error_jmp_valid = 0;
+    g_crash_jmp_valid = 0;
+
+    // The zone, WADs and screens are reused by the next D_DoomMain; the video
+    // backend and everything else D_DoomMain doesn't reset start over here.
+    I_ShutdownGraphics();
+    doom_clear_session();
 
-    fprintf(stderr, "[doom] doom_reset: engine state cleared, ready for re-init\n");
+    UBO_LOG(UBO_LOG_INFO, "[doom] doom_reset: engine state cleared, ready for re-init\n");
 }
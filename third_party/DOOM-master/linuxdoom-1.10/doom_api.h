@@ -7,19 +7,229 @@
 extern "C" {
 #endif
 
+// Everything declared here stays visible although the rest of the library is
+// built with -fvisibility=hidden; libubodoom.map then trims the exports to
+// doom_*, ubo_rgba and ubo_library_mode.
+#pragma GCC visibility push(default)
+
 // When non-zero, D_DoomMain will return after initialization (instead of entering D_DoomLoop).
 extern int ubo_library_mode;
 
 // Framebuffer produced by i_video_ubo.c (320x200 RGBA8888)
 extern uint8_t ubo_rgba[320 * 200 * 4];
 
+// Palette indices produced by i_video_ubo.c for UBO_OUTPUT_INDEX8
+// (screenwidth x screenheight, packed)
+extern uint8_t ubo_index8[320 * 200];
+
+// Non-zero lets i_video_ubo.c pick a NEON/SSE2 pixel conversion kernel when
+// the CPU has one (UBO_DOOM_SIMD, default on); zero forces the plain C loops.
+extern int ubo_video_simd;
+
+// Non-zero lets i_video_ubo.c reuse the last frame's RGB565 status bar rows
+// when nothing on the bar changed (UBO_DOOM_STATUSBAR_CACHE, default on).
+extern int ubo_video_sbarcache;
+
+// Non-zero lets i_video_ubo.c reuse the last frame's RGB565 rows above and
+// below a shrunk view while the border there is unchanged
+// (UBO_DOOM_BORDER_CACHE, default on).
+extern int ubo_video_bordercache;
+
+// Non-zero lets D_Display compare menu, pause, intermission and title screens
+// with the last frame and skip converting and publishing an identical one
+// (UBO_DOOM_SKIP_STATIC, default on).
+extern int ubo_video_skipstatic;
+
+// Non-zero adds the sound effects of the level's things to the lump prefetch
+// R_PrecacheLevel starts (UBO_DOOM_SFX_PREFETCH, default on).
+extern int ubo_sfx_prefetch;
+
+// LCD geometry for the native RGB565 output: 320x200 is scaled to 240x150 and
+// letterboxed into 240x240 (45px black bars top and bottom).
+#define UBO_LCD_WIDTH          240
+#define UBO_LCD_HEIGHT         240
+#define UBO_LCD_ACTIVE_HEIGHT  150
+#define UBO_LCD_PAD_TOP        ((UBO_LCD_HEIGHT - UBO_LCD_ACTIVE_HEIGHT) / 2)
+
+// RGB565 frames (240x240, big-endian byte order, ready for the ST7789) are
+// produced into a ring of UBO_FRAME_RING buffers so a consumer on another
+// thread never sees a half-written frame.  i_video_ubo.c renders into the
+// buffer returned by ubo_frame_begin() and hands it over with
+// ubo_frame_publish(); consumers use doom_acquire_frame()/doom_release_frame().
+#define UBO_FRAME_RING 3
+
+// layout is the LCD orientation (rotation | mirror << 2) the frame is drawn
+// with; a buffer last drawn with another one is cleared to black first,
+// since the letterbox bars, which are never drawn, moved.
+uint16_t* ubo_frame_begin(int layout);
+void ubo_frame_publish(void);
+
+// Called before ubo_frame_publish(): static region `region` (the status
+// bar, or a band of view border above or below the view) covers LCD rows y0
+// to y1 - 1 (y0 -1 for none, or when it doesn't span whole rows) and
+// changed says whether they differ from the last frame's.
+// doom_get_dirty_rects() skips comparing rows it knows are unchanged.
+enum {
+    UBO_STATIC_STATUSBAR,
+    UBO_STATIC_BORDER_TOP,
+    UBO_STATIC_BORDER_BOTTOM,
+    UBO_STATIC_REGIONS
+};
+void ubo_frame_static(int region, int y0, int y1, int changed);
+
+// Returns 1 once after doom_invalidate_dirty(): the consumer wants a new
+// frame published even if the picture has not changed since the last one.
+int ubo_frame_wanted(void);
+
+// True while doom_set_aux_buffers() asks for UBO_AUX_INDEX: it samples the
+// 8-bit screen, so the view has to be drawn there (doom_set_direct565()).
+int ubo_aux_wants_index(void);
+
+// Called by ubo_frame_publish() to wake the native display sink.
+void ubo_lcd_notify(void);
+
+// Called at the end of I_FinishUpdate for each frame it showed in format:
+// runs the doom_set_frame_callback() sink.
+void ubo_frame_done(int format);
+
 // Minimal embedded API.
 int doom_init(const char* iwad_path);
 void doom_tick(void);
 void doom_shutdown(void);
 
+// Run doom_init()'s engine start-up (WAD, tables, zone, title screen) ahead of
+// time, e.g. from a background thread when the app starts, without opening
+// the sound device, the frame shm or the capture.  The next doom_init() only
+// starts those and returns.  Safe to call while another thread calls
+// doom_init(), which waits for it.  -1 on failure or with UBO_DOOM_NET set.
+int doom_prewarm(const char* iwad_path);
+int doom_is_prewarmed(void);  // 1 between doom_prewarm() and doom_init()
+
+// doom_init() in steps, for a host that shows start-up progress.
+// doom_init_begin() reads the settings and the command line (0, or -1 as
+// doom_init() fails); each doom_init_step() then runs engine start-up
+// phases (V_Init, W_Init, R_Init, ...) until one has taken it past
+// budget_ms (0 = all that remain; a phase under way always finishes) and
+// returns the percent done, 100 once the engine is up as after doom_init(),
+// or -1 if start-up failed.  doom_init() or doom_prewarm() in between
+// finishes the phases in one go.  The phases' times, kept from the last
+// start-up and logged at INFO when it completes, tell which one dominates
+// a cold start: doom_init_phase_name() is NULL past the last phase and
+// doom_init_phase_us() is -1 for one that has not run.
+int doom_init_begin(const char* iwad_path);
+int doom_init_step(int budget_ms);
+const char* doom_init_phase_name(int phase);
+int doom_init_phase_us(int phase);
+
+// While the app is in the background: stop the sound effects and music,
+// close the PCM, and hand back what is rebuilt on first use (PU_CACHE
+// lumps, the free zone pages, composites, flattened patches and resident
+// WAD pages).  doom_resume(), or the next doom_init(), reopens the PCM and
+// unpauses the music; the rest refills lazily.  The game itself is kept.
+// -1 before doom_init() or while doom_run_async() runs.  Call between
+// tics, like doom_rewind().
+int doom_suspend(void);
+int doom_resume(void);
+int doom_is_suspended(void);
+
+// doom_tick() split: run_sim runs input + G_Ticker + sound for one tic,
+// render runs D_Display (BSP, drawing, palette conversion).  Use render=0 for
+// tics whose frame would never be displayed.
+void doom_tick_ex(int run_sim, int render);
+
+// Render only every Nth tic in doom_tick() and doom_run_async() (default 1).
+void doom_set_render_divisor(int divisor);
+int doom_get_render_divisor(void);
+
+// Quality governor (UBO_DOOM_GOVERNOR=1, default): under load or above
+// UBO_DOOM_GOVERNOR_TEMP (75 C) it steps from full quality (0) to low
+// detail (1), a view two sizes smaller (2), every other frame drawn (3)
+// and unfuzzed shadows (4), and back once there is room again.  level
+// 0..4 holds that level, -1 hands it back to the governor.  Applied by
+// the next tic; safe from any thread.
+void doom_set_quality_level(int level);
+int doom_get_quality_level(void);
+
+// Thread classes for doom_set_thread_policy().
+typedef enum ubo_thread_e {
+    UBO_THREAD_TIC = 0,      // doom_run_async()'s scheduler, or the thread calling doom_tick()
+    UBO_THREAD_AUDIO = 1,    // the ALSA writer (UBO_DOOM_AUDIO_THREAD)
+    UBO_THREAD_DISPLAY = 2,  // the native LCD sink (doom_lcd_open) and HDMI output (doom_hdmi_open)
+    UBO_THREAD_RENDER = 3,   // the view strip workers (UBO_DOOM_RENDER_THREADS)
+    UBO_THREAD_NUM
+} ubo_thread_t;
+
+// Where a class of engine threads runs: cpus is a mask (bit n = CPU n, 0 =
+// any CPU), priority 1..99 runs them SCHED_FIFO at that priority and 0
+// SCHED_OTHER.  Each thread moves itself at its next loop, including ones
+// started later; SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO, and a
+// refusal is logged, not fatal.  doom_init() reads UBO_DOOM_TIC_POLICY,
+// UBO_DOOM_AUDIO_POLICY, UBO_DOOM_DISPLAY_POLICY and UBO_DOOM_RENDER_POLICY
+// ("CPUS[:PRIO]", e.g. "3:20" or "2-3").  Returns 0, -1 for a bad argument.
+int doom_set_thread_policy(ubo_thread_t thread, uint64_t cpus, int priority);
+
+// Fixed-timestep pacing for a host loop running at its own rate: adds
+// elapsed_us of wall time to an accumulator, runs the whole 35 Hz tics it
+// covers, at most the catch-up limit, then renders one frame if render is
+// set.  With interpolation on (UBO_DOOM_INTERPOLATE, default) that frame
+// shows things and the view the leftover fraction of the way from the tic
+// before the last to the last, so motion stays smooth at any frame rate.
+// Returns the tics run, -1 while doom_run_async() owns the engine.
+int doom_advance(uint32_t elapsed_us, int render);
+
+// doom_advance() after a stall: each call runs at most max_tics tics
+// (default UBO_ADVANCE_MAX_TICS), and up to backlog_tics more tics of owed
+// time (default 35) carry over to the calls after it, so game time catches
+// up over the next frames without a frame drawing a long burst.  A longer
+// stall, or the time a level load took, is dropped.  backlog_tics 0 keeps
+// only what the call itself runs.  UBO_DOOM_CATCHUP="TICS[:BACKLOG]" sets
+// it at doom_init().  -1 for max_tics outside 1..UBO_CATCHUP_MAX_TICS or
+// backlog_tics outside 0..UBO_CATCHUP_MAX_BACKLOG.
+#define UBO_ADVANCE_MAX_TICS 4
+#define UBO_CATCHUP_MAX_TICS 35
+#define UBO_CATCHUP_MAX_BACKLOG 350
+int doom_set_catchup(int max_tics, int backlog_tics);
+
+// Level loads in steps: a restart after death, the next map or a new game
+// from the menu builds the level at most budget_ms per tic (a step that is
+// under way always finishes), showing the last frame with a progress bar
+// meanwhile; the game's own tics resume once the level is complete.
+// ubo_status_t.load_pct follows it.  0 loads in one go, as netgames, demos
+// and doom_simulate() always do.  UBO_DOOM_LOAD_BUDGET_MS sets it at
+// doom_init() (default UBO_LOAD_BUDGET_MS); -1 outside 0..UBO_LOAD_MAX_BUDGET_MS.
+#define UBO_LOAD_BUDGET_MS 10
+#define UBO_LOAD_MAX_BUDGET_MS 1000
+int doom_set_load_budget(int budget_ms);
+void doom_set_interpolation(int enabled);
+int doom_get_interpolation(void);
+
+// The clock the engine's timing-dependent behaviour runs on: I_GetTime()
+// (the screen wipe outside library mode, -timedemo's realtics, the menu's
+// mouse and joystick repeat), the staged level load budget, idle mode's
+// grace and doom_run_async()'s pacing.  UBO_TIME_MONOTONIC (default) is
+// CLOCK_MONOTONIC.  UBO_TIME_VIRTUAL only moves one tic with each tic
+// run, plus what doom_advance_time() adds, so a harness runs as fast as
+// the CPU allows and sees the same timing every run: a level loads in one
+// tic, the quality governor sees tics that took no time, and
+// doom_run_async() runs tics back to back.  Profiling, deadline stats and
+// input lag still measure wall time.  Switching carries on from the time
+// the other clock had reached.  -1 for another value or while
+// doom_run_async() owns the engine.
+typedef enum {
+    UBO_TIME_MONOTONIC = 0,
+    UBO_TIME_VIRTUAL = 1,
+} ubo_time_source_t;
+
+int doom_set_time_source(ubo_time_source_t source);
+ubo_time_source_t doom_get_time_source(void);
+// Moves the virtual clock on by us without running a tic, e.g. for idle
+// time between tics; -1 on the monotonic clock or under doom_run_async().
+int doom_advance_time(uint32_t us);
+uint64_t doom_get_time_us(void);  // the engine clock, microseconds
+
 // Input (a tiny stable enum that we map to doomkeys.h internally).
 typedef enum ubo_key_e {
+    UBO_KEY_NONE = 0,
     UBO_KEY_UP = 1,
     UBO_KEY_DOWN = 2,
     UBO_KEY_LEFT = 3,
@@ -28,27 +238,875 @@ typedef enum ubo_key_e {
     UBO_KEY_USE = 6,      // maps to Space
     UBO_KEY_ESCAPE = 7,        // maps to Esc
     UBO_KEY_MENU_SELECT = 8,  // maps to KEY_ENTER — only safe for menus, not in-game
+    UBO_KEY_MAP = 9,          // maps to Tab: the automap, or its overlay (UBO_DOOM_AUTOMAP_OVERLAY)
 } ubo_key_t;
 
+// Key events are queued and handed to the engine right before the next tic
+// builds its ticcmd.  The queue is lock-free and safe to post to from any
+// number of host threads, e.g. straight from a keypad callback, including
+// while doom_run_async() is active; the scheduler starts a tic up to
+// UBO_DOOM_INPUT_EARLY_MS (default 8) early when input is waiting.
 void doom_key_down(ubo_key_t key);
 void doom_key_up(ubo_key_t key);
 
+// Batched input.  hold_tics > 0 is a tap: key down now (unless already held)
+// and auto key-up after hold_tics tics, counted inside the engine; tapping a
+// held key restarts its countdown, and tapping UP/DOWN releases the opposite
+// direction.  hold_tics == 0 is a plain key down (down=1, held until key up)
+// or key up (down=0).
+typedef struct ubo_event_s {
+    int key;         // ubo_key_t
+    int down;        // only used when hold_tics == 0
+    int hold_tics;
+} ubo_event_t;
+
+// Queue n events; returns how many were accepted (the rest hit a full queue).
+int doom_post_events(const ubo_event_t* evs, int n);
+
+// Queue a key-up for every key the engine currently considers held.
+void doom_release_all_keys(void);
+
+// Direct ticcmd for bots: while set, every tic's command for the console
+// player is this one instead of what the keys build.  forwardmove and
+// sidemove are -50..50 (a held key gives 25 walking, 50 running),
+// angleturn is in 1/65536 turns, positive to the left, and weapon 1..8
+// asks for weapon_t weapon - 1 (1 fist ... 7 BFG, 8 chainsaw) the way the
+// number keys do; 0 keeps the current one.  NULL goes back
+// to keyboard input.  Call between tics, from the thread running them.
+#define UBO_TICCMD_ATTACK 1
+#define UBO_TICCMD_USE    2
+
+typedef struct ubo_ticcmd_s {
+    int8_t forwardmove;
+    int8_t sidemove;
+    int16_t angleturn;
+    uint8_t buttons;     // UBO_TICCMD_*
+    uint8_t weapon;
+} ubo_ticcmd_t;
+
+void doom_set_ticcmd(const ubo_ticcmd_t* cmd);
+
+// Log verbosity: 0 = errors only, 1 = info (default), 2 = per-event debug.
+// Initialised from UBO_DOOM_LOG_LEVEL by doom_init().
+void doom_set_log_level(int level);
+int doom_get_log_level(void);
+// Diagnostics are formatted into an in-memory ring (256 lines of up to 255
+// bytes) without blocking or a syscall, and a libubodoom thread writes them to
+// stderr every 100 ms.  The first doom_read_log() stops that: the host then
+// drains the ring itself.  Copies whole lines, oldest first, into buf (keep it
+// at least 256 bytes) and returns the bytes copied, 0 when there is nothing
+// new.  Lines lost to a full ring are reported in a "log: N lines dropped" line.
+int doom_read_log(char* buf, int size);
+
 // Accessors for ctypes.
 const uint8_t* doom_get_rgba_ptr(void);
 int doom_get_rgba_width(void);
 int doom_get_rgba_height(void);
 
+// Output format written by I_FinishUpdate. Only the selected buffer is
+// updated each frame; the default is RGBA8888 for backwards compatibility.
+typedef enum ubo_output_format_e {
+    UBO_OUTPUT_RGBA8888 = 0,   // ubo_rgba, 320x200x4 (240x150x4 with UBO_DOOM_LCD_RES=1)
+    UBO_OUTPUT_RGB565_BE = 1,  // frame ring, 240x240x2, letterboxed
+    UBO_OUTPUT_INDEX8 = 2,     // ubo_index8, 320x200x1 palette indices (240x150 with UBO_DOOM_LCD_RES=1)
+} ubo_output_format_t;
+
+void doom_set_output_format(ubo_output_format_t fmt);
+ubo_output_format_t doom_get_output_format(void);
+
+// Latest complete RGB565 frame.  The pointer changes as frames are
+// published; re-fetch it every frame (or use doom_acquire_frame()).
+const uint8_t* doom_get_rgb565_ptr(void);
+int doom_get_rgb565_size(void);  // bytes: 240*240*2
+
+// Lock-free triple buffering for a single consumer thread.  On success the
+// frame stays untouched by the engine until doom_release_frame().
+typedef struct ubo_frame_s {
+    const uint8_t* data;
+    int size;        // bytes
+    int width;
+    int height;
+    uint32_t seq;    // monotonically increasing, 1 = first published frame
+} ubo_frame_t;
+
+// Returns 1 and fills *out if a frame newer than the last acquired one is
+// available, 0 if there is nothing new (skip the push), or -1 if the previous
+// frame has not been released yet.
+int doom_acquire_frame(ubo_frame_t* out);
+void doom_release_frame(void);
+uint32_t doom_get_frame_seq(void);  // seq of the most recently published frame
+
+// Copy the current RGB565 LCD frame into a caller-owned buffer (e.g. a
+// preallocated Python bytearray).  Returns bytes copied, or -1 if dst_size is
+// smaller than doom_get_rgb565_size().
+int doom_copy_rgb565(uint8_t* dst, int dst_size);
+
+// Copy the current frame in any output format into a caller-owned buffer:
+// the RGB565 frame as doom_copy_rgb565() does, ubo_rgba
+// (doom_get_rgba_width() * doom_get_rgba_height() * 4 bytes) or ubo_index8
+// (one byte a pixel).  Only the format selected with doom_set_output_format()
+// is kept up to date.  Returns bytes copied, or -1 for an unknown format or a
+// dst_size that is too small.
+int doom_copy_frame_into(void* dst, int dst_size, ubo_output_format_t fmt);
+
+// The palette the last UBO_OUTPUT_INDEX8 frame is shown with: 256 RGB565
+// entries in the frames' big-endian byte order, gamma and damage/pickup
+// tints applied, so a consumer turns ubo_index8 into an LCD frame with one
+// table lookup a pixel.  The version counts palette changes (0 before the
+// first INDEX8 frame); copy the palette again only when it moves.
+// doom_copy_palette565() returns bytes copied (512), or -1 for a dst_size
+// that is too small.  Both belong to the thread running the tics, like
+// doom_copy_frame_into().
+uint32_t doom_get_palette_version(void);
+int doom_copy_palette565(void* dst, int dst_size);
+
+// Downscale filter used by the RGB565 output (320x200 -> 240x150).
+typedef enum ubo_scale_filter_e {
+    UBO_SCALE_NEAREST = 0,  // nearest neighbour (cheapest, default)
+    UBO_SCALE_AREA2 = 1,    // 2-tap average of nearest + next pixel per axis
+    UBO_SCALE_BOX = 2,      // exact 4:3 box filter (3:1, 2:2, 1:3 weights)
+} ubo_scale_filter_t;
+
+void doom_set_scale_filter(ubo_scale_filter_t filter);
+ubo_scale_filter_t doom_get_scale_filter(void);
+
+// How the RGB565 frame is turned to match the way the panel is mounted,
+// applied while scaling, so it costs nothing extra per frame.  Rotations
+// are clockwise; mirror flips left and right before the rotation.  The
+// letterbox bars turn with the picture, and the frame shm gets the frame
+// as the LCD does.  The RGBA output and screenshots stay upright.
+// UBO_DOOM_LCD_ROTATION (0/90/180/270) and UBO_DOOM_LCD_MIRROR set it at
+// doom_init().
+typedef enum ubo_rotation_e {
+    UBO_ROTATE_0 = 0,
+    UBO_ROTATE_90 = 1,
+    UBO_ROTATE_180 = 2,
+    UBO_ROTATE_270 = 3,
+} ubo_rotation_t;
+
+void doom_set_lcd_orientation(ubo_rotation_t rotation, int mirror);
+ubo_rotation_t doom_get_lcd_rotation(void);
+int doom_get_lcd_mirror(void);
+
+// Direct RGB565 rendering: the 3D view is drawn straight into RGB565 through
+// colormaps with the palette applied, and the RGB565 frame copies it (1:1 at
+// UBO_DOOM_LCD_RES, nearest-sampled otherwise) instead of converting every
+// pixel.  Only frames that need nothing else in 8 bits go that way: a level
+// with no automap, menu or pause, at high detail without
+// UBO_DOOM_TRANSPOSED_VIEW, RGB565 output with the nearest filter (or
+// UBO_DOOM_LCD_RES), and no capture, stream or UBO_AUX_INDEX.  All other
+// frames are drawn as before.  The spectre fuzz darkens by a fixed ratio
+// instead of through colormap 6.  Off by default; UBO_DOOM_DIRECT565=1
+// turns it on at doom_init().
+void doom_set_direct565(int enabled);
+int doom_get_direct565(void);
+
+// Dirty-region tracking for the RGB565 LCD frame.  Rectangles use the ubo
+// display convention of inclusive coordinates (x0,y0,x1,y1).
+typedef struct ubo_rect_s {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} ubo_rect_t;
+
+// Report the full-width row bands of the RGB565 frame that changed since the
+// previous call (or since doom_invalidate_dirty()), then remember the current
+// frame as the new reference.  Bands closer than a few rows are merged, and
+// anything beyond `max` is folded into the last rect.  Returns the number of
+// rects written (0 = nothing changed, skip the blit).
+int doom_get_dirty_rects(ubo_rect_t* out, int max);
+
+// Force the next doom_get_dirty_rects() to report the whole LCD, e.g. after
+// something other than Doom has drawn to the display.  A static screen is
+// published once more so there is a frame to report.
+void doom_invalidate_dirty(void);
+
+// Push-based frames: fn(frame, user) runs at the end of every I_FinishUpdate
+// that showed a new frame, on the thread running the tic, so a consumer
+// needs no polling after doom_tick().  The frame is the output format's
+// (doom_set_output_format()): the RGB565 ring slot just published, or the
+// RGBA or palette-index buffer.  Everything *frame points to is read-only and valid only
+// until fn returns; copy out what has to outlive it.  rects are the row bands
+// changed since the frame fn was last given, tracked separately from
+// doom_get_dirty_rects() so both can be used (the whole frame for RGBA, and
+// for the first frame after setting fn or doom_invalidate_dirty()).  A
+// static screen isn't shown again, so fn isn't called for it either.
+// One callback at a time; NULL removes it.  Setting it waits for a call
+// in flight, so after doom_set_frame_callback(NULL, NULL) returns, user can
+// be freed.  fn must not call doom_set_frame_callback() or run tics, and
+// should return quickly; a consumer with several sinks fans out from it.
+typedef struct ubo_frame_info_s {
+    ubo_output_format_t format;
+    const uint8_t* data;
+    int width;
+    int height;
+    int stride;              // bytes from one row to the next
+    uint32_t seq;            // doom_get_frame_seq()'s for RGB565, counts shown frames otherwise
+    int num_rects;
+    const ubo_rect_t* rects;
+} ubo_frame_info_t;
+
+typedef void (*ubo_frame_callback_t)(const ubo_frame_info_t* frame, void* user);
+
+void doom_set_frame_callback(ubo_frame_callback_t fn, void* user);
+
+// Native display sink (i_lcd_ubo.c): a thread inside the library sends each
+// published RGB565 frame's dirty bands to the ST7789 itself, through an
+// fbtft framebuffer ("/dev/fb1") or raw spidev ("/dev/spidev0.0", D/C on
+// UBO_DOOM_LCD_DC_GPIO).  The consumer side of the frame ring is then the
+// sink's: don't call doom_acquire_frame()/doom_get_dirty_rects() while it is
+// active.  Needs UBO_OUTPUT_RGB565_BE.  Returns 0, or -1 (logged) if the
+// device can't be used.  doom_lcd_active() turns 0 if a write fails later.
+int doom_lcd_open(const char* device);
+void doom_lcd_close(void);
+int doom_lcd_active(void);
+
+// Gameplay capture (i_capture_ubo.c): a thread inside the library feeds each
+// shown frame to a V4L2 memory-to-memory H.264 encoder (UBO_DOOM_CAPTURE_DEVICE,
+// default /dev/video11) and writes the Annex B stream to `output`: a file, a
+// FIFO (opened on the thread, so it may wait for its reader) or
+// "udp:host:port".  Frames are dropped, never queued, while the encoder or
+// the output is behind.  doom_init() starts it from UBO_DOOM_CAPTURE and
+// doom_shutdown() stops it.  Returns 0, or -1 (logged) if the encoder can't
+// be set up; doom_capture_active() turns 0 if the output fails later.
+int doom_capture_start(const char* output);
+void doom_capture_stop(void);
+int doom_capture_active(void);
+
+// Remote framebuffer stream (i_stream_ubo.c, wire format in framestream.h):
+// a thread inside the library sends each shown 8-bit frame to one viewer
+// over TCP, XORed against the frame the viewer already has and RLE-coded,
+// plus the palette whenever it changes.  `output` is "tcp:host:port" to
+// connect out (retried every second) or "tcp::port" to listen for the
+// viewer.  Frames are dropped, never queued, while the viewer is behind.
+// doom_init() starts it from UBO_DOOM_STREAM and doom_shutdown() stops it.
+// Returns 0, or -1 (logged) if `output` is malformed or the port can't be
+// bound.
+int doom_stream_start(const char* output);
+void doom_stream_stop(void);
+int doom_stream_active(void);
+
+// Spectator mirroring (i_spectate_ubo.c, wire format in spectate.h): instead
+// of frames, a game sends a spectator each tic's ticcmds over UDP, plus the
+// skill, map, settings and P_Random index each new game starts from, and a
+// playsim hash once a second.  The spectator runs the simulation and renders
+// it itself, in lockstep: a few dozen bytes a tic instead of kilobytes a
+// frame.
+// - doom_mirror_start("udp:host:port") sends the game to a spectator (a
+//   broadcast address reaches all of them), from the next G_InitNew: a new
+//   game or demo.  A loaded savegame or rewind can't be mirrored; the
+//   spectators wait for the next new game.
+// - doom_spectate_start("udp::port") listens for a game.  The spectator
+//   joins the session it hears about, from the start (the game keeps 30
+//   minutes to answer resend requests from), runs behind the game at most
+//   a few tics, and holds while the next tic hasn't arrived.  Local input
+//   is ignored; starting or loading a game of its own leaves the session.
+// - A check point whose hash differs counts as a desync (logged once a
+//   session); the spectator keeps going, there is nothing to resync from.
+// doom_init() starts them from UBO_DOOM_MIRROR / UBO_DOOM_SPECTATE,
+// doom_reset() and doom_shutdown() stop them.  Returns 0, or -1 (logged) if
+// the address is malformed, the port can't be bound or the other role is
+// running.
+typedef struct ubo_spectate_stats_s {
+    int role;                   // 0 off, 1 mirroring, 2 spectating
+    int following;              // spectator: 1 while it runs the game's session
+    uint32_t session;           // the session's id, from the game
+    uint32_t tics;              // tics sent (game) or run (spectator) this session
+    uint32_t behind;            // spectator: tics the game is known to be ahead
+    uint32_t packets;           // datagrams sent (game) or received (spectator)
+    uint32_t bytes;
+    uint32_t resends;           // resend requests answered (game) or sent
+    uint32_t hash_checks;       // spectator: check points compared
+    uint32_t desyncs;           // ...that differed
+    uint32_t desync_tic;        // the first of them this session, ~0u if none
+} ubo_spectate_stats_t;
+
+int doom_mirror_start(const char* target);
+int doom_spectate_start(const char* source);
+void doom_spectate_stop(void);  // either role
+int doom_get_spectate_stats(ubo_spectate_stats_t* out);
+
+// HDMI output for docked mode (i_drm_ubo.c): drives the first connected
+// display on a KMS `device` ("/dev/dri/card0") at its preferred mode, or
+// UBO_DOOM_HDMI_MODE ("1280x720"), with the frame scaled to a centred 4:3
+// picture.  A thread double-buffers and page-flips on vblank, so the output
+// never tears; a frame it hasn't shown by then is replaced by the next.
+// doom_init() opens it from UBO_DOOM_HDMI and doom_shutdown() closes it,
+// giving the display back its console mode.  Returns 0, or -1 (logged) if
+// there's no connected display, the mode can't be set (another process is
+// DRM master) or the library was built without DRM.
+int doom_hdmi_open(const char* device);
+void doom_hdmi_close(void);
+int doom_hdmi_active(void);
+
 // Returns 1 if the engine is healthy, 0 otherwise (init failed or died mid-tick).
 int doom_is_alive(void);
 
+// Native tick scheduler: runs the doom_tick() body on a dedicated pthread,
+// paced with clock_nanosleep(TIMER_ABSTIME) at `hz` tics/sec (<= 0 means
+// TICRATE, 35).  While it runs, doom_tick() is a no-op.  Returns 0 on success,
+// -1 if the engine is not initialised or the thread could not be started.
+// In the menu, paused or on a title page it wakes only about
+// UBO_DOOM_IDLE_HZ (default 10, 0 = never) times a second, runs the tics
+// due in one go and blocks on the input queue in between; a posted event
+// wakes it at once (ubo_status_t.idle).
+int doom_run_async(int hz);
+void doom_stop_async(void);   // blocks until the scheduler thread has exited
+int doom_is_async(void);
+
+// Engine state change reported by the scheduler thread (alive, gamestate or
+// menuactive differ from the previous event).  The first event after
+// doom_run_async() is always the current state.
+typedef struct ubo_state_event_s {
+    int alive;
+    int gamestate;   // -1 when not alive
+    int menuactive;
+    uint32_t gametic;
+} ubo_state_event_t;
+
+// Drain up to `max` pending state events (single consumer).  Returns count.
+int doom_poll_state_events(ubo_state_event_t* out, int max);
+
+// Typed game events, posted after every tic (doom_tick, doom_advance or the
+// native scheduler) for what the tic changed, and by a tic that crashed.
+// The first tic of a session reports its starting point (LEVEL_START when
+// that is a level, MENU_OPEN when a menu is up).
+typedef enum {
+    UBO_GAME_EVENT_LEVEL_START = 1,   // data0 episode, data1 map; also restarts
+    UBO_GAME_EVENT_LEVEL_EXIT = 2,    // data0 the gamestate it left for
+    UBO_GAME_EVENT_INTERMISSION = 3,  // data0 episode, data1 map just finished
+    UBO_GAME_EVENT_MENU_OPEN = 4,
+    UBO_GAME_EVENT_MENU_CLOSE = 5,
+    UBO_GAME_EVENT_PLAYER_DEATH = 6,  // data0 the player
+    UBO_GAME_EVENT_SAVE_DONE = 7,     // data0 1 = written, 0 = failed
+    UBO_GAME_EVENT_ENGINE_DIED = 8    // data0 the crash cause, as in ubo_status_t
+} ubo_game_event_type_t;
+
+typedef struct ubo_game_event_s {
+    int type;        // ubo_game_event_type_t
+    int data0;
+    int data1;
+    uint32_t gametic;
+} ubo_game_event_t;
+
+// An eventfd (non-blocking, close-on-exec) that is readable while game
+// events are pending: wait on it with poll/select or an asyncio reader,
+// then call doom_poll_game_events().  The same fd for the whole process
+// (survives doom_shutdown); the caller must not close or read it.  -1 if
+// it could not be made.
+int doom_game_event_fd(void);
+// Drain up to `max` pending game events (single consumer), oldest first,
+// and clear the fd unless more are left.  Returns count.  64 wait at most;
+// events past that are dropped until the host drains.
+int doom_poll_game_events(ubo_game_event_t* out, int max);
+
+// Engine status snapshot, refreshed by the engine at the end of every tic.
+typedef struct ubo_status_s {
+    uint32_t version;       // seqlock: odd while the engine is writing
+    int alive;
+    int gamestate;          // -1 when not alive
+    int menuactive;
+    int paused;
+    int automapactive;
+    uint32_t gametic;
+    uint32_t frame_seq;     // seq of the last published RGB565 frame
+    int health;             // console player; 0 outside a level
+    int armor;
+    int ready_weapon;       // weapontype_t
+    int ready_ammo;         // ammo for ready_weapon, -1 if it uses none
+    uint32_t last_tic_us;   // wall time of the last tic (input..sound submit)
+    uint32_t audio_underruns; // as in ubo_audio_stats_t
+    uint32_t audio_mix_us;    // the last tic's share of last_tic_us spent mixing
+    uint32_t input_lag_us;    // posted-to-sampled wait of the newest input event taken
+    // The last crash doom_init()/a tic recovered from (alive drops to 0): SIGSEGV/SIGBUS
+    // number, -1 for I_Error, 0 = none since the library was loaded.  Kept
+    // across doom_reset() so a host can report it after recovering.
+    int crash_cause;
+    uint32_t crash_gametic;
+    int crash_gamestate;
+    int crash_episode;
+    int crash_map;
+    // Deadlines.  A tic misses its deadline when it ends after the next tic
+    // was due: doom_run_async()'s schedule, or one tic (1/35 s) after it
+    // started when the host drives the tics.  Tics that loaded a level and
+    // doom_simulate() tics are not counted.  The longest tic is kept with
+    // its phases and where the game was at the time.
+    uint32_t deadline_tics;   // tics checked
+    uint32_t deadline_misses;
+    uint32_t worst_tic_us;
+    uint32_t worst_sim_us;    // input, G_Ticker, S_UpdateSounds
+    uint32_t worst_render_us; // D_Display
+    uint32_t worst_sound_us;  // I_UpdateSound + I_SubmitSound
+    uint32_t worst_gametic;
+    int worst_gamestate;
+    int worst_episode;
+    int worst_map;
+    int episode;              // the current gameepisode/gamemap, 0 outside a level
+    int map;
+    // Quality governor (UBO_DOOM_GOVERNOR, doom_set_quality_level): the
+    // level it holds, 0 (full) .. 4, and what it saw over the last second.
+    int quality_level;
+    int frame_load_pct;       // time spent in tics, percent of the second
+    int cpu_temp_mc;          // millidegrees C, -1 when there is no sensor
+    // 1 in idle mode (UBO_DOOM_IDLE_HZ): menu, pause or a title page, and
+    // no input for a second.  doom_run_async() slows down by itself; a
+    // host driving the tics can too, as long as a key press wakes it.
+    int idle;
+    // doom_advance() catch-up: whole tics of wall time still owed, and the
+    // tics dropped past the backlog since the library was loaded.
+    uint32_t catchup_backlog_tics;
+    uint32_t catchup_dropped_tics;
+    // A level load in steps (doom_set_load_budget): percent done, -1 when
+    // none runs.
+    int load_pct;
+    // Zone totals (no heap walk, unlike doom_get_zone_stats): bytes in all
+    // zones, in allocated blocks, the most ever allocated at once, and the
+    // cache blocks purged to make room, since the last doom_init().
+    int zone_size;
+    int zone_used;
+    int zone_high_water;
+    uint32_t zone_purges;
+    // Since the library was loaded, kept across doom_reset(): level loads
+    // and what the last and the longest took (only the time the load ran,
+    // not the tics between the steps of a staged one), crashes recovered
+    // from and doom_reset() calls.
+    uint32_t level_loads;
+    uint32_t last_load_us;
+    uint32_t max_load_us;
+    uint32_t crash_count;
+    uint32_t reset_count;
+} ubo_status_t;
+
+// Copy a consistent snapshot (retries while the engine is mid-update).
+void doom_get_status(ubo_status_t* out);
+
+// Zero the deadline counters and the longest tic (from any thread; applied
+// by the next tic).  doom_init() starts them at zero.
+void doom_reset_deadline_stats(void);
+
+// The live struct behind doom_get_status(), for zero-call reads
+// (ctypes.Structure.from_address).  From the tic thread it is always
+// consistent; from other threads check that `version` is even and unchanged
+// across the read.
+const ubo_status_t* doom_get_status_ptr(void);
+
+// Per-subsystem frame profiler.  Off unless UBO_DOOM_PROFILE=1 (or
+// doom_set_profile_enabled(1)); when off each probe is a single branch.
+typedef enum ubo_prof_stage_e {
+    UBO_PROF_TIC = 0,        // whole doom_tick()/doom_tick_ex() call
+    UBO_PROF_TICKER,         // G_Ticker (includes P_Ticker)
+    UBO_PROF_BSP,            // R_RenderBSPNode
+    UBO_PROF_PLANES,         // R_DrawPlanes
+    UBO_PROF_MASKED,         // R_DrawMasked
+    UBO_PROF_SPRITESORT,     // R_SortVisSprites (inside masked)
+    UBO_PROF_STATUSBAR,      // ST_Drawer
+    UBO_PROF_FINISH_UPDATE,  // I_FinishUpdate (palette conversion + scaling)
+    UBO_PROF_UPDATE_SOUND,   // I_UpdateSound
+    UBO_PROF_SUBMIT_SOUND,   // I_SubmitSound
+    UBO_PROF_NUM_STAGES
+} ubo_prof_stage_t;
+
+// Histogram bucket 0 counts samples under 1us, bucket i (1..14) samples in
+// [2^(i-1), 2^i) us, the last bucket everything from 16.384 ms up.  Window
+// stats (hist, avg_us, max_us) are halved every UBO_PROF_WINDOW samples so
+// they follow recent behaviour; calls and total_us never decay.
+#define UBO_PROF_BUCKETS 16
+#define UBO_PROF_WINDOW  256
+
+typedef struct ubo_prof_stat_s {
+    uint32_t calls;
+    uint32_t last_us;
+    uint32_t avg_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t hist[UBO_PROF_BUCKETS];
+} ubo_prof_stat_t;
+
+typedef struct ubo_profile_s {
+    uint32_t version;        // seqlock, as in ubo_status_t
+    int enabled;
+    uint32_t tics;           // doom_tick calls profiled since reset
+    ubo_prof_stat_t stage[UBO_PROF_NUM_STAGES];
+} ubo_profile_t;
+
+// Snapshot of the profile, published once per tic (safe from any thread).
+void doom_get_profile(ubo_profile_t* out);
+void doom_set_profile_enabled(int enabled);
+void doom_reset_profile(void);
+
+// Short stage name ("tic", "bsp", ...) for logs and reports; NULL if out of range.
+const char* doom_prof_stage_name(int stage);
+
+// Timeline trace.  Off unless UBO_DOOM_TRACE is set (1, or the events to keep
+// per thread) or doom_set_trace_enabled() is called; the profiler stages, level
+// loads, wipes, composite textures, lump reads, file writes and ALSA writes
+// are then recorded as scoped events into a lock-free ring per thread.
+// doom_trace_dump() writes the rings as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev), from any thread, without stopping the recording.  Returns
+// the events written, or -1 if path can't be written.
+void doom_set_trace_enabled(int events);
+int doom_trace_dump(const char* path);
+
+// Headless timedemo (ubodoom_bench).  Queues demo lump `demo` ("demo1") as a
+// -timedemo run, started by the next tic.  blit=0 skips I_FinishUpdate
+// (vanilla -noblit) so the timings leave out the RGB565 conversion.  Drive
+// it with doom_tick() until doom_timedemo_result() returns 1; the engine then
+// drops back to the title loop and the next demo can be queued.
+// Returns -1 if the engine is not running or the lump does not exist.
+typedef struct ubo_timedemo_s {
+    uint32_t gametics;
+    uint32_t realtics;       // I_GetTime() units (1/35 s) from level start
+} ubo_timedemo_t;
+
+int doom_timedemo(const char* demo, int blit);
+int doom_timedemo_result(ubo_timedemo_t* out);
+
+// Called by G_CheckDemoStatus() when a timing demo ends in library mode.
+void ubo_timedemo_done(int realtics);
+
+// Probes used inside the engine (r_main.c, d_main.c, i_video_ubo.c); each
+// stage is also a trace event while tracing.
+extern int ubo_prof_enabled;
+extern int ubo_trace_enabled;
+void ubo_prof_begin(ubo_prof_stage_t stage);
+void ubo_prof_end(ubo_prof_stage_t stage);
+
+#define UBO_PROF_BEGIN(stage) \
+    do { if (ubo_prof_enabled | ubo_trace_enabled) ubo_prof_begin(stage); } while (0)
+#define UBO_PROF_END(stage) \
+    do { if (ubo_prof_enabled | ubo_trace_enabled) ubo_prof_end(stage); } while (0)
+
+// Zone heap fragmentation snapshot (Z_ZoneStats); call from the tic thread
+// or while the engine is idle.  fragmentation = 1 - largest_free / free.
+typedef struct ubo_zone_stats_s {
+    int size;
+    int free;
+    int free_blocks;
+    int largest_free;
+    int purgable;
+    int slabs;
+    int slab_used;
+    int slab_free;
+    int arena_size;   // level arena (outside the zone)
+    int arena_used;
+} ubo_zone_stats_t;
+
+int doom_get_zone_stats(ubo_zone_stats_t* out);  // -1 before doom_init()
+
+// Zone allocation profiler.  every > 0 (UBO_DOOM_ZONE_PROFILE) charges each
+// zone block to the Z_Malloc call site, or the lump, that made it, and books
+// frees, purges (cache thrash) and lifetimes against it; every > 1 also logs
+// the zone use and purges since the last sample every that many tics.
+// 0 stops.  Applied at the next tic; turning it on starts the counts over.
+void doom_set_zone_profile(int every);
+// Per-tag and per-site report as JSON, NUL terminated in buf: the zone
+// totals, then "tags" (live blocks and bytes, allocs, purges) and "sites"
+// (most purged first; allocs, frees, purges, live and peak bytes, lifetimes
+// in 1/35 s).  Returns the length the whole report needs, so a call with
+// size 0 sizes the buffer, or -1 before doom_init().  Same threading rule as
+// doom_get_zone_stats().
+int doom_zone_report(char* buf, int size);
+// Z_FileDumpHeap into path: every zone block with its size, owner and tag,
+// and any broken links.  0, or -1 if path can't be written.
+int doom_zone_dump(const char* path);
+
+// Zone budget, applied by the next doom_init().  base_mb is allocated up
+// front; when it runs out, zones are chained on (4 MB at a time) until
+// max_mb in total.  max_mb <= base_mb never grows.  Overrides
+// UBO_DOOM_ZONE_MB / UBO_DOOM_ZONE_MAX_MB; defaults 32 / 64.
+void doom_set_zone_limits(int base_mb, int max_mb);
+
+// Engine memory budget (UBO_DOOM_MEMORY_MB), applied by the next
+// doom_init(); 0 = none.  The zone defaults to mb/8 growing to mb/4, the
+// composite and pk3 caches to mb/32, unless set themselves.  Once a second
+// of play the footprint (doom_get_memstats) is measured, and over budget the
+// caches are dropped and free zone pages handed back, then the WAD pages
+// if that was not enough.  For 512 MB boards, e.g. 48.
+void doom_set_memory_budget(int mb);
+
+// Queue a PWAD (.wad, or .pk3/.zip) for the next doom_init(), after the
+// IWAD and any added before it; later files replace earlier lumps of the
+// same name, and their sprite and flat blocks are merged into the IWAD's.
+// The shareware IWAD refuses PWADs, as it always did.  Returns the number
+// queued, or -1 while the engine runs, for an unreadable path or past 16.
+// path NULL empties the list.  UBO_DOOM_PWADS ("a.wad:b.pk3") adds more.
+int doom_add_pwad(const char* path);
+
+// Config settings by their config file name ("sfx_volume", "key_fire",
+// "screenblocks", "chatmacro0", ...), parsed to the setting's type (numbers in
+// decimal or 0x hex).  Once any is set, the next doom_init() takes them over
+// the built-in defaults and reads no config file, and the engine writes none;
+// the key bindings doom_init() otherwise forces are left to the host's values.
+// value NULL unsets key, key NULL clears them all (back to the file).
+// Returns -1 for an unknown key or bad number, or while the engine runs.
+int doom_set_config(const char* key, const char* value);
+// The current value as text (engine's live value once initialised), NUL
+// terminated in buf; returns its length or -1 for an unknown key.
+int doom_get_config(const char* key, char* buf, int size);
+
+// Memory budget report since the last doom_init().  Same threading rule
+// as doom_get_zone_stats().
+typedef struct ubo_memstats_s {
+    int zone_bytes;     // all zones, headers included
+    int max_bytes;      // growth limit
+    int zones;          // base zone plus chained ones
+    int used;           // bytes in allocated blocks
+    int high_water;     // most bytes ever allocated at once
+    int purges;         // cache blocks thrown out to make room
+    int largest_free;
+    int free;
+    // What the engine holds in RAM, measured at the call (mincore on the
+    // zones and the WAD mappings), against the memory budget.
+    int budget;          // 0 = none
+    int footprint;       // the four below
+    int zone_resident;
+    int wad_resident;
+    int composite_bytes;
+    int arena_bytes;
+    int process_rss;     // whole process, host included
+    int trims;           // times over budget since doom_init()
+} ubo_memstats_t;
+
+int doom_get_memstats(ubo_memstats_t* out);  // -1 before doom_init()
+
+// Peak use of the growable engine pools on the current level (reset at
+// each level load, which also logs the last level's peaks).  They start
+// at the vanilla limits (128 visplanes, 256 drawsegs, 128 vissprites,
+// 128 intercepts, 8 spechits) and double when a frame or move runs out.
+// Renderer peaks are per frame and per render thread strip.  Same
+// threading rule as doom_get_zone_stats().
+typedef struct ubo_pool_stats_s {
+    int visplanes;
+    int drawsegs;
+    int vissprites;
+    int intercepts;   // one line trace
+    int spechits;     // special lines crossed by one move
+} ubo_pool_stats_t;
+
+int doom_get_pool_stats(ubo_pool_stats_t* out);  // -1 before doom_init()
+
+// Composite wall texture cache since doom_init(). Outside the zone,
+// bounded by UBO_DOOM_COMPOSITE_MB and evicted least recently drawn first.
+// A hit is a texture found built the first time a frame draws it; a miss
+// is one R_GetColumn had to build, prebuilt ones the level worker built.
+typedef struct ubo_composite_stats_s {
+    int textures;        // composites resident now
+    int bytes;
+    int limit;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t prebuilt;
+    uint32_t evictions;
+} ubo_composite_stats_t;
+
+int doom_get_composite_stats(ubo_composite_stats_t* out);  // -1 before doom_init()
+
+// ALSA output since doom_init() (or doom_reset_audio_stats()), for sizing
+// UBO_DOOM_ALSA_PERIOD_US / _BUFFER_US and telling audio stalls from slow
+// tics.  Frames are at `rate`.  The fields are atomics written by the tick
+// and audio threads, so any thread may call this; they are read one by one.
+typedef struct ubo_audio_stats_s {
+    int active;              // a PCM is open
+    int threaded;            // UBO_DOOM_AUDIO_THREAD
+    int rate;
+    int period_frames;
+    int buffer_frames;
+    uint32_t underruns;      // writes that found the device run dry (-EPIPE)
+    uint32_t errors;         // other failed writes (suspend, device gone)
+    uint32_t overruns;       // tics whose mix did not fit in the ring
+    uint32_t writes;
+    uint64_t frames_written;
+    int delay_frames;        // snd_pcm_delay after the last write
+    int delay_max;
+    int ring_frames;         // mixed but not yet written, at the last tic
+    int ring_max;
+    int lead_frames;         // the queue the tick thread aims for
+    uint32_t mix_us;         // I_UpdateSound, last tic
+    uint32_t mix_avg_us;     // over about 16 tics
+    uint32_t mix_max_us;
+} ubo_audio_stats_t;
+
+int doom_get_audio_stats(ubo_audio_stats_t* out);  // -1 before doom_init()
+// Zeroes the counters and maxima.
+void doom_reset_audio_stats(void);
+
+// Implemented by i_sound_alsa.c.
+void ubo_audio_stats(ubo_audio_stats_t* out);
+void ubo_audio_stats_reset(void);
+
+// Headless fast-forward for regression tests and bots: runs `tics` game tics
+// back to back with no D_Display and no sound updates or mixing; new sound
+// effects are dropped and music paused until it returns.  Input queued with
+// doom_post_events() is still consumed.  If hashes is non-NULL, hashes[i]
+// gets doom_state_hash() after tic i.  Returns the tics run (fewer if the
+// engine died), or -1 before doom_init(), while doom_run_async() runs or in
+// a netgame.
+int doom_simulate(int tics, uint32_t* hashes);
+// FNV-1a over leveltime, the P_Random index, the players and every mobj's
+// position, momentum, angle, health, state and tics.
+uint32_t doom_state_hash(void);
+// FNV-1a over the screenwidth x screenheight pixels of screens[0], the 8-bit
+// frame the last render drew (before the palette conversion).  A renderer
+// variant that hashes the same as the plain drawers every tic draws the same
+// pixels.  0 before doom_init().
+uint32_t doom_get_frame_hash(void);
+
+// Auxiliary per-frame buffers for bots and automated QA, off by default.
+// The renderer fills the depth and label buffers as it draws (a branch per
+// drawn column when off); the palette-index frame is sampled from the
+// 8-bit frame once it is complete, status bar included, before the palette
+// and any damage or pickup tint are applied.  A change takes effect on the
+// next rendered frame; index_width/height are 1..320 x 1..200 (0 keeps
+// them, 80x50 to start with).
+#define UBO_AUX_INDEX  1     // the 8-bit frame, nearest-sampled down
+#define UBO_AUX_DEPTH  2     // nearest wall per view column
+#define UBO_AUX_LABELS 4     // sprite seen at each view pixel
+
+// Labels: 0 nothing (walls, flats, masked textures), 255 the player's
+// weapon, else the thing's mobjtype_t + 1.
+#define UBO_AUX_LABEL_WEAPON 255
+
+typedef struct ubo_aux_frame_s {
+    uint32_t seq;            // counts frames drawn with a buffer on
+    int mask;                // UBO_AUX_* filled
+    const uint8_t* index;    // index_height rows of index_width PLAYPAL indices
+    int index_width;
+    int index_height;
+    // The 3D view: view_width x view_height view pixels whose top left is
+    // view_x, view_y on the frame.  In low detail a view column is two
+    // pixels wide (view_detail 1).  view_width is 0 when the last frame
+    // drew no view (menu screens, intermission, automap).
+    int view_x, view_y;
+    int view_width, view_height;
+    int view_detail;
+    const uint16_t* depth;   // view_width entries, map units, 0 = no wall
+    const uint8_t* labels;   // view_height rows, label_stride bytes apart
+    int label_stride;
+} ubo_aux_frame_t;
+
+void doom_set_aux_buffers(int mask, int index_width, int index_height);
+// The buffers of the last rendered frame; the pointers stay valid, their
+// contents until the next rendered tic, so read them between tics on the
+// thread running them.  -1 before doom_init() and until a frame is drawn
+// with a buffer on.
+int doom_get_aux_frame(ubo_aux_frame_t* out);
+
+// Batched environments for bots and reinforcement learning (i_env_ubo.c).
+// The engine is one set of globals, so each environment is a forked worker
+// process running its own doom_init() on the IWAD, with no sound, wipes,
+// governor or on-disk caches.  Observations are box-filtered down from the
+// rendered frame into shared memory the workers write and the caller reads
+// in place; a step sends each worker its ticcmd over a socket, runs
+// frame_skip tics with the last one drawn, and waits for all of them, so
+// n environments run on n cores.  Open them before the caller starts any
+// threads of its own, and before (or instead of) doom_init() in this process.
+typedef struct ubo_env_config_s {
+    int obs_width;       // 1..320, 0 = 80
+    int obs_height;      // 1..200, 0 = 50
+    int channels;        // 1 = luma, 3 = RGB; 0 = 1
+    int frame_skip;      // tics per step; 0 = 4
+    int skill;           // 1..5; 0 = 3
+    int episode;         // 0 = 1
+    int map;             // 0 = 1
+} ubo_env_config_t;
+
+typedef enum {
+    UBO_ENV_RUNNING = 0,
+    UBO_ENV_DIED = 1,        // the player died
+    UBO_ENV_EXITED = 2,      // the level was finished
+    UBO_ENV_LOST = 3         // the worker's engine died or the worker exited
+} ubo_env_done_t;
+
+// The state after a step, for the caller's reward.  Counts are this
+// episode's so far.
+typedef struct ubo_env_result_s {
+    int done;            // ubo_env_done_t
+    int health;
+    int armor;
+    int weapon;          // ready weapon_t + 1, as in ubo_ticcmd_t (9 = super shotgun)
+    int ammo;            // of the ready weapon, -1 for fist and chainsaw
+    int kills;
+    int items;
+    int secrets;
+    int x, y;            // map units
+    int angle;           // degrees, 0 = east, counterclockwise
+    int tics;
+} ubo_env_result_t;
+
+#define UBO_ENV_MAX 16
+
+// Forks count (1..UBO_ENV_MAX) workers and waits until every one is in the
+// first tic of a new game; cfg may be NULL for the defaults.  Returns count,
+// or -1 (logged) if this process already runs the engine, envs are already
+// open, or a worker fails to start.
+int doom_env_open(const char* iwad_path, const ubo_env_config_t* cfg, int count);
+// Bytes in one observation: obs_width * obs_height * channels, row-major,
+// channels interleaved.  0 while no envs are open.
+int doom_env_obs_size(void);
+// Environment i's latest observation, valid until its next step or reset.
+const uint8_t* doom_env_obs(int index);
+// Steps environments 0..n-1 with actions[i], in parallel.  An environment
+// that ends (results[i].done != 0) starts its next episode straight away:
+// results[i] is the final state, the observation the new episode's first
+// frame.  obs, if non-NULL, gets the n observations back to back.  Returns
+// n, or -1 if n is out of range or a worker was lost (its done is
+// UBO_ENV_LOST; close and reopen).
+int doom_env_step_batch(const ubo_ticcmd_t* actions, int n, uint8_t* obs,
+                        ubo_env_result_t* results);
+// Starts a new episode in environment index (-1 = all); 0 or -1.
+int doom_env_reset(int index);
+void doom_env_close(void);   // stops and reaps every worker
+
+// Savegame writes.  G_DoSaveGame hands the file to an I/O thread that writes a
+// temp file, fsyncs and renames it (UBO_DOOM_ASYNC_SAVE=0 writes on the tic).
+// Returns the last write's state; *seq (if non-NULL) counts finished writes,
+// so a host can show a "saved" toast when it moves.
+typedef enum {
+    UBO_SAVE_NONE = 0,
+    UBO_SAVE_WRITING = 1,
+    UBO_SAVE_DONE = 2,
+    UBO_SAVE_FAILED = 3
+} ubo_save_state_t;
+
+int doom_get_save_status(uint32_t* seq);
+
+// Screenshots.  The next frame shown is written to path as a PNG, encoded on
+// a worker thread: the 8-bit picture with its palette (320x200, or 240x150
+// with UBO_DOOM_LCD_RES), or with lcd != 0 the 240x240 letterboxed RGB565
+// frame as the panel gets it.  Returns -1 before doom_init(), for a path
+// too long, or while another shot is pending or being written.  The status
+// is a ubo_save_state_t; *seq (if non-NULL) counts finished shots.
+int doom_screenshot(const char* path, int lcd);
+int doom_get_screenshot_status(uint32_t* seq);
+
+// Rewind ring and memory quick slot (UBO_DOOM_REWIND_SECONDS).  Requests are
+// queued and take effect on the next tic; -1 before doom_init().
+int doom_rewind(int seconds);       // back to the snapshot about `seconds` old
+int doom_snapshot_save(void);       // quick save to memory, no SD card write
+int doom_snapshot_load(void);       // load it back
+
+// Demo files, streamed to disk a 4 KB chunk at a time so a recording has no
+// length limit.  Recording restarts the current map (E1M1 / MAP01 on medium
+// outside a level) and runs across level changes until doom_demo_stop() or
+// doom_shutdown().  Playback returns to the title loop when the demo ends.
+// Queued for the next tic; -1 before doom_init(), for a path longer than
+// 255 bytes or, for doom_demo_play(), a file that can't be read.
+int doom_demo_record(const char* path);
+int doom_demo_play(const char* path);
+int doom_demo_stop(void);           // finish the recording or playback
+int doom_get_demo_state(void);      // 0 = none, 1 = recording, 2 = playing
+
 // Reset engine state so doom_init() can be called again after a mid-tick crash.
-// NOTE: leaks the old zone heap allocation — acceptable for a crash recovery path.
+// The zone is cleared and reused by the next doom_init(), not leaked.
 void doom_reset(void);
 
 // Query current engine state (useful for context-sensitive input mapping).
 int doom_get_gamestate(void);   // 0=GS_LEVEL, 1=GS_INTERMISSION, 2=GS_FINALE, 3=GS_DEMOSCREEN
 int doom_get_menuactive(void);  // 1 if menu overlay is active, 0 otherwise
 
+#pragma GCC visibility pop
+
 #ifdef __cplusplus
 }
 #endif
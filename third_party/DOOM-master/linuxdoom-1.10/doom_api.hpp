@@ -0,0 +1,329 @@
+#ifndef UBO_DOOM_API_HPP
+#define UBO_DOOM_API_HPP
+
+// C++20 layer over doom_api.h for C++ hosts, header-only.  Nothing here
+// allocates, throws or adds state beyond what the C ABI keeps:
+// - ubo::Engine is the one engine as a move-only handle: the live handle
+//   shuts the engine down when it goes away, a moved-from one does nothing.
+// - Frames are std::span views of the engine's own buffers, so reading a
+//   frame copies nothing; a FrameLease releases doom_acquire_frame()'s
+//   slot when it goes out of scope.
+// - Engine::subscribe() wraps doom_set_frame_callback() for any callable;
+//   the FrameSubscription it returns clears the callback when destroyed.
+// - InputBatch collects events on the stack for one doom_post_events().
+// Errors come back the way the C calls report them: std::optional, bool or
+// the count the C function returns.
+//
+// The C API is one set of globals, so there is one Engine at a time.
+
+#if __cplusplus < 202002L
+#error "doom_api.hpp needs C++20 (std::span); C++ hosts on older standards use doom_api.h"
+#endif
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "doom_api.h"
+
+namespace ubo {
+
+enum class Key : int {
+    None = UBO_KEY_NONE,
+    Up = UBO_KEY_UP,
+    Down = UBO_KEY_DOWN,
+    Left = UBO_KEY_LEFT,
+    Right = UBO_KEY_RIGHT,
+    Fire = UBO_KEY_FIRE,
+    Use = UBO_KEY_USE,
+    Escape = UBO_KEY_ESCAPE,
+    MenuSelect = UBO_KEY_MENU_SELECT,
+};
+
+enum class OutputFormat : int {
+    Rgba8888 = UBO_OUTPUT_RGBA8888,
+    Rgb565Be = UBO_OUTPUT_RGB565_BE,
+};
+
+// ubo_status_t.gamestate
+enum class GameState : int {
+    Dead = -1,
+    Level = 0,
+    Intermission = 1,
+    Finale = 2,
+    DemoScreen = 3,
+};
+
+using Rect = ubo_rect_t;
+
+// A snapshot of ubo_status_t with typed accessors; raw has every field.
+struct Status {
+    ubo_status_t raw;
+
+    bool alive() const noexcept { return raw.alive != 0; }
+    GameState game_state() const noexcept { return static_cast<GameState>(raw.gamestate); }
+    bool in_menu() const noexcept { return raw.menuactive != 0; }
+    bool paused() const noexcept { return raw.paused != 0; }
+    std::uint32_t gametic() const noexcept { return raw.gametic; }
+    std::uint32_t frame_seq() const noexcept { return raw.frame_seq; }
+    std::chrono::microseconds last_tic() const noexcept { return std::chrono::microseconds(raw.last_tic_us); }
+    int quality_level() const noexcept { return raw.quality_level; }
+};
+
+// A read-only frame: the bytes stay valid as long as the call that handed
+// the view out says (FrameLease's lifetime, or the subscriber's call).
+struct FrameView {
+    OutputFormat format;
+    std::span<const std::byte> data;
+    int width;
+    int height;
+    int stride;                 // bytes from one row to the next
+    std::uint32_t seq;
+    std::span<const Rect> rects; // changed bands; empty from acquire_frame()
+
+    std::span<const std::byte> row(int y) const noexcept
+    {
+        return data.subspan(static_cast<std::size_t>(y) * static_cast<std::size_t>(stride),
+                            static_cast<std::size_t>(stride));
+    }
+};
+
+// The RGB565 frame doom_acquire_frame() pinned, released on destruction.
+class FrameLease {
+public:
+    FrameLease() noexcept = default;
+    FrameLease(FrameLease&& other) noexcept : frame_(std::exchange(other.frame_, std::nullopt)) {}
+    FrameLease& operator=(FrameLease&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            frame_ = std::exchange(other.frame_, std::nullopt);
+        }
+        return *this;
+    }
+    FrameLease(const FrameLease&) = delete;
+    FrameLease& operator=(const FrameLease&) = delete;
+    ~FrameLease() { release(); }
+
+    explicit operator bool() const noexcept { return frame_.has_value(); }
+    const FrameView& operator*() const noexcept { return *frame_; }
+    const FrameView* operator->() const noexcept { return &*frame_; }
+
+    void release() noexcept
+    {
+        if (frame_)
+        {
+            frame_.reset();
+            doom_release_frame();
+        }
+    }
+
+private:
+    friend class Engine;
+    explicit FrameLease(const FrameView& frame) noexcept : frame_(frame) {}
+
+    std::optional<FrameView> frame_;
+};
+
+// Up to N events for one doom_post_events(); add() returns false when full.
+template <std::size_t N = 16>
+class InputBatch {
+public:
+    bool tap(Key key, int hold_tics) noexcept { return add(key, 1, hold_tics); }
+    bool press(Key key) noexcept { return add(key, 1, 0); }
+    bool release(Key key) noexcept { return add(key, 0, 0); }
+
+    bool add(Key key, int down, int hold_tics) noexcept
+    {
+        if (size_ == N)
+            return false;
+        events_[size_++] = ubo_event_t{ static_cast<int>(key), down, hold_tics };
+        return true;
+    }
+
+    void clear() noexcept { size_ = 0; }
+    std::size_t size() const noexcept { return size_; }
+    std::span<const ubo_event_t> events() const noexcept { return { events_, size_ }; }
+
+private:
+    ubo_event_t events_[N];
+    std::size_t size_ = 0;
+};
+
+// Active doom_set_frame_callback() registration; removing it waits for a
+// call in flight.  The callable passed to subscribe() must outlive it.
+class FrameSubscription {
+public:
+    FrameSubscription() noexcept = default;
+    FrameSubscription(FrameSubscription&& other) noexcept : active_(std::exchange(other.active_, false)) {}
+    FrameSubscription& operator=(FrameSubscription&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            active_ = std::exchange(other.active_, false);
+        }
+        return *this;
+    }
+    FrameSubscription(const FrameSubscription&) = delete;
+    FrameSubscription& operator=(const FrameSubscription&) = delete;
+    ~FrameSubscription() { reset(); }
+
+    explicit operator bool() const noexcept { return active_; }
+
+    void reset() noexcept
+    {
+        if (active_)
+        {
+            doom_set_frame_callback(nullptr, nullptr);
+            active_ = false;
+        }
+    }
+
+private:
+    friend class Engine;
+    explicit FrameSubscription(bool active) noexcept : active_(active) {}
+
+    bool active_ = false;
+};
+
+class Engine {
+public:
+    // doom_init(iwad); nullopt if it failed (the engine log says why).
+    [[nodiscard]] static std::optional<Engine> init(const char* iwad) noexcept
+    {
+        if (doom_init(iwad) != 0)
+            return std::nullopt;
+        return Engine(true);
+    }
+
+    Engine(Engine&& other) noexcept : owned_(std::exchange(other.owned_, false)) {}
+    Engine& operator=(Engine&& other) noexcept
+    {
+        if (this != &other)
+        {
+            shutdown();
+            owned_ = std::exchange(other.owned_, false);
+        }
+        return *this;
+    }
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+    ~Engine() { shutdown(); }
+
+    void shutdown() noexcept
+    {
+        if (owned_)
+        {
+            doom_shutdown();
+            owned_ = false;
+        }
+    }
+
+    bool alive() const noexcept { return doom_is_alive() != 0; }
+
+    // Tics
+    void tick() noexcept { doom_tick(); }
+    void tick(bool run_sim, bool render) noexcept { doom_tick_ex(run_sim, render); }
+    // The tics elapsed wall time covers; -1 while run_async() owns the engine.
+    int advance(std::chrono::microseconds elapsed, bool render = true) noexcept
+    {
+        auto us = elapsed.count();
+        return doom_advance(us < 0 ? 0u : us > 0xFFFFFFFF ? 0xFFFFFFFFu : static_cast<std::uint32_t>(us),
+                            render);
+    }
+    bool run_async(int hz = 35) noexcept { return doom_run_async(hz) == 0; }
+    void stop_async() noexcept { doom_stop_async(); }
+
+    // Input
+    void key_down(Key key) noexcept { doom_key_down(static_cast<ubo_key_t>(key)); }
+    void key_up(Key key) noexcept { doom_key_up(static_cast<ubo_key_t>(key)); }
+    int post(std::span<const ubo_event_t> events) noexcept
+    {
+        return doom_post_events(events.data(), static_cast<int>(events.size()));
+    }
+    template <std::size_t N>
+    int post(const InputBatch<N>& batch) noexcept { return post(batch.events()); }
+    void release_all_keys() noexcept { doom_release_all_keys(); }
+
+    // Status: a consistent copy from any thread, or the live struct (only
+    // consistent on the tic thread, see doom_get_status_ptr()).
+    Status status() const noexcept
+    {
+        Status s;
+        doom_get_status(&s.raw);
+        return s;
+    }
+    const ubo_status_t& live_status() const noexcept { return *doom_get_status_ptr(); }
+
+    // Frames
+    void set_output_format(OutputFormat format) noexcept
+    {
+        doom_set_output_format(static_cast<ubo_output_format_t>(format));
+    }
+    OutputFormat output_format() const noexcept { return static_cast<OutputFormat>(doom_get_output_format()); }
+
+    // ubo_rgba; written by the next frame, so read it between tics.
+    std::span<const std::byte> rgba() const noexcept
+    {
+        return { reinterpret_cast<const std::byte*>(doom_get_rgba_ptr()),
+                 static_cast<std::size_t>(doom_get_rgba_width()) * static_cast<std::size_t>(doom_get_rgba_height()) * 4 };
+    }
+
+    // The newest RGB565 frame not acquired yet, pinned until the lease
+    // goes; an empty lease if there is none (or one is still held).
+    FrameLease acquire_frame() noexcept
+    {
+        ubo_frame_t f;
+
+        if (doom_acquire_frame(&f) != 1)
+            return FrameLease();
+        return FrameLease(FrameView{ OutputFormat::Rgb565Be,
+                                     { reinterpret_cast<const std::byte*>(f.data), static_cast<std::size_t>(f.size) },
+                                     f.width, f.height, f.width * 2, f.seq, {} });
+    }
+
+    // Changed bands since the last call, written into out.
+    std::span<Rect> dirty_rects(std::span<Rect> out) noexcept
+    {
+        return out.first(static_cast<std::size_t>(doom_get_dirty_rects(out.data(), static_cast<int>(out.size()))));
+    }
+
+    // fn(const FrameView&) for every shown frame, on the tic thread, as
+    // doom_set_frame_callback() describes; fn is called through a pointer
+    // to it, so it must outlive the subscription.  One at a time.
+    template <typename F>
+    [[nodiscard]] FrameSubscription subscribe(F& fn) noexcept
+    {
+        static_assert(std::is_invocable_v<F&, const FrameView&>, "subscribe(fn): fn(const ubo::FrameView&)");
+        doom_set_frame_callback(&Engine::deliver<F>, static_cast<void*>(&fn));
+        return FrameSubscription(true);
+    }
+
+private:
+    explicit Engine(bool owned) noexcept : owned_(owned) {}
+
+    template <typename F>
+    static void deliver(const ubo_frame_info_t* info, void* user) noexcept
+    {
+        const FrameView view{
+            static_cast<OutputFormat>(info->format),
+            { reinterpret_cast<const std::byte*>(info->data),
+              static_cast<std::size_t>(info->stride) * static_cast<std::size_t>(info->height) },
+            info->width, info->height, info->stride, info->seq,
+            { info->rects, static_cast<std::size_t>(info->num_rects) },
+        };
+        (*static_cast<F*>(user))(view);
+    }
+
+    bool owned_ = false;
+};
+
+} // namespace ubo
+
+#endif // UBO_DOOM_API_HPP
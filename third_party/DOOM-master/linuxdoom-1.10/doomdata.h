@@ -174,8 +174,10 @@ typedef struct
 
 // BSP node structure.
 
-// Indicate a leaf.
-#define	NF_SUBSECTOR	0x8000
+// Indicate a leaf.  The WAD's 16 bit children use NF_MAPSUBSECTOR;
+//  node_t's, which also hold ZDBSP extended nodes, NF_SUBSECTOR.
+#define	NF_MAPSUBSECTOR	0x8000
+#define	NF_SUBSECTOR	0x80000000
 
 typedef struct
 {
@@ -189,7 +191,7 @@ typedef struct
   // clip against view frustum.
   short		bbox[2][4];
 
-  // If NF_SUBSECTOR its a subsector,
+  // If NF_MAPSUBSECTOR its a subsector,
   // else it's a node of another subtree.
   unsigned short	children[2];
 
@@ -183,6 +183,10 @@ extern  boolean	usergame;
 extern  boolean	demoplayback;
 extern  boolean	demorecording;
 
+// UBO: the ticcmds come from a game mirrored over the network
+//  (i_spectate.h), played in lockstep like a netgame node's.
+extern  boolean	spectating;
+
 // Quit after playing a demo from cmdline.
 extern  boolean		singledemo;	
 
@@ -90,11 +90,52 @@ void	F_CastTicker (void);
 boolean F_CastResponder (event_t *ev);
 void	F_CastDrawer (void);
 
+//
+// F_FinaleFlat
+// The flat the finale text is drawn over for the game in progress,
+//  NULL if it has none.
+//
+static char* F_FinaleFlat (void)
+{
+    switch (gamemode)
+    {
+      case shareware:
+      case registered:
+      case retail:
+	switch (gameepisode)
+	{
+	  case 1: return "FLOOR4_8";
+	  case 2: return "SFLR6_1";
+	  case 3: return "MFLR8_4";
+	  case 4: return "MFLR8_3";
+	}
+	return NULL;
+
+      case commercial:
+	switch (gamemap)
+	{
+	  case 6: return "SLIME16";
+	  case 11: return "RROCK14";
+	  case 20: return "RROCK07";
+	  case 30: return "RROCK17";
+	  case 15: return "RROCK13";
+	  case 31: return "RROCK19";
+	}
+	return NULL;
+
+      default:
+	return "F_SKY1"; // Not used anywhere else.
+    }
+}
+
+
 //
 // F_StartFinale
 //
 void F_StartFinale (void)
 {
+    char*	flat;
+
     gameaction = ga_nothing;
     gamestate = GS_FINALE;
     viewactive = false;
@@ -116,19 +157,15 @@ void F_StartFinale (void)
 	switch (gameepisode)
 	{
 	  case 1:
-	    finaleflat = "FLOOR4_8";
 	    finaletext = e1text;
 	    break;
 	  case 2:
-	    finaleflat = "SFLR6_1";
 	    finaletext = e2text;
 	    break;
 	  case 3:
-	    finaleflat = "MFLR8_4";
 	    finaletext = e3text;
 	    break;
 	  case 4:
-	    finaleflat = "MFLR8_3";
 	    finaletext = e4text;
 	    break;
 	  default:
@@ -146,27 +183,21 @@ void F_StartFinale (void)
 	  switch (gamemap)
 	  {
 	    case 6:
-	      finaleflat = "SLIME16";
 	      finaletext = c1text;
 	      break;
 	    case 11:
-	      finaleflat = "RROCK14";
 	      finaletext = c2text;
 	      break;
 	    case 20:
-	      finaleflat = "RROCK07";
 	      finaletext = c3text;
 	      break;
 	    case 30:
-	      finaleflat = "RROCK17";
 	      finaletext = c4text;
 	      break;
 	    case 15:
-	      finaleflat = "RROCK13";
 	      finaletext = c5text;
 	      break;
 	    case 31:
-	      finaleflat = "RROCK19";
 	      finaletext = c6text;
 	      break;
 	    default:
@@ -180,11 +211,13 @@ void F_StartFinale (void)
       // Indeterminate.
       default:
 	S_ChangeMusic(mus_read_m, true);
-	finaleflat = "F_SKY1"; // Not used anywhere else.
 	finaletext = c1text;  // FIXME - other text, music?
 	break;
     }
     
+    flat = F_FinaleFlat ();
+    if (flat)
+	finaleflat = flat;
     finalestage = 0;
     finalecount = 0;
 	
@@ -617,6 +650,12 @@ F_DrawPatchCol
     byte*	dest;
     byte*	desttop;
     int		count;
+
+    if (screenwidth != SCREENWIDTH)
+    {
+	V_DrawPatchColumn (x, 0, 0, patch, col);
+	return;
+    }
 	
     column = (column_t *)((byte *)patch + LONG(patch->columnofs[col]));
     desttop = screens[0]+x;
@@ -645,6 +684,7 @@ void F_BunnyScroll (void)
 {
     int		scrolled;
     int		x;
+    int		vx;
     patch_t*	p1;
     patch_t*	p2;
     char	name[10];
@@ -662,12 +702,13 @@ void F_BunnyScroll (void)
     if (scrolled < 0)
 	scrolled = 0;
 		
-    for ( x=0 ; x<SCREENWIDTH ; x++)
+    for ( x=0 ; x<screenwidth ; x++)
     {
-	if (x+scrolled < 320)
-	    F_DrawPatchCol (x, p1, x+scrolled);
+	vx = V_UNSCALEX(x);
+	if (vx+scrolled < 320)
+	    F_DrawPatchCol (x, p1, vx+scrolled);
 	else
-	    F_DrawPatchCol (x, p2, x+scrolled - 320);		
+	    F_DrawPatchCol (x, p2, vx+scrolled - 320);		
     }
 	
     if (finalecount < 1130)
@@ -736,3 +777,81 @@ void F_Drawer (void)
 }
 
 
+
+
+//
+// F_ListLumps
+// UBO: the patches and flat the finale the current map ends in will
+//  draw, for R_PrecacheLevel to page in behind the level's own; none
+//  if the map does not end in one.  The cast only shows rotation 0 of
+//  its members' frames.  Fills up to max of lumps, returns the count.
+//
+static int F_ListLump (int lump, int* lumps, int count, int max)
+{
+    if (lump >= 0 && count < max)
+	lumps[count++] = lump;
+    return count;
+}
+
+int F_ListLumps (int* lumps, int max)
+{
+    int			i;
+    int			j;
+    int			count;
+    char*		flat;
+    char		name[9];
+    spritedef_t*	sprdef;
+
+    if (gamemode == commercial)
+    {
+	if (gamemap != 6 && gamemap != 11 && gamemap != 20
+	    && gamemap != 30 && gamemap != 15 && gamemap != 31)
+	    return 0;
+    }
+    else if (gamemap != 8)
+	return 0;
+
+    count = 0;
+    flat = F_FinaleFlat ();
+    if (flat)
+	count = F_ListLump (W_CheckNumForName (flat), lumps, count, max);
+
+    if (gamemode == commercial)
+    {
+	if (gamemap != 30)
+	    return count;
+	count = F_ListLump (W_CheckNumForName ("BOSSBACK"), lumps, count, max);
+	for (i=0 ; castorder[i].name ; i++)
+	{
+	    sprdef = &sprites[states[mobjinfo[castorder[i].type].seestate].sprite];
+	    for (j=0 ; j<sprdef->numframes ; j++)
+		count = F_ListLump (firstspritelump + sprdef->spriteframes[j].lump[0],
+				    lumps, count, max);
+	}
+	return count;
+    }
+
+    switch (gameepisode)
+    {
+      case 1:
+	count = F_ListLump (W_CheckNumForName (gamemode == retail ? "CREDIT" : "HELP2"),
+			    lumps, count, max);
+	break;
+      case 2:
+	count = F_ListLump (W_CheckNumForName ("VICTORY2"), lumps, count, max);
+	break;
+      case 3:
+	count = F_ListLump (W_CheckNumForName ("PFUB1"), lumps, count, max);
+	count = F_ListLump (W_CheckNumForName ("PFUB2"), lumps, count, max);
+	for (i=0 ; i<7 ; i++)
+	{
+	    sprintf (name, "END%i", i);
+	    count = F_ListLump (W_CheckNumForName (name), lumps, count, max);
+	}
+	break;
+      case 4:
+	count = F_ListLump (W_CheckNumForName ("ENDPIC"), lumps, count, max);
+	break;
+    }
+    return count;
+}
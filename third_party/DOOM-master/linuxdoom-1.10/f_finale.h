@@ -42,6 +42,10 @@ void F_Drawer (void);
 
 void F_StartFinale (void);
 
+// The lumps the current map's finale (if any) draws, up to max;
+//  returns the count.  For R_PrecacheLevel.
+int F_ListLumps (int* lumps, int max);
+
 
 
 
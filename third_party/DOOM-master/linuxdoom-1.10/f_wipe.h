@@ -63,6 +63,9 @@ wipe_ScreenWipe
   int		height,
   int		ticks );
 
+// UBO: forget a wipe in progress (its buffers went with the zone)
+void wipe_Abort (void);
+
 #endif
 //-----------------------------------------------------------------------------
 //
@@ -0,0 +1,51 @@
+#ifndef UBO_FRAMESHM_H
+#define UBO_FRAMESHM_H
+
+#include <stdint.h>
+
+// Frame export for other processes (UBO_DOOM_FRAMESHM=/name).  The engine
+// creates the POSIX shared memory object and copies every frame
+// I_FinishUpdate produces into the next of FRAMESHM_SLOTS slots, in the
+// selected output format.  Consumers shm_open the name read-only, map it
+// and use the pixels in place:
+// - seq is the newest complete frame (0 = none yet); its pixels are in
+//   slot seq % FRAMESHM_SLOTS, at data_offset + slot * slot_bytes.
+// - A slot's seq is 0 while the engine rewrites it.  A consumer that
+//   still sees the same seq in the slot after reading the pixels knows
+//   they were not overwritten meanwhile; otherwise it drops the frame.
+// - The engine does a shared FUTEX_WAKE on seq after each frame, so
+//   consumers sleep with FUTEX_WAIT on the value they last saw.
+// Both sides use the GCC __atomic builtins on the seq words.
+
+#define FRAMESHM_MAGIC   0x4d524655u    // "UFRM"
+#define FRAMESHM_VERSION 1
+#define FRAMESHM_SLOTS   4
+
+enum {
+    FRAMESHM_RGBA8888 = 0,      // as ubo_output_format_t
+    FRAMESHM_RGB565_BE = 1,
+};
+
+typedef struct frameshm_slot_s {
+    uint32_t seq;
+    uint32_t format;            // FRAMESHM_*
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;            // bytes per row
+    uint32_t bytes;
+    uint64_t time_us;           // CLOCK_MONOTONIC when it was published
+} frameshm_slot_t;
+
+typedef struct frameshm_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_bytes;
+    uint32_t data_offset;       // from the start of the mapping
+    uint32_t seq;               // futex word
+    uint32_t pid;               // the engine process, to tell a stale object
+    uint32_t pad;
+    frameshm_slot_t slot[FRAMESHM_SLOTS];
+} frameshm_t;
+
+#endif // UBO_FRAMESHM_H
@@ -0,0 +1,49 @@
+#ifndef UBO_FRAMESTREAM_H
+#define UBO_FRAMESTREAM_H
+
+#include <stdint.h>
+
+// Remote framebuffer stream (UBO_DOOM_STREAM=tcp:host:port, i_stream_ubo.c).
+// A TCP connection carries the shown 8-bit frames and their palette; all
+// fields are little-endian.
+// - It opens with one framestream_hello_t, then carries messages, each a
+//   framestream_msg_t followed by `bytes` of payload.
+// - FRAMESTREAM_PALETTE: 768 bytes of RGB, sent before the first frame and
+//   before every frame whose palette differs from the last one sent.
+// - FRAMESTREAM_KEY: the frame's width*height palette indices, packed rows
+//   with no stride, RLE-coded.  Always the first frame on a connection.
+// - FRAMESTREAM_DELTA: the same, XORed byte for byte with the frame the
+//   previous KEY or DELTA message produced, then RLE-coded.  Unchanged
+//   pixels are 0, so in-game motion packs to a few KB.
+// - The RLE is a sequence of ops: a control byte c < 0x80 is followed by
+//   c + 1 literal bytes; c >= 0x80 by one byte repeated c - 0x7e times
+//   (2..129).
+// - seq counts the frames the engine handed to the stream; a gap means
+//   frames were dropped while the viewer was behind.
+
+#define FRAMESTREAM_MAGIC   0x534f4255u     // "UBOS"
+#define FRAMESTREAM_VERSION 1
+
+enum {
+    FRAMESTREAM_PALETTE = 'P',
+    FRAMESTREAM_KEY = 'K',
+    FRAMESTREAM_DELTA = 'D',
+};
+
+typedef struct framestream_hello_s {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t width;
+    uint16_t height;
+    uint16_t pad;
+} framestream_hello_t;
+
+typedef struct framestream_msg_s {
+    uint8_t type;               // FRAMESTREAM_*
+    uint8_t pad[3];
+    uint32_t seq;
+    uint32_t time_ms;           // CLOCK_MONOTONIC when the frame was shown
+    uint32_t bytes;             // payload that follows
+} framestream_msg_t;
+
+#endif // UBO_FRAMESTREAM_H
@@ -38,6 +38,9 @@ rcsid[] = "$Id: g_game.c,v 1.8 1997/02/03 22:45:09 b1 Exp $";
 #include "m_menu.h"
 #include "m_random.h"
 #include "i_system.h"
+#include "i_log.h"
+#include "i_spectate.h"
+#include "i_trace.h"
 
 #include "p_setup.h"
 #include "p_saveg.h"
@@ -89,10 +92,16 @@ void	G_DoLoadLevel (void);
 void	G_DoNewGame (void); 
 void	G_DoLoadGame (void); 
 void	G_DoPlayDemo (void); 
+void	G_DoSpectate (void);
 void	G_DoCompleted (void); 
 void	G_DoVictory (void); 
 void	G_DoWorldDone (void); 
 void	G_DoSaveGame (void); 
+void	G_TakeSnapshot (void);
+
+static void	G_JournalBegin (void);
+static void	G_JournalLevel (void);
+static void	G_JournalTiccmd (ticcmd_t* cmd);
  
  
 gameaction_t    gameaction; 
@@ -125,13 +134,18 @@ int             gametic;
 int             levelstarttic;          // gametic at level start 
 int             totalkills, totalitems, totalsecret;    // for intermission 
  
-char            demoname[32]; 
+char            demoname[256]; 
 boolean         demorecording; 
 boolean         demoplayback; 
 boolean		netdemo; 
+boolean		spectating;		// UBO: ticcmds from i_spectate
 byte*		demobuffer;
 byte*		demo_p;
 byte*		demoend; 
+FILE*		demofile;		// UBO: recording streams here
+int		demomapped;		// UBO: length of an M_MapFile'd demo
+static boolean	demobegin;		// UBO: G_DoNewGame starts recording
+static char	demofilename[256];	// UBO: G_PlayDemoFile's path
 boolean         singledemo;            	// quit after playing a demo from cmdline 
  
 boolean         precache = true;        // if true, load all graphics at start 
@@ -141,6 +155,7 @@ wbstartstruct_t wminfo;               	// parms for world map / intermission
 short		consistancy[MAXPLAYERS][BACKUPTICS]; 
  
 byte*		savebuffer;
+int		savecompress = 1;	// UBO_DOOM_SAVE_COMPRESS
  
  
 // 
@@ -453,9 +468,53 @@ void G_BuildTiccmd (ticcmd_t* cmd)
 //
 extern  gamestate_t     wipegamestate; 
  
-void G_DoLoadLevel (void) 
+// UBO: staged loads.  With levelloadbudget (microseconds, doom_api's
+//  UBO_DOOM_LOAD_BUDGET_MS) set, the level changes a single-player game
+//  makes from G_Ticker (a restart after death, the next map, a new game
+//  from the menu) go through G_StageLoadLevel: P_SetupLevel runs only as
+//  far as the budget allows and G_Ticker ends the tic there, without
+//  gametic moving on.  The host calls G_ContinueLoadLevel instead of
+//  running tics until it returns true, then runs the tic again on the
+//  complete level.  Netgames, demos and timedemos load in one go.
+//
+int		levelloadbudget;
+boolean		levelloading;
+static boolean	stagenewgame;
+
+// UBO: level loads since the library was loaded, and what the last and
+//  the longest took.  Only the time the load's own calls ran counts, not
+//  the tics between the steps of a staged one.
+unsigned	levelloads;
+unsigned	lastloadus;
+unsigned	maxloadus;
+static int64_t	loadbusyus;
+
+static void G_CountLoadTime (int64_t start, boolean done)
+{
+    loadbusyus += I_GetTimeUs () - start;
+    if (!done)
+	return;
+    levelloads++;
+    lastloadus = (unsigned)loadbusyus;
+    if (lastloadus > maxloadus)
+	maxloadus = lastloadus;
+    loadbusyus = 0;
+}
+
+static void G_StartLoadLevel (void) 
 { 
     int             i; 
+    char            mapname[16];
+
+    loadbusyus = 0;		// a staged load a crash cut short
+    G_JournalLevel ();
+
+    // UBO: read ahead what the last load of this map read
+    if (gamemode == commercial)
+	sprintf (mapname, "map%02i", gamemap);
+    else
+	sprintf (mapname, "E%iM%i", gameepisode, gamemap);
+    W_StartMapProfile (mapname);
 
     // Set the sky map.
     // First thing, we have a dummy sky texture name,
@@ -492,10 +551,15 @@ void G_DoLoadLevel (void)
 	memset (players[i].frags,0,sizeof(players[i].frags)); 
     } 
 		 
-    P_SetupLevel (gameepisode, gamemap, 0, gameskill);    
+    P_StartSetupLevel (gameepisode, gamemap, 0, gameskill);    
+    gameaction = ga_nothing; 
+}
+
+static void G_FinishLoadLevel (void) 
+{ 
+    W_FinishMapProfile ();
     displayplayer = consoleplayer;		// view the guy you are playing    
     starttime = I_GetTime (); 
-    gameaction = ga_nothing; 
     Z_CheckHeap ();
     
     // clear cmd building stuff
@@ -506,6 +570,62 @@ void G_DoLoadLevel (void)
     memset (mousebuttons, 0, sizeof(mousebuttons)); 
     memset (joybuttons, 0, sizeof(joybuttons)); 
 } 
+
+void G_DoLoadLevel (void) 
+{ 
+    int64_t	start = I_GetTimeUs ();
+
+    UBO_TRACE_BEGIN ("load_level");
+    G_StartLoadLevel ();
+    P_ContinueSetupLevel (0);
+    G_FinishLoadLevel ();
+    UBO_TRACE_END ();
+    G_CountLoadTime (start, true);
+} 
+
+static void G_StageLoadLevel (void) 
+{ 
+    int		i;
+    int64_t	start;
+
+    if (levelloadbudget <= 0 || netgame || demoplayback || demorecording
+	|| timingdemo)
+    {
+	G_DoLoadLevel ();
+	return;
+    }
+    start = I_GetTimeUs ();
+    UBO_TRACE_BEGIN ("load_level");
+    G_StartLoadLevel ();
+    // the old level's mobjs are gone until P_LoadThings spawns new ones
+    for (i=0 ; i<MAXPLAYERS ; i++)
+	players[i].mo = NULL;
+    levelloading = true;
+    UBO_TRACE_END ();
+    G_CountLoadTime (start, false);
+    // a small map is often done within the first budget
+    G_ContinueLoadLevel ();
+} 
+
+boolean G_ContinueLoadLevel (void) 
+{ 
+    boolean	done;
+    int64_t	start;
+
+    if (!levelloading)
+	return true;
+    start = I_GetTimeUs ();
+    UBO_TRACE_BEGIN ("load_level");
+    done = P_ContinueSetupLevel (levelloadbudget);
+    if (done)
+    {
+	G_FinishLoadLevel ();
+	levelloading = false;
+    }
+    UBO_TRACE_END ();
+    G_CountLoadTime (start, done);
+    return done;
+} 
  
  
 //
@@ -630,7 +750,7 @@ void G_Ticker (void)
 	switch (gameaction) 
 	{ 
 	  case ga_loadlevel: 
-	    G_DoLoadLevel (); 
+	    G_StageLoadLevel (); 
 	    break; 
 	  case ga_newgame: 
 	    G_DoNewGame (); 
@@ -644,6 +764,9 @@ void G_Ticker (void)
 	  case ga_playdemo: 
 	    G_DoPlayDemo (); 
 	    break; 
+	  case ga_spectate:
+	    G_DoSpectate ();
+	    break;
 	  case ga_completed: 
 	    G_DoCompleted (); 
 	    break; 
@@ -661,6 +784,10 @@ void G_Ticker (void)
 	    break; 
 	} 
     }
+
+    // UBO: the rest of the tic waits for a staged load to finish
+    if (levelloading)
+	return;
     
     // get commands, check consistancy,
     // and build new consistancy check
@@ -678,6 +805,8 @@ void G_Ticker (void)
 		G_ReadDemoTiccmd (cmd); 
 	    if (demorecording) 
 		G_WriteDemoTiccmd (cmd);
+	    I_SpectateTiccmd (i, cmd);
+	    G_JournalTiccmd (cmd);
 	    
 	    // check for turbo cheats
 	    if (cmd->forwardmove > TURBOTHRESHOLD 
@@ -723,6 +852,9 @@ void G_Ticker (void)
 		    break; 
 					 
 		  case BTS_SAVEGAME: 
+		    // UBO: the game saves, not the spectators mirroring it
+		    if (spectating)
+			break;
 		    if (!savedescription[0]) 
 			strcpy (savedescription, "NET GAME"); 
 		    savegameslot =  
@@ -735,6 +867,7 @@ void G_Ticker (void)
     }
     
     // do main actions
+    tickerheld = false;
     switch (gamestate) 
     { 
       case GS_LEVEL: 
@@ -742,6 +875,7 @@ void G_Ticker (void)
 	ST_Ticker (); 
 	AM_Ticker (); 
 	HU_Ticker ();            
+	G_TakeSnapshot ();
 	break; 
 	 
       case GS_INTERMISSION: 
@@ -756,6 +890,9 @@ void G_Ticker (void)
 	D_PageTicker (); 
 	break; 
     }        
+
+    // UBO: the tic goes to the spectators mirroring the game
+    I_SpectateTicDone ();
 } 
  
  
@@ -1028,6 +1165,33 @@ void G_SecretExitLevel (void)
     gameaction = ga_completed; 
 } 
  
+//
+// G_PrefetchNextMap
+// Pages the next map's lumps in while the intermission is up, so
+//  P_SetupLevel reads them from memory.
+//
+static void G_PrefetchNextMap (void)
+{
+    char	name[16];
+    int		lumps[ML_BLOCKMAP+1];
+    int		lump;
+    int		i;
+
+    if (gamemode == commercial)
+	sprintf (name, "map%02i", wminfo.next+1);
+    else
+	sprintf (name, "E%iM%i", gameepisode, wminfo.next+1);
+
+    lump = W_CheckNumForName (name);
+    if (lump == -1 || lump + ML_BLOCKMAP >= numlumps)
+	return;
+
+    for (i=0 ; i<=ML_BLOCKMAP ; i++)
+	lumps[i] = lump + i;
+    W_PrefetchLumps (lumps, ML_BLOCKMAP+1);
+}
+
+
 void G_DoCompleted (void) 
 { 
     int             i; 
@@ -1148,6 +1312,7 @@ void G_DoCompleted (void)
     if (statcopy)
 	memcpy (statcopy, &wminfo, sizeof(wminfo));
 	
+    G_PrefetchNextMap ();
     WI_Start (&wminfo); 
 } 
 
@@ -1184,7 +1349,7 @@ void G_DoWorldDone (void)
 {        
     gamestate = GS_LEVEL; 
     gamemap = wminfo.next+1; 
-    G_DoLoadLevel (); 
+    G_StageLoadLevel (); 
     gameaction = ga_nothing; 
     viewactive = true; 
 } 
@@ -1209,23 +1374,37 @@ void G_LoadGame (char* name)
 #define VERSIONSIZE		16 
 
 
+static boolean	loadsnapshot;	// savebuffer is a rewind snapshot
+
 void G_DoLoadGame (void) 
 { 
-    int		length; 
+    int		length = 0; 
     int		i; 
     int		a,b,c; 
     char	vcheck[VERSIONSIZE]; 
+    boolean	fromsnapshot;
 	 
     gameaction = ga_nothing; 
+    fromsnapshot = loadsnapshot;
+    loadsnapshot = false;
 	 
-    length = M_ReadFile (savename, &savebuffer); 
+    if (!fromsnapshot)
+    {
+	G_ClearSnapshots ();
+	M_FinishWrites ();
+	length = M_MapFile (savename, &savebuffer); 
+    }
     save_p = savebuffer + SAVESTRINGSIZE;
     
     // skip the description field 
     memset (vcheck,0,sizeof(vcheck)); 
     sprintf (vcheck,"version %i",VERSION); 
     if (strcmp (save_p, vcheck)) 
+    {
+	if (!fromsnapshot)
+	    M_UnmapFile (savebuffer, length);
 	return;				// bad version 
+    }
     save_p += VERSIONSIZE; 
 			 
     gameskill = *save_p++; 
@@ -1234,8 +1413,10 @@ void G_DoLoadGame (void)
     for (i=0 ; i<MAXPLAYERS ; i++) 
 	playeringame[i] = *save_p++; 
 
-    // load a base level 
+    // load a base level, without the things the save replaces
+    loadinggame = true;
     G_InitNew (gameskill, gameepisode, gamemap); 
+    loadinggame = false;
  
     // get the times 
     a = *save_p++; 
@@ -1253,7 +1434,8 @@ void G_DoLoadGame (void)
 	I_Error ("Bad savegame");
     
     // done 
-    Z_Free (savebuffer); 
+    if (!fromsnapshot)
+	M_UnmapFile (savebuffer, length); 
  
     if (setsizeneeded)
 	R_ExecuteSetViewSize ();
@@ -1278,21 +1460,18 @@ G_SaveGame
     sendsave = true; 
 } 
  
-void G_DoSaveGame (void) 
-{ 
-    char	name[100]; 
+//
+// G_WriteGame
+// Serializes the game into P_SaveBuffer the way a savegame file
+//  holds it, returning its length.
+//
+static int G_WriteGame (char* description)
+{
     char	name2[VERSIONSIZE]; 
-    char*	description; 
-    int		length; 
     int		i; 
-	
-    if (M_CheckParm("-cdrom"))
-	sprintf(name,"c:\\doomdata\\"SAVEGAMENAME"%d.dsg",savegameslot);
-    else
-	sprintf (name,SAVEGAMENAME"%d.dsg",savegameslot); 
-    description = savedescription; 
-	 
-    save_p = savebuffer = screens[1]+0x4000; 
+
+    P_SaveBegin ();
+    P_SaveReserve (SAVESTRINGSIZE + VERSIONSIZE + 3 + MAXPLAYERS + 3);
 	 
     memcpy (save_p, description, SAVESTRINGSIZE); 
     save_p += SAVESTRINGSIZE; 
@@ -1315,12 +1494,24 @@ void G_DoSaveGame (void)
     P_ArchiveThinkers (); 
     P_ArchiveSpecials (); 
 	 
+    P_SaveReserve (1);
     *save_p++ = 0x1d;		// consistancy marker 
+
+    return save_p - P_SaveBuffer ();
+}
+
+void G_DoSaveGame (void) 
+{ 
+    char	name[100]; 
+    int		length; 
+	
+    if (M_CheckParm("-cdrom"))
+	sprintf(name,"c:\\doomdata\\"SAVEGAMENAME"%d.dsg",savegameslot);
+    else
+	sprintf (name,SAVEGAMENAME"%d.dsg",savegameslot); 
 	 
-    length = save_p - savebuffer; 
-    if (length > SAVEGAMESIZE) 
-	I_Error ("Savegame buffer overrun"); 
-    M_WriteFile (name, savebuffer, length); 
+    length = G_WriteGame (savedescription);
+    M_WriteFileAsync (name, P_SaveBuffer (), length, savecompress); 
     gameaction = ga_nothing; 
     savedescription[0] = 0;		 
 	 
@@ -1331,6 +1522,364 @@ void G_DoSaveGame (void)
 } 
  
 
+//
+// REWIND SNAPSHOTS
+// UBO: once a second of level time G_TakeSnapshot writes the game with
+//  the savegame serializers into memory.  The ring keeps each snapshot
+//  only as its XOR against the one before, with the zero runs coded
+//  out, so a second costs a few KB.  snapbase holds the oldest in full
+//  (its own delta is never stored) and snaplast the newest, which the
+//  next delta is coded against.
+//  Every raw buffer is zero past its length, so two of different
+//  lengths XOR as if padded.  G_Rewind rebuilds one into snapwork and
+//  loads it through G_DoLoadGame without touching the disk.
+//
+#define SNAPSHOTSIZE	(2*SAVEGAMESIZE)
+#define MAXSNAPSHOTS	120
+
+int		rewindseconds = 30;	// UBO_DOOM_REWIND_SECONDS
+
+typedef struct
+{
+    byte*	delta;
+    int		length;
+} snapshot_t;
+
+static snapshot_t	snapshots[MAXSNAPSHOTS];
+static int		snapfirst;
+static int		numsnapshots;
+
+static byte*		snapbase;
+static byte*		snaplast;
+static byte*		snapwork;
+static byte*		snapcode;
+static byte*		snapquick;
+static int		snapbaselength;
+static int		snaplastlength;
+static int		snapworklength;
+static int		snapquicklength;
+
+
+static boolean G_InitSnapshots (void)
+{
+    if (snapwork)
+	return true;
+
+    snapbase = calloc (1, SNAPSHOTSIZE);
+    snaplast = calloc (1, SNAPSHOTSIZE);
+    snapwork = calloc (1, SNAPSHOTSIZE);
+    snapquick = calloc (1, SNAPSHOTSIZE);
+    // a literal run costs 8 bytes and ends only at 8 zeros
+    snapcode = malloc (2*SNAPSHOTSIZE);
+    if (snapbase && snaplast && snapwork && snapquick && snapcode)
+	return true;
+
+    fprintf (stderr, "[doom] rewind: no memory for snapshot buffers\n");
+    free (snapbase);
+    free (snaplast);
+    free (snapwork);
+    free (snapquick);
+    free (snapcode);
+    snapbase = snaplast = snapwork = snapquick = snapcode = NULL;
+    rewindseconds = 0;
+    return false;
+}
+
+
+//
+// G_WriteSnapshot
+// G_WriteGame copied into a zero padded snapshot buffer.
+//
+static int G_WriteSnapshot (byte* buf, int oldlength)
+{
+    static char	description[SAVESTRINGSIZE] = "rewind";
+    int		length;
+
+    length = G_WriteGame (description);
+    if (length > SNAPSHOTSIZE)
+	I_Error ("G_WriteSnapshot: %i byte snapshot", length);
+    memcpy (buf, P_SaveBuffer (), length);
+    if (length < oldlength)
+	memset (buf+length, 0, oldlength-length);
+    return length;
+}
+
+
+//
+// G_CodeDelta
+// Codes to XOR from into snapcode as its length, then runs of
+//  (zero byte count, literal count, literals).
+//
+static int
+G_CodeDelta
+( byte*		from,
+  int		fromlength,
+  byte*		to,
+  int		tolength )
+{
+    byte*	out;
+    int		length;
+    int		i;
+    int		start;
+    int		end;
+    int		zeros;
+    int		count;
+
+    length = fromlength > tolength ? fromlength : tolength;
+    out = snapcode;
+    memcpy (out, &tolength, sizeof(int));
+    out += sizeof(int);
+
+    i = 0;
+    while (i < length)
+    {
+	start = i;
+	while (i < length && from[i] == to[i])
+	    i++;
+	if (i == length)
+	    break;
+	zeros = i - start;
+
+	// literals up to the next run of 8 matching bytes
+	start = i;
+	end = i;
+	while (i < length && i - end < 8)
+	{
+	    if (from[i] != to[i])
+		end = i+1;
+	    i++;
+	}
+	i = end;
+	count = end - start;
+
+	memcpy (out, &zeros, sizeof(int));
+	memcpy (out+sizeof(int), &count, sizeof(int));
+	out += 2*sizeof(int);
+	for ( ; start < end ; start++)
+	    *out++ = from[start] ^ to[start];
+    }
+    return out - snapcode;
+}
+
+
+//
+// G_ApplyDelta
+// XORs a G_CodeDelta result into buf, returning the new length.
+//
+static int G_ApplyDelta (byte* buf, snapshot_t* snap)
+{
+    byte*	in;
+    byte*	end;
+    byte*	p;
+    int		length;
+    int		zeros;
+    int		count;
+
+    in = snap->delta;
+    end = in + snap->length;
+    memcpy (&length, in, sizeof(int));
+    in += sizeof(int);
+
+    p = buf;
+    while (in < end)
+    {
+	memcpy (&zeros, in, sizeof(int));
+	memcpy (&count, in+sizeof(int), sizeof(int));
+	in += 2*sizeof(int);
+	p += zeros;
+	while (count--)
+	    *p++ ^= *in++;
+    }
+    return length;
+}
+
+
+static snapshot_t* G_Snapshot (int index)
+{
+    return &snapshots[(snapfirst+index) % MAXSNAPSHOTS];
+}
+
+//
+// G_DropOldestSnapshot
+// Steps snapbase forward to the next snapshot.
+//
+static void G_DropOldestSnapshot (void)
+{
+    if (numsnapshots > 1)
+	snapbaselength = G_ApplyDelta (snapbase, G_Snapshot(1));
+    free (G_Snapshot(0)->delta);
+    G_Snapshot(0)->delta = NULL;
+    snapfirst = (snapfirst+1) % MAXSNAPSHOTS;
+    numsnapshots--;
+}
+
+
+void G_ClearSnapshots (void)
+{
+    for ( ; numsnapshots ; numsnapshots--)
+    {
+	free (G_Snapshot(numsnapshots-1)->delta);
+	G_Snapshot(numsnapshots-1)->delta = NULL;
+    }
+    snapfirst = 0;
+}
+
+
+//
+// G_FreeSnapshots
+// Drops the ring and frees its buffers; the next snapshot allocates
+//  them again.
+//
+void G_FreeSnapshots (void)
+{
+    G_ClearSnapshots ();
+    free (snapbase);
+    free (snaplast);
+    free (snapwork);
+    free (snapquick);
+    free (snapcode);
+    snapbase = snaplast = snapwork = snapquick = snapcode = NULL;
+    snapquicklength = 0;
+}
+
+
+//
+// G_TakeSnapshot
+// Called after each level tic.  Demos and netgames are left alone,
+//  as is a dead player: rewinding should land before the death.
+//
+void G_TakeSnapshot (void)
+{
+    snapshot_t*	snap;
+    int		length;
+    int		codelength;
+    int		limit;
+
+    limit = rewindseconds < MAXSNAPSHOTS ? rewindseconds : MAXSNAPSHOTS;
+    if (limit <= 0
+	|| leveltime % TICRATE
+	|| demoplayback || demorecording || netgame || spectating
+	|| players[consoleplayer].playerstate != PST_LIVE)
+	return;
+    if (!G_InitSnapshots ())
+	return;
+
+    snapworklength = G_WriteSnapshot (snapwork, snapworklength);
+
+    while (numsnapshots >= limit)
+	G_DropOldestSnapshot ();
+
+    snap = G_Snapshot (numsnapshots);
+    if (!numsnapshots)
+    {
+	// the oldest is only ever read from snapbase
+	snap->delta = NULL;
+	snap->length = 0;
+	length = snapworklength > snapbaselength ? snapworklength : snapbaselength;
+	memcpy (snapbase, snapwork, length);
+	snapbaselength = snapworklength;
+    }
+    else
+    {
+	codelength = G_CodeDelta (snaplast, snaplastlength,
+				  snapwork, snapworklength);
+	snap->delta = malloc (codelength);
+	if (!snap->delta)
+	{
+	    // leave snaplast alone so the ring stays consistent
+	    fprintf (stderr, "[doom] rewind: no memory for a snapshot\n");
+	    return;
+	}
+	memcpy (snap->delta, snapcode, codelength);
+	snap->length = codelength;
+    }
+
+    length = snapworklength > snaplastlength ? snapworklength : snaplastlength;
+    memcpy (snaplast, snapwork, length);
+    snaplastlength = snapworklength;
+    numsnapshots++;
+}
+
+
+//
+// G_LoadSnapshot
+// Loads snapwork at the start of the next G_Ticker.
+//
+static void G_LoadSnapshot (void)
+{
+    savebuffer = snapwork;
+    loadsnapshot = true;
+    gameaction = ga_loadgame;
+}
+
+
+//
+// G_Rewind
+// Goes back to the snapshot taken about seconds ago, or the oldest,
+//  and forgets the ones after it.
+//
+boolean G_Rewind (int seconds)
+{
+    int		index;
+    int		i;
+
+    if (!numsnapshots || demoplayback || netgame)
+	return false;
+
+    index = numsnapshots - (seconds > 0 ? seconds : 1);
+    if (index < 0)
+	index = 0;
+
+    memcpy (snapwork, snapbase, SNAPSHOTSIZE);
+    snapworklength = snapbaselength;
+    for (i=1 ; i<=index ; i++)
+	snapworklength = G_ApplyDelta (snapwork, G_Snapshot(i));
+
+    for (i=index+1 ; i<numsnapshots ; i++)
+    {
+	free (G_Snapshot(i)->delta);
+	G_Snapshot(i)->delta = NULL;
+    }
+    numsnapshots = index+1;
+    memcpy (snaplast, snapwork, SNAPSHOTSIZE);
+    snaplastlength = snapworklength;
+
+    G_LoadSnapshot ();
+    return true;
+}
+
+
+//
+// G_QuickSnapshot
+// A savegame slot kept in memory, so quick saves don't write the
+//  SD card.
+//
+boolean G_QuickSnapshot (void)
+{
+    if (gamestate != GS_LEVEL || demoplayback || netgame)
+	return false;
+    if (!G_InitSnapshots ())
+	return false;
+
+    snapquicklength = G_WriteSnapshot (snapquick, snapquicklength);
+    players[consoleplayer].message = GGSAVED;
+    return true;
+}
+
+
+boolean G_QuickRestore (void)
+{
+    if (!snapquicklength || demoplayback || netgame)
+	return false;
+
+    memcpy (snapwork, snapquick, SNAPSHOTSIZE);
+    snapworklength = snapquicklength;
+    G_ClearSnapshots ();
+    G_LoadSnapshot ();
+    return true;
+}
+
+
 //
 // G_InitNew
 // Can be called by the startup code or the menu task,
@@ -1355,6 +1904,7 @@ G_DeferedInitNew
 
 void G_DoNewGame (void) 
 {
+    G_ClearSnapshots ();
     demoplayback = false; 
     netdemo = false;
     netgame = false;
@@ -1364,7 +1914,14 @@ void G_DoNewGame (void)
     fastparm = false;
     nomonsters = false;
     consoleplayer = 0;
+    stagenewgame = !demobegin;
     G_InitNew (d_skill, d_episode, d_map); 
+    stagenewgame = false;
+    if (demobegin)
+    {
+	demobegin = false;
+	G_BeginRecording ();
+    }
     gameaction = ga_nothing; 
 } 
 
@@ -1489,7 +2046,13 @@ G_InitNew
 	    break;
 	} 
  
-    G_DoLoadLevel (); 
+    G_JournalBegin ();
+    I_SpectateBegin ();
+
+    if (stagenewgame)
+	G_StageLoadLevel ();
+    else
+	G_DoLoadLevel (); 
 } 
  
 
@@ -1499,9 +2062,37 @@ G_InitNew
 #define DEMOMARKER		0x80
 
 
+//
+// UBO: recordings no longer go to a -maxdemo sized zone buffer that
+// is written out at the end.  The tics collect in a small chunk that
+// is appended to the open demo file each time it fills, so a session
+// can run for as long as it likes and a crash loses at most a chunk.
+//
+#define DEMOCHUNK		4096
+
+static byte	demochunk[DEMOCHUNK];
+
+static void G_FlushDemo (void)
+{
+    if (demo_p > demochunk
+	&& (fwrite (demochunk, 1, demo_p - demochunk, demofile)
+	    != (size_t)(demo_p - demochunk)
+	    || fflush (demofile)))
+	fprintf (stderr, "[doom] demo: write to %s failed\n", demoname);
+    demo_p = demochunk;
+}
+
+
+// UBO: Doom 1.91 demos (crash journals) keep all 16 bits of angleturn
+#define LONGTICSVERSION		111
+
+static boolean	demolongtics;
+
 void G_ReadDemoTiccmd (ticcmd_t* cmd) 
 { 
-    if (*demo_p == DEMOMARKER) 
+    // a file cut short (a recording that never finished) ends the
+    // same way as one with its marker
+    if (demo_p + (demolongtics ? 5 : 4) > demoend || *demo_p == DEMOMARKER) 
     {
 	// end of demo data stream 
 	G_CheckDemoStatus (); 
@@ -1509,7 +2100,13 @@ void G_ReadDemoTiccmd (ticcmd_t* cmd)
     } 
     cmd->forwardmove = ((signed char)*demo_p++); 
     cmd->sidemove = ((signed char)*demo_p++); 
-    cmd->angleturn = ((unsigned char)*demo_p++)<<8; 
+    if (demolongtics)
+    {
+	cmd->angleturn = demo_p[0] | (demo_p[1] << 8);
+	demo_p += 2;
+    }
+    else
+	cmd->angleturn = ((unsigned char)*demo_p++)<<8; 
     cmd->buttons = (unsigned char)*demo_p++; 
 } 
 
@@ -1518,17 +2115,15 @@ void G_WriteDemoTiccmd (ticcmd_t* cmd)
 { 
     if (gamekeydown['q'])           // press q to end demo recording 
 	G_CheckDemoStatus (); 
+    if (!demorecording)
+	return;
+    if (demo_p > demoend - 16)
+	G_FlushDemo ();
     *demo_p++ = cmd->forwardmove; 
     *demo_p++ = cmd->sidemove; 
     *demo_p++ = (cmd->angleturn+128)>>8; 
     *demo_p++ = cmd->buttons; 
     demo_p -= 4; 
-    if (demo_p > demoend - 16)
-    {
-	// no more space 
-	G_CheckDemoStatus (); 
-	return; 
-    } 
 	
     G_ReadDemoTiccmd (cmd);         // make SURE it is exactly the same 
 } 
@@ -1537,22 +2132,12 @@ void G_WriteDemoTiccmd (ticcmd_t* cmd)
  
 //
 // G_RecordDemo 
+// The file is opened by G_BeginRecording; -maxdemo is no longer needed.
 // 
 void G_RecordDemo (char* name) 
 { 
-    int             i; 
-    int				maxsize;
-	
     usergame = false; 
-    strcpy (demoname, name); 
-    strcat (demoname, ".lmp"); 
-    maxsize = 0x20000;
-    i = M_CheckParm ("-maxdemo");
-    if (i && i<myargc-1)
-	maxsize = atoi(myargv[i+1])*1024;
-    demobuffer = Z_Malloc (maxsize,PU_STATIC,NULL); 
-    demoend = demobuffer + maxsize;
-	
+    snprintf (demoname, sizeof(demoname), "%s.lmp", name); 
     demorecording = true; 
 } 
  
@@ -1561,7 +2146,16 @@ void G_BeginRecording (void)
 { 
     int             i; 
 		
-    demo_p = demobuffer;
+    demofile = fopen (demoname, "wb");
+    if (!demofile)
+    {
+	fprintf (stderr, "[doom] demo: can't create %s\n", demoname);
+	demorecording = false;
+	return;
+    }
+    demobuffer = demo_p = demochunk;
+    demoend = demochunk + DEMOCHUNK;
+    demolongtics = false;
 	
     *demo_p++ = VERSION;
     *demo_p++ = gameskill; 
@@ -1576,8 +2170,234 @@ void G_BeginRecording (void)
     for (i=0 ; i<MAXPLAYERS ; i++) 
 	*demo_p++ = playeringame[i]; 		 
 } 
+
+
+//
+// G_RecordDemoFile
+// UBO: record to a path from the library API.  The recording starts
+// from a fresh load of the current map (E1M1 / MAP01 on medium when
+// no level is running) so that playback begins where it did.
+//
+boolean G_RecordDemoFile (char* path)
+{
+    if (demorecording || demoplayback || netgame)
+	return false;
+    snprintf (demoname, sizeof(demoname), "%s", path);
+    demorecording = true;
+    demobegin = true;
+    if (gamestate == GS_LEVEL)
+	G_DeferedInitNew (gameskill, gameepisode, gamemap);
+    else
+	G_DeferedInitNew (sk_medium, 1, 1);
+    return true;
+}
  
 
+//
+// CRASH JOURNAL
+// UBO: a game begun by G_InitNew keeps the ticcmds G_Ticker hands its
+//  players in a ring of the last journalminutes, next to the header a
+//  demo of it would open with.  When a tic crashes, doom_api calls
+//  G_WriteJournal, which writes them to journalfile as a Doom 1.91
+//  longtics demo (all 16 bits of angleturn, so the replay turns the
+//  way the game did) for doom_demo_play on a bench machine.
+// Once the ring has dropped the start of the game, or a savegame or
+//  rewind snapshot was loaded into it, the demo opens at the oldest
+//  level start still held instead.  That replays from a pistol start
+//  and that level's prndindex is only logged, so it shows the way to
+//  the crash rather than repeating it exactly.
+// The ring is allocated with the first game, for journalminutes of
+//  a four player game; a tic costs a 5 byte copy a player.
+//
+#define JOURNALCMDSIZE		5
+#define JOURNALLEVELS		32
+#define JOURNALHEADER		13
+
+int		journalminutes = 10;	// UBO_DOOM_JOURNAL_MINUTES
+char*		journalfile;		// NULL = no journal
+
+extern int	prndindex;
+
+typedef struct
+{
+    int		cmd;		// journalcmds when it began
+    int		episode;
+    int		map;
+    int		prndindex;
+} journallevel_t;
+
+static byte*		journal;
+static int		journalsize;	// ticcmds the ring holds
+static int		journalcmds;	// ticcmds since the game began
+static boolean		journalexact;	// a new game, nothing loaded since
+static byte		journalheader[JOURNALHEADER];
+static journallevel_t	journallevels[JOURNALLEVELS];
+static int		numjournallevels;
+
+
+//
+// G_JournalBegin
+// From G_InitNew: a new game, or the base level of a loaded one.
+//
+static void G_JournalBegin (void)
+{
+    byte*	p;
+    int		i;
+
+    journalcmds = 0;
+    numjournallevels = 0;
+    journalexact = !loadinggame;
+    if (!journalfile || journalminutes <= 0)
+	return;
+    if (!journal)
+    {
+	journalsize = (journalminutes < 60 ? journalminutes : 60)
+	    * 60 * TICRATE * MAXPLAYERS;
+	journal = malloc (journalsize * JOURNALCMDSIZE);
+	if (!journal)
+	{
+	    UBO_LOG (UBO_LOG_ERROR, "[doom] journal: no memory for %i minutes\n",
+		     journalminutes);
+	    journalminutes = 0;
+	    return;
+	}
+    }
+
+    p = journalheader;
+    *p++ = LONGTICSVERSION;
+    *p++ = gameskill;
+    *p++ = gameepisode;
+    *p++ = gamemap;
+    *p++ = deathmatch;
+    *p++ = respawnparm;
+    *p++ = fastparm;
+    *p++ = nomonsters;
+    *p++ = consoleplayer;
+    for (i=0 ; i<MAXPLAYERS ; i++)
+	*p++ = playeringame[i];
+}
+
+
+//
+// G_JournalLevel
+// A level starts at the next ticcmd.
+//
+static void G_JournalLevel (void)
+{
+    journallevel_t*	level;
+
+    if (!journal)
+	return;
+    level = &journallevels[numjournallevels++ % JOURNALLEVELS];
+    level->cmd = journalcmds;
+    level->episode = gameepisode;
+    level->map = gamemap;
+    level->prndindex = prndindex;
+}
+
+
+static void G_JournalTiccmd (ticcmd_t* cmd)
+{
+    byte*	p;
+
+    if (!journal)
+	return;
+    if (demoplayback)
+    {
+	// a demo is its own record; the next game starts a new one
+	journalcmds = numjournallevels = 0;
+	journalexact = false;
+	return;
+    }
+    p = journal + (journalcmds % journalsize) * JOURNALCMDSIZE;
+    p[0] = cmd->forwardmove;
+    p[1] = cmd->sidemove;
+    p[2] = cmd->angleturn;
+    p[3] = cmd->angleturn >> 8;
+    p[4] = cmd->buttons;
+    journalcmds++;
+}
+
+
+//
+// G_WriteJournal
+// The journal as a demo in journalfile; false if there is nothing to
+//  write or it could not be.  M_WriteFileParts does not allocate, as
+//  the heap may be what crashed.
+//
+boolean G_WriteJournal (void)
+{
+    byte		header[JOURNALHEADER];
+    byte		marker;
+    void*		parts[4];
+    int			lengths[4];
+    journallevel_t*	level;
+    int			first;
+    int			count;
+    int			start;
+    int			piece;
+    int			i;
+    boolean		ok;
+
+    if (!journal || !numjournallevels)
+	return false;
+
+    // the oldest ticcmd still in the ring
+    first = journalcmds > journalsize ? journalcmds - journalsize : 0;
+    memcpy (header, journalheader, JOURNALHEADER);
+    level = NULL;
+    if (!journalexact || first > 0)
+    {
+	i = numjournallevels > JOURNALLEVELS ? numjournallevels - JOURNALLEVELS : 0;
+	for ( ; i<numjournallevels ; i++)
+	{
+	    level = &journallevels[i % JOURNALLEVELS];
+	    if (level->cmd >= first)
+		break;
+	}
+	if (i == numjournallevels)
+	{
+	    UBO_LOG (UBO_LOG_ERROR, "[doom] journal: no level start in the last"
+		     " %i minutes to replay from\n", journalminutes);
+	    return false;
+	}
+	first = level->cmd;
+	header[2] = level->episode;
+	header[3] = level->map;
+    }
+
+    // the ring from first on, in at most two pieces; none if the
+    //  crash came while the level loaded
+    count = journalcmds - first;
+    start = first % journalsize;
+    piece = count < journalsize - start ? count : journalsize - start;
+    marker = DEMOMARKER;
+    parts[0] = header;
+    lengths[0] = JOURNALHEADER;
+    parts[1] = journal + start*JOURNALCMDSIZE;
+    lengths[1] = piece * JOURNALCMDSIZE;
+    parts[2] = journal;
+    lengths[2] = (count - piece) * JOURNALCMDSIZE;
+    parts[3] = &marker;
+    lengths[3] = 1;
+    ok = M_WriteFileParts (journalfile, parts, lengths, 4);
+    if (!ok)
+    {
+	UBO_LOG (UBO_LOG_ERROR, "[doom] journal: couldn't write %s\n", journalfile);
+	return false;
+    }
+
+    if (level)
+	UBO_LOG (UBO_LOG_INFO, "[doom] journal: %s replays %i tics from a pistol start"
+		 " of E%iM%i (prndindex was %i)\n", journalfile,
+		 journalcmds - first, level->episode, level->map, level->prndindex);
+    else
+	UBO_LOG (UBO_LOG_INFO, "[doom] journal: %s replays the game's %i tics\n",
+		 journalfile, journalcmds);
+    return ok;
+}
+
+
 //
 // G_PlayDemo 
 //
@@ -1586,6 +2406,7 @@ char*	defdemoname;
 
 extern int ubo_library_mode;
 extern int pagetic;
+extern void ubo_timedemo_done (int realtics);
 
 void G_DeferedPlayDemo (char* name) 
 {
@@ -1603,21 +2424,76 @@ void G_DeferedPlayDemo (char* name)
     defdemoname = name; 
     gameaction = ga_playdemo; 
 } 
+
+//
+// G_FreeDemo
+// Lumps go back to the cache, files are unmapped.
+//
+static void G_FreeDemo (void)
+{
+    if (demomapped)
+	M_UnmapFile (demobuffer, demomapped);
+    else
+	Z_ChangeTag (demobuffer, PU_CACHE);
+    demomapped = 0;
+}
+
+//
+// G_PlayDemoFile
+// UBO: play a demo from a file (one G_RecordDemoFile wrote) rather
+// than a WAD lump.  Unlike the WAD demos these are this version, so
+// library mode can play them.
+//
+boolean G_PlayDemoFile (char* path)
+{
+    if (demorecording || demoplayback || netgame)
+	return false;
+    snprintf (demofilename, sizeof(demofilename), "%s", path);
+    defdemoname = demofilename;
+    gameaction = ga_playdemo;
+    return true;
+}
  
 void G_DoPlayDemo (void) 
 { 
     skill_t skill; 
     int             i, episode, map; 
+    int             length;
 	 
     gameaction = ga_nothing; 
-    demobuffer = demo_p = W_CacheLumpName (defdemoname, PU_STATIC); 
-    if ( *demo_p++ != VERSION)
+    if (defdemoname == demofilename)
+    {
+	length = M_MapFile (demofilename, &demobuffer);
+	if (length < 13)
+	{
+	    fprintf (stderr, "[doom] demo: can't read %s\n", demofilename);
+	    if (length >= 0)
+		M_UnmapFile (demobuffer, length);
+	    D_AdvanceDemo ();
+	    return;
+	}
+	demomapped = length;
+    }
+    else
+    {
+	demobuffer = W_CacheLumpName (defdemoname, PU_STATIC); 
+	length = W_LumpLength (W_GetNumForName (defdemoname));
+    }
+    demo_p = demobuffer;
+    demoend = demobuffer + length;
+    // IWAD demos are v1.9 (109); the 1.9 and 1.10 game logic is the same,
+    // so accept them for timing runs, where only the tic count matters.
+    demolongtics = *demo_p == LONGTICSVERSION;
+    if ( *demo_p != VERSION && !demolongtics
+	 && !(timingdemo && *demo_p == 109))
     {
       fprintf( stderr, "Demo is from a different game version!\n");
       gameaction = ga_nothing;
+      G_FreeDemo ();
       D_AdvanceDemo ();  // skip to next title sequence instead of leaving a half-state
       return;
     }
+    demo_p++;
     
     skill = *demo_p++; 
     episode = *demo_p++; 
@@ -1645,6 +2521,46 @@ void G_DoPlayDemo (void)
     demoplayback = true; 
 } 
 
+//
+// G_DoSpectate
+// UBO: a spectator begins the session of the game it mirrors the way
+//  G_DoPlayDemo begins a demo, from the settings the game began it
+//  with; I_SpectateBegin then sets the P_Random index it started at.
+//
+void G_DeferedSpectate (void)
+{
+    gameaction = ga_spectate;
+}
+
+void G_DoSpectate (void)
+{
+    const spectate_start_t*	start;
+    int				i;
+
+    gameaction = ga_nothing;
+    // a demo playing ends without going back to the title loop
+    if (demoplayback)
+    {
+	G_FreeDemo ();
+	demoplayback = false;
+    }
+    else if (demorecording)
+	G_CheckDemoStatus ();
+    start = I_SpectateStart ();
+    deathmatch = start->deathmatch;
+    respawnparm = start->respawn;
+    fastparm = start->fast;
+    nomonsters = start->nomonsters;
+    consoleplayer = start->consoleplayer;
+    for (i=0 ; i<MAXPLAYERS ; i++)
+	playeringame[i] = start->playeringame[i];
+    // the spectator runs every player, as netdemos do
+    netgame = netdemo = start->netgame;
+
+    G_InitNew (start->skill, start->episode, start->map);
+    usergame = false;
+}
+
 //
 // G_TimeDemo 
 //
@@ -1677,8 +2593,16 @@ boolean G_CheckDemoStatus (void)
     if (timingdemo) 
     { 
 	endtime = I_GetTime (); 
-	I_Error ("timed %i gametics in %i realtics",gametic 
-		 , endtime-starttime); 
+	// In library mode I_Error would kill the engine: hand the timing
+	// to ubodoom_bench and fall through to the normal playback cleanup.
+	if (ubo_library_mode)
+	{
+	    ubo_timedemo_done (endtime-starttime);
+	    timingdemo = false;
+	}
+	else
+	    I_Error ("timed %i gametics in %i realtics",gametic 
+		     , endtime-starttime); 
     } 
 	 
     if (demoplayback) 
@@ -1686,7 +2610,7 @@ boolean G_CheckDemoStatus (void)
 	if (singledemo) 
 	    I_Quit (); 
 			 
-	Z_ChangeTag (demobuffer, PU_CACHE); 
+	G_FreeDemo ();
 	demoplayback = false; 
 	netdemo = false;
 	netgame = false;
@@ -1703,10 +2627,15 @@ boolean G_CheckDemoStatus (void)
     if (demorecording) 
     { 
 	*demo_p++ = DEMOMARKER; 
-	M_WriteFile (demoname, demobuffer, demo_p - demobuffer); 
-	Z_Free (demobuffer); 
+	G_FlushDemo ();
+	fclose (demofile);
+	demofile = NULL;
 	demorecording = false; 
-	I_Error ("Demo %s recorded",demoname); 
+	// In library mode the game simply carries on unrecorded.
+	if (ubo_library_mode)
+	    fprintf (stderr, "[doom] demo %s recorded\n", demoname);
+	else
+	    I_Error ("Demo %s recorded",demoname); 
     } 
 	 
     return false; 
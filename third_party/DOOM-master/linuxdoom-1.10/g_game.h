@@ -60,16 +60,51 @@ void G_PlayDemo (char* name);
 void G_TimeDemo (char* name);
 boolean G_CheckDemoStatus (void);
 
+// UBO: record / play demo files for the library API, see g_game.c.
+boolean G_RecordDemoFile (char* path);
+boolean G_PlayDemoFile (char* path);
+
+// UBO: a spectator starts the session of the game it mirrors
+//  (i_spectate.h) at the next G_Ticker.
+void G_DeferedSpectate (void);
+
 void G_ExitLevel (void);
 void G_SecretExitLevel (void);
 
 void G_WorldDone (void);
 
+// UBO: staged level loads, see g_game.c.
+extern int levelloadbudget;
+extern boolean levelloading;
+boolean G_ContinueLoadLevel (void);
+// UBO: level load times for ubo_status_t, see g_game.c.
+extern unsigned levelloads;
+extern unsigned lastloadus;
+extern unsigned maxloadus;
+
 void G_Ticker (void);
 boolean G_Responder (event_t*	ev);
 
 void G_ScreenShot (void);
 
+// UBO: savegames written zlib packed (M_WriteFileAsync); loads take
+//  both.
+extern int savecompress;
+
+// UBO: crash journal, see g_game.c.  G_WriteJournal writes the last
+//  journalminutes of ticcmds to journalfile as a demo.
+extern int journalminutes;
+extern char* journalfile;
+boolean G_WriteJournal (void);
+
+// UBO: in-memory rewind ring and quick slot, see g_game.c.
+extern int rewindseconds;
+void G_ClearSnapshots (void);
+void G_FreeSnapshots (void);
+boolean G_Rewind (int seconds);
+boolean G_QuickSnapshot (void);
+boolean G_QuickRestore (void);
+
 
 #endif
 //-----------------------------------------------------------------------------
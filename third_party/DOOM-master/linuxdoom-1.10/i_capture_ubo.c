@@ -0,0 +1,679 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "doom_api.h"
+#include "doomdef.h"
+#include "i_mailbox.h"
+#include "i_video.h"
+#include "v_video.h"
+
+// Gameplay capture (doom_capture_start, UBO_DOOM_CAPTURE):
+// - I_FinishUpdate hands each shown 8-bit frame and its palette to
+//   I_CaptureFrame, which copies the 64 KB into a one-deep mailbox
+//   (i_mailbox.h).  A frame the capture thread hasn't taken yet is
+//   replaced, never queued.
+// - The capture thread converts it to YUV420 through a palette LUT straight
+//   into an mmap'd OUTPUT buffer of the V4L2 memory-to-memory H.264 encoder
+//   (bcm2835-codec's /dev/video11 on a Pi) and writes the encoded CAPTURE
+//   buffers to a file, a FIFO or "udp:host:port" as an Annex B stream.
+// - While both OUTPUT buffers are still with the encoder the frame is
+//   dropped, so a slow encoder or reader costs frames, never tic time.
+
+#define CAP_OUT_BUFS    2
+#define CAP_CAP_BUFS    4
+#define CAP_CAP_BYTES   (512 * 1024)
+#define CAP_UDP_CHUNK   1316        // 7 TS packets; fits a 1500 MTU
+#define CAP_WAIT_MS     20          // encoded data is collected at least this often
+#define CAP_DRAIN_MS    500
+
+typedef struct
+{
+    void* mem;
+    size_t len;
+} capbuf_t;
+
+static int g_fd = -1;               // encoder
+static int g_out = -1;              // file, FIFO or UDP socket
+static int g_udp;
+static char g_outname[256];
+
+static capbuf_t g_obuf[CAP_OUT_BUFS];
+static capbuf_t g_cbuf[CAP_CAP_BUFS];
+static int g_obusy[CAP_OUT_BUFS];
+static int g_width, g_height;
+static int g_ystride, g_yrows;      // luma plane as the driver laid it out
+
+static mailbox_t g_mailbox = MAILBOX_INIT;
+
+static pthread_t g_thread;
+static volatile int g_running;
+static int g_started;
+
+static uint64_t g_period_us;
+static uint64_t g_last_us;
+
+static uint32_t g_encoded, g_replaced, g_dropped;
+static uint64_t g_bytes;
+
+static uint8_t g_ylut[256], g_ulut[256], g_vlut[256];
+static byte g_lutpal[256 * 3];
+static int g_lut_valid;
+
+static int I_CaptureEnvInt(const char* name, int def)
+{
+    const char* v = getenv(name);
+    return (v && v[0] != '\0') ? atoi(v) : def;
+}
+
+static uint64_t I_CaptureNowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static int I_CaptureIoctl(unsigned long req, void* arg)
+{
+    int r;
+    do
+        r = ioctl(g_fd, req, arg);
+    while (r < 0 && errno == EINTR);
+    return r;
+}
+
+//
+// Output
+//
+
+static int I_CaptureOpenOutput(const char* name)
+{
+    struct stat st;
+
+    if (!strncmp(name, "udp:", 4))
+    {
+        char host[128];
+        const char* port = strrchr(name + 4, ':');
+        struct addrinfo hints, *ai;
+        size_t n;
+
+        if (!port || port == name + 4)
+        {
+            fprintf(stderr, "[doom] capture: %s is not udp:host:port\n", name);
+            return -1;
+        }
+        n = (size_t)(port - (name + 4));
+        if (n >= sizeof(host))
+            n = sizeof(host) - 1;
+        memcpy(host, name + 4, n);
+        host[n] = '\0';
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo(host, port + 1, &hints, &ai) != 0)
+        {
+            fprintf(stderr, "[doom] capture: can't resolve %s\n", host);
+            return -1;
+        }
+        g_out = socket(ai->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (g_out < 0 || connect(g_out, ai->ai_addr, ai->ai_addrlen) < 0)
+        {
+            fprintf(stderr, "[doom] capture: udp %s: %s\n", name + 4, strerror(errno));
+            freeaddrinfo(ai);
+            return -1;
+        }
+        freeaddrinfo(ai);
+        g_udp = 1;
+        return 0;
+    }
+
+    // a FIFO can't be opened before its reader is there: wait for one here,
+    // on the thread, while still letting doom_capture_stop() end the wait
+    if (stat(name, &st) == 0 && S_ISFIFO(st.st_mode))
+    {
+        while (g_running)
+        {
+            g_out = open(name, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+            if (g_out >= 0 || errno != ENXIO)
+                break;
+            usleep(100000);
+        }
+        if (g_out >= 0)
+            fcntl(g_out, F_SETFL, fcntl(g_out, F_GETFL) & ~O_NONBLOCK);
+        else if (!g_running)
+            return -1;
+    }
+    else
+        g_out = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (g_out < 0)
+    {
+        fprintf(stderr, "[doom] capture: can't open %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    g_udp = 0;
+    return 0;
+}
+
+static int I_CaptureWrite(const uint8_t* data, size_t len)
+{
+    g_bytes += len;
+    while (len > 0)
+    {
+        size_t n = len;
+        ssize_t w;
+
+        if (g_udp)
+        {
+            if (n > CAP_UDP_CHUNK)
+                n = CAP_UDP_CHUNK;
+            // nobody listening is not an error for a live stream
+            w = send(g_out, data, n, MSG_NOSIGNAL);
+            if (w < 0 && errno != EINTR && errno != ECONNREFUSED && errno != ENOBUFS)
+                return -1;
+            if (w < 0 && errno == EINTR)
+                continue;
+            w = (ssize_t)n;
+        }
+        else
+        {
+            w = write(g_out, data, n);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return -1;
+        }
+        data += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+//
+// Encoder
+//
+
+static void I_CaptureUnmap(void)
+{
+    for (int i = 0; i < CAP_OUT_BUFS; i++)
+    {
+        if (g_obuf[i].mem)
+            munmap(g_obuf[i].mem, g_obuf[i].len);
+        g_obuf[i].mem = NULL;
+    }
+    for (int i = 0; i < CAP_CAP_BUFS; i++)
+    {
+        if (g_cbuf[i].mem)
+            munmap(g_cbuf[i].mem, g_cbuf[i].len);
+        g_cbuf[i].mem = NULL;
+    }
+}
+
+static int I_CaptureMapBuffers(enum v4l2_buf_type type, capbuf_t* bufs, int count)
+{
+    struct v4l2_requestbuffers req;
+
+    memset(&req, 0, sizeof(req));
+    req.count = (uint32_t)count;
+    req.type = type;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (I_CaptureIoctl(VIDIOC_REQBUFS, &req) < 0 || req.count < (uint32_t)count)
+    {
+        fprintf(stderr, "[doom] capture: REQBUFS failed: %s\n", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        struct v4l2_buffer buf;
+        struct v4l2_plane plane;
+
+        memset(&buf, 0, sizeof(buf));
+        memset(&plane, 0, sizeof(plane));
+        buf.type = type;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = (uint32_t)i;
+        buf.m.planes = &plane;
+        buf.length = 1;
+        if (I_CaptureIoctl(VIDIOC_QUERYBUF, &buf) < 0)
+            return -1;
+        bufs[i].len = plane.length;
+        bufs[i].mem = mmap(NULL, plane.length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           g_fd, plane.m.mem_offset);
+        if (bufs[i].mem == MAP_FAILED)
+        {
+            bufs[i].mem = NULL;
+            fprintf(stderr, "[doom] capture: mmap failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int I_CaptureQueue(enum v4l2_buf_type type, int index, size_t used, uint64_t time_us)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+
+    memset(&buf, 0, sizeof(buf));
+    memset(&plane, 0, sizeof(plane));
+    buf.type = type;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = (uint32_t)index;
+    buf.m.planes = &plane;
+    buf.length = 1;
+    plane.bytesused = (uint32_t)used;
+    buf.timestamp.tv_sec = (time_t)(time_us / 1000000u);
+    buf.timestamp.tv_usec = (suseconds_t)(time_us % 1000000u);
+    return I_CaptureIoctl(VIDIOC_QBUF, &buf);
+}
+
+static void I_CaptureControl(uint32_t id, int value, const char* what)
+{
+    struct v4l2_control ctrl;
+
+    ctrl.id = id;
+    ctrl.value = value;
+    if (I_CaptureIoctl(VIDIOC_S_CTRL, &ctrl) < 0 && doom_get_log_level() >= 2)
+        fprintf(stderr, "[doom] capture: encoder ignores %s: %s\n", what, strerror(errno));
+}
+
+static int I_CaptureOpenEncoder(const char* device, int fps)
+{
+    struct v4l2_capability cap;
+    struct v4l2_format fmt;
+    struct v4l2_streamparm parm;
+    int gop;
+
+    g_fd = open(device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (g_fd < 0)
+    {
+        fprintf(stderr, "[doom] capture: can't open %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    memset(&cap, 0, sizeof(cap));
+    if (I_CaptureIoctl(VIDIOC_QUERYCAP, &cap) < 0
+        || !((cap.capabilities & V4L2_CAP_DEVICE_CAPS ? cap.device_caps : cap.capabilities)
+             & V4L2_CAP_VIDEO_M2M_MPLANE))
+    {
+        fprintf(stderr, "[doom] capture: %s is not a multi-planar M2M device\n", device);
+        return -1;
+    }
+
+    // raw frames in: planar YUV420, one plane, laid out as the driver wants
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.width = (uint32_t)g_width;
+    fmt.fmt.pix_mp.height = (uint32_t)g_height;
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUV420;
+    fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+    fmt.fmt.pix_mp.colorspace = V4L2_COLORSPACE_SMPTE170M;
+    fmt.fmt.pix_mp.num_planes = 1;
+    if (I_CaptureIoctl(VIDIOC_S_FMT, &fmt) < 0 || fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_YUV420
+        || fmt.fmt.pix_mp.num_planes != 1)
+    {
+        fprintf(stderr, "[doom] capture: encoder won't take %dx%d YUV420\n", g_width, g_height);
+        return -1;
+    }
+    g_ystride = (int)fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+    if (g_ystride < g_width)
+        g_ystride = g_width;
+    // chroma follows the (possibly height-aligned) luma plane
+    g_yrows = (int)(fmt.fmt.pix_mp.plane_fmt[0].sizeimage * 2 / 3 / (uint32_t)g_ystride);
+    if (g_yrows < g_height)
+        g_yrows = g_height;
+
+    // H.264 out
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    fmt.fmt.pix_mp.width = (uint32_t)g_width;
+    fmt.fmt.pix_mp.height = (uint32_t)g_height;
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = CAP_CAP_BYTES;
+    if (I_CaptureIoctl(VIDIOC_S_FMT, &fmt) < 0 || fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_H264)
+    {
+        fprintf(stderr, "[doom] capture: %s doesn't encode H.264\n", device);
+        return -1;
+    }
+
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    parm.parm.output.timeperframe.numerator = 1;
+    parm.parm.output.timeperframe.denominator = (uint32_t)fps;
+    I_CaptureIoctl(VIDIOC_S_PARM, &parm);
+
+    gop = I_CaptureEnvInt("UBO_DOOM_CAPTURE_GOP", fps * 2);
+    I_CaptureControl(V4L2_CID_MPEG_VIDEO_BITRATE, I_CaptureEnvInt("UBO_DOOM_CAPTURE_KBPS", 1500) * 1000,
+                     "bitrate");
+    I_CaptureControl(V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, gop > 0 ? gop : fps * 2, "I-frame period");
+    // a stream can be joined at any key frame
+    I_CaptureControl(V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1, "repeated SPS/PPS");
+
+    if (I_CaptureMapBuffers(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, g_obuf, CAP_OUT_BUFS) < 0
+        || I_CaptureMapBuffers(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, g_cbuf, CAP_CAP_BUFS) < 0)
+        return -1;
+
+    // rows below the picture (height alignment) stay black
+    for (int i = 0; i < CAP_OUT_BUFS; i++)
+    {
+        size_t ybytes = (size_t)g_ystride * g_yrows;
+
+        memset(g_obuf[i].mem, 16, ybytes < g_obuf[i].len ? ybytes : g_obuf[i].len);
+        if (ybytes < g_obuf[i].len)
+            memset((uint8_t*)g_obuf[i].mem + ybytes, 128, g_obuf[i].len - ybytes);
+        g_obusy[i] = 0;
+    }
+    for (int i = 0; i < CAP_CAP_BUFS; i++)
+    {
+        if (I_CaptureQueue(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, i, 0, 0) < 0)
+        {
+            fprintf(stderr, "[doom] capture: QBUF failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (I_CaptureIoctl(VIDIOC_STREAMON, &type) < 0)
+        return -1;
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (I_CaptureIoctl(VIDIOC_STREAMON, &type) < 0)
+        return -1;
+    return 0;
+}
+
+static void I_CaptureCloseEncoder(void)
+{
+    if (g_fd >= 0)
+    {
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+
+        I_CaptureIoctl(VIDIOC_STREAMOFF, &type);
+        type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        I_CaptureIoctl(VIDIOC_STREAMOFF, &type);
+    }
+    I_CaptureUnmap();
+    if (g_fd >= 0)
+        close(g_fd);
+    g_fd = -1;
+}
+
+// Takes back the raw buffers the encoder is done with and writes out the
+// encoded ones.  Returns 1 once the buffer flagged LAST (after a stop
+// command) has gone out, -1 if the output can't be written, 0 otherwise.
+static int I_CaptureCollect(void)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+
+    for (;;)
+    {
+        memset(&buf, 0, sizeof(buf));
+        memset(&plane, 0, sizeof(plane));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.m.planes = &plane;
+        buf.length = 1;
+        if (I_CaptureIoctl(VIDIOC_DQBUF, &buf) < 0)
+            break;
+        if (buf.index < CAP_OUT_BUFS)
+            g_obusy[buf.index] = 0;
+    }
+    for (;;)
+    {
+        int last;
+
+        memset(&buf, 0, sizeof(buf));
+        memset(&plane, 0, sizeof(plane));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.m.planes = &plane;
+        buf.length = 1;
+        if (I_CaptureIoctl(VIDIOC_DQBUF, &buf) < 0)
+            return errno == EPIPE ? 1 : 0;              // EPIPE: drained
+        if (buf.index >= CAP_CAP_BUFS)
+            continue;
+        last = (buf.flags & V4L2_BUF_FLAG_LAST) != 0;
+        if (plane.bytesused > plane.data_offset)
+        {
+            if (I_CaptureWrite((const uint8_t*)g_cbuf[buf.index].mem + plane.data_offset,
+                               plane.bytesused - plane.data_offset) < 0)
+                return -1;
+            g_encoded++;
+        }
+        if (last)
+            return 1;
+        I_CaptureQueue(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, (int)buf.index, 0, 0);
+    }
+}
+
+// BT.601 limited range, the encoder's default colorspace
+static void I_CaptureBuildLut(const byte* pal)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        int r = pal[i*3 + 0], g = pal[i*3 + 1], b = pal[i*3 + 2];
+
+        g_ylut[i] = (uint8_t)((( 66*r + 129*g +  25*b + 128) >> 8) + 16);
+        g_ulut[i] = (uint8_t)(((-38*r -  74*g + 112*b + 128) >> 8) + 128);
+        g_vlut[i] = (uint8_t)(((112*r -  94*g -  18*b + 128) >> 8) + 128);
+    }
+    memcpy(g_lutpal, pal, sizeof(g_lutpal));
+    g_lut_valid = 1;
+}
+
+static void I_CaptureConvert(uint8_t* dst, const byte* src)
+{
+    uint8_t* ydst = dst;
+    uint8_t* udst = dst + (size_t)g_ystride * g_yrows;
+    uint8_t* vdst = udst + (size_t)(g_ystride / 2) * (g_yrows / 2);
+
+    for (int y = 0; y < g_height; y++)
+    {
+        const byte* s = src + y * SCREENWIDTH;
+        uint8_t* d = ydst + (size_t)y * g_ystride;
+
+        for (int x = 0; x < g_width; x++)
+            d[x] = g_ylut[s[x]];
+    }
+    for (int y = 0; y < g_height / 2; y++)
+    {
+        const byte* s0 = src + (2*y) * SCREENWIDTH;
+        const byte* s1 = s0 + SCREENWIDTH;
+        uint8_t* u = udst + (size_t)y * (g_ystride / 2);
+        uint8_t* v = vdst + (size_t)y * (g_ystride / 2);
+
+        for (int x = 0; x < g_width / 2; x++)
+        {
+            byte a = s0[2*x], b = s0[2*x + 1], c = s1[2*x], d = s1[2*x + 1];
+
+            u[x] = (uint8_t)((g_ulut[a] + g_ulut[b] + g_ulut[c] + g_ulut[d] + 2) >> 2);
+            v[x] = (uint8_t)((g_vlut[a] + g_vlut[b] + g_vlut[c] + g_vlut[d] + 2) >> 2);
+        }
+    }
+}
+
+static void I_CaptureEncode(const byte* frame, const byte* pal, uint64_t time_us)
+{
+    int i;
+
+    for (i = 0; i < CAP_OUT_BUFS && g_obusy[i]; i++)
+        ;
+    if (i == CAP_OUT_BUFS)
+    {
+        g_dropped++;
+        return;
+    }
+    if (!g_lut_valid || memcmp(g_lutpal, pal, sizeof(g_lutpal)))
+        I_CaptureBuildLut(pal);
+    I_CaptureConvert(g_obuf[i].mem, frame);
+    if (I_CaptureQueue(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, i,
+                       (size_t)g_ystride * g_yrows * 3 / 2, time_us) < 0)
+    {
+        g_dropped++;
+        return;
+    }
+    g_obusy[i] = 1;
+}
+
+// Push the frames still inside the encoder out before the streams stop.
+static void I_CaptureDrain(void)
+{
+    struct v4l2_encoder_cmd cmd;
+    uint64_t deadline = I_CaptureNowUs() + CAP_DRAIN_MS * 1000u;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cmd = V4L2_ENC_CMD_STOP;
+    if (I_CaptureIoctl(VIDIOC_ENCODER_CMD, &cmd) < 0)
+        return;
+    while (I_CaptureNowUs() < deadline)
+    {
+        struct pollfd pfd = { g_fd, POLLIN, 0 };
+
+        if (I_CaptureCollect() != 0)
+            break;
+        poll(&pfd, 1, 20);
+    }
+}
+
+//
+// Thread
+//
+
+static void* I_CaptureThread(void* arg)
+{
+    sigset_t pipe;
+
+    (void)arg;
+    // a FIFO reader going away must end the capture, not the process
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, NULL);
+
+    if (I_CaptureOpenOutput(g_outname) < 0)
+    {
+        g_running = 0;
+        return NULL;
+    }
+    fprintf(stderr, "[doom] capture: %dx%d H.264 to %s\n", g_width, g_height, g_outname);
+
+    while (g_running)
+    {
+        const mailslot_t* work = I_MailboxTake(&g_mailbox, CAP_WAIT_MS, &g_running);
+
+        if (I_CaptureCollect() < 0)
+            break;
+        if (work && g_running)
+            I_CaptureEncode(work->frame, work->pal, work->time_us);
+    }
+
+    if (g_running)
+    {
+        struct timespec zero = { 0, 0 };
+
+        fprintf(stderr, "[doom] capture: writing %s failed: %s; capture stopped\n",
+                g_outname, strerror(errno));
+        sigtimedwait(&pipe, NULL, &zero);
+        g_running = 0;
+    }
+    else
+        I_CaptureDrain();
+    return NULL;
+}
+
+static void I_CaptureRelease(void)
+{
+    I_CaptureCloseEncoder();
+    if (g_out >= 0)
+        close(g_out);
+    g_out = -1;
+}
+
+int doom_capture_start(const char* output)
+{
+    const char* device;
+    int fps;
+
+    if (!output || !output[0])
+        return -1;
+    if (g_started)
+        return 0;
+
+    g_width = screenwidth;
+    g_height = screenheight;
+    fps = I_CaptureEnvInt("UBO_DOOM_CAPTURE_FPS", TICRATE);
+    if (fps < 1 || fps > TICRATE)
+        fps = TICRATE;
+    g_period_us = 1000000u / (unsigned)fps;
+    device = getenv("UBO_DOOM_CAPTURE_DEVICE");
+    if (!device || !device[0])
+        device = "/dev/video11";
+    if (I_CaptureOpenEncoder(device, fps) < 0)
+    {
+        I_CaptureRelease();
+        return -1;
+    }
+
+    snprintf(g_outname, sizeof(g_outname), "%s", output);
+    g_encoded = g_replaced = g_dropped = 0;
+    g_bytes = 0;
+    g_last_us = 0;
+    I_MailboxReset(&g_mailbox);
+    g_lut_valid = 0;
+    g_running = 1;
+    if (pthread_create(&g_thread, NULL, I_CaptureThread, NULL) != 0)
+    {
+        fprintf(stderr, "[doom] capture: can't start the capture thread\n");
+        g_running = 0;
+        I_CaptureRelease();
+        return -1;
+    }
+    g_started = 1;
+    return 0;
+}
+
+void doom_capture_stop(void)
+{
+    if (!g_started)
+        return;
+    g_running = 0;
+    I_MailboxWake(&g_mailbox);
+    pthread_join(g_thread, NULL);
+    fprintf(stderr, "[doom] capture: %u frames encoded, %llu KB, %u dropped by the encoder, "
+            "%u replaced in the mailbox\n", g_encoded, (unsigned long long)(g_bytes / 1024),
+            g_dropped, g_replaced);
+    I_CaptureRelease();
+    g_started = 0;
+}
+
+int doom_capture_active(void) { return g_started && g_running; }
+
+void I_CaptureFrame(const byte* src, const byte* palette)
+{
+    uint64_t now;
+
+    if (!g_running || screenwidth != g_width || screenheight != g_height)
+        return;
+    // UBO_DOOM_CAPTURE_FPS below the frame rate: keep every n-th frame,
+    // with 2 ms of slack for tic jitter
+    now = I_CaptureNowUs();
+    if (g_last_us && now - g_last_us + 2000 < g_period_us)
+        return;
+    g_last_us = now;
+
+    if (I_MailboxPost(&g_mailbox, src, palette, now, 0))
+        g_replaced++;
+}
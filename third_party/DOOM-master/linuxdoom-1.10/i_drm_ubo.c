@@ -0,0 +1,522 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef UBO_DRM
+#include <drm.h>
+#include <drm_mode.h>
+#endif
+
+#include "doom_api.h"
+#include "doomdef.h"
+#include "i_log.h"
+#include "i_mailbox.h"
+#include "i_thread.h"
+#include "i_video.h"
+#include "v_video.h"
+
+// HDMI output (doom_hdmi_open, UBO_DOOM_HDMI) for a docked unit, through
+// KMS on /dev/dri/cardN with the kernel's ioctls alone (libdrm-dev only
+// supplies the headers; nothing is linked):
+// - The first connected connector is driven at its preferred mode, or the
+//   one UBO_DOOM_HDMI_MODE names ("1280x720"), from two XRGB8888 dumb
+//   buffers.  The picture is the 4:3 rectangle the game was drawn for,
+//   centred on black.
+// - I_FinishUpdate hands each shown 8-bit frame and its palette to
+//   I_HdmiFrame, a one-deep mailbox (i_mailbox.h) as for the stream: a frame the thread
+//   hasn't taken yet is replaced, never queued.
+// - The thread scales the newest frame into the back buffer (nearest, each
+//   source row looked up once and copied down the rows it covers), flips
+//   to it with drmModePageFlip's ioctl and waits for the flip event before
+//   taking the next one.  Frames are whole and change only on vblank, so
+//   the picture never tears and the thread sleeps between vblanks.
+// - doom_hdmi_close() puts back the mode and framebuffer the console had.
+
+#define HDMI_WAIT_MS        100     // the mailbox and flip waits check g_running this often
+
+static volatile int g_running;
+static int g_started;
+
+static mailbox_t g_mailbox = MAILBOX_INIT;
+
+static pthread_t g_thread;
+
+static uint32_t g_flips, g_replaced, g_missed;
+static uint64_t g_scale_us;
+
+#ifdef UBO_DRM
+
+static uint64_t I_HdmiNowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+#define HDMI_CONNECTED      1       // drm_mode_get_connector.connection
+
+typedef struct
+{
+    uint32_t handle;
+    uint32_t fb;
+    uint32_t pitch;
+    uint64_t size;
+    uint8_t* mem;
+} hdmibuf_t;
+
+static int g_fd = -1;
+static uint32_t g_connector;
+static uint32_t g_crtc;
+static struct drm_mode_modeinfo g_modeinfo;
+static struct drm_mode_crtc g_saved;    // what the console had on g_crtc
+static int g_have_saved;
+static hdmibuf_t g_bufs[2];
+static int g_back;
+
+// the 4:3 picture: g_pw x g_ph at g_px, g_py; g_xmap for the frame it was built for
+static int g_px, g_py, g_pw, g_ph;
+static int* g_xmap;
+static int g_map_w = -1;
+static uint32_t* g_row;
+
+static int I_HdmiIoctl(unsigned long req, void* arg)
+{
+    int r;
+
+    do
+        r = ioctl(g_fd, req, arg);
+    while (r < 0 && (errno == EINTR || errno == EAGAIN));
+    return r;
+}
+
+//
+// Mode setting
+//
+
+static int I_HdmiModeWanted(const struct drm_mode_modeinfo* m, int w, int h)
+{
+    return w > 0 ? m->hdisplay == w && m->vdisplay == h : (m->type & DRM_MODE_TYPE_PREFERRED) != 0;
+}
+
+// The first connected connector with a mode, its mode and a CRTC to drive it.
+static int I_HdmiFindOutput(void)
+{
+    struct drm_mode_card_res res;
+    uint32_t* connectors = NULL;
+    uint32_t* crtcs = NULL;
+    const char* want = getenv("UBO_DOOM_HDMI_MODE");
+    int want_w = 0, want_h = 0;
+    int found = 0;
+
+    if (want && want[0] && sscanf(want, "%dx%d", &want_w, &want_h) != 2)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: UBO_DOOM_HDMI_MODE=%s: expected WIDTHxHEIGHT\n", want);
+        want_w = want_h = 0;
+    }
+
+    memset(&res, 0, sizeof(res));
+    if (I_HdmiIoctl(DRM_IOCTL_MODE_GETRESOURCES, &res) < 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: not a KMS device: %s\n", strerror(errno));
+        return -1;
+    }
+    connectors = calloc(res.count_connectors + 1, sizeof(*connectors));
+    crtcs = calloc(res.count_crtcs + 1, sizeof(*crtcs));
+    if (!connectors || !crtcs)
+        goto done;
+    res.connector_id_ptr = (uintptr_t)connectors;
+    res.crtc_id_ptr = (uintptr_t)crtcs;
+    res.count_fbs = res.count_encoders = 0;
+    if (I_HdmiIoctl(DRM_IOCTL_MODE_GETRESOURCES, &res) < 0)
+        goto done;
+
+    for (uint32_t c = 0; c < res.count_connectors && !found; c++)
+    {
+        struct drm_mode_get_connector conn;
+        struct drm_mode_modeinfo* modes;
+        struct drm_mode_get_encoder enc;
+        uint32_t* encoders;
+        int pick = -1;
+
+        // count_modes 0 has the kernel probe the connector first
+        memset(&conn, 0, sizeof(conn));
+        conn.connector_id = connectors[c];
+        if (I_HdmiIoctl(DRM_IOCTL_MODE_GETCONNECTOR, &conn) < 0
+            || conn.connection != HDMI_CONNECTED || !conn.count_modes)
+            continue;
+        modes = calloc(conn.count_modes, sizeof(*modes));
+        encoders = calloc(conn.count_encoders + 1, sizeof(*encoders));
+        if (!modes || !encoders)
+        {
+            free(modes);
+            free(encoders);
+            continue;
+        }
+        conn.modes_ptr = (uintptr_t)modes;
+        conn.encoders_ptr = (uintptr_t)encoders;
+        conn.count_props = 0;
+        if (I_HdmiIoctl(DRM_IOCTL_MODE_GETCONNECTOR, &conn) < 0)
+            conn.count_modes = 0;
+
+        for (uint32_t m = 0; m < conn.count_modes && pick < 0; m++)
+            if (I_HdmiModeWanted(&modes[m], want_w, want_h))
+                pick = (int)m;
+        if (pick < 0 && conn.count_modes)
+        {
+            if (want_w > 0)
+                UBO_LOG(UBO_LOG_INFO, "[doom] hdmi: no %dx%d mode, using %ux%u\n", want_w, want_h,
+                        modes[0].hdisplay, modes[0].vdisplay);
+            pick = 0;
+        }
+
+        // the CRTC its encoder drives now, else the first one it can use
+        memset(&enc, 0, sizeof(enc));
+        enc.encoder_id = conn.encoder_id ? conn.encoder_id : encoders[0];
+        if (pick >= 0 && enc.encoder_id && I_HdmiIoctl(DRM_IOCTL_MODE_GETENCODER, &enc) == 0)
+        {
+            g_crtc = enc.crtc_id;
+            for (uint32_t k = 0; !g_crtc && k < res.count_crtcs; k++)
+                if (enc.possible_crtcs & (1u << k))
+                    g_crtc = crtcs[k];
+            if (g_crtc)
+            {
+                g_connector = conn.connector_id;
+                g_modeinfo = modes[pick];
+                found = 1;
+            }
+        }
+        free(modes);
+        free(encoders);
+    }
+    if (!found)
+        UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: no connected display\n");
+
+  done:
+    free(connectors);
+    free(crtcs);
+    return found ? 0 : -1;
+}
+
+static int I_HdmiCreateBuffer(hdmibuf_t* b)
+{
+    struct drm_mode_create_dumb create;
+    struct drm_mode_map_dumb map;
+    struct drm_mode_fb_cmd fb;
+
+    memset(&create, 0, sizeof(create));
+    create.width = g_modeinfo.hdisplay;
+    create.height = g_modeinfo.vdisplay;
+    create.bpp = 32;
+    if (I_HdmiIoctl(DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0)
+        return -1;
+    b->handle = create.handle;
+    b->pitch = create.pitch;
+    b->size = create.size;
+
+    memset(&fb, 0, sizeof(fb));
+    fb.width = create.width;
+    fb.height = create.height;
+    fb.pitch = create.pitch;
+    fb.bpp = 32;
+    fb.depth = 24;
+    fb.handle = create.handle;
+    if (I_HdmiIoctl(DRM_IOCTL_MODE_ADDFB, &fb) < 0)
+        return -1;
+    b->fb = fb.fb_id;
+
+    memset(&map, 0, sizeof(map));
+    map.handle = create.handle;
+    if (I_HdmiIoctl(DRM_IOCTL_MODE_MAP_DUMB, &map) < 0)
+        return -1;
+    b->mem = mmap(NULL, (size_t)b->size, PROT_READ | PROT_WRITE, MAP_SHARED, g_fd, (off_t)map.offset);
+    if (b->mem == MAP_FAILED)
+    {
+        b->mem = NULL;
+        return -1;
+    }
+    memset(b->mem, 0, (size_t)b->size);
+    return 0;
+}
+
+static void I_HdmiDestroyBuffer(hdmibuf_t* b)
+{
+    struct drm_mode_destroy_dumb destroy;
+
+    if (b->mem)
+        munmap(b->mem, (size_t)b->size);
+    if (b->fb)
+        I_HdmiIoctl(DRM_IOCTL_MODE_RMFB, &b->fb);
+    if (b->handle)
+    {
+        memset(&destroy, 0, sizeof(destroy));
+        destroy.handle = b->handle;
+        I_HdmiIoctl(DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+    memset(b, 0, sizeof(*b));
+}
+
+static int I_HdmiSetCrtc(uint32_t fb, struct drm_mode_modeinfo* mode, int valid)
+{
+    struct drm_mode_crtc crtc;
+
+    memset(&crtc, 0, sizeof(crtc));
+    crtc.crtc_id = g_crtc;
+    crtc.fb_id = fb;
+    crtc.set_connectors_ptr = (uintptr_t)&g_connector;
+    crtc.count_connectors = 1;
+    crtc.mode = *mode;
+    crtc.mode_valid = (uint32_t)valid;
+    return I_HdmiIoctl(DRM_IOCTL_MODE_SETCRTC, &crtc);
+}
+
+static void I_HdmiRelease(void)
+{
+    if (g_fd < 0)
+        return;
+    if (g_have_saved)
+        I_HdmiSetCrtc(g_saved.fb_id, &g_saved.mode, (int)g_saved.mode_valid);
+    g_have_saved = 0;
+    I_HdmiDestroyBuffer(&g_bufs[0]);
+    I_HdmiDestroyBuffer(&g_bufs[1]);
+    ioctl(g_fd, DRM_IOCTL_DROP_MASTER, 0);
+    close(g_fd);
+    g_fd = -1;
+    free(g_xmap);
+    free(g_row);
+    g_xmap = NULL;
+    g_row = NULL;
+    g_map_w = -1;
+}
+
+static int I_HdmiOpen(const char* device)
+{
+    int w, h;
+
+    g_fd = open(device, O_RDWR | O_CLOEXEC);
+    if (g_fd < 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: can't open %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    // only the master may set modes; a running compositor keeps it
+    if (ioctl(g_fd, DRM_IOCTL_SET_MASTER, 0) < 0)
+        UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: not DRM master on %s (%s), mode setting may fail\n",
+                device, strerror(errno));
+    if (I_HdmiFindOutput() < 0)
+        return -1;
+    if (I_HdmiCreateBuffer(&g_bufs[0]) < 0 || I_HdmiCreateBuffer(&g_bufs[1]) < 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: can't allocate %ux%u scanout buffers: %s\n",
+                g_modeinfo.hdisplay, g_modeinfo.vdisplay, strerror(errno));
+        return -1;
+    }
+
+    memset(&g_saved, 0, sizeof(g_saved));
+    g_saved.crtc_id = g_crtc;
+    g_have_saved = I_HdmiIoctl(DRM_IOCTL_MODE_GETCRTC, &g_saved) == 0;
+    if (I_HdmiSetCrtc(g_bufs[0].fb, &g_modeinfo, 1) < 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: can't set %ux%u: %s\n", g_modeinfo.hdisplay,
+                g_modeinfo.vdisplay, strerror(errno));
+        g_have_saved = 0;
+        return -1;
+    }
+    g_back = 1;
+
+    // 4:3, as tall as the mode allows
+    w = g_modeinfo.hdisplay;
+    h = g_modeinfo.vdisplay;
+    g_ph = h;
+    g_pw = h * 4 / 3;
+    if (g_pw > w)
+    {
+        g_pw = w;
+        g_ph = w * 3 / 4;
+    }
+    g_px = (w - g_pw) / 2;
+    g_py = (h - g_ph) / 2;
+    g_xmap = malloc((size_t)g_pw * sizeof(*g_xmap));
+    g_row = malloc((size_t)g_pw * sizeof(*g_row));
+    if (!g_xmap || !g_row)
+        return -1;
+    g_map_w = -1;
+    return 0;
+}
+
+//
+// Scaling and flipping
+//
+
+static void I_HdmiScale(const hdmibuf_t* b, const byte* src, const byte* palette, int sw, int sh)
+{
+    uint32_t pal[256];
+    int y = 0;
+
+    for (int i = 0; i < 256; i++)
+        pal[i] = (uint32_t)palette[i*3] << 16 | (uint32_t)palette[i*3 + 1] << 8 | palette[i*3 + 2];
+    if (g_map_w != sw)
+    {
+        for (int x = 0; x < g_pw; x++)
+            g_xmap[x] = x * sw / g_pw;
+        g_map_w = sw;
+    }
+
+    // Each source row once into g_row, then down every output row it
+    // covers: the dumb buffer may be write-combined, so never read back.
+    while (y < g_ph)
+    {
+        int sy = y * sh / g_ph;
+        const byte* s = src + sy * SCREENWIDTH;
+
+        for (int x = 0; x < g_pw; x++)
+            g_row[x] = pal[s[g_xmap[x]]];
+        do
+        {
+            memcpy(b->mem + (size_t)(g_py + y) * b->pitch + (size_t)g_px * 4, g_row,
+                   (size_t)g_pw * 4);
+            y++;
+        } while (y < g_ph && y * sh / g_ph == sy);
+    }
+}
+
+// Flips to the back buffer and waits for the vblank it lands on.
+static int I_HdmiFlip(void)
+{
+    struct drm_mode_crtc_page_flip flip;
+    char events[256];
+
+    memset(&flip, 0, sizeof(flip));
+    flip.crtc_id = g_crtc;
+    flip.fb_id = g_bufs[g_back].fb;
+    flip.flags = DRM_MODE_PAGE_FLIP_EVENT;
+    if (I_HdmiIoctl(DRM_IOCTL_MODE_PAGE_FLIP, &flip) < 0)
+        return -1;
+
+    while (g_running)
+    {
+        struct pollfd pfd = { g_fd, POLLIN, 0 };
+        ssize_t n;
+        ssize_t at = 0;
+
+        if (poll(&pfd, 1, HDMI_WAIT_MS) <= 0)
+            continue;
+        n = read(g_fd, events, sizeof(events));
+        while (n > 0 && at + (ssize_t)sizeof(struct drm_event) <= n)
+        {
+            const struct drm_event* e = (const struct drm_event*)(events + at);
+
+            if (e->type == DRM_EVENT_FLIP_COMPLETE)
+            {
+                g_back ^= 1;
+                return 0;
+            }
+            if (!e->length)
+                break;
+            at += e->length;
+        }
+    }
+    return 0;
+}
+
+static void* I_HdmiThread(void* arg)
+{
+    (void)arg;
+    while (g_running)
+    {
+        const mailslot_t* work;
+
+        I_ThreadPoll(UBO_THREAD_DISPLAY);
+        work = I_MailboxTake(&g_mailbox, HDMI_WAIT_MS, &g_running);
+        if (!work || !g_running)
+            continue;
+
+        uint64_t t0 = I_HdmiNowUs();
+        I_HdmiScale(&g_bufs[g_back], work->frame, work->pal, work->width, work->height);
+        g_scale_us += I_HdmiNowUs() - t0;
+        if (I_HdmiFlip() < 0)
+        {
+            g_missed++;
+            if (errno != EBUSY)
+            {
+                UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: page flip failed: %s; output stopped\n", strerror(errno));
+                g_running = 0;
+            }
+            continue;
+        }
+        g_flips++;
+    }
+    return NULL;
+}
+
+#endif // UBO_DRM
+
+int doom_hdmi_open(const char* device)
+{
+    if (!device || !device[0])
+        return -1;
+    if (g_started)
+        return 0;
+#ifdef UBO_DRM
+    if (I_HdmiOpen(device) < 0)
+    {
+        I_HdmiRelease();
+        return -1;
+    }
+    g_flips = g_replaced = g_missed = 0;
+    g_scale_us = 0;
+    I_MailboxReset(&g_mailbox);
+    g_running = 1;
+    if (pthread_create(&g_thread, NULL, I_HdmiThread, NULL) != 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: can't start the output thread\n");
+        g_running = 0;
+        I_HdmiRelease();
+        return -1;
+    }
+    g_started = 1;
+    UBO_LOG(UBO_LOG_INFO, "[doom] hdmi: %ux%u@%u on %s, picture %dx%d\n", g_modeinfo.hdisplay,
+            g_modeinfo.vdisplay, g_modeinfo.vrefresh, device, g_pw, g_ph);
+    return 0;
+#else
+    UBO_LOG(UBO_LOG_ERROR, "[doom] hdmi: %s: built without DRM (make DRM=1, needs libdrm-dev)\n", device);
+    return -1;
+#endif
+}
+
+void doom_hdmi_close(void)
+{
+    if (!g_started)
+        return;
+    g_running = 0;
+    I_MailboxWake(&g_mailbox);
+    pthread_join(g_thread, NULL);
+    UBO_LOG(UBO_LOG_INFO, "[doom] hdmi: %u frames flipped, %u flips failed, %u replaced in the "
+            "mailbox, %.2f ms scaling per frame\n", g_flips, g_missed, g_replaced,
+            g_flips ? (double)g_scale_us / g_flips / 1000.0 : 0.0);
+#ifdef UBO_DRM
+    I_HdmiRelease();
+#endif
+    g_started = 0;
+}
+
+int doom_hdmi_active(void) { return g_started && g_running; }
+
+// Like I_StreamFrame: every frame goes in, and the thread shows the newest
+// one at its next vblank.
+void I_HdmiFrame(const byte* src, const byte* palette)
+{
+    if (!g_running)
+        return;
+
+    if (I_MailboxPost(&g_mailbox, src, palette, 0, 0))
+        g_replaced++;
+}
@@ -0,0 +1,448 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "doom_api.h"
+#include "doomstat.h"
+#include "d_items.h"
+#include "g_game.h"
+#include "i_log.h"
+
+// Batched environments (doom_env_*): one forked worker per environment,
+// each with the whole engine to itself.  They share one anonymous mapping
+// with the caller, a page-aligned slot per worker: the ticcmd the caller
+// writes, then the result and the observation the worker writes.  A byte
+// over the worker's socketpair starts a step ('s'), a new episode ('r') or
+// the exit ('q'); the worker answers each with a byte once its slot is
+// written, 'k', or 'x' when its engine died.  The caller writes all the
+// requests of a batch before it reads any answer, so the steps run at once.
+//
+// Worker 0 keeps the on-disk caches next to the config (level, texture and
+// lump profile); the others run without them, since they would write the
+// same temp files.  A worker never calls doom_shutdown() - it leaves with
+// _exit(), so none of them rewrites the config either.
+
+#define ENV_OP_STEP  's'
+#define ENV_OP_RESET 'r'
+#define ENV_OP_QUIT  'q'
+#define ENV_OK       'k'
+#define ENV_DEAD     'x'
+
+// d_main.c: a title screen advance still pending would undo the new game.
+extern boolean advancedemo;
+
+typedef struct {
+    ubo_ticcmd_t cmd;
+    ubo_env_result_t result;
+} envslot_t;
+
+#define ENV_OBS_OFFSET ((sizeof(envslot_t) + 63) & ~(size_t)63)
+
+static ubo_env_config_t g_env_cfg;
+static int g_env_count = 0;
+static int g_env_obs_bytes = 0;
+static size_t g_env_slot_bytes = 0;
+static uint8_t* g_env_shm = NULL;
+static size_t g_env_shm_size = 0;
+static pid_t g_env_pid[UBO_ENV_MAX];
+static int g_env_fd[UBO_ENV_MAX];
+
+static envslot_t* I_EnvSlot(int i)
+{
+    return (envslot_t*)(g_env_shm + (size_t)i * g_env_slot_bytes);
+}
+
+static uint8_t* I_EnvObsPtr(int i)
+{
+    return g_env_shm + (size_t)i * g_env_slot_bytes + ENV_OBS_OFFSET;
+}
+
+static int I_EnvSend(int fd, char op)
+{
+    ssize_t n;
+
+    do
+        n = send(fd, &op, 1, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    return n == 1 ? 0 : -1;
+}
+
+// The answer byte, or 0 when the worker is gone.
+static char I_EnvRecv(int fd)
+{
+    ssize_t n;
+    char c;
+
+    do
+        n = read(fd, &c, 1);
+    while (n < 0 && errno == EINTR);
+    return n == 1 ? c : 0;
+}
+
+//
+// Worker side
+//
+
+// Box filter from the RGBA frame down to the observation size.
+static void I_EnvObserve(uint8_t* obs)
+{
+    const int sw = doom_get_rgba_width();
+    const int sh = doom_get_rgba_height();
+    const int ow = g_env_cfg.obs_width;
+    const int oh = g_env_cfg.obs_height;
+    int ox, oy, x, y;
+
+    for (oy = 0; oy < oh; oy++) {
+        int y0 = oy * sh / oh;
+        int y1 = (oy + 1) * sh / oh;
+
+        if (y1 <= y0)
+            y1 = y0 + 1;
+        for (ox = 0; ox < ow; ox++) {
+            int x0 = ox * sw / ow;
+            int x1 = (ox + 1) * sw / ow;
+            unsigned r = 0, g = 0, b = 0, count;
+
+            if (x1 <= x0)
+                x1 = x0 + 1;
+            count = (unsigned)((x1 - x0) * (y1 - y0));
+            for (y = y0; y < y1; y++) {
+                const uint8_t* p = ubo_rgba + ((size_t)y * sw + x0) * 4;
+
+                for (x = x0; x < x1; x++, p += 4) {
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                }
+            }
+            if (g_env_cfg.channels == 1) {
+                *obs++ = (uint8_t)((77 * r + 150 * g + 29 * b) / (256 * count));
+            } else {
+                *obs++ = (uint8_t)(r / count);
+                *obs++ = (uint8_t)(g / count);
+                *obs++ = (uint8_t)(b / count);
+            }
+        }
+    }
+}
+
+static void I_EnvState(ubo_env_result_t* r, int done)
+{
+    player_t* p = &players[consoleplayer];
+    ammotype_t ammo = weaponinfo[p->readyweapon].ammo;
+
+    memset(r, 0, sizeof(*r));
+    r->done = done;
+    r->health = p->health;
+    r->armor = p->armorpoints;
+    r->weapon = (int)p->readyweapon + 1;
+    r->ammo = ammo == am_noammo ? -1 : p->ammo[ammo];
+    r->kills = p->killcount;
+    r->items = p->itemcount;
+    r->secrets = p->secretcount;
+    if (p->mo) {
+        r->x = p->mo->x >> FRACBITS;
+        r->y = p->mo->y >> FRACBITS;
+        r->angle = (int)(((uint64_t)p->mo->angle * 360) >> 32);
+    }
+    r->tics = leveltime;
+}
+
+static int I_EnvEnded(void)
+{
+    if (players[consoleplayer].playerstate == PST_DEAD)
+        return UBO_ENV_DIED;
+    if (gameaction == ga_completed || gamestate != GS_LEVEL)
+        return UBO_ENV_EXITED;
+    return UBO_ENV_RUNNING;
+}
+
+// A new game on the configured map, drawn once: its first observation.
+static int I_EnvNewEpisode(uint8_t* obs)
+{
+    int tics;
+
+    advancedemo = false;
+    G_DeferedInitNew((skill_t)(g_env_cfg.skill - 1), g_env_cfg.episode, g_env_cfg.map);
+    for (tics = 0; tics < TICRATE; tics++) {
+        doom_simulate(1, NULL);
+        if (!doom_is_alive())
+            return -1;
+        if (gamestate == GS_LEVEL && gameaction == ga_nothing)
+            break;
+    }
+    if (gamestate != GS_LEVEL)
+        return -1;
+    doom_tick_ex(0, 1);
+    if (!doom_is_alive())
+        return -1;
+    I_EnvObserve(obs);
+    return 0;
+}
+
+// frame_skip tics with the slot's ticcmd, the last one drawn; stops early
+// when the episode ends, and then starts the next one.
+static int I_EnvStep(envslot_t* slot, uint8_t* obs)
+{
+    int done = UBO_ENV_RUNNING;
+    int i;
+
+    doom_set_ticcmd(&slot->cmd);
+    for (i = 0; i < g_env_cfg.frame_skip && !done; i++) {
+        if (i == g_env_cfg.frame_skip - 1)
+            doom_tick_ex(1, 1);
+        else
+            doom_simulate(1, NULL);
+        if (!doom_is_alive())
+            return -1;
+        done = I_EnvEnded();
+    }
+    I_EnvState(&slot->result, done);
+    if (done)
+        return I_EnvNewEpisode(obs);
+    I_EnvObserve(obs);
+    return 0;
+}
+
+static void I_EnvWorker(int index, int fd, const char* iwad_path)
+{
+    static const ubo_ticcmd_t idle;
+    static const char* const unset[] = {
+        "UBO_DOOM_NET", "UBO_DOOM_CAPTURE", "UBO_DOOM_FRAMESHM", "UBO_DOOM_SNDSERV",
+    };
+    static const char* const caches[] = {
+        "UBO_DOOM_LEVEL_CACHE", "UBO_DOOM_RCACHE", "UBO_DOOM_LUMP_PROFILE",
+    };
+    envslot_t* slot = I_EnvSlot(index);
+    uint8_t* obs = I_EnvObsPtr(index);
+    size_t i;
+    char op;
+
+    for (i = 0; i < sizeof(unset) / sizeof(unset[0]); i++)
+        unsetenv(unset[i]);
+    for (i = 0; index > 0 && i < sizeof(caches) / sizeof(caches[0]); i++)
+        setenv(caches[i], "0", 1);
+    setenv("UBO_DOOM_ALSA_DEVICE", "null", 1);
+    setenv("UBO_DOOM_AUDIO_THREAD", "0", 1);
+    setenv("UBO_DOOM_MUSIC", "0", 1);
+    setenv("UBO_DOOM_WIPE", "0", 1);
+    setenv("UBO_DOOM_GOVERNOR", "0", 1);
+
+    if (doom_init(iwad_path) != 0) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] env %d: doom_init(%s) failed\n", index, iwad_path);
+        _exit(1);
+    }
+    doom_set_output_format(UBO_OUTPUT_RGBA8888);
+    doom_set_interpolation(0);
+    doom_set_ticcmd(&idle);
+    if (I_EnvNewEpisode(obs) < 0) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] env %d: E%dM%d didn't start\n",
+                index, g_env_cfg.episode, g_env_cfg.map);
+        _exit(1);
+    }
+    I_EnvState(&slot->result, UBO_ENV_RUNNING);
+    I_EnvSend(fd, ENV_OK);
+
+    while ((op = I_EnvRecv(fd)) != 0 && op != ENV_OP_QUIT) {
+        int rc;
+
+        if (op == ENV_OP_STEP) {
+            rc = I_EnvStep(slot, obs);
+        } else {
+            rc = I_EnvNewEpisode(obs);
+            I_EnvState(&slot->result, UBO_ENV_RUNNING);
+        }
+        if (rc < 0) {
+            slot->result.done = UBO_ENV_LOST;
+            I_EnvSend(fd, ENV_DEAD);
+            _exit(1);
+        }
+        I_EnvSend(fd, ENV_OK);
+    }
+    _exit(0);
+}
+
+//
+// Caller side
+//
+
+static int I_EnvConfigure(const ubo_env_config_t* cfg)
+{
+    static const ubo_env_config_t defaults = { 80, 50, 1, 4, 3, 1, 1 };
+    ubo_env_config_t c = cfg ? *cfg : defaults;
+
+    if (!c.obs_width)  c.obs_width = defaults.obs_width;
+    if (!c.obs_height) c.obs_height = defaults.obs_height;
+    if (!c.channels)   c.channels = defaults.channels;
+    if (!c.frame_skip) c.frame_skip = defaults.frame_skip;
+    if (!c.skill)      c.skill = defaults.skill;
+    if (!c.episode)    c.episode = defaults.episode;
+    if (!c.map)        c.map = defaults.map;
+    if (c.obs_width < 1 || c.obs_width > SCREENWIDTH || c.obs_height < 1
+        || c.obs_height > SCREENHEIGHT || (c.channels != 1 && c.channels != 3)
+        || c.frame_skip < 1 || c.frame_skip > TICRATE || c.skill < 1 || c.skill > 5
+        || c.episode < 1 || c.map < 1)
+        return -1;
+    g_env_cfg = c;
+    g_env_obs_bytes = c.obs_width * c.obs_height * c.channels;
+    g_env_slot_bytes = (ENV_OBS_OFFSET + (size_t)g_env_obs_bytes + 4095) & ~(size_t)4095;
+    return 0;
+}
+
+static void I_EnvLost(int i)
+{
+    I_EnvSlot(i)->result.done = UBO_ENV_LOST;
+}
+
+int doom_env_open(const char* iwad_path, const ubo_env_config_t* cfg, int count)
+{
+    const pid_t parent = getpid();
+    int i;
+
+    if (g_env_count || doom_is_alive() || doom_is_prewarmed()) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_env_open: %s\n",
+                g_env_count ? "envs already open" : "this process runs the engine");
+        return -1;
+    }
+    if (!iwad_path || count < 1 || count > UBO_ENV_MAX || I_EnvConfigure(cfg) < 0) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_env_open: bad arguments\n");
+        return -1;
+    }
+    g_env_shm_size = (size_t)count * g_env_slot_bytes;
+    g_env_shm = mmap(NULL, g_env_shm_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_env_shm == MAP_FAILED) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_env_open: %s\n", strerror(errno));
+        g_env_shm = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        int sv[2];
+        pid_t pid;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+            break;
+        fflush(stdout);
+        fflush(stderr);
+        pid = fork();
+        if (pid == 0) {
+            int j;
+
+            close(sv[0]);
+            for (j = 0; j < i; j++)
+                close(g_env_fd[j]);
+            // die with the caller rather than run on without it
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() != parent)
+                _exit(1);
+            I_EnvWorker(i, sv[1], iwad_path);
+        }
+        close(sv[1]);
+        if (pid < 0) {
+            close(sv[0]);
+            break;
+        }
+        g_env_pid[i] = pid;
+        g_env_fd[i] = sv[0];
+        g_env_count = i + 1;
+    }
+    if (g_env_count < count) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] doom_env_open: worker %d: %s\n", g_env_count, strerror(errno));
+        doom_env_close();
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (I_EnvRecv(g_env_fd[i]) != ENV_OK) {
+            UBO_LOG(UBO_LOG_ERROR, "[doom] doom_env_open: env %d didn't start\n", i);
+            doom_env_close();
+            return -1;
+        }
+    }
+    UBO_LOG(UBO_LOG_INFO, "[doom] %d envs, %dx%dx%d observations, %d tics a step\n", count,
+            g_env_cfg.obs_width, g_env_cfg.obs_height, g_env_cfg.channels, g_env_cfg.frame_skip);
+    return count;
+}
+
+int doom_env_obs_size(void) { return g_env_count ? g_env_obs_bytes : 0; }
+
+const uint8_t* doom_env_obs(int index)
+{
+    if (index < 0 || index >= g_env_count)
+        return NULL;
+    return I_EnvObsPtr(index);
+}
+
+int doom_env_step_batch(const ubo_ticcmd_t* actions, int n, uint8_t* obs,
+                        ubo_env_result_t* results)
+{
+    int lost = 0;
+    int i;
+
+    if (!actions || n < 1 || n > g_env_count)
+        return -1;
+    for (i = 0; i < n; i++) {
+        I_EnvSlot(i)->cmd = actions[i];
+        if (I_EnvSend(g_env_fd[i], ENV_OP_STEP) < 0) {
+            I_EnvLost(i);
+            lost = 1;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (I_EnvSlot(i)->result.done != UBO_ENV_LOST && I_EnvRecv(g_env_fd[i]) != ENV_OK) {
+            I_EnvLost(i);
+            lost = 1;
+        }
+        if (results)
+            results[i] = I_EnvSlot(i)->result;
+        if (obs)
+            memcpy(obs + (size_t)i * g_env_obs_bytes, I_EnvObsPtr(i), (size_t)g_env_obs_bytes);
+    }
+    return lost ? -1 : n;
+}
+
+int doom_env_reset(int index)
+{
+    int first = index < 0 ? 0 : index;
+    int last = index < 0 ? g_env_count - 1 : index;
+    int rc = 0;
+    int i;
+
+    if (index >= g_env_count || !g_env_count)
+        return -1;
+    for (i = first; i <= last; i++)
+        if (I_EnvSend(g_env_fd[i], ENV_OP_RESET) < 0)
+            I_EnvLost(i);
+    for (i = first; i <= last; i++) {
+        if (I_EnvSlot(i)->result.done == UBO_ENV_LOST || I_EnvRecv(g_env_fd[i]) != ENV_OK) {
+            I_EnvLost(i);
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+void doom_env_close(void)
+{
+    int i;
+
+    for (i = 0; i < g_env_count; i++)
+        I_EnvSend(g_env_fd[i], ENV_OP_QUIT);
+    for (i = 0; i < g_env_count; i++) {
+        close(g_env_fd[i]);
+        while (waitpid(g_env_pid[i], NULL, 0) < 0 && errno == EINTR)
+            ;
+    }
+    g_env_count = 0;
+    if (g_env_shm)
+        munmap(g_env_shm, g_env_shm_size);
+    g_env_shm = NULL;
+}
@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+
+#include "doom_api.h"
+#include "doomdef.h"
+#include "frameshm.h"
+#include "i_video.h"
+
+// Shared-memory frame export (UBO_DOOM_FRAMESHM, layout in frameshm.h):
+// I_FinishUpdate hands each converted frame to I_FrameShmPublish, which
+// copies it once into the next slot and wakes the waiting consumers.
+// Any number of viewers or recorders then read it in place instead of the
+// service copying ubo_rgba for each of them.
+
+// Big enough for either output: 320x200 RGBA or the 240x240 RGB565 LCD frame.
+#define FRAMESHM_SLOT_BYTES \
+    (SCREENWIDTH * SCREENHEIGHT * 4 > UBO_LCD_WIDTH * UBO_LCD_HEIGHT * 2 \
+     ? SCREENWIDTH * SCREENHEIGHT * 4 : UBO_LCD_WIDTH * UBO_LCD_HEIGHT * 2)
+#define FRAMESHM_DATA_OFFSET ((sizeof(frameshm_t) + 63) & ~(size_t)63)
+#define FRAMESHM_SIZE (FRAMESHM_DATA_OFFSET + (size_t)FRAMESHM_SLOTS * FRAMESHM_SLOT_BYTES)
+
+static frameshm_t* g_fshm;
+static char g_fshm_name[NAME_MAX];
+
+int I_FrameShmStart(void)
+{
+    const char* name = getenv("UBO_DOOM_FRAMESHM");
+    int fd;
+
+    if (!name || !name[0] || !strcmp(name, "0"))
+        return 0;
+    if (g_fshm)
+        return 1;
+
+    // a leftover object from a crashed run is replaced, not reused
+    snprintf(g_fshm_name, sizeof(g_fshm_name), "%s%s", name[0] == '/' ? "" : "/", name);
+    shm_unlink(g_fshm_name);
+    fd = shm_open(g_fshm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[doom] frameshm: shm_open %s failed: %s\n", g_fshm_name, strerror(errno));
+        return 0;
+    }
+    if (ftruncate(fd, FRAMESHM_SIZE) < 0
+        || (g_fshm = mmap(NULL, FRAMESHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "[doom] frameshm: shared memory failed: %s\n", strerror(errno));
+        g_fshm = NULL;
+        close(fd);
+        shm_unlink(g_fshm_name);
+        return 0;
+    }
+    close(fd);
+
+    memset(g_fshm, 0, sizeof(*g_fshm));
+    g_fshm->version = FRAMESHM_VERSION;
+    g_fshm->slots = FRAMESHM_SLOTS;
+    g_fshm->slot_bytes = FRAMESHM_SLOT_BYTES;
+    g_fshm->data_offset = (uint32_t)FRAMESHM_DATA_OFFSET;
+    g_fshm->pid = (uint32_t)getpid();
+    // consumers check the magic last, once the header is complete
+    __atomic_store_n(&g_fshm->magic, FRAMESHM_MAGIC, __ATOMIC_RELEASE);
+    fprintf(stderr, "[doom] frameshm: exporting frames to %s (%zu KB)\n",
+            g_fshm_name, FRAMESHM_SIZE / 1024);
+    return 1;
+}
+
+void I_FrameShmStop(void)
+{
+    if (!g_fshm)
+        return;
+    munmap(g_fshm, FRAMESHM_SIZE);
+    shm_unlink(g_fshm_name);
+    g_fshm = NULL;
+}
+
+int I_FrameShmActive(void) { return g_fshm != NULL; }
+
+void I_FrameShmPublish(int format, const void* pixels, int width, int height, int stride)
+{
+    uint32_t seq;
+    frameshm_slot_t* slot;
+    struct timespec ts;
+    size_t bytes = (size_t)stride * height;
+
+    if (!g_fshm || bytes > FRAMESHM_SLOT_BYTES)
+        return;
+
+    seq = g_fshm->seq + 1;
+    if (seq == 0)
+        seq = 1;
+    slot = &g_fshm->slot[seq % FRAMESHM_SLOTS];
+
+    // readers of the old frame in this slot see seq change and drop it
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((uint8_t*)g_fshm + FRAMESHM_DATA_OFFSET + (size_t)(seq % FRAMESHM_SLOTS) * FRAMESHM_SLOT_BYTES,
+           pixels, bytes);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    slot->format = (uint32_t)format;
+    slot->width = (uint32_t)width;
+    slot->height = (uint32_t)height;
+    slot->stride = (uint32_t)stride;
+    slot->bytes = (uint32_t)bytes;
+    slot->time_us = (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_fshm->seq, seq, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &g_fshm->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
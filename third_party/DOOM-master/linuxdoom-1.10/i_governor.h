@@ -0,0 +1,39 @@
+#ifndef __I_GOVERNOR__
+#define __I_GOVERNOR__
+
+#include <stdint.h>
+
+// Quality governor, i_governor_ubo.c (UBO_DOOM_GOVERNOR,
+// doom_set_quality_level).  Each second of game time it compares the time
+// the tics took with the time they had, and reads the CPU temperature.
+// Under load or over UBO_DOOM_GOVERNOR_TEMP it sheds one level; with room
+// to spare for several seconds, and the CPU cool again, it takes one back:
+//   0  full quality
+//   1  low detail (detailshift 1)
+//   2  view two screenblocks smaller
+//   3  every other frame drawn, so the LCD refreshes half as often
+//   4  shadows drawn solid instead of fuzzed
+// Levels stack: 3 keeps the low detail and the smaller view.
+#define GOV_LEVELS	5
+
+// mode 0 keeps full quality, 1 governs.  hot_c is the temperature in
+// degrees C to shed quality at; a level is only taken back once it is
+// 5 degrees below.  Returns the governor to level 0.
+void I_GovernorInit(int mode, int hot_c);
+
+// After each tic doom_run_tic() times: its busy time and whether it ran
+// the game simulation (a frame drawn between tics doesn't).
+void I_GovernorTic(uint32_t busy_us, int sim);
+
+// Whether a frame the host asked for should be drawn (level 3 and up
+// drop every other one).
+int I_GovernorKeepFrame(void);
+
+// level < 0 governs again; 0 .. GOV_LEVELS-1 holds that level.
+void I_GovernorPin(int level);
+
+int I_GovernorLevel(void);
+int I_GovernorLoad(void);           // percent of the last second spent in tics
+int I_GovernorTemp(void);           // millidegrees C, -1 when unknown
+
+#endif
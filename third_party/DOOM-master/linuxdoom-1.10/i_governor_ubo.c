@@ -0,0 +1,193 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "doomdef.h"
+#include "i_governor.h"
+#include "i_log.h"
+#include "r_main.h"
+#include "r_things.h"
+
+// Everything but I_GovernorPin runs on the tic thread, between tics, so
+// the renderer state it changes is never in use; a pin is handed over
+// through g_gov_want and taken by the next tic.  A window is a second of
+// game time (TICRATE simulated tics); its load is the busy time of every
+// tic and in-between frame in it over that second.  Shedding waits two
+// windows after a change (five after a thermal one: the die is slow to
+// answer), and a level comes back only after five windows in a row under
+// GOV_REGAIN_LOAD, so a level that only just fits isn't retried each second.
+#define GOV_THERMAL        "/sys/class/thermal/thermal_zone0/temp"
+#define GOV_SHED_LOAD      85       // percent
+#define GOV_REGAIN_LOAD    50
+#define GOV_REGAIN_WINDOWS 5
+#define GOV_SETTLE_WINDOWS 2
+#define GOV_THERMAL_SETTLE 5
+#define GOV_COOL_MC        5000     // hysteresis below the hot threshold
+#define GOV_NO_REQUEST     (-2)
+
+// m_menu.c: the view size the menus and the config keep.
+extern int screenblocks;
+// r_main.c: what R_SetViewSize last asked for.
+extern int setblocks;
+extern int setdetail;
+
+static int g_gov_mode = 1;
+static int g_gov_hot_mc = 75000;
+static int g_gov_pin = -1;
+static int g_gov_level = 0;
+static int g_gov_load = 0;
+static int g_gov_temp = -1;
+static uint64_t g_gov_busy_us = 0;
+static int g_gov_sim_tics = 0;
+static int g_gov_calm = 0;
+static int g_gov_settle = 0;
+static int g_gov_base_detail = 0;
+static unsigned g_gov_frames = 0;
+static atomic_int g_gov_want = GOV_NO_REQUEST;
+
+static int I_GovernorReadTemp(void)
+{
+    FILE* f = fopen(GOV_THERMAL, "r");
+    int mc;
+
+    if (!f)
+        return -1;
+    if (fscanf(f, "%d", &mc) != 1)
+        mc = -1;
+    fclose(f);
+    return mc;
+}
+
+// Puts the view and the shadows where level wants them.  A menu size
+// change while governed goes to R_SetViewSize too; that is undone here.
+static void I_GovernorApply(int from)
+{
+    int level = g_gov_level;
+    int blocks = screenblocks;
+    int detail;
+
+    if (level == 0) {
+        plainshadows = 0;
+        if (from > 0)
+            R_SetViewSize(screenblocks, g_gov_base_detail);
+        return;
+    }
+    if (from == 0)
+        g_gov_base_detail = setdetail;
+    detail = 1;
+    if (level >= 2) {
+        blocks = (screenblocks > 10 ? 10 : screenblocks) - 2;
+        if (blocks < 3)
+            blocks = 3;
+    }
+    if (setblocks != blocks || setdetail != detail)
+        R_SetViewSize(blocks, detail);
+    plainshadows = level >= 4;
+}
+
+static void I_GovernorSet(int level, const char* why)
+{
+    int from = g_gov_level;
+
+    if (level == from)
+        return;
+    g_gov_level = level;
+    g_gov_calm = 0;
+    I_GovernorApply(from);
+    if (g_gov_temp >= 0)
+        UBO_LOG(UBO_LOG_INFO, "[doom] quality level %d -> %d (%s; load %d%%, %d.%d C)\n",
+                from, level, why, g_gov_load, g_gov_temp / 1000, g_gov_temp % 1000 / 100);
+    else
+        UBO_LOG(UBO_LOG_INFO, "[doom] quality level %d -> %d (%s; load %d%%)\n",
+                from, level, why, g_gov_load);
+}
+
+static void I_GovernorWindow(void)
+{
+    int hot;
+
+    g_gov_load = (int)(g_gov_busy_us * TICRATE / 10000 / g_gov_sim_tics);
+    g_gov_busy_us = 0;
+    g_gov_sim_tics = 0;
+    g_gov_temp = I_GovernorReadTemp();
+
+    if (g_gov_pin >= 0 || !g_gov_mode) {
+        // pinned, or off: only keep the view where the level wants it
+        I_GovernorApply(g_gov_level);
+        return;
+    }
+    if (g_gov_settle > 0)
+        g_gov_settle--;
+
+    hot = g_gov_temp >= g_gov_hot_mc;
+    if ((hot || g_gov_load >= GOV_SHED_LOAD) && g_gov_level < GOV_LEVELS - 1) {
+        if (g_gov_settle == 0) {
+            g_gov_settle = hot ? GOV_THERMAL_SETTLE : GOV_SETTLE_WINDOWS;
+            I_GovernorSet(g_gov_level + 1, hot ? "hot" : "load");
+            return;
+        }
+    } else if (g_gov_load < GOV_REGAIN_LOAD
+               && (g_gov_temp < 0 || g_gov_temp < g_gov_hot_mc - GOV_COOL_MC)) {
+        if (++g_gov_calm >= GOV_REGAIN_WINDOWS && g_gov_level > 0 && g_gov_settle == 0) {
+            g_gov_settle = GOV_SETTLE_WINDOWS;
+            I_GovernorSet(g_gov_level - 1, "headroom");
+            return;
+        }
+        I_GovernorApply(g_gov_level);
+        return;
+    }
+    g_gov_calm = 0;
+    I_GovernorApply(g_gov_level);
+}
+
+void I_GovernorInit(int mode, int hot_c)
+{
+    g_gov_mode = mode != 0;
+    if (hot_c > 0)
+        g_gov_hot_mc = hot_c * 1000;
+    g_gov_pin = -1;
+    g_gov_level = 0;
+    g_gov_load = 0;
+    g_gov_temp = -1;
+    g_gov_busy_us = 0;
+    g_gov_sim_tics = 0;
+    g_gov_calm = 0;
+    g_gov_settle = 0;
+    g_gov_frames = 0;
+    atomic_store(&g_gov_want, GOV_NO_REQUEST);
+    plainshadows = 0;
+}
+
+void I_GovernorTic(uint32_t busy_us, int sim)
+{
+    int want = atomic_exchange(&g_gov_want, GOV_NO_REQUEST);
+
+    if (want != GOV_NO_REQUEST) {
+        g_gov_pin = want;
+        if (want >= 0)
+            I_GovernorSet(want, "pinned");
+        else if (!g_gov_mode)
+            I_GovernorSet(0, "off");
+    }
+    if (!g_gov_mode && g_gov_pin < 0)
+        return;
+    g_gov_busy_us += busy_us;
+    if (sim && ++g_gov_sim_tics >= TICRATE)
+        I_GovernorWindow();
+}
+
+int I_GovernorKeepFrame(void)
+{
+    return g_gov_level < 3 || (g_gov_frames++ & 1) == 0;
+}
+
+void I_GovernorPin(int level)
+{
+    if (level >= GOV_LEVELS)
+        level = GOV_LEVELS - 1;
+    atomic_store(&g_gov_want, level < 0 ? -1 : level);
+}
+
+int I_GovernorLevel(void) { return g_gov_level; }
+int I_GovernorLoad(void) { return g_gov_load; }
+int I_GovernorTemp(void) { return g_gov_temp; }
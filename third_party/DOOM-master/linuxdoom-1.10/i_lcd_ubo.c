@@ -0,0 +1,447 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/fb.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#include "doom_api.h"
+#include "i_thread.h"
+
+// Native display sink (doom_lcd_open):
+// - A thread waits for ubo_frame_publish(), takes the frame with
+//   doom_acquire_frame() and sends the row bands doom_get_dirty_rects()
+//   reports straight to the ST7789, so frames never pass through Python.
+// - /dev/fbN (fbtft): bands are byte-swapped to the framebuffer's native
+//   RGB565 and fbtft's deferred I/O ships the pages that were touched.
+// - /dev/spidevB.C: CASET/RASET/RAMWR per band with the D/C line on a
+//   gpiochip line, then the pixels in transfers of spidev's bufsiz
+//   (4096 unless the kernel has spidev.bufsiz=65536 on its command line).
+//   The panel is assumed to be set up by ubo's own driver unless
+//   UBO_DOOM_LCD_INIT=1 (reset and a minimal 16 bpp init).
+
+#define LCD_MAX_RECTS   8
+#define LCD_ROW_BYTES   (UBO_LCD_WIDTH * 2)
+
+typedef enum { LCD_OFF, LCD_FB, LCD_SPI } lcdmode_t;
+
+static lcdmode_t g_mode = LCD_OFF;
+static int g_fd = -1;
+
+// fbdev
+static uint8_t* g_fbmem;
+static size_t g_fbsize;
+static int g_fbstride;
+
+// spidev
+static int g_dc = -1;           // line handle fd for D/C
+static int g_dc_level = -1;
+static int g_chunk = 4096;
+static uint32_t g_spi_hz;
+
+static int g_off_x, g_off_y;    // panel RAM offset of the 240x240 window
+
+static pthread_t g_thread;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static volatile int g_running;
+static uint32_t g_wake_seq;     // doom_get_frame_seq() at the last wake-up
+
+static uint32_t g_frames;
+static uint64_t g_bytes;
+static uint64_t g_send_us;
+
+static int I_LcdEnvInt(const char* name, int def)
+{
+    const char* v = getenv(name);
+    return (v && v[0] != '\0') ? atoi(v) : def;
+}
+
+static uint64_t I_LcdNowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+//
+// fbdev
+//
+
+static int I_LcdOpenFb(const char* device)
+{
+    struct fb_var_screeninfo var;
+    struct fb_fix_screeninfo fix;
+
+    g_fd = open(device, O_RDWR | O_CLOEXEC);
+    if (g_fd < 0)
+    {
+        fprintf(stderr, "[doom] lcd: can't open %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    if (ioctl(g_fd, FBIOGET_VSCREENINFO, &var) < 0 || ioctl(g_fd, FBIOGET_FSCREENINFO, &fix) < 0)
+    {
+        fprintf(stderr, "[doom] lcd: %s is not a framebuffer: %s\n", device, strerror(errno));
+        return -1;
+    }
+    if (var.bits_per_pixel != 16
+        || (int)var.xres < g_off_x + UBO_LCD_WIDTH || (int)var.yres < g_off_y + UBO_LCD_HEIGHT)
+    {
+        fprintf(stderr, "[doom] lcd: %s is %ux%u at %u bpp, need 16 bpp and %dx%d\n", device,
+                var.xres, var.yres, var.bits_per_pixel, g_off_x + UBO_LCD_WIDTH, g_off_y + UBO_LCD_HEIGHT);
+        return -1;
+    }
+    g_fbstride = (int)fix.line_length;
+    g_fbsize = (size_t)fix.smem_len;
+    g_fbmem = mmap(NULL, g_fbsize, PROT_READ | PROT_WRITE, MAP_SHARED, g_fd, 0);
+    if (g_fbmem == MAP_FAILED)
+    {
+        fprintf(stderr, "[doom] lcd: mmap %s: %s\n", device, strerror(errno));
+        g_fbmem = NULL;
+        return -1;
+    }
+    g_mode = LCD_FB;
+    return 0;
+}
+
+static void I_LcdSendFb(const uint16_t* frame, const ubo_rect_t* r)
+{
+    for (int y = r->y0; y <= r->y1; y++)
+    {
+        const uint16_t* src = frame + y * UBO_LCD_WIDTH;
+        uint16_t* dst = (uint16_t*)(g_fbmem + (size_t)(y + g_off_y) * g_fbstride) + g_off_x;
+
+        // the frame is big-endian for the panel; fbtft swaps on its own
+        for (int x = 0; x < UBO_LCD_WIDTH; x++)
+            dst[x] = __builtin_bswap16(src[x]);
+    }
+    g_bytes += (uint64_t)(r->y1 - r->y0 + 1) * LCD_ROW_BYTES;
+}
+
+//
+// spidev
+//
+
+static int I_LcdDc(int level)
+{
+    struct gpiohandle_data data;
+
+    if (level == g_dc_level)
+        return 0;
+    memset(&data, 0, sizeof(data));
+    data.values[0] = (uint8_t)level;
+    if (ioctl(g_dc, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0)
+        return -1;
+    g_dc_level = level;
+    return 0;
+}
+
+static int I_LcdSpiWrite(const uint8_t* buf, int len)
+{
+    while (len > 0)
+    {
+        struct spi_ioc_transfer tr;
+        int n = len < g_chunk ? len : g_chunk;
+
+        memset(&tr, 0, sizeof(tr));
+        tr.tx_buf = (uintptr_t)buf;
+        tr.len = (uint32_t)n;
+        tr.speed_hz = g_spi_hz;
+        tr.bits_per_word = 8;
+        if (ioctl(g_fd, SPI_IOC_MESSAGE(1), &tr) < 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int I_LcdCommand(uint8_t cmd, const uint8_t* params, int n)
+{
+    if (I_LcdDc(0) < 0 || I_LcdSpiWrite(&cmd, 1) < 0)
+        return -1;
+    if (n > 0 && (I_LcdDc(1) < 0 || I_LcdSpiWrite(params, n) < 0))
+        return -1;
+    return 0;
+}
+
+static void I_LcdSleepMs(int ms)
+{
+    struct timespec d = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&d, NULL);
+}
+
+static int I_LcdRequestLine(int chip, int line, int value)
+{
+    struct gpiohandle_request req;
+
+    memset(&req, 0, sizeof(req));
+    req.lineoffsets[0] = (uint32_t)line;
+    req.lines = 1;
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    req.default_values[0] = (uint8_t)value;
+    snprintf(req.consumer_label, sizeof(req.consumer_label), "ubodoom");
+    if (ioctl(chip, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0)
+        return -1;
+    return req.fd;
+}
+
+// SWRESET, SLPOUT, COLMOD 16 bpp, MADCTL, INVON, NORON, DISPON.
+static int I_LcdInitPanel(void)
+{
+    const uint8_t colmod = 0x55;
+    const uint8_t madctl = 0x00;
+
+    if (I_LcdCommand(0x01, NULL, 0) < 0)
+        return -1;
+    I_LcdSleepMs(150);
+    if (I_LcdCommand(0x11, NULL, 0) < 0)
+        return -1;
+    I_LcdSleepMs(10);
+    if (I_LcdCommand(0x3a, &colmod, 1) < 0 || I_LcdCommand(0x36, &madctl, 1) < 0
+        || I_LcdCommand(0x21, NULL, 0) < 0 || I_LcdCommand(0x13, NULL, 0) < 0
+        || I_LcdCommand(0x29, NULL, 0) < 0)
+        return -1;
+    return 0;
+}
+
+static int I_LcdOpenSpi(const char* device)
+{
+    const char* chipname = getenv("UBO_DOOM_LCD_GPIOCHIP");
+    int dc_line = I_LcdEnvInt("UBO_DOOM_LCD_DC_GPIO", 25);
+    int rst_line = I_LcdEnvInt("UBO_DOOM_LCD_RST_GPIO", -1);
+    uint8_t mode = (uint8_t)I_LcdEnvInt("UBO_DOOM_LCD_SPI_MODE", 0);
+    int chip;
+    FILE* f;
+
+    g_spi_hz = (uint32_t)I_LcdEnvInt("UBO_DOOM_LCD_SPI_HZ", 40000000);
+    g_fd = open(device, O_RDWR | O_CLOEXEC);
+    if (g_fd < 0)
+    {
+        fprintf(stderr, "[doom] lcd: can't open %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    if (ioctl(g_fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(g_fd, SPI_IOC_WR_MAX_SPEED_HZ, &g_spi_hz) < 0)
+    {
+        fprintf(stderr, "[doom] lcd: %s is not a spidev: %s\n", device, strerror(errno));
+        return -1;
+    }
+
+    // a message may not exceed spidev's bounce buffer
+    g_chunk = 4096;
+    f = fopen("/sys/module/spidev/parameters/bufsiz", "r");
+    if (f)
+    {
+        int bufsiz;
+        if (fscanf(f, "%d", &bufsiz) == 1 && bufsiz >= 64)
+            g_chunk = bufsiz;
+        fclose(f);
+    }
+
+    chip = open(chipname && chipname[0] ? chipname : "/dev/gpiochip0", O_RDWR | O_CLOEXEC);
+    if (chip < 0)
+    {
+        fprintf(stderr, "[doom] lcd: can't open gpiochip: %s\n", strerror(errno));
+        return -1;
+    }
+    g_dc = I_LcdRequestLine(chip, dc_line, 1);
+    if (g_dc < 0)
+    {
+        fprintf(stderr, "[doom] lcd: D/C line %d: %s (in use by the display driver?)\n",
+                dc_line, strerror(errno));
+        close(chip);
+        return -1;
+    }
+    g_dc_level = 1;
+    if (rst_line >= 0)
+    {
+        int rst = I_LcdRequestLine(chip, rst_line, 1);
+        struct gpiohandle_data data;
+
+        if (rst < 0)
+        {
+            fprintf(stderr, "[doom] lcd: reset line %d: %s\n", rst_line, strerror(errno));
+            close(chip);
+            return -1;
+        }
+        memset(&data, 0, sizeof(data));
+        ioctl(rst, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+        I_LcdSleepMs(10);
+        data.values[0] = 1;
+        ioctl(rst, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+        I_LcdSleepMs(120);
+        close(rst);
+    }
+    close(chip);
+
+    g_mode = LCD_SPI;
+    if (I_LcdEnvInt("UBO_DOOM_LCD_INIT", 0) && I_LcdInitPanel() < 0)
+    {
+        fprintf(stderr, "[doom] lcd: panel init failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int I_LcdSendSpi(const uint16_t* frame, const ubo_rect_t* r)
+{
+    int x0 = r->x0 + g_off_x, x1 = r->x1 + g_off_x;
+    int y0 = r->y0 + g_off_y, y1 = r->y1 + g_off_y;
+    uint8_t caset[4] = { (uint8_t)(x0 >> 8), (uint8_t)x0, (uint8_t)(x1 >> 8), (uint8_t)x1 };
+    uint8_t raset[4] = { (uint8_t)(y0 >> 8), (uint8_t)y0, (uint8_t)(y1 >> 8), (uint8_t)y1 };
+    int len = (r->y1 - r->y0 + 1) * LCD_ROW_BYTES;
+
+    // bands are full rows, so the pixels are one contiguous run
+    if (I_LcdCommand(0x2a, caset, 4) < 0 || I_LcdCommand(0x2b, raset, 4) < 0
+        || I_LcdCommand(0x2c, (const uint8_t*)(frame + r->y0 * UBO_LCD_WIDTH), len) < 0)
+        return -1;
+    g_bytes += (uint64_t)len;
+    return 0;
+}
+
+//
+// Thread
+//
+
+static void* I_LcdThread(void* arg)
+{
+    ubo_rect_t rects[LCD_MAX_RECTS];
+    ubo_frame_t frame;
+
+    (void)arg;
+    while (g_running)
+    {
+        int n;
+
+        I_ThreadPoll(UBO_THREAD_DISPLAY);
+        pthread_mutex_lock(&g_lock);
+        while (g_running && doom_get_frame_seq() == g_wake_seq)
+            pthread_cond_wait(&g_cond, &g_lock);
+        g_wake_seq = doom_get_frame_seq();
+        pthread_mutex_unlock(&g_lock);
+        if (!g_running)
+            break;
+
+        if (doom_acquire_frame(&frame) != 1)
+            continue;
+        n = doom_get_dirty_rects(rects, LCD_MAX_RECTS);
+        if (n > 0)
+        {
+            uint64_t t0 = I_LcdNowUs();
+
+            for (int i = 0; i < n; i++)
+            {
+                if (g_mode == LCD_FB)
+                    I_LcdSendFb((const uint16_t*)frame.data, &rects[i]);
+                else if (I_LcdSendSpi((const uint16_t*)frame.data, &rects[i]) < 0)
+                {
+                    fprintf(stderr, "[doom] lcd: SPI write failed: %s; display sink stopped\n",
+                            strerror(errno));
+                    g_running = 0;
+                    break;
+                }
+            }
+            g_send_us += I_LcdNowUs() - t0;
+            g_frames++;
+        }
+        doom_release_frame();
+    }
+    return NULL;
+}
+
+static void I_LcdRelease(void)
+{
+    if (g_fbmem)
+        munmap(g_fbmem, g_fbsize);
+    g_fbmem = NULL;
+    if (g_dc >= 0)
+        close(g_dc);
+    g_dc = -1;
+    g_dc_level = -1;
+    if (g_fd >= 0)
+        close(g_fd);
+    g_fd = -1;
+    g_mode = LCD_OFF;
+}
+
+int doom_lcd_open(const char* device)
+{
+    const char* base;
+    int err;
+
+    if (!device || !device[0])
+        return -1;
+    if (g_mode != LCD_OFF)
+        return 0;
+
+    g_off_x = I_LcdEnvInt("UBO_DOOM_LCD_X", 0);
+    g_off_y = I_LcdEnvInt("UBO_DOOM_LCD_Y", 0);
+    base = strrchr(device, '/');
+    base = base ? base + 1 : device;
+    if (!strncmp(base, "fb", 2))
+        err = I_LcdOpenFb(device);
+    else if (!strncmp(base, "spidev", 6))
+        err = I_LcdOpenSpi(device);
+    else
+    {
+        fprintf(stderr, "[doom] lcd: %s is neither /dev/fbN nor /dev/spidevB.C\n", device);
+        err = -1;
+    }
+    if (err < 0)
+    {
+        I_LcdRelease();
+        return -1;
+    }
+
+    // the first frame goes out whole
+    doom_invalidate_dirty();
+    g_frames = 0;
+    g_bytes = 0;
+    g_send_us = 0;
+    g_wake_seq = doom_get_frame_seq() - 1;
+    g_running = 1;
+    if (pthread_create(&g_thread, NULL, I_LcdThread, NULL) != 0)
+    {
+        fprintf(stderr, "[doom] lcd: can't start the display thread\n");
+        g_running = 0;
+        I_LcdRelease();
+        return -1;
+    }
+    fprintf(stderr, "[doom] lcd: %s sink on %s\n", g_mode == LCD_FB ? "framebuffer" : "spidev", device);
+    return 0;
+}
+
+void doom_lcd_close(void)
+{
+    if (g_mode == LCD_OFF)
+        return;
+    pthread_mutex_lock(&g_lock);
+    g_running = 0;
+    pthread_cond_signal(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+    pthread_join(g_thread, NULL);
+    fprintf(stderr, "[doom] lcd: %u frames, %llu KB, %.2f ms per frame\n", g_frames,
+            (unsigned long long)(g_bytes / 1024),
+            g_frames ? (double)g_send_us / g_frames / 1000.0 : 0.0);
+    I_LcdRelease();
+}
+
+int doom_lcd_active(void) { return g_mode != LCD_OFF && g_running; }
+
+void ubo_lcd_notify(void)
+{
+    if (!g_running)
+        return;
+    pthread_mutex_lock(&g_lock);
+    pthread_cond_signal(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,35 @@
+#ifndef __I_LOG__
+#define __I_LOG__
+
+// Leveled diagnostics, i_log_ubo.c (doom_read_log, UBO_DOOM_LOG_LEVEL).
+// I_Log formats a line straight into the next slot of a lock-free ring;
+// callers on any thread never block and make no syscall.  A drain thread
+// started by I_LogStart writes what has collected to stderr in one write
+// every UBO_LOG_DRAIN_MS, until the host takes the log over by reading it
+// with doom_read_log.  Without a drain thread lines go to stderr at once.
+#define UBO_LOG_ERROR 0
+#define UBO_LOG_INFO  1
+#define UBO_LOG_DEBUG 2
+
+#define UBO_LOG_DRAIN_MS 100
+
+// stderr verbosity: lines above it are not even formatted.
+extern int ubo_log_level;
+
+#define UBO_LOG(level, ...) \
+    do { if (ubo_log_level >= (level)) I_Log((level), __VA_ARGS__); } while (0)
+
+void I_Log(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void I_LogStart(void);
+void I_LogStop(void);          // joins the drain thread after a last drain
+
+// Writes what is in the ring to stderr now, unless the host reads the log
+// or a drain is already running; for the crash handler.
+void I_LogFlush(void);
+
+// Whole lines, oldest first, into buf; the bytes copied.  The first call
+// stops the stderr drain.
+int I_LogRead(char* buf, int size);
+
+#endif
@@ -0,0 +1,192 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i_log.h"
+
+// Log ring: UBO_LOG_SLOTS lines of up to UBO_LOG_LINE bytes.  A writer
+// takes the next line number n with one fetch-add and owns slot n % slots;
+// its seq is 0 while the text is written and n + 1 once it is complete.
+// The single reader (the drain thread or doom_read_log, under
+// g_log_readlock) copies a slot out and checks seq again afterwards, so
+// a line overwritten meanwhile by a writer a whole ring ahead is counted
+// as dropped instead of coming out torn.
+#define UBO_LOG_SLOTS 256           // power of two
+#define UBO_LOG_LINE  256
+
+typedef struct {
+    atomic_uint seq;
+    int length;
+    char text[UBO_LOG_LINE];
+} logslot_t;
+
+int ubo_log_level = UBO_LOG_INFO;
+
+static logslot_t g_log_ring[UBO_LOG_SLOTS];
+static atomic_uint g_log_head;      // next line number
+static unsigned g_log_tail;         // next line to read (g_log_readlock)
+static unsigned g_log_dropped;      // lines lost to overwriting, not reported yet
+static pthread_mutex_t g_log_readlock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_int g_log_buffered;   // writers use the ring
+static atomic_int g_log_host;       // doom_read_log took the log over
+static atomic_int g_log_stop;
+static pthread_t g_log_thread;
+static int g_log_running;
+
+void I_Log(int level, const char* fmt, ...)
+{
+    va_list ap;
+    logslot_t* slot;
+    unsigned n;
+    int length;
+
+    (void)level;
+    va_start(ap, fmt);
+    if (!atomic_load_explicit(&g_log_buffered, memory_order_relaxed)) {
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    n = atomic_fetch_add_explicit(&g_log_head, 1, memory_order_relaxed);
+    slot = &g_log_ring[n & (UBO_LOG_SLOTS - 1)];
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);      // seq 0 before the text changes
+    length = vsnprintf(slot->text, UBO_LOG_LINE, fmt, ap);
+    va_end(ap);
+    if (length < 0)
+        length = 0;
+    if (length >= UBO_LOG_LINE) {
+        length = UBO_LOG_LINE - 1;
+        slot->text[length - 1] = '\n';              // cut lines still end one
+    }
+    slot->length = length;
+    atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+}
+
+// Copies complete lines from g_log_tail on into buf while they fit;
+// g_log_readlock held.  Stops at a line still being written.
+static int I_LogTake(char* buf, int size)
+{
+    int used = 0;
+
+    if (g_log_dropped && size > 48) {
+        used = snprintf(buf, size, "[doom] log: %u lines dropped\n", g_log_dropped);
+        g_log_dropped = 0;
+    }
+    for (;;) {
+        unsigned head = atomic_load_explicit(&g_log_head, memory_order_acquire);
+        logslot_t* slot;
+        unsigned seq;
+        int length;
+
+        if (head - g_log_tail > UBO_LOG_SLOTS) {
+            // lapped: the oldest lines are gone
+            g_log_dropped += head - UBO_LOG_SLOTS - g_log_tail;
+            g_log_tail = head - UBO_LOG_SLOTS;
+        }
+        if (g_log_tail == head)
+            break;
+        slot = &g_log_ring[g_log_tail & (UBO_LOG_SLOTS - 1)];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != g_log_tail + 1) {
+            if (seq == 0 || seq - (g_log_tail + 1) > UBO_LOG_SLOTS * 4u)
+                break;                              // not written yet
+            continue;                               // overwritten: lap check above
+        }
+        length = slot->length;
+        if (length > UBO_LOG_LINE - 1)
+            length = UBO_LOG_LINE - 1;
+        if (used + length > size)
+            break;
+        memcpy(buf + used, slot->text, length);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq)
+            continue;                               // torn; go round again
+        used += length;
+        g_log_tail++;
+    }
+    return used;
+}
+
+static void I_LogDrain(void)
+{
+    char buf[UBO_LOG_SLOTS * 32];
+    int length;
+
+    do {
+        length = I_LogTake(buf, sizeof(buf));
+        if (length > 0 && write(2, buf, length) < 0)
+            break;
+    } while (length == (int)sizeof(buf) || length > (int)sizeof(buf) - UBO_LOG_LINE);
+}
+
+static void* I_LogThread(void* arg)
+{
+    struct timespec pause = { 0, UBO_LOG_DRAIN_MS * 1000000L };
+
+    (void)arg;
+    while (!atomic_load(&g_log_stop)) {
+        nanosleep(&pause, NULL);
+        if (atomic_load(&g_log_host))
+            continue;
+        pthread_mutex_lock(&g_log_readlock);
+        I_LogDrain();
+        pthread_mutex_unlock(&g_log_readlock);
+    }
+    return NULL;
+}
+
+void I_LogStart(void)
+{
+    if (g_log_running)
+        return;
+    atomic_store(&g_log_stop, 0);
+    atomic_store(&g_log_buffered, 1);
+    if (pthread_create(&g_log_thread, NULL, I_LogThread, NULL) == 0) {
+        g_log_running = 1;
+        return;
+    }
+    // No drain thread: a host reading the log still gets the ring.
+    atomic_store(&g_log_buffered, atomic_load(&g_log_host));
+}
+
+void I_LogStop(void)
+{
+    if (!g_log_running)
+        return;
+    atomic_store(&g_log_stop, 1);
+    pthread_join(g_log_thread, NULL);
+    g_log_running = 0;
+    // Until the next start, lines go straight to stderr again unless the
+    // host reads them.
+    atomic_store(&g_log_buffered, atomic_load(&g_log_host));
+    I_LogFlush();
+}
+
+void I_LogFlush(void)
+{
+    if (atomic_load(&g_log_host))
+        return;
+    if (pthread_mutex_trylock(&g_log_readlock) != 0)
+        return;
+    I_LogDrain();
+    pthread_mutex_unlock(&g_log_readlock);
+}
+
+int I_LogRead(char* buf, int size)
+{
+    int length;
+
+    if (!atomic_exchange(&g_log_host, 1))
+        atomic_store(&g_log_buffered, 1);
+    pthread_mutex_lock(&g_log_readlock);
+    length = I_LogTake(buf, size);
+    pthread_mutex_unlock(&g_log_readlock);
+    return length;
+}
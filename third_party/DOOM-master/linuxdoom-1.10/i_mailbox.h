@@ -0,0 +1,50 @@
+#ifndef __I_MAILBOX__
+#define __I_MAILBOX__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "doomdef.h"
+#include "doomtype.h"
+
+// One-deep frame mailbox, i_mailbox_ubo.c, between I_FinishUpdate and an
+// output thread (capture, stream, HDMI).  The tic side copies a shown
+// 8-bit frame and its palette into the mailbox buffer; a frame the thread
+// hasn't taken yet is replaced, never queued.  The thread takes it by
+// swapping buffers under the lock, so the copy is the only work done
+// holding it, and works on its buffer until the next take.
+
+typedef struct {
+    byte frame[SCREENWIDTH * SCREENHEIGHT];
+    byte pal[256 * 3];
+    uint64_t time_us;
+    uint32_t seq;
+    int width, height;          // screenwidth, screenheight when posted
+} mailslot_t;
+
+typedef struct {
+    mailslot_t slots[2];
+    int mail;                   // index of the mailbox buffer
+    int full;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} mailbox_t;
+
+#define MAILBOX_INIT { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER }
+
+// Empties it, before the thread starts.
+void I_MailboxReset(mailbox_t* box);
+
+// Tic side: copies the frame in and wakes the thread; 1 if it replaced
+// one the thread never took.
+int I_MailboxPost(mailbox_t* box, const byte* src, const byte* palette,
+                  uint64_t time_us, uint32_t seq);
+
+// Thread side: waits up to wait_ms for a frame while *running; the slot
+// now the thread's, or NULL if none came.
+const mailslot_t* I_MailboxTake(mailbox_t* box, int wait_ms, volatile int* running);
+
+// Wakes a thread waiting in I_MailboxTake, after *running was cleared.
+void I_MailboxWake(mailbox_t* box);
+
+#endif
@@ -0,0 +1,71 @@
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "i_mailbox.h"
+#include "v_video.h"
+
+void I_MailboxReset(mailbox_t* box)
+{
+    pthread_mutex_lock(&box->lock);
+    box->full = 0;
+    pthread_mutex_unlock(&box->lock);
+}
+
+int I_MailboxPost(mailbox_t* box, const byte* src, const byte* palette,
+                  uint64_t time_us, uint32_t seq)
+{
+    mailslot_t* slot;
+    int replaced;
+
+    // 64 KB under the lock; the thread holds it only to swap buffers
+    pthread_mutex_lock(&box->lock);
+    replaced = box->full;
+    slot = &box->slots[box->mail];
+    memcpy(slot->frame, src, sizeof(slot->frame));
+    memcpy(slot->pal, palette, sizeof(slot->pal));
+    slot->time_us = time_us;
+    slot->seq = seq;
+    slot->width = screenwidth;
+    slot->height = screenheight;
+    box->full = 1;
+    pthread_cond_signal(&box->cond);
+    pthread_mutex_unlock(&box->lock);
+    return replaced;
+}
+
+const mailslot_t* I_MailboxTake(mailbox_t* box, int wait_ms, volatile int* running)
+{
+    const mailslot_t* slot = NULL;
+
+    pthread_mutex_lock(&box->lock);
+    if (*running && !box->full)
+    {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += wait_ms * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&box->cond, &box->lock, &ts);
+    }
+    if (box->full)
+    {
+        // the old work buffer becomes the mailbox
+        slot = &box->slots[box->mail];
+        box->mail ^= 1;
+        box->full = 0;
+    }
+    pthread_mutex_unlock(&box->lock);
+    return slot;
+}
+
+void I_MailboxWake(mailbox_t* box)
+{
+    pthread_mutex_lock(&box->lock);
+    pthread_cond_signal(&box->cond);
+    pthread_mutex_unlock(&box->lock);
+}
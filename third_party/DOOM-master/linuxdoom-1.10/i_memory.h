@@ -0,0 +1,36 @@
+#ifndef __I_MEMORY__
+#define __I_MEMORY__
+
+// Memory budget, i_memory_ubo.c (UBO_DOOM_MEMORY_MB and
+// doom_set_memory_budget).  The engine's footprint is what it holds in RAM:
+// the zones' and the mapped WADs' resident pages, the composite cache and
+// the level arena.  With a budget, I_MemoryTic measures it once a second of
+// game time; over budget it gives back what is cheapest to rebuild, and
+// when that was not enough the WAD pages too.  doom_init also derives the
+// zone and composite cache sizes from the budget (doom_api.c).
+
+typedef struct {
+    int budget;        // bytes, 0 = none
+    int footprint;     // zone + wad + composites + arena
+    int zone;          // resident zone pages
+    int wad;           // resident WAD mapping pages, inflated pk3 members, shared lump copies
+    int composites;
+    int arena;
+    int process;       // whole process RSS, host included
+    int trims;         // times I_MemoryTic went over budget
+} memreport_t;
+
+// I_MemoryRelease levels
+#define MEM_RELEASE_CACHES 0   // half the composites, patches, pk3 members, shared lumps, PU_CACHE, free zone pages
+#define MEM_RELEASE_PAGES  1   // also the WAD pages
+#define MEM_RELEASE_ALL    2   // every composite too (doom_suspend)
+
+void I_MemoryInit(int budget_mb);
+// Once per tic on the tic thread; sim as for I_GovernorTic.
+void I_MemoryTic(int sim);
+// Between tics only.  Returns the zone bytes handed back.
+int I_MemoryRelease(int level);
+// Measures now; tic thread or engine idle.
+void I_MemoryReport(memreport_t* out);
+
+#endif
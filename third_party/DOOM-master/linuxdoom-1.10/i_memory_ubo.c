@@ -0,0 +1,124 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "doomdef.h"
+#include "i_log.h"
+#include "i_memory.h"
+#include "r_data.h"
+#include "v_video.h"
+#include "w_wad.h"
+#include "z_zone.h"
+
+// A trim is followed by MEM_SETTLE_WINDOWS without one, so the rebuilt
+// caches and the pages faulted back in are measured before the next.  A
+// window over budget right after that steps up to the WAD pages; one under
+// budget steps back down to the caches.
+#define MEM_SETTLE_WINDOWS 5
+
+static int g_mem_budget = 0;
+static int g_mem_trims = 0;
+static int g_mem_sim_tics = 0;
+static int g_mem_settle = 0;
+static int g_mem_level = MEM_RELEASE_CACHES;
+
+static int I_MemoryProcessRss(void)
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    long size, rss;
+
+    if (!f)
+        return 0;
+    if (fscanf(f, "%ld %ld", &size, &rss) != 2)
+        rss = 0;
+    fclose(f);
+    return (int)(rss * sysconf(_SC_PAGESIZE));
+}
+
+void I_MemoryReport(memreport_t* out)
+{
+    zonestats_t zs;
+
+    memset(out, 0, sizeof(*out));
+    Z_ZoneStats(&zs);
+    out->budget = g_mem_budget;
+    out->zone = Z_ResidentBytes();
+    out->wad = W_ResidentBytes() + zipcachebytes + sharedcachebytes;
+    out->composites = compositebytes;
+    out->arena = zs.arenasize;
+    out->footprint = out->zone + out->wad + out->composites + out->arena;
+    out->process = I_MemoryProcessRss();
+    out->trims = g_mem_trims;
+}
+
+int I_MemoryRelease(int level)
+{
+    int limit = compositelimit;
+    int released;
+
+    W_CancelPrefetch();
+    if (level >= MEM_RELEASE_ALL) {
+        R_PurgeComposites();
+    } else {
+        // LRU first; what the last frame drew stays
+        compositelimit = compositebytes / 2;
+        R_TrimComposites();
+        compositelimit = limit;
+    }
+    V_FlushPatches();
+    W_FlushZipCache();
+    W_FlushSharedCache();
+    Z_FreeTags(PU_PURGELEVEL, PU_CACHE);
+    released = Z_ReleaseFree();
+    if (level >= MEM_RELEASE_PAGES)
+        W_ReleasePages();
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    return released;
+}
+
+static void I_MemoryWindow(void)
+{
+    memreport_t before;
+    memreport_t after;
+
+    if (g_mem_settle > 0) {
+        g_mem_settle--;
+        return;
+    }
+    I_MemoryReport(&before);
+    if (before.footprint <= g_mem_budget) {
+        g_mem_level = MEM_RELEASE_CACHES;
+        return;
+    }
+    I_MemoryRelease(g_mem_level);
+    g_mem_trims++;
+    g_mem_settle = MEM_SETTLE_WINDOWS;
+    I_MemoryReport(&after);
+    UBO_LOG(UBO_LOG_INFO, "[doom] memory %d KB over the %d KB budget: %s released, now %d KB "
+            "(zone %d, wad %d, composites %d, arena %d KB)\n",
+            (before.footprint - g_mem_budget) / 1024, g_mem_budget / 1024,
+            g_mem_level == MEM_RELEASE_CACHES ? "caches" : "caches and WAD pages",
+            after.footprint / 1024, after.zone / 1024, after.wad / 1024,
+            after.composites / 1024, after.arena / 1024);
+    g_mem_level = MEM_RELEASE_PAGES;
+}
+
+void I_MemoryInit(int budget_mb)
+{
+    g_mem_budget = budget_mb > 0 ? budget_mb * 1024 * 1024 : 0;
+    g_mem_trims = 0;
+    g_mem_sim_tics = 0;
+    g_mem_settle = 0;
+    g_mem_level = MEM_RELEASE_CACHES;
+}
+
+void I_MemoryTic(int sim)
+{
+    if (!g_mem_budget || !sim || ++g_mem_sim_tics < TICRATE)
+        return;
+    g_mem_sim_tics = 0;
+    I_MemoryWindow();
+}
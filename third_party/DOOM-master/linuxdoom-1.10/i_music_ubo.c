@@ -0,0 +1,915 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "doomdef.h"
+#include "i_sound.h"
+#include "sndshm.h"
+
+// Software music for the ALSA backend:
+// - I_RegisterSong copies the MUS score out of the lump, and the sequencer
+//   steps its events at 140 Hz while rendering, so the song runs on the audio
+//   clock rather than on tics.
+// - Notes play on a small synth: every General MIDI family maps to one of six
+//   harmonic wavetables and an attack/decay/sustain/release envelope, and the
+//   channel 15 drums are tone and noise bursts.  GENMIDI's OPL patches are not
+//   used.
+// - I_MusicRender adds the music into frames that are already mixed.  The
+//   audio thread calls it just before each write, so the synth never runs on
+//   the tick thread (except with UBO_DOOM_AUDIO_THREAD=0).
+// - UBO_DOOM_MUSIC_QUALITY picks the voice count and wavetable interpolation.
+//   UBO_DOOM_MUSIC_BUDGET caps render time at a percentage of the audio it
+//   makes; over it, the quietest voices are dropped and the cap comes back
+//   down a voice at a time.
+// - With a sndserver running, the API calls are forwarded to it and the
+//   server renders the song with its own copy of this file.
+
+#define MUS_TICRATE     140
+#define MUS_CHANNELS    16
+#define MUS_DRUMS       15
+#define MUS_MAXVOICES   32
+#define MUS_WAVES       6
+#define MUS_WAVEBITS    10
+#define MUS_WAVELEN     (1 << MUS_WAVEBITS)
+#define MUS_BLOCK       16      // frames per envelope step
+#define MUS_CHUNK       256     // frames rendered per pass
+#define MUS_ENVONE      (1 << 24)
+
+enum { WAVE_SINE, WAVE_ORGAN, WAVE_SQUARE, WAVE_SAW, WAVE_BRASS, WAVE_TRIANGLE };
+enum { ENV_ATTACK, ENV_DECAY, ENV_SUSTAIN, ENV_RELEASE };
+
+// One patch per General MIDI family (program / 8).
+typedef struct
+{
+    int wave;
+    int attack_ms;
+    int decay_ms;       // down to the sustain level; 0 goes straight there
+    int sustain;        // 0..255; 0 ends the note after the decay
+    int release_ms;
+} mus_patch_t;
+
+static const mus_patch_t g_patches[16] =
+{
+    { WAVE_SAW,       2,  900,  40, 200 },  // piano
+    { WAVE_SINE,      1,  500,   0, 150 },  // chromatic percussion
+    { WAVE_ORGAN,     5,    0, 255,  60 },  // organ
+    { WAVE_SAW,       2,  700, 120, 150 },  // guitar
+    { WAVE_TRIANGLE,  2,  400, 150,  80 },  // bass
+    { WAVE_SAW,      60,    0, 255, 300 },  // strings
+    { WAVE_SAW,      80,    0, 230, 400 },  // ensemble
+    { WAVE_BRASS,    30,  300, 200, 150 },  // brass
+    { WAVE_SQUARE,   20,  200, 210, 100 },  // reed
+    { WAVE_SINE,     30,    0, 255, 120 },  // pipe
+    { WAVE_SQUARE,    5,  200, 220, 100 },  // synth lead
+    { WAVE_TRIANGLE,200,    0, 255, 600 },  // synth pad
+    { WAVE_ORGAN,   100,  800, 120, 500 },  // synth effects
+    { WAVE_SAW,       3,  600,  60, 200 },  // ethnic
+    { WAVE_SINE,      1,  300,   0, 100 },  // percussive
+    { WAVE_SQUARE,   10,  500,  80, 300 },  // sound effects
+};
+
+// Harmonic amplitudes of each wavetable.
+static const float g_harmonics[MUS_WAVES][8] =
+{
+    { 1 },
+    { 1, 0.5f, 0, 0.25f, 0, 0, 0, 0.12f },
+    { 1, 0, 1/3.f, 0, 1/5.f, 0, 1/7.f, 0 },
+    { 1, 1/2.f, 1/3.f, 1/4.f, 1/5.f, 1/6.f, 1/7.f, 1/8.f },
+    { 1, 0.7f, 0.5f, 0.35f, 0.25f, 0.15f, 0.1f, 0.05f },
+    { 1, 0, -1/9.f, 0, 1/25.f, 0, -1/49.f, 0 },
+};
+
+// Drum kinds, picked by General MIDI key.
+typedef struct
+{
+    float tone_hz;      // start of the tone
+    float tone_end_hz;  // where it has swept to when the hit dies
+    int tone;           // 0..256 mix of the tone
+    int noise;          // 0..256 mix of the noise
+    int bright;         // high-pass the noise
+    int decay_ms;
+} mus_drum_t;
+
+enum { DRUM_KICK, DRUM_SNARE, DRUM_TOM, DRUM_HAT, DRUM_OPENHAT, DRUM_CYMBAL, DRUM_CLICK };
+
+static const mus_drum_t g_drums[] =
+{
+    { 150,  50, 256,  24, 0, 250 },     // kick
+    { 200, 160, 100, 200, 0, 180 },     // snare
+    { 120,  80, 230,  40, 0, 300 },     // tom (tone set by key)
+    {   0,   0,   0, 160, 1,  50 },     // closed hi-hat
+    {   0,   0,   0, 160, 1, 300 },     // open hi-hat
+    {   0,   0,   0, 140, 1, 900 },     // crash, ride
+    { 400, 300,  80, 170, 1,  80 },     // stick, clap, the rest
+};
+
+typedef struct
+{
+    int active;
+    int channel;
+    int note;
+    unsigned age;
+
+    const int16_t* wave;
+    uint32_t phase;
+    uint32_t inc;
+
+    int stage;
+    int env;            // 0..MUS_ENVONE
+    int attack;         // per frame
+    int decay;
+    int sustain;
+    int release;
+    int release_ms;
+
+    int velocity;       // 0..127
+    int lgain;          // 0..32767 at full envelope
+    int rgain;
+
+    // drums
+    int drum;
+    int tonemix;
+    int noisemix;
+    int bright;
+    uint32_t noise;
+    int lastnoise;
+    uint32_t sweep;     // 16.16 multiplier on inc per envelope step
+} mus_voice_t;
+
+typedef struct
+{
+    int program;
+    int volume;
+    int pan;
+    int expression;
+    int lastvelocity;
+    float bend;         // semitones
+} mus_channel_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int g_enabled = 1;
+static int g_interp = 1;
+static int g_maxvoices = 16;
+static int g_budget_pct = 5;
+
+static int g_rate;
+static uint32_t g_noteinc[128];
+static int16_t g_waves[MUS_WAVES][MUS_WAVELEN];
+static int g_waves_built;
+
+static uint8_t* g_score;
+static int g_scorelen;
+static int g_pos;
+static int g_wait;          // tics before the next event group
+static int g_playing;
+static int g_looping;
+static int g_paused;
+static int g_volume = 15;   // 0..15 from the menu
+static int g_ticleft;       // frames left in this MUS tic
+static int g_ticfrac;
+
+static mus_channel_t g_channels[MUS_CHANNELS];
+static mus_voice_t g_voices[MUS_MAXVOICES];
+static int g_active;
+static int g_cap;           // voices allowed now, <= g_maxvoices
+static int g_under;         // frames rendered well under budget
+static unsigned g_age;
+
+static int g_acc[MUS_CHUNK * 2];
+
+static void I_MusBuildWaves(void)
+{
+    int w, i, h;
+    float v, peak;
+    float tmp[MUS_WAVELEN];
+
+    for (w = 0; w < MUS_WAVES; w++)
+    {
+        peak = 0;
+        for (i = 0; i < MUS_WAVELEN; i++)
+        {
+            v = 0;
+            for (h = 0; h < 8; h++)
+                v += g_harmonics[w][h] * sinf(6.28318531f * (h + 1) * i / MUS_WAVELEN);
+            tmp[i] = v;
+            if (fabsf(v) > peak)
+                peak = fabsf(v);
+        }
+        for (i = 0; i < MUS_WAVELEN; i++)
+            g_waves[w][i] = (int16_t)lrintf(tmp[i] / peak * 30000);
+    }
+    g_waves_built = 1;
+}
+
+static int I_MusFrames(int ms)
+{
+    return ms * g_rate / 1000 + 1;
+}
+
+static void I_MusChannelReset(void)
+{
+    int i;
+
+    for (i = 0; i < MUS_CHANNELS; i++)
+    {
+        g_channels[i].program = 0;
+        g_channels[i].volume = 100;
+        g_channels[i].pan = 64;
+        g_channels[i].expression = 127;
+        g_channels[i].lastvelocity = 100;
+        g_channels[i].bend = 0;
+    }
+}
+
+static void I_MusSilence(void)
+{
+    memset(g_voices, 0, sizeof(g_voices));
+    g_active = 0;
+}
+
+static void I_MusVoiceGain(mus_voice_t* v)
+{
+    const mus_channel_t* c = &g_channels[v->channel];
+    int g, l, r;
+
+    // quarter scale leaves room for a handful of loud voices
+    g = v->velocity * c->volume * c->expression / (127 * 127);
+    g = g * g_volume * 64 / 15;
+    l = c->pan <= 64 ? 64 : 127 - c->pan;
+    r = c->pan >= 64 ? 64 : c->pan;
+    v->lgain = g * l / 64;
+    v->rgain = g * r / 64;
+}
+
+static uint32_t I_MusInc(int note, float bend)
+{
+    double inc = g_noteinc[note & 127];
+
+    if (bend != 0)
+        inc *= pow(2.0, bend / 12.0);
+    return inc > 4294967295.0 ? 0xffffffffu : (uint32_t)inc;
+}
+
+static mus_voice_t* I_MusAllocVoice(void)
+{
+    mus_voice_t* best = NULL;
+    int i;
+
+    if (g_active < g_cap)
+    {
+        for (i = 0; i < MUS_MAXVOICES; i++)
+            if (!g_voices[i].active)
+            {
+                g_active++;
+                return &g_voices[i];
+            }
+    }
+
+    // Steal a released voice, quietest first, else the oldest.
+    for (i = 0; i < MUS_MAXVOICES; i++)
+    {
+        mus_voice_t* v = &g_voices[i];
+
+        if (!v->active)
+            continue;
+        if (!best
+            || (v->stage == ENV_RELEASE && best->stage != ENV_RELEASE)
+            || (v->stage == ENV_RELEASE && v->env < best->env)
+            || (best->stage != ENV_RELEASE && v->stage != ENV_RELEASE && v->age < best->age))
+            best = v;
+    }
+    return best;
+}
+
+static void I_MusNoteOn(int channel, int note, int velocity)
+{
+    const mus_patch_t* p;
+    const mus_drum_t* d;
+    mus_voice_t* v;
+    int kind;
+
+    v = I_MusAllocVoice();
+    if (!v)
+        return;
+    memset(v, 0, sizeof(*v));
+    v->active = 1;
+    v->channel = channel;
+    v->note = note;
+    v->age = g_age++;
+    v->velocity = velocity;
+    v->stage = ENV_ATTACK;
+
+    if (channel == MUS_DRUMS)
+    {
+        if (note == 35 || note == 36)
+            kind = DRUM_KICK;
+        else if (note == 38 || note == 40)
+            kind = DRUM_SNARE;
+        else if (note == 41 || note == 43 || note == 45 || note == 47 || note == 48 || note == 50)
+            kind = DRUM_TOM;
+        else if (note == 42 || note == 44)
+            kind = DRUM_HAT;
+        else if (note == 46)
+            kind = DRUM_OPENHAT;
+        else if (note == 49 || note == 51 || note == 52 || note == 55 || note == 57 || note == 59)
+            kind = DRUM_CYMBAL;
+        else
+            kind = DRUM_CLICK;
+        d = &g_drums[kind];
+
+        v->drum = 1;
+        v->wave = g_waves[WAVE_SINE];
+        v->tonemix = d->tone;
+        v->noisemix = d->noise;
+        v->bright = d->bright;
+        v->noise = 0x12345u + note * 2654435761u;
+        if (d->tone)
+        {
+            float start = d->tone_hz;
+            float end = d->tone_end_hz;
+
+            if (kind == DRUM_TOM)
+            {
+                // low floor tom (41) to high tom (50)
+                start = 80 + (note - 41) * 15;
+                end = start * 0.7f;
+            }
+            v->inc = (uint32_t)(start * 4294967296.0 / g_rate);
+            v->sweep = (uint32_t)(65536 * pow(end / start,
+                                              (double)MUS_BLOCK / I_MusFrames(d->decay_ms)));
+        }
+        v->env = MUS_ENVONE;
+        v->stage = ENV_DECAY;
+        v->decay = MUS_ENVONE / I_MusFrames(d->decay_ms);
+        v->sustain = 0;
+        v->release_ms = d->decay_ms / 2;
+    }
+    else
+    {
+        p = &g_patches[(g_channels[channel].program >> 3) & 15];
+        v->wave = g_waves[p->wave];
+        v->inc = I_MusInc(note, g_channels[channel].bend);
+        v->attack = MUS_ENVONE / I_MusFrames(p->attack_ms);
+        v->sustain = p->sustain * (MUS_ENVONE / 256);
+        v->decay = p->decay_ms ? (MUS_ENVONE - v->sustain) / I_MusFrames(p->decay_ms) : 0;
+        v->release_ms = p->release_ms;
+    }
+    I_MusVoiceGain(v);
+}
+
+static void I_MusRelease(mus_voice_t* v)
+{
+    if (v->stage == ENV_RELEASE)
+        return;
+    v->stage = ENV_RELEASE;
+    v->release = v->env / I_MusFrames(v->release_ms) + 1;
+}
+
+static void I_MusNoteOff(int channel, int note)
+{
+    int i;
+
+    // drums ring out on their own
+    if (channel == MUS_DRUMS)
+        return;
+    for (i = 0; i < MUS_MAXVOICES; i++)
+        if (g_voices[i].active && g_voices[i].channel == channel
+            && g_voices[i].note == note)
+            I_MusRelease(&g_voices[i]);
+}
+
+static void I_MusChannelChanged(int channel, int bend)
+{
+    int i;
+
+    for (i = 0; i < MUS_MAXVOICES; i++)
+    {
+        mus_voice_t* v = &g_voices[i];
+
+        if (!v->active || v->channel != channel)
+            continue;
+        I_MusVoiceGain(v);
+        if (bend && !v->drum)
+            v->inc = I_MusInc(v->note, g_channels[channel].bend);
+    }
+}
+
+static int I_MusByte(void)
+{
+    if (g_pos >= g_scorelen)
+        return -1;
+    return g_score[g_pos++];
+}
+
+static void I_MusEnd(void)
+{
+    int i;
+
+    if (g_looping)
+    {
+        g_pos = 0;
+        return;
+    }
+    g_playing = 0;
+    for (i = 0; i < MUS_MAXVOICES; i++)
+        if (g_voices[i].active)
+            I_MusRelease(&g_voices[i]);
+}
+
+// Runs one event.  Returns 1 when it was the last of its group.
+static int I_MusEvent(void)
+{
+    int b, type, channel, last, v, w;
+    mus_channel_t* c;
+
+    b = I_MusByte();
+    if (b < 0)
+    {
+        I_MusEnd();
+        return 1;
+    }
+    last = b & 0x80;
+    type = (b >> 4) & 7;
+    channel = b & 15;
+    c = &g_channels[channel];
+
+    switch (type)
+    {
+    case 0:     // release note
+        v = I_MusByte();
+        if (v >= 0)
+            I_MusNoteOff(channel, v & 127);
+        break;
+
+    case 1:     // play note
+        v = I_MusByte();
+        if (v < 0)
+            break;
+        if (v & 0x80)
+        {
+            w = I_MusByte();
+            if (w >= 0)
+                c->lastvelocity = w & 127;
+        }
+        I_MusNoteOn(channel, v & 127, c->lastvelocity);
+        break;
+
+    case 2:     // pitch wheel, 128 is centre, a whole tone each way
+        v = I_MusByte();
+        if (v >= 0)
+        {
+            c->bend = (v - 128) / 64.0f;
+            I_MusChannelChanged(channel, 1);
+        }
+        break;
+
+    case 3:     // system event
+        v = I_MusByte();
+        if (v == 10 || v == 11)
+        {
+            for (w = 0; w < MUS_MAXVOICES; w++)
+                if (g_voices[w].active && g_voices[w].channel == channel)
+                    I_MusRelease(&g_voices[w]);
+        }
+        else if (v == 14)
+        {
+            c->volume = 100;
+            c->pan = 64;
+            c->expression = 127;
+            c->bend = 0;
+            I_MusChannelChanged(channel, 1);
+        }
+        break;
+
+    case 4:     // controller
+        v = I_MusByte();
+        w = I_MusByte();
+        if (v < 0 || w < 0)
+            break;
+        w &= 127;
+        if (v == 0)
+            c->program = w;
+        else if (v == 3)
+            c->volume = w;
+        else if (v == 4)
+            c->pan = w;
+        else if (v == 5)
+            c->expression = w;
+        if (v >= 3 && v <= 5)
+            I_MusChannelChanged(channel, 0);
+        break;
+
+    case 5:     // end of measure
+        break;
+
+    case 6:     // score end
+    default:
+        I_MusEnd();
+        return 1;
+    }
+
+    if (last)
+    {
+        // variable length delay in MUS tics
+        v = 0;
+        do
+        {
+            b = I_MusByte();
+            if (b < 0)
+                break;
+            v = (v << 7) | (b & 127);
+        } while (b & 0x80);
+        g_wait = v;
+        return 1;
+    }
+    return 0;
+}
+
+static void I_MusTic(void)
+{
+    int events = 0;
+
+    // a score without delays must not spin here
+    while (g_playing && g_wait == 0 && events < 1024)
+        while (!I_MusEvent() && ++events < 1024)
+            ;
+    if (g_wait > 0)
+        g_wait--;
+}
+
+static void I_MusRenderVoice(mus_voice_t* v, int* acc, int count)
+{
+    const int16_t* wave = v->wave;
+    uint32_t phase = v->phase;
+    uint32_t inc = v->inc;
+    int n, i, s, lg, rg, nz;
+
+    while (count > 0 && v->active)
+    {
+        n = count < MUS_BLOCK ? count : MUS_BLOCK;
+
+        // one envelope step a block
+        switch (v->stage)
+        {
+        case ENV_ATTACK:
+            v->env += v->attack * n;
+            if (v->env >= MUS_ENVONE)
+            {
+                v->env = MUS_ENVONE;
+                v->stage = v->decay ? ENV_DECAY : ENV_SUSTAIN;
+            }
+            break;
+        case ENV_DECAY:
+            v->env -= v->decay * n;
+            if (v->env <= v->sustain)
+            {
+                v->env = v->sustain;
+                v->stage = ENV_SUSTAIN;
+            }
+            break;
+        case ENV_RELEASE:
+            v->env -= v->release * n;
+            if (v->env < 0)
+                v->env = 0;
+            break;
+        }
+        if (v->env <= 0 && v->stage != ENV_ATTACK)
+        {
+            v->active = 0;
+            g_active--;
+            break;
+        }
+
+        lg = (int)((int64_t)v->lgain * v->env >> 24);
+        rg = (int)((int64_t)v->rgain * v->env >> 24);
+
+        if (v->drum)
+        {
+            for (i = 0; i < n; i++)
+            {
+                v->noise ^= v->noise << 13;
+                v->noise ^= v->noise >> 17;
+                v->noise ^= v->noise << 5;
+                nz = (int16_t)(v->noise >> 16);
+                if (v->bright)
+                {
+                    s = (nz - v->lastnoise) >> 1;
+                    v->lastnoise = nz;
+                    nz = s;
+                }
+                s = (nz * v->noisemix + wave[phase >> (32 - MUS_WAVEBITS)] * v->tonemix) >> 8;
+                phase += inc;
+                acc[i * 2] += (s * lg) >> 15;
+                acc[i * 2 + 1] += (s * rg) >> 15;
+            }
+            inc = (uint32_t)(((uint64_t)inc * v->sweep) >> 16);
+        }
+        else if (g_interp)
+        {
+            for (i = 0; i < n; i++)
+            {
+                int idx = phase >> (32 - MUS_WAVEBITS);
+                int frac = (phase >> (32 - MUS_WAVEBITS - 15)) & 0x7fff;
+
+                s = wave[idx];
+                s += ((wave[(idx + 1) & (MUS_WAVELEN - 1)] - s) * frac) >> 15;
+                phase += inc;
+                acc[i * 2] += (s * lg) >> 15;
+                acc[i * 2 + 1] += (s * rg) >> 15;
+            }
+        }
+        else
+        {
+            for (i = 0; i < n; i++)
+            {
+                s = wave[phase >> (32 - MUS_WAVEBITS)];
+                phase += inc;
+                acc[i * 2] += (s * lg) >> 15;
+                acc[i * 2 + 1] += (s * rg) >> 15;
+            }
+        }
+
+        acc += n * 2;
+        count -= n;
+    }
+
+    v->phase = phase;
+    v->inc = inc;
+}
+
+// Over budget: release voices down to one fewer than are playing.
+static void I_MusShed(void)
+{
+    int i, n;
+    mus_voice_t* quiet;
+
+    if (g_cap > 4)
+        g_cap--;
+    for (n = g_active - g_cap; n > 0; n--)
+    {
+        quiet = NULL;
+        for (i = 0; i < MUS_MAXVOICES; i++)
+            if (g_voices[i].active && (!quiet || g_voices[i].env < quiet->env))
+                quiet = &g_voices[i];
+        if (!quiet)
+            break;
+        quiet->active = 0;
+        g_active--;
+    }
+}
+
+void I_MusicRender(signed short* out, int count)
+{
+    struct timespec t0, t1;
+    long long spent, budget;
+    int frames = count;
+    int n, i, s;
+
+    if (!g_enabled || !g_rate)
+        return;
+    pthread_mutex_lock(&g_lock);
+    if ((!g_playing && !g_active) || g_paused)
+    {
+        pthread_mutex_unlock(&g_lock);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (count > 0)
+    {
+        if (g_ticleft == 0)
+        {
+            I_MusTic();
+            g_ticfrac += g_rate;
+            g_ticleft = g_ticfrac / MUS_TICRATE;
+            g_ticfrac %= MUS_TICRATE;
+        }
+
+        n = count;
+        if (n > g_ticleft)
+            n = g_ticleft;
+        if (n > MUS_CHUNK)
+            n = MUS_CHUNK;
+
+        memset(g_acc, 0, n * 2 * sizeof(*g_acc));
+        for (i = 0; i < MUS_MAXVOICES; i++)
+            if (g_voices[i].active)
+                I_MusRenderVoice(&g_voices[i], g_acc, n);
+
+        for (i = 0; i < n * 2; i++)
+        {
+            s = out[i] + g_acc[i];
+            out[i] = s > 32767 ? 32767 : s < -32768 ? -32768 : s;
+        }
+
+        out += n * 2;
+        count -= n;
+        g_ticleft -= n;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    spent = (t1.tv_sec - t0.tv_sec) * 1000000000LL + t1.tv_nsec - t0.tv_nsec;
+    budget = (long long)frames * 10000000LL * g_budget_pct / g_rate;
+    if (spent > budget)
+    {
+        I_MusShed();
+        g_under = 0;
+    }
+    else if (spent * 2 < budget && g_cap < g_maxvoices)
+    {
+        g_under += frames;
+        if (g_under >= g_rate)
+        {
+            g_cap++;
+            g_under = 0;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void I_MusicSetRate(int rate)
+{
+    int i;
+
+    pthread_mutex_lock(&g_lock);
+    g_rate = rate;
+    for (i = 0; i < 128; i++)
+        g_noteinc[i] = (uint32_t)(440.0 * pow(2.0, (i - 69) / 12.0) * 4294967296.0 / rate);
+    I_MusSilence();
+    g_ticleft = 0;
+    g_ticfrac = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+//
+// MUSIC API.
+//
+void I_InitMusic(void)
+{
+    const char* env;
+    int i;
+
+    env = getenv("UBO_DOOM_MUSIC");
+    g_enabled = !(env && env[0] == '0');
+
+    // 0: 8 voices straight from the tables, 1: 16 interpolated, 2: 32
+    env = getenv("UBO_DOOM_MUSIC_QUALITY");
+    i = env && env[0] ? atoi(env) : 1;
+    g_maxvoices = i <= 0 ? 8 : i == 1 ? 16 : MUS_MAXVOICES;
+    g_interp = i > 0;
+
+    env = getenv("UBO_DOOM_MUSIC_BUDGET");
+    g_budget_pct = env && env[0] ? atoi(env) : 5;
+    if (g_budget_pct < 1)
+        g_budget_pct = 1;
+    if (g_budget_pct > 100)
+        g_budget_pct = 100;
+
+    if (!g_waves_built)
+        I_MusBuildWaves();
+
+    pthread_mutex_lock(&g_lock);
+    free(g_score);
+    g_score = NULL;
+    g_scorelen = 0;
+    g_playing = g_paused = 0;
+    g_cap = g_maxvoices;
+    g_under = 0;
+    I_MusSilence();
+    pthread_mutex_unlock(&g_lock);
+
+    if (g_enabled)
+        fprintf(stderr, "[doom] I_InitMusic: %d voices%s, %d%% budget\n",
+                g_maxvoices, g_interp ? " interpolated" : "", g_budget_pct);
+}
+
+void I_ShutdownMusic(void)
+{
+    pthread_mutex_lock(&g_lock);
+    free(g_score);
+    g_score = NULL;
+    g_scorelen = 0;
+    g_playing = 0;
+    I_MusSilence();
+    pthread_mutex_unlock(&g_lock);
+}
+
+void I_SetMusicVolume(int volume)
+{
+    int i;
+
+    if (I_SndServMusic(SNDCMD_MUSICVOLUME, NULL, volume))
+        return;
+    pthread_mutex_lock(&g_lock);
+    g_volume = volume < 0 ? 0 : volume > 15 ? 15 : volume;
+    for (i = 0; i < MUS_MAXVOICES; i++)
+        if (g_voices[i].active)
+            I_MusVoiceGain(&g_voices[i]);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void I_PlaySong(int handle, int looping)
+{
+    (void)handle;
+    if (I_SndServMusic(SNDCMD_SONGPLAY, NULL, looping))
+        return;
+    pthread_mutex_lock(&g_lock);
+    I_MusSilence();
+    I_MusChannelReset();
+    g_pos = 0;
+    g_wait = 0;
+    g_ticleft = 0;
+    g_playing = g_score != NULL;
+    g_looping = looping;
+    g_paused = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void I_PauseSong(int handle)
+{
+    (void)handle;
+    if (I_SndServMusic(SNDCMD_SONGPAUSE, NULL, 0))
+        return;
+    pthread_mutex_lock(&g_lock);
+    g_paused = 1;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void I_ResumeSong(int handle)
+{
+    (void)handle;
+    if (I_SndServMusic(SNDCMD_SONGRESUME, NULL, 0))
+        return;
+    pthread_mutex_lock(&g_lock);
+    g_paused = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void I_StopSong(int handle)
+{
+    (void)handle;
+    if (I_SndServMusic(SNDCMD_SONGSTOP, NULL, 0))
+        return;
+    pthread_mutex_lock(&g_lock);
+    g_playing = 0;
+    I_MusSilence();
+    pthread_mutex_unlock(&g_lock);
+}
+
+void I_UnRegisterSong(int handle)
+{
+    (void)handle;
+    if (I_SndServMusic(SNDCMD_SONGFREE, NULL, 0))
+        return;
+    pthread_mutex_lock(&g_lock);
+    g_playing = 0;
+    I_MusSilence();
+    free(g_score);
+    g_score = NULL;
+    g_scorelen = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+// The score is copied, so the lump can be purged (or the zone reset) while
+// the audio thread plays it.
+int I_RegisterSong(void* data)
+{
+    const uint8_t* mus = data;
+    uint8_t* score = NULL;
+    int len = 0;
+    int start;
+
+    if (I_SndServMusic(SNDCMD_SONG, data, 0))
+        return 1;
+    if (mus && !memcmp(mus, "MUS\x1a", 4))
+    {
+        len = mus[4] | mus[5] << 8;
+        start = mus[6] | mus[7] << 8;
+        score = malloc(len ? len : 1);
+        if (score)
+            memcpy(score, mus + start, len);
+    }
+    else if (g_enabled)
+        fprintf(stderr, "[doom] I_RegisterSong: not a MUS lump\n");
+
+    pthread_mutex_lock(&g_lock);
+    g_playing = 0;
+    I_MusSilence();
+    free(g_score);
+    g_score = score;
+    g_scorelen = score ? len : 0;
+    pthread_mutex_unlock(&g_lock);
+    return 1;
+}
+
+// Is the song playing?
+int I_QrySongPlaying(int handle)
+{
+    (void)handle;
+    return g_playing;
+}
@@ -23,6 +23,8 @@
 static const char
 rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 
+#define _GNU_SOURCE		// recvmmsg / sendmmsg
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -33,7 +35,8 @@ rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 #include <errno.h>
 #include <unistd.h>
 #include <netdb.h>
-#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <stddef.h>
 
 #include "i_system.h"
 #include "d_event.h"
@@ -51,19 +54,7 @@ rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 
 
 
-// For some odd reason...
-#define ntohl(x) \
-        ((unsigned long int)((((unsigned long int)(x) & 0x000000ffU) << 24) | \
-                             (((unsigned long int)(x) & 0x0000ff00U) <<  8) | \
-                             (((unsigned long int)(x) & 0x00ff0000U) >>  8) | \
-                             (((unsigned long int)(x) & 0xff000000U) >> 24)))
-
-#define ntohs(x) \
-        ((unsigned short int)((((unsigned short int)(x) & 0x00ff) << 8) | \
-                              (((unsigned short int)(x) & 0xff00) >> 8))) \
-	  
-#define htonl(x) ntohl(x)
-#define htons(x) ntohs(x)
+// Packets are in network byte order (the <arpa/inet.h> ntohl/htons).
 
 void	NetSend (void);
 boolean NetListen (void);
@@ -75,14 +66,32 @@ boolean NetListen (void);
 
 int	DOOMPORT =	(IPPORT_USERRESERVED +0x1d );
 
-int			sendsocket;
-int			insocket;
+// One non-blocking socket, bound to DOOMPORT, sends and receives,
+// so every node's packets come from the address and port the others
+// send to and two games can share a host on different ports.
+int			netsocket = -1;
 
 struct	sockaddr_in	sendaddress[MAXNETNODES];
 
 void	(*netget) (void);
 void	(*netsend) (void);
 
+// A tic's packets to all nodes go out in one sendmmsg, and one
+// recvmmsg reads everything that queued up since the last tic.
+#define NETBATCH	8
+
+static doomdata_t	txbuf[NETBATCH];
+static struct iovec	txiov[NETBATCH];
+static struct mmsghdr	txmsgs[NETBATCH];
+static int		txcount;
+
+static doomdata_t	rxbuf[NETBATCH];
+static struct iovec	rxiov[NETBATCH];
+static struct sockaddr_in rxaddr[NETBATCH];
+static struct mmsghdr	rxmsgs[NETBATCH];
+static int		rxcount;
+static int		rxnext;
+
 
 //
 // UDPsocket
@@ -121,37 +130,70 @@ BindToLocalPort
 }
 
 
+//
+// I_FlushNetwork
+// Sends the packets PacketSend queued.  UDP gives no guarantee anyway,
+// so a packet the kernel refuses is dropped and left to the
+// retransmit requests in d_net.c.
+//
+void I_FlushNetwork (void)
+{
+    int		sent;
+    int		c;
+
+    for (sent = 0 ; sent < txcount ; sent += c)
+    {
+	c = sendmmsg (netsocket, txmsgs+sent, txcount-sent, 0);
+	if (c < 1)
+	{
+	    if (c == -1 && errno == EINTR)
+	    {
+		c = 0;
+		continue;
+	    }
+	    c = 1;
+	}
+    }
+    txcount = 0;
+}
+
+
 //
 // PacketSend
 //
 void PacketSend (void)
 {
     int		c;
-    doomdata_t	sw;
+    doomdata_t*	sw;
+
+    if (txcount == NETBATCH)
+	I_FlushNetwork ();
+    sw = &txbuf[txcount];
 				
     // byte swap
-    sw.checksum = htonl(netbuffer->checksum);
-    sw.player = netbuffer->player;
-    sw.retransmitfrom = netbuffer->retransmitfrom;
-    sw.starttic = netbuffer->starttic;
-    sw.numtics = netbuffer->numtics;
+    sw->checksum = htonl(netbuffer->checksum);
+    sw->player = netbuffer->player;
+    sw->retransmitfrom = netbuffer->retransmitfrom;
+    sw->starttic = netbuffer->starttic;
+    sw->numtics = netbuffer->numtics;
     for (c=0 ; c< netbuffer->numtics ; c++)
     {
-	sw.cmds[c].forwardmove = netbuffer->cmds[c].forwardmove;
-	sw.cmds[c].sidemove = netbuffer->cmds[c].sidemove;
-	sw.cmds[c].angleturn = htons(netbuffer->cmds[c].angleturn);
-	sw.cmds[c].consistancy = htons(netbuffer->cmds[c].consistancy);
-	sw.cmds[c].chatchar = netbuffer->cmds[c].chatchar;
-	sw.cmds[c].buttons = netbuffer->cmds[c].buttons;
+	sw->cmds[c].forwardmove = netbuffer->cmds[c].forwardmove;
+	sw->cmds[c].sidemove = netbuffer->cmds[c].sidemove;
+	sw->cmds[c].angleturn = htons(netbuffer->cmds[c].angleturn);
+	sw->cmds[c].consistancy = htons(netbuffer->cmds[c].consistancy);
+	sw->cmds[c].chatchar = netbuffer->cmds[c].chatchar;
+	sw->cmds[c].buttons = netbuffer->cmds[c].buttons;
     }
-		
-    //printf ("sending %i\n",gametic);		
-    c = sendto (sendsocket , &sw, doomcom->datalength
-		,0,(void *)&sendaddress[doomcom->remotenode]
-		,sizeof(sendaddress[doomcom->remotenode]));
-	
-    //	if (c == -1)
-    //		I_Error ("SendPacket error: %s",strerror(errno));
+
+    txiov[txcount].iov_base = sw;
+    txiov[txcount].iov_len = doomcom->datalength;
+    memset (&txmsgs[txcount], 0, sizeof(txmsgs[txcount]));
+    txmsgs[txcount].msg_hdr.msg_name = &sendaddress[doomcom->remotenode];
+    txmsgs[txcount].msg_hdr.msg_namelen = sizeof(sendaddress[0]);
+    txmsgs[txcount].msg_hdr.msg_iov = &txiov[txcount];
+    txmsgs[txcount].msg_hdr.msg_iovlen = 1;
+    txcount++;
 }
 
 
@@ -162,31 +204,59 @@ void PacketGet (void)
 {
     int			i;
     int			c;
-    struct sockaddr_in	fromaddress;
-    int			fromlen;
-    doomdata_t		sw;
-				
-    fromlen = sizeof(fromaddress);
-    c = recvfrom (insocket, &sw, sizeof(sw), 0
-		  , (struct sockaddr *)&fromaddress, &fromlen );
-    if (c == -1 )
+    struct sockaddr_in*	fromaddress;
+    doomdata_t*		sw;
+
+    // whatever is still queued goes out before we look for replies
+    if (txcount)
+	I_FlushNetwork ();
+
+    if (rxnext == rxcount)
     {
-	if (errno != EWOULDBLOCK)
-	    I_Error ("GetPacket: %s",strerror(errno));
-	doomcom->remotenode = -1;		// no packet
-	return;
+	rxnext = rxcount = 0;
+	for (i=0 ; i<NETBATCH ; i++)
+	{
+	    rxiov[i].iov_base = &rxbuf[i];
+	    rxiov[i].iov_len = sizeof(rxbuf[i]);
+	    memset (&rxmsgs[i], 0, sizeof(rxmsgs[i]));
+	    rxmsgs[i].msg_hdr.msg_name = &rxaddr[i];
+	    rxmsgs[i].msg_hdr.msg_namelen = sizeof(rxaddr[i]);
+	    rxmsgs[i].msg_hdr.msg_iov = &rxiov[i];
+	    rxmsgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	c = recvmmsg (netsocket, rxmsgs, NETBATCH, MSG_DONTWAIT, NULL);
+	if (c == -1)
+	{
+	    if (errno != EWOULDBLOCK && errno != EAGAIN
+		&& errno != EINTR && errno != ECONNREFUSED)
+		I_Error ("GetPacket: %s",strerror(errno));
+	    doomcom->remotenode = -1;		// no packet
+	    return;
+	}
+	rxcount = c;
+	if (!rxcount)
+	{
+	    doomcom->remotenode = -1;
+	    return;
+	}
     }
 
+    sw = &rxbuf[rxnext];
+    fromaddress = &rxaddr[rxnext];
+    c = rxmsgs[rxnext].msg_len;
+    rxnext++;
+
+    // too short for the header, or more tics than fit
+    if (c < (int)offsetof(doomdata_t, cmds) || sw->numtics > BACKUPTICS)
     {
-	static int first=1;
-	if (first)
-	    printf("len=%d:p=[0x%x 0x%x] \n", c, *(int*)&sw, *((int*)&sw+1));
-	first = 0;
+	doomcom->remotenode = -1;
+	return;
     }
 
     // find remote node number
     for (i=0 ; i<doomcom->numnodes ; i++)
-	if ( fromaddress.sin_addr.s_addr == sendaddress[i].sin_addr.s_addr )
+	if ( fromaddress->sin_addr.s_addr == sendaddress[i].sin_addr.s_addr
+	     && fromaddress->sin_port == sendaddress[i].sin_port )
 	    break;
 
     if (i == doomcom->numnodes)
@@ -200,20 +270,20 @@ void PacketGet (void)
     doomcom->datalength = c;
 	
     // byte swap
-    netbuffer->checksum = ntohl(sw.checksum);
-    netbuffer->player = sw.player;
-    netbuffer->retransmitfrom = sw.retransmitfrom;
-    netbuffer->starttic = sw.starttic;
-    netbuffer->numtics = sw.numtics;
+    netbuffer->checksum = ntohl(sw->checksum);
+    netbuffer->player = sw->player;
+    netbuffer->retransmitfrom = sw->retransmitfrom;
+    netbuffer->starttic = sw->starttic;
+    netbuffer->numtics = sw->numtics;
 
     for (c=0 ; c< netbuffer->numtics ; c++)
     {
-	netbuffer->cmds[c].forwardmove = sw.cmds[c].forwardmove;
-	netbuffer->cmds[c].sidemove = sw.cmds[c].sidemove;
-	netbuffer->cmds[c].angleturn = ntohs(sw.cmds[c].angleturn);
-	netbuffer->cmds[c].consistancy = ntohs(sw.cmds[c].consistancy);
-	netbuffer->cmds[c].chatchar = sw.cmds[c].chatchar;
-	netbuffer->cmds[c].buttons = sw.cmds[c].buttons;
+	netbuffer->cmds[c].forwardmove = sw->cmds[c].forwardmove;
+	netbuffer->cmds[c].sidemove = sw->cmds[c].sidemove;
+	netbuffer->cmds[c].angleturn = ntohs(sw->cmds[c].angleturn);
+	netbuffer->cmds[c].consistancy = ntohs(sw->cmds[c].consistancy);
+	netbuffer->cmds[c].chatchar = sw->cmds[c].chatchar;
+	netbuffer->cmds[c].buttons = sw->cmds[c].buttons;
     }
 }
 
@@ -243,11 +313,15 @@ int GetLocalAddress (void)
 //
 void I_InitNetwork (void)
 {
-    boolean		trueval = true;
     int			i;
     int			p;
+    int			port;
+    char		host[256];
+    char*		colon;
     struct hostent*	hostentry;	// host information entry
 	
+    I_ShutdownNetwork ();
+    free (doomcom);
     doomcom = malloc (sizeof (*doomcom) );
     memset (doomcom, 0, sizeof(*doomcom) );
     
@@ -295,25 +369,43 @@ void I_InitNetwork (void)
     netgame = true;
 
     // parse player number and host list
+    if (i >= myargc-1)
+	I_Error ("-net: missing player number");
     doomcom->consoleplayer = myargv[i+1][0]-'1';
+    if (doomcom->consoleplayer < 0 || doomcom->consoleplayer >= MAXPLAYERS)
+	I_Error ("-net: player must be 1 to %i", MAXPLAYERS);
 
     doomcom->numnodes = 1;	// this node for sure
 	
     i++;
     while (++i < myargc && myargv[i][0] != '-')
     {
+	if (doomcom->numnodes == MAXPLAYERS)
+	    I_Error ("-net: at most %i players", MAXPLAYERS);
+
+	// host:port for a node that listens on another port
+	strncpy (host, myargv[i], sizeof(host)-1);
+	host[sizeof(host)-1] = 0;
+	port = DOOMPORT;
+	colon = strchr (host, ':');
+	if (colon)
+	{
+	    *colon = 0;
+	    port = atoi (colon+1);
+	}
+
 	sendaddress[doomcom->numnodes].sin_family = AF_INET;
-	sendaddress[doomcom->numnodes].sin_port = htons(DOOMPORT);
-	if (myargv[i][0] == '.')
+	sendaddress[doomcom->numnodes].sin_port = htons(port);
+	if (host[0] == '.')
 	{
 	    sendaddress[doomcom->numnodes].sin_addr.s_addr 
-		= inet_addr (myargv[i]+1);
+		= inet_addr (host+1);
 	}
 	else
 	{
-	    hostentry = gethostbyname (myargv[i]);
+	    hostentry = gethostbyname (host);
 	    if (!hostentry)
-		I_Error ("gethostbyname: couldn't find %s", myargv[i]);
+		I_Error ("gethostbyname: couldn't find %s", host);
 	    sendaddress[doomcom->numnodes].sin_addr.s_addr 
 		= *(int *)hostentry->h_addr_list[0];
 	}
@@ -324,11 +416,25 @@ void I_InitNetwork (void)
     doomcom->numplayers = doomcom->numnodes;
     
     // build message to receive
-    insocket = UDPsocket ();
-    BindToLocalPort (insocket,htons(DOOMPORT));
-    ioctl (insocket, FIONBIO, &trueval);
+    netsocket = UDPsocket ();
+    BindToLocalPort (netsocket,htons(DOOMPORT));
+    fcntl (netsocket, F_SETFL, fcntl (netsocket, F_GETFL) | O_NONBLOCK);
+}
+
 
-    sendsocket = UDPsocket ();
+//
+// I_ShutdownNetwork
+// Closes the socket so a restarted game can bind the port again.
+//
+void I_ShutdownNetwork (void)
+{
+    if (netsocket != -1)
+    {
+	I_FlushNetwork ();
+	close (netsocket);
+	netsocket = -1;
+    }
+    txcount = rxcount = rxnext = 0;
 }
 
 
@@ -36,6 +36,10 @@
 void I_InitNetwork (void);
 void I_NetCmd (void);
 
+// Sends the packets queued since the last PacketGet.
+void I_FlushNetwork (void);
+void I_ShutdownNetwork (void);
+
 
 #endif
 //-----------------------------------------------------------------------------
@@ -0,0 +1,274 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "d_main.h"
+#include "doomdef.h"
+#include "i_sound.h"
+#include "sndshm.h"
+
+// Out-of-process sound (UBO_DOOM_SNDSERV=/path/to/sndserver):
+// - The engine spawns ../sndserv's server, which reads the effects from
+//   the IWAD itself, mixes them with the music synth and writes ALSA at
+//   real-time priority (UBO_DOOM_SNDSERV_RTPRIO).  A stalled host process
+//   or tick thread no longer starves the device.
+// - The two talk through sndshm.h: I_StartSound and friends post fixed
+//   size commands to a lock-free ring and never block; the server polls
+//   it once per mix pass and publishes the handles it is playing.
+// - If the server cannot start, I_InitSound falls back to in-process
+//   ALSA.  If it dies later, sound stops with a log line.
+
+extern char** environ;
+
+static sndshm_t* g_shm;
+static pid_t g_pid;
+static int g_handle;
+static int g_dead;
+static unsigned g_dropped;
+
+static void I_SndServSleepMs(int ms)
+{
+    struct timespec d = { 0, ms * 1000000L };
+    nanosleep(&d, NULL);
+}
+
+static int I_SndServAlive(void)
+{
+    int status;
+
+    if (!g_shm || g_dead)
+        return 0;
+    if (waitpid(g_pid, &status, WNOHANG) == g_pid)
+    {
+        fprintf(stderr, "[doom] sndserver exited (status %d); sound is off\n", status);
+        g_dead = 1;
+        return 0;
+    }
+    return 1;
+}
+
+static int I_SndServPost(int op, int a, int b, int c, int d, int e)
+{
+    uint32_t head, tail;
+    sndcmd_t* cmd;
+
+    if (!g_shm || g_dead)
+        return 0;
+    head = g_shm->head;
+    tail = __atomic_load_n(&g_shm->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= SNDSHM_RING)
+    {
+        // the server is wedged; a dropped effect beats a stalled tic
+        if (g_dropped++ % 64 == 0)
+            fprintf(stderr, "[doom] sndserver ring full, %u commands dropped\n", g_dropped);
+        return 0;
+    }
+    cmd = &g_shm->cmd[head & (SNDSHM_RING - 1)];
+    cmd->op = op;
+    cmd->a = a;
+    cmd->b = b;
+    cmd->c = c;
+    cmd->d = d;
+    cmd->e = e;
+    __atomic_store_n(&g_shm->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Waits up to ms for the server to run everything posted.
+static int I_SndServDrain(int ms)
+{
+    while (__atomic_load_n(&g_shm->tail, __ATOMIC_ACQUIRE) != g_shm->head)
+    {
+        if (ms <= 0 || !I_SndServAlive())
+            return 0;
+        I_SndServSleepMs(1);
+        ms--;
+    }
+    return 1;
+}
+
+int I_SndServStart(void)
+{
+    const char* path = getenv("UBO_DOOM_SNDSERV");
+    const char* prio = getenv("UBO_DOOM_SNDSERV_RTPRIO");
+    char name[64];
+    char fdarg[16];
+    char* argv[12];
+    int argc = 0;
+    int fd, i, err;
+
+    if (!path || !path[0] || !strcmp(path, "0"))
+        return 0;
+    if (g_shm)
+        return !g_dead;
+
+    snprintf(name, sizeof(name), "/ubodoom-snd-%d", (int)getpid());
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[doom] sndserver: shm_open failed: %s\n", strerror(errno));
+        return 0;
+    }
+    shm_unlink(name);
+    if (ftruncate(fd, sizeof(sndshm_t)) < 0
+        || (g_shm = mmap(NULL, sizeof(sndshm_t), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "[doom] sndserver: shared memory failed: %s\n", strerror(errno));
+        g_shm = NULL;
+        close(fd);
+        return 0;
+    }
+    memset(g_shm, 0, sizeof(*g_shm));
+    g_shm->magic = SNDSHM_MAGIC;
+    g_shm->version = SNDSHM_VERSION;
+
+    // shm_open sets close-on-exec; the server inherits this one
+    fcntl(fd, F_SETFD, 0);
+    snprintf(fdarg, sizeof(fdarg), "%d", fd);
+    argv[argc++] = (char*)path;
+    argv[argc++] = "-quiet";
+    argv[argc++] = "-shmfd";
+    argv[argc++] = fdarg;
+    if (wadfiles[0])
+    {
+        argv[argc++] = "-wad";
+        argv[argc++] = wadfiles[0];
+    }
+    argv[argc++] = "-rtprio";
+    argv[argc++] = (char*)(prio && prio[0] ? prio : "10");
+    argv[argc] = NULL;
+
+    err = posix_spawn(&g_pid, path, NULL, NULL, argv, environ);
+    close(fd);
+    if (err)
+    {
+        fprintf(stderr, "[doom] sndserver: cannot run %s: %s\n", path, strerror(err));
+        munmap(g_shm, sizeof(sndshm_t));
+        g_shm = NULL;
+        return 0;
+    }
+
+    // The server answers once the WAD is read and the device is open.
+    g_dead = 0;
+    for (i = 0; i < 3000 && !__atomic_load_n(&g_shm->ready, __ATOMIC_ACQUIRE); i++)
+    {
+        if (!I_SndServAlive())
+            break;
+        I_SndServSleepMs(1);
+    }
+    if (g_dead || !g_shm->ready)
+    {
+        fprintf(stderr, "[doom] sndserver did not start; mixing in process\n");
+        I_SndServStop();
+        return 0;
+    }
+    fprintf(stderr, "[doom] I_InitSound: sndserver pid %d, %d Hz\n",
+            (int)g_pid, g_shm->rate);
+    return 1;
+}
+
+void I_SndServStop(void)
+{
+    int i;
+
+    if (!g_shm)
+        return;
+    if (!g_dead)
+    {
+        I_SndServPost(SNDCMD_QUIT, 0, 0, 0, 0, 0);
+        for (i = 0; i < 1000 && waitpid(g_pid, NULL, WNOHANG) == 0; i++)
+            I_SndServSleepMs(1);
+        if (i == 1000)
+        {
+            kill(g_pid, SIGKILL);
+            waitpid(g_pid, NULL, 0);
+        }
+    }
+    munmap(g_shm, sizeof(sndshm_t));
+    g_shm = NULL;
+    g_dead = 0;
+}
+
+int I_SndServActive(void)
+{
+    return g_shm != NULL;
+}
+
+// Once a tic from I_SubmitSound.
+void I_SndServPoll(void)
+{
+    I_SndServAlive();
+}
+
+unsigned I_SndServUnderruns(void)
+{
+    return g_shm ? __atomic_load_n(&g_shm->underruns, __ATOMIC_RELAXED) : 0;
+}
+
+int I_SndServPlay(int id, int vol, int sep, int pitch)
+{
+    if (++g_handle <= 0)
+        g_handle = 1;
+    I_SndServPost(SNDCMD_PLAY, id, vol, sep, pitch, g_handle);
+    return g_handle;
+}
+
+void I_SndServStopSound(int handle)
+{
+    I_SndServPost(SNDCMD_STOP, 0, 0, 0, 0, handle);
+}
+
+void I_SndServUpdate(int handle, int vol, int sep, int pitch)
+{
+    I_SndServPost(SNDCMD_UPDATE, 0, vol, sep, pitch, handle);
+}
+
+int I_SndServIsPlaying(int handle)
+{
+    int i;
+
+    if (!g_shm || g_dead || handle <= 0)
+        return 0;
+    // posted but not yet picked up counts as playing
+    if (handle > g_handle - (int)(g_shm->head - __atomic_load_n(&g_shm->tail, __ATOMIC_ACQUIRE)))
+        return 1;
+    for (i = 0; i < SNDSHM_CHANNELS; i++)
+        if (__atomic_load_n(&g_shm->playing[i], __ATOMIC_RELAXED) == handle)
+            return 1;
+    return 0;
+}
+
+int I_SndServMusic(int op, const void* data, int arg)
+{
+    const unsigned char* mus = data;
+    int len;
+
+    if (!g_shm)
+        return 0;
+    if (op == SNDCMD_SONG)
+    {
+        // the song area is only rewritten while the server is idle
+        if (!mus || memcmp(mus, "MUS\x1a", 4) || !I_SndServDrain(200))
+            return 1;
+        len = (mus[4] | mus[5] << 8) + (mus[6] | mus[7] << 8);
+        if (len > SNDSHM_SONGMAX)
+        {
+            fprintf(stderr, "[doom] sndserver: song of %d bytes is too long\n", len);
+            return 1;
+        }
+        memcpy(g_shm->song, mus, len);
+        arg = len;
+    }
+    I_SndServPost(op, arg, 0, 0, 0, 0);
+    return 1;
+}
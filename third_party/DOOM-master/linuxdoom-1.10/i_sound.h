@@ -47,6 +47,11 @@ void I_SubmitSound(void);
 // ... shut down and relase at program termination.
 void I_ShutdownSound(void);
 
+// UBO: give the device and loaded effects up while the app is in the
+//  background, and take the device back.
+void I_SuspendSound(void);
+void I_ResumeSound(void);
+
 
 //
 //  SFX I/O
@@ -112,6 +117,27 @@ void I_StopSong(int handle);
 // See above (register), then think backwards
 void I_UnRegisterSong(int handle);
 
+// ALSA backend: the software synth in i_music_ubo.c.
+// Called with the device rate before any rendering.
+void I_MusicSetRate(int rate);
+// Adds count stereo frames of music into out, saturating.
+void I_MusicRender(signed short* out, int count);
+
+// ALSA backend: mixing in a separate sndserver process, i_sndserv_ubo.c.
+// I_SndServStart returns 0 unless UBO_DOOM_SNDSERV names a server that
+// came up; the rest are no-ops while none is running.
+int I_SndServStart(void);
+void I_SndServStop(void);
+int I_SndServActive(void);
+void I_SndServPoll(void);
+unsigned I_SndServUnderruns(void);
+int I_SndServPlay(int id, int vol, int sep, int pitch);
+void I_SndServStopSound(int handle);
+void I_SndServUpdate(int handle, int vol, int sep, int pitch);
+int I_SndServIsPlaying(int handle);
+// Forwards a music call (SNDCMD_SONG..SNDCMD_MUSICVOLUME); 1 if sent.
+int I_SndServMusic(int op, const void* data, int arg);
+
 
 
 #endif
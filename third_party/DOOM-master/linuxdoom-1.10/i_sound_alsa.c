@@ -28,6 +28,7 @@ rcsid[] = "$Id: i_unix.c,v 1.5 1997/02/03 22:45:10 b1 Exp $";
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <errno.h>
 
 #include <math.h>
 
@@ -39,12 +40,19 @@ rcsid[] = "$Id: i_unix.c,v 1.5 1997/02/03 22:45:10 b1 Exp $";
 #endif
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 
 // Linux voxware output.
 #include <alsa/asoundlib.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // Timer stuff. Experimental.
 #include <time.h>
 #include <signal.h>
@@ -52,12 +60,16 @@ rcsid[] = "$Id: i_unix.c,v 1.5 1997/02/03 22:45:10 b1 Exp $";
 #include "z_zone.h"
 
 #include "i_system.h"
+#include "i_log.h"
+#include "i_trace.h"
 #include "i_sound.h"
+#include "i_thread.h"
 #include "m_argv.h"
 #include "m_misc.h"
 #include "w_wad.h"
 
 #include "doomdef.h"
+#include "doom_api.h"
 
 // UNIX hack, to be removed.
 #ifdef SNDSERV
@@ -92,7 +104,9 @@ static int flag = 0;
 
 // Needed for calling the actual sound output.
 #define SAMPLECOUNT		512
-#define NUM_CHANNELS		8
+// Mixer slots compiled in; UBO_DOOM_MIX_CHANNELS picks how many
+//  are used, 8 by default as before.
+#define NUM_CHANNELS		32
 // It is 2 for 16bit, and 2 for two channels.
 #define BUFMUL                  4
 #define MIXBUFFERSIZE		(SAMPLECOUNT*BUFMUL)
@@ -100,12 +114,32 @@ static int flag = 0;
 #define SAMPLERATE		11025	// Hz
 #define SAMPLESIZE		2   	// 16bit
 
+// The rate the device runs at.  The mixer steps through the
+//  11025 Hz effects at this rate, interpolating when it is higher,
+//  unless I_UpsampleSfx has already converted them to it.
+static int		audiorate = SAMPLERATE;
+static int		audioperiod = 256;	// frames per device period
+static int		audiobuffer;		// frames the device buffers
+
+// Frames of mixed audio the audio thread's ring holds, a power of two.
+#define AUDIORING	16384
+
+static int		mixchannels = 8;
+
+// Frames mixed per pass.  Each playing channel adds a pass worth of
+//  samples into mixacc, which is then saturated into the output once.
+#define MIXBLOCK	256
+
+static int		mixacc[MIXBLOCK*2];
+
 // The actual lengths of all sound effects.
 int 		lengths[NUMSFX];
 
 // The actual output device.
 int audio_fd;
 static snd_pcm_t* audio_pcm = NULL;
+// Closed by I_SuspendSound, to be reopened by I_ResumeSound.
+static int audiosuspended;
 // The global mixing buffer.
 // Basically, samples from all active internal channels
 //  are modifed and added, and stored in the buffer
@@ -151,6 +185,17 @@ int		vol_lookup[128*256];
 int*		channelleftvol_lookup[NUM_CHANNELS];
 int*		channelrightvol_lookup[NUM_CHANNELS];
 
+// Set when the channel plays an upsampled effect: channels[] and
+//  channelsend[] then point at 16 bit samples, scaled by the volumes
+//  below (16.16, 1.0 at 127) instead of going through the lookups.
+static int	channelwide[NUM_CHANNELS];
+static int	channelleftscale[NUM_CHANNELS];
+static int	channelrightscale[NUM_CHANNELS];
+
+// Effects upsampled to audiorate, or NULL.
+static short*	sfxwide[NUMSFX];
+static int	sfxwidelen[NUMSFX];
+
 static int
 I_OpenPreferredAlsaPcm(snd_pcm_t** out_pcm)
 {
@@ -192,21 +237,143 @@ I_OpenPreferredAlsaPcm(snd_pcm_t** out_pcm)
     continue;
   }
 
-  fprintf(stderr, "ALSA: trying playback device '%s'\n", dev);
+  UBO_LOG(UBO_LOG_INFO, "ALSA: trying playback device '%s'\n", dev);
   err = snd_pcm_open(out_pcm, dev, SND_PCM_STREAM_PLAYBACK, 0);
   if (err >= 0)
   {
-      fprintf(stderr, "ALSA: using playback device '%s'\n", dev);
+      UBO_LOG(UBO_LOG_INFO, "ALSA: using playback device '%s'\n", dev);
       return 0;
   }
 
-  fprintf(stderr, "ALSA: snd_pcm_open('%s') failed: %s\n", dev, snd_strerror(err));
+  UBO_LOG(UBO_LOG_INFO, "ALSA: snd_pcm_open('%s') failed: %s\n", dev, snd_strerror(err));
     }
 
     return -1;
 }
 
 
+static int I_EnvInt (const char* name, int def, int min, int max)
+{
+    const char*	env = getenv (name);
+    int		v;
+
+    if (!env || !env[0])
+	return def;
+    v = atoi (env);
+    if (v < min)
+	v = min;
+    if (v > max)
+	v = max;
+    return v;
+}
+
+//
+// I_SetAlsaParams
+// Asks the device for its own rate, UBO_DOOM_ALSA_RATE (11025 by
+//  default; 44100 or 48000 let most codecs skip ALSA's resampler),
+//  and UBO_DOOM_ALSA_PERIOD_US / UBO_DOOM_ALSA_BUFFER_US.  The mixer
+//  then runs at whatever rate the device settled on.  Without the
+//  audio thread each tic writes SAMPLECOUNT frames, so that mode
+//  stays at 11025 Hz with the old half second buffer.  Falls back to
+//  snd_pcm_set_params when the device refuses the hardware setup.
+//
+static void I_SetAlsaParams (snd_pcm_t* pcm, int threaded)
+{
+    snd_pcm_hw_params_t*	hw = NULL;
+    snd_pcm_sw_params_t*	sw = NULL;
+    snd_pcm_uframes_t		period;
+    snd_pcm_uframes_t		buffer;
+    unsigned			rate;
+    int				period_us;
+    int				buffer_us;
+    int				dir = 0;
+    int				err;
+
+    rate = SAMPLERATE;
+    if (threaded)
+	rate = I_EnvInt ("UBO_DOOM_ALSA_RATE", SAMPLERATE, 8000, 96000);
+    period_us = I_EnvInt ("UBO_DOOM_ALSA_PERIOD_US", 10000, 1000, 100000);
+    buffer_us = I_EnvInt ("UBO_DOOM_ALSA_BUFFER_US",
+			  threaded ? 40000 : 500000, 2*period_us, 1000000);
+
+    if ((err = snd_pcm_hw_params_malloc (&hw)) < 0
+	|| (err = snd_pcm_hw_params_any (pcm, hw)) < 0
+	|| (err = snd_pcm_hw_params_set_access (pcm, hw,
+			SND_PCM_ACCESS_RW_INTERLEAVED)) < 0
+	|| (err = snd_pcm_hw_params_set_format (pcm, hw,
+			SND_PCM_FORMAT_S16_LE)) < 0
+	|| (err = snd_pcm_hw_params_set_channels (pcm, hw, 2)) < 0)
+	goto fallback;
+
+    // let ALSA resample only when the device can't take the rate
+    if (snd_pcm_hw_params_set_rate_resample (pcm, hw, 0) < 0
+	|| snd_pcm_hw_params_set_rate_near (pcm, hw, &rate, &dir) < 0)
+    {
+	snd_pcm_hw_params_set_rate_resample (pcm, hw, 1);
+	if ((err = snd_pcm_hw_params_set_rate_near (pcm, hw, &rate, &dir)) < 0)
+	    goto fallback;
+    }
+    if (!threaded && rate != SAMPLERATE)
+    {
+	rate = SAMPLERATE;
+	snd_pcm_hw_params_set_rate_resample (pcm, hw, 1);
+	if ((err = snd_pcm_hw_params_set_rate_near (pcm, hw, &rate, &dir)) < 0
+	    || rate != SAMPLERATE)
+	    goto fallback;
+    }
+
+    period = (snd_pcm_uframes_t)((long long)period_us * rate / 1000000);
+    buffer = (snd_pcm_uframes_t)((long long)buffer_us * rate / 1000000);
+    dir = 0;
+    if ((err = snd_pcm_hw_params_set_period_size_near (pcm, hw,
+			&period, &dir)) < 0
+	|| (err = snd_pcm_hw_params_set_buffer_size_near (pcm, hw,
+			&buffer)) < 0
+	|| (err = snd_pcm_hw_params (pcm, hw)) < 0)
+	goto fallback;
+    snd_pcm_hw_params_get_period_size (hw, &period, &dir);
+    snd_pcm_hw_params_get_buffer_size (hw, &buffer);
+
+    // start on the first period and wake the writer once per period
+    if ((err = snd_pcm_sw_params_malloc (&sw)) < 0
+	|| (err = snd_pcm_sw_params_current (pcm, sw)) < 0
+	|| (err = snd_pcm_sw_params_set_start_threshold (pcm, sw,
+			period)) < 0
+	|| (err = snd_pcm_sw_params_set_avail_min (pcm, sw, period)) < 0
+	|| (err = snd_pcm_sw_params (pcm, sw)) < 0)
+	UBO_LOG (UBO_LOG_ERROR, "ALSA: sw params failed: %s\n", snd_strerror (err));
+
+    audiorate = rate;
+    audioperiod = period;
+    audiobuffer = buffer;
+    if (audioperiod > AUDIORING/8)
+	audioperiod = AUDIORING/8;
+    UBO_LOG (UBO_LOG_INFO, "ALSA: %u Hz, period %lu, buffer %lu frames\n",
+	     rate, (unsigned long)period, (unsigned long)buffer);
+    snd_pcm_sw_params_free (sw);
+    snd_pcm_hw_params_free (hw);
+    return;
+
+  fallback:
+    UBO_LOG (UBO_LOG_ERROR, "ALSA: hw params failed: %s\n", snd_strerror (err));
+    if (hw)
+	snd_pcm_hw_params_free (hw);
+    audiorate = SAMPLERATE;
+    audioperiod = 256;
+    audiobuffer = (int)((long long)buffer_us * SAMPLERATE / 1000000);
+    err = snd_pcm_set_params (pcm,
+			      SND_PCM_FORMAT_S16_LE,
+			      SND_PCM_ACCESS_RW_INTERLEAVED,
+			      2,		// channels
+			      SAMPLERATE,
+			      1,		// soft_resample
+			      buffer_us);	// latency in us
+    if (err < 0)
+	UBO_LOG (UBO_LOG_ERROR, "ALSA: snd_pcm_set_params failed: %s\n",
+		 snd_strerror (err));
+}
+
+
 
 
 //
@@ -244,10 +411,8 @@ getsfx
   int*          len )
 {
     unsigned char*      sfx;
-    unsigned char*      paddedsfx;
-    int                 i;
     int                 size;
-    int                 paddedsize;
+    int                 samples;
     char                name[20];
     int                 sfxlump;
 
@@ -279,37 +444,219 @@ getsfx
     //	     sfxname, sfxlump, size );
     //fflush( stderr );
     
+    // Played in place: straight from the WAD mapping when there
+    //  is one, else from the static zone copy.  The mixer stops
+    //  at lengths[], so there is no padding out to SAMPLECOUNT.
     sfx = (unsigned char*)W_CacheLumpNum( sfxlump, PU_STATIC );
 
-    // Pads the sound effect out to the mixing buffer size.
-    // The original realloc would interfere with zone memory.
-    paddedsize = ((size-8 + (SAMPLECOUNT-1)) / SAMPLECOUNT) * SAMPLECOUNT;
+    // The DMX header's sample count, if it fits the lump.
+    samples = size - 8;
+    if (size >= 8)
+    {
+	int	count = sfx[4] | sfx[5]<<8 | sfx[6]<<16 | sfx[7]<<24;
+
+	if (count > 0 && count < samples)
+	    samples = count;
+    }
+    if (samples < 0)
+	samples = 0;
 
-    // Allocate from zone memory.
-    paddedsfx = (unsigned char*)Z_Malloc( paddedsize+8, PU_STATIC, 0 );
-    // ddt: (unsigned char *) realloc(sfx, paddedsize+8);
-    // This should interfere with zone memory handling,
-    //  which does not kick in in the soundserver.
+    *len = samples;
 
-    // Now copy and pad.
-    memcpy(  paddedsfx, sfx, size );
-    for (i=size ; i<paddedsize+8 ; i++)
-        paddedsfx[i] = 128;
+    return (void *) (sfx + 8);
+}
 
-    // Remove the cached lump.
-    Z_Free( sfx );
-    
-    // Preserve padded length.
-    *len = paddedsize;
 
-    // Return allocated padded data.
-    return (void *) (paddedsfx + 8);
+//
+// UPSAMPLED EFFECTS
+// With the device above 11025 Hz, each effect is converted to its
+//  rate once as it loads, so the mixer adds the samples as they are
+//  instead of stepping and interpolating the 8 bit originals per
+//  frame.  An 8 tap windowed sinc, in 256 phases, filters out the
+//  images a linear blend leaves.  The result lives outside the zone.
+//  UBO_DOOM_SFX_UPSAMPLE=0 keeps mixing the originals.
+//
+#define SFXTAPS		8
+#define SFXPHASES	256
+
+static void I_FreeUpsampledSfx (void)
+{
+    int		i;
+
+    for (i = 0; i < NUM_CHANNELS; i++)
+	if (channelwide[i])
+	    channels[i] = 0;
+    for (i = 1; i < NUMSFX; i++)
+	if (!S_sfx[i].link)
+	    free (sfxwide[i]);
+    memset (sfxwide, 0, sizeof(sfxwide));
+    memset (sfxwidelen, 0, sizeof(sfxwidelen));
+}
+
+
+static int		sfxupsample;
+static float		sfxkernel[SFXPHASES][SFXTAPS];
+
+
+//
+// I_InitUpsampler
+// Decides whether effects get upsampled and builds the filter.
+//
+static void I_InitUpsampler (void)
+{
+    int			p, k;
+    float		t, v, sum;
+    char*		env;
+
+    env = getenv ("UBO_DOOM_SFX_UPSAMPLE");
+    sfxupsample = audiorate != SAMPLERATE && !(env && env[0] == '0');
+    if (!sfxupsample)
+	return;
+
+    for (p = 0; p < SFXPHASES; p++)
+    {
+	sum = 0;
+	for (k = 0; k < SFXTAPS; k++)
+	{
+	    t = k - (SFXTAPS/2-1) - (float)p/SFXPHASES;
+	    v = t == 0 ? 1 : sinf (M_PI*t) / (M_PI*t);
+	    v *= 0.5f + 0.5f * cosf (M_PI*t / (SFXTAPS/2));
+	    sfxkernel[p][k] = v;
+	    sum += v;
+	}
+	for (k = 0; k < SFXTAPS; k++)
+	    sfxkernel[p][k] /= sum;
+    }
+}
+
+
+//
+// I_UpsampleSfx
+// Converts one loaded effect (not an alias) to audiorate.
+//
+static void I_UpsampleSfx (int id)
+{
+    unsigned char*	src = S_sfx[id].data;
+    short*		dst;
+    unsigned long long	pos;
+    unsigned int	step;
+    int			len = lengths[id];
+    int			out;
+    int			j, k, p;
+    int			idx;
+    float		sum, v;
+
+    out = (int)((long long)len * audiorate / SAMPLERATE);
+    dst = malloc (out * sizeof(*dst));
+    if (!dst)
+	return;
+
+    step = (unsigned)(((unsigned long long)SAMPLERATE << 16) / audiorate);
+    for (j = 0, pos = 0; j < out; j++, pos += step)
+    {
+	p = (pos >> 8) & (SFXPHASES-1);
+	sum = 0;
+	for (k = 0; k < SFXTAPS; k++)
+	{
+	    idx = (int)(pos >> 16) + k - (SFXTAPS/2-1);
+	    if (idx >= 0 && idx < len)
+		sum += (src[idx] - 128) * sfxkernel[p][k];
+	}
+	v = sum * 256;
+	dst[j] = v > 32767 ? 32767 : v < -32768 ? -32768 : (short)lrintf (v);
+    }
+    sfxwide[id] = dst;
+    sfxwidelen[id] = out;
+}
+
+
+//
+// I_CacheSfx
+// Loads an effect on its first use; an alias loads what it points
+//  at and shares it.  With the WAD mapped this is a copy of pages
+//  the level prefetch has usually brought in already.
+//
+static void I_CacheSfx (int id)
+{
+    int		link;
+
+    if (S_sfx[id].link)
+    {
+	link = S_sfx[id].link - S_sfx;
+	if (!S_sfx[link].data)
+	    I_CacheSfx (link);
+	S_sfx[id].data = S_sfx[link].data;
+	lengths[id] = lengths[link];
+	sfxwide[id] = sfxwide[link];
+	sfxwidelen[id] = sfxwidelen[link];
+	return;
+    }
+
+    S_sfx[id].data = getsfx (S_sfx[id].name, &lengths[id]);
+    if (sfxupsample)
+	I_UpsampleSfx (id);
 }
 
 
 
 
 
+
+
+//
+// I_SetChannelParams
+// Points a channel at the volume lookups and scales for volume
+//  and stereo separation, for a new sound or a params update.
+//  Does nothing when neither changed.
+//
+static int	channelvolume[NUM_CHANNELS];
+static int	channelsep[NUM_CHANNELS];
+
+static void
+I_SetChannelParams
+( int		slot,
+  int		volume,
+  int		seperation )
+{
+    int		rightvol;
+    int		leftvol;
+
+    if (channelleftvol_lookup[slot]
+	&& channelvolume[slot] == volume
+	&& channelsep[slot] == seperation)
+	return;
+    channelvolume[slot] = volume;
+    channelsep[slot] = seperation;
+
+    // Separation, that is, orientation/stereo.
+    //  range is: 1 - 256
+    seperation += 1;
+
+    // Per left/right channel.
+    //  x^2 seperation,
+    //  adjust volume properly.
+    leftvol =
+	volume - ((volume*seperation*seperation) >> 16); ///(256*256);
+    seperation = seperation - 257;
+    rightvol =
+	volume - ((volume*seperation*seperation) >> 16);	
+
+    // Sanity check, clamp volume.
+    if (rightvol < 0 || rightvol > 127)
+	I_Error("rightvol out of bounds");
+    
+    if (leftvol < 0 || leftvol > 127)
+	I_Error("leftvol out of bounds");
+    
+    // Get the proper lookup table piece
+    //  for this volume level???
+    channelleftvol_lookup[slot] = &vol_lookup[leftvol*256];
+    channelrightvol_lookup[slot] = &vol_lookup[rightvol*256];
+    channelleftscale[slot] = leftvol*65536/127;
+    channelrightscale[slot] = rightvol*65536/127;
+}
+
+
 //
 // This function adds a sound to the
 //  list of currently active sounds,
@@ -333,9 +680,6 @@ addsfx
     int		oldestnum = 0;
     int		slot;
 
-    int		rightvol;
-    int		leftvol;
-
     // Chainsaw troubles.
     // Play these sound effects only one at a time.
     if ( sfxid == sfx_sawup
@@ -346,7 +690,7 @@ addsfx
 	 || sfxid == sfx_pistol	 )
     {
 	// Loop all channels, check.
-	for (i=0 ; i<NUM_CHANNELS ; i++)
+	for (i=0 ; i<mixchannels ; i++)
 	{
 	    // Active, and using the same SFX?
 	    if ( (channels[i])
@@ -362,7 +706,7 @@ addsfx
     }
 
     // Loop all channels to find oldest SFX.
-    for (i=0; (i<NUM_CHANNELS) && (channels[i]); i++)
+    for (i=0; (i<mixchannels) && (channels[i]); i++)
     {
 	if (channelstart[i] < oldest)
 	{
@@ -375,7 +719,7 @@ addsfx
     // If we found a channel, fine.
     // If not, we simply overwrite the first one, 0.
     // Probably only happens at startup.
-    if (i == NUM_CHANNELS)
+    if (i == mixchannels)
 	slot = oldestnum;
     else
 	slot = i;
@@ -383,9 +727,22 @@ addsfx
     // Okay, in the less recent channel,
     //  we will handle the new SFX.
     // Set pointer to raw data.
-    channels[slot] = (unsigned char *) S_sfx[sfxid].data;
-    // Set pointer to end of raw data.
-    channelsend[slot] = channels[slot] + lengths[sfxid];
+    if (sfxwide[sfxid])
+    {
+	channels[slot] = (unsigned char *) sfxwide[sfxid];
+	channelsend[slot] = (unsigned char *) (sfxwide[sfxid] + sfxwidelen[sfxid]);
+	channelwide[slot] = 1;
+    }
+    else
+    {
+	channels[slot] = (unsigned char *) S_sfx[sfxid].data;
+	// Set pointer to end of raw data.
+	channelsend[slot] = channels[slot] + lengths[sfxid];
+	channelwide[slot] = 0;
+    }
+    // The mixer reads a sample before checking the end.
+    if (channelsend[slot] <= channels[slot])
+	channels[slot] = 0;
 
     // Reset current handle number, limited to 0..100.
     if (!handlenums)
@@ -397,36 +754,16 @@ addsfx
 
     // Set stepping???
     // Kinda getting the impression this is never used.
-    channelstep[slot] = step;
+    if (channelwide[slot])
+	channelstep[slot] = step;
+    else
+	channelstep[slot] = (unsigned)((unsigned long long)step * SAMPLERATE / audiorate);
     // ???
     channelstepremainder[slot] = 0;
     // Should be gametic, I presume.
     channelstart[slot] = gametic;
 
-    // Separation, that is, orientation/stereo.
-    //  range is: 1 - 256
-    seperation += 1;
-
-    // Per left/right channel.
-    //  x^2 seperation,
-    //  adjust volume properly.
-    leftvol =
-	volume - ((volume*seperation*seperation) >> 16); ///(256*256);
-    seperation = seperation - 257;
-    rightvol =
-	volume - ((volume*seperation*seperation) >> 16);	
-
-    // Sanity check, clamp volume.
-    if (rightvol < 0 || rightvol > 127)
-	I_Error("rightvol out of bounds");
-    
-    if (leftvol < 0 || leftvol > 127)
-	I_Error("leftvol out of bounds");
-    
-    // Get the proper lookup table piece
-    //  for this volume level???
-    channelleftvol_lookup[slot] = &vol_lookup[leftvol*256];
-    channelrightvol_lookup[slot] = &vol_lookup[rightvol*256];
+    I_SetChannelParams(slot, volume, seperation);
 
     // Preserve sound SFX id,
     //  e.g. for avoiding duplicates of chainsaw.
@@ -490,14 +827,6 @@ void I_SetSfxVolume(int volume)
   snd_SfxVolume = volume;
 }
 
-// MUSIC API - dummy. Some code from DOS version.
-void I_SetMusicVolume(int volume)
-{
-  // Internal state variable.
-  snd_MusicVolume = volume;
-  // Now set volume on output device.
-  // Whatever( snd_MusciVolume );
-}
 
 
 //
@@ -535,8 +864,12 @@ I_StartSound
   // UNUSED
   priority = 0;
 
-  // ALSA backend: always enqueue into the internal mixer channels.
-  // Do not use the legacy sndserver text protocol path.
+  // ALSA backend: the internal mixer channels, or sndserver's
+  //  through shared memory.  The popen text protocol is not used.
+  if (I_SndServActive())
+    return I_SndServPlay(id, vol, sep, pitch);
+  if (!S_sfx[id].data)
+    I_CacheSfx(id);
   id = addsfx( id, vol, steptable[pitch], sep );
 
   return id;
@@ -550,7 +883,12 @@ void I_StopSound (int handle)
   // Would be looping all channels,
   //  tracking down the handle,
   //  an setting the channel to zero.
-  
+  if (I_SndServActive())
+  {
+    I_SndServStopSound(handle);
+    return;
+  }
+
   // UNUSED.
   handle = 0;
 }
@@ -558,6 +896,8 @@ void I_StopSound (int handle)
 
 int I_SoundIsPlaying(int handle)
 {
+    if (I_SndServActive())
+	return I_SndServIsPlaying(handle);
     // Ouch.
     return gametic < handle;
 }
@@ -570,111 +910,535 @@ int I_SoundIsPlaying(int handle)
 //  channels, retrieves a given number of samples
 //  from the raw sound data, modifies it according
 //  to the current (internal) channel parameters,
-//  mixes the per channel samples into the global
-//  mixbuffer, clamping it to the allowed range,
-//  and sets up everything for transferring the
-//  contents of the mixbuffer to the (two)
+//  mixes count stereo frames of the per channel
+//  samples into out, clamping them to the allowed
+//  range, ready for transferring to the (two)
 //  hardware channels (left and right, that is).
 //
 // This function currently supports only 16bit.
 //
-void I_UpdateSound( void )
+//
+// I_MixChannel
+// Adds count frames of one channel into acc, left and right
+//  interleaved, and frees the channel when its sound runs out.
+//
+static void I_MixChannel (int chan, int* acc, int count)
 {
-#ifdef SNDINTR
-  // Debug. Count buffer misses with interrupt.
-  static int misses = 0;
+    unsigned char*	src = channels[chan];
+    unsigned char*	end = channelsend[chan];
+    const int*		lvol = channelleftvol_lookup[chan];
+    const int*		rvol = channelrightvol_lookup[chan];
+    unsigned int	step = channelstep[chan];
+    unsigned int	frac = channelstepremainder[chan];
+    unsigned int	sample;
+    unsigned int	next;
+    int			f;
+
+    if (audiorate == SAMPLERATE)
+    {
+	while (count--)
+	{
+	    sample = *src;
+	    acc[0] += lvol[sample];
+	    acc[1] += rvol[sample];
+	    acc += 2;
+	    frac += step;
+	    src += frac >> 16;
+	    frac &= 65536-1;
+	    if (src >= end)
+	    {
+		src = 0;
+		break;
+	    }
+	}
+    }
+    else
+    {
+	// Past the effects' own rate, blend each sample into the next.
+	while (count--)
+	{
+	    sample = *src;
+	    next = src+1 < end ? src[1] : 128;
+	    // 15 bits of the position keep the product in range
+	    f = frac >> 1;
+	    acc[0] += lvol[sample] + (((lvol[next] - lvol[sample]) * f) >> 15);
+	    acc[1] += rvol[sample] + (((rvol[next] - rvol[sample]) * f) >> 15);
+	    acc += 2;
+	    frac += step;
+	    src += frac >> 16;
+	    frac &= 65536-1;
+	    if (src >= end)
+	    {
+		src = 0;
+		break;
+	    }
+	}
+    }
+
+    channels[chan] = src;
+    channelstepremainder[chan] = frac;
+}
+
+
+//
+// I_MixChannelWide
+// I_MixChannel for an upsampled effect.  At its own pitch this is
+//  a straight multiply-add of the samples.
+//
+static void I_MixChannelWide (int chan, int* acc, int count)
+{
+    const short*	src = (const short*) channels[chan];
+    const short*	end = (const short*) channelsend[chan];
+    int			lv = channelleftscale[chan];
+    int			rv = channelrightscale[chan];
+    unsigned int	step = channelstep[chan];
+    unsigned int	frac = channelstepremainder[chan];
+    int			n;
+    int			i;
+
+    if (step == 65536)
+    {
+	n = end - src;
+	if (n > count)
+	    n = count;
+	for (i = 0; i < n; i++)
+	{
+	    acc[i*2] += (src[i] * lv) >> 16;
+	    acc[i*2+1] += (src[i] * rv) >> 16;
+	}
+	src += n;
+    }
+    else
+    {
+	while (count-- && src < end)
+	{
+	    acc[0] += (*src * lv) >> 16;
+	    acc[1] += (*src * rv) >> 16;
+	    acc += 2;
+	    frac += step;
+	    src += frac >> 16;
+	    frac &= 65536-1;
+	}
+    }
+
+    channels[chan] = src < end ? (unsigned char*) src : 0;
+    channelstepremainder[chan] = frac;
+}
+
+
+//
+// I_PackMix
+// Clamps n accumulated values to 16 bits.
+//
+static void I_PackMix_C (signed short* out, const int* acc, int n)
+{
+    int		i;
+    int		v;
+
+    for (i = 0; i < n; i++)
+    {
+	v = acc[i];
+	if (v > 0x7fff)
+	    v = 0x7fff;
+	else if (v < -0x8000)
+	    v = -0x8000;
+	out[i] = v;
+    }
+}
+
+#if defined(__ARM_NEON)
+#define MIX_SIMD_NAME	"neon"
+
+static void I_PackMix_SIMD (signed short* out, const int* acc, int n)
+{
+    int		i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+	vst1q_s16 (out + i, vcombine_s16 (vqmovn_s32 (vld1q_s32 (acc + i)),
+					  vqmovn_s32 (vld1q_s32 (acc + i + 4))));
+    I_PackMix_C (out + i, acc + i, n - i);
+}
+
+#elif defined(__SSE2__)
+#define MIX_SIMD_NAME	"sse2"
+
+static void I_PackMix_SIMD (signed short* out, const int* acc, int n)
+{
+    int		i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+	_mm_storeu_si128 ((__m128i*)(out + i),
+			  _mm_packs_epi32 (_mm_loadu_si128 ((const __m128i*)(acc + i)),
+					   _mm_loadu_si128 ((const __m128i*)(acc + i + 4))));
+    I_PackMix_C (out + i, acc + i, n - i);
+}
 #endif
 
-  
-  // Mix current sound data.
-  // Data, from raw sound, for right and left.
-  register unsigned int	sample;
-  register int		dl;
-  register int		dr;
-  
-  // Pointers in global mixbuffer, left, right, end.
-  signed short*		leftout;
-  signed short*		rightout;
-  signed short*		leftend;
-  // Step in mixbuffer, left and right, thus two.
-  int				step;
-
-  // Mixing channel index.
-  int				chan;
-    
-    // Left and right channel
-    //  are in global mixbuffer, alternating.
-    leftout = mixbuffer;
-    rightout = mixbuffer+1;
-    step = 2;
-
-    // Determine end, for left channel only
-    //  (right channel is implicit).
-    leftend = mixbuffer + SAMPLECOUNT*step;
-
-    // Mix sounds into the mixing buffer.
-    // Loop over step*SAMPLECOUNT,
-    //  that is 512 values for two channels.
-    while (leftout != leftend)
+static void	(*I_PackMix) (signed short* out, const int* acc, int n) = I_PackMix_C;
+
+
+//
+// I_MixSound
+// Mixes count stereo frames into out, a block at a time: every
+//  playing channel is summed into mixacc and the block is then
+//  saturated to 16 bits, so a silent channel costs one test a block.
+//
+static void I_MixSound (signed short* out, int count)
+{
+    int		chan;
+    int		n;
+
+    while (count > 0)
+    {
+	n = count < MIXBLOCK ? count : MIXBLOCK;
+	memset (mixacc, 0, n*2*sizeof(*mixacc));
+
+	for (chan = 0; chan < mixchannels; chan++)
+	{
+	    if (!channels[chan])
+		continue;
+	    if (channelwide[chan])
+		I_MixChannelWide (chan, mixacc, n);
+	    else
+		I_MixChannel (chan, mixacc, n);
+	}
+
+	I_PackMix (out, mixacc, n*2);
+	out += n*2;
+	count -= n;
+    }
+}
+
+
+//
+// AUDIO THREAD
+// The tick thread only mixes: I_UpdateSound writes as many frames as
+//  the wall clock has advanced since the last call into a ring, and
+//  I_SubmitSound publishes them.  A thread of its own moves the ring
+//  to ALSA, so a full device buffer blocks it rather than the tic,
+//  and an underrun is recovered there.  Frames queued in the ring and
+//  the device are kept between audiolead, the longest recent gap
+//  between tics plus two device periods, and twice that.  This soaks up
+//  tick jitter and the device clock drifting from ours at the least
+//  latency the tic rate allows.
+// UBO_DOOM_AUDIO_THREAD=0 keeps the blocking writes on the tick thread.
+//
+static signed short	audioring[AUDIORING*2];
+static int		audiolead;
+static int		audiogap;	// longest recent gap between tics, frames
+static unsigned		audiohead;	// next frame to mix, tick thread
+static unsigned		audiomixed;	// audiohead as last published
+static unsigned		audiotail;	// next frame to write, audio thread
+static unsigned long long audiodry;	// clock frame the device runs dry
+
+static int		audiothread;
+static int		audioquit;
+static int		audiowaiting;
+static pthread_t	audiopthread;
+static pthread_mutex_t	audiolock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	audiowake = PTHREAD_COND_INITIALIZER;
+
+static struct timespec	audiot0;
+static unsigned long long audiodue;	// frames the clock asked for so far
+
+
+//
+// TELEMETRY
+// Read by doom_get_audio_stats from any thread.  The writer of the
+//  PCM (audio thread or tick thread) counts writes and failures and
+//  samples the device delay after each write; the tick thread times
+//  the mixing and samples the ring.
+//
+static ubo_audio_stats_t audiostats;
+static unsigned		mixavg16;	// mixing time EMA, us * 16
+
+static void I_StatMax (int* max, int value)
+{
+    if (value > __atomic_load_n (max, __ATOMIC_RELAXED))
+	__atomic_store_n (max, value, __ATOMIC_RELAXED);
+}
+
+//
+// I_AudioWrote
+// Books the result of a snd_pcm_writei, before any recovery.
+//
+static void I_AudioWrote (snd_pcm_sframes_t frames)
+{
+    if (frames == -EPIPE)
+	__atomic_add_fetch (&audiostats.underruns, 1, __ATOMIC_RELAXED);
+    else if (frames < 0)
+	__atomic_add_fetch (&audiostats.errors, 1, __ATOMIC_RELAXED);
+    else
+    {
+	__atomic_add_fetch (&audiostats.writes, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&audiostats.frames_written, (uint64_t)frames,
+			    __ATOMIC_RELAXED);
+    }
+}
+
+static void I_AudioDelay (snd_pcm_sframes_t delay)
+{
+    __atomic_store_n (&audiostats.delay_frames, (int)delay, __ATOMIC_RELAXED);
+    I_StatMax (&audiostats.delay_max, (int)delay);
+}
+
+static void I_MixTime (const struct timespec* t0)
+{
+    struct timespec	t1;
+    unsigned		us;
+
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    us = (unsigned)((t1.tv_sec - t0->tv_sec) * 1000000
+		    + (t1.tv_nsec - t0->tv_nsec) / 1000);
+    mixavg16 += us - (mixavg16 >> 4);
+    __atomic_store_n (&audiostats.mix_us, us, __ATOMIC_RELAXED);
+    __atomic_store_n (&audiostats.mix_avg_us, mixavg16 >> 4, __ATOMIC_RELAXED);
+    if (us > __atomic_load_n (&audiostats.mix_max_us, __ATOMIC_RELAXED))
+	__atomic_store_n (&audiostats.mix_max_us, us, __ATOMIC_RELAXED);
+}
+
+void ubo_audio_stats (ubo_audio_stats_t* out)
+{
+    out->active = audio_pcm != NULL || I_SndServActive ();
+    out->threaded = audiothread;
+    out->rate = audiorate;
+    out->period_frames = audioperiod;
+    out->buffer_frames = audiobuffer;
+    // with sndserver, its own count (not cleared by a reset)
+    out->underruns = __atomic_load_n (&audiostats.underruns, __ATOMIC_RELAXED)
+		     + I_SndServUnderruns ();
+    out->errors = __atomic_load_n (&audiostats.errors, __ATOMIC_RELAXED);
+    out->overruns = __atomic_load_n (&audiostats.overruns, __ATOMIC_RELAXED);
+    out->writes = __atomic_load_n (&audiostats.writes, __ATOMIC_RELAXED);
+    out->frames_written = __atomic_load_n (&audiostats.frames_written,
+					   __ATOMIC_RELAXED);
+    out->delay_frames = __atomic_load_n (&audiostats.delay_frames, __ATOMIC_RELAXED);
+    out->delay_max = __atomic_load_n (&audiostats.delay_max, __ATOMIC_RELAXED);
+    out->ring_frames = __atomic_load_n (&audiostats.ring_frames, __ATOMIC_RELAXED);
+    out->ring_max = __atomic_load_n (&audiostats.ring_max, __ATOMIC_RELAXED);
+    out->lead_frames = __atomic_load_n (&audiostats.lead_frames, __ATOMIC_RELAXED);
+    out->mix_us = __atomic_load_n (&audiostats.mix_us, __ATOMIC_RELAXED);
+    out->mix_avg_us = __atomic_load_n (&audiostats.mix_avg_us, __ATOMIC_RELAXED);
+    out->mix_max_us = __atomic_load_n (&audiostats.mix_max_us, __ATOMIC_RELAXED);
+}
+
+// Counters and maxima only; the current levels carry on.
+void ubo_audio_stats_reset (void)
+{
+    __atomic_store_n (&audiostats.underruns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&audiostats.errors, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&audiostats.overruns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&audiostats.writes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&audiostats.frames_written, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&audiostats.delay_max, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&audiostats.ring_max, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&audiostats.mix_max_us, 0, __ATOMIC_RELAXED);
+}
+
+
+//
+// I_AudioClock
+// Frames at the device rate since the audio thread started.
+//
+static unsigned long long I_AudioClock (void)
+{
+    struct timespec	now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((unsigned long long)(now.tv_sec - audiot0.tv_sec) * 1000000000ull
+	    + now.tv_nsec - audiot0.tv_nsec) * audiorate / 1000000000ull;
+}
+
+
+static void* I_AudioThread (void* arg)
+{
+    unsigned		tail;
+    unsigned		musictail;	// frames from tail up to here have music
+    unsigned		avail;
+    unsigned		count;
+    snd_pcm_sframes_t	frames;
+    snd_pcm_sframes_t	delay;
+
+    (void)arg;
+    tail = audiotail;
+    musictail = tail;
+    while (!__atomic_load_n (&audioquit, __ATOMIC_ACQUIRE))
     {
-	// Reset left/right value. 
-	dl = 0;
-	dr = 0;
-
-	// Love thy L2 chache - made this a loop.
-	// Now more channels could be set at compile time
-	//  as well. Thus loop those  channels.
-	for ( chan = 0; chan < NUM_CHANNELS; chan++ )
+	I_ThreadPoll (UBO_THREAD_AUDIO);
+	avail = __atomic_load_n (&audiomixed, __ATOMIC_ACQUIRE) - tail;
+	if (!avail)
 	{
-	    // Check channel, if active.
-	    if (channels[ chan ])
+	    struct timespec	until;
+
+	    clock_gettime (CLOCK_REALTIME, &until);
+	    until.tv_nsec += 50*1000*1000;
+	    if (until.tv_nsec >= 1000*1000*1000)
 	    {
-		// Get the raw data from the channel. 
-		sample = *channels[ chan ];
-		// Add left and right part
-		//  for this channel (sound)
-		//  to the current data.
-		// Adjust volume accordingly.
-		dl += channelleftvol_lookup[ chan ][sample];
-		dr += channelrightvol_lookup[ chan ][sample];
-		// Increment index ???
-		channelstepremainder[ chan ] += channelstep[ chan ];
-		// MSB is next sample???
-		channels[ chan ] += channelstepremainder[ chan ] >> 16;
-		// Limit to LSB???
-		channelstepremainder[ chan ] &= 65536-1;
-
-		// Check whether we are done.
-		if (channels[ chan ] >= channelsend[ chan ])
-		    channels[ chan ] = 0;
+		until.tv_sec++;
+		until.tv_nsec -= 1000*1000*1000;
 	    }
+	    pthread_mutex_lock (&audiolock);
+	    __atomic_store_n (&audiowaiting, 1, __ATOMIC_SEQ_CST);
+	    if (__atomic_load_n (&audiomixed, __ATOMIC_SEQ_CST) == tail
+		&& !__atomic_load_n (&audioquit, __ATOMIC_SEQ_CST))
+		pthread_cond_timedwait (&audiowake, &audiolock, &until);
+	    __atomic_store_n (&audiowaiting, 0, __ATOMIC_RELAXED);
+	    pthread_mutex_unlock (&audiolock);
+	    continue;
+	}
+
+	// no further than the end of the ring or one period
+	count = AUDIORING - (tail & (AUDIORING-1));
+	if (count > avail)
+	    count = avail;
+	if (count > audioperiod)
+	    count = audioperiod;
+
+	// music goes in at the last moment, once even if the write is short
+	if ((int)(musictail - tail) < 0)
+	    musictail = tail;
+	if ((int)(musictail - tail) < (int)count)
+	{
+	    I_MusicRender (audioring + (musictail & (AUDIORING-1))*2,
+			   count - (int)(musictail - tail));
+	    musictail = tail + count;
 	}
-	
-	// Clamp to range. Left hardware channel.
-	// Has been char instead of short.
-	// if (dl > 127) *leftout = 127;
-	// else if (dl < -128) *leftout = -128;
-	// else *leftout = dl;
-
-	if (dl > 0x7fff)
-	    *leftout = 0x7fff;
-	else if (dl < -0x8000)
-	    *leftout = -0x8000;
-	else
-	    *leftout = dl;
-
-	// Same for right hardware channel.
-	if (dr > 0x7fff)
-	    *rightout = 0x7fff;
-	else if (dr < -0x8000)
-	    *rightout = -0x8000;
-	else
-	    *rightout = dr;
-
-	// Increment current pointers in mixbuffer.
-	leftout += step;
-	rightout += step;
+
+	UBO_TRACE_BEGIN ("pcm_write");
+	frames = snd_pcm_writei (audio_pcm,
+				 audioring + (tail & (AUDIORING-1))*2, count);
+	UBO_TRACE_END ();
+	I_AudioWrote (frames);
+	if (frames < 0)
+	    frames = snd_pcm_recover (audio_pcm, (int)frames, 1);
+	if (frames > 0)
+	{
+	    tail += frames;
+	    __atomic_store_n (&audiotail, tail, __ATOMIC_RELEASE);
+	}
+	else if (frames < 0)
+	{
+	    // the device is gone; drop what was mixed
+	    tail = __atomic_load_n (&audiomixed, __ATOMIC_ACQUIRE);
+	    __atomic_store_n (&audiotail, tail, __ATOMIC_RELEASE);
+	}
+
+	if (snd_pcm_delay (audio_pcm, &delay) < 0 || delay < 0)
+	    delay = 0;
+	I_AudioDelay (delay);
+	// kept as a time, since the writer may then sleep a while
+	__atomic_store_n (&audiodry, I_AudioClock () + delay, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+
+//
+// I_MixAhead
+// Mixes the frames the clock has asked for since the last call, or
+//  more or fewer to keep the queue between audiolead and twice that.
+//
+static void I_MixAhead (void)
+{
+    unsigned long long	due;
+    unsigned long long	dry;
+    int			queued;
+    int			count;
+    int			room;
+    int			part;
+
+    due = I_AudioClock ();
+    count = (int)(due - audiodue);
+    audiodue = due;
+
+    // a stall (level load, paused service) is not a tic gap
+    audiogap -= audiogap >> 6;
+    if (count > audiogap && count < audiorate/4)
+	audiogap = count;
+    audiolead = audiogap + 2*audioperiod;
+    if (audiolead > AUDIORING/4)
+	audiolead = AUDIORING/4;
+
+    queued = (int)(audiohead - __atomic_load_n (&audiotail, __ATOMIC_ACQUIRE));
+    dry = __atomic_load_n (&audiodry, __ATOMIC_RELAXED);
+    if (dry > due)
+	queued += (int)(dry - due);
+    if (queued + count < audiolead)
+	count = audiolead - queued;
+    if (queued + count > 2*audiolead)
+	count = 2*audiolead - queued;
+    room = AUDIORING - (int)(audiohead - __atomic_load_n (&audiotail, __ATOMIC_ACQUIRE));
+    if (count > room)
+    {
+	count = room;
+	__atomic_add_fetch (&audiostats.overruns, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n (&audiostats.lead_frames, audiolead, __ATOMIC_RELAXED);
+
+    while (count > 0)
+    {
+	part = AUDIORING - (audiohead & (AUDIORING-1));
+	if (part > count)
+	    part = count;
+	I_MixSound (audioring + (audiohead & (AUDIORING-1))*2, part);
+	audiohead += part;
+	count -= part;
     }
+}
+
+
+static void I_StartAudioThread (void)
+{
+    audiohead = audiomixed = audiotail = 0;
+    audiodry = 0;
+    audiodue = 0;
+    clock_gettime (CLOCK_MONOTONIC, &audiot0);
+    audiogap = audiorate/TICRATE;	// until the tics say otherwise
+    audioquit = 0;
+    if (pthread_create (&audiopthread, NULL, I_AudioThread, NULL))
+    {
+	UBO_LOG (UBO_LOG_ERROR, "[doom] I_InitSound: no audio thread, "
+		 "writing on the tick thread\n");
+	return;
+    }
+    audiothread = 1;
+}
+
+
+static void I_StopAudioThread (void)
+{
+    if (!audiothread)
+	return;
+
+    pthread_mutex_lock (&audiolock);
+    __atomic_store_n (&audioquit, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_signal (&audiowake);
+    pthread_mutex_unlock (&audiolock);
+    pthread_join (audiopthread, NULL);
+    audiothread = 0;
+}
+
+
+void I_UpdateSound( void )
+{
+#ifdef SNDINTR
+  // Debug. Count buffer misses with interrupt.
+  static int misses = 0;
+#endif
+    struct timespec	t0;
+
+    if (I_SndServActive ())
+	return;
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    if (audiothread)
+    {
+	I_MixAhead ();
+	I_MixTime (&t0);
+	return;
+    }
+    
+    I_MixSound (mixbuffer, SAMPLECOUNT);
+    I_MixTime (&t0);
 
 #ifdef SNDINTR
     // Debug check.
@@ -707,15 +1471,50 @@ void I_UpdateSound( void )
 void
 I_SubmitSound(void)
 {
+  if (I_SndServActive())
+  {
+    I_SndServPoll();
+    return;
+  }
   if (!audio_pcm) return;
 
+  if (audiothread)
+  {
+    int queued;
+
+    // hand the frames I_UpdateSound mixed to the audio thread
+    __atomic_store_n(&audiomixed, audiohead, __ATOMIC_SEQ_CST);
+    queued = (int)(audiohead - __atomic_load_n(&audiotail, __ATOMIC_ACQUIRE));
+    __atomic_store_n(&audiostats.ring_frames, queued, __ATOMIC_RELAXED);
+    I_StatMax(&audiostats.ring_max, queued);
+    if (__atomic_load_n(&audiowaiting, __ATOMIC_SEQ_CST))
+    {
+      pthread_mutex_lock(&audiolock);
+      pthread_cond_signal(&audiowake);
+      pthread_mutex_unlock(&audiolock);
+    }
+    return;
+  }
+
+  I_MusicRender(mixbuffer, SAMPLECOUNT);
+
   // SAMPLECOUNT is "frames" (each frame = stereo sample = 4 bytes)
-  snd_pcm_sframes_t frames = snd_pcm_writei(audio_pcm, mixbuffer, SAMPLECOUNT);
+  snd_pcm_sframes_t frames;
+  snd_pcm_sframes_t delay;
+
+  UBO_TRACE_BEGIN("pcm_write");
+  frames = snd_pcm_writei(audio_pcm, mixbuffer, SAMPLECOUNT);
+  UBO_TRACE_END();
+
+  I_AudioWrote(frames);
   if (frames < 0)
   {
     // Try to recover from underruns, etc.
     frames = snd_pcm_recover(audio_pcm, (int)frames, 1);
   }
+  if (snd_pcm_delay(audio_pcm, &delay) < 0 || delay < 0)
+    delay = 0;
+  I_AudioDelay(delay);
 }
 
 
@@ -732,9 +1531,23 @@ I_UpdateSoundParams
   // Would be using the handle to identify
   //  on which channel the sound might be active,
   //  and resetting the channel parameters.
+  int i;
 
-  // UNUSED.
-  handle = vol = sep = pitch = 0;
+  if (I_SndServActive())
+  {
+    I_SndServUpdate(handle, vol, sep, pitch);
+    return;
+  }
+
+  // Pitch stays as started.
+  for (i=0 ; i<mixchannels ; i++)
+  {
+    if (channels[i] && channelhandles[i] == handle)
+    {
+      I_SetChannelParams(i, vol, sep);
+      return;
+    }
+  }
 }
 
 
@@ -743,12 +1556,15 @@ I_UpdateSoundParams
 void
 I_ShutdownSound(void)
 {
+  I_SndServStop();
   if (audio_pcm)
   {
+    I_StopAudioThread();
     snd_pcm_drain(audio_pcm);
     snd_pcm_close(audio_pcm);
     audio_pcm = NULL;
   }
+  I_FreeUpsampledSfx();
 }
 
 
@@ -757,133 +1573,152 @@ I_ShutdownSound(void)
 
 
 
-void
-I_InitSound()
+//
+// I_OpenAudio
+// Opens and sets up the PCM, and matches the music synth and the
+//  effect upsampler to the rate it got.  Returns whether the audio
+//  thread should write to it, or -1 without a device.
+//
+static int I_OpenAudio (void)
 {
-  /* We always use in-process ALSA output regardless of the SNDSERV flag.
-   * doomdef.h defines SNDSERV=1 (for the external sndserver approach), but
-   * this file is the ALSA replacement.  The sndserver globals (sndserver,
-   * sndserver_filename) are still defined above (inside #ifdef SNDSERV) to
-   * satisfy references from m_misc.c; we just skip launching the process. */
-  int i;
-  int err;
-  if (audio_pcm) return;
+  char*	env;
+  int	threaded;
 
-  /* Pre-cache all sound effects from the WAD into S_sfx[i].data.
-   * Without this, S_StartSoundAtVolume finds sfx->data == NULL and
-   * prints "16bit and not pre-cached" for every sound. */
-  fprintf(stderr, "I_InitSound: pre-caching sound data...\n");
-  for (i = 1; i < NUMSFX; i++)
+  if (I_OpenPreferredAlsaPcm(&audio_pcm) < 0)
   {
-    if (!S_sfx[i].link)
-    {
-      S_sfx[i].data = getsfx(S_sfx[i].name, &lengths[i]);
-    }
-    else
-    {
-      /* Alias — e.g. chaingun reuses pistol sample. */
-      S_sfx[i].data  = S_sfx[i].link->data;
-      lengths[i]     = lengths[S_sfx[i].link - S_sfx];
-    }
+    UBO_LOG(UBO_LOG_ERROR, "ALSA: failed to open any playback PCM device\n");
+    audio_pcm = NULL;
+    return -1;
   }
-  fprintf(stderr, "I_InitSound: pre-cached all sound data\n");
 
-  /* Zero the mix buffer. */
-  for (i = 0; i < MIXBUFFERSIZE; i++)
-    mixbuffer[i] = 0;
+  env = getenv("UBO_DOOM_AUDIO_THREAD");
+  threaded = !(env && env[0] == '0');
 
-  if (I_OpenPreferredAlsaPcm(&audio_pcm) < 0)
+  I_SetAlsaParams(audio_pcm, threaded);
+  I_MusicSetRate(audiorate);
+  I_InitUpsampler();
+  return threaded;
+}
+
+
+//
+// I_SuspendSound
+// doom_suspend: drops the loaded effects (what is playing was stopped
+//  by S_StopSounds) and closes the PCM so other programs get the
+//  device.  The sndserver keeps its own.
+//
+void I_SuspendSound (void)
+{
+  int	i;
+
+  if (audio_pcm)
   {
-    fprintf(stderr, "ALSA: failed to open any playback PCM device\n");
+    I_StopAudioThread();
+    snd_pcm_drop(audio_pcm);
+    snd_pcm_close(audio_pcm);
     audio_pcm = NULL;
-    return;
+    audiosuspended = 1;
   }
 
-  err = snd_pcm_set_params(
-      audio_pcm,
-      SND_PCM_FORMAT_S16_LE,
-      SND_PCM_ACCESS_RW_INTERLEAVED,
-      2,          // channels
-      11025,      // rate
-      1,          // soft_resample
-      500000      // latency in us
-  );
-  if (err < 0)
+  I_FreeUpsampledSfx();
+  for (i = 0; i < NUM_CHANNELS; i++)
+    channels[i] = 0;
+  for (i = 1; i < NUMSFX; i++)
   {
-    fprintf(stderr, "ALSA: snd_pcm_set_params failed: %s\n", snd_strerror(err));
-    snd_pcm_close(audio_pcm);
-    audio_pcm = NULL;
-    return;
+    /* A zone copy (no WAD mapping) goes back to the cache. */
+    if (S_sfx[i].data && !S_sfx[i].link && !W_IsMappedPtr(S_sfx[i].data))
+      Z_ChangeTag((byte*)S_sfx[i].data - 8, PU_CACHE);
+    S_sfx[i].data = NULL;
   }
 }
 
 
-
-
-
 //
-// MUSIC API.
-// Still no music done.
-// Remains. Dummies.
+// I_ResumeSound
+// Reopens the PCM I_SuspendSound closed; effects load again as they
+//  are started.
 //
-void I_InitMusic(void)		{ }
-void I_ShutdownMusic(void)	{ }
+void I_ResumeSound (void)
+{
+  int	threaded;
 
-static int	looping=0;
-static int	musicdies=-1;
+  if (!audiosuspended)
+    return;
+  audiosuspended = 0;
 
-void I_PlaySong(int handle, int looping)
-{
-  // UNUSED.
-  handle = looping = 0;
-  musicdies = gametic + TICRATE*30;
+  threaded = I_OpenAudio();
+  if (threaded > 0)
+    I_StartAudioThread();
 }
 
-void I_PauseSong (int handle)
-{
-  // UNUSED.
-  handle = 0;
-}
 
-void I_ResumeSong (int handle)
+void
+I_InitSound()
 {
-  // UNUSED.
-  handle = 0;
-}
+  /* doomdef.h defines SNDSERV=1 for vanilla's popen'd sndserver.  This
+   * file mixes in process unless UBO_DOOM_SNDSERV names a server, which
+   * is then driven through shared memory (i_sndserv_ubo.c).  The
+   * sndserver globals above (inside #ifdef SNDSERV) only satisfy
+   * m_misc.c. */
+  int i;
+  char* env;
+  const char* mixname;
+  int threaded;
+
+  /* Effects are loaded by I_StartSound on first use.  A doom_reset
+   * cleared the zone the last session's copies were in, so forget
+   * them (and anything still playing) before the early return. */
+  I_FreeUpsampledSfx();
+  for (i = 0; i < NUM_CHANNELS; i++)
+    channels[i] = 0;
+  for (i = 1; i < NUMSFX; i++)
+    S_sfx[i].data = NULL;
+  audiosuspended = 0;
+  if (audio_pcm || I_SndServActive()) return;
+  if (I_SndServStart()) return;
 
-void I_StopSong(int handle)
-{
-  // UNUSED.
-  handle = 0;
-  
-  looping = 0;
-  musicdies = 0;
-}
+  /* Zero the mix buffer. */
+  for (i = 0; i < MIXBUFFERSIZE; i++)
+    mixbuffer[i] = 0;
 
-void I_UnRegisterSong(int handle)
-{
-  // UNUSED.
-  handle = 0;
-}
+  mixchannels = I_EnvInt("UBO_DOOM_MIX_CHANNELS", 8, 1, NUM_CHANNELS);
+  mixname = "c";
+  I_PackMix = I_PackMix_C;
+#ifdef MIX_SIMD_NAME
+  if (ubo_video_simd && I_CpuHasSimd())
+  {
+    I_PackMix = I_PackMix_SIMD;
+    mixname = MIX_SIMD_NAME;
+  }
+#endif
+  UBO_LOG(UBO_LOG_INFO, "[doom] I_InitSound: %d mixer channels, %s pack\n",
+	  mixchannels, mixname);
 
-int I_RegisterSong(void* data)
-{
-  // UNUSED.
-  data = NULL;
-  
-  return 1;
-}
+  threaded = I_OpenAudio();
+  if (threaded < 0)
+    return;
 
-// Is the song playing?
-int I_QrySongPlaying(int handle)
-{
-  // UNUSED.
-  handle = 0;
-  return looping || musicdies > gametic;
+  /* UBO_DOOM_SFX_PRECACHE=1 loads every effect now, as vanilla did. */
+  env = getenv("UBO_DOOM_SFX_PRECACHE");
+  if (env && env[0] == '1')
+  {
+    for (i = 1; i < NUMSFX; i++)
+      if (!S_sfx[i].data)
+        I_CacheSfx(i);
+    UBO_LOG(UBO_LOG_INFO, "[doom] I_InitSound: pre-cached all sound data\n");
+  }
+  if (sfxupsample)
+    UBO_LOG(UBO_LOG_INFO, "[doom] I_InitSound: effects upsampled to %d Hz as they load\n",
+	    audiorate);
+
+  if (threaded)
+    I_StartAudioThread();
 }
 
 
 
+
+
 //
 // Experimental stuff.
 // A Linux timer interrupt, for asynchronous
@@ -0,0 +1,48 @@
+#ifndef __I_SPECTATE__
+#define __I_SPECTATE__
+
+#include "d_ticcmd.h"
+#include "doomtype.h"
+#include "spectate.h"
+
+// Spectator mirroring, i_spectate_ubo.c (doom_mirror_start,
+// doom_spectate_start; wire format in spectate.h).  The game mirroring
+// itself sends the ticcmds G_Ticker hands its players; a spectator plays
+// them back in lockstep, the way a netgame node runs the other players'
+// commands, and checks P_StateHash() against the game's once a second.
+
+// From G_InitNew once P_Random is reset, before the level loads: a game
+// begins a session; on a spectator the session it was waiting for starts
+// here (its P_Random index is set), and any other G_InitNew stops it
+// spectating.
+void I_SpectateBegin (void);
+
+// G_Ticker, for each player in the game: a game records cmd, a spectator
+// replaces it with the game's.
+void I_SpectateTiccmd (int player, ticcmd_t* cmd);
+
+// G_Ticker after a tic that read ticcmds: a game sends it, a spectator
+// goes on to the next and checks the state hash at a check point.
+void I_SpectateTicDone (void);
+
+// Whether the spectator's P_Ticker holds this tic, as the game's did for
+// its menu.
+boolean I_SpectateHeld (void);
+
+// Every doom_run_tic: reads the socket.  A game answers resend requests;
+// a spectator takes tics in, and queues the session's start
+// (G_DeferedSpectate) when it has one it can join.
+void I_SpectatePoll (void);
+
+// A spectator can run its next tic (always true otherwise).
+boolean I_SpectateReady (void);
+
+// Extra tics the spectator should run this call to catch up with the game.
+int I_SpectateCatchup (void);
+
+// The session start G_DoSpectate builds the game from.
+const spectate_start_t* I_SpectateStart (void);
+
+void I_ShutdownSpectate (void);
+
+#endif
@@ -0,0 +1,727 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "doom_api.h"
+#include "doomdef.h"
+#include "doomstat.h"
+#include "g_game.h"
+#include "i_log.h"
+#include "i_spectate.h"
+#include "p_saveg.h"
+#include "p_tick.h"
+#include "w_wad.h"
+
+// Spectator mirroring (doom_mirror_start / doom_spectate_start,
+// UBO_DOOM_MIRROR / UBO_DOOM_SPECTATE), wire format in spectate.h.  All of
+// it runs on the tic thread, from the G_Ticker and doom_run_tic hooks in
+// i_spectate.h; a tic costs the game one sendto() of a few dozen bytes.
+// - The game keeps the session's tics in a ring of SPECTATE_HISTORY_TICS,
+//   sends each new one together with the SPECTATE_REDUNDANCY - 1 before it,
+//   and answers a spectator's resend request from the ring, a burst of at
+//   most SPECTATE_BURST datagrams at a time.
+// - The spectator keeps the tics it hasn't run in a ring of
+//   SPECTATE_AHEAD_TICS.  It joins a session once it has its START and tic
+//   0 (asking for them when it only sees later tics), and asks again from
+//   the first tic it is missing at most every SPECTATE_ASK_MS.  A tic it
+//   doesn't have yet holds its simulation; tics it has beyond the next
+//   SPECTATE_LAG_TICS are run on top, up to SPECTATE_CATCHUP a call, so a
+//   late joiner catches up at about 70x real time.
+// - After each check point tic both sides hash the playsim.  A spectator
+//   whose hash differs counts a desync and logs the first of a session;
+//   it goes on mirroring, as there is no state to resync from.
+
+#define SPECTATE_OFF            0
+#define SPECTATE_MIRROR         1
+#define SPECTATE_SPECTATOR      2
+
+#define SPECTATE_AHEAD_TICS     4096
+#define SPECTATE_BURST          8
+#define SPECTATE_ASK_MS         50
+#define SPECTATE_LAG_TICS       4
+#define SPECTATE_CATCHUP        64
+#define SPECTATE_HASHES         64      // check points either side remembers
+#define SPECTATE_TIC_MAX        SPECTATE_TIC_BYTES(MAXPLAYERS)
+#define SPECTATE_NONE           0xffffffffu
+
+extern int prndindex;
+
+static int g_role = SPECTATE_OFF;
+static int g_sock = -1;
+static struct sockaddr_storage g_peer;  // game: where tics go; spectator: the game
+static socklen_t g_peerlen;
+static char g_name[256];
+
+// the session either side is in
+static uint32_t g_session;
+static spectate_start_t g_start;
+static int g_syncable;
+static int g_slot[MAXPLAYERS];          // player -> place in a tic, -1 = not in the game
+static int g_ticbytes;
+static uint32_t g_tics;                 // game: tics sent; spectator: tics run
+
+// game side
+static byte* g_history;                 // SPECTATE_HISTORY_TICS tics
+static byte g_cur[SPECTATE_TIC_MAX];
+static uint32_t g_hash[SPECTATE_HASHES], g_hash_tag[SPECTATE_HASHES];
+
+// spectator side
+static byte g_ahead[SPECTATE_AHEAD_TICS][SPECTATE_TIC_MAX];
+static uint32_t g_ahead_tag[SPECTATE_AHEAD_TICS];   // tic + 1 held in the slot, 0 = none
+static int g_following;                 // running g_session
+static int g_starting;                  // G_DoSpectate is queued or running
+static uint32_t g_joining;              // session whose START and tic 0 it waits for
+static int g_have_start;
+static uint32_t g_refused;              // a session it can't or won't join
+static uint32_t g_latest;               // tics of g_session the game is known to have
+static uint64_t g_asked_us;
+static uint32_t g_game_hash[SPECTATE_HASHES], g_game_hash_tag[SPECTATE_HASHES];
+static uint32_t g_own_hash[SPECTATE_HASHES], g_own_hash_tag[SPECTATE_HASHES];
+
+static ubo_spectate_stats_t g_stats = { .desync_tic = SPECTATE_NONE };
+static byte g_packet[sizeof(spectate_packet_t) + SPECTATE_MAX_PAYLOAD];
+
+static uint64_t I_SpectateNowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+//
+// Sessions
+//
+
+static void I_SpectateSetPlayers(const spectate_start_t* start)
+{
+    int n = 0;
+
+    for (int i = 0; i < MAXPLAYERS; i++)
+        g_slot[i] = start->playeringame[i] ? n++ : -1;
+    g_ticbytes = SPECTATE_TIC_BYTES(n);
+}
+
+static void I_SpectateSend(const spectate_packet_t* head, const void* payload,
+                           const struct sockaddr* to, socklen_t tolen)
+{
+    size_t len = sizeof(*head) + head->bytes;
+
+    memcpy(g_packet, head, sizeof(*head));
+    memcpy(g_packet + sizeof(*head), payload, head->bytes);
+    if (sendto(g_sock, g_packet, len, MSG_DONTWAIT | MSG_NOSIGNAL, to, tolen) == (ssize_t)len)
+    {
+        g_stats.packets++;
+        g_stats.bytes += (uint32_t)len;
+    }
+}
+
+static void I_SpectateHead(spectate_packet_t* head, int type, uint32_t tic)
+{
+    memset(head, 0, sizeof(*head));
+    head->magic = SPECTATE_MAGIC;
+    head->version = SPECTATE_VERSION;
+    head->type = (uint8_t)type;
+    head->session = g_session;
+    head->tic = tic;
+    head->hash_tic = SPECTATE_NONE;
+}
+
+static void I_SpectateSendStart(const struct sockaddr* to, socklen_t tolen)
+{
+    spectate_packet_t head;
+
+    I_SpectateHead(&head, SPECTATE_START, 0);
+    head.bytes = sizeof(g_start);
+    I_SpectateSend(&head, &g_start, to, tolen);
+}
+
+// count tics from first out of the history; count 0 says the ring no
+// longer holds first, tic is then the oldest it does.
+static void I_SpectateSendTics(uint32_t first, int count, const struct sockaddr* to, socklen_t tolen)
+{
+    byte payload[SPECTATE_MAX_PAYLOAD];
+    spectate_packet_t head;
+
+    I_SpectateHead(&head, SPECTATE_TICS, first);
+    for (int i = 0; i < count; i++)
+        memcpy(payload + i * g_ticbytes,
+               g_history + ((first + i) % SPECTATE_HISTORY_TICS) * g_ticbytes, g_ticbytes);
+    head.count = (uint16_t)count;
+    head.bytes = (uint16_t)(count * g_ticbytes);
+    // the newest check point the datagram's tics reach, while it is kept
+    if ((first + count) / SPECTATE_HASH_TICS > 0)
+    {
+        uint32_t tic = (first + count) / SPECTATE_HASH_TICS * SPECTATE_HASH_TICS - 1;
+        int slot = (int)(tic / SPECTATE_HASH_TICS % SPECTATE_HASHES);
+
+        if (g_hash_tag[slot] == tic + 1)
+        {
+            head.hash_tic = tic;
+            head.hash = g_hash[slot];
+        }
+    }
+    I_SpectateSend(&head, payload, to, tolen);
+}
+
+//
+// Game side
+//
+
+static void I_MirrorBegin(void)
+{
+    g_session++;
+    memset(&g_start, 0, sizeof(g_start));
+    g_start.flags = loadinggame ? SPECTATE_UNSYNCABLE : 0;
+    g_start.skill = (uint8_t)gameskill;
+    g_start.episode = (uint8_t)gameepisode;
+    g_start.map = (uint8_t)gamemap;
+    g_start.deathmatch = (uint8_t)deathmatch;
+    g_start.respawn = (uint8_t)respawnparm;
+    g_start.fast = (uint8_t)fastparm;
+    g_start.nomonsters = (uint8_t)nomonsters;
+    g_start.netgame = (uint8_t)netgame;
+    g_start.consoleplayer = (uint8_t)consoleplayer;
+    for (int i = 0; i < MAXPLAYERS; i++)
+        g_start.playeringame[i] = (uint8_t)playeringame[i];
+    g_start.numlumps = (uint16_t)numlumps;
+    g_start.prndindex = (uint32_t)prndindex;
+    I_SpectateSetPlayers(&g_start);
+    g_syncable = !loadinggame;
+    g_tics = 0;
+    memset(g_hash_tag, 0, sizeof(g_hash_tag));
+    g_stats.session = g_session;
+    g_stats.tics = 0;
+    I_SpectateSendStart((struct sockaddr*)&g_peer, g_peerlen);
+}
+
+static void I_MirrorTicDone(void)
+{
+    uint32_t tic = g_tics;
+    uint32_t first;
+
+    g_cur[0] = tickerheld ? SPECTATE_TIC_HELD : 0;
+    memcpy(g_history + (tic % SPECTATE_HISTORY_TICS) * g_ticbytes, g_cur, g_ticbytes);
+    g_tics++;
+    g_stats.tics = g_tics;
+    if (g_tics % SPECTATE_HASH_TICS == 0)
+    {
+        int slot = (int)(tic / SPECTATE_HASH_TICS % SPECTATE_HASHES);
+
+        g_hash[slot] = P_StateHash();
+        g_hash_tag[slot] = tic + 1;
+    }
+    first = g_tics > SPECTATE_REDUNDANCY ? g_tics - SPECTATE_REDUNDANCY : 0;
+    I_SpectateSendTics(first, (int)(g_tics - first), (struct sockaddr*)&g_peer, g_peerlen);
+    // for spectators that join late or lost the first one
+    if (g_tics % TICRATE == 0)
+        I_SpectateSendStart((struct sockaddr*)&g_peer, g_peerlen);
+}
+
+static void I_MirrorResend(const spectate_packet_t* req, const struct sockaddr* from, socklen_t fromlen)
+{
+    uint32_t oldest = g_tics > SPECTATE_HISTORY_TICS ? g_tics - SPECTATE_HISTORY_TICS : 0;
+    int per = SPECTATE_MAX_PAYLOAD / g_ticbytes;
+    uint32_t tic = req->tic;
+
+    if (!g_ticbytes)
+        return;                         // no session yet
+    g_stats.resends++;
+    if (req->session != g_session || tic == 0)
+        I_SpectateSendStart(from, fromlen);
+    if (req->session != g_session || !g_syncable)
+        return;
+    if (tic < oldest)
+    {
+        I_SpectateSendTics(oldest, 0, from, fromlen);
+        return;
+    }
+    // each datagram ends at a check point, so every one it covers is sent
+    for (int i = 0; i < SPECTATE_BURST && tic < g_tics; i++)
+    {
+        uint32_t end = (tic / SPECTATE_HASH_TICS + 1) * SPECTATE_HASH_TICS;
+        int count;
+
+        if (end > g_tics)
+            end = g_tics;
+        count = end - tic < (uint32_t)per ? (int)(end - tic) : per;
+
+        I_SpectateSendTics(tic, count, from, fromlen);
+        tic += (uint32_t)count;
+    }
+}
+
+//
+// Spectator side
+//
+
+static void I_SpectateLeave(const char* why)
+{
+    if (g_following || g_starting)
+        UBO_LOG(UBO_LOG_INFO, "[doom] spectate: %s\n", why);
+    g_refused = g_session;
+    g_following = g_starting = 0;
+    g_joining = 0;
+    g_have_start = 0;
+    spectating = false;
+}
+
+static void I_SpectateNewSession(uint32_t session)
+{
+    g_session = session;
+    g_have_start = 0;
+    g_latest = 0;
+    g_tics = 0;
+    memset(g_ahead_tag, 0, sizeof(g_ahead_tag));
+    memset(g_game_hash_tag, 0, sizeof(g_game_hash_tag));
+    memset(g_own_hash_tag, 0, sizeof(g_own_hash_tag));
+    g_stats.session = session;
+    g_stats.tics = 0;
+    g_stats.desync_tic = SPECTATE_NONE;
+}
+
+static void I_SpectateAsk(uint32_t tic)
+{
+    spectate_packet_t head;
+    uint64_t now = I_SpectateNowUs();
+
+    if (now - g_asked_us < SPECTATE_ASK_MS * 1000u)
+        return;
+    g_asked_us = now;
+    I_SpectateHead(&head, SPECTATE_RESEND, tic);
+    // not counted as traffic received
+    if (sendto(g_sock, &head, sizeof(head), MSG_DONTWAIT | MSG_NOSIGNAL,
+               (struct sockaddr*)&g_peer, g_peerlen) == (ssize_t)sizeof(head))
+        g_stats.resends++;
+}
+
+static void I_SpectateCompare(uint32_t tic)
+{
+    int slot = (int)(tic / SPECTATE_HASH_TICS % SPECTATE_HASHES);
+
+    if (g_game_hash_tag[slot] != tic + 1 || g_own_hash_tag[slot] != tic + 1)
+        return;
+    g_own_hash_tag[slot] = 0;           // compared once
+    g_stats.hash_checks++;
+    if (g_game_hash[slot] == g_own_hash[slot])
+        return;
+    g_stats.desyncs++;
+    if (g_stats.desync_tic == SPECTATE_NONE)
+    {
+        g_stats.desync_tic = tic;
+        UBO_LOG(UBO_LOG_ERROR, "[doom] spectate: out of sync at tic %u of the session"
+                " (state %08x, the game's %08x)\n", tic, g_own_hash[slot], g_game_hash[slot]);
+    }
+}
+
+static void I_SpectateStartPacket(const spectate_packet_t* head, const byte* payload)
+{
+    const spectate_start_t* start = (const spectate_start_t*)payload;
+
+    if (head->bytes < sizeof(*start) || head->session == g_refused
+        || (head->session == g_session && g_have_start))
+        return;
+    if (start->flags & SPECTATE_UNSYNCABLE)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] spectate: the game loaded a save; waiting for a new game\n");
+        g_refused = head->session;
+        return;
+    }
+    if (start->numlumps != (uint16_t)numlumps)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] spectate: the game has %u lumps, this WAD %d; not joining\n",
+                start->numlumps, numlumps);
+        g_refused = head->session;
+        return;
+    }
+    if (head->session != g_session)
+    {
+        if (g_following || g_starting)
+            I_SpectateLeave("the game began a new session");
+        I_SpectateNewSession(head->session);
+    }
+    g_start = *start;
+    I_SpectateSetPlayers(&g_start);
+    g_have_start = 1;
+    if (!g_following && !g_starting)
+        g_joining = head->session;
+}
+
+static void I_SpectateTicsPacket(const spectate_packet_t* head, const byte* payload)
+{
+    if (head->session == g_refused)
+        return;
+    if (head->session != g_session)
+    {
+        // a session under way that it hasn't seen begin
+        if (g_following || g_starting)
+            I_SpectateLeave("the game began a new session");
+        I_SpectateNewSession(head->session);
+        g_joining = head->session;
+    }
+    if (!g_have_start)
+        return;                         // tic sizes unknown until the START
+    if (head->count == 0)
+    {
+        if (head->tic > g_tics)
+        {
+            UBO_LOG(UBO_LOG_ERROR, "[doom] spectate: joined %u tics too late; waiting for a new game\n",
+                    head->tic - g_tics);
+            I_SpectateLeave("waiting for the game's next session");
+        }
+        return;
+    }
+    if (head->bytes < head->count * g_ticbytes)
+        return;
+    for (uint32_t i = 0; i < head->count; i++)
+    {
+        uint32_t tic = head->tic + i;
+        int slot = (int)(tic % SPECTATE_AHEAD_TICS);
+
+        if (tic < g_tics || tic >= g_tics + SPECTATE_AHEAD_TICS)
+            continue;
+        memcpy(g_ahead[slot], payload + i * g_ticbytes, g_ticbytes);
+        g_ahead_tag[slot] = tic + 1;
+    }
+    if (head->tic + head->count > g_latest)
+        g_latest = head->tic + head->count;
+    if (head->hash_tic != SPECTATE_NONE)
+    {
+        int slot = (int)(head->hash_tic / SPECTATE_HASH_TICS % SPECTATE_HASHES);
+
+        if (g_game_hash_tag[slot] != head->hash_tic + 1)
+        {
+            g_game_hash[slot] = head->hash;
+            g_game_hash_tag[slot] = head->hash_tic + 1;
+            I_SpectateCompare(head->hash_tic);
+        }
+    }
+}
+
+static int I_SpectateHave(uint32_t tic)
+{
+    return g_ahead_tag[tic % SPECTATE_AHEAD_TICS] == tic + 1;
+}
+
+//
+// Hooks
+//
+
+void I_SpectateBegin(void)
+{
+    if (g_role == SPECTATE_MIRROR)
+    {
+        I_MirrorBegin();
+        return;
+    }
+    if (g_role != SPECTATE_SPECTATOR)
+        return;
+    if (!g_starting)
+    {
+        // a game of its own: the session is left to the game
+        I_SpectateLeave("left the game it mirrored for one of its own");
+        return;
+    }
+    g_starting = 0;
+    g_following = 1;
+    g_tics = 0;
+    spectating = true;
+    prndindex = (int)g_start.prndindex;
+    UBO_LOG(UBO_LOG_INFO, "[doom] spectate: following the game, skill %d E%dM%d, %d tics known\n",
+            g_start.skill + 1, g_start.episode, g_start.map, (int)g_latest);
+}
+
+void I_SpectateTiccmd(int player, ticcmd_t* cmd)
+{
+    byte* p;
+
+    if (g_slot[player] < 0)
+        return;
+    if (g_role == SPECTATE_MIRROR && g_history)
+    {
+        p = g_cur + 1 + 5 * g_slot[player];
+        p[0] = (byte)cmd->forwardmove;
+        p[1] = (byte)cmd->sidemove;
+        p[2] = (byte)cmd->angleturn;
+        p[3] = (byte)(cmd->angleturn >> 8);
+        p[4] = cmd->buttons;
+    }
+    else if (spectating && g_following && I_SpectateHave(g_tics))
+    {
+        p = g_ahead[g_tics % SPECTATE_AHEAD_TICS] + 1 + 5 * g_slot[player];
+        memset(cmd, 0, sizeof(*cmd));
+        cmd->forwardmove = (signed char)p[0];
+        cmd->sidemove = (signed char)p[1];
+        cmd->angleturn = (short)(p[2] | (p[3] << 8));
+        cmd->buttons = p[4];
+    }
+}
+
+void I_SpectateTicDone(void)
+{
+    uint32_t tic = g_tics;
+
+    if (g_role == SPECTATE_MIRROR)
+    {
+        if (g_history && g_session && g_syncable)
+            I_MirrorTicDone();
+        return;
+    }
+    if (!spectating || !g_following)
+        return;
+    g_ahead_tag[tic % SPECTATE_AHEAD_TICS] = 0;
+    g_tics++;
+    g_stats.tics = g_tics;
+    if (g_tics % SPECTATE_HASH_TICS == 0)
+    {
+        int slot = (int)(tic / SPECTATE_HASH_TICS % SPECTATE_HASHES);
+
+        g_own_hash[slot] = P_StateHash();
+        g_own_hash_tag[slot] = tic + 1;
+        I_SpectateCompare(tic);
+    }
+}
+
+boolean I_SpectateHeld(void)
+{
+    return g_following && I_SpectateHave(g_tics)
+        && (g_ahead[g_tics % SPECTATE_AHEAD_TICS][0] & SPECTATE_TIC_HELD);
+}
+
+void I_SpectatePoll(void)
+{
+    struct sockaddr_storage from;
+    socklen_t fromlen;
+    ssize_t n;
+
+    if (g_sock < 0)
+        return;
+    for (;;)
+    {
+        const spectate_packet_t* head = (const spectate_packet_t*)g_packet;
+
+        fromlen = sizeof(from);
+        n = recvfrom(g_sock, g_packet, sizeof(g_packet), MSG_DONTWAIT,
+                     (struct sockaddr*)&from, &fromlen);
+        if (n < 0)
+            break;
+        if ((size_t)n < sizeof(*head) || head->magic != SPECTATE_MAGIC
+            || head->version != SPECTATE_VERSION || (size_t)n < sizeof(*head) + head->bytes)
+            continue;
+        if (g_role == SPECTATE_MIRROR)
+        {
+            if (head->type == SPECTATE_RESEND && g_history && g_session)
+                I_MirrorResend(head, (struct sockaddr*)&from, fromlen);
+            continue;
+        }
+        g_stats.packets++;
+        g_stats.bytes += (uint32_t)n;
+        // requests go back to whoever the game's datagrams come from
+        memcpy(&g_peer, &from, fromlen);
+        g_peerlen = fromlen;
+        if (head->type == SPECTATE_START)
+            I_SpectateStartPacket(head, g_packet + sizeof(*head));
+        else if (head->type == SPECTATE_TICS)
+            I_SpectateTicsPacket(head, g_packet + sizeof(*head));
+    }
+    if (g_role != SPECTATE_SPECTATOR || !g_session || g_session == g_refused)
+        return;
+
+    g_stats.behind = g_latest > g_tics ? g_latest - g_tics : 0;
+    if (g_joining && g_have_start && I_SpectateHave(0))
+    {
+        // once the hold for tic 0 is over
+        g_joining = 0;
+        g_starting = 1;
+        G_DeferedSpectate();
+    }
+    else if (g_joining || g_following)
+    {
+        uint32_t tic = g_tics;
+
+        // the first tic in the window it is missing
+        while (tic < g_latest && tic < g_tics + SPECTATE_AHEAD_TICS && I_SpectateHave(tic))
+            tic++;
+        if (!g_have_start)
+            I_SpectateAsk(0);
+        else if (tic < g_latest)
+            I_SpectateAsk(tic);
+    }
+}
+
+boolean I_SpectateReady(void)
+{
+    if (g_role != SPECTATE_SPECTATOR || !(spectating || g_starting))
+        return true;
+    return I_SpectateHave(g_tics);
+}
+
+int I_SpectateCatchup(void)
+{
+    uint32_t have = 0;
+
+    if (g_role != SPECTATE_SPECTATOR || !spectating)
+        return 0;
+    while (have < SPECTATE_LAG_TICS + SPECTATE_CATCHUP && I_SpectateHave(g_tics + 1 + have))
+        have++;
+    if (have <= SPECTATE_LAG_TICS)
+        return 0;
+    return (int)(have - SPECTATE_LAG_TICS);
+}
+
+const spectate_start_t* I_SpectateStart(void)
+{
+    return &g_start;
+}
+
+//
+// API
+//
+
+static int I_SpectateOpen(const char* name, int role)
+{
+    struct addrinfo hints, *ai;
+    char host[128];
+    const char* port;
+    size_t n;
+    int one = 1;
+
+    if (strncmp(name, "udp:", 4) || !(port = strrchr(name + 4, ':')) || !port[1])
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] spectate: %s is not udp:host:port or udp::port\n", name);
+        return -1;
+    }
+    n = (size_t)(port - (name + 4));
+    if (n >= sizeof(host))
+        n = sizeof(host) - 1;
+    memcpy(host, name + 4, n);
+    host[n] = '\0';
+    port++;
+    if ((role == SPECTATE_MIRROR) != (host[0] != '\0'))
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] spectate: %s: the game sends to udp:host:port, a spectator"
+                " listens on udp::port\n", name);
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = host[0] ? 0 : AI_PASSIVE;
+    if (getaddrinfo(host[0] ? host : NULL, port, &hints, &ai) != 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] spectate: can't resolve %s\n", name);
+        return -1;
+    }
+    g_sock = socket(ai->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_sock >= 0 && role == SPECTATE_MIRROR)
+    {
+        // a broadcast address reaches every spectator on the LAN
+        setsockopt(g_sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+        memcpy(&g_peer, ai->ai_addr, ai->ai_addrlen);
+        g_peerlen = ai->ai_addrlen;
+    }
+    else if (g_sock >= 0)
+    {
+        setsockopt(g_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(g_sock, ai->ai_addr, ai->ai_addrlen) < 0)
+        {
+            UBO_LOG(UBO_LOG_ERROR, "[doom] spectate: can't listen on port %s: %s\n", port, strerror(errno));
+            close(g_sock);
+            g_sock = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    if (g_sock < 0)
+        return -1;
+    snprintf(g_name, sizeof(g_name), "%s", name);
+    return 0;
+}
+
+static void I_SpectateReset(int role)
+{
+    g_role = role;
+    g_session = g_refused = g_joining = 0;
+    g_following = g_starting = g_have_start = g_syncable = 0;
+    g_tics = g_latest = 0;
+    g_asked_us = 0;
+    memset(g_hash_tag, 0, sizeof(g_hash_tag));
+    memset(g_ahead_tag, 0, sizeof(g_ahead_tag));
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.role = role;
+    g_stats.desync_tic = SPECTATE_NONE;
+    for (int i = 0; i < MAXPLAYERS; i++)
+        g_slot[i] = -1;
+}
+
+int doom_mirror_start(const char* target)
+{
+    if (!target || !target[0] || g_role != SPECTATE_OFF)
+        return g_role == SPECTATE_MIRROR ? 0 : -1;
+    if (!g_history)
+        g_history = malloc((size_t)SPECTATE_HISTORY_TICS * SPECTATE_TIC_MAX);
+    if (!g_history)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] mirror: no memory for the tic history\n");
+        return -1;
+    }
+    if (I_SpectateOpen(target, SPECTATE_MIRROR) < 0)
+        return -1;
+    I_SpectateReset(SPECTATE_MIRROR);
+    // a session number a restarted game doesn't reuse
+    g_session = (uint32_t)(I_SpectateNowUs() / 1000u) << 8;
+    UBO_LOG(UBO_LOG_INFO, "[doom] mirror: sending ticcmds to %s from the next new game\n", g_name);
+    return 0;
+}
+
+int doom_spectate_start(const char* source)
+{
+    if (!source || !source[0] || g_role != SPECTATE_OFF)
+        return g_role == SPECTATE_SPECTATOR ? 0 : -1;
+    if (I_SpectateOpen(source, SPECTATE_SPECTATOR) < 0)
+        return -1;
+    I_SpectateReset(SPECTATE_SPECTATOR);
+    g_peerlen = 0;
+    UBO_LOG(UBO_LOG_INFO, "[doom] spectate: waiting for a game on %s\n", g_name);
+    return 0;
+}
+
+void doom_spectate_stop(void)
+{
+    if (g_role == SPECTATE_OFF)
+        return;
+    if (g_role == SPECTATE_MIRROR)
+        UBO_LOG(UBO_LOG_INFO, "[doom] mirror: %u datagrams, %u KB sent, %u resend requests answered\n",
+                g_stats.packets, g_stats.bytes / 1024, g_stats.resends);
+    else
+        UBO_LOG(UBO_LOG_INFO, "[doom] spectate: %u datagrams, %u KB received, %u resend requests,"
+                " %u of %u check points out of sync\n", g_stats.packets, g_stats.bytes / 1024,
+                g_stats.resends, g_stats.desyncs, g_stats.hash_checks);
+    close(g_sock);
+    g_sock = -1;
+    spectating = false;
+    I_SpectateReset(SPECTATE_OFF);
+}
+
+int doom_get_spectate_stats(ubo_spectate_stats_t* out)
+{
+    if (!out)
+        return -1;
+    *out = g_stats;
+    out->following = g_following;
+    return 0;
+}
+
+void I_ShutdownSpectate(void)
+{
+    doom_spectate_stop();
+    free(g_history);
+    g_history = NULL;
+}
@@ -0,0 +1,471 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "doom_api.h"
+#include "doomdef.h"
+#include "framestream.h"
+#include "i_log.h"
+#include "i_mailbox.h"
+#include "i_video.h"
+#include "v_video.h"
+
+// Remote framebuffer stream (doom_stream_start, UBO_DOOM_STREAM), wire
+// format in framestream.h:
+// - I_FinishUpdate hands each shown 8-bit frame and its palette to
+//   I_StreamFrame, which copies the 64 KB into a one-deep mailbox
+//   (i_mailbox.h), as I_CaptureFrame does.  A frame the stream thread hasn't taken yet is
+//   replaced, never queued.
+// - The thread keeps the newest frame and, whenever the viewer's socket can
+//   take more, sends it XORed against the frame the viewer has and RLE-coded
+//   in the same pass, plus the palette when it changed, at most
+//   UBO_DOOM_STREAM_FPS times a second.  Until then newer frames replace it,
+//   so a slow link costs frames, never tic time, and the last frame before
+//   the picture holds still always goes out.
+// - "tcp:host:port" connects out and retries once a second; "tcp::port"
+//   listens, and a new viewer takes over from the previous one.  Either way
+//   a new connection starts with a key frame of the current picture.
+
+#define STREAM_WAIT_MS      20          // the viewer socket is polled at least this often
+#define STREAM_RETRY_MS     1000
+#define STREAM_SEND_MS      2000        // a viewer that takes no data this long is dropped
+#define STREAM_PIXELS       (SCREENWIDTH * SCREENHEIGHT)
+#define STREAM_PACKED_MAX   (STREAM_PIXELS + STREAM_PIXELS / 128 + 1)
+
+static int g_listen = -1;
+static int g_peer = -1;
+static char g_host[128];
+static char g_port[16];
+static char g_outname[256];
+static int g_width, g_height;
+static int g_connect_failed;
+static uint64_t g_retry_us;
+
+static mailbox_t g_mailbox = MAILBOX_INIT;
+
+static pthread_t g_thread;
+static volatile int g_running;
+static int g_started;
+
+static uint64_t g_period_us;
+static uint64_t g_sent_us;
+static uint32_t g_seq;
+
+// thread side: the newest frame (rows packed, no stride) and what the viewer has
+static byte g_latest[STREAM_PIXELS];
+static byte g_latest_pal[256 * 3];
+static uint64_t g_latest_us;
+static uint32_t g_latest_seq;
+static int g_have_latest;
+static int g_pending;
+static byte g_base[STREAM_PIXELS];
+static byte g_base_pal[256 * 3];
+static int g_base_valid;
+static uint8_t g_out[2 * sizeof(framestream_msg_t) + 256 * 3 + STREAM_PACKED_MAX];
+
+static uint32_t g_keys, g_deltas, g_palettes, g_replaced, g_dropped, g_viewers;
+static uint64_t g_bytes, g_raw_bytes;
+
+static int I_StreamEnvInt(const char* name, int def)
+{
+    const char* v = getenv(name);
+    return (v && v[0] != '\0') ? atoi(v) : def;
+}
+
+static uint64_t I_StreamNowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+//
+// Coding
+//
+
+static uint8_t* I_StreamLiterals(uint8_t* d, const byte* src, const byte* base, size_t i, size_t end)
+{
+    while (i < end)
+    {
+        size_t n = end - i > 128 ? 128 : end - i;
+
+        *d++ = (uint8_t)(n - 1);
+        for (size_t k = 0; k < n; k++, i++)
+            *d++ = base ? (uint8_t)(src[i] ^ base[i]) : src[i];
+    }
+    return d;
+}
+
+// n bytes of src, XORed with base unless it is NULL, RLE-coded into dst as
+// framestream.h describes.  Returns the length, at most STREAM_PACKED_MAX
+// for a full frame: literals cost one control byte per 128, runs of 3 or
+// more two bytes.
+static size_t I_StreamPack(uint8_t* dst, const byte* src, const byte* base, size_t n)
+{
+    uint8_t* d = dst;
+    size_t lit = 0;
+    size_t i = 0;
+
+    while (i < n)
+    {
+        uint8_t v = base ? (uint8_t)(src[i] ^ base[i]) : src[i];
+        size_t run = 1;
+
+        if (base)
+            while (i + run < n && run < 129 && (uint8_t)(src[i + run] ^ base[i + run]) == v)
+                run++;
+        else
+            while (i + run < n && run < 129 && src[i + run] == v)
+                run++;
+        if (run >= 3)
+        {
+            d = I_StreamLiterals(d, src, base, lit, i);
+            *d++ = (uint8_t)(run + 0x7e);
+            *d++ = v;
+            lit = i + run;
+        }
+        i += run;
+    }
+    d = I_StreamLiterals(d, src, base, lit, n);
+    return (size_t)(d - dst);
+}
+
+//
+// Connection
+//
+
+static int I_StreamParse(const char* name)
+{
+    const char* port;
+    size_t n;
+
+    if (strncmp(name, "tcp:", 4) || !(port = strrchr(name + 4, ':')) || !port[1])
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] stream: %s is not tcp:host:port or tcp::port\n", name);
+        return -1;
+    }
+    n = (size_t)(port - (name + 4));
+    if (n >= sizeof(g_host))
+        n = sizeof(g_host) - 1;
+    memcpy(g_host, name + 4, n);
+    g_host[n] = '\0';
+    snprintf(g_port, sizeof(g_port), "%s", port + 1);
+    return 0;
+}
+
+static int I_StreamOpenListener(void)
+{
+    struct addrinfo hints, *ai;
+    int one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(NULL, g_port, &hints, &ai) != 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] stream: bad port %s\n", g_port);
+        return -1;
+    }
+    g_listen = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_listen >= 0)
+        setsockopt(g_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (g_listen < 0 || bind(g_listen, ai->ai_addr, ai->ai_addrlen) < 0 || listen(g_listen, 1) < 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] stream: can't listen on port %s: %s\n", g_port, strerror(errno));
+        freeaddrinfo(ai);
+        if (g_listen >= 0)
+            close(g_listen);
+        g_listen = -1;
+        return -1;
+    }
+    freeaddrinfo(ai);
+    return 0;
+}
+
+static int I_StreamSend(const void* data, size_t len)
+{
+    const uint8_t* p = data;
+
+    while (len > 0)
+    {
+        ssize_t w = send(g_peer, p, len, MSG_NOSIGNAL);
+
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static void I_StreamDropPeer(const char* why)
+{
+    UBO_LOG(UBO_LOG_INFO, "[doom] stream: viewer %s\n", why);
+    close(g_peer);
+    g_peer = -1;
+}
+
+static void I_StreamSetPeer(int fd)
+{
+    struct timeval tv = { STREAM_SEND_MS / 1000, (STREAM_SEND_MS % 1000) * 1000 };
+    framestream_hello_t hello;
+    int one = 1;
+
+    if (g_peer >= 0)
+        I_StreamDropPeer("replaced by a new one");
+    g_peer = fd;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = FRAMESTREAM_MAGIC;
+    hello.version = FRAMESTREAM_VERSION;
+    hello.width = (uint16_t)g_width;
+    hello.height = (uint16_t)g_height;
+    if (I_StreamSend(&hello, sizeof(hello)) < 0)
+    {
+        I_StreamDropPeer("gone");
+        return;
+    }
+    g_viewers++;
+    UBO_LOG(UBO_LOG_INFO, "[doom] stream: viewer connected, %dx%d\n", g_width, g_height);
+    // the picture it joins on, even if nothing moves for a while
+    g_base_valid = 0;
+    g_pending = g_have_latest;
+}
+
+static void I_StreamConnect(void)
+{
+    struct addrinfo hints, *ai;
+    uint64_t now;
+    int fd = -1;
+
+    if (!g_host[0])
+    {
+        fd = accept4(g_listen, NULL, NULL, SOCK_CLOEXEC);
+        if (fd >= 0)
+            I_StreamSetPeer(fd);
+        return;
+    }
+    if (g_peer >= 0 || (now = I_StreamNowUs()) < g_retry_us)
+        return;
+    g_retry_us = now + STREAM_RETRY_MS * 1000u;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(g_host, g_port, &hints, &ai) != 0)
+    {
+        if (!g_connect_failed)
+            UBO_LOG(UBO_LOG_ERROR, "[doom] stream: can't resolve %s, retrying\n", g_host);
+        g_connect_failed = 1;
+        return;
+    }
+    fd = socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0)
+    {
+        // bounds connect() too
+        struct timeval tv = { STREAM_RETRY_MS / 1000, (STREAM_RETRY_MS % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    if (fd < 0 || connect(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+    {
+        if (!g_connect_failed)
+            UBO_LOG(UBO_LOG_ERROR, "[doom] stream: can't connect to %s:%s: %s, retrying\n",
+                    g_host, g_port, strerror(errno));
+        g_connect_failed = 1;
+        if (fd >= 0)
+            close(fd);
+        freeaddrinfo(ai);
+        return;
+    }
+    freeaddrinfo(ai);
+    g_connect_failed = 0;
+    I_StreamSetPeer(fd);
+}
+
+//
+// Thread
+//
+
+static uint8_t* I_StreamHeader(uint8_t* d, int type, uint32_t bytes)
+{
+    framestream_msg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = (uint8_t)type;
+    msg.seq = g_latest_seq;
+    msg.time_ms = (uint32_t)(g_latest_us / 1000u);
+    msg.bytes = bytes;
+    memcpy(d, &msg, sizeof(msg));
+    return d + sizeof(msg);
+}
+
+// Sends the newest frame if the viewer can take it now; otherwise it waits
+// for the next try, and a newer frame may replace it meanwhile.
+static void I_StreamFlush(void)
+{
+    struct pollfd pfd = { g_peer, POLLOUT, 0 };
+    size_t pixels = (size_t)g_width * g_height;
+    uint8_t* d = g_out;
+    uint8_t* frame;
+    size_t packed;
+
+    if (poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLERR | POLLHUP)))
+    {
+        I_StreamDropPeer("gone");
+        return;
+    }
+    if (!(pfd.revents & POLLOUT))
+        return;
+
+    if (!g_base_valid || memcmp(g_base_pal, g_latest_pal, sizeof(g_base_pal)))
+    {
+        d = I_StreamHeader(d, FRAMESTREAM_PALETTE, sizeof(g_latest_pal));
+        memcpy(d, g_latest_pal, sizeof(g_latest_pal));
+        d += sizeof(g_latest_pal);
+        memcpy(g_base_pal, g_latest_pal, sizeof(g_base_pal));
+        g_palettes++;
+    }
+    frame = d;
+    d += sizeof(framestream_msg_t);
+    packed = I_StreamPack(d, g_latest, g_base_valid ? g_base : NULL, pixels);
+    I_StreamHeader(frame, g_base_valid ? FRAMESTREAM_DELTA : FRAMESTREAM_KEY, (uint32_t)packed);
+    d += packed;
+
+    if (I_StreamSend(g_out, (size_t)(d - g_out)) < 0)
+    {
+        I_StreamDropPeer(errno == EAGAIN ? "stalled" : "gone");
+        return;
+    }
+    if (g_base_valid)
+        g_deltas++;
+    else
+        g_keys++;
+    g_bytes += (uint64_t)(d - g_out);
+    g_raw_bytes += pixels;
+    memcpy(g_base, g_latest, pixels);
+    g_base_valid = 1;
+    g_pending = 0;
+    g_sent_us = I_StreamNowUs();
+}
+
+static void* I_StreamThread(void* arg)
+{
+    (void)arg;
+    while (g_running)
+    {
+        const mailslot_t* work = I_MailboxTake(&g_mailbox, STREAM_WAIT_MS, &g_running);
+
+        if (work)
+        {
+            if (g_pending && g_peer >= 0)
+                g_dropped++;
+            for (int y = 0; y < g_height; y++)
+                memcpy(g_latest + y * g_width, work->frame + y * SCREENWIDTH, (size_t)g_width);
+            memcpy(g_latest_pal, work->pal, sizeof(g_latest_pal));
+            g_latest_us = work->time_us;
+            g_latest_seq = work->seq;
+            g_have_latest = 1;
+            g_pending = 1;
+        }
+        I_StreamConnect();
+        // with 2 ms of slack for tic jitter
+        if (g_peer >= 0 && g_pending && g_running
+            && I_StreamNowUs() - g_sent_us + 2000 >= g_period_us)
+            I_StreamFlush();
+    }
+    return NULL;
+}
+
+static void I_StreamRelease(void)
+{
+    if (g_peer >= 0)
+        close(g_peer);
+    if (g_listen >= 0)
+        close(g_listen);
+    g_peer = g_listen = -1;
+}
+
+int doom_stream_start(const char* output)
+{
+    int fps;
+
+    if (!output || !output[0])
+        return -1;
+    if (g_started)
+        return 0;
+    if (I_StreamParse(output) < 0 || (!g_host[0] && I_StreamOpenListener() < 0))
+        return -1;
+
+    g_width = screenwidth;
+    g_height = screenheight;
+    fps = I_StreamEnvInt("UBO_DOOM_STREAM_FPS", TICRATE);
+    if (fps < 1 || fps > TICRATE)
+        fps = TICRATE;
+    g_period_us = 1000000u / (unsigned)fps;
+
+    snprintf(g_outname, sizeof(g_outname), "%s", output);
+    g_keys = g_deltas = g_palettes = g_replaced = g_dropped = g_viewers = 0;
+    g_bytes = g_raw_bytes = 0;
+    g_sent_us = 0;
+    g_seq = 0;
+    I_MailboxReset(&g_mailbox);
+    g_have_latest = g_pending = g_base_valid = 0;
+    g_connect_failed = 0;
+    g_retry_us = 0;
+    g_running = 1;
+    if (pthread_create(&g_thread, NULL, I_StreamThread, NULL) != 0)
+    {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] stream: can't start the stream thread\n");
+        g_running = 0;
+        I_StreamRelease();
+        return -1;
+    }
+    g_started = 1;
+    UBO_LOG(UBO_LOG_INFO, "[doom] stream: %dx%d palette frames, %s %s:%s\n", g_width, g_height,
+            g_host[0] ? "connecting to" : "listening on", g_host[0] ? g_host : "*", g_port);
+    return 0;
+}
+
+void doom_stream_stop(void)
+{
+    if (!g_started)
+        return;
+    g_running = 0;
+    I_MailboxWake(&g_mailbox);
+    pthread_join(g_thread, NULL);
+    UBO_LOG(UBO_LOG_INFO, "[doom] stream: %u key + %u delta frames and %u palettes, %llu KB sent for "
+            "%llu KB of pixels, %u skipped for the rate cap or a slow viewer, %u "
+            "replaced in the mailbox, %u viewers\n", g_keys, g_deltas, g_palettes,
+            (unsigned long long)(g_bytes / 1024), (unsigned long long)(g_raw_bytes / 1024),
+            g_dropped, g_replaced, g_viewers);
+    I_StreamRelease();
+    g_started = 0;
+}
+
+int doom_stream_active(void) { return g_started && g_running; }
+
+// Unlike I_CaptureFrame every frame goes in: the thread applies the rate
+// cap, so the newest one is there to send when the cap allows.
+void I_StreamFrame(const byte* src, const byte* palette)
+{
+    if (!g_running || screenwidth != g_width || screenheight != g_height)
+        return;
+
+    if (I_MailboxPost(&g_mailbox, src, palette, I_StreamNowUs(), ++g_seq))
+        g_replaced++;
+}
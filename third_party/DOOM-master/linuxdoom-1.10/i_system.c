@@ -30,9 +30,17 @@ rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 #include <setjmp.h>
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__ARM_NEON) && defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
 #include "doomdef.h"
 #include "m_misc.h"
 #include "i_video.h"
@@ -40,6 +48,7 @@ rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 
 #include "d_net.h"
 #include "g_game.h"
+#include "i_log.h"
 
 #ifdef __GNUG__
 #pragma implementation "i_system.h"
@@ -74,30 +83,208 @@ int  I_GetHeapSize (void)
     return mb_used*1024*1024;
 }
 
+//
+// Zone pages (UBO_DOOM_ZONE_MMAP, UBO_DOOM_ZONE_MLOCK).
+// malloc leaves the zone to be faulted in a page at a time, mostly
+//  during the first level.  Mapped, it starts on a huge page boundary,
+//  asks for transparent huge pages and has every page faulted in up
+//  front; locked, it can't be swapped out either, and Z_ReleaseFree
+//  can't hand its free pages back.  Each step that fails is logged and
+//  the zone works without it.  The mapped bases are remembered, so a
+//  zone keeps the kind of free it was allocated with when the options
+//  change between sessions.
+//
+int	zonemmap;
+int	zonemlock;
+
+#define ZONEHUGE	(2*1024*1024)
+#define MAXZONEMAPS	32
+
+static byte*	zonemaps[MAXZONEMAPS];
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE	23
+#endif
+
+static size_t I_ZoneMapLength (int size)
+{
+    return ((size_t)size + ZONEHUGE-1) & ~(size_t)(ZONEHUGE-1);
+}
+
+static byte* I_ZoneMap (int size)
+{
+    size_t	length = I_ZoneMapLength (size);
+    size_t	page = (size_t)sysconf (_SC_PAGESIZE);
+    uintptr_t	raw;
+    uintptr_t	base;
+    size_t	i;
+    size_t	slot;
+    int		locked;
+
+    for (i = 0 ; i < MAXZONEMAPS && zonemaps[i] ; i++)
+	;
+    if (i == MAXZONEMAPS)
+	return (byte *) malloc (size);
+    slot = i;
+
+    // over-map by a huge page, then trim to an aligned run
+    raw = (uintptr_t)mmap (NULL, length + ZONEHUGE, PROT_READ|PROT_WRITE,
+			   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if ((void *)raw == MAP_FAILED)
+    {
+	UBO_LOG (UBO_LOG_ERROR, "[doom] zone: can't map %d KB, using malloc\n",
+		 size >> 10);
+	return (byte *) malloc (size);
+    }
+    base = (raw + ZONEHUGE-1) & ~(uintptr_t)(ZONEHUGE-1);
+    if (base > raw)
+	munmap ((void *)raw, base - raw);
+    if (raw + ZONEHUGE > base)
+	munmap ((void *)(base + length), raw + ZONEHUGE - base);
+
+#ifdef MADV_HUGEPAGE
+    if (madvise ((void *)base, length, MADV_HUGEPAGE))
+	UBO_LOG (UBO_LOG_INFO, "[doom] zone: no transparent huge pages\n");
+#endif
+    if (madvise ((void *)base, length, MADV_POPULATE_WRITE))
+    {
+	// before Linux 5.14: touch every page instead
+	for (i = 0 ; i < length ; i += page)
+	    ((volatile byte *)base)[i] = 0;
+    }
+    locked = zonemlock && !mlock ((void *)base, length);
+    if (zonemlock && !locked)
+	UBO_LOG (UBO_LOG_ERROR, "[doom] zone: can't lock %d KB (RLIMIT_MEMLOCK?)\n",
+		 size >> 10);
+
+    UBO_LOG (UBO_LOG_INFO, "[doom] zone: %d KB mapped%s\n", size >> 10,
+	     locked ? " and locked" : "");
+    zonemaps[slot] = (byte *) base;
+    return (byte *) base;
+}
+
 byte* I_ZoneBase (int*	size)
 {
-    *size = mb_used*1024*1024;
+    // a positive *size asks for that many bytes (chained zones)
+    if (*size <= 0)
+	*size = mb_used*1024*1024;
+    if (zonemmap || zonemlock)
+	return I_ZoneMap (*size);
     return (byte *) malloc (*size);
 }
 
+void I_ZoneFree (byte* base, int size)
+{
+    int		i;
+
+    for (i = 0 ; i < MAXZONEMAPS ; i++)
+    {
+	if (zonemaps[i] == base)
+	{
+	    zonemaps[i] = NULL;
+	    munmap (base, I_ZoneMapLength (size));
+	    return;
+	}
+    }
+    free (base);
+}
+
+
+//
+// I_ResidentBytes
+// How much of [base, base+size) is in RAM now, in whole pages
+//  (mincore).  The range must be mapped; 0 if the kernel says no.
+//
+int I_ResidentBytes (const void* base, int size)
+{
+    static unsigned char*	vec;
+    static size_t		veclen;
+    uintptr_t	page = (uintptr_t)sysconf (_SC_PAGESIZE);
+    uintptr_t	start = (uintptr_t)base & ~(page-1);
+    uintptr_t	end = ((uintptr_t)base + size + page-1) & ~(page-1);
+    size_t	pages = (end - start) / page;
+    size_t	i;
+    int		resident = 0;
+
+    if (size <= 0)
+	return 0;
+    if (pages > veclen)
+    {
+	free (vec);
+	vec = malloc (pages);
+	veclen = vec ? pages : 0;
+	if (!vec)
+	    return 0;
+    }
+    if (mincore ((void *)start, end - start, vec))
+	return 0;
+    for (i = 0 ; i < pages ; i++)
+	resident += vec[i] & 1;
+    return resident * (int)page;
+}
+
+
+
+//
+// TIME SOURCE
+// UBO: CLOCK_MONOTONIC from the first call on, or the virtual clock
+//  I_SetVirtualTime switches to, which only moves when I_AdvanceTime
+//  moves it.  Virtual time is kept in 1/TICRATE microseconds so that a
+//  tic is a whole step.  Each switch carries on from the time the other
+//  clock had reached, so waits on I_GetTime never see it run backwards.
+//
+boolean		virtualtime;
+
+static int64_t	timebase = -1;		// us of CLOCK_MONOTONIC at time 0
+static int64_t	vclock;			// virtual us * TICRATE
+
+static int64_t I_MonotonicUs (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t I_GetTimeUs (void)
+{
+    int64_t	now;
+
+    if (virtualtime)
+	return vclock / TICRATE;
+    now = I_MonotonicUs ();
+    if (timebase < 0)
+	timebase = now;
+    return now - timebase;
+}
+
+void I_SetVirtualTime (boolean on)
+{
+    if (on == virtualtime)
+	return;
+    if (on)
+	vclock = I_GetTimeUs () * TICRATE;
+    else
+	timebase = I_MonotonicUs () - vclock / TICRATE;
+    virtualtime = on;
+}
+
+void I_AdvanceTime (int64_t us, int tics)
+{
+    if (virtualtime)
+	vclock += us * TICRATE + (int64_t)tics * 1000000;
+}
 
 
 //
 // I_GetTime
-// returns time in 1/70th second tics
+// returns time in 1/35th second tics
 //
 int  I_GetTime (void)
 {
-    struct timeval	tp;
-    struct timezone	tzp;
-    int			newtics;
-    static int		basetime=0;
-  
-    gettimeofday(&tp, &tzp);
-    if (!basetime)
-	basetime = tp.tv_sec;
-    newtics = (tp.tv_sec-basetime)*TICRATE + tp.tv_usec*TICRATE/1000000;
-    return newtics;
+    if (virtualtime)
+	return vclock / 1000000;
+    return I_GetTimeUs () * TICRATE / 1000000;
 }
 
 
@@ -107,7 +294,12 @@ int  I_GetTime (void)
 //
 void I_Init (void)
 {
-    I_InitSound();
+    extern int ubo_prewarming;
+
+    // doom_prewarm: the device is opened when doom_init takes the engine over.
+    if (!ubo_prewarming)
+	I_InitSound();
+    I_InitMusic();
     //  I_InitGraphics();
 }
 
@@ -155,11 +347,54 @@ byte*	I_AllocLow(int length)
 }
 
 
+//
+// I_CpuHasSimd
+//
+int I_CpuHasSimd (void)
+{
+#if defined(__ARM_NEON) && defined(__arm__)
+    // armv7 built with -mfpu=neon can still land on a core without it.
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#elif defined(__ARM_NEON) || defined(__SSE2__)
+    // Advanced SIMD is mandatory on aarch64, SSE2 on x86-64.
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+//
+// I_GrowArray
+//
+void*
+I_GrowArray
+( void*		array,
+  int*		max,
+  int		size,
+  int		initial,
+  char*		what )
+{
+    int		newmax;
+    void*	grown;
+
+    newmax = *max ? *max*2 : initial;
+    grown = realloc (array, (size_t)newmax*size);
+    if (!grown)
+	I_Error ("I_GrowArray: no memory for %i %s", newmax, what);
+
+    *max = newmax;
+    return grown;
+}
+
+
 //
 // I_Error
 //
 extern boolean demorecording;
 
+__thread jmp_buf*	i_errorjmp;
+
 void I_Error (char *error, ...)
 {
     va_list	argptr;
@@ -173,6 +408,9 @@ void I_Error (char *error, ...)
 
     fflush( stderr );
 
+    if (i_errorjmp)
+	longjmp (*i_errorjmp, 1);
+
     // In library mode, jumping out via longjmp instead of exit() to avoid
     // killing the host process (ubo_app).
     {
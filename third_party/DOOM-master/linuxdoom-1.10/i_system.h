@@ -23,6 +23,9 @@
 #ifndef __I_SYSTEM__
 #define __I_SYSTEM__
 
+#include <setjmp.h>
+#include <stdint.h>
+
 #include "d_ticcmd.h"
 #include "d_event.h"
 
@@ -37,13 +40,29 @@ void I_Init (void);
 // Called by startup code
 // to get the ammount of memory to malloc
 // for the zone management.
+// A positive *size requests that many bytes instead of the default.
 byte*	I_ZoneBase (int *size);
+void	I_ZoneFree (byte* base, int size);	// size as I_ZoneBase gave it
+// Bytes of a mapped range resident in RAM (tic thread only).
+int	I_ResidentBytes (const void* base, int size);
+// Map the zone with huge pages and fault it in at once; also mlock it.
+extern int	zonemmap;
+extern int	zonemlock;
+int	I_GetHeapSize (void);
 
 
 // Called by D_DoomLoop,
 // returns current time in tics.
 int I_GetTime (void);
 
+// UBO: the time I_GetTime counts in microseconds, CLOCK_MONOTONIC or
+// with virtualtime a clock that only I_AdvanceTime moves, by us plus
+// whole tics (it does nothing on the monotonic clock).  Tic thread.
+extern boolean	virtualtime;
+int64_t	I_GetTimeUs (void);
+void	I_SetVirtualTime (boolean on);
+void	I_AdvanceTime (int64_t us, int tics);
+
 
 //
 // Called by D_DoomLoop,
@@ -83,11 +102,31 @@ void I_Quit (void);
 // just mallocs under unix
 byte* I_AllocLow (int length);
 
+// True when the NEON or SSE2 code this was built with (the
+// i_video_ubo.c converters, R_DrawSpanSimd) can run on this CPU.
+int I_CpuHasSimd (void);
+
+// Regrows a malloced pool of *max items of size bytes to twice
+// that (initial items if empty) and updates *max.  Pools grown
+// this way are kept and reused; I_Error if out of memory.
+void*
+I_GrowArray
+( void*		array,
+  int*		max,
+  int		size,
+  int		initial,
+  char*		what );
+
 void I_Tactile (int on, int off, int total);
 
 
 void I_Error (char *error, ...);
 
+// Set by threads other than the engine's own (the r_main.c render
+// workers): I_Error prints and longjmps there instead, and that thread
+// hands the failure back to the engine thread.
+extern __thread jmp_buf*	i_errorjmp;
+
 
 #endif
 //-----------------------------------------------------------------------------
@@ -0,0 +1,23 @@
+#ifndef __I_THREAD__
+#define __I_THREAD__
+
+#include <stdint.h>
+
+// Thread placement, i_thread_ubo.c (doom_set_thread_policy and the
+// UBO_DOOM_*_POLICY variables).  Each engine thread calls I_ThreadPoll
+// with its class once per loop; when the class's policy changed since the
+// thread last looked, it moves itself: CPU affinity, then SCHED_FIFO or
+// SCHED_OTHER.  Polling is one relaxed load and a compare, and a class
+// nobody set a policy for leaves its threads as they were created.
+
+// kind is a UBO_THREAD_* class; cpus a CPU mask (bit n = CPU n, 0 = any),
+// priority 1..99 for SCHED_FIFO, 0 for SCHED_OTHER.  -1 for a bad kind.
+int I_ThreadSetPolicy(int kind, uint64_t cpus, int priority);
+
+// Reads UBO_DOOM_TIC_POLICY, _AUDIO_, _DISPLAY_ and _RENDER_POLICY:
+// "CPUS[:PRIO]", CPUS a list like "3" or "0,2-3" (empty = any).
+void I_ThreadPolicyFromEnv(void);
+
+void I_ThreadPoll(int kind);
+
+#endif
@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "doom_api.h"
+#include "i_log.h"
+#include "i_thread.h"
+
+// A class's policy is written under g_policy_lock and published by bumping
+// its gen; gen 0 means never set.  Every thread keeps the gen it last
+// applied per class, so a thread that polls for the first time after a
+// policy was set applies it too (a render worker started later, or a new
+// host thread calling doom_tick()).
+typedef struct {
+    atomic_uint gen;
+    uint64_t cpus;
+    int priority;
+} threadpolicy_t;
+
+static threadpolicy_t g_policy[UBO_THREAD_NUM];
+static pthread_mutex_t g_policy_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread unsigned t_seen[UBO_THREAD_NUM];
+
+static const char* const g_thread_names[UBO_THREAD_NUM] = {
+    "tic", "audio", "display", "render",
+};
+
+static const char* const g_thread_env[UBO_THREAD_NUM] = {
+    "UBO_DOOM_TIC_POLICY", "UBO_DOOM_AUDIO_POLICY",
+    "UBO_DOOM_DISPLAY_POLICY", "UBO_DOOM_RENDER_POLICY",
+};
+
+int I_ThreadSetPolicy(int kind, uint64_t cpus, int priority)
+{
+    if (kind < 0 || kind >= UBO_THREAD_NUM || priority < 0 || priority > 99)
+        return -1;
+    pthread_mutex_lock(&g_policy_lock);
+    g_policy[kind].cpus = cpus;
+    g_policy[kind].priority = priority;
+    atomic_fetch_add_explicit(&g_policy[kind].gen, 1, memory_order_release);
+    pthread_mutex_unlock(&g_policy_lock);
+    return 0;
+}
+
+// "0,2-3" -> 0xd; -1 on anything else.  "" and "any" are 0.
+static int I_ThreadParseCpus(const char* s, uint64_t* cpus)
+{
+    char* end;
+    long lo, hi;
+
+    *cpus = 0;
+    if (!*s || !strcmp(s, "any"))
+        return 0;
+    for (;;) {
+        if (!isdigit((unsigned char)*s))
+            return -1;
+        lo = hi = strtol(s, &end, 10);
+        if (*end == '-') {
+            s = end + 1;
+            if (!isdigit((unsigned char)*s))
+                return -1;
+            hi = strtol(s, &end, 10);
+        }
+        if (lo > hi || hi >= 64)
+            return -1;
+        for (; lo <= hi; lo++)
+            *cpus |= 1ull << lo;
+        if (*end != ',')
+            return *end ? -1 : 0;
+        s = end + 1;
+    }
+}
+
+void I_ThreadPolicyFromEnv(void)
+{
+    char buf[128];
+    char* colon;
+    char* end;
+    uint64_t cpus;
+    long priority;
+    int kind;
+
+    for (kind = 0; kind < UBO_THREAD_NUM; kind++) {
+        const char* env = getenv(g_thread_env[kind]);
+
+        if (!env || !env[0])
+            continue;
+        snprintf(buf, sizeof(buf), "%s", env);
+        priority = 0;
+        colon = strchr(buf, ':');
+        if (colon) {
+            *colon = '\0';
+            priority = strtol(colon + 1, &end, 10);
+            if (end == colon + 1 || *end)
+                priority = -1;
+        }
+        if (I_ThreadParseCpus(buf, &cpus) < 0
+            || I_ThreadSetPolicy(kind, cpus, (int)priority) < 0)
+            UBO_LOG(UBO_LOG_ERROR, "[doom] %s=%s: expected CPUS[:PRIO], e.g. \"2-3:20\"\n",
+                    g_thread_env[kind], env);
+    }
+}
+
+static void I_ThreadApply(int kind, uint64_t cpus, int priority)
+{
+    struct sched_param param;
+    cpu_set_t set;
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    int tid = (int)syscall(SYS_gettid);
+    int failed = 0;
+    int err;
+    int i;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < 64 && i < CPU_SETSIZE; i++)
+        if (cpus ? (cpus >> i) & 1 : i < ncpus)
+            CPU_SET(i, &set);
+    err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] %s thread %d: CPUs 0x%llx: %s\n",
+                g_thread_names[kind], tid, (unsigned long long)cpus, strerror(err));
+        failed = 1;
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    if (priority > sched_get_priority_max(SCHED_FIFO))
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    // no CAP_SYS_NICE or RLIMIT_RTPRIO: not fatal, the thread keeps running
+    err = pthread_setschedparam(pthread_self(), priority ? SCHED_FIFO : SCHED_OTHER, &param);
+    if (err) {
+        UBO_LOG(UBO_LOG_ERROR, "[doom] %s thread %d: no %s %d: %s\n", g_thread_names[kind], tid,
+                priority ? "SCHED_FIFO" : "SCHED_OTHER", param.sched_priority, strerror(err));
+        failed = 1;
+    }
+    if (!failed)
+        UBO_LOG(UBO_LOG_INFO, "[doom] %s thread %d: CPUs 0x%llx (0 = any), %s %d\n",
+                g_thread_names[kind], tid, (unsigned long long)cpus,
+                priority ? "SCHED_FIFO" : "SCHED_OTHER", param.sched_priority);
+}
+
+void I_ThreadPoll(int kind)
+{
+    unsigned gen = atomic_load_explicit(&g_policy[kind].gen, memory_order_relaxed);
+    uint64_t cpus;
+    int priority;
+
+    if (gen == t_seen[kind])
+        return;
+    pthread_mutex_lock(&g_policy_lock);
+    t_seen[kind] = atomic_load_explicit(&g_policy[kind].gen, memory_order_relaxed);
+    cpus = g_policy[kind].cpus;
+    priority = g_policy[kind].priority;
+    pthread_mutex_unlock(&g_policy_lock);
+    I_ThreadApply(kind, cpus, priority);
+}
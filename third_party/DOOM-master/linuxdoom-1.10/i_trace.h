@@ -0,0 +1,34 @@
+#ifndef __I_TRACE__
+#define __I_TRACE__
+
+// Timeline trace, i_trace_ubo.c (UBO_DOOM_TRACE, doom_trace_dump).
+// Scoped markers around engine phases record one complete event each:
+// name, start and duration.  Every thread writes a ring of its own, so a
+// marker takes no lock and makes no syscall beyond clock_gettime; each
+// ring keeps the thread's last events.  I_TraceDump writes every ring as
+// Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open.
+// Off, each marker is a single branch.
+
+// Nonzero while recording.  Names ("load_level") are kept by pointer,
+// so pass string literals.
+extern int ubo_trace_enabled;
+
+#define UBO_TRACE_BEGIN(name) \
+    do { if (ubo_trace_enabled) I_TraceBegin(name); } while (0)
+#define UBO_TRACE_END() \
+    do { if (ubo_trace_enabled) I_TraceEnd(); } while (0)
+
+void I_TraceBegin(const char* name);
+void I_TraceEnd(void);              // closes the innermost open marker
+
+// events <= 0 stops recording, 1 picks the default ring size, more asks
+// for that many events per thread (rounded up to a power of two).  The
+// rings are sized by the first call that turns tracing on.
+void I_TraceSetEnabled(int events);
+
+// Writes every thread's events, oldest first, to path; the events
+// written, or -1 if path can't be written.  Safe from any thread while
+// others keep recording.
+int I_TraceDump(const char* path);
+
+#endif
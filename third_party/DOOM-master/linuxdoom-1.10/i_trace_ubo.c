@@ -0,0 +1,213 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i_trace.h"
+
+// One ring per thread, found through a thread-local pointer.  A thread's
+// first marker takes a free ring off g_trace_rings (a ring whose thread
+// has exited is handed back by the key destructor) or pushes a new one with a
+// compare-and-swap; rings are never unlinked, so the dump walks the list
+// without a lock.  Only the owner writes a ring: it fills event n % size,
+// then publishes head = n + 1.  The dump copies a ring's events and reads
+// head again afterwards; an event the owner may have been rewriting
+// meanwhile (a whole ring ahead) is left out instead of coming out torn.
+#define UBO_TRACE_DEFAULT 16384     // events per thread
+#define UBO_TRACE_DEPTH   16        // open markers per thread
+
+typedef struct {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    int tid;
+} traceevent_t;
+
+typedef struct tracering_s {
+    struct tracering_s* next;
+    atomic_int owned;
+    atomic_uint head;               // events written
+    int tid;
+    unsigned gen;                   // g_trace_gen the open markers belong to
+    int depth;
+    const char* open_name[UBO_TRACE_DEPTH];
+    uint64_t open_ns[UBO_TRACE_DEPTH];
+    traceevent_t events[];          // g_trace_size
+} tracering_t;
+
+int ubo_trace_enabled = 0;
+
+static _Atomic(tracering_t*) g_trace_rings;
+static unsigned g_trace_size;       // power of two, fixed once set
+static atomic_uint g_trace_gen;     // bumped by every enable
+static __thread tracering_t* t_ring;
+static pthread_key_t g_trace_key;
+static pthread_once_t g_trace_once = PTHREAD_ONCE_INIT;
+
+static uint64_t I_TraceNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void I_TraceThreadExit(void* ring)
+{
+    atomic_store_explicit(&((tracering_t*)ring)->owned, 0, memory_order_release);
+}
+
+static void I_TraceMakeKey(void)
+{
+    pthread_key_create(&g_trace_key, I_TraceThreadExit);
+}
+
+static tracering_t* I_TraceRing(void)
+{
+    tracering_t* ring;
+    int expect;
+
+    if (t_ring)
+        return t_ring;
+
+    for (ring = atomic_load_explicit(&g_trace_rings, memory_order_acquire);
+         ring; ring = ring->next) {
+        expect = 0;
+        if (atomic_compare_exchange_strong(&ring->owned, &expect, 1))
+            break;
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(*ring) + g_trace_size * sizeof(traceevent_t));
+        if (!ring)
+            return NULL;
+        atomic_store_explicit(&ring->owned, 1, memory_order_relaxed);
+        ring->next = atomic_load_explicit(&g_trace_rings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&g_trace_rings, &ring->next, ring,
+                                                      memory_order_release,
+                                                      memory_order_relaxed))
+            ;
+    }
+    ring->tid = (int)syscall(SYS_gettid);
+    ring->depth = 0;
+    pthread_once(&g_trace_once, I_TraceMakeKey);
+    pthread_setspecific(g_trace_key, ring);
+    t_ring = ring;
+    return ring;
+}
+
+void I_TraceBegin(const char* name)
+{
+    tracering_t* ring = I_TraceRing();
+    unsigned gen = atomic_load_explicit(&g_trace_gen, memory_order_relaxed);
+
+    if (!ring)
+        return;
+    if (ring->gen != gen) {
+        ring->gen = gen;
+        ring->depth = 0;
+    }
+    if (ring->depth < UBO_TRACE_DEPTH) {
+        ring->open_name[ring->depth] = name;
+        ring->open_ns[ring->depth] = I_TraceNow();
+    }
+    ring->depth++;
+}
+
+void I_TraceEnd(void)
+{
+    tracering_t* ring = t_ring;
+    traceevent_t* ev;
+    unsigned n;
+
+    // a marker opened before tracing was (re)started has no begin here
+    if (!ring || ring->gen != atomic_load_explicit(&g_trace_gen, memory_order_relaxed)
+        || ring->depth == 0)
+        return;
+    if (--ring->depth >= UBO_TRACE_DEPTH)
+        return;
+
+    n = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ev = &ring->events[n & (g_trace_size - 1)];
+    ev->name = ring->open_name[ring->depth];
+    ev->start_ns = ring->open_ns[ring->depth];
+    ev->dur_ns = I_TraceNow() - ev->start_ns;
+    ev->tid = ring->tid;
+    atomic_store_explicit(&ring->head, n + 1, memory_order_release);
+}
+
+void I_TraceSetEnabled(int events)
+{
+    unsigned size = 1;
+
+    if (events <= 0) {
+        ubo_trace_enabled = 0;
+        return;
+    }
+    if (!g_trace_size) {
+        if (events == 1)
+            events = UBO_TRACE_DEFAULT;
+        while (size < (unsigned)events && size < (1u << 24))
+            size <<= 1;
+        g_trace_size = size;
+    }
+    if (!ubo_trace_enabled)
+        atomic_fetch_add_explicit(&g_trace_gen, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    ubo_trace_enabled = 1;
+}
+
+int I_TraceDump(const char* path)
+{
+    FILE* f;
+    tracering_t* ring;
+    traceevent_t* copy;
+    traceevent_t* ev;
+    unsigned head;
+    unsigned now;
+    unsigned first;
+    unsigned keep;
+    unsigned n;
+    int pid = (int)getpid();
+    int written = 0;
+
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+    copy = g_trace_size ? malloc(g_trace_size * sizeof(*copy)) : NULL;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+               "\"args\":{\"name\":\"doom\"}}", pid);
+    for (ring = atomic_load_explicit(&g_trace_rings, memory_order_acquire);
+         ring && copy; ring = ring->next) {
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        first = head > g_trace_size ? head - g_trace_size : 0;
+        for (n = first; n != head; n++)
+            copy[n - first] = ring->events[n & (g_trace_size - 1)];
+
+        // the owner may have been rewriting event now - size meanwhile
+        atomic_thread_fence(memory_order_acquire);
+        now = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        keep = now - first >= g_trace_size ? now - g_trace_size + 1 : first;
+        for (n = keep; (int)(head - n) > 0; n++) {
+            ev = &copy[n - first];
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                       "\"ts\":%llu.%03u,\"dur\":%llu.%03u}",
+                    ev->name, pid, ev->tid,
+                    (unsigned long long)(ev->start_ns / 1000),
+                    (unsigned)(ev->start_ns % 1000),
+                    (unsigned long long)(ev->dur_ns / 1000),
+                    (unsigned)(ev->dur_ns % 1000));
+            written++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    free(copy);
+    if (fclose(f) != 0)
+        return -1;
+    return written;
+}
@@ -45,6 +45,52 @@ void I_SetPalette (byte* palette);
 void I_UpdateNoBlit (void);
 void I_FinishUpdate (void);
 
+// Set by D_Display before I_FinishUpdate when the status bar rows
+//  are as the last frame left them, so they need not be converted again.
+extern boolean sbarclean;
+
+// Set by D_Display when screens[0] is the picture the last frame showed;
+//  the conversion and the frame hand-over are then skipped.
+extern boolean framestatic;
+
+// Direct RGB565 view (doom_set_direct565), i_video_ubo.c.
+// I_Direct565Frame: true if the coming frame's view can go straight to
+//  RGB565 as far as the output is concerned (format, filter, nothing that
+//  reads the 8-bit picture); brings colormaps565 up to date for it.
+// I_Direct565ToIndex: after such a frame, fills the view window of
+//  screens[0] back in from screen565, for whatever reads it next (the
+//  wipe, the loading screen, frame hashes, screenshots).  A no-op when
+//  screens[0] is already current.
+boolean I_Direct565Frame (void);
+void I_Direct565ToIndex (void);
+
+// Shared-memory frame export, i_frameshm_ubo.c (frameshm.h).
+// I_FrameShmStart returns 0 unless UBO_DOOM_FRAMESHM names an object
+// it could create; I_FrameShmPublish is a no-op while none is open.
+int I_FrameShmStart (void);
+void I_FrameShmStop (void);
+int I_FrameShmActive (void);
+void I_FrameShmPublish (int format, const void* pixels, int width, int height, int stride);
+
+// H.264 capture, i_capture_ubo.c (doom_capture_start).
+// Takes a copy of the shown 8-bit frame and its palette for the capture
+// thread; a no-op while no capture runs.
+void I_CaptureFrame (const byte* src, const byte* palette);
+
+// Remote framebuffer stream, i_stream_ubo.c (doom_stream_start).
+// Same hand-off as I_CaptureFrame, for the stream thread.
+void I_StreamFrame (const byte* src, const byte* palette);
+
+// KMS HDMI output, i_drm_ubo.c (doom_hdmi_open).
+// Same hand-off again, for the page-flipping thread.
+void I_HdmiFrame (const byte* src, const byte* palette);
+
+// Screenshots, i_video_ubo.c (M_ScreenShot, doom_screenshot).
+// The next shown frame is written to name as a PNG: the 8-bit picture
+// with its palette, or the 240x240 letterboxed LCD frame when lcd is set.
+// Returns false while another shot is pending.
+boolean I_RequestScreenShot (char const* name, boolean lcd);
+
 // Wait for vertical retrace or pause a bit.
 void I_WaitVBL(int count);
 
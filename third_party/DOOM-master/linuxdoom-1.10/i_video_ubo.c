@@ -1,41 +1,526 @@
 #include "doom_api.h"
 
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "doomdef.h"
+#include "doomstat.h"
+#include "frameshm.h"
 #include "i_system.h"
 #include "i_video.h"
+#include "m_misc.h"
+#include "r_local.h"
+#include "st_stuff.h"
 #include "v_video.h"
 #include "w_wad.h"
 #include "z_zone.h"
 
 // Headless video backend:
 // - No X11, no input polling here.
-// - Converts Doom's 8-bit paletted screen (screens[0]) into a 320x200 RGBA8888 buffer (ubo_rgba).
+// - Converts Doom's 8-bit paletted screen (screens[0]) into either a 320x200
+//   RGBA8888 buffer (ubo_rgba) or a ready-to-blit 240x240 letterboxed RGB565
+//   big-endian frame in the doom_api.c frame ring, or just packs it into
+//   ubo_index8 with its RGB565 palette alongside, depending on
+//   doom_set_output_format().
+// - The RGB565 frame is turned for the panel (doom_set_lcd_orientation) as
+//   it is scaled: each row is stored where the orientation puts it.
+// - With UBO_DOOM_LCD_RES=1 the engine already drew a 240x150 picture
+//   (screenwidth x screenheight); it is converted 1:1 with no scaling, and
+//   the RGBA buffer holds it packed at 240 pixels a row.
+// - With doom_set_direct565() a level frame's view window arrives already
+//   in RGB565 (screen565, view565) and is only copied or sampled.
 
 static int g_inited = 0;
-static byte* g_palette = NULL;   // 256 * 3 RGB
+static int g_have_palette = 0;
+
+// Every PLAYPAL palette under every gamma level, converted once per
+// I_InitGraphics: ST_doPaletteStuff flashes between them several times a
+// second, so a switch only repoints the current set.  The last set holds a
+// palette that did not come from PLAYPAL.
+#define UBO_NUMPALETTES     14
+#define UBO_NUMGAMMA        5
+#define UBO_CUSTOM_SET      (UBO_NUMPALETTES * UBO_NUMGAMMA)
+
+static byte g_palrgb[UBO_CUSTOM_SET + 1][256 * 3];     // gamma-corrected R,G,B
+static uint16_t g_pal565[UBO_CUSTOM_SET + 1][256];     // RGB565, stored big-endian
+static uint32_t g_pal32[UBO_CUSTOM_SET + 1][256];      // R,G,B,255 in memory order
+static int g_numpalettes = 0;        // PLAYPAL palettes converted (a PWAD may ship fewer)
+static int g_playpal_lump = -1;
+static int g_palnum = 0;             // PLAYPAL palette shown, -1 for the custom set
+static int g_palgamma = 0;           // usegamma the current set was picked for
+
+static byte* g_palette = g_palrgb[0];       // current set; what captures and shots see
+static const uint16_t* g_lut565 = g_pal565[0];
+static const uint32_t* g_lut32 = g_pal32[0];
+static uint64_t g_lutwide[256];      // palette index -> r | g<<20 | b<<40 (filter accumulator)
+static const uint32_t* g_lutwide_for = NULL;   // g_lut32 g_lutwide was derived from
+
+// Precomputed 2-tap scaling kernel for one axis: output pixel i blends source
+// pixels src0[i] and src1[i] with weights w0[i] + w1[i] == 16.  Nearest is the
+// degenerate case src0 == src1, w0 == 16.
+typedef struct
+{
+    int src0;
+    int src1;
+    int w0;
+    int w1;
+} scaletap_t;
+
+static scaletap_t g_xtaps[UBO_LCD_WIDTH];
+static scaletap_t g_xtaps_rev[UBO_LCD_WIDTH];   // g_xtaps right to left, for mirrored rows
+static scaletap_t g_ytaps[UBO_LCD_ACTIVE_HEIGHT];
+static ubo_scale_filter_t g_taps_filter = -1;   // filter the tap tables were built for
+
+// Where an orientation puts the upright letterboxed picture: its pixel
+// (x, y) goes to frame index origin + x * sx + y * sy.  Rows that stay
+// rows (sx = +-1) go through the row kernels, reversed ones with
+// g_xtaps_rev; rows that become columns (sx = +-240) are stored strided.
+typedef struct
+{
+    int origin;
+    int sx;
+    int sy;
+} orient_t;
+
+static const orient_t g_upright = { 0, 1, UBO_LCD_WIDTH };
+
+// Status bar cache (UBO_DOOM_STATUSBAR_CACHE): the RGB565 rows taken only
+// from status bar pixels, as converted for the last frame.  When D_Display
+// reports the bar unchanged (sbarclean) they are copied into the frame
+// instead of being scaled and looked up again.  Any palette, filter or
+// output format change drops them.
+boolean sbarclean;
+
+static int g_sbar_y = UBO_LCD_ACTIVE_HEIGHT;    // first status bar row
+static int g_sbar_valid = 0;
+static int g_cached_layout = 0;                 // LCD orientation of the cached rows
+static uint16_t g_sbar565[UBO_LCD_ACTIVE_HEIGHT * UBO_LCD_WIDTH];
+
+// View border cache (UBO_DOOM_BORDER_CACHE): with the view shrunk
+// (screenblocks < 10) the rows above and below it show only the border
+// R_FillBackScreen tiled.  Each band keeps the screens[0] rows its LCD
+// rows were scaled from and the RGB565 rows they became; while those
+// source rows are unchanged the LCD rows are copied instead of converted,
+// and the dirty rect tracker skips them.  A HU message or the menu over
+// the border just has the band converted, and kept, again.
+typedef struct
+{
+    int y0, y1;         // active LCD rows, empty when y1 == y0
+    int src0, src1;     // screens[0] rows they sample, src1 included
+    int valid;
+} borderband_t;
+
+static borderband_t g_border[2];                // above the view, below it
+static byte g_border8[SCREENWIDTH * SCREENHEIGHT];
+static uint16_t g_border565[UBO_LCD_ACTIVE_HEIGHT * UBO_LCD_WIDTH]; // at y0 * UBO_LCD_WIDTH
+
+// Palette, filter and output format changes: no cached row is what the
+// next frame would convert.
+static void I_DropCachedRows(void)
+{
+    g_sbar_valid = 0;
+    g_border[0].valid = 0;
+    g_border[1].valid = 0;
+}
+
+// Static frames (UBO_DOOM_SKIP_STATIC): while D_Display reports the screen
+// as the last frame showed it (framestatic) nothing is converted or
+// published, so the frame seq stays put and the service sends nothing.
+// g_shown says the output still holds that frame; palette, filter and
+// output format changes clear it so the next frame goes out anyway.
+boolean framestatic;
+
+static int g_shown = 0;
+static ubo_output_format_t g_shown_format;
+static ubo_scale_filter_t g_shown_filter;
+static int g_shown_layout;
+
+// Screenshots (M_ScreenShot, doom_screenshot): a request claims g_shot
+// (-1 while the path is copied in), then sets it to 1 for the 8-bit
+// picture or 2 for the LCD frame.  The next I_FinishUpdate hands that to
+// the PNG worker; while the worker is still busy the request waits.
+static atomic_int g_shot;
+static char g_shot_path[1024];
+
+// Direct RGB565 view (doom_set_direct565).  colormaps565 is rebuilt when
+// the shown set changes; g_cmap565_for is the set it was built from.
+// g_view8_stale: the view window of screens[0] is older than screen565's.
+// g_inv565 maps RGB565 colours back to palette indices for
+// I_Direct565ToIndex, filled in as colours turn up (a view holds a few
+// hundred), for the palette g_inv565_for.
+static const uint16_t* g_cmap565_for = NULL;
+static int g_view8_stale = 0;
+static byte g_inv565[65536];
+static byte g_inv565_known[65536 / 8];
+static const byte* g_inv565_for = NULL;
+static uint16_t g_shot_lcd[UBO_LCD_WIDTH * UBO_LCD_HEIGHT];   // bars stay black
+
+// Palette-index output (UBO_OUTPUT_INDEX8): the RGB565 palette the last
+// ubo_index8 frame goes with.  It is copied, and g_index_palver moves,
+// only when a frame goes out with another set than the last one;
+// g_index_pal_for is the set it was copied from.
+static uint16_t g_index_pal565[256];
+static uint32_t g_index_palver = 0;
+static const uint16_t* g_index_pal_for = NULL;
+
+static void I_BuildAxisTaps(scaletap_t* taps, int dst_n, int src_n, ubo_scale_filter_t filter)
+{
+    for (int i = 0; i < dst_n; i++)
+    {
+        scaletap_t* t = &taps[i];
+        int nearest = (i * src_n) / dst_n;
+
+        switch (filter)
+        {
+          case UBO_SCALE_AREA2:
+            // Plain 2-tap average of the nearest pixel and its right/lower neighbour.
+            t->src0 = nearest;
+            t->src1 = nearest + 1 < src_n ? nearest + 1 : nearest;
+            t->w0 = 8;
+            t->w1 = 8;
+            break;
+
+          case UBO_SCALE_BOX:
+          {
+            // Exact box filter: output pixel i covers source interval
+            // [i*src_n, (i+1)*src_n) in units of 1/dst_n source pixels.  For
+            // 4:3 (320->240, 200->150) that spans at most two source pixels,
+            // giving weights 3:1, 2:2, 1:3.
+            int start = i * src_n;
+            int span = src_n;
+            int split = (nearest + 1) * dst_n;       // end of first source pixel
+            int cover0 = split - start;
+            if (cover0 > span)
+                cover0 = span;
+            t->src0 = nearest;
+            t->src1 = nearest + 1 < src_n ? nearest + 1 : nearest;
+            t->w0 = (cover0 * 16 + span / 2) / span;
+            t->w1 = 16 - t->w0;
+            break;
+          }
+
+          case UBO_SCALE_NEAREST:
+          default:
+            t->src0 = nearest;
+            t->src1 = nearest;
+            t->w0 = 16;
+            t->w1 = 0;
+            break;
+        }
+    }
+}
+
+static void I_BuildScaleTables(ubo_scale_filter_t filter)
+{
+    I_BuildAxisTaps(g_xtaps, UBO_LCD_WIDTH, screenwidth, filter);
+    I_BuildAxisTaps(g_ytaps, UBO_LCD_ACTIVE_HEIGHT, screenheight, filter);
+    for (int x = 0; x < UBO_LCD_WIDTH; x++)
+        g_xtaps_rev[x] = g_xtaps[UBO_LCD_WIDTH - 1 - x];
+    g_taps_filter = filter;
+
+    // Rows whose taps all fall at or below the top of the status bar.
+    g_sbar_y = UBO_LCD_ACTIVE_HEIGHT;
+    while (g_sbar_y > 0 && g_ytaps[g_sbar_y - 1].src0 >= V_SCALEY(ST_Y))
+        g_sbar_y--;
+    I_DropCachedRows();
+}
+
+static inline uint16_t I_PackRGB565BE(int r, int g, int b)
+{
+    uint16_t v = (uint16_t)(((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3));
+    uint16_t out;
+    // Store the bytes in big-endian order regardless of host endianness so
+    // the conversion loops can write whole uint16_t's (ST7789 wants BE).
+    byte* p = (byte*)&out;
+    p[0] = (byte)(v >> 8);
+    p[1] = (byte)(v & 0xFF);
+    return out;
+}
+
+static void I_BuildPaletteSet(int set, const byte* palette, int gamma)
+{
+    const byte* curve = gammatable[gamma];
+
+    for (int i = 0; i < 256; i++)
+    {
+        int r = curve[palette[i*3 + 0]];
+        int g = curve[palette[i*3 + 1]];
+        int b = curve[palette[i*3 + 2]];
+        byte* rgba = (byte*)&g_pal32[set][i];
+
+        g_palrgb[set][i*3 + 0] = (byte)r;
+        g_palrgb[set][i*3 + 1] = (byte)g;
+        g_palrgb[set][i*3 + 2] = (byte)b;
+        g_pal565[set][i] = I_PackRGB565BE(r, g, b);
+        rgba[0] = (byte)r;
+        rgba[1] = (byte)g;
+        rgba[2] = (byte)b;
+        rgba[3] = 255;
+    }
+}
+
+static void I_BuildPaletteSets(void)
+{
+    const byte* playpal;
+
+    g_playpal_lump = W_GetNumForName("PLAYPAL");
+    g_numpalettes = W_LumpLength(g_playpal_lump) / (256 * 3);
+    if (g_numpalettes > UBO_NUMPALETTES)
+        g_numpalettes = UBO_NUMPALETTES;
+    if (g_numpalettes < 1)
+        I_Error("I_InitGraphics: PLAYPAL is too short");
+    playpal = W_CacheLumpNum(g_playpal_lump, PU_CACHE);
+    for (int p = 0; p < g_numpalettes; p++)
+        for (int gamma = 0; gamma < UBO_NUMGAMMA; gamma++)
+            I_BuildPaletteSet(p * UBO_NUMGAMMA + gamma, playpal + p * 256 * 3, gamma);
+}
+
+static int I_GammaLevel(void)
+{
+    return usegamma >= 0 && usegamma < UBO_NUMGAMMA ? usegamma : 0;
+}
+
+static void I_UpdateColormaps565(void)
+{
+    if (g_cmap565_for == g_lut565 || !colormaps565)
+        return;
+    R_SetPalette565(g_lut565);
+    g_cmap565_for = g_lut565;
+}
+
+static void I_UsePaletteSet(int set)
+{
+    g_palette = g_palrgb[set];
+    g_lut565 = g_pal565[set];
+    g_lut32 = g_pal32[set];
+    g_have_palette = 1;
+    I_DropCachedRows();
+    g_shown = 0;
+    if (set == UBO_CUSTOM_SET)
+    {
+        // Same storage, new colours.
+        g_cmap565_for = NULL;
+        g_inv565_for = NULL;
+        g_index_pal_for = NULL;
+    }
+    // ST_Drawer flashes the palette after D_Display picked the frame's
+    // drawers, so the view drawn next must already see it.
+    if (direct565)
+        I_UpdateColormaps565();
+}
+
+static void I_FollowGamma(void)
+{
+    // usegamma can change without an I_SetPalette (doom_set_config, a
+    // loaded config); follow it here for PLAYPAL palettes.
+    if (g_palnum >= 0 && g_palgamma != I_GammaLevel())
+    {
+        g_palgamma = I_GammaLevel();
+        I_UsePaletteSet(g_palnum * UBO_NUMGAMMA + g_palgamma);
+    }
+}
+
+static void I_BuildWideLut(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        const byte* rgba = (const byte*)&g_lut32[i];
+
+        // 20 bits per channel: room for a 16x16-weighted sum of four taps.
+        g_lutwide[i] = (uint64_t)rgba[0] | ((uint64_t)rgba[1] << 20) | ((uint64_t)rgba[2] << 40);
+    }
+    g_lutwide_for = g_lut32;
+}
+
+//
+// Pixel conversion kernels.  The palette lookup itself is a gather either
+// way; the vector paths batch the loads and replace per-byte / per-pixel
+// stores with one 16-byte store per 4 RGBA or 8 RGB565 pixels.  Selected
+// once in I_InitGraphics.
+//
+typedef void (*rgbarow_t)(uint32_t* dst, const byte* src, int n);
+typedef void (*row565_t)(uint16_t* dst, const byte* src, const scaletap_t* t);
+
+static void I_RowRGBA_C(uint32_t* dst, const byte* src, int n)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] = g_lut32[src[i]];
+}
+
+static void I_Row565_C(uint16_t* dst, const byte* src, const scaletap_t* t)
+{
+    for (int x = 0; x < UBO_LCD_WIDTH; x++)
+        dst[x] = g_lut565[src[t[x].src0]];
+}
+
+#if defined(__ARM_NEON)
+
+static void I_RowRGBA_NEON(uint32_t* dst, const byte* src, int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        uint32x4_t a = vdupq_n_u32(g_lut32[src[i + 0]]);
+        uint32x4_t b = vdupq_n_u32(g_lut32[src[i + 4]]);
+
+        a = vsetq_lane_u32(g_lut32[src[i + 1]], a, 1);
+        b = vsetq_lane_u32(g_lut32[src[i + 5]], b, 1);
+        a = vsetq_lane_u32(g_lut32[src[i + 2]], a, 2);
+        b = vsetq_lane_u32(g_lut32[src[i + 6]], b, 2);
+        a = vsetq_lane_u32(g_lut32[src[i + 3]], a, 3);
+        b = vsetq_lane_u32(g_lut32[src[i + 7]], b, 3);
+        vst1q_u32(dst + i, a);
+        vst1q_u32(dst + i + 4, b);
+    }
+    for (; i < n; i++)
+        dst[i] = g_lut32[src[i]];
+}
+
+static void I_Row565_NEON(uint16_t* dst, const byte* src, const scaletap_t* t)
+{
+    // UBO_LCD_WIDTH is a multiple of 8
+    for (int x = 0; x < UBO_LCD_WIDTH; x += 8, t += 8)
+    {
+        uint16x8_t v = vdupq_n_u16(g_lut565[src[t[0].src0]]);
+
+        v = vsetq_lane_u16(g_lut565[src[t[1].src0]], v, 1);
+        v = vsetq_lane_u16(g_lut565[src[t[2].src0]], v, 2);
+        v = vsetq_lane_u16(g_lut565[src[t[3].src0]], v, 3);
+        v = vsetq_lane_u16(g_lut565[src[t[4].src0]], v, 4);
+        v = vsetq_lane_u16(g_lut565[src[t[5].src0]], v, 5);
+        v = vsetq_lane_u16(g_lut565[src[t[6].src0]], v, 6);
+        v = vsetq_lane_u16(g_lut565[src[t[7].src0]], v, 7);
+        vst1q_u16(dst + x, v);
+    }
+}
+
+#define I_RowRGBA_SIMD  I_RowRGBA_NEON
+#define I_Row565_SIMD   I_Row565_NEON
+#define SIMD_NAME       "neon"
+
+#elif defined(__SSE2__)
+
+static void I_RowRGBA_SSE2(uint32_t* dst, const byte* src, int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = _mm_set_epi32((int)g_lut32[src[i + 3]], (int)g_lut32[src[i + 2]],
+                                  (int)g_lut32[src[i + 1]], (int)g_lut32[src[i + 0]]);
+        __m128i b = _mm_set_epi32((int)g_lut32[src[i + 7]], (int)g_lut32[src[i + 6]],
+                                  (int)g_lut32[src[i + 5]], (int)g_lut32[src[i + 4]]);
+
+        _mm_storeu_si128((__m128i*)(dst + i), a);
+        _mm_storeu_si128((__m128i*)(dst + i + 4), b);
+    }
+    for (; i < n; i++)
+        dst[i] = g_lut32[src[i]];
+}
+
+static void I_Row565_SSE2(uint16_t* dst, const byte* src, const scaletap_t* t)
+{
+    // UBO_LCD_WIDTH is a multiple of 8
+    for (int x = 0; x < UBO_LCD_WIDTH; x += 8, t += 8)
+    {
+        __m128i v = _mm_set_epi16((short)g_lut565[src[t[7].src0]], (short)g_lut565[src[t[6].src0]],
+                                  (short)g_lut565[src[t[5].src0]], (short)g_lut565[src[t[4].src0]],
+                                  (short)g_lut565[src[t[3].src0]], (short)g_lut565[src[t[2].src0]],
+                                  (short)g_lut565[src[t[1].src0]], (short)g_lut565[src[t[0].src0]]);
+
+        _mm_storeu_si128((__m128i*)(dst + x), v);
+    }
+}
+
+#define I_RowRGBA_SIMD  I_RowRGBA_SSE2
+#define I_Row565_SIMD   I_Row565_SSE2
+#define SIMD_NAME       "sse2"
+
+#endif
+
+static rgbarow_t g_rowrgba = I_RowRGBA_C;
+static row565_t g_row565 = I_Row565_C;
+
+static void I_SelectKernels(void)
+{
+    const char* name = "c";
+
+    g_rowrgba = I_RowRGBA_C;
+    g_row565 = I_Row565_C;
+#ifdef SIMD_NAME
+    if (ubo_video_simd && I_CpuHasSimd())
+    {
+        g_rowrgba = I_RowRGBA_SIMD;
+        g_row565 = I_Row565_SIMD;
+        name = SIMD_NAME;
+    }
+#endif
+    fprintf(stderr, "[doom] I_InitGraphics: %s pixel conversion\n", name);
+}
 
 void I_InitGraphics(void)
 {
     if (g_inited) return;
 
-    // Load PLAYPAL palette lump (first palette only).
-    g_palette = (byte*)W_CacheLumpName("PLAYPAL", PU_STATIC);
+    I_SelectKernels();
+    I_BuildScaleTables(doom_get_scale_filter());
+
+    I_BuildPaletteSets();
     g_inited = 1;
+    I_SetPalette((byte*)W_CacheLumpNum(g_playpal_lump, PU_CACHE));
 }
 
 void I_ShutdownGraphics(void)
 {
-    // Nothing to free (WAD cache owns PLAYPAL; ubo_rgba is static).
+    // Nothing to free (palette/LUT are private copies; output buffers are static),
+    // but the next I_InitGraphics picks the kernels and reads PLAYPAL again.
+    g_inited = 0;
+    g_playpal_lump = -1;
+    g_lutwide_for = NULL;
+    g_have_palette = 0;
+    g_taps_filter = -1;
+    I_DropCachedRows();
+    g_shown = 0;
+    g_cmap565_for = NULL;          // colormaps565 is reallocated by R_Init
+    g_inv565_for = NULL;
+    g_index_pal_for = NULL;
+    g_view8_stale = 0;
 }
 
 void I_SetPalette(byte* palette)
 {
-    // Doom will call this when palette changes (e.g., damage).
-    // The argument points to 256*3 bytes.
-    g_palette = palette;
+    // Doom will call this when palette changes (e.g., damage) and on a
+    // gamma toggle.  The argument points into the PU_CACHE PLAYPAL lump, so
+    // the palette number falls out of the offset and the converted set is
+    // already there; anything else is converted into the custom set.
+    int gamma = I_GammaLevel();
+
+    if (g_playpal_lump >= 0)
+    {
+        const byte* playpal = W_CacheLumpNum(g_playpal_lump, PU_CACHE);
+        ptrdiff_t offset = palette - playpal;
+
+        if (offset >= 0 && offset % (256 * 3) == 0 && offset / (256 * 3) < g_numpalettes)
+        {
+            g_palnum = (int)(offset / (256 * 3));
+            g_palgamma = gamma;
+            I_UsePaletteSet(g_palnum * UBO_NUMGAMMA + gamma);
+            return;
+        }
+    }
+    I_BuildPaletteSet(UBO_CUSTOM_SET, palette, gamma);
+    g_palnum = -1;
+    g_palgamma = gamma;
+    I_UsePaletteSet(UBO_CUSTOM_SET);
 }
 
 void I_UpdateNoBlit(void) { }
@@ -44,21 +529,486 @@ void I_StartFrame(void) { }
 void I_StartTic(void) { }
 void I_ReadScreen(byte* scr) { memcpy(scr, screens[0], SCREENWIDTH*SCREENHEIGHT); }
 
+static void I_FinishUpdateIndex(void)
+{
+    I_DropCachedRows();     // the RGB565 rows are not kept up to date
+    if (g_index_pal_for != g_lut565)
+    {
+        memcpy(g_index_pal565, g_lut565, sizeof(g_index_pal565));
+        g_index_pal_for = g_lut565;
+        if (++g_index_palver == 0)
+            g_index_palver = 1;
+    }
+    if (screenwidth == SCREENWIDTH)
+        memcpy(ubo_index8, screens[0], (size_t)SCREENWIDTH * screenheight);
+    else
+        for (int y = 0; y < screenheight; y++)
+            memcpy(ubo_index8 + y * screenwidth, screens[0] + y * SCREENWIDTH, (size_t)screenwidth);
+}
+
+uint32_t doom_get_palette_version(void) { return g_index_palver; }
+
+int doom_copy_palette565(void* dst, int dst_size)
+{
+    if (!dst || dst_size < (int)sizeof(g_index_pal565)) return -1;
+    memcpy(dst, g_index_pal565, sizeof(g_index_pal565));
+    return (int)sizeof(g_index_pal565);
+}
+
+static void I_FinishUpdateRGBA(void)
+{
+    I_DropCachedRows();   // the RGB565 rows are not kept up to date
+    // Convert 8-bit indexed pixels to RGBA (alpha=255), one word per pixel.
+    if (screenwidth == SCREENWIDTH)
+    {
+        g_rowrgba((uint32_t*)ubo_rgba, screens[0], SCREENWIDTH * SCREENHEIGHT);
+        return;
+    }
+    for (int y = 0; y < screenheight; y++)
+        g_rowrgba((uint32_t*)ubo_rgba + y * screenwidth, screens[0] + y * SCREENWIDTH, screenwidth);
+}
+
+//
+// I_Orient
+// The orient_t for a doom_set_lcd_orientation() layout, rotation | mirror << 2.
+// The frame is square, so every rotation keeps its size.
+//
+static void I_Orient(int layout, orient_t* o)
+{
+    const int w = UBO_LCD_WIDTH;
+
+    switch (layout & 3)
+    {
+      case UBO_ROTATE_90:
+        o->origin = w - 1;              // top left goes to top right
+        o->sx = w;
+        o->sy = -1;
+        break;
+      case UBO_ROTATE_180:
+        o->origin = w * w - 1;
+        o->sx = -1;
+        o->sy = -w;
+        break;
+      case UBO_ROTATE_270:
+        o->origin = (w - 1) * w;        // top left goes to bottom left
+        o->sx = -w;
+        o->sy = 1;
+        break;
+      default:
+        *o = g_upright;
+        break;
+    }
+    if (layout & 4)
+    {
+        // Mirrored: x counts from the other end of the row.
+        o->origin += (w - 1) * o->sx;
+        o->sx = -o->sx;
+    }
+}
+
+static void I_NearestRow(uint16_t* dst, const byte* src, const orient_t* o)
+{
+    if (o->sx == 1)
+        g_row565(dst, src, g_xtaps);
+    else if (o->sx == -1)
+        g_row565(dst - (UBO_LCD_WIDTH - 1), src, g_xtaps_rev);
+    else
+        for (int x = 0; x < UBO_LCD_WIDTH; x++)
+            dst[x * o->sx] = g_lut565[src[g_xtaps[x].src0]];
+}
+
+static void I_ScaleNearest(uint16_t* frame, int y0, int y1, const orient_t* o)
+{
+    for (int y = y0; y < y1; y++)
+        I_NearestRow(frame + o->origin + (UBO_LCD_PAD_TOP + y) * o->sy,
+                     screens[0] + g_ytaps[y].src0 * SCREENWIDTH, o);
+}
+
+//
+// I_ScaleDirect
+// I_ScaleNearest for a view565 frame: source pixels inside the view
+// window are taken from screen565 as they are, the rest converted from
+// screens[0].  At LCD resolution upright the view part of a row is a
+// memcpy.
+//
+static void I_ScaleDirect(uint16_t* frame, int y0, int y1, const orient_t* o)
+{
+    int x0 = 0;
+    int x1;
+
+    // The output columns sampling the view window: x0 to x1 - 1.
+    while (x0 < UBO_LCD_WIDTH && g_xtaps[x0].src0 < viewwindowx)
+        x0++;
+    for (x1 = x0; x1 < UBO_LCD_WIDTH && g_xtaps[x1].src0 < viewwindowx + scaledviewwidth; x1++)
+        ;
+
+    for (int y = y0; y < y1; y++)
+    {
+        int sy = g_ytaps[y].src0;
+        const byte* src = screens[0] + sy * SCREENWIDTH;
+        const uint16_t* view = screen565 + sy * SCREENWIDTH;
+        uint16_t* dst = frame + o->origin + (UBO_LCD_PAD_TOP + y) * o->sy;
+        int x;
+
+        if (sy < viewwindowy || sy >= viewwindowy + viewheight)
+        {
+            I_NearestRow(dst, src, o);
+            continue;
+        }
+        for (x = 0; x < x0; x++)
+            dst[x * o->sx] = g_lut565[src[g_xtaps[x].src0]];
+        if (o->sx == 1 && screenwidth == UBO_LCD_WIDTH)
+            memcpy(dst + x0, view + x0, (size_t)(x1 - x0) * sizeof(uint16_t));
+        else
+            for (x = x0; x < x1; x++)
+                dst[x * o->sx] = view[g_xtaps[x].src0];
+        for (x = x1; x < UBO_LCD_WIDTH; x++)
+            dst[x * o->sx] = g_lut565[src[g_xtaps[x].src0]];
+    }
+}
+
+static void I_ScaleFiltered(uint16_t* frame, int y0, int y1, const orient_t* o)
+{
+    if (g_lutwide_for != g_lut32)
+        I_BuildWideLut();
+    for (int y = y0; y < y1; y++)
+    {
+        const scaletap_t* ty = &g_ytaps[y];
+        const byte* row0 = screens[0] + ty->src0 * SCREENWIDTH;
+        const byte* row1 = screens[0] + ty->src1 * SCREENWIDTH;
+        uint16_t* dst = frame + o->origin + (UBO_LCD_PAD_TOP + y) * o->sy;
+
+        for (int x = 0; x < UBO_LCD_WIDTH; x++)
+        {
+            const scaletap_t* tx = &g_xtaps[x];
+            // Weights sum to 16*16 = 256, so each channel is sum >> 8.
+            uint64_t top = g_lutwide[row0[tx->src0]] * tx->w0
+                         + g_lutwide[row0[tx->src1]] * tx->w1;
+            uint64_t bot = g_lutwide[row1[tx->src0]] * tx->w0
+                         + g_lutwide[row1[tx->src1]] * tx->w1;
+            uint64_t sum = top * ty->w0 + bot * ty->w1;
+
+            dst[x * o->sx] = I_PackRGB565BE((int)((sum >> 8) & 0xFF),
+                                    (int)((sum >> 28) & 0xFF),
+                                    (int)((sum >> 48) & 0xFF));
+        }
+    }
+}
+
+static ubo_scale_filter_t I_PrepareScale(void)
+{
+    ubo_scale_filter_t filter = doom_get_scale_filter();
+
+    // A picture drawn at LCD resolution maps 1:1; filtering would only blur it.
+    if (screenwidth == UBO_LCD_WIDTH)
+        filter = UBO_SCALE_NEAREST;
+    if (filter != g_taps_filter)
+        I_BuildScaleTables(filter);
+    return filter;
+}
+
+static int I_LcdLayout(void)
+{
+    return (int)doom_get_lcd_rotation() | doom_get_lcd_mirror() << 2;
+}
+
+static void I_ScaleRows(uint16_t* frame, int y0, int y1, const orient_t* o,
+                        ubo_scale_filter_t filter)
+{
+    if (y1 <= y0)
+        return;
+    if (view565)
+        I_ScaleDirect(frame, y0, y1, o);
+    else if (filter == UBO_SCALE_NEAREST)
+        I_ScaleNearest(frame, y0, y1, o);
+    else
+        I_ScaleFiltered(frame, y0, y1, o);
+}
+
+//
+// I_FrameRows
+// The frame rows active rows a to b - 1 land on, y0 to y1 - 1.  0 when
+// the orientation turns its rows into columns: the caches need whole rows.
+//
+static int I_FrameRows(const orient_t* o, int a, int b, int* y0, int* y1)
+{
+    if (o->sy == UBO_LCD_WIDTH)
+    {
+        *y0 = UBO_LCD_PAD_TOP + a;
+        *y1 = UBO_LCD_PAD_TOP + b;
+        return 1;
+    }
+    if (o->sy == -UBO_LCD_WIDTH)
+    {
+        *y0 = UBO_LCD_HEIGHT - UBO_LCD_PAD_TOP - b;
+        *y1 = UBO_LCD_HEIGHT - UBO_LCD_PAD_TOP - a;
+        return 1;
+    }
+    return 0;
+}
+
+//
+// I_BorderBands
+// The active rows taken only from view border: those whose taps all fall
+// above the view window, and those between its bottom and the status bar.
+//
+static void I_BorderBands(borderband_t* top, borderband_t* bottom)
+{
+    int view_end = viewwindowy + viewheight;
+    int y = 0;
+
+    // src1 >= src0, and both grow with y.
+    while (y < g_sbar_y && g_ytaps[y].src1 < viewwindowy)
+        y++;
+    top->y0 = 0;
+    top->y1 = y;
+    top->src0 = 0;
+    top->src1 = y ? g_ytaps[y - 1].src1 : -1;
+
+    y = g_sbar_y;
+    while (y > top->y1 && g_ytaps[y - 1].src0 >= view_end)
+        y--;
+    bottom->y0 = y;
+    bottom->y1 = g_sbar_y;
+    bottom->src0 = y < g_sbar_y ? g_ytaps[y].src0 : 0;
+    bottom->src1 = y < g_sbar_y ? g_ytaps[g_sbar_y - 1].src1 : -1;
+}
+
+static void I_FinishUpdateRGB565(void)
+{
+    ubo_scale_filter_t filter = I_PrepareScale();
+    int layout = I_LcdLayout();
+    orient_t o;
+    borderband_t bands[2];
+    int sbar_y0 = -1;
+    int sbar_y1 = -1;
+    int done = 0;       // active rows converted or copied so far
+
+    I_Orient(layout, &o);
+    if (layout != g_cached_layout)
+    {
+        I_DropCachedRows();
+        g_cached_layout = layout;
+    }
+
+    // Scale 320x200 -> 240x150 (or copy 240x150) and place it between the
+    // letterbox bars.
+    // The bars are never written, so they stay black (static storage,
+    // cleared again by ubo_frame_begin when the orientation moves them).
+    uint16_t* frame = ubo_frame_begin(layout);
+    int cache = ubo_video_sbarcache && I_FrameRows(&o, g_sbar_y, UBO_LCD_ACTIVE_HEIGHT,
+                                                   &sbar_y0, &sbar_y1);
+    uint16_t* sbar = cache ? frame + sbar_y0 * UBO_LCD_WIDTH : NULL;
+    size_t sbar_bytes = cache ? (size_t)(sbar_y1 - sbar_y0) * UBO_LCD_WIDTH * sizeof(uint16_t) : 0;
+    int reuse = cache && sbarclean && g_sbar_valid;
+    int rows = reuse ? g_sbar_y : UBO_LCD_ACTIVE_HEIGHT;
+    int border = ubo_video_bordercache && gamestate == GS_LEVEL && !automapactive;
+
+    if (border)
+        I_BorderBands(&bands[0], &bands[1]);
+    for (int i = 0; i < 2; i++)
+    {
+        const borderband_t* band = &bands[i];
+        borderband_t* kept = &g_border[i];
+        int region = UBO_STATIC_BORDER_TOP + i;
+        int y0;
+        int y1;
+
+        if (!border || band->y1 == band->y0 || !I_FrameRows(&o, band->y0, band->y1, &y0, &y1))
+        {
+            kept->valid = 0;
+            ubo_frame_static(region, -1, -1, 1);
+            continue;
+        }
+
+        size_t src_off = (size_t)band->src0 * SCREENWIDTH;
+        size_t src_bytes = (size_t)(band->src1 - band->src0 + 1) * SCREENWIDTH;
+        size_t bytes = (size_t)(y1 - y0) * UBO_LCD_WIDTH * sizeof(uint16_t);
+        uint16_t* dst = frame + y0 * UBO_LCD_WIDTH;
+        uint16_t* rows565 = g_border565 + band->y0 * UBO_LCD_WIDTH;
+        int same = kept->valid && kept->y0 == band->y0 && kept->y1 == band->y1
+                && kept->src0 == band->src0 && kept->src1 == band->src1
+                && memcmp(screens[0] + src_off, g_border8 + src_off, src_bytes) == 0;
+
+        I_ScaleRows(frame, done, band->y0, &o, filter);
+        if (same)
+            memcpy(dst, rows565, bytes);
+        else
+        {
+            I_ScaleRows(frame, band->y0, band->y1, &o, filter);
+            memcpy(rows565, dst, bytes);
+            memcpy(g_border8 + src_off, screens[0] + src_off, src_bytes);
+            *kept = *band;
+            kept->valid = 1;
+        }
+        ubo_frame_static(region, y0, y1, !same);
+        done = band->y1;
+    }
+    I_ScaleRows(frame, done, rows, &o, filter);
+
+    if (reuse)
+        memcpy(sbar, g_sbar565, sbar_bytes);
+    else if (cache)
+    {
+        memcpy(g_sbar565, sbar, sbar_bytes);
+        g_sbar_valid = 1;
+    }
+    else
+        g_sbar_valid = 0;
+    ubo_frame_static(UBO_STATIC_STATUSBAR, cache ? sbar_y0 : -1, sbar_y1, !reuse);
+    I_FrameShmPublish(FRAMESHM_RGB565_BE, frame, UBO_LCD_WIDTH, UBO_LCD_HEIGHT,
+                      UBO_LCD_WIDTH * (int)sizeof(uint16_t));
+    ubo_frame_publish();
+}
+
+boolean I_Direct565Frame(void)
+{
+    if (!g_inited || !g_have_palette)
+        return false;
+    if (doom_get_output_format() != UBO_OUTPUT_RGB565_BE
+        || (doom_get_scale_filter() != UBO_SCALE_NEAREST && screenwidth != UBO_LCD_WIDTH))
+        return false;
+    if (doom_capture_active() || doom_stream_active() || doom_hdmi_active() || ubo_aux_wants_index())
+        return false;
+    I_FollowGamma();
+    I_UpdateColormaps565();
+    return g_cmap565_for == g_lut565;
+}
+
+static byte I_Index565(uint16_t be)
+{
+    if (!(g_inv565_known[be >> 3] & (1 << (be & 7))))
+    {
+        const byte* p = (const byte*)&be;
+        int v = p[0] << 8 | p[1];
+        int r = (v >> 8) & 0xF8;
+        int g = (v >> 3) & 0xFC;
+        int b = (v << 3) & 0xF8;
+        int best = 0;
+        int bestd = 1 << 30;
+
+        // The nearest palette colour as RGB565 shows it, so a colour the
+        // palette itself produced maps back to an index that shows as it.
+        for (int i = 0; i < 256 && bestd; i++)
+        {
+            int dr = (g_palette[i*3 + 0] & 0xF8) - r;
+            int dg = (g_palette[i*3 + 1] & 0xFC) - g;
+            int db = (g_palette[i*3 + 2] & 0xF8) - b;
+            int d = dr*dr + dg*dg + db*db;
+
+            if (d < bestd)
+            {
+                bestd = d;
+                best = i;
+            }
+        }
+        g_inv565[be] = (byte)best;
+        g_inv565_known[be >> 3] |= (byte)(1 << (be & 7));
+    }
+    return g_inv565[be];
+}
+
+void I_Direct565ToIndex(void)
+{
+    if (!g_view8_stale)
+        return;
+    g_view8_stale = 0;
+    if (g_inv565_for != g_palette)
+    {
+        memset(g_inv565_known, 0, sizeof(g_inv565_known));
+        g_inv565_for = g_palette;
+    }
+    for (int y = viewwindowy; y < viewwindowy + viewheight; y++)
+    {
+        const uint16_t* src = screen565 + y * SCREENWIDTH;
+        byte* dst = screens[0] + y * SCREENWIDTH;
+
+        for (int x = viewwindowx; x < viewwindowx + scaledviewwidth; x++)
+            dst[x] = I_Index565(src[x]);
+    }
+}
+
+boolean I_RequestScreenShot(char const* name, boolean lcd)
+{
+    int idle = 0;
+
+    if (strlen(name) >= sizeof(g_shot_path))
+        return false;
+    if (!atomic_compare_exchange_strong(&g_shot, &idle, -1))
+        return false;
+    strcpy(g_shot_path, name);
+    atomic_store(&g_shot, lcd ? 2 : 1);
+    return true;
+}
+
+static void I_TakeScreenShot(void)
+{
+    int kind = atomic_load(&g_shot);
+    boolean taken;
+
+    if (kind <= 0)
+        return;
+    I_Direct565ToIndex();
+    if (kind == 2)
+    {
+        // The frame the LCD would show, whatever the output format, but
+        // upright whichever way the panel is mounted.
+        if (I_PrepareScale() == UBO_SCALE_NEAREST)
+            I_ScaleNearest(g_shot_lcd, 0, UBO_LCD_ACTIVE_HEIGHT, &g_upright);
+        else
+            I_ScaleFiltered(g_shot_lcd, 0, UBO_LCD_ACTIVE_HEIGHT, &g_upright);
+        taken = M_WritePNGAsync(g_shot_path, g_shot_lcd, UBO_LCD_WIDTH, UBO_LCD_HEIGHT,
+                                UBO_LCD_WIDTH * (int)sizeof(uint16_t), NULL);
+    }
+    else
+        taken = M_WritePNGAsync(g_shot_path, screens[0], screenwidth, screenheight,
+                                SCREENWIDTH, g_palette);
+    if (taken)
+        atomic_store(&g_shot, 0);
+}
+
 void I_FinishUpdate(void)
 {
     if (!g_inited) I_InitGraphics();
-    if (!g_palette) return;
+    if (!g_have_palette) return;
+    g_view8_stale = view565;
+    I_FollowGamma();
+    I_TakeScreenShot();
+    if (noblit)           // timedemo without conversion (doom_timedemo blit=0)
+    {
+        I_DropCachedRows();
+        g_shown = 0;
+        return;
+    }
 
-    // Convert 8-bit indexed pixels to RGBA (alpha=255).
-    const byte* src = screens[0];
-    uint8_t* dst = ubo_rgba;
+    ubo_output_format_t format = doom_get_output_format();
+    ubo_scale_filter_t filter = doom_get_scale_filter();
+    int layout = I_LcdLayout();
+    if (ubo_frame_wanted())
+        g_shown = 0;
+    if (framestatic && g_shown && format == g_shown_format && filter == g_shown_filter
+        && (format != UBO_OUTPUT_RGB565_BE || layout == g_shown_layout))
+        return;
 
-    for (int i = 0; i < SCREENWIDTH * SCREENHEIGHT; i++)
+    UBO_PROF_BEGIN(UBO_PROF_FINISH_UPDATE);
+    if (format == UBO_OUTPUT_RGB565_BE)
+        I_FinishUpdateRGB565();
+    else if (format == UBO_OUTPUT_INDEX8)
+        I_FinishUpdateIndex();  // the frame shm carries converted frames only
+    else
     {
-        int idx = src[i] * 3;
-        dst[i*4 + 0] = g_palette[idx + 0];
-        dst[i*4 + 1] = g_palette[idx + 1];
-        dst[i*4 + 2] = g_palette[idx + 2];
-        dst[i*4 + 3] = 255;
+        I_FinishUpdateRGBA();
+        I_FrameShmPublish(FRAMESHM_RGBA8888, ubo_rgba, screenwidth, screenheight, screenwidth * 4);
     }
+    if (view565 && (doom_capture_active() || doom_stream_active() || doom_hdmi_active()))
+        I_Direct565ToIndex();   // started since D_Display chose view565
+    I_CaptureFrame(screens[0], g_palette);
+    I_StreamFrame(screens[0], g_palette);
+    I_HdmiFrame(screens[0], g_palette);
+    ubo_frame_done(format);
+    UBO_PROF_END(UBO_PROF_FINISH_UPDATE);
+    g_shown = 1;
+    g_shown_format = format;
+    g_shown_filter = filter;
+    g_shown_layout = layout;
 }
@@ -38,50 +38,26 @@ rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 
 
 
-// Fixme. __USE_C_FIXED__ or something.
-
-fixed_t
-FixedMul
-( fixed_t	a,
-  fixed_t	b )
-{
-    return ((long long) a * (long long) b) >> FRACBITS;
-}
+// FixedMul and FixedDiv are inline in m_fixed.h.
 
 
 
 //
-// FixedDiv, C version.
+// FixedDiv2, C version: no overflow guard.
 //
 
-fixed_t
-FixedDiv
-( fixed_t	a,
-  fixed_t	b )
-{
-    if ( (abs(a)>>14) >= abs(b))
-	return (a^b)<0 ? MININT : MAXINT;
-    return FixedDiv2 (a,b);
-}
-
-
-
 fixed_t
 FixedDiv2
 ( fixed_t	a,
   fixed_t	b )
 {
-#if 0
     long long c;
-    c = ((long long)a<<16) / ((long long)b);
-    return (fixed_t) c;
-#endif
 
-    double c;
-
-    c = ((double)a) / ((double)b) * FRACUNIT;
+    if (!b)
+	I_Error("FixedDiv: divide by zero");
+    c = ((long long) a * FRACUNIT) / b;
 
-    if (c >= 2147483648.0 || c < -2147483648.0)
+    if (c > MAXINT || c < MININT)
 	I_Error("FixedDiv: divide by zero");
     return (fixed_t) c;
 }
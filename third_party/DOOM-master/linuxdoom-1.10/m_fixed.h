@@ -24,6 +24,10 @@
 #define __M_FIXED__
 
 
+#include <stdlib.h>
+
+#include "doomtype.h"
+
 #ifdef __GNUG__
 #pragma interface
 #endif
@@ -37,8 +41,31 @@
 
 typedef int fixed_t;
 
-fixed_t FixedMul	(fixed_t a, fixed_t b);
-fixed_t FixedDiv	(fixed_t a, fixed_t b);
+//
+// UBO: FixedMul and FixedDiv are inline so the renderer's per-seg
+// and per-sprite setup and the playsim's movement code don't pay a
+// call for one multiply or divide.  FixedDiv divides in 64-bit
+// integers once the overflow guard has passed, like the DOS asm,
+// instead of through a double.  FixedDiv2 stays out of line.
+//
+static inline fixed_t
+FixedMul
+( fixed_t	a,
+  fixed_t	b )
+{
+    return ((long long) a * (long long) b) >> FRACBITS;
+}
+
+static inline fixed_t
+FixedDiv
+( fixed_t	a,
+  fixed_t	b )
+{
+    if ( (abs(a)>>14) >= abs(b))
+	return (a^b)<0 ? MININT : MAXINT;
+    return (fixed_t) (((long long) a * FRACUNIT) / b);
+}
+
 fixed_t FixedDiv2	(fixed_t a, fixed_t b);
 
 
@@ -20,19 +20,27 @@
 // DESCRIPTION:
 //	Main loop menu stuff.
 //	Default Config File.
-//	PCX Screenshots.
+//	PCX and PNG Screenshots.
 //
 //-----------------------------------------------------------------------------
 
 static const char
 rcsid[] = "$Id: m_misc.c,v 1.6 1997/02/03 22:45:10 b1 Exp $";
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#ifdef UBO_ZLIB
+#include <zlib.h>
+#endif
 
 #include <ctype.h>
 
@@ -47,6 +55,8 @@ rcsid[] = "$Id: m_misc.c,v 1.6 1997/02/03 22:45:10 b1 Exp $";
 #include "w_wad.h"
 
 #include "i_system.h"
+#include "i_log.h"
+#include "i_trace.h"
 #include "i_video.h"
 #include "v_video.h"
 
@@ -119,13 +129,18 @@ M_WriteFile
     int		handle;
     int		count;
 	
+    UBO_TRACE_BEGIN ("write_file");
     handle = open ( name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
 
     if (handle == -1)
+    {
+	UBO_TRACE_END ();
 	return false;
+    }
 
     count = write (handle, source, length);
     close (handle);
+    UBO_TRACE_END ();
 	
     if (count < length)
 	return false;
@@ -134,6 +149,319 @@ M_WriteFile
 }
 
 
+//
+// M_WriteFileParts
+// UBO: M_WriteFile of count pieces written one after another, with
+//  plain write(2) calls and no allocation, for writing after a crash.
+//
+boolean
+M_WriteFileParts
+( char const*	name,
+  void**	parts,
+  int*		lengths,
+  int		count )
+{
+    int		handle;
+    int		i;
+    int		length;
+    int		written;
+    byte*	p;
+    boolean	ok;
+
+    handle = open (name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (handle == -1)
+	return false;
+
+    ok = true;
+    for (i=0 ; i<count && ok ; i++)
+    {
+	p = parts[i];
+	for (length = lengths[i] ; length > 0 ; p += written, length -= written)
+	{
+	    written = write (handle, p, length);
+	    if (written <= 0)
+	    {
+		ok = false;
+		break;
+	    }
+	}
+    }
+    if (close (handle) != 0)
+	ok = false;
+    return ok;
+}
+
+
+//
+// PACKED FILES
+// UBO: a file M_WriteFileAsync was asked to compress is packmagic,
+//  the unpacked length (4 bytes, little endian) and a zlib stream at
+//  the fastest level, which on a savegame is a fraction of the SD
+//  card writes for a few ms of the writer thread.  M_MapFile spots
+//  the magic and hands back the unpacked data instead, so readers
+//  take either.  Builds with ZLIB=0 write plain files and cannot read
+//  packed ones.
+//
+#define PACKHEADER	12
+
+static const byte	packmagic[8] = { 0x89, 'U', 'B', 'Z', '\r', '\n', 0x1a, '\n' };
+
+
+//
+// M_PackFile
+// The packed form of data in a malloc'd *out; 0 if it could not be.
+//
+static int M_PackFile (byte** out, const byte* data, int length)
+{
+#ifdef UBO_ZLIB
+    uLongf	size;
+
+    size = compressBound (length);
+    if ((*out = malloc (PACKHEADER + size)) == NULL)
+	return 0;
+    memcpy (*out, packmagic, sizeof(packmagic));
+    (*out)[8] = length;
+    (*out)[9] = length >> 8;
+    (*out)[10] = length >> 16;
+    (*out)[11] = length >> 24;
+    if (compress2 (*out+PACKHEADER, &size, data, length, Z_BEST_SPEED) != Z_OK)
+    {
+	free (*out);
+	*out = NULL;
+	return 0;
+    }
+    return PACKHEADER + size;
+#else
+    (void)data;
+    (void)length;
+    *out = NULL;
+    return 0;
+#endif
+}
+
+
+//
+// M_UnpackFile
+// A packed file's data in a PU_STATIC zone block; NULL when it is
+//  damaged or this build has no zlib.
+//
+static byte*
+M_UnpackFile
+( const byte*	data,
+  int		length,
+  int*		outlength )
+{
+#ifdef UBO_ZLIB
+    uLongf	size;
+    byte*	buf;
+
+    size = data[8] | (data[9] << 8) | (data[10] << 16) | ((uLongf)data[11] << 24);
+    // deflate tops out a little past 1000:1
+    if (!size || size > 0x7fffffff || size > (uLongf)(length-PACKHEADER) * 1032)
+	return NULL;
+    buf = Z_Malloc (size, PU_STATIC, NULL);
+    if (uncompress (buf, &size, data+PACKHEADER, length-PACKHEADER) != Z_OK)
+    {
+	Z_Free (buf);
+	return NULL;
+    }
+    *outlength = size;
+    return buf;
+#else
+    (void)data;
+    (void)length;
+    (void)outlength;
+    return NULL;
+#endif
+}
+
+
+//
+// ASYNC FILE WRITES
+// UBO: M_WriteFileAsync hands a copy of the data to a worker thread
+//  that writes name.tmp, fsyncs it and renames it over name, so a
+//  slow SD card doesn't freeze a tic and a crash mid-write leaves the
+//  old file in place.  One write runs at a time; a new one waits for
+//  the last.  M_WriteStatus reports it to the host.
+//
+int			asyncwrites = 1;	// UBO_DOOM_ASYNC_SAVE
+static atomic_int	writestate;		// M_WRITE_*
+static atomic_uint	writeseq;		// finished writes
+
+static pthread_t	writethread;
+static int		writerunning;
+static char		writename[1024];
+static byte*		writedata;
+static int		writelength;
+static boolean		writepack;
+
+
+//
+// M_WriteFileSafe
+// The write itself: temporary file, fsync, rename, fsync the
+//  directory so the rename survives a power cut.
+//
+static boolean
+M_WriteReplace
+( char const*	name,
+  void*		source,
+  int		length )
+{
+    char	tmp[1040];
+    char	dir[1024];
+    char*	slash;
+    byte*	p;
+    int		handle;
+    int		count;
+    boolean	ok;
+
+    snprintf (tmp, sizeof(tmp), "%s.tmp", name);
+    handle = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (handle == -1)
+	return false;
+
+    ok = true;
+    for (p = source ; length > 0 ; p += count, length -= count)
+    {
+	count = write (handle, p, length);
+	if (count <= 0)
+	{
+	    ok = false;
+	    break;
+	}
+    }
+    if (ok && fsync (handle) != 0)
+	ok = false;
+    if (close (handle) != 0)
+	ok = false;
+    if (!ok || rename (tmp, name) != 0)
+    {
+	remove (tmp);
+	return false;
+    }
+
+    snprintf (dir, sizeof(dir), "%s", name);
+    slash = strrchr (dir, '/');
+    if (slash)
+	*slash = 0;
+    else
+	strcpy (dir, ".");
+    handle = open (dir, O_RDONLY);
+    if (handle != -1)
+    {
+	fsync (handle);
+	close (handle);
+    }
+    return true;
+}
+
+
+static boolean
+M_WriteFileSafe
+( char const*	name,
+  void*		source,
+  int		length,
+  boolean	pack )
+{
+    boolean	ok;
+    byte*	packed;
+    int		packedlength;
+
+    UBO_TRACE_BEGIN ("write_file");
+    packed = NULL;
+    packedlength = pack ? M_PackFile (&packed, source, length) : 0;
+    if (packedlength)
+	ok = M_WriteReplace (name, packed, packedlength);
+    else
+	ok = M_WriteReplace (name, source, length);
+    free (packed);
+    UBO_TRACE_END ();
+    return ok;
+}
+
+
+static void* M_WriteThread (void* arg)
+{
+    boolean	ok;
+
+    (void)arg;
+    ok = M_WriteFileSafe (writename, writedata, writelength, writepack);
+    if (!ok)
+	fprintf (stderr, "[doom] M_WriteFileAsync: couldn't write %s\n",
+		 writename);
+    atomic_store (&writestate, ok ? M_WRITE_DONE : M_WRITE_FAILED);
+    atomic_fetch_add (&writeseq, 1);
+    return NULL;
+}
+
+
+//
+// M_WriteStatus
+// The last write's M_WRITE_* state; seq counts finished writes.
+//
+int M_WriteStatus (unsigned* seq)
+{
+    unsigned	done;
+
+    // writeseq moves after writestate, so a new seq sees the final state
+    done = atomic_load (&writeseq);
+    if (seq)
+	*seq = done;
+    return atomic_load (&writestate);
+}
+
+
+//
+// M_FinishWrites
+// Waits for a write still running.
+//
+void M_FinishWrites (void)
+{
+    if (!writerunning)
+	return;
+    pthread_join (writethread, NULL);
+    writerunning = 0;
+    free (writedata);
+    writedata = NULL;
+}
+
+
+boolean
+M_WriteFileAsync
+( char const*	name,
+  void*		source,
+  int		length,
+  boolean	pack )
+{
+    boolean	ok;
+
+    M_FinishWrites ();
+    atomic_store (&writestate, M_WRITE_BUSY);
+
+    if (asyncwrites && strlen (name) < sizeof(writename)
+	&& (writedata = malloc (length)) != NULL)
+    {
+	strcpy (writename, name);
+	memcpy (writedata, source, length);
+	writelength = length;
+	writepack = pack;
+	if (pthread_create (&writethread, NULL, M_WriteThread, NULL) == 0)
+	{
+	    writerunning = 1;
+	    return true;
+	}
+	free (writedata);
+	writedata = NULL;
+    }
+
+    // no worker: write it here
+    ok = M_WriteFileSafe (name, source, length, pack);
+    atomic_store (&writestate, ok ? M_WRITE_DONE : M_WRITE_FAILED);
+    atomic_fetch_add (&writeseq, 1);
+    return ok;
+}
+
+
 //
 // M_ReadFile
 //
@@ -164,6 +492,62 @@ M_ReadFile
 }
 
 
+//
+// M_MapFile
+// UBO: M_ReadFile as a read-only private mapping, for files that are
+//  parsed once and dropped with M_UnmapFile.  A packed file comes back
+//  unpacked, in a zone block; a damaged one as it is on disk.
+//
+int
+M_MapFile
+( char const*	name,
+  byte**	buffer )
+{
+    int		handle;
+    int		length;
+    int		unpackedlength;
+    struct stat	fileinfo;
+    void*	base;
+    byte*	unpacked;
+	
+    handle = open (name, O_RDONLY | O_BINARY, 0666);
+    if (handle == -1)
+	I_Error ("Couldn't read file %s", name);
+    if (fstat (handle,&fileinfo) == -1 || fileinfo.st_size <= 0)
+	I_Error ("Couldn't read file %s", name);
+    length = fileinfo.st_size;
+    base = mmap (NULL, length, PROT_READ, MAP_PRIVATE, handle, 0);
+    close (handle);
+    if (base == MAP_FAILED)
+	length = M_ReadFile (name, buffer);
+    else
+    {
+	madvise (base, length, MADV_WILLNEED);
+	*buffer = base;
+    }
+
+    if (length < PACKHEADER || memcmp (*buffer, packmagic, sizeof(packmagic)))
+	return length;
+    unpacked = M_UnpackFile (*buffer, length, &unpackedlength);
+    if (!unpacked)
+    {
+	UBO_LOG (UBO_LOG_ERROR, "[doom] M_MapFile: couldn't unpack %s\n", name);
+	return length;
+    }
+    M_UnmapFile (*buffer, length);
+    *buffer = unpacked;
+    return unpackedlength;
+}
+
+void M_UnmapFile (byte* buffer, int length)
+{
+    if (Z_IsZonePtr (buffer))
+	Z_Free (buffer);
+    else
+	munmap (buffer, length);
+}
+
+
 //
 // DEFAULTS
 //
@@ -302,6 +686,128 @@ default_t	defaults[] =
 int	numdefaults;
 char*	defaultfile;
 
+#define NUMDEFAULTS	((int)(sizeof(defaults)/sizeof(defaults[0])))
+#define ISSTRINGDEFAULT(d) \
+	((d)->defaultvalue <= -0xfff || (d)->defaultvalue >= 0xfff)
+
+
+//
+// CONFIG STORE
+// UBO: settings a host passes with doom_set_config before doom_init,
+//  kept parsed to the type of their default.  While any are set the
+//  store replaces the config file: M_LoadDefaults applies them over
+//  the built-in values without opening defaultfile, and M_SaveDefaults
+//  writes nothing; M_GetConfig reads the live values back instead.
+//
+static boolean	configset[NUMDEFAULTS];
+static intptr_t	configvalue[NUMDEFAULTS];	// int, or a malloc'd string
+static int	configcount;
+
+
+static default_t* M_FindDefault (char const* name)
+{
+    int		i;
+
+    for (i=0 ; i<NUMDEFAULTS ; i++)
+	if (!strcmp (name, defaults[i].name))
+	    return &defaults[i];
+    return NULL;
+}
+
+
+static void M_UnsetConfig (int i)
+{
+    if (!configset[i])
+	return;
+    if (ISSTRINGDEFAULT(&defaults[i]))
+	free ((char*)configvalue[i]);
+    configset[i] = false;
+    configcount--;
+}
+
+
+//
+// M_SetConfig
+// value NULL unsets name; name NULL clears the store.  Returns false
+//  for an unknown name or a value that isn't a number for a number.
+//
+boolean M_SetConfig (char const* name, char const* value)
+{
+    default_t*	d;
+    char*	end;
+    char*	copy;
+    long	v;
+    int		i;
+
+    if (!name)
+    {
+	for (i=0 ; i<NUMDEFAULTS ; i++)
+	    M_UnsetConfig (i);
+	return true;
+    }
+    if ((d = M_FindDefault (name)) == NULL)
+	return false;
+    i = d - defaults;
+    if (!value)
+    {
+	M_UnsetConfig (i);
+	return true;
+    }
+
+    if (ISSTRINGDEFAULT(d))
+    {
+	if ((copy = strdup (value)) == NULL)
+	    return false;
+	M_UnsetConfig (i);
+	configvalue[i] = (intptr_t)copy;
+    }
+    else
+    {
+	v = strtol (value, &end, 0);
+	if (end == value || *end)
+	    return false;
+	M_UnsetConfig (i);
+	configvalue[i] = (int)v;
+    }
+    configset[i] = true;
+    configcount++;
+    return true;
+}
+
+
+boolean M_ConfigIsSet (char const* name)
+{
+    default_t*	d;
+
+    d = M_FindDefault (name);
+    return d && configset[d - defaults];
+}
+
+
+//
+// M_GetConfig
+// The current value as text, as the config file would hold it
+//  (without the quotes); the length, or -1 for an unknown name.
+//
+int M_GetConfig (char const* name, char* buffer, int size)
+{
+    default_t*	d;
+    intptr_t	v;
+    int		i;
+
+    if ((d = M_FindDefault (name)) == NULL)
+	return -1;
+    i = d - defaults;
+    if (numdefaults)
+	v = ISSTRINGDEFAULT(d) ? (intptr_t)*(char**)d->location : *d->location;
+    else
+	v = configset[i] ? configvalue[i] : d->defaultvalue;
+
+    if (ISSTRINGDEFAULT(d))
+	return snprintf (buffer, size, "%s", v ? (char*)v : "");
+    return snprintf (buffer, size, "%i", (int)v);
+}
+
 
 //
 // M_SaveDefaults
@@ -312,14 +818,17 @@ void M_SaveDefaults (void)
     int		v;
     FILE*	f;
 	
+    // UBO: the host keeps the settings; there is no file to write
+    if (configcount)
+	return;
+
     f = fopen (defaultfile, "w");
     if (!f)
 	return; // can't write the file, but don't complain
 		
     for (i=0 ; i<numdefaults ; i++)
     {
-	if (defaults[i].defaultvalue > -0xfff
-	    && defaults[i].defaultvalue < 0xfff)
+	if (!ISSTRINGDEFAULT(&defaults[i]))
 	{
 	    v = *defaults[i].location;
 	    fprintf (f,"%s\t\t%i\n",defaults[i].name,v);
@@ -364,6 +873,22 @@ void M_LoadDefaults (void)
     else
 	defaultfile = basedefault;
     
+    // UBO: settings from the host instead of the file
+    if (configcount)
+    {
+	printf ("	%i settings from the host, no default file\n", configcount);
+	for (i=0 ; i<numdefaults ; i++)
+	{
+	    if (!configset[i])
+		continue;
+	    if (ISSTRINGDEFAULT(&defaults[i]))
+		*(char**)defaults[i].location = (char*)configvalue[i];
+	    else
+		*defaults[i].location = configvalue[i];
+	}
+	return;
+    }
+
     // read the file in, overriding any set defaults
     f = fopen (defaultfile, "r");
     if (f)
@@ -498,21 +1023,302 @@ WritePCXfile
 }
 
 
+//
+// PNG SCREENSHOTS
+// UBO: M_WritePNGAsync copies the picture for a worker thread that
+//  builds the PNG (deflated with zlib in a ZLIB=1 build, stored blocks
+//  otherwise) and writes it like M_WriteFileAsync, so a shot costs the
+//  tic one copy.  One shot at a time; M_ScreenShotStatus reports it.
+//
+static atomic_int	shotstate;		// M_WRITE_*
+static atomic_uint	shotseq;		// finished shots
+
+static pthread_t	shotthread;
+static int		shotrunning;
+static char		shotname[1024];
+static byte*		shotpixels;		// packed rows
+static byte		shotpalette[768];
+static int		shotwidth;
+static int		shotheight;
+static boolean		shotindexed;		// else RGB565 big-endian
+
+
+static unsigned M_PNGCrc (unsigned crc, const byte* p, int length)
+{
+#ifdef UBO_ZLIB
+    return crc32 (crc, p, length);
+#else
+    int		k;
+
+    crc = ~crc;
+    while (length--)
+    {
+	crc ^= *p++;
+	for (k=0 ; k<8 ; k++)
+	    crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+    }
+    return ~crc;
+#endif
+}
+
+
+static byte* M_PNGLong (byte* p, unsigned v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+
+//
+// M_PNGChunk
+// Length, type, data and the CRC of type and data.
+//
+static byte*
+M_PNGChunk
+( byte*		p,
+  const char*	type,
+  const byte*	data,
+  int		length )
+{
+    p = M_PNGLong (p, length);
+    memcpy (p, type, 4);
+    if (length)
+	memcpy (p+4, data, length);
+    p = M_PNGLong (p+4+length, M_PNGCrc (0, p, 4+length));
+    return p;
+}
+
+
+//
+// M_PNGDeflate
+// The zlib stream for IDAT; returns its length, 0 when out of memory.
+//
+static int M_PNGDeflate (byte** out, const byte* raw, int length)
+{
+#ifdef UBO_ZLIB
+    uLongf	size;
+
+    size = compressBound (length);
+    if ((*out = malloc (size)) == NULL)
+	return 0;
+    if (compress2 (*out, &size, raw, length, 6) != Z_OK)
+    {
+	free (*out);
+	return 0;
+    }
+    return size;
+#else
+    // stored blocks: 2 byte header, 5 bytes a 64k block, adler32
+    unsigned	a = 1;
+    unsigned	b = 0;
+    byte*	p;
+    int		i;
+    int		n;
+
+    if ((*out = malloc (length + (length/65535+1)*5 + 6)) == NULL)
+	return 0;
+    p = *out;
+    *p++ = 0x78;
+    *p++ = 0x01;
+    do
+    {
+	n = length > 65535 ? 65535 : length;
+	*p++ = n == length;
+	*p++ = n;
+	*p++ = n >> 8;
+	*p++ = ~n;
+	*p++ = ~n >> 8;
+	for (i=0 ; i<n ; i++)
+	{
+	    a = (a + raw[i]) % 65521;
+	    b = (b + a) % 65521;
+	}
+	memcpy (p, raw, n);
+	p += n;
+	raw += n;
+	length -= n;
+    } while (length);
+    p = M_PNGLong (p, (b << 16) | a);
+    return p - *out;
+#endif
+}
+
+
+//
+// M_EncodePNG
+// Filter-less rows, 8-bit indexed with a PLTE or 8-bit RGB.
+//
+static int M_EncodePNG (byte** png)
+{
+    static const byte	signature[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+    byte	header[13];
+    byte*	raw;
+    byte*	idat;
+    byte*	dst;
+    byte*	src;
+    byte*	p;
+    int		rowbytes;
+    int		idatlength;
+    int		x;
+    int		y;
+    unsigned	v;
+
+    rowbytes = 1 + shotwidth * (shotindexed ? 1 : 3);
+    if ((raw = malloc (rowbytes * shotheight)) == NULL)
+	return 0;
+    src = shotpixels;
+    for (y=0 ; y<shotheight ; y++)
+    {
+	dst = raw + y*rowbytes;
+	*dst++ = 0;		// filter: none
+	if (shotindexed)
+	{
+	    memcpy (dst, src, shotwidth);
+	    src += shotwidth;
+	    continue;
+	}
+	for (x=0 ; x<shotwidth ; x++, src += 2)
+	{
+	    v = (src[0] << 8) | src[1];
+	    *dst++ = ((v >> 8) & 0xf8) | (v >> 13);
+	    *dst++ = ((v >> 3) & 0xfc) | ((v >> 9) & 3);
+	    *dst++ = ((v << 3) & 0xf8) | ((v >> 2) & 7);
+	}
+    }
+    idatlength = M_PNGDeflate (&idat, raw, rowbytes * shotheight);
+    free (raw);
+    if (!idatlength)
+	return 0;
+
+    if ((*png = malloc (8 + 25 + 780 + 12 + idatlength + 12)) == NULL)
+    {
+	free (idat);
+	return 0;
+    }
+    M_PNGLong (header, shotwidth);
+    M_PNGLong (header+4, shotheight);
+    header[8] = 8;				// bit depth
+    header[9] = shotindexed ? 3 : 2;		// palette / RGB
+    header[10] = header[11] = header[12] = 0;	// deflate, adaptive, progressive
+
+    memcpy (*png, signature, 8);
+    p = M_PNGChunk (*png+8, "IHDR", header, 13);
+    if (shotindexed)
+	p = M_PNGChunk (p, "PLTE", shotpalette, 768);
+    p = M_PNGChunk (p, "IDAT", idat, idatlength);
+    p = M_PNGChunk (p, "IEND", NULL, 0);
+    free (idat);
+    return p - *png;
+}
+
+
+static void* M_ShotThread (void* arg)
+{
+    byte*	png;
+    int		length;
+    boolean	ok;
+
+    (void)arg;
+    length = M_EncodePNG (&png);
+    free (shotpixels);
+    shotpixels = NULL;
+    ok = length && M_WriteFileSafe (shotname, png, length, false);
+    if (length)
+	free (png);
+    if (!ok)
+	fprintf (stderr, "[doom] M_WritePNGAsync: couldn't write %s\n",
+		 shotname);
+    atomic_store (&shotstate, ok ? M_WRITE_DONE : M_WRITE_FAILED);
+    atomic_fetch_add (&shotseq, 1);
+    return NULL;
+}
+
+
+//
+// M_ScreenShotStatus
+// The last shot's M_WRITE_* state; seq counts finished shots.
+//
+int M_ScreenShotStatus (unsigned* seq)
+{
+    unsigned	done;
+
+    done = atomic_load (&shotseq);
+    if (seq)
+	*seq = done;
+    return atomic_load (&shotstate);
+}
+
+
+//
+// M_FinishScreenShots
+// Waits for a shot still being encoded or written.
+//
+void M_FinishScreenShots (void)
+{
+    if (!shotrunning)
+	return;
+    pthread_join (shotthread, NULL);
+    shotrunning = 0;
+}
+
+
+boolean
+M_WritePNGAsync
+( char const*	name,
+  const void*	pixels,
+  int		width,
+  int		height,
+  int		stride,
+  const byte*	palette )
+{
+    const byte*	src;
+    int		rowbytes;
+    int		y;
+
+    if (atomic_load (&shotstate) == M_WRITE_BUSY)
+	return false;
+    M_FinishScreenShots ();
+
+    rowbytes = width * (palette ? 1 : 2);
+    if (strlen (name) >= sizeof(shotname)
+	|| (shotpixels = malloc (rowbytes * height)) == NULL)
+    {
+	atomic_store (&shotstate, M_WRITE_FAILED);
+	atomic_fetch_add (&shotseq, 1);
+	return true;
+    }
+    strcpy (shotname, name);
+    src = pixels;
+    for (y=0 ; y<height ; y++)
+	memcpy (shotpixels + y*rowbytes, src + y*stride, rowbytes);
+    shotwidth = width;
+    shotheight = height;
+    shotindexed = palette != NULL;
+    if (palette)
+	memcpy (shotpalette, palette, sizeof(shotpalette));
+
+    atomic_store (&shotstate, M_WRITE_BUSY);
+    if (pthread_create (&shotthread, NULL, M_ShotThread, NULL) == 0)
+	shotrunning = 1;
+    else
+	M_ShotThread (NULL);	// no worker: encode it here
+    return true;
+}
+
+
 //
 // M_ScreenShot
 //
 void M_ScreenShot (void)
 {
     int		i;
-    byte*	linear;
     char	lbmname[12];
     
-    // munge planar buffer to linear
-    linear = screens[2];
-    I_ReadScreen (linear);
-    
     // find a file name to save it to
-    strcpy(lbmname,"DOOM00.pcx");
+    strcpy(lbmname,"DOOM00.png");
 		
     for (i=0 ; i<=99 ; i++)
     {
@@ -522,12 +1328,12 @@ void M_ScreenShot (void)
 	    break;	// file doesn't exist
     }
     if (i==100)
-	I_Error ("M_ScreenShot: Couldn't create a PCX");
+	I_Error ("M_ScreenShot: Couldn't create a PNG");
     
-    // save the pcx file
-    WritePCXfile (lbmname, linear,
-		  SCREENWIDTH, SCREENHEIGHT,
-		  W_CacheLumpName ("PLAYPAL",PU_CACHE));
+    // UBO: I_FinishUpdate hands the next frame and its palette to the
+    //  PNG worker instead of a PCX being written from the tic
+    if (!I_RequestScreenShot (lbmname, false))
+	return;
 	
     players[consoleplayer].message = "screen shot";
 }
@@ -37,17 +37,77 @@ M_WriteFile
   void*		source,
   int		length );
 
+// UBO: M_WriteFile of count pieces, without allocating.
+boolean
+M_WriteFileParts
+( char const*	name,
+  void**	parts,
+  int*		lengths,
+  int		count );
+
+// UBO: write on a worker thread via name.tmp, fsync and rename,
+//  zlib packed if pack is set (M_MapFile unpacks it again).
+//  Returns false only when a synchronous fallback write failed.
+#define M_WRITE_NONE	0
+#define M_WRITE_BUSY	1
+#define M_WRITE_DONE	2
+#define M_WRITE_FAILED	3
+
+extern int	asyncwrites;
+
+boolean
+M_WriteFileAsync
+( char const*	name,
+  void*		source,
+  int		length,
+  boolean	pack );
+
+void M_FinishWrites (void);
+
+int M_WriteStatus (unsigned* seq);
+
 int
 M_ReadFile
 ( char const*	name,
   byte**	buffer );
 
+int
+M_MapFile
+( char const*	name,
+  byte**	buffer );
+
+void M_UnmapFile (byte* buffer, int length);
+
 void M_ScreenShot (void);
 
+// UBO: PNG screenshot encoded and written on a worker thread.
+//  With a palette the pixels are 8-bit indices, without one RGB565
+//  big-endian.  Returns false while the last shot is still running.
+boolean
+M_WritePNGAsync
+( char const*	name,
+  const void*	pixels,
+  int		width,
+  int		height,
+  int		stride,
+  const byte*	palette );
+
+void M_FinishScreenShots (void);
+
+int M_ScreenShotStatus (unsigned* seq);
+
 void M_LoadDefaults (void);
 
 void M_SaveDefaults (void);
 
+// UBO: in-memory config store (doom_set_config); while it holds any
+//  setting, no config file is read or written.
+boolean M_SetConfig (char const* name, char const* value);
+
+boolean M_ConfigIsSet (char const* name);
+
+int M_GetConfig (char const* name, char* buffer, int size);
+
 
 int
 M_DrawText
@@ -24,6 +24,10 @@
 static const char rcsid[] = "$Id: m_random.c,v 1.1 1997/02/03 22:45:11 b1 Exp $";
 
 
+#include "doomstat.h"
+#include "m_random.h"
+
+
 //
 // M_Random
 // Returns a 0-255 number
@@ -53,6 +57,13 @@ unsigned char rndtable[256] = {
 int	rndindex = 0;
 int	prndindex = 0;
 
+int		randomstreams = 1;	// UBO_DOOM_RANDOM_STREAMS
+
+// Where each cosmetic stream is on the table; they start spread out
+//  so that none replays another's numbers.
+static unsigned	streamindex[NUMRANDOMSTREAMS];
+static const unsigned streamstart[NUMRANDOMSTREAMS] = { 0, 0, 85, 170 };
+
 // Which one is deterministic?
 int P_Random (void)
 {
@@ -68,7 +79,43 @@ int M_Random (void)
 
 void M_ClearRandom (void)
 {
+    int		i;
+
     rndindex = prndindex = 0;
+    for (i=0 ; i<NUMRANDOMSTREAMS ; i++)
+	streamindex[i] = 0;
+}
+
+
+
+//
+// Random streams.
+//
+int M_StreamRandom (randomstream_t stream)
+{
+    unsigned	index;
+
+    if (stream == rs_playsim)
+	return P_Random ();
+    if (stream == rs_misc
+	|| !randomstreams || demoplayback || demorecording || netgame)
+	return M_Random ();
+
+    index = __atomic_add_fetch (&streamindex[stream], 1, __ATOMIC_RELAXED);
+    return rndtable[(streamstart[stream] + index) & 0xff];
+}
+
+int M_RandomAt (randomstream_t stream, unsigned key)
+{
+    unsigned	h;
+
+    h = key*0x9e3779b1u + (unsigned)stream*0x85ebca77u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h & 0xff;
 }
 
 
@@ -39,6 +39,36 @@ int P_Random (void);
 void M_ClearRandom (void);
 
 
+//
+// Random streams.
+// Subsystems outside the play simulation each draw from their own
+//  stream, so nothing they do moves another's numbers.  Vanilla
+//  runs them all off M_Random's index; so do demos, netgames and
+//  randomstreams 0 (UBO_DOOM_RANDOM_STREAMS), where they are the
+//  same single sequence as before.
+//
+typedef enum
+{
+    rs_playsim,		// P_Random; demo and netgame sync
+    rs_misc,		// M_Random: menus, status bar, intermission
+    rs_render,		// screen wipe and other view-only effects
+    rs_sound,		// sound effect pitch
+    NUMRANDOMSTREAMS
+
+} randomstream_t;
+
+extern int	randomstreams;
+
+// The next 0-255 of stream.  The cosmetic streams may be drawn from
+//  any thread; the order the numbers come out in is then theirs.
+int M_StreamRandom (randomstream_t stream);
+
+// 0-255 from stream's key'th slot, without advancing anything:
+//  work split across threads that keys on e.g. column and frame
+//  gets the same numbers whichever thread does it.
+int M_RandomAt (randomstream_t stream, unsigned key);
+
+
 #endif
 //-----------------------------------------------------------------------------
 //
@@ -32,6 +32,7 @@ rcsid[] = "$Id: p_enemy.c,v 1.5 1997/02/03 22:45:11 b1 Exp $";
 #include "i_system.h"
 
 #include "doomdef.h"
+#include "z_zone.h"
 #include "p_local.h"
 
 #include "s_sound.h"
@@ -95,56 +96,151 @@ void A_Fall (mobj_t *actor);
 
 
 //
-// Called by P_NoiseAlert.
-// Recursively traverse adjacent sectors,
-// sound blocking lines cut off traversal.
+// SOUND FLOOD
+// UBO: P_NoiseAlert wakes the sectors a shot can be heard in: those
+//  reached through open two sided lines, crossing at most one sound
+//  blocking line (soundtraversed 1 without, 2 with one).  Vanilla
+//  recursed line by line; on detailed maps that went deep and
+//  looked up both sides of every line again for each shot.  The
+//  two sided lines of each sector and the sector across them are
+//  listed once per level, and the flood is a breadth first pass
+//  per level of soundtraversed through a queue kept for the level.
+//  The openings still come from the sector heights at the time of
+//  the shot, so every sector ends up with what vanilla gave it.
 //
 
 mobj_t*		soundtarget;
 
-void
-P_RecursiveSound
-( sector_t*	sec,
-  int		soundblocks )
+typedef struct
+{
+    line_t*	line;			// for its sound blocking flag
+    sector_t*	other;			// the sector across it
+} soundlink_t;
+
+static soundlink_t*	soundlinks;
+static int*		soundfirst;	// numsectors+1 offsets into soundlinks
+static sector_t**	soundqueue;	// 2*numsectors: blocked once, then not
+
+
+//
+// P_InitSoundFlood
+// Called by P_SetupLevel once the lines are grouped.
+//
+void P_InitSoundFlood (void)
 {
     int		i;
+    int		j;
+    int		n;
     line_t*	check;
-    sector_t*	other;
-	
-    // wake up all monsters in this sector
-    if (sec->validcount == validcount
-	&& sec->soundtraversed <= soundblocks+1)
+
+    n = 0;
+    for (i=0 ; i<numsectors ; i++)
+	for (j=0 ; j<sectors[i].linecount ; j++)
+	    if (sectors[i].lines[j]->backsector)
+		n++;
+
+    soundlinks = Z_Malloc ((n ? n : 1)*sizeof(*soundlinks), PU_LEVEL, 0);
+    soundfirst = Z_Malloc ((numsectors+1)*sizeof(*soundfirst), PU_LEVEL, 0);
+    soundqueue = Z_Malloc (2*numsectors*sizeof(*soundqueue), PU_LEVEL, 0);
+
+    n = 0;
+    for (i=0 ; i<numsectors ; i++)
     {
-	return;		// already flooded
+	soundfirst[i] = n;
+	for (j=0 ; j<sectors[i].linecount ; j++)
+	{
+	    check = sectors[i].lines[j];
+	    if (!check->backsector)
+		continue;	// one sided: P_LineOpening gives no opening
+	    soundlinks[n].line = check;
+	    if (sides[ check->sidenum[0] ].sector == &sectors[i])
+		soundlinks[n].other = sides[ check->sidenum[1] ].sector;
+	    else
+		soundlinks[n].other = sides[ check->sidenum[0] ].sector;
+	    n++;
+	}
     }
-    
+    soundfirst[numsectors] = n;
+}
+
+
+//
+// P_SoundReaches
+// Marks sec as flooded at soundtraversed level+1 unless it already
+//  is at that level or below; returns true if it has to be visited.
+//
+static boolean P_SoundReaches (sector_t* sec, int level)
+{
+    if (sec->validcount == validcount
+	&& sec->soundtraversed <= level+1)
+	return false;		// already flooded
+
     sec->validcount = validcount;
-    sec->soundtraversed = soundblocks+1;
+    sec->soundtraversed = level+1;
     sec->soundtarget = soundtarget;
-	
-    for (i=0 ;i<sec->linecount ; i++)
-    {
-	check = sec->lines[i];
-	if (! (check->flags & ML_TWOSIDED) )
-	    continue;
-	
-	P_LineOpening (check);
+    return true;
+}
 
-	if (openrange <= 0)
-	    continue;	// closed door
-	
-	if ( sides[ check->sidenum[0] ].sector == sec)
-	    other = sides[ check->sidenum[1] ] .sector;
-	else
-	    other = sides[ check->sidenum[0] ].sector;
-	
-	if (check->flags & ML_SOUNDBLOCK)
+
+//
+// P_FloodSound
+// Level 0 sectors first, so one heard both ways gets 1 before any
+//  level 1 sector is expanded; the first queue holds level 0, the
+//  second the sectors just past one sound blocking line.
+//
+static void P_FloodSound (sector_t* start)
+{
+    sector_t**	queue[2];
+    int		tail[2];
+    int		head;
+    int		level;
+    sector_t*	sec;
+    sector_t*	other;
+    soundlink_t* link;
+    soundlink_t* end;
+    fixed_t	top;
+    fixed_t	bottom;
+
+    queue[0] = soundqueue;
+    queue[1] = soundqueue + numsectors;
+    tail[0] = tail[1] = 0;
+
+    if (P_SoundReaches (start, 0))
+	queue[0][tail[0]++] = start;
+
+    for (level=0 ; level<2 ; level++)
+    {
+	for (head=0 ; head<tail[level] ; head++)
 	{
-	    if (!soundblocks)
-		P_RecursiveSound (other, 1);
+	    sec = queue[level][head];
+	    if (sec->soundtraversed != level+1)
+		continue;	// heard without a block since it was queued
+
+	    link = soundlinks + soundfirst[sec - sectors];
+	    end = soundlinks + soundfirst[sec - sectors + 1];
+	    for ( ; link<end ; link++)
+	    {
+		if (! (link->line->flags & ML_TWOSIDED) )
+		    continue;
+
+		// openrange as P_LineOpening gives it
+		other = link->other;
+		top = sec->ceilingheight < other->ceilingheight
+		    ? sec->ceilingheight : other->ceilingheight;
+		bottom = sec->floorheight > other->floorheight
+		    ? sec->floorheight : other->floorheight;
+		if (top - bottom <= 0)
+		    continue;	// closed door
+
+		if (link->line->flags & ML_SOUNDBLOCK)
+		{
+		    if (!level && P_SoundReaches (other, 1))
+			queue[1][tail[1]++] = other;
+		}
+		else if (P_SoundReaches (other, level))
+		    queue[level][tail[level]++] = other;
+	    }
 	}
-	else
-	    P_RecursiveSound (other, soundblocks);
     }
 }
 
@@ -162,7 +258,7 @@ P_NoiseAlert
 {
     soundtarget = target;
     validcount++;
-    P_RecursiveSound (emmiter->subsector->sector, 0);
+    P_FloodSound (emmiter->subsector->sector);
 }
 
 
@@ -264,11 +360,6 @@ boolean P_CheckMissileRange (mobj_t* actor)
 fixed_t	xspeed[8] = {FRACUNIT,47000,0,-47000,-FRACUNIT,-47000,0,47000};
 fixed_t yspeed[8] = {0,47000,FRACUNIT,47000,0,-47000,-FRACUNIT,-47000};
 
-#define MAXSPECIALCROSS	8
-
-extern	line_t*	spechit[MAXSPECIALCROSS];
-extern	int	numspechit;
-
 boolean P_Move (mobj_t*	actor)
 {
     fixed_t	tryx;
@@ -784,6 +784,9 @@ P_DamageMobj
     fixed_t	thrust;
     int		temp;
 	
+    // UBO: before the returns, as A_VileAttack throws even a corpse
+    P_WakeThinker (&target->thinker);
+
     if ( !(target->flags & MF_SHOOTABLE) )
 	return;	// shouldn't happen...
 		
@@ -26,6 +26,8 @@ static const char
 rcsid[] = "$Id: p_lights.c,v 1.5 1997/02/03 22:45:11 b1 Exp $";
 
 
+#include <string.h>
+
 #include "z_zone.h"
 #include "m_random.h"
 
@@ -145,33 +147,182 @@ void P_SpawnLightFlash (sector_t*	sector)
 
 
 //
-// STROBE LIGHT FLASHING
+// LIGHT TABLES
+// UBO: strobes and glows never call P_Random once spawned, so they
+//  need no place in the thinker list: they sit in two tables and
+//  P_RunLights updates them all after the thinkers, in spawn order
+//  (map glows and strobes first, as they follow the map things in
+//  the list; a strobe a line starts later comes after them, as it
+//  would be appended).  Flickers and flashes draw from P_Random when
+//  they change, so they stay thinkers to keep their place in the
+//  order.  The tables grow by doubling from numsectors, which covers
+//  every map-spawned light, and go with the level (PU_LEVSPEC).
 //
+strobelight_t*	strobes;
+int*		strobecount;	// apart, so the countdown is one plain loop
+int		numstrobes;
+static int	maxstrobes;
+
+glowlight_t*	glows;
+int		numglows;
+static int	maxglows;
 
 
 //
-// T_StrobeFlash
+// P_InitLights
+// Called by P_SpawnSpecials; the zone has just dropped the old tables.
 //
-void T_StrobeFlash (strobe_t*		flash)
+void P_InitLights (void)
 {
-    if (--flash->count)
-	return;
-	
-    if (flash->sector->lightlevel == flash->minlight)
+    strobes = NULL;
+    strobecount = NULL;
+    numstrobes = maxstrobes = 0;
+    glows = NULL;
+    numglows = maxglows = 0;
+}
+
+
+//
+// P_AddStrobe
+//
+void
+P_AddStrobe
+( sector_t*	sector,
+  int		count,
+  int		minlight,
+  int		maxlight,
+  int		darktime,
+  int		brighttime )
+{
+    strobelight_t*	s;
+    int*		c;
+
+    if (numstrobes == maxstrobes)
     {
-	flash-> sector->lightlevel = flash->maxlight;
-	flash->count = flash->brighttime;
+	maxstrobes = maxstrobes ? maxstrobes*2 : numsectors > 8 ? numsectors : 8;
+	s = Z_Malloc (maxstrobes*sizeof(*s), PU_LEVSPEC, 0);
+	c = Z_Malloc (maxstrobes*sizeof(*c), PU_LEVSPEC, 0);
+	if (numstrobes)
+	{
+	    memcpy (s, strobes, numstrobes*sizeof(*s));
+	    memcpy (c, strobecount, numstrobes*sizeof(*c));
+	    Z_Free (strobes);
+	    Z_Free (strobecount);
+	}
+	strobes = s;
+	strobecount = c;
     }
-    else
+
+    s = &strobes[numstrobes];
+    s->sector = sector;
+    s->minlight = minlight;
+    s->maxlight = maxlight;
+    s->darktime = darktime;
+    s->brighttime = brighttime;
+    strobecount[numstrobes++] = count;
+}
+
+
+//
+// P_AddGlow
+//
+void
+P_AddGlow
+( sector_t*	sector,
+  int		minlight,
+  int		maxlight,
+  int		direction )
+{
+    glowlight_t*	g;
+
+    if (numglows == maxglows)
     {
-	flash-> sector->lightlevel = flash->minlight;
-	flash->count =flash->darktime;
+	maxglows = maxglows ? maxglows*2 : numsectors > 8 ? numsectors : 8;
+	g = Z_Malloc (maxglows*sizeof(*g), PU_LEVSPEC, 0);
+	if (numglows)
+	{
+	    memcpy (g, glows, numglows*sizeof(*g));
+	    Z_Free (glows);
+	}
+	glows = g;
+    }
+
+    g = &glows[numglows++];
+    g->sector = sector;
+    g->minlight = minlight;
+    g->maxlight = maxlight;
+    g->direction = direction;
+}
+
+
+//
+// P_RunLights
+// Called by P_RunThinkers after the last thinker.  What T_Glow and
+//  T_StrobeFlash did, glows first: a strobe started in a glowing
+//  sector came after its glow in the list.
+//
+void P_RunLights (void)
+{
+    glowlight_t*	g;
+    strobelight_t*	s;
+    sector_t*		sec;
+    int			i;
+
+    for (i=0, g=glows ; i<numglows ; i++, g++)
+    {
+	sec = g->sector;
+	if (g->direction == -1)
+	{
+	    // DOWN
+	    sec->lightlevel -= GLOWSPEED;
+	    if (sec->lightlevel <= g->minlight)
+	    {
+		sec->lightlevel += GLOWSPEED;
+		g->direction = 1;
+	    }
+	}
+	else if (g->direction == 1)
+	{
+	    // UP
+	    sec->lightlevel += GLOWSPEED;
+	    if (sec->lightlevel >= g->maxlight)
+	    {
+		sec->lightlevel -= GLOWSPEED;
+		g->direction = -1;
+	    }
+	}
     }
 
+    // Most tics no strobe changes; only the countdown runs.
+    for (i=0 ; i<numstrobes ; i++)
+	strobecount[i]--;
+
+    for (i=0, s=strobes ; i<numstrobes ; i++, s++)
+    {
+	if (strobecount[i])
+	    continue;
+
+	if (s->sector->lightlevel == s->minlight)
+	{
+	    s->sector->lightlevel = s->maxlight;
+	    strobecount[i] = s->brighttime;
+	}
+	else
+	{
+	    s->sector->lightlevel = s->minlight;
+	    strobecount[i] = s->darktime;
+	}
+    }
 }
 
 
 
+//
+// STROBE LIGHT FLASHING
+//
+
+
+
 //
 // P_SpawnStrobeFlash
 // After the map has been loaded, scan each sector
@@ -183,29 +334,25 @@ P_SpawnStrobeFlash
   int		fastOrSlow,
   int		inSync )
 {
-    strobe_t*	flash;
+    int		minlight;
+    int		maxlight;
+    int		count;
 	
-    flash = Z_Malloc ( sizeof(*flash), PU_LEVSPEC, 0);
-
-    P_AddThinker (&flash->thinker);
-
-    flash->sector = sector;
-    flash->darktime = fastOrSlow;
-    flash->brighttime = STROBEBRIGHT;
-    flash->thinker.function.acp1 = (actionf_p1) T_StrobeFlash;
-    flash->maxlight = sector->lightlevel;
-    flash->minlight = P_FindMinSurroundingLight(sector, sector->lightlevel);
+    maxlight = sector->lightlevel;
+    minlight = P_FindMinSurroundingLight(sector, sector->lightlevel);
 		
-    if (flash->minlight == flash->maxlight)
-	flash->minlight = 0;
+    if (minlight == maxlight)
+	minlight = 0;
 
     // nothing special about it during gameplay
     sector->special = 0;	
 
     if (!inSync)
-	flash->count = (P_Random()&7)+1;
+	count = (P_Random()&7)+1;
     else
-	flash->count = 1;
+	count = 1;
+
+    P_AddStrobe (sector, count, minlight, maxlight, fastOrSlow, STROBEBRIGHT);
 }
 
 
@@ -310,47 +457,12 @@ EV_LightTurnOn
 //
 // Spawn glowing light
 //
-
-void T_Glow(glow_t*	g)
-{
-    switch(g->direction)
-    {
-      case -1:
-	// DOWN
-	g->sector->lightlevel -= GLOWSPEED;
-	if (g->sector->lightlevel <= g->minlight)
-	{
-	    g->sector->lightlevel += GLOWSPEED;
-	    g->direction = 1;
-	}
-	break;
-	
-      case 1:
-	// UP
-	g->sector->lightlevel += GLOWSPEED;
-	if (g->sector->lightlevel >= g->maxlight)
-	{
-	    g->sector->lightlevel -= GLOWSPEED;
-	    g->direction = -1;
-	}
-	break;
-    }
-}
-
-
 void P_SpawnGlowingLight(sector_t*	sector)
 {
-    glow_t*	g;
-	
-    g = Z_Malloc( sizeof(*g), PU_LEVSPEC, 0);
-
-    P_AddThinker(&g->thinker);
-
-    g->sector = sector;
-    g->minlight = P_FindMinSurroundingLight(sector,sector->lightlevel);
-    g->maxlight = sector->lightlevel;
-    g->thinker.function.acp1 = (actionf_p1) T_Glow;
-    g->direction = -1;
+    P_AddGlow (sector,
+	       P_FindMinSurroundingLight(sector,sector->lightlevel),
+	       sector->lightlevel,
+	       -1);
 
     sector->special = 0;
 }
@@ -73,6 +73,8 @@ extern	thinker_t	thinkercap;
 void P_InitThinkers (void);
 void P_AddThinker (thinker_t* thinker);
 void P_RemoveThinker (thinker_t* thinker);
+void P_WakeThinker (thinker_t* thinker);
+void P_UnparkThinkers (void);
 
 
 //
@@ -114,6 +116,7 @@ P_SpawnMobj
   mobjtype_t	type );
 
 void 	P_RemoveMobj (mobj_t* th);
+void	P_InitStates (void);
 boolean	P_SetMobjState (mobj_t* mobj, statenum_t state);
 void 	P_MobjThinker (mobj_t* mobj);
 
@@ -127,6 +130,7 @@ void	P_SpawnPlayerMissile (mobj_t* source, mobjtype_t type);
 // P_ENEMY
 //
 void P_NoiseAlert (mobj_t* target, mobj_t* emmiter);
+void P_InitSoundFlood (void);
 
 
 //
@@ -151,10 +155,12 @@ typedef struct
     }			d;
 } intercept_t;
 
+// Starting size of the growable intercept pool.
 #define MAXINTERCEPTS	128
 
-extern intercept_t	intercepts[MAXINTERCEPTS];
+extern intercept_t*	intercepts;
 extern intercept_t*	intercept_p;
+extern int		interceptpeak;	// most in one trace this level
 
 typedef boolean (*traverser_t) (intercept_t *in);
 
@@ -173,6 +179,8 @@ extern fixed_t		lowfloor;
 void 	P_LineOpening (line_t* linedef);
 
 boolean P_BlockLinesIterator (int x, int y, boolean(*func)(line_t*) );
+boolean P_BlockLinesInBox (int x, int y, const fixed_t* box,
+			   boolean(*func)(line_t*) );
 boolean P_BlockThingsIterator (int x, int y, boolean(*func)(mobj_t*) );
 
 #define PT_ADDLINES		1
@@ -207,11 +215,29 @@ extern fixed_t		tmceilingz;
 
 extern	line_t*		ceilingline;
 
+// Special lines crossed by the move being checked, in a pool that
+// starts at MAXSPECIALCROSS and grows.
+#define MAXSPECIALCROSS		8
+
+extern line_t**		spechit;
+extern int		numspechit;
+extern int		spechitpeak;	// most in one move this level
+
 boolean P_CheckPosition (mobj_t *thing, fixed_t x, fixed_t y);
 boolean P_TryMove (mobj_t* thing, fixed_t x, fixed_t y);
 boolean P_TeleportMove (mobj_t* thing, fixed_t x, fixed_t y);
 void	P_SlideMove (mobj_t* mo);
 boolean P_CheckSight (mobj_t* t1, mobj_t* t2);
+void	P_InitSightCache (void);
+void	P_FlushSightCache (void);
+void	P_SectorMoved (sector_t* sector);
+extern int		sightcache;	// reuse exact P_CheckSight results
+extern int		sightcachehits;
+extern int		sightcounts[2];	// rejected, traced
+void	P_PrepareSight (void);
+void	P_ShutdownSightThreads (void);
+extern int		sightthreads;	// trace likely checks in parallel
+extern int		sightprepared;
 void 	P_UseLines (player_t* player);
 
 boolean P_ChangeSector (sector_t* sector, boolean crunch);
@@ -244,13 +270,19 @@ P_RadiusAttack
 // P_SETUP
 //
 extern byte*		rejectmatrix;	// for fast sight rejection
-extern short*		blockmaplump;	// offsets in blockmap are from here
-extern short*		blockmap;
+extern byte*		rejectlive;	// the same, or built (P_LoadReject)
+extern char*		levelcache;	// directory of derived map data
+void	P_FreeLevelCache (void);
+extern int*		blockmap;	// block b is blockmaplines[blockmap[b]]
+extern int*		blockmaplines;	//  up to blockmaplines[blockmap[b+1]]
+extern fixed_t*		blocklinebox[4];	// BOXTOP.. of each list entry
 extern int		bmapwidth;
 extern int		bmapheight;	// in mapblocks
 extern fixed_t		bmaporgx;
 extern fixed_t		bmaporgy;	// origin of block map
 extern mobj_t**		blocklinks;	// for thing chains
+extern int		loadthreads;	// share map lump conversion
+void	P_ShutdownLoadThreads (void);
 
 
 
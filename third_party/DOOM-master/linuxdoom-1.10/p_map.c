@@ -64,10 +64,10 @@ line_t*		ceilingline;
 
 // keep track of special lines as they are hit,
 // but don't process them until the move is proven valid
-#define MAXSPECIALCROSS		8
-
-line_t*		spechit[MAXSPECIALCROSS];
+line_t**	spechit;
 int		numspechit;
+int		spechitpeak;
+static int	maxspechit;
 
 
 
@@ -239,8 +239,13 @@ boolean PIT_CheckLine (line_t* ld)
     // if contacted a special line, add it to the list
     if (ld->special)
     {
+	if (numspechit == maxspechit)
+	    spechit = I_GrowArray (spechit, &maxspechit, sizeof(*spechit),
+				   MAXSPECIALCROSS, "spechits");
 	spechit[numspechit] = ld;
 	numspechit++;
+	if (numspechit > spechitpeak)
+	    spechitpeak = numspechit;
     }
 
     return true;
@@ -435,7 +440,7 @@ P_CheckPosition
 
     for (bx=xl ; bx<=xh ; bx++)
 	for (by=yl ; by<=yh ; by++)
-	    if (!P_BlockLinesIterator (bx,by,PIT_CheckLine))
+	    if (!P_BlockLinesInBox (bx,by,tmbbox,PIT_CheckLine))
 		return false;
 
     return true;
@@ -1155,6 +1160,41 @@ mobj_t*		bombsource;
 mobj_t*		bombspot;
 int		bombdamage;
 
+// shootable things in range, gathered before any is damaged
+static mobj_t**	bombtargets;
+static int	numbombtargets;
+static int	maxbombtargets;
+
+
+//
+// PIT_RadiusTarget
+// Lists the things PIT_RadiusAttack would not turn away on flags,
+//  type or distance, so the blocks are walked in one tight pass that
+//  only reads the things' leading fields, and the sight checks and
+//  damage then run down the list.
+//
+boolean PIT_RadiusTarget (mobj_t* thing)
+{
+    fixed_t	dx;
+    fixed_t	dy;
+    fixed_t	dist;
+
+    if (!(thing->flags & MF_SHOOTABLE))
+	return true;
+
+    dx = abs(thing->x - bombspot->x);
+    dy = abs(thing->y - bombspot->y);
+    dist = dx>dy ? dx : dy;
+    if ((dist - thing->radius) >> FRACBITS >= bombdamage)
+	return true;
+
+    if (numbombtargets == maxbombtargets)
+	bombtargets = I_GrowArray (bombtargets, &maxbombtargets,
+				   sizeof(*bombtargets), 64, "bomb targets");
+    bombtargets[numbombtargets++] = thing;
+    return true;
+}
+
 
 //
 // PIT_RadiusAttack
@@ -1215,6 +1255,9 @@ P_RadiusAttack
     int		xh;
     int		yl;
     int		yh;
+    int		first;
+    int		i;
+    mobj_t*	thing;
     
     fixed_t	dist;
 	
@@ -1227,9 +1270,23 @@ P_RadiusAttack
     bombsource = source;
     bombdamage = damage;
 	
+    // A death state's action could explode at once and nest here,
+    //  so each call lists above its caller's targets.  Things are only
+    //  damaged, never moved, so the listed ones are those the block
+    //  walk would have damaged, in the same order; PIT_RadiusAttack
+    //  still checks each one as it comes, skipping any removed since.
+    first = numbombtargets;
     for (y=yl ; y<=yh ; y++)
 	for (x=xl ; x<=xh ; x++)
-	    P_BlockThingsIterator (x, y, PIT_RadiusAttack );
+	    P_BlockThingsIterator (x, y, PIT_RadiusTarget );
+
+    for (i=first ; i<numbombtargets ; i++)
+    {
+	thing = bombtargets[i];
+	if (thing->thinker.function.acv != (actionf_v)(-1))
+	    PIT_RadiusAttack (thing);
+    }
+    numbombtargets = first;
 }
 
 
@@ -1258,6 +1315,9 @@ boolean PIT_ChangeSector (mobj_t*	thing)
 {
     mobj_t*	mo;
 	
+    // UBO: its sector moves, so it may not be parked (p_tick.c)
+    P_WakeThinker (&thing->thinker);
+
     if (P_ThingHeightClip (thing))
     {
 	// keep checking
@@ -1314,6 +1374,29 @@ boolean PIT_ChangeSector (mobj_t*	thing)
 
 
 
+//
+// PIT_ChangeSectorNear
+// UBO: PIT_ChangeSector for things whose box reaches the moving
+//  sector's lines.  The blockbox is whole 128 unit blocks grown by
+//  MAXRADIUS, so most of what it holds stands well clear of a lift.
+//
+int		sectorclip = 1;		// UBO_DOOM_SECTOR_CLIP
+static sector_t*	changesector;
+
+static boolean PIT_ChangeSectorNear (mobj_t* thing)
+{
+    fixed_t*	bbox = changesector->bbox;
+
+    if (thing->x + thing->radius < bbox[BOXLEFT]
+	|| thing->x - thing->radius > bbox[BOXRIGHT]
+	|| thing->y + thing->radius < bbox[BOXBOTTOM]
+	|| thing->y - thing->radius > bbox[BOXTOP])
+	return true;
+
+    return PIT_ChangeSector (thing);
+}
+
+
 //
 // P_ChangeSector
 //
@@ -1324,14 +1407,25 @@ P_ChangeSector
 {
     int		x;
     int		y;
+    boolean	(*func)(mobj_t*);
 	
     nofit = false;
     crushchange = crunch;
+
+    // Vanilla also re-clips things clear of the sector, which can
+    //  crush a stuck monster or refresh a stale floorz; demos and
+    //  netgames keep doing that so they stay in sync.
+    func = PIT_ChangeSector;
+    if (sectorclip && !demoplayback && !demorecording && !netgame)
+    {
+	changesector = sector;
+	func = PIT_ChangeSectorNear;
+    }
 	
     // re-check heights for all things near the moving sector
     for (x=sector->blockbox[BOXLEFT] ; x<= sector->blockbox[BOXRIGHT] ; x++)
 	for (y=sector->blockbox[BOXBOTTOM];y<= sector->blockbox[BOXTOP] ; y++)
-	    P_BlockThingsIterator (x, y, PIT_ChangeSector);
+	    P_BlockThingsIterator (x, y, func);
 	
 	
     return nofit;
@@ -32,6 +32,7 @@ rcsid[] = "$Id: p_maputl.c,v 1.5 1997/02/03 22:45:11 b1 Exp $";
 
 
 #include "m_bbox.h"
+#include "i_system.h"
 
 #include "doomdef.h"
 #include "p_local.h"
@@ -475,7 +476,8 @@ P_BlockLinesIterator
   boolean(*func)(line_t*) )
 {
     int			offset;
-    short*		list;
+    int*		list;
+    int*		end;
     line_t*		ld;
 	
     if (x<0
@@ -487,10 +489,10 @@ P_BlockLinesIterator
     }
     
     offset = y*bmapwidth+x;
-	
-    offset = *(blockmap+offset);
 
-    for ( list = blockmaplump+offset ; *list != -1 ; list++)
+    list = blockmaplines + blockmap[offset];
+    end = blockmaplines + blockmap[offset+1];
+    for ( ; list < end ; list++)
     {
 	ld = &lines[*list];
 
@@ -506,6 +508,79 @@ P_BlockLinesIterator
 }
 
 
+//
+// P_BlockLinesInBox
+// P_BlockLinesIterator for a func that ignores every line whose
+//  bbox misses box (with PIT_CheckLine's edge test).  Each stretch of
+//  the block's list is first tested against blocklinebox, a loop with
+//  no branches or line_t reads the compiler can vectorize; only the
+//  lines that touch box are then marked and handed to func, in list
+//  order.  A missed line is left unmarked, which is harmless: it
+//  misses again in any other block of the same query.
+//
+#define LINESTRETCH	64
+
+boolean
+P_BlockLinesInBox
+( int			x,
+  int			y,
+  const fixed_t*	box,
+  boolean(*func)(line_t*) )
+{
+    fixed_t		top = box[BOXTOP];
+    fixed_t		bottom = box[BOXBOTTOM];
+    fixed_t		left = box[BOXLEFT];
+    fixed_t		right = box[BOXRIGHT];
+    const fixed_t*	ltop;
+    const fixed_t*	lbottom;
+    const fixed_t*	lleft;
+    const fixed_t*	lright;
+    byte		touch[LINESTRETCH];
+    int			first;
+    int			end;
+    int			count;
+    int			i;
+    line_t*		ld;
+
+    if (x<0
+	|| y<0
+	|| x>=bmapwidth
+	|| y>=bmapheight)
+    {
+	return true;
+    }
+
+    first = blockmap[y*bmapwidth+x];
+    end = blockmap[y*bmapwidth+x+1];
+    for ( ; first < end ; first += count)
+    {
+	count = end-first < LINESTRETCH ? end-first : LINESTRETCH;
+	ltop = blocklinebox[BOXTOP] + first;
+	lbottom = blocklinebox[BOXBOTTOM] + first;
+	lleft = blocklinebox[BOXLEFT] + first;
+	lright = blocklinebox[BOXRIGHT] + first;
+	for (i=0 ; i<count ; i++)
+	    touch[i] = (right > lleft[i]) & (left < lright[i])
+		& (top > lbottom[i]) & (bottom < ltop[i]);
+
+	for (i=0 ; i<count ; i++)
+	{
+	    if (!touch[i])
+		continue;
+	    ld = &lines[blockmaplines[first+i]];
+	    if (ld->validcount == validcount)
+		continue; 	// line has already been checked
+
+	    ld->validcount = validcount;
+
+	    if ( !func(ld) )
+		return false;
+	}
+    }
+    return true;	// everything was checked
+}
+
+
 //
 // P_BlockThingsIterator
 //
@@ -541,13 +616,36 @@ P_BlockThingsIterator
 //
 // INTERCEPT ROUTINES
 //
-intercept_t	intercepts[MAXINTERCEPTS];
+intercept_t*	intercepts;
 intercept_t*	intercept_p;
+int		interceptpeak;
+static int	maxintercepts;
 
 divline_t 	trace;
 boolean 	earlyout;
 int		ptflags;
 
+
+//
+// P_CheckIntercepts
+// Makes room for one more intercept: the pool starts at
+//  MAXINTERCEPTS and doubles, so a long trace on a detailed map no
+//  longer runs off the end of it.
+//
+static void P_CheckIntercepts (void)
+{
+    int		used;
+
+    used = intercept_p - intercepts;
+    if (used < maxintercepts)
+	return;
+
+    intercepts = I_GrowArray (intercepts, &maxintercepts,
+			      sizeof(*intercepts), MAXINTERCEPTS,
+			      "intercepts");
+    intercept_p = intercepts + used;
+}
+
 //
 // PIT_AddLineIntercepts.
 // Looks for lines in the given block
@@ -600,6 +698,7 @@ PIT_AddLineIntercepts (line_t* ld)
     }
     
 	
+    P_CheckIntercepts ();
     intercept_p->frac = frac;
     intercept_p->isaline = true;
     intercept_p->d.line = ld;
@@ -665,6 +764,7 @@ boolean PIT_AddThingIntercepts (mobj_t* thing)
     if (frac < 0)
 	return true;		// behind source
 
+    P_CheckIntercepts ();
     intercept_p->frac = frac;
     intercept_p->isaline = false;
     intercept_p->d.thing = thing;
@@ -685,45 +785,35 @@ P_TraverseIntercepts
   fixed_t	maxfrac )
 {
     int			count;
-    fixed_t		dist;
     intercept_t*	scan;
     intercept_t*	in;
+    intercept_t		hold;
 	
     count = intercept_p - intercepts;
-    
-    in = 0;			// shut up compiler warning
-	
-    while (count--)
+    if (count > interceptpeak)
+	interceptpeak = count;
+
+    // Sort by frac.  Insertion is stable, so equal fracs keep the
+    //  order they were added in, which is the one the old repeated
+    //  minimum search picked them in; the block walk adds them
+    //  nearly in order, so this is close to one pass.
+    for (scan = intercepts+1 ; scan<intercept_p ; scan++)
     {
-	dist = MAXINT;
-	for (scan = intercepts ; scan<intercept_p ; scan++)
-	{
-	    if (scan->frac < dist)
-	    {
-		dist = scan->frac;
-		in = scan;
-	    }
-	}
-	
-	if (dist > maxfrac)
-	    return true;	// checked everything in range		
+	if (scan[-1].frac <= scan->frac)
+	    continue;
+	hold = *scan;
+	for (in = scan ; in > intercepts && in[-1].frac > hold.frac ; in--)
+	    *in = in[-1];
+	*in = hold;
+    }
 
-#if 0  // UNUSED
+    for (in = intercepts ; in<intercept_p ; in++)
     {
-	// don't check these yet, there may be others inserted
-	in = scan = intercepts;
-	for ( scan = intercepts ; scan<intercept_p ; scan++)
-	    if (scan->frac > maxfrac)
-		*in++ = *scan;
-	intercept_p = in;
-	return false;
-    }
-#endif
+	if (in->frac > maxfrac)
+	    return true;	// checked everything in range		
 
         if ( !func (in) )
 	    return false;	// don't bother going farther
-
-	in->frac = MAXINT;
     }
 	
     return true;		// everything was traversed
@@ -30,6 +30,7 @@ rcsid[] = "$Id: p_mobj.c,v 1.5 1997/02/03 22:45:12 b1 Exp $";
 
 #include "doomdef.h"
 #include "p_local.h"
+#include "p_saveg.h"
 #include "sounds.h"
 
 #include "st_stuff.h"
@@ -43,6 +44,77 @@ rcsid[] = "$Id: p_mobj.c,v 1.5 1997/02/03 22:45:12 b1 Exp $";
 void G_PlayerReborn (int player);
 void P_SpawnMapThing (mapthing_t*	mthing);
 
+void A_Look (mobj_t* actor);
+void A_Chase (mobj_t* actor);
+void A_FaceTarget (mobj_t* actor);
+
+
+//
+// PACKED STATES
+// A state_t is 28 bytes or more, and every transition used to be an
+//  indirect call.  P_InitStates packs what P_SetMobjState reads into
+//  8 bytes a state and numbers the monster actions run most often,
+//  which are then called directly; the rest still go through
+//  states[].action.
+//
+enum
+{
+    SA_NONE,
+    SA_CHASE,
+    SA_LOOK,
+    SA_FACETARGET,
+    SA_OTHER
+};
+
+typedef struct
+{
+    short		tics;
+    unsigned short	frame;
+    unsigned short	nextstate;
+    byte		sprite;
+    byte		action;
+} packedstate_t;
+
+static packedstate_t	packedstates[NUMSTATES];
+
+
+//
+// P_InitStates
+//
+void P_InitStates (void)
+{
+    packedstate_t*	ps;
+    state_t*		st;
+    int			i;
+
+    for (i=0 ; i<NUMSTATES ; i++)
+    {
+	st = &states[i];
+	ps = &packedstates[i];
+
+	if (st->tics != (short)st->tics
+	    || st->frame != (unsigned short)st->frame
+	    || st->sprite != (byte)st->sprite)
+	    I_Error ("P_InitStates: state %i does not pack", i);
+
+	ps->tics = st->tics;
+	ps->frame = st->frame;
+	ps->nextstate = st->nextstate;
+	ps->sprite = st->sprite;
+
+	if (!st->action.acp1)
+	    ps->action = SA_NONE;
+	else if (st->action.acp1 == (actionf_p1)A_Chase)
+	    ps->action = SA_CHASE;
+	else if (st->action.acp1 == (actionf_p1)A_Look)
+	    ps->action = SA_LOOK;
+	else if (st->action.acp1 == (actionf_p1)A_FaceTarget)
+	    ps->action = SA_FACETARGET;
+	else
+	    ps->action = SA_OTHER;
+    }
+}
+
 
 //
 // P_SetMobjState
@@ -55,7 +127,10 @@ P_SetMobjState
 ( mobj_t*	mobj,
   statenum_t	state )
 {
-    state_t*	st;
+    packedstate_t*	ps;
+
+    // UBO: a parked mobj has something to do again
+    P_WakeThinker (&mobj->thinker);
 
     do
     {
@@ -66,18 +141,31 @@ P_SetMobjState
 	    return false;
 	}
 
-	st = &states[state];
-	mobj->state = st;
-	mobj->tics = st->tics;
-	mobj->sprite = st->sprite;
-	mobj->frame = st->frame;
+	ps = &packedstates[state];
+	mobj->state = &states[state];
+	mobj->tics = ps->tics;
+	mobj->sprite = ps->sprite;
+	mobj->frame = ps->frame;
 
 	// Modified handling.
 	// Call action functions when the state is set
-	if (st->action.acp1)		
-	    st->action.acp1(mobj);	
+	switch (ps->action)
+	{
+	  case SA_CHASE:
+	    A_Chase (mobj);
+	    break;
+	  case SA_LOOK:
+	    A_Look (mobj);
+	    break;
+	  case SA_FACETARGET:
+	    A_FaceTarget (mobj);
+	    break;
+	  case SA_OTHER:
+	    states[state].action.acp1 (mobj);
+	    break;
+	}
 	
-	state = st->nextstate;
+	state = ps->nextstate;
     } while (!mobj->tics);
 				
     return true;
@@ -526,6 +614,11 @@ P_SpawnMobj
     else 
 	mobj->z = z;
 
+    mobj->oldx = mobj->x;
+    mobj->oldy = mobj->y;
+    mobj->oldz = mobj->z;
+    mobj->oldangle = mobj->angle;
+
     mobj->thinker.function.acp1 = (actionf_p1)P_MobjThinker;
 	
     P_AddThinker (&mobj->thinker);
@@ -669,6 +762,7 @@ void P_SpawnPlayer (mapthing_t* mthing)
 	mobj->flags |= (mthing->type-1)<<MF_TRANSSHIFT;
 		
     mobj->angle	= ANG45 * (mthing->angle/45);
+    mobj->oldangle = mobj->angle;
     mobj->player = p;
     mobj->health = p->health;
 
@@ -772,6 +866,22 @@ void P_SpawnMapThing (mapthing_t* mthing)
 	return;
     }
     
+    // UBO: a savegame being loaded replaces every thing, so keep only
+    //  what spawning it would leave behind: the level totals and the
+    //  P_Random calls for lastlook and tics.  Netgames spawn anyway,
+    //  as removing the things also queues items to respawn.
+    if (loadinggame && !netgame)
+    {
+	P_Random ();
+	if (states[mobjinfo[i].spawnstate].tics > 0)
+	    P_Random ();
+	if (mobjinfo[i].flags & MF_COUNTKILL)
+	    totalkills++;
+	if (mobjinfo[i].flags & MF_COUNTITEM)
+	    totalitems++;
+	return;
+    }
+
     // spawn it
     x = mthing->x << FRACBITS;
     y = mthing->y << FRACBITS;
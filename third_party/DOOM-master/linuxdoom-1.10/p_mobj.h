@@ -204,6 +204,11 @@ typedef enum
 
 
 // Map Object definition.
+// UBO: the fields P_MobjThinker, P_XYMovement and the P_CheckPosition
+//  iterators read for every mobj come first, so a collision test
+//  touches one or two cache lines; the rest follow.  x, y and z stay
+//  right after the thinker, as in degenmobj_t.  Savegames keep the
+//  vanilla order (savemobj_t in p_saveg.c).
 typedef struct mobj_s
 {
     // List: thinker links.
@@ -214,14 +219,22 @@ typedef struct mobj_s
     fixed_t		y;
     fixed_t		z;
 
-    // More list: links in sector (if needed)
-    struct mobj_s*	snext;
-    struct mobj_s*	sprev;
+    int			flags;
 
-    //More drawing info: to determine current sprite.
-    angle_t		angle;	// orientation
-    spritenum_t		sprite;	// used to find patch_t and flip value
-    int			frame;	// might be ORed with FF_FULLBRIGHT
+    // For movement checking.
+    fixed_t		radius;
+    fixed_t		height;	
+
+    // Momentums, used to update position.
+    fixed_t		momx;
+    fixed_t		momy;
+    fixed_t		momz;
+
+    // The closest interval over all contacted Sectors.
+    fixed_t		floorz;
+    fixed_t		ceilingz;
+
+    int			tics;	// state tic counter
 
     // Interaction info, by BLOCKMAP.
     // Links in blocks (if needed).
@@ -230,38 +243,33 @@ typedef struct mobj_s
     
     struct subsector_s*	subsector;
 
-    // The closest interval over all contacted Sectors.
-    fixed_t		floorz;
-    fixed_t		ceilingz;
+    state_t*		state;
 
-    // For movement checking.
-    fixed_t		radius;
-    fixed_t		height;	
+    // Thing being chased/attacked (or NULL),
+    // also the originator for missiles.
+    struct mobj_s*	target;
 
-    // Momentums, used to update position.
-    fixed_t		momx;
-    fixed_t		momy;
-    fixed_t		momz;
+    mobjtype_t		type;
+    int			health;
+
+    // More list: links in sector (if needed)
+    struct mobj_s*	snext;
+    struct mobj_s*	sprev;
+
+    //More drawing info: to determine current sprite.
+    angle_t		angle;	// orientation
+    spritenum_t		sprite;	// used to find patch_t and flip value
+    int			frame;	// might be ORed with FF_FULLBRIGHT
 
     // If == validcount, already checked.
     int			validcount;
 
-    mobjtype_t		type;
     mobjinfo_t*		info;	// &mobjinfo[mobj->type]
-    
-    int			tics;	// state tic counter
-    state_t*		state;
-    int			flags;
-    int			health;
 
     // Movement direction, movement generation (zig-zagging).
     int			movedir;	// 0-7
     int			movecount;	// when 0, select a new dir
 
-    // Thing being chased/attacked (or NULL),
-    // also the originator for missiles.
-    struct mobj_s*	target;
-
     // Reaction time: if non 0, don't attack yet.
     // Used by player to freeze a bit after teleporting.
     int			reactiontime;   
@@ -282,6 +290,13 @@ typedef struct mobj_s
 
     // Thing being chased/attacked for tracers.
     struct mobj_s*	tracer;	
+
+    // UBO: where the thing was at the start of the last tic, for
+    //  drawing it between tics (R_InterpolateMobj).  Not saved.
+    fixed_t		oldx;
+    fixed_t		oldy;
+    fixed_t		oldz;
+    angle_t		oldangle;
     
 } mobj_t;
 
@@ -24,6 +24,11 @@
 static const char
 rcsid[] = "$Id: p_tick.c,v 1.4 1997/02/03 16:47:55 b1 Exp $";
 
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
 #include "i_system.h"
 #include "z_zone.h"
 #include "p_local.h"
@@ -33,6 +38,7 @@ rcsid[] = "$Id: p_tick.c,v 1.4 1997/02/03 16:47:55 b1 Exp $";
 #include "r_state.h"
 
 byte*		save_p;
+boolean		loadinggame;
 
 
 // Pads save_p to a 4-byte boundary
@@ -40,6 +46,134 @@ byte*		save_p;
 #define PADSAVEP()	save_p += (4 - ((int) save_p & 3)) & 3
 
 
+//
+// SAVE BUFFER
+// UBO: the P_Archive* functions write into a heap buffer that grows
+//  ahead of each record (P_SaveReserve), where vanilla used a fixed
+//  SAVEGAMESIZE stretch of screens[1] and gave up past it.  The
+//  buffer is kept from one save to the next; realloc keeps its 4 byte
+//  alignment, so PADSAVEP pads the same after a move.
+//
+#define SAVEBUFFERSIZE	0x2c000		// vanilla's SAVEGAMESIZE
+
+static byte*	savebuf;
+static int	savebufsize;
+
+
+//
+// P_SaveBegin
+// Points save_p at the start of the save buffer.
+//
+void P_SaveBegin (void)
+{
+    if (!savebuf)
+    {
+	savebuf = malloc (SAVEBUFFERSIZE);
+	if (!savebuf)
+	    I_Error ("P_SaveBegin: no memory for the savegame buffer");
+	savebufsize = SAVEBUFFERSIZE;
+    }
+    save_p = savebuf;
+}
+
+
+//
+// P_SaveReserve
+// Makes room for bytes more at save_p, and the padding before them.
+//
+void P_SaveReserve (int bytes)
+{
+    int		used;
+    int		size;
+    byte*	buf;
+
+    used = save_p - savebuf;
+    if (used + bytes + 3 <= savebufsize)
+	return;
+
+    for (size = savebufsize ; used + bytes + 3 > size ; size *= 2)
+	;
+    buf = realloc (savebuf, size);
+    if (!buf)
+	I_Error ("P_SaveReserve: no memory for a %i byte savegame", size);
+    savebuf = buf;
+    savebufsize = size;
+    save_p = buf + used;
+}
+
+
+//
+// P_SaveBuffer
+// The start of what was written since P_SaveBegin.
+//
+byte* P_SaveBuffer (void)
+{
+    return savebuf;
+}
+
+// UBO: the vanilla thinker_t; the run list links that follow it in
+//  memory (p_tick.c) are not saved.
+typedef struct
+{
+    thinker_t*		prev;
+    thinker_t*		next;
+    think_t		function;
+
+} savethinker_t;
+
+// UBO: a mobj_t as vanilla lays it out, which is what a savegame
+//  holds.  mobj_t itself puts its hot fields first, so P_ArchiveThinkers
+//  and P_UnArchiveThinkers go through this field by field; the fields
+//  mobj_t has beyond these are rebuilt on load.
+typedef struct
+{
+    savethinker_t	thinker;
+    fixed_t		x;
+    fixed_t		y;
+    fixed_t		z;
+    struct mobj_s*	snext;
+    struct mobj_s*	sprev;
+    angle_t		angle;
+    spritenum_t		sprite;
+    int			frame;
+    struct mobj_s*	bnext;
+    struct mobj_s*	bprev;
+    struct subsector_s*	subsector;
+    fixed_t		floorz;
+    fixed_t		ceilingz;
+    fixed_t		radius;
+    fixed_t		height;	
+    fixed_t		momx;
+    fixed_t		momy;
+    fixed_t		momz;
+    int			validcount;
+    mobjtype_t		type;
+    mobjinfo_t*		info;
+    int			tics;
+    state_t*		state;
+    int			flags;
+    int			health;
+    int			movedir;
+    int			movecount;
+    struct mobj_s*	target;
+    int			reactiontime;   
+    int			threshold;
+    struct player_s*	player;
+    int			lastlook;	
+    mapthing_t		spawnpoint;	
+    struct mobj_s*	tracer;	
+
+} savemobj_t;
+
+#define SAVEMOBJFIELDS \
+    F(x) F(y) F(z) F(snext) F(sprev) F(angle) F(sprite)	\
+    F(frame) F(bnext) F(bprev) F(subsector) F(floorz) F(ceilingz)	\
+    F(radius) F(height) F(momx) F(momy) F(momz) F(validcount)		\
+    F(type) F(info) F(tics) F(state) F(flags) F(health) F(movedir)	\
+    F(movecount) F(target) F(reactiontime) F(threshold) F(player)	\
+    F(lastlook) F(spawnpoint) F(tracer)
+
+
 
 //
 // P_ArchivePlayers
@@ -55,6 +189,7 @@ void P_ArchivePlayers (void)
 	if (!playeringame[i])
 	    continue;
 	
+	P_SaveReserve (sizeof(player_t));
 	PADSAVEP();
 
 	dest = (player_t *)save_p;
@@ -120,6 +255,8 @@ void P_ArchiveWorld (void)
     side_t*		si;
     short*		put;
 	
+    // 7 shorts a sector, 3 a line and up to 5 for each of its sides
+    P_SaveReserve ((numsectors*7 + numlines*13) * sizeof(short));
     put = (short *)save_p;
     
     // do sectors
@@ -188,6 +325,7 @@ void P_UnArchiveWorld (void)
 	sec->specialdata = 0;
 	sec->soundtarget = 0;
     }
+    P_FlushSightCache ();
     
     // do lines
     for (i=0, li = lines ; i<numlines ; i++,li++)
@@ -233,21 +371,30 @@ void P_ArchiveThinkers (void)
 {
     thinker_t*		th;
     mobj_t*		mobj;
+    savemobj_t		saved;
 	
     // save off the current thinkers
     for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
     {
 	if (th->function.acp1 == (actionf_p1)P_MobjThinker)
 	{
+	    P_SaveReserve (1 + sizeof(saved));
 	    *save_p++ = tc_mobj;
 	    PADSAVEP();
-	    mobj = (mobj_t *)save_p;
-	    memcpy (mobj, th, sizeof(*mobj));
-	    save_p += sizeof(*mobj);
-	    mobj->state = (state_t *)(mobj->state - states);
+	    mobj = (mobj_t *)th;
+	    memset (&saved, 0, sizeof(saved));
+	    saved.thinker.prev = mobj->thinker.prev;
+	    saved.thinker.next = mobj->thinker.next;
+	    saved.thinker.function = mobj->thinker.function;
+#define F(f) saved.f = mobj->f;
+	    SAVEMOBJFIELDS
+#undef F
+	    saved.state = (state_t *)(saved.state - states);
 	    
-	    if (mobj->player)
-		mobj->player = (player_t *)((mobj->player-players) + 1);
+	    if (saved.player)
+		saved.player = (player_t *)((saved.player-players) + 1);
+	    memcpy (save_p, &saved, sizeof(saved));
+	    save_p += sizeof(saved);
 	    continue;
 	}
 		
@@ -255,6 +402,7 @@ void P_ArchiveThinkers (void)
     }
 
     // add a terminating marker
+    P_SaveReserve (1);
     *save_p++ = tc_end;	
 }
 
@@ -269,8 +417,10 @@ void P_UnArchiveThinkers (void)
     thinker_t*		currentthinker;
     thinker_t*		next;
     mobj_t*		mobj;
+    savemobj_t		saved;
     
     // remove all the current thinkers
+    P_UnparkThinkers ();
     currentthinker = thinkercap.next;
     while (currentthinker != &thinkercap)
     {
@@ -284,6 +434,7 @@ void P_UnArchiveThinkers (void)
 	currentthinker = next;
     }
     P_InitThinkers ();
+    numstrobes = numglows = 0;	// the level's lights, as thinkers above
 	
     // read in saved thinkers
     while (1)
@@ -297,8 +448,15 @@ void P_UnArchiveThinkers (void)
 	  case tc_mobj:
 	    PADSAVEP();
 	    mobj = Z_Malloc (sizeof(*mobj), PU_LEVEL, NULL);
-	    memcpy (mobj, save_p, sizeof(*mobj));
-	    save_p += sizeof(*mobj);
+	    memcpy (&saved, save_p, sizeof(saved));
+	    save_p += sizeof(saved);
+#define F(f) mobj->f = saved.f;
+	    SAVEMOBJFIELDS
+#undef F
+	    mobj->oldx = mobj->x;
+	    mobj->oldy = mobj->y;
+	    mobj->oldz = mobj->z;
+	    mobj->oldangle = mobj->angle;
 	    mobj->state = &states[(int)mobj->state];
 	    mobj->target = NULL;
 	    if (mobj->player)
@@ -341,6 +499,70 @@ enum
 
 
 
+//
+// P_ArchiveSpecial
+// UBO: a special as vanilla laid it out: its class, padding,
+//  savethinker_t, then the rest of the struct, with the sector
+//  pointer at sectorofs swizzled.
+//
+static void
+P_ArchiveSpecial
+( int		tclass,
+  thinker_t*	th,
+  size_t	size,
+  size_t	sectorofs )
+{
+    savethinker_t	header;
+    sector_t*		sector;
+
+    P_SaveReserve (1 + size - sizeof(thinker_t) + sizeof(header));
+    *save_p++ = tclass;
+    PADSAVEP();
+
+    header.prev = th->prev;
+    header.next = th->next;
+    header.function = th->function;
+    memcpy (save_p, &header, sizeof(header));
+    save_p += sizeof(header);
+
+    memcpy (save_p, (byte *)th + sizeof(thinker_t), size - sizeof(thinker_t));
+    memcpy (&sector, (byte *)th + sectorofs, sizeof(sector));
+    sector = (sector_t *)(sector - sectors);
+    memcpy (save_p + (sectorofs - sizeof(thinker_t)), &sector, sizeof(sector));
+    save_p += size - sizeof(thinker_t);
+}
+
+
+//
+// P_UnArchiveSpecial
+// The other way; the function is the saved one, for the callers
+//  that look at it.
+//
+static void*
+P_UnArchiveSpecial
+( size_t	size,
+  size_t	sectorofs )
+{
+    savethinker_t	header;
+    thinker_t*		th;
+    sector_t*		sector;
+
+    th = Z_Malloc (size, PU_LEVEL, NULL);
+    memcpy (&header, save_p, sizeof(header));
+    save_p += sizeof(header);
+    th->function = header.function;
+
+    memcpy ((byte *)th + sizeof(thinker_t), save_p, size - sizeof(thinker_t));
+    save_p += size - sizeof(thinker_t);
+
+    memcpy (&sector, (byte *)th + sectorofs, sizeof(sector));
+    sector = &sectors[(intptr_t)sector];
+    memcpy ((byte *)th + sectorofs, &sector, sizeof(sector));
+    return th;
+}
+
+
+
 //
 // Things to handle:
 //
@@ -348,20 +570,15 @@ enum
 // T_VerticalDoor, (vldoor_t: sector_t * swizzle),
 // T_MoveFloor, (floormove_t: sector_t * swizzle),
 // T_LightFlash, (lightflash_t: sector_t * swizzle),
-// T_StrobeFlash, (strobe_t: sector_t *),
-// T_Glow, (glow_t: sector_t *),
+// strobes, (strobe_t: sector_t *), from p_lights.c's table
+// glows, (glow_t: sector_t *), likewise
 // T_PlatRaise, (plat_t: sector_t *), - active list
 //
 void P_ArchiveSpecials (void)
 {
     thinker_t*		th;
-    ceiling_t*		ceiling;
-    vldoor_t*		door;
-    floormove_t*	floor;
-    plat_t*		plat;
-    lightflash_t*	flash;
-    strobe_t*		strobe;
-    glow_t*		glow;
+    strobe_t		strobe;
+    glow_t		glow;
     int			i;
 	
     // save off the current thinkers
@@ -374,96 +591,67 @@ void P_ArchiveSpecials (void)
 		    break;
 	    
 	    if (i<MAXCEILINGS)
-	    {
-		*save_p++ = tc_ceiling;
-		PADSAVEP();
-		ceiling = (ceiling_t *)save_p;
-		memcpy (ceiling, th, sizeof(*ceiling));
-		save_p += sizeof(*ceiling);
-		ceiling->sector = (sector_t *)(ceiling->sector - sectors);
-	    }
+		P_ArchiveSpecial (tc_ceiling, th, sizeof(ceiling_t), offsetof(ceiling_t, sector));
 	    continue;
 	}
 			
 	if (th->function.acp1 == (actionf_p1)T_MoveCeiling)
 	{
-	    *save_p++ = tc_ceiling;
-	    PADSAVEP();
-	    ceiling = (ceiling_t *)save_p;
-	    memcpy (ceiling, th, sizeof(*ceiling));
-	    save_p += sizeof(*ceiling);
-	    ceiling->sector = (sector_t *)(ceiling->sector - sectors);
+	    P_ArchiveSpecial (tc_ceiling, th, sizeof(ceiling_t), offsetof(ceiling_t, sector));
 	    continue;
 	}
 			
 	if (th->function.acp1 == (actionf_p1)T_VerticalDoor)
 	{
-	    *save_p++ = tc_door;
-	    PADSAVEP();
-	    door = (vldoor_t *)save_p;
-	    memcpy (door, th, sizeof(*door));
-	    save_p += sizeof(*door);
-	    door->sector = (sector_t *)(door->sector - sectors);
+	    P_ArchiveSpecial (tc_door, th, sizeof(vldoor_t), offsetof(vldoor_t, sector));
 	    continue;
 	}
 			
 	if (th->function.acp1 == (actionf_p1)T_MoveFloor)
 	{
-	    *save_p++ = tc_floor;
-	    PADSAVEP();
-	    floor = (floormove_t *)save_p;
-	    memcpy (floor, th, sizeof(*floor));
-	    save_p += sizeof(*floor);
-	    floor->sector = (sector_t *)(floor->sector - sectors);
+	    P_ArchiveSpecial (tc_floor, th, sizeof(floormove_t), offsetof(floormove_t, sector));
 	    continue;
 	}
 			
 	if (th->function.acp1 == (actionf_p1)T_PlatRaise)
 	{
-	    *save_p++ = tc_plat;
-	    PADSAVEP();
-	    plat = (plat_t *)save_p;
-	    memcpy (plat, th, sizeof(*plat));
-	    save_p += sizeof(*plat);
-	    plat->sector = (sector_t *)(plat->sector - sectors);
+	    P_ArchiveSpecial (tc_plat, th, sizeof(plat_t), offsetof(plat_t, sector));
 	    continue;
 	}
 			
 	if (th->function.acp1 == (actionf_p1)T_LightFlash)
 	{
-	    *save_p++ = tc_flash;
-	    PADSAVEP();
-	    flash = (lightflash_t *)save_p;
-	    memcpy (flash, th, sizeof(*flash));
-	    save_p += sizeof(*flash);
-	    flash->sector = (sector_t *)(flash->sector - sectors);
-	    continue;
-	}
-			
-	if (th->function.acp1 == (actionf_p1)T_StrobeFlash)
-	{
-	    *save_p++ = tc_strobe;
-	    PADSAVEP();
-	    strobe = (strobe_t *)save_p;
-	    memcpy (strobe, th, sizeof(*strobe));
-	    save_p += sizeof(*strobe);
-	    strobe->sector = (sector_t *)(strobe->sector - sectors);
-	    continue;
-	}
-			
-	if (th->function.acp1 == (actionf_p1)T_Glow)
-	{
-	    *save_p++ = tc_glow;
-	    PADSAVEP();
-	    glow = (glow_t *)save_p;
-	    memcpy (glow, th, sizeof(*glow));
-	    save_p += sizeof(*glow);
-	    glow->sector = (sector_t *)(glow->sector - sectors);
+	    P_ArchiveSpecial (tc_flash, th, sizeof(lightflash_t), offsetof(lightflash_t, sector));
 	    continue;
 	}
     }
+
+    // UBO: strobes and glows from p_lights.c's tables, in their
+    //  vanilla records; the order of specials does not matter on load.
+    for (i = 0; i < numstrobes; i++)
+    {
+	memset (&strobe, 0, sizeof(strobe));
+	strobe.sector = strobes[i].sector;
+	strobe.count = strobecount[i];
+	strobe.minlight = strobes[i].minlight;
+	strobe.maxlight = strobes[i].maxlight;
+	strobe.darktime = strobes[i].darktime;
+	strobe.brighttime = strobes[i].brighttime;
+	P_ArchiveSpecial (tc_strobe, &strobe.thinker, sizeof(strobe), offsetof(strobe_t, sector));
+    }
+
+    for (i = 0; i < numglows; i++)
+    {
+	memset (&glow, 0, sizeof(glow));
+	glow.sector = glows[i].sector;
+	glow.minlight = glows[i].minlight;
+	glow.maxlight = glows[i].maxlight;
+	glow.direction = glows[i].direction;
+	P_ArchiveSpecial (tc_glow, &glow.thinker, sizeof(glow), offsetof(glow_t, sector));
+    }
 	
     // add a terminating marker
+    P_SaveReserve (1);
     *save_p++ = tc_endspecials;	
 
 }
@@ -495,10 +683,7 @@ void P_UnArchiveSpecials (void)
 			
 	  case tc_ceiling:
 	    PADSAVEP();
-	    ceiling = Z_Malloc (sizeof(*ceiling), PU_LEVEL, NULL);
-	    memcpy (ceiling, save_p, sizeof(*ceiling));
-	    save_p += sizeof(*ceiling);
-	    ceiling->sector = &sectors[(int)ceiling->sector];
+	    ceiling = P_UnArchiveSpecial (sizeof(*ceiling), offsetof(ceiling_t, sector));
 	    ceiling->sector->specialdata = ceiling;
 
 	    if (ceiling->thinker.function.acp1)
@@ -510,10 +695,7 @@ void P_UnArchiveSpecials (void)
 				
 	  case tc_door:
 	    PADSAVEP();
-	    door = Z_Malloc (sizeof(*door), PU_LEVEL, NULL);
-	    memcpy (door, save_p, sizeof(*door));
-	    save_p += sizeof(*door);
-	    door->sector = &sectors[(int)door->sector];
+	    door = P_UnArchiveSpecial (sizeof(*door), offsetof(vldoor_t, sector));
 	    door->sector->specialdata = door;
 	    door->thinker.function.acp1 = (actionf_p1)T_VerticalDoor;
 	    P_AddThinker (&door->thinker);
@@ -521,10 +703,7 @@ void P_UnArchiveSpecials (void)
 				
 	  case tc_floor:
 	    PADSAVEP();
-	    floor = Z_Malloc (sizeof(*floor), PU_LEVEL, NULL);
-	    memcpy (floor, save_p, sizeof(*floor));
-	    save_p += sizeof(*floor);
-	    floor->sector = &sectors[(int)floor->sector];
+	    floor = P_UnArchiveSpecial (sizeof(*floor), offsetof(floormove_t, sector));
 	    floor->sector->specialdata = floor;
 	    floor->thinker.function.acp1 = (actionf_p1)T_MoveFloor;
 	    P_AddThinker (&floor->thinker);
@@ -532,10 +711,7 @@ void P_UnArchiveSpecials (void)
 				
 	  case tc_plat:
 	    PADSAVEP();
-	    plat = Z_Malloc (sizeof(*plat), PU_LEVEL, NULL);
-	    memcpy (plat, save_p, sizeof(*plat));
-	    save_p += sizeof(*plat);
-	    plat->sector = &sectors[(int)plat->sector];
+	    plat = P_UnArchiveSpecial (sizeof(*plat), offsetof(plat_t, sector));
 	    plat->sector->specialdata = plat;
 
 	    if (plat->thinker.function.acp1)
@@ -547,32 +723,26 @@ void P_UnArchiveSpecials (void)
 				
 	  case tc_flash:
 	    PADSAVEP();
-	    flash = Z_Malloc (sizeof(*flash), PU_LEVEL, NULL);
-	    memcpy (flash, save_p, sizeof(*flash));
-	    save_p += sizeof(*flash);
-	    flash->sector = &sectors[(int)flash->sector];
+	    flash = P_UnArchiveSpecial (sizeof(*flash), offsetof(lightflash_t, sector));
 	    flash->thinker.function.acp1 = (actionf_p1)T_LightFlash;
 	    P_AddThinker (&flash->thinker);
 	    break;
 				
 	  case tc_strobe:
 	    PADSAVEP();
-	    strobe = Z_Malloc (sizeof(*strobe), PU_LEVEL, NULL);
-	    memcpy (strobe, save_p, sizeof(*strobe));
-	    save_p += sizeof(*strobe);
-	    strobe->sector = &sectors[(int)strobe->sector];
-	    strobe->thinker.function.acp1 = (actionf_p1)T_StrobeFlash;
-	    P_AddThinker (&strobe->thinker);
+	    strobe = P_UnArchiveSpecial (sizeof(*strobe), offsetof(strobe_t, sector));
+	    P_AddStrobe (strobe->sector, strobe->count,
+			 strobe->minlight, strobe->maxlight,
+			 strobe->darktime, strobe->brighttime);
+	    Z_Free (strobe);
 	    break;
 				
 	  case tc_glow:
 	    PADSAVEP();
-	    glow = Z_Malloc (sizeof(*glow), PU_LEVEL, NULL);
-	    memcpy (glow, save_p, sizeof(*glow));
-	    save_p += sizeof(*glow);
-	    glow->sector = &sectors[(int)glow->sector];
-	    glow->thinker.function.acp1 = (actionf_p1)T_Glow;
-	    P_AddThinker (&glow->thinker);
+	    glow = P_UnArchiveSpecial (sizeof(*glow), offsetof(glow_t, sector));
+	    P_AddGlow (glow->sector, glow->minlight, glow->maxlight,
+		       glow->direction);
+	    Z_Free (glow);
 	    break;
 				
 	  default:
@@ -40,7 +40,19 @@ void P_UnArchiveThinkers (void);
 void P_ArchiveSpecials (void);
 void P_UnArchiveSpecials (void);
 
-extern byte*		save_p; 
+extern byte*		save_p;
+
+// UBO: the archive functions write into a buffer that grows as they
+//  go.  P_SaveBegin points save_p at its start, P_SaveReserve makes
+//  room for that many bytes more (moving the buffer, so take pointers
+//  into it after), and P_SaveBuffer is its start once they are done.
+void P_SaveBegin (void);
+void P_SaveReserve (int bytes);
+byte* P_SaveBuffer (void);
+
+// UBO: set while G_DoLoadGame sets the level up, so P_SpawnMapThing
+//  skips things P_UnArchiveThinkers would remove again.
+extern boolean		loadinggame; 
 
 
 #endif
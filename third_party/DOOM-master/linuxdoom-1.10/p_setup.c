@@ -27,7 +27,15 @@ rcsid[] = "$Id: p_setup.c,v 1.5 1997/02/03 22:45:12 b1 Exp $";
 
 
 #include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "z_zone.h"
 
@@ -37,6 +45,7 @@ rcsid[] = "$Id: p_setup.c,v 1.5 1997/02/03 22:45:12 b1 Exp $";
 #include "g_game.h"
 
 #include "i_system.h"
+#include "i_log.h"
 #include "w_wad.h"
 
 #include "doomdef.h"
@@ -86,9 +95,9 @@ side_t*		sides;
 // Blockmap size.
 int		bmapwidth;
 int		bmapheight;	// size in mapblocks
-short*		blockmap;	// int for larger maps
-// offsets in blockmap are from here
-short*		blockmaplump;		
+int*		blockmap;	// per block, first line in blockmaplines
+int*		blockmaplines;	// every block's lines, end to end
+fixed_t*	blocklinebox[4];	// bbox of every blockmaplines entry
 // origin of block map
 fixed_t		bmaporgx;
 fixed_t		bmaporgy;
@@ -105,6 +114,10 @@ mobj_t**	blocklinks;
 //
 byte*		rejectmatrix;
 
+// P_CheckSight's table outside demos and netgames: the WAD's, or one
+//  built by P_LoadReject when the map shipped without any.
+byte*		rejectlive;
+
 
 // Maintain single and multi player starting spots.
 #define MAX_DEATHMATCH_STARTS	10
@@ -115,41 +128,387 @@ mapthing_t	playerstarts[MAXPLAYERS];
 
 
 
+//
+// Level loading on loadthreads threads (UBO_DOOM_LOAD_THREADS).
+// The loaders count the records, make the arrays and cache the lump
+//  on the engine thread, as the zone and the level arena are not
+//  thread safe; only the conversion loop, which writes each record
+//  on its own, is handed out in chunks that the workers and the
+//  engine thread claim in turn.  P_SetupLevel keeps its order, so a
+//  loader still sees everything the ones before it made.
+//
+#define MAXLOADTHREADS		8
+#define LOADCHUNK		256	// records per claim
+
+typedef void (*loadconvert_t) (const byte* data, int first, int last);
+
+int			loadthreads = 1;
+
+static int		numloadthreads = 1;
+static pthread_t	loadpthreads[MAXLOADTHREADS];
+static pthread_mutex_t	loadlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	loadstartcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	loaddonecond = PTHREAD_COND_INITIALIZER;
+static unsigned		loadtask;
+static int		loadpending;
+static boolean		loadquit;
+
+static loadconvert_t	loadconvert;
+static const byte*	loaddata;
+static int		loadcount;
+static int		loadnext;
+static boolean		loadfailed;
+
+
+static void P_RunLoadChunks (void)
+{
+    int		first;
+    int		last;
+
+    while ((first = __atomic_fetch_add (&loadnext, LOADCHUNK, __ATOMIC_RELAXED))
+	   < loadcount)
+    {
+	last = first + LOADCHUNK;
+	loadconvert (loaddata, first, last < loadcount ? last : loadcount);
+    }
+}
+
+
+static void* P_LoadThread (void* arg)
+{
+    unsigned	task = 0;
+    boolean	quit;
+    jmp_buf	errorjmp;
+
+    for (;;)
+    {
+	pthread_mutex_lock (&loadlock);
+	while (loadtask == task && !loadquit)
+	    pthread_cond_wait (&loadstartcond, &loadlock);
+	task = loadtask;
+	quit = loadquit;
+	pthread_mutex_unlock (&loadlock);
+	if (quit)
+	    break;
+
+	// A missing texture or flat only flags the pass here; the
+	//  engine thread converts it again itself and fails there.
+	i_errorjmp = &errorjmp;
+	if (!setjmp (errorjmp))
+	    P_RunLoadChunks ();
+	else
+	    loadfailed = true;
+	i_errorjmp = NULL;
+
+	pthread_mutex_lock (&loadlock);
+	if (--loadpending == 0)
+	    pthread_cond_signal (&loaddonecond);
+	pthread_mutex_unlock (&loadlock);
+    }
+    return NULL;
+}
+
+
+//
+// P_InitLoadThreads
+// Starts loadthreads-1 workers, or stops them all for 1.
+//
+static void P_InitLoadThreads (void)
+{
+    int		count = loadthreads;
+    int		i;
+
+    if (count > MAXLOADTHREADS)
+	count = MAXLOADTHREADS;
+    if (count < 1)
+	count = 1;
+    if (count == numloadthreads)
+	return;
+
+    P_ShutdownLoadThreads ();
+    loadquit = false;
+    loadtask = 0;
+    for (i=1 ; i<count ; i++)
+    {
+	if (pthread_create (&loadpthreads[i], NULL, P_LoadThread, NULL) != 0)
+	{
+	    fprintf (stderr, "[doom] P_SetupLevel: load thread %d failed to start\n", i);
+	    break;
+	}
+	numloadthreads = i+1;
+    }
+    fprintf (stderr, "[doom] P_SetupLevel: %d load threads\n", numloadthreads);
+}
+
+
+//
+// P_ShutdownLoadThreads
+//
+void P_ShutdownLoadThreads (void)
+{
+    int		i;
+
+    if (numloadthreads > 1)
+    {
+	pthread_mutex_lock (&loadlock);
+	loadquit = true;
+	pthread_cond_broadcast (&loadstartcond);
+	pthread_mutex_unlock (&loadlock);
+
+	for (i=1 ; i<numloadthreads ; i++)
+	    pthread_join (loadpthreads[i], NULL);
+    }
+    numloadthreads = 1;
+}
+
+
+//
+// P_ConvertRecords
+// Runs convert over records 0..count-1 of data, on the load
+//  threads too when there are enough records to share.
+//
+static void P_ConvertRecords (loadconvert_t convert, const byte* data, int count)
+{
+    jmp_buf*	savedjmp;
+    jmp_buf	errorjmp;
+
+    if (numloadthreads <= 1 || count < 2*LOADCHUNK)
+    {
+	convert (data, 0, count);
+	return;
+    }
+
+    loadconvert = convert;
+    loaddata = data;
+    loadcount = count;
+    loadnext = 0;
+    loadfailed = false;
+
+    pthread_mutex_lock (&loadlock);
+    loadpending = numloadthreads-1;
+    loadtask++;
+    pthread_cond_broadcast (&loadstartcond);
+    pthread_mutex_unlock (&loadlock);
+
+    // the workers still read data and fill the arrays, so an
+    //  error must not leave before they are done
+    savedjmp = i_errorjmp;
+    i_errorjmp = &errorjmp;
+    if (!setjmp (errorjmp))
+	P_RunLoadChunks ();
+    else
+	loadfailed = true;
+    i_errorjmp = savedjmp;
+
+    pthread_mutex_lock (&loadlock);
+    while (loadpending)
+	pthread_cond_wait (&loaddonecond, &loadlock);
+    pthread_mutex_unlock (&loadlock);
+
+    if (loadfailed)
+	convert (data, 0, count);
+}
+
+
+
+
+
+//
+// ZDBSP extended nodes.
+// A NODES lump that starts with "XNOD" (or "ZNOD", the same after
+//  a zlib stream) carries the BSP with 32 bit indices, for maps too
+//  big for the vanilla lumps:
+//	orgverts newverts { x y }[newverts]	(fixed_t)
+//	numsubsectors { numsegs }[]		(segs follow each other)
+//	numsegs { v1 v2 line side }[]		(32, 32, 16, 8 bits)
+//	numnodes { x y dx dy bbox[2][4] children[2] }[]
+//			(16 bit partition and box, 32 bit children)
+//  all little endian; SEGS and SSECTORS are then empty.
+//  P_OpenExtendedNodes checks the sizes up front, so the loaders
+//  below only convert.
+//
+#define XSEGSIZE	11
+#define XNODESIZE	32
+
+typedef struct
+{
+    int			orgverts;
+    int			newverts;
+    int			numsubsectors;
+    int			numsegs;
+    int			numnodes;
+    const byte*		vertexes;
+    const byte*		subsectors;
+    const byte*		segs;
+    const byte*		nodes;
+} xnodes_t;
+
+static xnodes_t		xnodes;
+static boolean		extendednodes;
+static byte*		xnodeslump;	// cached NODES lump (XNOD)
+static byte*		xnodesbuf;	// inflated ZNOD stream
+
+static inline int P_ReadLong (const byte* p)
+{
+    return p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned)p[3]<<24);
+}
+
+static inline int P_ReadShort (const byte* p)
+{
+    return (short)(p[0] | (p[1]<<8));
+}
+
+static const byte* P_TakeNodeRecords (const byte** p, const byte* end,
+				      int count, int size)
+{
+    const byte*	records = *p;
+
+    if (count < 0 || (end - records) / size < count)
+	I_Error ("P_SetupLevel: extended nodes are truncated");
+    *p = records + (long)count*size;
+    return records;
+}
+
+static int P_TakeNodeCount (const byte** p, const byte* end)
+{
+    return P_ReadLong (P_TakeNodeRecords (p, end, 1, 4));
+}
+
+static void P_CloseNodesLump (void)
+{
+    if (xnodeslump)
+	Z_Free (xnodeslump);
+    xnodeslump = NULL;
+}
+
+//
+// P_CloseExtendedNodes
+//
+static void P_CloseExtendedNodes (void)
+{
+    P_CloseNodesLump ();
+    free (xnodesbuf);
+    xnodesbuf = NULL;
+    extendednodes = false;
+}
+
+//
+// P_OpenExtendedNodes
+// Sets extendednodes when the map's NODES are ZDBSP's, and finds
+//  each table in them.
+//
+static void P_OpenExtendedNodes (int lump)
+{
+    byte*	data;
+    const byte*	p;
+    const byte*	end;
+    int		size;
+
+    P_CloseExtendedNodes ();
+    size = W_LumpLength (lump);
+    if (size < 4)
+	return;
+    data = xnodeslump = W_CacheLumpNum (lump, PU_STATIC);
+    if (!memcmp (data, "XNOD", 4))
+    {
+	p = data+4;
+	end = data+size;
+    }
+    else if (!memcmp (data, "ZNOD", 4))
+    {
+	xnodesbuf = W_Inflate (data+4, size-4, &size);
+	P_CloseNodesLump ();
+	p = xnodesbuf;
+	end = xnodesbuf+size;
+    }
+    else
+    {
+	P_CloseNodesLump ();
+	return;
+    }
+
+    extendednodes = true;
+    xnodes.orgverts = P_TakeNodeCount (&p, end);
+    xnodes.newverts = P_TakeNodeCount (&p, end);
+    xnodes.vertexes = P_TakeNodeRecords (&p, end, xnodes.newverts, 8);
+    xnodes.numsubsectors = P_TakeNodeCount (&p, end);
+    xnodes.subsectors = P_TakeNodeRecords (&p, end, xnodes.numsubsectors, 4);
+    xnodes.numsegs = P_TakeNodeCount (&p, end);
+    xnodes.segs = P_TakeNodeRecords (&p, end, xnodes.numsegs, XSEGSIZE);
+    xnodes.numnodes = P_TakeNodeCount (&p, end);
+    xnodes.nodes = P_TakeNodeRecords (&p, end, xnodes.numnodes, XNODESIZE);
+    if (xnodes.orgverts < 0
+	|| xnodes.orgverts > W_LumpLength (lump-ML_NODES+ML_VERTEXES)
+	/ (int)sizeof(mapvertex_t))
+	I_Error ("P_SetupLevel: extended nodes use %i of the map's vertexes",
+		 xnodes.orgverts);
+}
+
+//
+// P_MapSubsectorCount
+//
+static int P_MapSubsectorCount (int lumpnum)
+{
+    if (extendednodes)
+	return xnodes.numsubsectors;
+    return W_LumpLength (lumpnum+ML_SSECTORS) / sizeof(mapsubsector_t);
+}
+
 
 
 //
 // P_LoadVertexes
 //
+static void P_ConvertVertexes (const byte* data, int first, int last)
+{
+    int			i;
+    const mapvertex_t*	ml;
+    vertex_t*		li;
+
+    ml = (const mapvertex_t *)data + first;
+    li = vertexes + first;
+
+    // Copy and convert vertex coordinates,
+    // internal representation as fixed.
+    for (i=first ; i<last ; i++, li++, ml++)
+    {
+	li->x = SHORT(ml->x)<<FRACBITS;
+	li->y = SHORT(ml->y)<<FRACBITS;
+    }
+}
+
 void P_LoadVertexes (int lump)
 {
     byte*		data;
+
     int			i;
-    mapvertex_t*	ml;
-    vertex_t*		li;
 
     // Determine number of lumps:
     //  total lump length / vertex record length.
     numvertexes = W_LumpLength (lump) / sizeof(mapvertex_t);
 
+    // Extended nodes add the vertexes their splits made after
+    //  the first orgverts of the lump.
+    if (extendednodes)
+	numvertexes = xnodes.orgverts + xnodes.newverts;
+
     // Allocate zone memory for buffer.
-    vertexes = Z_Malloc (numvertexes*sizeof(vertex_t),PU_LEVEL,0);	
+    vertexes = Z_LevelMalloc (numvertexes*sizeof(vertex_t));	
 
     // Load data into cache.
     data = W_CacheLumpNum (lump,PU_STATIC);
-	
-    ml = (mapvertex_t *)data;
-    li = vertexes;
-
-    // Copy and convert vertex coordinates,
-    // internal representation as fixed.
-    for (i=0 ; i<numvertexes ; i++, li++, ml++)
-    {
-	li->x = SHORT(ml->x)<<FRACBITS;
-	li->y = SHORT(ml->y)<<FRACBITS;
-    }
+    P_ConvertRecords (P_ConvertVertexes, data,
+		      extendednodes ? xnodes.orgverts : numvertexes);
 
     // Free buffer memory.
     Z_Free (data);
+
+    if (extendednodes)
+	for (i=0 ; i<xnodes.newverts ; i++)
+	{
+	    vertexes[xnodes.orgverts+i].x = P_ReadLong (xnodes.vertexes + i*8);
+	    vertexes[xnodes.orgverts+i].y = P_ReadLong (xnodes.vertexes + i*8+4);
+	}
 }
 
 
@@ -157,31 +516,25 @@ void P_LoadVertexes (int lump)
 //
 // P_LoadSegs
 //
-void P_LoadSegs (int lump)
+static void P_ConvertSegs (const byte* data, int first, int last)
 {
-    byte*		data;
     int			i;
-    mapseg_t*		ml;
+    const mapseg_t*	ml;
     seg_t*		li;
     line_t*		ldef;
     int			linedef;
     int			side;
 	
-    numsegs = W_LumpLength (lump) / sizeof(mapseg_t);
-    segs = Z_Malloc (numsegs*sizeof(seg_t),PU_LEVEL,0);	
-    memset (segs, 0, numsegs*sizeof(seg_t));
-    data = W_CacheLumpNum (lump,PU_STATIC);
-	
-    ml = (mapseg_t *)data;
-    li = segs;
-    for (i=0 ; i<numsegs ; i++, li++, ml++)
+    ml = (const mapseg_t *)data + first;
+    li = segs + first;
+    for (i=first ; i<last ; i++, li++, ml++)
     {
-	li->v1 = &vertexes[SHORT(ml->v1)];
-	li->v2 = &vertexes[SHORT(ml->v2)];
+	li->v1 = &vertexes[(unsigned short)SHORT(ml->v1)];
+	li->v2 = &vertexes[(unsigned short)SHORT(ml->v2)];
 					
 	li->angle = (SHORT(ml->angle))<<16;
 	li->offset = (SHORT(ml->offset))<<16;
-	linedef = SHORT(ml->linedef);
+	linedef = (unsigned short)SHORT(ml->linedef);
 	ldef = &lines[linedef];
 	li->linedef = ldef;
 	side = SHORT(ml->side);
@@ -192,7 +545,79 @@ void P_LoadSegs (int lump)
 	else
 	    li->backsector = 0;
     }
+}
+
+//
+// P_ConvertExtendedSegs
+// ZDBSP's segs leave the angle and the offset along the linedef
+//  to the loader; doubles keep this off R_PointToAngle2's globals.
+//
+static void P_ConvertExtendedSegs (const byte* data, int first, int last)
+{
+    int			i;
+    const byte*		ml;
+    seg_t*		li;
+    line_t*		ldef;
+    vertex_t*		start;
+    unsigned		v1;
+    unsigned		v2;
+    unsigned		linedef;
+    int			side;
+    double		dx;
+    double		dy;
+
+    ml = data + first*XSEGSIZE;
+    li = segs + first;
+    for (i=first ; i<last ; i++, li++, ml += XSEGSIZE)
+    {
+	v1 = P_ReadLong (ml);
+	v2 = P_ReadLong (ml+4);
+	linedef = (unsigned short)P_ReadShort (ml+8);
+	side = ml[10] & 1;
+	if (v1 >= (unsigned)numvertexes || v2 >= (unsigned)numvertexes
+	    || linedef >= (unsigned)numlines)
+	    I_Error ("P_LoadSegs: seg %i is out of range", i);
+
+	li->v1 = &vertexes[v1];
+	li->v2 = &vertexes[v2];
+	dx = (double)li->v2->x - li->v1->x;
+	dy = (double)li->v2->y - li->v1->y;
+	li->angle = (angle_t)(long long)(atan2 (dy, dx) * (ANG180 / M_PI));
+
+	ldef = &lines[linedef];
+	start = side ? ldef->v2 : ldef->v1;
+	dx = (double)li->v1->x - start->x;
+	dy = (double)li->v1->y - start->y;
+	li->offset = (fixed_t)sqrt (dx*dx + dy*dy);
+
+	li->linedef = ldef;
+	li->sidedef = &sides[ldef->sidenum[side]];
+	li->frontsector = sides[ldef->sidenum[side]].sector;
+	if (ldef-> flags & ML_TWOSIDED)
+	    li->backsector = sides[ldef->sidenum[side^1]].sector;
+	else
+	    li->backsector = 0;
+    }
+}
+
+void P_LoadSegs (int lump)
+{
+    byte*		data;
+
+    if (extendednodes)
+    {
+	numsegs = xnodes.numsegs;
+	segs = Z_LevelMalloc (numsegs*sizeof(seg_t));
+	memset (segs, 0, numsegs*sizeof(seg_t));
+	P_ConvertRecords (P_ConvertExtendedSegs, xnodes.segs, numsegs);
+	return;
+    }
 	
+    numsegs = W_LumpLength (lump) / sizeof(mapseg_t);
+    segs = Z_LevelMalloc (numsegs*sizeof(seg_t));	
+    memset (segs, 0, numsegs*sizeof(seg_t));
+    data = W_CacheLumpNum (lump,PU_STATIC);
+    P_ConvertRecords (P_ConvertSegs, data, numsegs);
     Z_Free (data);
 }
 
@@ -200,26 +625,53 @@ void P_LoadSegs (int lump)
 //
 // P_LoadSubsectors
 //
+static void P_ConvertSubsectors (const byte* data, int first, int last)
+{
+    int				i;
+    const mapsubsector_t*	ms;
+    subsector_t*		ss;
+	
+    ms = (const mapsubsector_t *)data + first;
+    ss = subsectors + first;
+    
+    for (i=first ; i<last ; i++, ss++, ms++)
+    {
+	ss->numlines = (unsigned short)SHORT(ms->numsegs);
+	ss->firstline = (unsigned short)SHORT(ms->firstseg);
+    }
+}
+
 void P_LoadSubsectors (int lump)
 {
     byte*		data;
+    int			firstline;
     int			i;
-    mapsubsector_t*	ms;
-    subsector_t*	ss;
+
+    // ZDBSP's subsectors only count their segs
+    if (extendednodes)
+    {
+	numsubsectors = xnodes.numsubsectors;
+	subsectors = Z_LevelMalloc (numsubsectors*sizeof(subsector_t));
+	memset (subsectors,0, numsubsectors*sizeof(subsector_t));
+	firstline = 0;
+	for (i=0 ; i<numsubsectors ; i++)
+	{
+	    subsectors[i].numlines = P_ReadLong (xnodes.subsectors + i*4);
+	    subsectors[i].firstline = firstline;
+	    if (subsectors[i].numlines < 0
+		|| subsectors[i].numlines > xnodes.numsegs - firstline)
+		I_Error ("P_LoadSubsectors: subsector %i has too many segs", i);
+	    firstline += subsectors[i].numlines;
+	}
+	return;
+    }
 	
     numsubsectors = W_LumpLength (lump) / sizeof(mapsubsector_t);
-    subsectors = Z_Malloc (numsubsectors*sizeof(subsector_t),PU_LEVEL,0);	
+    subsectors = Z_LevelMalloc (numsubsectors*sizeof(subsector_t));	
     data = W_CacheLumpNum (lump,PU_STATIC);
 	
-    ms = (mapsubsector_t *)data;
     memset (subsectors,0, numsubsectors*sizeof(subsector_t));
-    ss = subsectors;
-    
-    for (i=0 ; i<numsubsectors ; i++, ss++, ms++)
-    {
-	ss->numlines = SHORT(ms->numsegs);
-	ss->firstline = SHORT(ms->firstseg);
-    }
+    P_ConvertRecords (P_ConvertSubsectors, data, numsubsectors);
 	
     Z_Free (data);
 }
@@ -229,32 +681,36 @@ void P_LoadSubsectors (int lump)
 //
 // P_LoadSectors
 //
-void P_LoadSectors (int lump)
+static void P_ConvertSectors (const byte* data, int first, int last)
 {
-    byte*		data;
     int			i;
-    mapsector_t*	ms;
+    const mapsector_t*	ms;
     sector_t*		ss;
 	
-    numsectors = W_LumpLength (lump) / sizeof(mapsector_t);
-    sectors = Z_Malloc (numsectors*sizeof(sector_t),PU_LEVEL,0);	
-    memset (sectors, 0, numsectors*sizeof(sector_t));
-    data = W_CacheLumpNum (lump,PU_STATIC);
-	
-    ms = (mapsector_t *)data;
-    ss = sectors;
-    for (i=0 ; i<numsectors ; i++, ss++, ms++)
+    ms = (const mapsector_t *)data + first;
+    ss = sectors + first;
+    for (i=first ; i<last ; i++, ss++, ms++)
     {
 	ss->floorheight = SHORT(ms->floorheight)<<FRACBITS;
 	ss->ceilingheight = SHORT(ms->ceilingheight)<<FRACBITS;
-	ss->floorpic = R_FlatNumForName(ms->floorpic);
-	ss->ceilingpic = R_FlatNumForName(ms->ceilingpic);
+	ss->floorpic = R_FlatNumForName((char *)ms->floorpic);
+	ss->ceilingpic = R_FlatNumForName((char *)ms->ceilingpic);
 	ss->lightlevel = SHORT(ms->lightlevel);
 	ss->special = SHORT(ms->special);
 	ss->tag = SHORT(ms->tag);
 	ss->thinglist = NULL;
     }
+}
+
+void P_LoadSectors (int lump)
+{
+    byte*		data;
 	
+    numsectors = W_LumpLength (lump) / sizeof(mapsector_t);
+    sectors = Z_LevelMalloc (numsectors*sizeof(sector_t));	
+    memset (sectors, 0, numsectors*sizeof(sector_t));
+    data = W_CacheLumpNum (lump,PU_STATIC);
+    P_ConvertRecords (P_ConvertSectors, data, numsectors);
     Z_Free (data);
 }
 
@@ -262,23 +718,19 @@ void P_LoadSectors (int lump)
 //
 // P_LoadNodes
 //
-void P_LoadNodes (int lump)
+static void P_ConvertNodes (const byte* data, int first, int last)
 {
-    byte*	data;
-    int		i;
-    int		j;
-    int		k;
-    mapnode_t*	mn;
-    node_t*	no;
-	
-    numnodes = W_LumpLength (lump) / sizeof(mapnode_t);
-    nodes = Z_Malloc (numnodes*sizeof(node_t),PU_LEVEL,0);	
-    data = W_CacheLumpNum (lump,PU_STATIC);
+    int			i;
+    int			j;
+    int			k;
+    unsigned		child;
+    const mapnode_t*	mn;
+    node_t*		no;
 	
-    mn = (mapnode_t *)data;
-    no = nodes;
+    mn = (const mapnode_t *)data + first;
+    no = nodes + first;
     
-    for (i=0 ; i<numnodes ; i++, no++, mn++)
+    for (i=first ; i<last ; i++, no++, mn++)
     {
 	no->x = SHORT(mn->x)<<FRACBITS;
 	no->y = SHORT(mn->y)<<FRACBITS;
@@ -286,12 +738,62 @@ void P_LoadNodes (int lump)
 	no->dy = SHORT(mn->dy)<<FRACBITS;
 	for (j=0 ; j<2 ; j++)
 	{
-	    no->children[j] = SHORT(mn->children[j]);
+	    child = (unsigned short)SHORT(mn->children[j]);
+	    if (child & NF_MAPSUBSECTOR)
+		child = (child & ~NF_MAPSUBSECTOR) | NF_SUBSECTOR;
+	    no->children[j] = child;
 	    for (k=0 ; k<4 ; k++)
 		no->bbox[j][k] = SHORT(mn->bbox[j][k])<<FRACBITS;
 	}
     }
-	
+}
+
+static void P_ConvertExtendedNodes (const byte* data, int first, int last)
+{
+    int			i;
+    int			j;
+    int			k;
+    const byte*		mn;
+    node_t*		no;
+
+    mn = data + first*XNODESIZE;
+    no = nodes + first;
+
+    for (i=first ; i<last ; i++, no++, mn += XNODESIZE)
+    {
+	no->x = P_ReadShort (mn)<<FRACBITS;
+	no->y = P_ReadShort (mn+2)<<FRACBITS;
+	no->dx = P_ReadShort (mn+4)<<FRACBITS;
+	no->dy = P_ReadShort (mn+6)<<FRACBITS;
+	for (j=0 ; j<2 ; j++)
+	{
+	    no->children[j] = P_ReadLong (mn+24+j*4);
+	    for (k=0 ; k<4 ; k++)
+		no->bbox[j][k] = P_ReadShort (mn+8+j*8+k*2)<<FRACBITS;
+	}
+    }
+}
+
+void P_LoadNodes (int lump)
+{
+    byte*	data;
+    byte*	p;
+
+    numnodes = extendednodes ? xnodes.numnodes
+	: W_LumpLength (lump) / sizeof(mapnode_t);
+
+    // the arena only keeps 8 byte alignment
+    p = Z_LevelMalloc (numnodes*sizeof(node_t) + sizeof(node_t)-1);
+    nodes = (node_t *)(((uintptr_t)p + sizeof(node_t)-1)
+		       & ~(uintptr_t)(sizeof(node_t)-1));
+
+    if (extendednodes)
+    {
+	P_ConvertRecords (P_ConvertExtendedNodes, xnodes.nodes, numnodes);
+	return;
+    }
+    data = W_CacheLumpNum (lump,PU_STATIC);
+    P_ConvertRecords (P_ConvertNodes, data, numnodes);
     Z_Free (data);
 }
 
@@ -355,23 +857,17 @@ void P_LoadThings (int lump)
 // P_LoadLineDefs
 // Also counts secret lines for intermissions.
 //
-void P_LoadLineDefs (int lump)
+static void P_ConvertLineDefs (const byte* data, int first, int last)
 {
-    byte*		data;
     int			i;
-    maplinedef_t*	mld;
+    const maplinedef_t*	mld;
     line_t*		ld;
     vertex_t*		v1;
     vertex_t*		v2;
 	
-    numlines = W_LumpLength (lump) / sizeof(maplinedef_t);
-    lines = Z_Malloc (numlines*sizeof(line_t),PU_LEVEL,0);	
-    memset (lines, 0, numlines*sizeof(line_t));
-    data = W_CacheLumpNum (lump,PU_STATIC);
-	
-    mld = (maplinedef_t *)data;
-    ld = lines;
-    for (i=0 ; i<numlines ; i++, mld++, ld++)
+    mld = (const maplinedef_t *)data + first;
+    ld = lines + first;
+    for (i=first ; i<last ; i++, mld++, ld++)
     {
 	ld->flags = SHORT(mld->flags);
 	ld->special = SHORT(mld->special);
@@ -428,7 +924,17 @@ void P_LoadLineDefs (int lump)
 	else
 	    ld->backsector = 0;
     }
+}
+
+void P_LoadLineDefs (int lump)
+{
+    byte*		data;
 	
+    numlines = W_LumpLength (lump) / sizeof(maplinedef_t);
+    lines = Z_LevelMalloc (numlines*sizeof(line_t));	
+    memset (lines, 0, numlines*sizeof(line_t));
+    data = W_CacheLumpNum (lump,PU_STATIC);
+    P_ConvertRecords (P_ConvertLineDefs, data, numlines);
     Z_Free (data);
 }
 
@@ -436,62 +942,495 @@ void P_LoadLineDefs (int lump)
 //
 // P_LoadSideDefs
 //
-void P_LoadSideDefs (int lump)
+static void P_ConvertSideDefs (const byte* data, int first, int last)
 {
-    byte*		data;
     int			i;
-    mapsidedef_t*	msd;
+    const mapsidedef_t*	msd;
     side_t*		sd;
 	
-    numsides = W_LumpLength (lump) / sizeof(mapsidedef_t);
-    sides = Z_Malloc (numsides*sizeof(side_t),PU_LEVEL,0);	
-    memset (sides, 0, numsides*sizeof(side_t));
-    data = W_CacheLumpNum (lump,PU_STATIC);
-	
-    msd = (mapsidedef_t *)data;
-    sd = sides;
-    for (i=0 ; i<numsides ; i++, msd++, sd++)
+    msd = (const mapsidedef_t *)data + first;
+    sd = sides + first;
+    for (i=first ; i<last ; i++, msd++, sd++)
     {
 	sd->textureoffset = SHORT(msd->textureoffset)<<FRACBITS;
 	sd->rowoffset = SHORT(msd->rowoffset)<<FRACBITS;
-	sd->toptexture = R_TextureNumForName(msd->toptexture);
-	sd->bottomtexture = R_TextureNumForName(msd->bottomtexture);
-	sd->midtexture = R_TextureNumForName(msd->midtexture);
+	sd->toptexture = R_TextureNumForName((char *)msd->toptexture);
+	sd->bottomtexture = R_TextureNumForName((char *)msd->bottomtexture);
+	sd->midtexture = R_TextureNumForName((char *)msd->midtexture);
 	sd->sector = &sectors[SHORT(msd->sector)];
     }
+}
+
+void P_LoadSideDefs (int lump)
+{
+    byte*		data;
 	
+    numsides = W_LumpLength (lump) / sizeof(mapsidedef_t);
+    sides = Z_LevelMalloc (numsides*sizeof(side_t));	
+    memset (sides, 0, numsides*sizeof(side_t));
+    data = W_CacheLumpNum (lump,PU_STATIC);
+    P_ConvertRecords (P_ConvertSideDefs, data, numsides);
     Z_Free (data);
 }
 
 
+//
+// LEVEL CACHE
+// What P_LoadBlockMap, P_GroupLines and P_LoadReject derive from a
+//  map depends only on its lumps, so it is written to a file per map
+//  in levelcache and the next load of that map (a new game, a
+//  savegame, a level restart) reads it back from a read-only mapping:
+//  the blockmap lists and a generated REJECT are used in place, the
+//  sector line lists and subsector sectors are pointed back up.
+//
+// Layout: header, blockmap[numblocks+1],
+//  blockmaplines[numblocklines], the sector of every subsector,
+//  lcachesector_t[numsectors], the line of every entry in the sector
+//  line lists (sector order), reject[rejectsize].
+//
+char*		levelcache;
+
+#define LCACHE_MAGIC	"UBOLVC01"
+
+typedef struct
+{
+    char		magic[8];
+    unsigned long long	key;		// W_LumpsChecksum() of the map
+    int			numsectors;
+    int			numlines;
+    int			numsubsectors;
+    int			numblocklines;
+    int			numsectorlines;
+    int			rejectsize;	// 0 = the WAD's REJECT is used
+    fixed_t		bmaporgx;
+    fixed_t		bmaporgy;
+    int			bmapwidth;
+    int			bmapheight;
+} lcacheheader_t;
+
+typedef struct
+{
+    int			linecount;
+    fixed_t		bbox[4];
+    int			blockbox[4];
+} lcachesector_t;
+
+static byte*		lcache;		// valid mapping, or NULL
+static int		lcachesize;
+static boolean		rejectbuilt;	// rejectlive was generated
+
+static long long P_LevelCacheSize (lcacheheader_t* h)
+{
+    return sizeof(*h)
+	+ ((long long)h->bmapwidth*h->bmapheight+1 + h->numblocklines)*4
+	+ (long long)h->numsubsectors*4
+	+ (long long)h->numsectors*sizeof(lcachesector_t)
+	+ (long long)h->numsectorlines*4
+	+ h->rejectsize;
+}
+
+static void P_LevelCachePath (char* path, int size, char* mapname)
+{
+    snprintf (path, size, "%s/%.8s", levelcache, mapname);
+}
+
+//
+// P_FreeLevelCache
+// Unmaps the level cache; the blockmap and a cached REJECT go with it.
+//
+void P_FreeLevelCache (void)
+{
+    if (lcache)
+	munmap (lcache, lcachesize);
+    lcache = NULL;
+}
+
+//
+// P_CheckLevelCache
+// The cache must describe as many sectors, lines and subsectors as
+//  the map's lumps hold, and every index in it must be in range.
+//
+static boolean P_CheckLevelCache (lcacheheader_t* header, int lumpnum)
+{
+    int			sectorcount;
+    int			linecount;
+    int			ssectorcount;
+    int*		block;
+    int*		ssector;
+    lcachesector_t*	sector;
+    int*		index;
+    int			total;
+    int			i;
+
+    sectorcount = W_LumpLength (lumpnum+ML_SECTORS) / sizeof(mapsector_t);
+    linecount = W_LumpLength (lumpnum+ML_LINEDEFS) / sizeof(maplinedef_t);
+    ssectorcount = P_MapSubsectorCount (lumpnum);
+    if (header->numsectors != sectorcount
+	|| header->numlines != linecount
+	|| header->numsubsectors != ssectorcount
+	|| (header->rejectsize
+	    && header->rejectsize != (sectorcount*sectorcount+7)/8))
+	return false;
+
+    block = (int *)(header+1);
+    for (i=0 ; i<header->bmapwidth*header->bmapheight ; i++)
+	if (block[i] < 0 || block[i] > block[i+1])
+	    return false;
+    if (block[i] != header->numblocklines)
+	return false;
+
+    ssector = block + i+1 + header->numblocklines;
+    for (i=0 ; i<ssectorcount ; i++)
+	if ((unsigned)ssector[i] >= (unsigned)sectorcount)
+	    return false;
+
+    sector = (lcachesector_t *)(ssector + ssectorcount);
+    total = 0;
+    for (i=0 ; i<sectorcount ; i++)
+    {
+	if (sector[i].linecount < 0)
+	    return false;
+	total += sector[i].linecount;
+    }
+    if (total != header->numsectorlines)
+	return false;
+
+    index = (int *)(sector + sectorcount);
+    for (i=0 ; i<total ; i++)
+	if ((unsigned)index[i] >= (unsigned)linecount)
+	    return false;
+    return true;
+}
+
+//
+// P_OpenLevelCache
+// Maps the map's cache file if it was built from the same lumps and
+//  holds together; P_LoadBlockMap, P_LoadReject and P_GroupLines
+//  then read it instead of deriving.
+//
+static void P_OpenLevelCache (int lumpnum)
+{
+    lcacheheader_t*	header;
+    struct stat		st;
+    char		path[1024];
+    FILE*		f;
+    void*		base;
+
+    P_FreeLevelCache ();
+    if (!levelcache)
+	return;
+
+    P_LevelCachePath (path, sizeof(path), lumpinfo[lumpnum].name);
+    if ( !(f = fopen (path, "rb")) )
+	return;
+    if (fstat (fileno (f), &st) == -1 || st.st_size < (off_t)sizeof(lcacheheader_t))
+    {
+	fclose (f);
+	return;
+    }
+    base = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno (f), 0);
+    fclose (f);
+    if (base == MAP_FAILED)
+	return;
+
+    header = base;
+    if (memcmp (header->magic, LCACHE_MAGIC, 8)
+	|| header->key != W_LumpsChecksum (lumpnum, ML_BLOCKMAP+1)
+	|| header->bmapwidth <= 0 || header->bmapheight <= 0
+	|| header->numblocklines < 0 || header->numsectorlines < 0
+	|| header->numsectors < 0 || header->numsubsectors < 0
+	|| header->rejectsize < 0
+	|| st.st_size != P_LevelCacheSize (header)
+	|| !P_CheckLevelCache (header, lumpnum))
+    {
+	fprintf (stderr, "[doom] P_SetupLevel: %s is stale, rebuilding\n", path);
+	munmap (base, st.st_size);
+	return;
+    }
+    lcache = base;
+    lcachesize = st.st_size;
+}
+
+//
+// P_WriteLevelCache
+// Written to a temporary file and renamed, as R_WriteDataCache does.
+//
+static void P_WriteLevelCache (int lumpnum)
+{
+    lcacheheader_t	header;
+    lcachesector_t	info;
+    char		path[1024];
+    char		tmp[1040];
+    sector_t*		sector;
+    FILE*		f;
+    int			numblocks;
+    int			index;
+    int			i;
+    int			j;
+    int			ok;
+
+    if (!levelcache)
+	return;
+    // a first write makes the directory; failing that, fopen fails
+    mkdir (levelcache, 0755);
+    P_LevelCachePath (path, sizeof(path), lumpinfo[lumpnum].name);
+    snprintf (tmp, sizeof(tmp), "%s.tmp", path);
+    if ( !(f = fopen (tmp, "wb")) )
+	return;
+
+    numblocks = bmapwidth*bmapheight;
+    memset (&header, 0, sizeof(header));
+    memcpy (header.magic, LCACHE_MAGIC, 8);
+    header.key = W_LumpsChecksum (lumpnum, ML_BLOCKMAP+1);
+    header.numsectors = numsectors;
+    header.numlines = numlines;
+    header.numsubsectors = numsubsectors;
+    header.numblocklines = blockmap[numblocks];
+    header.numsectorlines = 0;
+    for (i=0 ; i<numsectors ; i++)
+	header.numsectorlines += sectors[i].linecount;
+    header.rejectsize = rejectbuilt ? (numsectors*numsectors+7)/8 : 0;
+    header.bmaporgx = bmaporgx;
+    header.bmaporgy = bmaporgy;
+    header.bmapwidth = bmapwidth;
+    header.bmapheight = bmapheight;
+
+    ok = fwrite (&header, sizeof(header), 1, f) == 1;
+    ok &= fwrite (blockmap, 4, numblocks+1, f) == numblocks+1;
+    ok &= fwrite (blockmaplines, 4, header.numblocklines, f) == header.numblocklines;
+    for (i=0 ; i<numsubsectors ; i++)
+    {
+	index = subsectors[i].sector - sectors;
+	ok &= fwrite (&index, 4, 1, f) == 1;
+    }
+    for (i=0, sector=sectors ; i<numsectors ; i++, sector++)
+    {
+	info.linecount = sector->linecount;
+	memcpy (info.bbox, sector->bbox, sizeof(info.bbox));
+	memcpy (info.blockbox, sector->blockbox, sizeof(info.blockbox));
+	ok &= fwrite (&info, sizeof(info), 1, f) == 1;
+    }
+    for (i=0, sector=sectors ; i<numsectors ; i++, sector++)
+	for (j=0 ; j<sector->linecount ; j++)
+	{
+	    index = sector->lines[j] - lines;
+	    ok &= fwrite (&index, 4, 1, f) == 1;
+	}
+    if (header.rejectsize)
+	ok &= fwrite (rejectlive, 1, header.rejectsize, f) == header.rejectsize;
+    ok &= fclose (f) == 0;
+
+    if (ok && rename (tmp, path) == 0)
+	fprintf (stderr, "[doom] P_SetupLevel: wrote %s\n", path);
+    else
+	remove (tmp);
+}
+
+
+
 //
 // P_LoadBlockMap
 //
-void P_LoadBlockMap (int lump)
+static void P_ConvertBlockLists (const byte* data, int first, int last)
+{
+    const short*	words = (const short *)data;
+    int			offset;
+    int			count;
+    int			i;
+    int			j;
+
+    for (i=first ; i<last ; i++)
+    {
+	offset = (unsigned short)SHORT(words[4+i]);
+	count = blockmap[i+1] - blockmap[i];
+	for (j=0 ; j<count ; j++)
+	    blockmaplines[blockmap[i]+j] = (unsigned short)SHORT(words[offset+j]);
+    }
+}
+
+static void P_UnpackBlockMap (int lump)
 {
+    short*	data;
+    int		words;
+    int		numblocks;
+    int		total;
+    int		offset;
     int		i;
-    int		count;
+    int		j;
 	
-    blockmaplump = W_CacheLumpNum (lump,PU_LEVEL);
-    blockmap = blockmaplump+4;
-    count = W_LumpLength (lump)/2;
+    // The lump's lists are unpacked into one int array with a
+    //  start per block: no -1 terminators to test, no short line
+    //  numbers, and offsets read unsigned so maps past 32767 words
+    //  still load.  Every list keeps its leading line 0, as the
+    //  iterators always checked it.
+    data = W_CacheLumpNum (lump, PU_STATIC);
+    words = W_LumpLength (lump)/2;
+    if (words < 4)
+	I_Error ("P_LoadBlockMap: lump %i is too short", lump);
+
+    bmaporgx = SHORT(data[0])<<FRACBITS;
+    bmaporgy = SHORT(data[1])<<FRACBITS;
+    bmapwidth = SHORT(data[2]);
+    bmapheight = SHORT(data[3]);
+    numblocks = bmapwidth*bmapheight;
+    if (bmapwidth <= 0 || bmapheight <= 0 || 4+numblocks > words)
+	I_Error ("P_LoadBlockMap: bad %ix%i blockmap", bmapwidth, bmapheight);
+
+    blockmap = Z_LevelMalloc ((numblocks+1)*sizeof(*blockmap));
+    total = 0;
+    for (i=0 ; i<numblocks ; i++)
+    {
+	offset = (unsigned short)SHORT(data[4+i]);
+	for (j=offset ; j<words && (unsigned short)SHORT(data[j]) != 0xffff ; j++)
+	    ;
+	blockmap[i] = total;
+	total += j - offset;
+    }
+    blockmap[numblocks] = total;
 
-    for (i=0 ; i<count ; i++)
-	blockmaplump[i] = SHORT(blockmaplump[i]);
-		
-    bmaporgx = blockmaplump[0]<<FRACBITS;
-    bmaporgy = blockmaplump[1]<<FRACBITS;
-    bmapwidth = blockmaplump[2];
-    bmapheight = blockmaplump[3];
+    blockmaplines = Z_LevelMalloc ((total+1)*sizeof(*blockmaplines));
+    P_ConvertRecords (P_ConvertBlockLists, (byte *)data, numblocks);
+    Z_ChangeTag (data, PU_CACHE);
+}
+
+void P_LoadBlockMap (int lump)
+{
+    lcacheheader_t*	header = (lcacheheader_t *)lcache;
+    int			count;
+
+    if (header)
+    {
+	bmaporgx = header->bmaporgx;
+	bmaporgy = header->bmaporgy;
+	bmapwidth = header->bmapwidth;
+	bmapheight = header->bmapheight;
+	blockmap = (int *)(header+1);
+	blockmaplines = blockmap + bmapwidth*bmapheight+1;
+    }
+    else
+	P_UnpackBlockMap (lump);
 	
     // clear out mobj chains
     count = sizeof(*blocklinks)* bmapwidth*bmapheight;
-    blocklinks = Z_Malloc (count,PU_LEVEL, 0);
+    blocklinks = Z_LevelMalloc (count);
     memset (blocklinks, 0, count);
 }
 
 
 
+//
+// P_LoadReject
+// A REJECT lump too short for the map, or all zeroes, rejects
+//  nothing (or reads past its end), so P_CheckSight gets one built
+//  here instead: sectors no chain of two-sided lines connects can
+//  never see each other.  That only rejects what the trace would
+//  refuse anyway; demos and netgames keep using the WAD's.
+//
+static int P_SectorGroup (int* group, int i)
+{
+    while (group[i] != i)
+	i = group[i] = group[group[i]];
+    return i;
+}
+
+static void P_LoadReject (int lump)
+{
+    lcacheheader_t*	header = (lcacheheader_t *)lcache;
+    line_t*		li;
+    int*		group;
+    int			size;
+    int			length;
+    int			pnum;
+    int			a;
+    int			b;
+    int			i;
+    int			j;
+
+    rejectmatrix = W_CacheLumpNum (lump,PU_LEVEL);
+    rejectlive = rejectmatrix;
+    rejectbuilt = false;
+
+    size = (numsectors*numsectors+7)/8;
+    if (header)
+    {
+	if (header->rejectsize)
+	{
+	    rejectlive = lcache + lcachesize - header->rejectsize;
+	    rejectbuilt = true;
+	}
+	return;
+    }
+
+    length = W_LumpLength (lump);
+    for (i=0 ; i<length && i<size && !rejectmatrix[i] ; i++)
+	;
+    if (length >= size && i < size)
+	return;
+
+    group = Z_Malloc (numsectors*sizeof(*group), PU_STATIC, 0);
+    for (i=0 ; i<numsectors ; i++)
+	group[i] = i;
+    for (i=0, li=lines ; i<numlines ; i++, li++)
+    {
+	if (!(li->flags & ML_TWOSIDED) || !li->frontsector || !li->backsector)
+	    continue;
+	a = P_SectorGroup (group, li->frontsector - sectors);
+	b = P_SectorGroup (group, li->backsector - sectors);
+	group[a] = b;
+    }
+    for (i=0 ; i<numsectors ; i++)
+	group[i] = P_SectorGroup (group, i);
+
+    rejectlive = Z_LevelMalloc (size);
+    memset (rejectlive, 0, size);
+    for (i=0, pnum=0 ; i<numsectors ; i++)
+	for (j=0 ; j<numsectors ; j++, pnum++)
+	    if (group[i] != group[j])
+		rejectlive[pnum>>3] |= 1 << (pnum&7);
+    Z_Free (group);
+    rejectbuilt = true;
+    fprintf (stderr, "[doom] P_SetupLevel: REJECT lump is %s, built one for %i sectors\n",
+	     length < size ? "short" : "empty", numsectors);
+}
+
+
+//
+// P_GroupCachedLines
+// P_GroupLines from the level cache.
+//
+static void P_GroupCachedLines (void)
+{
+    lcacheheader_t*	header = (lcacheheader_t *)lcache;
+    line_t**		linebuffer;
+    int*		ssector;
+    lcachesector_t*	info;
+    int*		index;
+    sector_t*		sector;
+    int			i;
+    int			j;
+
+    ssector = blockmaplines + header->numblocklines;
+    for (i=0 ; i<numsubsectors ; i++)
+	subsectors[i].sector = &sectors[ssector[i]];
+
+    info = (lcachesector_t *)(ssector + numsubsectors);
+    index = (int *)(info + numsectors);
+    linebuffer = Z_LevelMalloc (header->numsectorlines*sizeof(*linebuffer));
+    for (i=0, sector=sectors ; i<numsectors ; i++, sector++, info++)
+    {
+	sector->linecount = info->linecount;
+	sector->lines = linebuffer;
+	for (j=0 ; j<info->linecount ; j++)
+	    *linebuffer++ = &lines[*index++];
+
+	memcpy (sector->bbox, info->bbox, sizeof(sector->bbox));
+	memcpy (sector->blockbox, info->blockbox, sizeof(sector->blockbox));
+	sector->soundorg.x = (sector->bbox[BOXRIGHT]+sector->bbox[BOXLEFT])/2;
+	sector->soundorg.y = (sector->bbox[BOXTOP]+sector->bbox[BOXBOTTOM])/2;
+    }
+}
+
+
 //
 // P_GroupLines
 // Builds sector line lists and subsector sector numbers.
@@ -509,6 +1448,12 @@ void P_GroupLines (void)
     seg_t*		seg;
     fixed_t		bbox[4];
     int			block;
+
+    if (lcache)
+    {
+	P_GroupCachedLines ();
+	return;
+    }
 	
     // look up sector number for each subsector
     ss = subsectors;
@@ -536,25 +1481,41 @@ void P_GroupLines (void)
     // build line tables for each sector
     // NOTE: original code used total*4 (sizeof(line_t*) on 32-bit DOS).
     // On 64-bit, sizeof(line_t*)=8, so we must use sizeof(*linebuffer).
-    linebuffer = Z_Malloc (total*sizeof(*linebuffer), PU_LEVEL, 0);
+    // A counting sort: the counts above place each sector's table,
+    //  and one pass over the lines fills them in line order, as the
+    //  per-sector scan of every line did.
+    linebuffer = Z_LevelMalloc (total*sizeof(*linebuffer));
     sector = sectors;
     for (i=0 ; i<numsectors ; i++, sector++)
     {
-	M_ClearBox (bbox);
 	sector->lines = linebuffer;
-	li = lines;
-	for (j=0 ; j<numlines ; j++, li++)
+	linebuffer += sector->linecount;
+	sector->linecount = 0;
+    }
+
+    li = lines;
+    for (i=0 ; i<numlines ; i++, li++)
+    {
+	sector = li->frontsector;
+	sector->lines[sector->linecount++] = li;
+	sector = li->backsector;
+	if (sector && sector != li->frontsector)
+	    sector->lines[sector->linecount++] = li;
+    }
+
+    sector = sectors;
+    for (i=0 ; i<numsectors ; i++, sector++)
+    {
+	M_ClearBox (bbox);
+	for (j=0 ; j<sector->linecount ; j++)
 	{
-	    if (li->frontsector == sector || li->backsector == sector)
-	    {
-		*linebuffer++ = li;
-		M_AddToBox (bbox, li->v1->x, li->v1->y);
-		M_AddToBox (bbox, li->v2->x, li->v2->y);
-	    }
+	    li = sector->lines[j];
+	    M_AddToBox (bbox, li->v1->x, li->v1->y);
+	    M_AddToBox (bbox, li->v2->x, li->v2->y);
 	}
-	if (linebuffer - sector->lines != sector->linecount)
-	    I_Error ("P_GroupLines: miscounted");
 			
+	memcpy (sector->bbox, bbox, sizeof(sector->bbox));
+
 	// set the degenmobj_t to the middle of the bounding box
 	sector->soundorg.x = (bbox[BOXRIGHT]+bbox[BOXLEFT])/2;
 	sector->soundorg.y = (bbox[BOXTOP]+bbox[BOXBOTTOM])/2;
@@ -580,11 +1541,56 @@ void P_GroupLines (void)
 }
 
 
+//
+// P_BuildBlockLineBoxes
+// Copies each line's bounding box next to its every entry in the
+//  blockmap lists, one array per side, so P_BlockLinesInBox can reject
+//  a block's far lines from a few contiguous words without reading
+//  their line_t.
+//
+static void P_BuildBlockLineBoxes (void)
+{
+    int		total;
+    int		i;
+    int		j;
+    line_t*	ld;
+
+    total = blockmap[bmapwidth*bmapheight];
+    for (j=0 ; j<4 ; j++)
+	blocklinebox[j] = Z_LevelMalloc ((total+1)*sizeof(fixed_t));
+
+    for (i=0 ; i<total ; i++)
+    {
+	if (blockmaplines[i] >= numlines)
+	{
+	    // no such line: a box no query box can touch
+	    blocklinebox[BOXTOP][i] = blocklinebox[BOXRIGHT][i] = MININT;
+	    blocklinebox[BOXBOTTOM][i] = blocklinebox[BOXLEFT][i] = MAXINT;
+	    continue;
+	}
+	ld = &lines[blockmaplines[i]];
+	for (j=0 ; j<4 ; j++)
+	    blocklinebox[j][i] = ld->bbox[j];
+    }
+}
+
+
 //
 // P_SetupLevel
 //
+// UBO: in steps, for G_ContinueLoadLevel.  P_StartSetupLevel does what
+//  comes before the map's lumps are read; P_ContinueSetupLevel then runs
+//  P_SetupStep 0 .. SETUPSTEPS-1 in order: the lumps, the geometry made
+//  from them, the things and the precache.  Each step runs to completion,
+//  so the level is only ever seen between two of them.
+//
+#define SETUPSTEPS	12
+
+static int	setuplump;
+static int	setupstep = -1;		// the next one, -1 = none under way
+
 void
-P_SetupLevel
+P_StartSetupLevel
 ( int		episode,
   int		map,
   int		playermask,
@@ -592,7 +1598,6 @@ P_SetupLevel
 {
     int		i;
     char	lumpname[9];
-    int		lumpnum;
 	
     totalkills = totalitems = totalsecret = wminfo.maxfrags = 0;
     wminfo.partime = 180;
@@ -609,6 +1614,21 @@ P_SetupLevel
     // Make sure all sounds are stopped before Z_FreeTags.
     S_Start ();			
 
+    // How far the last level pushed the growable pools.
+    if (drawsegpeak)
+	fprintf (stderr, "[doom] P_SetupLevel: last level peaked at %i visplanes,"
+		 " %i drawsegs, %i vissprites, %i intercepts, %i spechits\n",
+		 visplanepeak, drawsegpeak, visspritepeak,
+		 interceptpeak, spechitpeak);
+    visplanepeak = drawsegpeak = visspritepeak = 0;
+    interceptpeak = spechitpeak = 0;
+    if (sightcounts[1] || sightcachehits)
+	fprintf (stderr, "[doom] P_SetupLevel: last level rejected %i sight checks,"
+		 " traced %i, answered %i from the cache (%i prepared on the"
+		 " sight threads)\n",
+		 sightcounts[0], sightcounts[1], sightcachehits, sightprepared);
+    sightcounts[0] = sightcounts[1] = sightcachehits = sightprepared = 0;
+
     
 #if 0 // UNUSED
     if (debugfile)
@@ -620,6 +1640,8 @@ P_SetupLevel
 #endif
 	Z_FreeTags (PU_LEVEL, PU_PURGELEVEL-1);
 
+    // The cache lumps the last level left are all that can move now.
+    Z_Compact ();
 
     // UNUSED W_Profile ();
     P_InitThinkers ();
@@ -644,79 +1666,157 @@ P_SetupLevel
 	lumpname[4] = 0;
     }
 
-    lumpnum = W_GetNumForName (lumpname);
+    setuplump = W_GetNumForName (lumpname);
 	
     leveltime = 0;
-	
-    // note: most of this ordering is important	
-    fprintf(stderr, "[doom] P_SetupLevel: before P_LoadBlockMap\n");
-    P_LoadBlockMap (lumpnum+ML_BLOCKMAP);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadBlockMap\n");
-    P_LoadVertexes (lumpnum+ML_VERTEXES);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadVertexes\n");
-    P_LoadSectors (lumpnum+ML_SECTORS);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadSectors\n");
-    P_LoadSideDefs (lumpnum+ML_SIDEDEFS);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadSideDefs\n");
-
-    P_LoadLineDefs (lumpnum+ML_LINEDEFS);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadLineDefs\n");
-    P_LoadSubsectors (lumpnum+ML_SSECTORS);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadSubsectors\n");
-    P_LoadNodes (lumpnum+ML_NODES);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadNodes\n");
-    P_LoadSegs (lumpnum+ML_SEGS);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadSegs\n");
-	
-    rejectmatrix = W_CacheLumpNum (lumpnum+ML_REJECT,PU_LEVEL);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after ML_REJECT\n");
-    P_GroupLines ();
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_GroupLines\n");
-
-    bodyqueslot = 0;
-    deathmatch_p = deathmatchstarts;
-    fprintf(stderr, "[doom] P_SetupLevel: before P_LoadThings\n");
-    P_LoadThings (lumpnum+ML_THINGS);
-    Z_CheckHeap();
-    fprintf(stderr, "[doom] P_SetupLevel: after P_LoadThings\n");
-    
-    // if deathmatch, randomly spawn the active players
-    if (deathmatch)
+
+    P_InitLoadThreads ();
+    P_OpenExtendedNodes (setuplump+ML_NODES);
+    P_OpenLevelCache (setuplump);
+    setupstep = 0;
+}
+
+
+// note: most of this ordering is important	
+static void P_SetupStep (int step)
+{
+    int		lumpnum = setuplump;
+    int		i;
+
+    switch (step)
     {
-	for (i=0 ; i<MAXPLAYERS ; i++)
-	    if (playeringame[i])
-	    {
-		players[i].mo = NULL;
-		G_DeathMatchSpawnPlayer (i);
-	    }
+      case 0:
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: before P_LoadBlockMap\n");
+	P_LoadBlockMap (lumpnum+ML_BLOCKMAP);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadBlockMap\n");
+	break;
+      case 1:
+	P_LoadVertexes (lumpnum+ML_VERTEXES);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadVertexes\n");
+	break;
+      case 2:
+	P_LoadSectors (lumpnum+ML_SECTORS);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadSectors\n");
+	break;
+      case 3:
+	P_LoadSideDefs (lumpnum+ML_SIDEDEFS);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadSideDefs\n");
+	break;
+      case 4:
+	P_LoadLineDefs (lumpnum+ML_LINEDEFS);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadLineDefs\n");
+	break;
+      case 5:
+	P_LoadSubsectors (lumpnum+ML_SSECTORS);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadSubsectors\n");
+	break;
+      case 6:
+	P_LoadNodes (lumpnum+ML_NODES);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadNodes\n");
+	break;
+      case 7:
+	P_LoadSegs (lumpnum+ML_SEGS);
+	P_CloseExtendedNodes ();
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadSegs\n");
+	break;
+      case 8:
+	P_LoadReject (lumpnum+ML_REJECT);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after ML_REJECT\n");
+	break;
+      case 9:
+	P_GroupLines ();
+	P_BuildBlockLineBoxes ();
+	if (!lcache)
+	    P_WriteLevelCache (lumpnum);
+	P_InitSightCache ();
+	P_InitSoundFlood ();
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_GroupLines\n");
+	break;
+      case 10:
+	bodyqueslot = 0;
+	deathmatch_p = deathmatchstarts;
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: before P_LoadThings\n");
+	P_LoadThings (lumpnum+ML_THINGS);
+	Z_CheckHeap();
+	UBO_LOG(UBO_LOG_INFO, "[doom] P_SetupLevel: after P_LoadThings\n");
+    
+	// if deathmatch, randomly spawn the active players
+	if (deathmatch)
+	{
+	    for (i=0 ; i<MAXPLAYERS ; i++)
+		if (playeringame[i])
+		{
+		    players[i].mo = NULL;
+		    G_DeathMatchSpawnPlayer (i);
+		}
 			
-    }
+	}
 
-    // clear special respawning que
-    iquehead = iquetail = 0;		
+	// clear special respawning que
+	iquehead = iquetail = 0;		
 	
-    // set up world state
-    P_SpawnSpecials ();
+	// set up world state
+	P_SpawnSpecials ();
 	
-    // build subsector connect matrix
-    //	UNUSED P_ConnectSubsectors ();
+	// build subsector connect matrix
+	//	UNUSED P_ConnectSubsectors ();
+	break;
+      case 11:
+	// preload graphics
+	if (precache)
+	    R_PrecacheLevel ();
+
+	//printf ("free memory: 0x%x\n", Z_FreeMemory());
+	break;
+    }
+}
+
+
+// UBO: the budget runs on I_GetTimeUs, so under virtual time (where a
+//  tic takes no time) the level always loads in one go.
+boolean P_ContinueSetupLevel (int budget_us)
+{
+    int64_t	start;
 
-    // preload graphics
-    if (precache)
-	R_PrecacheLevel ();
+    start = I_GetTimeUs ();
+    while (setupstep >= 0 && setupstep < SETUPSTEPS)
+    {
+	P_SetupStep (setupstep++);
+	if (budget_us <= 0 || setupstep == SETUPSTEPS)
+	    continue;
+	if (I_GetTimeUs () - start >= budget_us)
+	    return false;
+    }
+    setupstep = -1;
+    return true;
+}
+
+
+int P_SetupProgress (void)
+{
+    return setupstep < 0 ? -1 : setupstep * 100 / SETUPSTEPS;
+}
 
-    //printf ("free memory: 0x%x\n", Z_FreeMemory());
 
+void
+P_SetupLevel
+( int		episode,
+  int		map,
+  int		playermask,
+  skill_t	skill)
+{
+    P_StartSetupLevel (episode, map, playermask, skill);
+    P_ContinueSetupLevel (0);
 }
 
 
@@ -726,6 +1826,7 @@ P_SetupLevel
 //
 void P_Init (void)
 {
+    P_InitStates ();
     P_InitSwitchList ();
     P_InitPicAnims ();
     R_InitSprites (sprnames);
@@ -37,6 +37,20 @@ P_SetupLevel
   int		playermask,
   skill_t	skill);
 
+// UBO: P_SetupLevel in steps.  P_StartSetupLevel frees the old level and
+//  finds the map; P_ContinueSetupLevel then builds it a step at a time
+//  until one has taken it past budget_us (0 = all at once) and returns
+//  true once the level is complete.  P_SetupProgress is how far it got
+//  in percent, -1 with no setup under way.
+void
+P_StartSetupLevel
+( int		episode,
+  int		map,
+  int		playermask,
+  skill_t	skill);
+boolean P_ContinueSetupLevel (int budget_us);
+int P_SetupProgress (void);
+
 // Called by startup code.
 void P_Init (void);
 
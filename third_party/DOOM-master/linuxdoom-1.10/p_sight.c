@@ -25,26 +25,167 @@ static const char
 rcsid[] = "$Id: p_sight.c,v 1.3 1997/01/28 22:08:28 b1 Exp $";
 
 
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "doomdef.h"
+#include "doomstat.h"
 
 #include "i_system.h"
+#include "z_zone.h"
 #include "p_local.h"
 
 // State.
 #include "r_state.h"
 
+// P_AimLineAttack's slopes (p_map.c); sight traces keep their own.
+fixed_t		topslope;
+fixed_t		bottomslope;
+
+int		sightcounts[2];
+
+
+//
+// SIGHT CACHE
+// P_CheckSight results for exact looker/target geometry, so idle
+//  monsters re-checking a player who has not moved skip the BSP
+//  walk.  Each entry lists the sectors whose heights the trace
+//  depended on (both sides of every two sided line it crossed) and
+//  is dropped once any of them moves.  The result is the one the
+//  walk would return, so demos stay in sync.
+//
+#define SIGHTCACHE	256		// entries, a power of two
+#define SIGHTSECTORS	8		// sectors an entry can depend on
+
+typedef struct
+{
+    fixed_t	x1, y1, z1, h1;
+    fixed_t	x2, y2, z2, h2;
+    int		stamp;			// sightstamp when filled, 0 = empty
+    int		numsectors;
+    int		sectors[SIGHTSECTORS];
+    boolean	result;
+} sightentry_t;
+
+int		sightcache = 1;		// UBO_DOOM_SIGHT_CACHE
+int		sightcachehits;
+
+static sightentry_t	sightentries[SIGHTCACHE];
+static int*		sectormoved;	// sightstamp of each sector's last move
+static int		sightstamp;
+
+
 //
 // P_CheckSight
+// The state of one trace.  The engine thread's marks lines with
+//  validcount as vanilla did; each sight thread has its own stamps.
 //
-fixed_t		sightzstart;		// eye z of looker
-fixed_t		topslope;
-fixed_t		bottomslope;		// slopes to top and bottom of target
+typedef struct
+{
+    fixed_t	sightzstart;		// eye z of looker
+    fixed_t	topslope;
+    fixed_t	bottomslope;		// slopes to top and bottom of target
 
-divline_t	strace;			// from t1 to t2
-fixed_t		t2x;
-fixed_t		t2y;
+    divline_t	strace;			// from t1 to t2
+    fixed_t	t2x;
+    fixed_t	t2y;
 
-int		sightcounts[2];
+    int*	linestamps;		// NULL = line->validcount
+    int		valid;
+
+    // sectors the trace depends on, -1 = too many
+    int		sectors[SIGHTSECTORS];
+    int		numsectors;
+} sighttrace_t;
+
+static sighttrace_t	sighttrace;
+
+
+//
+// P_InitSightCache
+// Called by P_SetupLevel once the sectors are loaded.
+//
+void P_InitSightCache (void)
+{
+    sectormoved = Z_Malloc (numsectors*sizeof(*sectormoved), PU_LEVEL, 0);
+    memset (sectormoved, 0, numsectors*sizeof(*sectormoved));
+    P_FlushSightCache ();
+}
+
+
+//
+// P_FlushSightCache
+// Drops every entry, for sector heights changed wholesale
+//  (savegame loads).
+//
+void P_FlushSightCache (void)
+{
+    memset (sightentries, 0, sizeof(sightentries));
+    sightstamp = 1;
+    if (sectormoved)
+	memset (sectormoved, 0, numsectors*sizeof(*sectormoved));
+}
+
+
+//
+// P_SectorMoved
+// A floor or ceiling is about to change height.
+//
+void P_SectorMoved (sector_t* sector)
+{
+    if (sectormoved)
+	sectormoved[sector - sectors] = ++sightstamp;
+}
+
+
+static void P_TraceSector (sighttrace_t* st, sector_t* sector)
+{
+    int		num = sector - sectors;
+    int		i;
+
+    if (st->numsectors < 0)
+	return;
+    for (i=0 ; i<st->numsectors ; i++)
+	if (st->sectors[i] == num)
+	    return;
+    if (st->numsectors == SIGHTSECTORS)
+	st->numsectors = -1;
+    else
+	st->sectors[st->numsectors++] = num;
+}
+
+
+static sightentry_t* P_SightEntry (mobj_t* t1, mobj_t* t2)
+{
+    unsigned	hash;
+
+    hash = (unsigned)t1->x * 0x9e3779b1u
+	^ (unsigned)t1->y * 0x85ebca77u
+	^ (unsigned)t2->x * 0xc2b2ae3du
+	^ (unsigned)t2->y * 0x27d4eb2fu
+	^ (unsigned)t1->z ^ (unsigned)t2->z;
+    return &sightentries[(hash ^ hash>>16) & (SIGHTCACHE-1)];
+}
+
+
+static boolean P_SightCached (sightentry_t* e, mobj_t* t1, mobj_t* t2)
+{
+    int		i;
+
+    if (!e->stamp
+	|| e->x1 != t1->x || e->y1 != t1->y
+	|| e->z1 != t1->z || e->h1 != t1->height
+	|| e->x2 != t2->x || e->y2 != t2->y
+	|| e->z2 != t2->z || e->h2 != t2->height)
+	return false;
+    for (i=0 ; i<e->numsectors ; i++)
+	if (sectormoved[e->sectors[i]] > e->stamp)
+	    return false;
+    return true;
+}
 
 
 //
@@ -132,7 +273,7 @@ P_InterceptVector2
 // Returns true
 //  if strace crosses the given subsector successfully.
 //
-boolean P_CrossSubsector (int num)
+static boolean P_CrossSubsector (sighttrace_t* st, int num)
 {
     seg_t*		seg;
     line_t*		line;
@@ -168,15 +309,23 @@ boolean P_CrossSubsector (int num)
 	line = seg->linedef;
 
 	// allready checked other side?
-	if (line->validcount == validcount)
-	    continue;
-	
-	line->validcount = validcount;
+	if (st->linestamps)
+	{
+	    if (st->linestamps[line - lines] == st->valid)
+		continue;
+	    st->linestamps[line - lines] = st->valid;
+	}
+	else
+	{
+	    if (line->validcount == validcount)
+		continue;
+	    line->validcount = validcount;
+	}
 		
 	v1 = line->v1;
 	v2 = line->v2;
-	s1 = P_DivlineSide (v1->x,v1->y, &strace);
-	s2 = P_DivlineSide (v2->x, v2->y, &strace);
+	s1 = P_DivlineSide (v1->x,v1->y, &st->strace);
+	s2 = P_DivlineSide (v2->x, v2->y, &st->strace);
 
 	// line isn't crossed?
 	if (s1 == s2)
@@ -186,8 +335,8 @@ boolean P_CrossSubsector (int num)
 	divl.y = v1->y;
 	divl.dx = v2->x - v1->x;
 	divl.dy = v2->y - v1->y;
-	s1 = P_DivlineSide (strace.x, strace.y, &divl);
-	s2 = P_DivlineSide (t2x, t2y, &divl);
+	s1 = P_DivlineSide (st->strace.x, st->strace.y, &divl);
+	s2 = P_DivlineSide (st->t2x, st->t2y, &divl);
 
 	// line isn't crossed?
 	if (s1 == s2)
@@ -201,6 +350,8 @@ boolean P_CrossSubsector (int num)
 	// crosses a two sided line
 	front = seg->frontsector;
 	back = seg->backsector;
+	P_TraceSector (st, front);
+	P_TraceSector (st, back);
 
 	// no wall to block sight with?
 	if (front->floorheight == back->floorheight
@@ -224,23 +375,23 @@ boolean P_CrossSubsector (int num)
 	if (openbottom >= opentop)	
 	    return false;		// stop
 	
-	frac = P_InterceptVector2 (&strace, &divl);
+	frac = P_InterceptVector2 (&st->strace, &divl);
 		
 	if (front->floorheight != back->floorheight)
 	{
-	    slope = FixedDiv (openbottom - sightzstart , frac);
-	    if (slope > bottomslope)
-		bottomslope = slope;
+	    slope = FixedDiv (openbottom - st->sightzstart , frac);
+	    if (slope > st->bottomslope)
+		st->bottomslope = slope;
 	}
 		
 	if (front->ceilingheight != back->ceilingheight)
 	{
-	    slope = FixedDiv (opentop - sightzstart , frac);
-	    if (slope < topslope)
-		topslope = slope;
+	    slope = FixedDiv (opentop - st->sightzstart , frac);
+	    if (slope < st->topslope)
+		st->topslope = slope;
 	}
 		
-	if (topslope <= bottomslope)
+	if (st->topslope <= st->bottomslope)
 	    return false;		// stop				
     }
     // passed the subsector ok
@@ -254,7 +405,7 @@ boolean P_CrossSubsector (int num)
 // Returns true
 //  if strace crosses the given node successfully.
 //
-boolean P_CrossBSPNode (int bspnum)
+static boolean P_CrossBSPNode (sighttrace_t* st, int bspnum)
 {
     node_t*	bsp;
     int		side;
@@ -262,31 +413,110 @@ boolean P_CrossBSPNode (int bspnum)
     if (bspnum & NF_SUBSECTOR)
     {
 	if (bspnum == -1)
-	    return P_CrossSubsector (0);
+	    return P_CrossSubsector (st, 0);
 	else
-	    return P_CrossSubsector (bspnum&(~NF_SUBSECTOR));
+	    return P_CrossSubsector (st, bspnum&(~NF_SUBSECTOR));
     }
 		
     bsp = &nodes[bspnum];
     
     // decide which side the start point is on
-    side = P_DivlineSide (strace.x, strace.y, (divline_t *)bsp);
+    side = P_DivlineSide (st->strace.x, st->strace.y, (divline_t *)bsp);
     if (side == 2)
 	side = 0;	// an "on" should cross both sides
 
     // cross the starting side
-    if (!P_CrossBSPNode (bsp->children[side]) )
+    if (!P_CrossBSPNode (st, bsp->children[side]) )
 	return false;
 	
     // the partition plane is crossed here
-    if (side == P_DivlineSide (t2x, t2y,(divline_t *)bsp))
+    if (side == P_DivlineSide (st->t2x, st->t2y,(divline_t *)bsp))
     {
 	// the line doesn't touch the other side
 	return true;
     }
     
     // cross the ending side		
-    return P_CrossBSPNode (bsp->children[side^1]);
+    return P_CrossBSPNode (st, bsp->children[side^1]);
+}
+
+
+//
+// P_TraceSight
+// Looks from the eyes of t1 to any part of t2 through the BSP.
+//
+static boolean
+P_TraceSight
+( sighttrace_t*	st,
+  mobj_t*	t1,
+  mobj_t*	t2 )
+{
+    if (st->linestamps)
+	st->valid++;
+    else
+	validcount++;
+	
+    st->sightzstart = t1->z + t1->height - (t1->height>>2);
+    st->topslope = (t2->z+t2->height) - st->sightzstart;
+    st->bottomslope = (t2->z) - st->sightzstart;
+	
+    st->strace.x = t1->x;
+    st->strace.y = t1->y;
+    st->t2x = t2->x;
+    st->t2y = t2->y;
+    st->strace.dx = t2->x - t1->x;
+    st->strace.dy = t2->y - t1->y;
+    st->numsectors = 0;
+
+    // the head node is the last node output
+    return P_CrossBSPNode (st, numnodes-1);
+}
+
+
+//
+// P_FillSightEntry
+// Keeps a trace's result, unless it crossed too many
+//  sectors to be worth it.
+//
+static void
+P_FillSightEntry
+( mobj_t*	t1,
+  mobj_t*	t2,
+  boolean	result,
+  int*		sectors,
+  int		numsectors )
+{
+    sightentry_t*	entry;
+
+    if (numsectors < 0)
+	return;
+
+    entry = P_SightEntry (t1, t2);
+    entry->x1 = t1->x;
+    entry->y1 = t1->y;
+    entry->z1 = t1->z;
+    entry->h1 = t1->height;
+    entry->x2 = t2->x;
+    entry->y2 = t2->y;
+    entry->z2 = t2->z;
+    entry->h2 = t2->height;
+    entry->stamp = sightstamp;
+    entry->numsectors = numsectors;
+    memcpy (entry->sectors, sectors, numsectors*sizeof(*sectors));
+    entry->result = result;
+}
+
+
+//
+// P_RejectTable
+// A REJECT built for a map that shipped none only rejects pairs the
+//  trace would refuse, but demos and netgames keep the WAD's.
+//
+static inline byte* P_RejectTable (void)
+{
+    if (demoplayback || demorecording || netgame)
+	return rejectmatrix;
+    return rejectlive;
 }
 
 
@@ -306,6 +536,9 @@ P_CheckSight
     int		pnum;
     int		bytenum;
     int		bitnum;
+    boolean	result;
+    boolean	cached;
+    sightentry_t* entry;
     
     // First check for trivial rejection.
 
@@ -317,7 +550,7 @@ P_CheckSight
     bitnum = 1 << (pnum&7);
 
     // Check in REJECT table.
-    if (rejectmatrix[bytenum]&bitnum)
+    if (P_RejectTable ()[bytenum]&bitnum)
     {
 	sightcounts[0]++;
 
@@ -325,25 +558,333 @@ P_CheckSight
 	return false;	
     }
 
+    cached = sightcache && sectormoved;
+    if (cached)
+    {
+	entry = P_SightEntry (t1, t2);
+	if (P_SightCached (entry, t1, t2))
+	{
+	    sightcachehits++;
+	    return entry->result;
+	}
+    }
+
     // An unobstructed LOS is possible.
     // Now look from eyes of t1 to any part of t2.
     sightcounts[1]++;
 
-    validcount++;
-	
-    sightzstart = t1->z + t1->height - (t1->height>>2);
-    topslope = (t2->z+t2->height) - sightzstart;
-    bottomslope = (t2->z) - sightzstart;
-	
-    strace.x = t1->x;
-    strace.y = t1->y;
-    t2x = t2->x;
-    t2y = t2->y;
-    strace.dx = t2->x - t1->x;
-    strace.dy = t2->y - t1->y;
+    result = P_TraceSight (&sighttrace, t1, t2);
+    if (cached)
+	P_FillSightEntry (t1, t2, result,
+			  sighttrace.sectors, sighttrace.numsectors);
+    return result;
+}
 
-    // the head node is the last node output
-    return P_CrossBSPNode (numnodes-1);	
+
+
+
+
+//
+// SIGHT THREADS
+// With sightthreads above 1, P_PrepareSight runs before the thinkers
+//  each tic.  It lists the P_CheckSight calls the A_Look and A_Chase
+//  actions about to fire will most likely make, traces them on the
+//  engine thread and sightthreads-1 workers, which take the next job
+//  off a shared counter, and files the results in the sight cache
+//  in list order.  The thinkers then run serially as before, so
+//  P_Random and any query whose ends moved in the meantime are
+//  untouched; a prepared result is only ever the one the walk would
+//  give.  sighttask/sightpending under sightlock hand a batch out,
+//  as with the render threads.
+//
+#define MAXSIGHTTHREADS	8
+#define MAXSIGHTJOBS	1024
+
+typedef struct
+{
+    mobj_t*	t1;
+    mobj_t*	t2;
+    boolean	result;
+    boolean	done;
+    int		numsectors;
+    int		sectors[SIGHTSECTORS];
+} sightjob_t;
+
+int			sightthreads = 1;	// UBO_DOOM_SIGHT_THREADS
+int			sightprepared;
+
+static int		numsightthreads = 1;
+static sightjob_t	sightjobs[MAXSIGHTJOBS];
+static int		numsightjobs;
+static int		sightnextjob;
+
+static sighttrace_t	sightworkers[MAXSIGHTTHREADS];
+static int		sightnumlines;
+
+static pthread_t	sightpthreads[MAXSIGHTTHREADS];
+static pthread_mutex_t	sightlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	sightstartcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	sightdonecond = PTHREAD_COND_INITIALIZER;
+static unsigned		sighttask;
+static int		sightpending;
+static boolean		sightquit;
+
+void A_Look (mobj_t* actor);
+void A_Chase (mobj_t* actor);
+
+
+//
+// P_RunSightJobs
+// Traces jobs until the list runs out.
+//
+static void P_RunSightJobs (sighttrace_t* st)
+{
+    sightjob_t*	job;
+    int		i;
+
+    while ((i = __atomic_fetch_add (&sightnextjob, 1, __ATOMIC_RELAXED))
+	   < numsightjobs)
+    {
+	job = &sightjobs[i];
+	job->result = P_TraceSight (st, job->t1, job->t2);
+	job->numsectors = st->numsectors;
+	if (st->numsectors > 0)
+	    memcpy (job->sectors, st->sectors,
+		    st->numsectors*sizeof(*st->sectors));
+	job->done = true;
+    }
+}
+
+
+static void* P_SightThread (void* arg)
+{
+    sighttrace_t*	st = &sightworkers[(int)(intptr_t)arg];
+    unsigned		task = 0;
+    boolean		quit;
+    jmp_buf		errorjmp;
+
+    for (;;)
+    {
+	pthread_mutex_lock (&sightlock);
+	while (sighttask == task && !sightquit)
+	    pthread_cond_wait (&sightstartcond, &sightlock);
+	task = sighttask;
+	quit = sightquit;
+	pthread_mutex_unlock (&sightlock);
+	if (quit)
+	    break;
+
+	// An I_Error in here only loses the job it hit; the
+	//  engine thread traces that one itself later.
+	i_errorjmp = &errorjmp;
+	if (!setjmp (errorjmp))
+	    P_RunSightJobs (st);
+	i_errorjmp = NULL;
+
+	pthread_mutex_lock (&sightlock);
+	if (--sightpending == 0)
+	    pthread_cond_signal (&sightdonecond);
+	pthread_mutex_unlock (&sightlock);
+    }
+    return NULL;
+}
+
+
+//
+// P_InitSightThreads
+// Starts sightthreads-1 workers, or stops them all for 1.
+//
+static void P_InitSightThreads (void)
+{
+    int		count = sightthreads;
+    int		i;
+
+    if (count > MAXSIGHTTHREADS)
+	count = MAXSIGHTTHREADS;
+    if (count < 1)
+	count = 1;
+    if (count == numsightthreads)
+	return;
+
+    P_ShutdownSightThreads ();
+    sightquit = false;
+    sighttask = 0;
+    for (i=1 ; i<count ; i++)
+    {
+	if (pthread_create (&sightpthreads[i], NULL, P_SightThread,
+			    (void *)(intptr_t)i) != 0)
+	{
+	    fprintf (stderr, "[doom] P_PrepareSight: sight thread %d failed to start\n", i);
+	    break;
+	}
+	numsightthreads = i+1;
+    }
+    fprintf (stderr, "[doom] P_PrepareSight: %d sight threads\n", numsightthreads);
+}
+
+
+//
+// P_ShutdownSightThreads
+//
+void P_ShutdownSightThreads (void)
+{
+    int		i;
+
+    if (numsightthreads > 1)
+    {
+	pthread_mutex_lock (&sightlock);
+	sightquit = true;
+	pthread_cond_broadcast (&sightstartcond);
+	pthread_mutex_unlock (&sightlock);
+
+	for (i=1 ; i<numsightthreads ; i++)
+	    pthread_join (sightpthreads[i], NULL);
+    }
+    numsightthreads = 1;
+
+    for (i=0 ; i<MAXSIGHTTHREADS ; i++)
+    {
+	free (sightworkers[i].linestamps);
+	sightworkers[i].linestamps = NULL;
+    }
+    sightnumlines = 0;
 }
 
 
+//
+// P_AddSightJob
+// Lists t1 looking at t2, unless REJECT or the cache
+//  already answers it.
+//
+static void P_AddSightJob (mobj_t* t1, mobj_t* t2)
+{
+    sightjob_t*	job;
+    int		pnum;
+
+    if (!t2 || t2 == t1 || numsightjobs == MAXSIGHTJOBS)
+	return;
+
+    pnum = (t1->subsector->sector - sectors)*numsectors
+	+ (t2->subsector->sector - sectors);
+    if (P_RejectTable ()[pnum>>3] & (1 << (pnum&7)))
+	return;
+    if (P_SightCached (P_SightEntry (t1, t2), t1, t2))
+	return;
+
+    job = &sightjobs[numsightjobs++];
+    job->t1 = t1;
+    job->t2 = t2;
+    job->done = false;
+}
+
+
+//
+// P_AddLookJobs
+// P_LookForPlayers checks sight to every live player.
+//
+static void P_AddLookJobs (mobj_t* actor)
+{
+    int		i;
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+	if (playeringame[i] && players[i].health > 0)
+	    P_AddSightJob (actor, players[i].mo);
+}
+
+
+//
+// P_PrepareSight
+// Called by P_RunThinkers before the thinkers run.
+//
+void P_PrepareSight (void)
+{
+    thinker_t*	th;
+    mobj_t*	mo;
+    actionf_p1	action;
+    mobj_t*	target;
+    int*	stamps;
+    int		i;
+
+    if (sightthreads != numsightthreads)
+	P_InitSightThreads ();
+    if (numsightthreads < 2 || !sightcache || !sectormoved)
+	return;
+
+    // The mobjs whose state runs out this tic, into a looking
+    //  or chasing one; parked ones are in a tics -1 state.
+    numsightjobs = 0;
+    for (th = thinkercap.rnext ; th != &thinkercap ; th = th->rnext)
+    {
+	if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+	    continue;
+	mo = (mobj_t *)th;
+	if (mo->tics != 1)
+	    continue;
+	action = states[mo->state->nextstate].action.acp1;
+
+	if (action == (actionf_p1)A_Look)
+	{
+	    target = mo->subsector->sector->soundtarget;
+	    if (target && (mo->flags & MF_AMBUSH))
+		P_AddSightJob (mo, target);
+	    P_AddLookJobs (mo);
+	}
+	else if (action == (actionf_p1)A_Chase)
+	{
+	    // P_CheckMissileRange, when A_Chase gets that far
+	    target = mo->target;
+	    if (target && (target->flags & MF_SHOOTABLE))
+	    {
+		if (netgame
+		    || (mo->info->missilestate
+			&& !(mo->flags & MF_JUSTATTACKED)
+			&& !(gameskill < sk_nightmare && !fastparm
+			     && mo->movecount)))
+		    P_AddSightJob (mo, target);
+	    }
+	    else
+		P_AddLookJobs (mo);
+	}
+    }
+    if (numsightjobs < numsightthreads)
+	return;
+
+    if (numlines > sightnumlines)
+    {
+	for (i=1 ; i<numsightthreads ; i++)
+	{
+	    stamps = realloc (sightworkers[i].linestamps,
+			      numlines*sizeof(*stamps));
+	    if (!stamps)
+		return;
+	    memset (stamps+sightnumlines, 0,
+		    (numlines-sightnumlines)*sizeof(*stamps));
+	    sightworkers[i].linestamps = stamps;
+	}
+	sightnumlines = numlines;
+    }
+
+    sightnextjob = 0;
+    pthread_mutex_lock (&sightlock);
+    sightpending = numsightthreads-1;
+    sighttask++;
+    pthread_cond_broadcast (&sightstartcond);
+    pthread_mutex_unlock (&sightlock);
+
+    P_RunSightJobs (&sighttrace);
+
+    pthread_mutex_lock (&sightlock);
+    while (sightpending)
+	pthread_cond_wait (&sightdonecond, &sightlock);
+    pthread_mutex_unlock (&sightlock);
+
+    for (i=0 ; i<numsightjobs ; i++)
+    {
+	if (!sightjobs[i].done)
+	    continue;
+	P_FillSightEntry (sightjobs[i].t1, sightjobs[i].t2,
+			  sightjobs[i].result, sightjobs[i].sectors,
+			  sightjobs[i].numsectors);
+	sightprepared++;
+    }
+}
@@ -64,6 +64,7 @@ typedef struct
     int		basepic;
     int		numpics;
     int		speed;
+    int		frame;		// leveltime/speed last written, -1 for none
     
 } anim_t;
 
@@ -181,6 +182,7 @@ void P_InitPicAnims (void)
 		     animdefs[i].endname);
 	
 	lastanim->speed = animdefs[i].speed;
+	lastanim->frame = -1;
 	lastanim++;
     }
 	
@@ -1085,6 +1087,8 @@ void P_UpdateSpecials (void)
     anim_t*	anim;
     int		pic;
     int		i;
+    int		frame;
+    int		left;
     line_t*	line;
 
     
@@ -1097,8 +1101,14 @@ void P_UpdateSpecials (void)
     }
     
     //	ANIMATE FLATS AND TEXTURES GLOBALLY
+    // The translations only change when leveltime crosses a multiple
+    //  of the speed, so the other tics leave them as they are.
     for (anim = anims ; anim < lastanim ; anim++)
     {
+	frame = leveltime/anim->speed;
+	if (frame == anim->frame)
+	    continue;
+	anim->frame = frame;
 	for (i=anim->basepic ; i<anim->basepic+anim->numpics ; i++)
 	{
 	    pic = anim->basepic + ( (leveltime/anim->speed + i)%anim->numpics );
@@ -1125,9 +1135,11 @@ void P_UpdateSpecials (void)
 
     
     //	DO BUTTONS
-    for (i = 0; i < MAXBUTTONS; i++)
+    // Stop at the last pressed one; most tics there are none.
+    for (i = 0, left = numbuttons; left > 0; i++)
 	if (buttonlist[i].btimer)
 	{
+	    left--;
 	    buttonlist[i].btimer--;
 	    if (!buttonlist[i].btimer)
 	    {
@@ -1150,6 +1162,7 @@ void P_UpdateSpecials (void)
 		}
 		S_StartSound((mobj_t *)&buttonlist[i].soundorg,sfx_swtchn);
 		memset(&buttonlist[i],0,sizeof(button_t));
+		numbuttons--;
 	    }
 	}
 	
@@ -1267,6 +1280,7 @@ void P_SpawnSpecials (void)
     }
     
     //	Init special SECTORs.
+    P_InitLights ();
     sector = sectors;
     for (i=0 ; i<numsectors ; i++, sector++)
     {
@@ -1356,6 +1370,11 @@ void P_SpawnSpecials (void)
     
     for (i = 0;i < MAXBUTTONS;i++)
 	memset(&buttonlist[i],0,sizeof(button_t));
+    numbuttons = 0;
+
+    // The translations are written again on the first tic of the level.
+    for (i = 0; anims + i < lastanim; i++)
+	anims[i].frame = -1;
 
     // UNUSED: no horizonal sliders.
     //	P_InitSlidingDoorFrames();
@@ -147,6 +147,8 @@ typedef struct
 
 
 
+// UBO: strobe_t and glow_t are what savegames hold; the running
+//  lights are the compact entries below (p_lights.c).
 typedef struct
 {
     thinker_t	thinker;
@@ -173,6 +175,51 @@ typedef struct
 } glow_t;
 
 
+typedef struct
+{
+    sector_t*	sector;
+    int		minlight;
+    int		maxlight;
+    int		darktime;
+    int		brighttime;
+
+} strobelight_t;
+
+typedef struct
+{
+    sector_t*	sector;
+    int		minlight;
+    int		maxlight;
+    int		direction;
+
+} glowlight_t;
+
+extern strobelight_t*	strobes;
+extern int*		strobecount;
+extern int		numstrobes;
+extern glowlight_t*	glows;
+extern int		numglows;
+
+void	P_InitLights (void);
+void	P_RunLights (void);
+
+void
+P_AddStrobe
+( sector_t*	sector,
+  int		count,
+  int		minlight,
+  int		maxlight,
+  int		darktime,
+  int		brighttime );
+
+void
+P_AddGlow
+( sector_t*	sector,
+  int		minlight,
+  int		maxlight,
+  int		direction );
+
+
 #define GLOWSPEED			8
 #define STROBEBRIGHT		5
 #define FASTDARK			15
@@ -181,7 +228,6 @@ typedef struct
 void    P_SpawnFireFlicker (sector_t* sector);
 void    T_LightFlash (lightflash_t* flash);
 void    P_SpawnLightFlash (sector_t* sector);
-void    T_StrobeFlash (strobe_t* flash);
 
 void
 P_SpawnStrobeFlash
@@ -197,7 +243,6 @@ EV_LightTurnOn
 ( line_t*	line,
   int		bright );
 
-void    T_Glow(glow_t* g);
 void    P_SpawnGlowingLight(sector_t* sector);
 
 
@@ -247,6 +292,7 @@ typedef struct
 #define BUTTONTIME      35             
 
 extern button_t	buttonlist[MAXBUTTONS]; 
+extern int	numbuttons;
 
 void
 P_ChangeSwitchTexture
@@ -99,6 +99,7 @@ switchlist_t alphSwitchList[] =
 int		switchlist[MAXSWITCHES * 2];
 int		numswitches;
 button_t        buttonlist[MAXBUTTONS];
+int             numbuttons;     // entries with btimer set
 
 //
 // P_InitSwitchList
@@ -182,6 +183,7 @@ P_StartButton
 	    buttonlist[i].btexture = texture;
 	    buttonlist[i].btimer = time;
 	    buttonlist[i].soundorg = (mobj_t *)&line->frontsector->soundorg;
+	    numbuttons++;
 	    return;
 	}
     }
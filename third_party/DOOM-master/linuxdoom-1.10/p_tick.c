@@ -27,12 +27,16 @@ rcsid[] = "$Id: p_tick.c,v 1.4 1997/02/03 16:47:55 b1 Exp $";
 
 #include "z_zone.h"
 #include "p_local.h"
+#include "i_spectate.h"
 
 #include "doomstat.h"
 
 
 int	leveltime;
 
+// UBO: the last P_Ticker held for the menu (G_Ticker clears it first)
+boolean	tickerheld;
+
 //
 // THINKERS
 // All thinkers should be allocated by Z_Malloc
@@ -53,6 +57,7 @@ thinker_t	thinkercap;
 void P_InitThinkers (void)
 {
     thinkercap.prev = thinkercap.next  = &thinkercap;
+    thinkercap.rprev = thinkercap.rnext = &thinkercap;
 }
 
 
@@ -68,6 +73,11 @@ void P_AddThinker (thinker_t* thinker)
     thinker->next = &thinkercap;
     thinker->prev = thinkercap.prev;
     thinkercap.prev = thinker;
+
+    thinkercap.rprev->rnext = thinker;
+    thinker->rnext = &thinkercap;
+    thinker->rprev = thinkercap.rprev;
+    thinkercap.rprev = thinker;
 }
 
 
@@ -81,6 +91,83 @@ void P_RemoveThinker (thinker_t* thinker)
 {
   // FIXME: NOP.
   thinker->function.acv = (actionf_v)(-1);
+
+  // UBO: parked, it has to be back on the run list to be freed
+  P_WakeThinker (thinker);
+}
+
+
+
+//
+// PARKED MOBJS
+// UBO: a mobj in a state that lasts forever (tics -1), not moving
+//  and resting on the floor, or hanging where nothing pulls it, has
+//  nothing to do in P_MobjThinker: decorations, most items, corpses.
+//  P_RunThinkers takes such a mobj off the run list after its think;
+//  the thinker list proper still has it, so everything else that
+//  walks thinkercap sees it where it always was.  What can give it
+//  something to do again wakes it: P_SetMobjState, P_DamageMobj,
+//  PIT_ChangeSector (the sector it is in moves) and P_RemoveThinker.
+//  Waking puts it back at its place in the list order, so thinkers
+//  still run in vanilla order, skipping only calls that did nothing.
+//  Players always think (the ticcmds move them), and so do monsters
+//  while nightmare respawning counts for them.
+//
+static boolean P_MobjParks (mobj_t* mo)
+{
+    if (mo->tics != -1 || mo->player)
+	return false;
+    if (mo->momx || mo->momy || mo->momz || (mo->flags & MF_SKULLFLY))
+	return false;
+    if ((mo->flags & MF_COUNTKILL) && respawnmonsters)
+	return false;
+    if (mo->z == mo->floorz)
+	return true;
+
+    // P_ZMovement leaves a hanging thing where it is
+    return (mo->flags & (MF_NOGRAVITY|MF_FLOAT)) == MF_NOGRAVITY
+	&& mo->z > mo->floorz
+	&& mo->z + mo->height <= mo->ceilingz;
+}
+
+
+//
+// P_WakeThinker
+// Puts a parked thinker back on the run list, after the nearest
+//  thinker before it that is on it.
+//
+void P_WakeThinker (thinker_t* thinker)
+{
+    thinker_t*	before;
+
+    if (thinker->rnext)
+	return;
+
+    for (before = thinker->prev ; !before->rnext ; before = before->prev)
+	;
+    thinker->rprev = before;
+    thinker->rnext = before->rnext;
+    before->rnext->rprev = thinker;
+    before->rnext = thinker;
+}
+
+
+//
+// P_UnparkThinkers
+// Run list = thinker list again, for P_UnArchiveThinkers freeing them
+//  all, which P_WakeThinker's walk back could not step over.
+//
+void P_UnparkThinkers (void)
+{
+    thinker_t*	th;
+
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	th->rprev = th->prev;
+	th->rnext = th->next;
+    }
+    thinkercap.rprev = thinkercap.prev;
+    thinkercap.rnext = thinkercap.next;
 }
 
 
@@ -97,28 +184,122 @@ void P_AllocateThinker (thinker_t*	thinker)
 
 //
 // P_RunThinkers
+// The thinkers themselves come from the zone's per-size-class slabs
+//  (z_zone.c), so mobjs sit packed together away from the specials,
+//  but list order is allocation order, which demos depend on.  The
+//  next node is fetched while the current one thinks, and mobjs, the
+//  bulk of the list, get a direct call.  Parked mobjs are not on the
+//  run list (see above), so they cost nothing here.
 //
 void P_RunThinkers (void)
 {
     thinker_t*	currentthinker;
+    thinker_t*	next;
 
-    currentthinker = thinkercap.next;
+    P_PrepareSight ();
+
+    currentthinker = thinkercap.rnext;
     while (currentthinker != &thinkercap)
     {
+	__builtin_prefetch (currentthinker->rnext);
 	if ( currentthinker->function.acv == (actionf_v)(-1) )
 	{
 	    // time to remove it
+	    next = currentthinker->rnext;
 	    currentthinker->next->prev = currentthinker->prev;
 	    currentthinker->prev->next = currentthinker->next;
+	    currentthinker->rnext->rprev = currentthinker->rprev;
+	    currentthinker->rprev->rnext = currentthinker->rnext;
 	    Z_Free (currentthinker);
+	    currentthinker = next;
+	    continue;
+	}
+
+	if (currentthinker->function.acp1 == (actionf_p1)P_MobjThinker)
+	{
+	    P_MobjThinker ((mobj_t *)currentthinker);
+
+	    if (currentthinker->function.acp1 == (actionf_p1)P_MobjThinker
+		&& P_MobjParks ((mobj_t *)currentthinker))
+	    {
+		next = currentthinker->rnext;
+		currentthinker->rnext->rprev = currentthinker->rprev;
+		currentthinker->rprev->rnext = currentthinker->rnext;
+		currentthinker->rnext = currentthinker->rprev = NULL;
+		currentthinker = next;
+		continue;
+	    }
 	}
 	else
 	{
 	    if (currentthinker->function.acp1)
 		currentthinker->function.acp1 (currentthinker);
 	}
-	currentthinker = currentthinker->next;
+	// Read after the think: a thinker appended by the last
+	//  one still runs this tic.
+	currentthinker = currentthinker->rnext;
     }
+
+    P_RunLights ();
+}
+
+
+
+//
+// P_StateHash
+// UBO: FNV-1a over the words of the playsim state a desync shows up
+//  in first, for doom_state_hash and the spectator's check points.
+//
+extern int	prndindex;
+
+static unsigned P_HashWord (unsigned h, unsigned v)
+{
+    int		i;
+
+    for (i=0 ; i<4 ; i++, v >>= 8)
+	h = (h ^ (v & 0xff)) * 16777619u;
+    return h;
+}
+
+unsigned P_StateHash (void)
+{
+    unsigned	h = 2166136261u;
+    thinker_t*	th;
+    mobj_t*	mo;
+    player_t*	p;
+    int		i;
+
+    h = P_HashWord (h, leveltime);
+    h = P_HashWord (h, prndindex);
+    for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+	if (!playeringame[i])
+	    continue;
+	p = &players[i];
+	h = P_HashWord (h, p->health);
+	h = P_HashWord (h, p->armorpoints);
+	h = P_HashWord (h, p->readyweapon);
+	h = P_HashWord (h, p->playerstate);
+    }
+    if (gamestate != GS_LEVEL)
+	return h;
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+	    continue;
+	mo = (mobj_t *)th;
+	h = P_HashWord (h, mo->type);
+	h = P_HashWord (h, mo->x);
+	h = P_HashWord (h, mo->y);
+	h = P_HashWord (h, mo->z);
+	h = P_HashWord (h, mo->momx);
+	h = P_HashWord (h, mo->momy);
+	h = P_HashWord (h, mo->angle);
+	h = P_HashWord (h, mo->health);
+	h = P_HashWord (h, mo->state - states);
+	h = P_HashWord (h, mo->tics);
+    }
+    return h;
 }
 
 
@@ -130,19 +311,27 @@ void P_RunThinkers (void)
 void P_Ticker (void)
 {
     int		i;
+
+    // UBO: the positions frames drawn during this tic start from
+    if (interpolation)
+	R_SaveInterpolation ();
     
     // run the tic
     if (paused)
 	return;
 		
     // pause if in menu and at least one tic has been run
-    if ( !netgame
-	 && menuactive
-	 && !demoplayback
-	 && players[consoleplayer].viewz != 1)
-    {
+    // UBO: a spectator holds where the game it mirrors did, whatever
+    //  its own menu does
+    if (spectating)
+	tickerheld = I_SpectateHeld ();
+    else
+	tickerheld = !netgame
+	    && menuactive
+	    && !demoplayback
+	    && players[consoleplayer].viewz != 1;
+    if (tickerheld)
 	return;
-    }
     
 		
     for (i=0 ; i<MAXPLAYERS ; i++)
@@ -34,6 +34,13 @@
 // Carries out all thinking of monsters and players.
 void P_Ticker (void);
 
+// UBO: whether the last P_Ticker held for the menu; G_Ticker clears it
+//  before the tic's ticker runs.
+extern boolean tickerheld;
+
+// UBO: a hash of the playsim state (doom_state_hash).
+unsigned P_StateHash (void);
+
 
 
 #endif
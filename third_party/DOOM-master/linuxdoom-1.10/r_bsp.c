@@ -26,6 +26,8 @@ static const char
 rcsid[] = "$Id: r_bsp.c,v 1.4 1997/02/03 22:45:12 b1 Exp $";
 
 
+#include <stdlib.h>
+
 #include "doomdef.h"
 
 #include "m_bbox.h"
@@ -44,14 +46,18 @@ rcsid[] = "$Id: r_bsp.c,v 1.4 1997/02/03 22:45:12 b1 Exp $";
 
 
 
-seg_t*		curline;
-side_t*		sidedef;
-line_t*		linedef;
-sector_t*	frontsector;
-sector_t*	backsector;
+RTHREAD seg_t*		curline;
+RTHREAD side_t*		sidedef;
+RTHREAD line_t*		linedef;
+RTHREAD sector_t*	frontsector;
+RTHREAD sector_t*	backsector;
+
+RTHREAD drawseg_t*	drawsegs;
+RTHREAD drawseg_t*	ds_p;
+RTHREAD int		maxdrawsegs;
 
-drawseg_t	drawsegs[MAXDRAWSEGS];
-drawseg_t*	ds_p;
+// Most drawsegs a frame (strip) has used since the level started.
+int			drawsegpeak;
 
 
 void
@@ -62,11 +68,39 @@ R_StoreWallRange
 
 
 
+//
+// R_GrowDrawSegs
+// Doubles the calling thread's drawseg pool, keeping ds_p.
+//
+void R_GrowDrawSegs (void)
+{
+    int		used;
+
+    used = ds_p - drawsegs;
+    drawsegs = I_GrowArray (drawsegs, &maxdrawsegs,
+			    sizeof(*drawsegs), MAXDRAWSEGS, "drawsegs");
+    ds_p = drawsegs + used;
+}
+
+
+//
+// R_FreeDrawSegs
+//
+void R_FreeDrawSegs (void)
+{
+    free (drawsegs);
+    drawsegs = ds_p = NULL;
+    maxdrawsegs = 0;
+}
+
+
 //
 // R_ClearDrawSegs
 //
 void R_ClearDrawSegs (void)
 {
+    if (!maxdrawsegs)
+	R_GrowDrawSegs ();
     ds_p = drawsegs;
 }
 
@@ -88,8 +122,17 @@ typedef	struct
 #define MAXSEGS		32
 
 // newend is one past the last valid seg
-cliprange_t*	newend;
-cliprange_t	solidsegs[MAXSEGS];
+RTHREAD cliprange_t*	newend;
+RTHREAD cliprange_t	solidsegs[MAXSEGS];
+
+// The strip's left and right edges as planes through the view
+//  point, inward normals, and the box corner nearest each normal.
+//  Widened by a degree, they only cut boxes the angle and clip
+//  post tests in R_CheckBBox would throw away too.
+#define VIEWPLANESLACK	(ANG45/45)
+
+static RTHREAD fixed_t	viewplanes[2][2];
+static RTHREAD int	viewplanecorner[2][2];
 
 
 
@@ -242,34 +285,55 @@ R_ClipPassWallSegment
 //
 // R_ClearClipSegs
 //
+// Everything outside this thread's strip starts out solid.
+//
 void R_ClearClipSegs (void)
 {
+    angle_t	left;
+    angle_t	right;
+    int		i;
+
     solidsegs[0].first = -0x7fffffff;
-    solidsegs[0].last = -1;
-    solidsegs[1].first = viewwidth;
+    solidsegs[0].last = rstripx1-1;
+    solidsegs[1].first = rstripx2+1;
     solidsegs[1].last = 0x7fffffff;
     newend = solidsegs+2;
+
+    // column x spans xtoviewangle[x] up to xtoviewangle[x-1]
+    left = (viewangle + xtoviewangle[rstripx1 ? rstripx1-1 : 0] + VIEWPLANESLACK)
+	>> ANGLETOFINESHIFT;
+    right = (viewangle + xtoviewangle[rstripx2+1] - VIEWPLANESLACK)
+	>> ANGLETOFINESHIFT;
+    viewplanes[0][0] = finesine[left];
+    viewplanes[0][1] = -finecosine[left];
+    viewplanes[1][0] = -finesine[right];
+    viewplanes[1][1] = finecosine[right];
+    for (i=0 ; i<2 ; i++)
+    {
+	viewplanecorner[i][0] = viewplanes[i][0] > 0 ? BOXRIGHT : BOXLEFT;
+	viewplanecorner[i][1] = viewplanes[i][1] > 0 ? BOXTOP : BOXBOTTOM;
+    }
 }
 
 //
 // R_AddLine
 // Clips the given segment
 // and adds any visible pieces to the line list.
+// angle1 and angle2 are R_PointToAngle of its vertices.
 //
-void R_AddLine (seg_t*	line)
+static void
+R_AddLine
+( seg_t*	line,
+  angle_t	angle1,
+  angle_t	angle2 )
 {
     int			x1;
     int			x2;
-    angle_t		angle1;
-    angle_t		angle2;
     angle_t		span;
     angle_t		tspan;
     
     curline = line;
 
-    // OPTIMIZE: quickly reject orthogonal back sides.
-    angle1 = R_PointToAngle (line->v1->x, line->v1->y);
-    angle2 = R_PointToAngle (line->v2->x, line->v2->y);
     
     // Clip to view edges.
     // OPTIMIZE: make constant out of 2*clipangle (FIELDOFVIEW).
@@ -398,6 +462,7 @@ boolean R_CheckBBox (fixed_t*	bspcoord)
 
     int			sx1;
     int			sx2;
+    int			i;
     
     // Find the corners of the box
     // that define the edges from current viewpoint.
@@ -418,6 +483,13 @@ boolean R_CheckBBox (fixed_t*	bspcoord)
     boxpos = (boxy<<2)+boxx;
     if (boxpos == 5)
 	return true;
+
+    // Wholly behind either edge of the strip?
+    for (i=0 ; i<2 ; i++)
+	if (((long long)bspcoord[viewplanecorner[i][0]] - viewx) * viewplanes[i][0]
+	    + ((long long)bspcoord[viewplanecorner[i][1]] - viewy) * viewplanes[i][1]
+	    < 0)
+	    return false;
 	
     x1 = bspcoord[checkcoord[boxpos][0]];
     y1 = bspcoord[checkcoord[boxpos][1]];
@@ -494,11 +566,18 @@ boolean R_CheckBBox (fixed_t*	bspcoord)
 // Add sprites of things in sector.
 // Draw one or more line segments.
 //
+#define SEGGROUP	16
+
 void R_Subsector (int num)
 {
     int			count;
+    int			group;
+    int			i;
     seg_t*		line;
     subsector_t*	sub;
+    fixed_t		vx[2*SEGGROUP];
+    fixed_t		vy[2*SEGGROUP];
+    angle_t		angles[2*SEGGROUP];
 	
 #ifdef RANGECHECK
     if (num>=numsubsectors)
@@ -534,16 +613,31 @@ void R_Subsector (int num)
 		
     R_AddSprites (frontsector);	
 
-    while (count--)
+    // The vertex angles go through R_PointToAngles a group of
+    //  segs at a time.
+    while (count > 0)
     {
-	R_AddLine (line);
-	line++;
+	group = count < SEGGROUP ? count : SEGGROUP;
+	for (i=0 ; i<group ; i++)
+	{
+	    vx[2*i] = line[i].v1->x;
+	    vy[2*i] = line[i].v1->y;
+	    vx[2*i+1] = line[i].v2->x;
+	    vy[2*i+1] = line[i].v2->y;
+	}
+	R_PointToAngles (vx, vy, angles, 2*group);
+
+	for (i=0 ; i<group ; i++)
+	    R_AddLine (&line[i], angles[2*i], angles[2*i+1]);
+	line += group;
+	count -= group;
     }
 }
 
 
 
 
+#ifndef BSPSTACK
 //
 // RenderBSPNode
 // Renders all subsectors below a given node,
@@ -576,5 +670,52 @@ void R_RenderBSPNode (int bspnum)
     if (R_CheckBBox (bsp->bbox[side^1]))	
 	R_RenderBSPNode (bsp->children[side^1]);
 }
+#else
+//
+// RenderBSPNode, iterative (build with -DBSPSTACK).
+// Goes down the near sides, stacking each node on the way, and
+//  checks the far boxes coming back up, once the near subtree has
+//  filled in the clip list, as the recursion does.  A tree deeper
+//  than the stack recurses for the rest.
+//
+#define MAXBSPSTACK	128
+
+void R_RenderBSPNode (int bspnum)
+{
+    node_t*	stack[MAXBSPSTACK];
+    int		farside[MAXBSPSTACK];
+    int		sp = 0;
+    node_t*	bsp;
+    int		side;
+
+    for (;;)
+    {
+	while (!(bspnum & NF_SUBSECTOR) && sp < MAXBSPSTACK)
+	{
+	    bsp = &nodes[bspnum];
+	    side = R_PointOnSide (viewx, viewy, bsp);
+	    stack[sp] = bsp;
+	    farside[sp++] = side^1;
+	    bspnum = bsp->children[side];
+	}
+
+	if (!(bspnum & NF_SUBSECTOR))
+	    R_RenderBSPNode (bspnum);
+	else if (bspnum == -1)
+	    R_Subsector (0);
+	else
+	    R_Subsector (bspnum&(~NF_SUBSECTOR));
+
+	// Back up to a far side that may be visible.
+	do
+	{
+	    if (!sp)
+		return;
+	    sp--;
+	} while (!R_CheckBBox (stack[sp]->bbox[farside[sp]]));
+	bspnum = stack[sp]->children[farside[sp]];
+    }
+}
+#endif
 
 
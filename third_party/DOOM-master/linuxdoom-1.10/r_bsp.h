@@ -28,25 +28,27 @@
 #endif
 
 
-extern seg_t*		curline;
-extern side_t*		sidedef;
-extern line_t*		linedef;
-extern sector_t*	frontsector;
-extern sector_t*	backsector;
+extern RTHREAD seg_t*		curline;
+extern RTHREAD side_t*		sidedef;
+extern RTHREAD line_t*		linedef;
+extern RTHREAD sector_t*	frontsector;
+extern RTHREAD sector_t*	backsector;
 
-extern int		rw_x;
-extern int		rw_stopx;
+extern RTHREAD int		rw_x;
+extern RTHREAD int		rw_stopx;
 
-extern boolean		segtextured;
+extern RTHREAD boolean		segtextured;
 
 // false if the back side is the same plane
-extern boolean		markfloor;		
-extern boolean		markceiling;
+extern RTHREAD boolean		markfloor;		
+extern RTHREAD boolean		markceiling;
 
 extern boolean		skymap;
 
-extern drawseg_t	drawsegs[MAXDRAWSEGS];
-extern drawseg_t*	ds_p;
+extern RTHREAD drawseg_t*	drawsegs;
+extern RTHREAD drawseg_t*	ds_p;
+extern RTHREAD int		maxdrawsegs;
+extern int			drawsegpeak;
 
 extern lighttable_t**	hscalelight;
 extern lighttable_t**	vscalelight;
@@ -59,6 +61,8 @@ typedef void (*drawfunc_t) (int start, int stop);
 // BSP?
 void R_ClearClipSegs (void);
 void R_ClearDrawSegs (void);
+void R_GrowDrawSegs (void);
+void R_FreeDrawSegs (void);
 
 
 void R_RenderBSPNode (int bspnum);
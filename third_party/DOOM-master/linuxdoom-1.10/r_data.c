@@ -27,9 +27,12 @@
 static const char
 rcsid[] = "$Id: r_data.c,v 1.4 1997/02/03 16:47:55 b1 Exp $";
 
+#include <pthread.h>
+#include <ctype.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include "i_system.h"
+#include "i_trace.h"
 #include "z_zone.h"
 
 #include "m_swap.h"
@@ -42,11 +45,22 @@ rcsid[] = "$Id: r_data.c,v 1.4 1997/02/03 16:47:55 b1 Exp $";
 
 #include "doomstat.h"
 #include "r_sky.h"
+#include "sounds.h"
+#include "doom_api.h"
+#include "wi_stuff.h"
+#include "f_finale.h"
 
 #ifdef LINUX
 #include  <alloca.h>
 #endif
 
+// p_spec.h has enum constants named open/close, so no fcntl.h or
+// unistd.h here; the cache is opened with stdio.
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 
 #include "r_data.h"
 
@@ -163,14 +177,24 @@ int*			texturewidthmask;
 // needed for texture pegging
 fixed_t*		textureheight;		
 int*			texturecompositesize;
+int*			texturepitchshift;
 short**			texturecolumnlump;
 unsigned short**	texturecolumnofs;
-byte**			texturecomposite;
 
 // for global animation
 int*		flattranslation;
 int*		texturetranslation;
 
+// Name lookup: texturehash[bucket] is the lowest-numbered texture with
+//  that hash, texturenext[texture] the next one up; flats are chained
+//  newest first, as W_CheckNumForName finds lumps.  -1 ends a chain.
+static int*	texturehash;
+static int*	texturenext;
+static unsigned	texturehashmask;
+static int*	flathash;
+static int*	flatnext;
+static unsigned	flathashmask;
+
 // needed for pre rendering
 fixed_t*	spritewidth;	
 fixed_t*	spriteoffset;
@@ -178,6 +202,29 @@ fixed_t*	spritetopoffset;
 
 lighttable_t	*colormaps;
 
+// colormaps, when its brightest level maps every index to itself
+//  (it does in the id IWADs), else NULL; column drawers handed this
+//  table skip the lookup.
+lighttable_t	*identitymap;
+
+// colormaps with the palette applied, for the direct565 drawers;
+//  R_SetPalette565 refills it whenever the shown palette changes.
+lighttable565_t	*colormaps565;
+unsigned short	palette565[256];
+static int	numcolormaps;
+
+// UBO: translated player colours.  Behind the lump's light tables
+//  colormaps holds room for each of them fused with each translation
+//  (MAXTRANSLATIONS), so a green player sprite drawn through one is a
+//  plain column, not a translation and a light lookup per pixel.  A
+//  table is built the first time it is drawn and stays for the run;
+//  colormaps565 has the same layout.
+#define MAXTRANSLATIONS		3
+
+static int		lumpcolormaps;	// light tables in the COLORMAP lump
+static byte*		translatedbuilt;	// per translation and table
+static pthread_mutex_t	translatedlock = PTHREAD_MUTEX_INITIALIZER;
+
 
 //
 // MAPTEXTURE_T CACHING
@@ -236,15 +283,48 @@ R_DrawColumnInCache
 
 
 
+//
+// R_CompositeSize
+// Bytes in the composite of tex: every column, each 1<<pitchshift.
+//
+static int R_CompositeSize (int tex)
+{
+    return textures[tex]->width << texturepitchshift[tex];
+}
+
+
+//
+// R_AllocComposite
+// Room for the composite of tex, columns on cache-line boundaries;
+//  NULL when out of memory.
+//
+static byte* R_AllocComposite (int tex)
+{
+    void*	block;
+
+    if (posix_memalign (&block, 64, R_CompositeSize (tex)))
+	return NULL;
+    return block;
+}
+
+
+
 //
 // R_GenerateComposite
 // Using the texture definition,
 //  the composite texture is created from the patches,
-//  and each column is cached.
+//  and each column is cached into block.
+// UBO: block holds every column at texturepitchshift strides from
+//  its cache-line aligned start, each the 1<<pitchshift bytes the
+//  drawers read from R_GetColumn's vanilla pointer: the lump from the
+//  first post's pixels on, headers and later posts included, for a
+//  single patch column; vanilla's packed composite from the column on,
+//  into the next one, for the rest.  Only what vanilla read past the
+//  end of the packed block, or of a lump cached in the zone, is zero
+//  here.
 //
-void R_GenerateComposite (int texnum)
+static void R_GenerateComposite (int texnum, byte* block)
 {
-    byte*		block;
     texture_t*		texture;
     texpatch_t*		patch;	
     patch_t*		realpatch;
@@ -252,24 +332,31 @@ void R_GenerateComposite (int texnum)
     int			x1;
     int			x2;
     int			i;
+    int			pitch;
+    int			count;
     column_t*		patchcol;
     short*		collump;
     unsigned short*	colofs;
+    byte*		packed;
+    byte*		source;
 	
+    UBO_TRACE_BEGIN ("composite");
     texture = textures[texnum];
 
-    block = Z_Malloc (texturecompositesize[texnum],
-		      PU_STATIC, 
-		      &texturecomposite[texnum]);	
-
     collump = texturecolumnlump[texnum];
     colofs = texturecolumnofs[texnum];
+
+    // vanilla's layout: the multi patch columns, one after another
+    //  (left blank if there is no memory for it on the worker)
+    packed = NULL;
+    if (texturecompositesize[texnum] > 0)
+	packed = calloc (1, texturecompositesize[texnum]);
     
     // Composite the columns together.
     patch = texture->patches;
 		
     for (i=0 , patch = texture->patches;
-	 i<texture->patchcount;
+	 i<texture->patchcount && packed;
 	 i++, patch++)
     {
 	int pw;
@@ -278,7 +365,7 @@ void R_GenerateComposite (int texnum)
 	/* Skip patches flagged missing/invalid (any negative lump number). */
 	if (patch->patch < 0)
 	    continue;
-	realpatch = W_CacheLumpNum (patch->patch, PU_CACHE);
+	realpatch = R_CacheLumpNum (patch->patch, PU_CACHE);
 	pw = (int)(short)SHORT(realpatch->width);
 	if (pw <= 0)
 	    continue;
@@ -314,16 +401,39 @@ void R_GenerateComposite (int texnum)
 	    patchcol = (column_t *)((byte *)realpatch
 				    + LONG(realpatch->columnofs[col]));
 	    R_DrawColumnInCache (patchcol,
-				 block + colofs[x],
+				 packed + colofs[x],
 				 patch->originy,
 				 texture->height);
 	}
 						
     }
 
-    // Now that the texture has been built in column cache,
-    //  it is purgable from zone memory.
-    Z_ChangeTag (block, PU_CACHE);
+    // Lay every column out at its stride.
+    pitch = 1 << texturepitchshift[texnum];
+    memset (block, 0, R_CompositeSize (texnum));
+    for (x=0 ; x<texture->width ; x++)
+    {
+	if (collump[x] > 0)
+	{
+	    source = R_CacheLumpNum (collump[x], PU_CACHE);
+	    count = W_LumpLength (collump[x]) - colofs[x];
+	    // in a mapped WAD vanilla went on into the next lumps
+	    if (count > 0 && lumpinfo[collump[x]].mapped)
+		count = W_MappedBytes (source + colofs[x]);
+	}
+	else
+	{
+	    source = packed;
+	    count = packed ? texturecompositesize[texnum] - colofs[x] : 0;
+	}
+	if (count > pitch)
+	    count = pitch;
+	if (count > 0)
+	    memcpy (block + (x<<texturepitchshift[texnum]),
+		    source + colofs[x], count);
+    }
+    free (packed);
+    UBO_TRACE_END ();
 }
 
 
@@ -343,6 +453,7 @@ void R_GenerateLookup (int texnum)
     int			i;
     short*		collump;
     unsigned short*	colofs;
+    boolean		missing;
 	
     texture = textures[texnum];
 
@@ -355,9 +466,6 @@ void R_GenerateLookup (int texnum)
 	return;
     }
 
-    // Composited texture not created yet.
-    texturecomposite[texnum] = 0;
-    
     texturecompositesize[texnum] = 0;
     collump = texturecolumnlump[texnum];
     colofs = texturecolumnofs[texnum];
@@ -376,6 +484,7 @@ void R_GenerateLookup (int texnum)
 	return;
     }
     memset (patchcount, 0, texture->width);
+    missing = false;
     patch = texture->patches;
 		
     for (i=0 , patch = texture->patches;
@@ -436,14 +545,23 @@ void R_GenerateLookup (int texnum)
 	
     for (x=0 ; x<texture->width ; x++)
     {
+	// UBO: vanilla returned at the first column without a patch,
+	//  leaving it and the rest of the lookup unset.  Those columns
+	//  now come from the start of the composite; the ones after
+	//  keep their last patch, as vanilla drew them.
 	if (!patchcount[x])
 	{
-	    printf ("R_GenerateLookup: column without a patch (%s)\n",
-		    texture->name);
-	    free(patchcount);
-	    return;
+	    if (!missing)
+		printf ("R_GenerateLookup: column without a patch (%s)\n",
+			texture->name);
+	    missing = true;
+	    collump[x] = -1;
+	    colofs[x] = 0;
+	    continue;
 	}
 	// I_Error ("R_GenerateLookup: column without a patch");
+	if (missing)
+	    continue;
 	
 	if (patchcount[x] > 1)
 	{
@@ -466,6 +584,309 @@ void R_GenerateLookup (int texnum)
 
 
 
+//
+// SHARED DRAWING CACHE
+// With render threads running (r_main.c) nothing a drawer reads may
+//  be purged, or filled in, behind another thread's back, and the
+//  zone is the engine thread's.  Lumps that are not mapped come from
+//  the shared lump cache instead (W_CacheLumpShared), which keeps
+//  them outside the zone until R_PrecacheLevel flushes it for the
+//  next level.
+//
+
+//
+// R_CacheLumpNum
+// W_CacheLumpNum for the drawers.  Mapped lumps come straight from
+//  the WAD; with render threads running the rest are copied once per
+//  level instead of going through the purgable cache.
+//
+void* R_CacheLumpNum (int lump, int tag)
+{
+    if (numrenderthreads <= 1
+	|| (unsigned)lump >= numlumps
+	|| lumpinfo[lump].mapped)
+	return W_CacheLumpNum (lump, tag);
+
+    return W_CacheLumpShared (lump);
+}
+
+
+
+//
+// COMPOSITE CACHE
+// Multi-patch textures are composited into malloced blocks outside
+//  the zone, so a purge can no longer throw one away to be rebuilt
+//  in the middle of a later frame.  Each block is stamped with the
+//  last framecount that drew it.  Once the blocks add up to more than
+//  compositelimit bytes, R_TrimComposites frees the least recently
+//  drawn ones between frames, when no render thread is reading.
+//  Textures the last frame drew are kept even over the limit, so a
+//  view larger than the cache does not rebuild every frame.
+// R_PrecacheLevel hands the level's textures to a worker that
+//  composites those whose patches are all mapped, which needs no
+//  zone; the rest are built on first use in R_GetColumn.  Blocks are
+//  published under rcachelock, readers seeing them through an
+//  acquire load.
+//
+static pthread_mutex_t	rcachelock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct
+{
+    byte*	data;		// NULL until built
+    int		lastuse;	// framecount that last drew it
+} composite_t;
+
+int			compositelimit = 4*1024*1024;
+int			compositebytes;
+int			numcomposites;
+unsigned		compositehits;
+unsigned		compositemisses;
+unsigned		compositeprebuilt;
+unsigned		compositeevictions;
+
+static composite_t*	composites;
+static int		compositeslots;	// numtextures they were made for
+
+static pthread_t	compthread;
+static int		compthreadrunning;
+static int		compcancel;
+static int*		complist;
+static int		numcomplist;
+
+
+//
+// R_PublishComposite
+// Makes block the composite of tex unless another thread got there
+//  first, and returns whichever one is now in the cache.
+//
+static byte*
+R_PublishComposite
+( int		tex,
+  byte*		block,
+  unsigned*	counter )
+{
+    byte*	data;
+
+    pthread_mutex_lock (&rcachelock);
+    data = composites[tex].data;
+    if (!data)
+    {
+	data = block;
+	composites[tex].lastuse = __atomic_load_n (&framecount, __ATOMIC_RELAXED);
+	compositebytes += R_CompositeSize (tex);
+	numcomposites++;
+	(*counter)++;
+	__atomic_store_n (&composites[tex].data, block, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock (&rcachelock);
+
+    if (data != block)
+	free (block);
+    return data;
+}
+
+
+//
+// R_GetComposite
+//
+static byte* R_GetComposite (int tex)
+{
+    composite_t*	c = &composites[tex];
+    byte*		block;
+    int			seen;
+
+    block = __atomic_load_n (&c->data, __ATOMIC_ACQUIRE);
+    if (block)
+    {
+	// one hit per texture per frame, whichever strip gets it
+	seen = __atomic_load_n (&c->lastuse, __ATOMIC_RELAXED);
+	if (seen != framecount
+	    && __atomic_compare_exchange_n (&c->lastuse, &seen, framecount, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	    __atomic_add_fetch (&compositehits, 1, __ATOMIC_RELAXED);
+	return block;
+    }
+
+    block = R_AllocComposite (tex);
+    if (!block)
+	I_Error ("R_GetComposite: no memory for %.8s", textures[tex]->name);
+    R_GenerateComposite (tex, block);
+    return R_PublishComposite (tex, block, &compositemisses);
+}
+
+
+//
+// R_TrimComposites
+// Called between frames: frees least recently drawn composites
+//  until the cache is back under compositelimit.
+//
+void R_TrimComposites (void)
+{
+    int		i;
+    int		lru;
+
+    pthread_mutex_lock (&rcachelock);
+    while (compositebytes > compositelimit)
+    {
+	lru = -1;
+	for (i=0 ; i<compositeslots ; i++)
+	    if (composites[i].data
+		&& composites[i].lastuse != framecount
+		&& (lru < 0 || composites[i].lastuse < composites[lru].lastuse))
+		lru = i;
+	if (lru < 0)
+	    break;
+
+	free (composites[lru].data);
+	composites[lru].data = NULL;
+	compositebytes -= R_CompositeSize (lru);
+	numcomposites--;
+	compositeevictions++;
+    }
+    pthread_mutex_unlock (&rcachelock);
+}
+
+
+//
+// R_CompositeThread
+// Builds the listed composites until the cache is full.  Only
+//  textures made of mapped patches are listed: their patches come
+//  straight from the WAD mapping, with no zone involved.
+//
+static void* R_CompositeThread (void* arg)
+{
+    byte*	block;
+    boolean	full;
+    int		tex;
+    int		i;
+
+    (void)arg;
+    for (i=0 ; i<numcomplist && !__atomic_load_n (&compcancel, __ATOMIC_RELAXED) ; i++)
+    {
+	tex = complist[i];
+	if (__atomic_load_n (&composites[tex].data, __ATOMIC_ACQUIRE))
+	    continue;
+
+	pthread_mutex_lock (&rcachelock);
+	full = compositebytes + R_CompositeSize (tex) > compositelimit;
+	pthread_mutex_unlock (&rcachelock);
+	if (full)
+	    break;
+
+	block = R_AllocComposite (tex);
+	if (!block)
+	    break;
+	R_GenerateComposite (tex, block);
+	R_PublishComposite (tex, block, &compositeprebuilt);
+    }
+    return NULL;
+}
+
+
+//
+// R_CancelComposites
+// Stops and joins the composite worker, if any.
+//
+static void R_CancelComposites (void)
+{
+    if (!compthreadrunning)
+	return;
+    __atomic_store_n (&compcancel, 1, __ATOMIC_RELAXED);
+    pthread_join (compthread, NULL);
+    compthreadrunning = 0;
+    free (complist);
+    complist = NULL;
+    numcomplist = 0;
+}
+
+
+//
+// R_PurgeComposites
+// Frees every built composite but keeps the table; R_GetColumn
+//  builds them again as they are drawn.
+//
+void R_PurgeComposites (void)
+{
+    int		i;
+
+    R_CancelComposites ();
+    pthread_mutex_lock (&rcachelock);
+    for (i=0 ; i<compositeslots ; i++)
+    {
+	free (composites[i].data);
+	composites[i].data = NULL;
+    }
+    compositebytes = 0;
+    numcomposites = 0;
+    pthread_mutex_unlock (&rcachelock);
+}
+
+
+//
+// R_PrecacheComposites
+// Starts the worker on the level's multi-patch textures.
+//
+static void R_PrecacheComposites (const char* texturepresent)
+{
+    texture_t*	texture;
+    int		i;
+    int		j;
+
+    R_CancelComposites ();
+
+    complist = malloc (numtextures * sizeof(*complist));
+    if (!complist)
+	return;
+    numcomplist = 0;
+
+    for (i=0 ; i<numtextures ; i++)
+    {
+	if (!texturepresent[i] || textures[i]->width <= 0 || composites[i].data)
+	    continue;
+
+	texture = textures[i];
+	for (j=0 ; j<texture->patchcount ; j++)
+	    if (texture->patches[j].patch >= 0
+		&& !lumpinfo[texture->patches[j].patch].mapped)
+		break;
+	if (j == texture->patchcount)
+	    complist[numcomplist++] = i;
+    }
+
+    __atomic_store_n (&compcancel, 0, __ATOMIC_RELAXED);
+    if (!numcomplist
+	|| pthread_create (&compthread, NULL, R_CompositeThread, NULL) != 0)
+    {
+	free (complist);
+	complist = NULL;
+	numcomplist = 0;
+	return;
+    }
+    compthreadrunning = 1;
+}
+
+
+//
+// R_FreeComposites
+// Joins the worker and drops every composite, for shutdown or
+//  before R_InitData sets the textures up again.
+//
+void R_FreeComposites (void)
+{
+    int		i;
+
+    R_CancelComposites ();
+    for (i=0 ; i<compositeslots ; i++)
+	free (composites[i].data);
+    free (composites);
+    composites = NULL;
+    compositeslots = 0;
+    compositebytes = 0;
+    numcomposites = 0;
+}
+
+
+
 //
 // R_GetColumn
 //
@@ -482,15 +903,230 @@ R_GetColumn
     ofs = texturecolumnofs[tex][col];
     
     if (lump > 0)
-	return (byte *)W_CacheLumpNum(lump,PU_CACHE)+ofs;
+	return (byte *)R_CacheLumpNum(lump,PU_CACHE)+ofs;
+
+    return R_GetComposite (tex) + (col << texturepitchshift[tex]);
+}
+
+
+//
+// R_GetTextureComposite
+//
+byte* R_GetTextureComposite (int tex)
+{
+    return R_GetComposite (tex);
+}
+
+
+//
+// R_GetTextureColumn
+//
+byte*
+R_GetTextureColumn
+( int		tex,
+  int		col )
+{
+    return R_TEXTURECOLUMN (R_GetComposite (tex), tex, col);
+}
+
 
-    if (!texturecomposite[tex])
-	R_GenerateComposite (tex);
 
-    return texturecomposite[tex] + ofs;
+
+//
+// STARTUP CACHE
+// R_GenerateLookup touches every patch lump and R_InitSpriteLumps
+//  every sprite header, which is most of a cold start on slow storage.
+// Both only depend on the WADs, so the results are written to
+//  rdatacache and later startups point the tables straight into a
+//  read-only mapping of it.
+//
+// Layout: header, texturecompositesize[numtextures],
+//  spritewidth/spriteoffset/spritetopoffset[numspritelumps],
+//  all texturecolumnlump columns, all texturecolumnofs columns
+//  (both in texture order, texture->width entries each).
+//
+char*		rdatacache;
+
+#define RCACHE_MAGIC	"UBORDC02"
+
+typedef struct
+{
+    char		magic[8];
+    unsigned long long	key;		// W_Checksum()
+    int			numtextures;
+    int			numspritelumps;
+    int			numcolumns;	// sum of texture widths
+    int			pad;
+} rcacheheader_t;
+
+static byte*		rcache;		// valid mapping, or NULL
+static int		rcachesize;
+static int		rcachecolumns;
+
+static int R_CacheSize (int ntextures, int nsprites, int ncolumns)
+{
+    return sizeof(rcacheheader_t) + ntextures*4 + nsprites*4*3 + ncolumns*2*2;
+}
+
+//
+// R_FreeDataCache
+// Unmaps the startup cache; the tables it backs go with it.
+//
+void R_FreeDataCache (void)
+{
+    if (rcache)
+	munmap (rcache, rcachesize);
+    rcache = NULL;
 }
 
+//
+// R_MapDataCache
+// Maps rdatacache if it was built from the same WADs.
+//
+static void R_MapDataCache (void)
+{
+    rcacheheader_t*	header;
+    struct stat		st;
+    FILE*		f;
+    void*		base;
 
+    R_FreeDataCache ();
+
+    if (!rdatacache || !(f = fopen (rdatacache, "rb")))
+	return;
+    if (fstat (fileno (f), &st) == -1 || st.st_size < (off_t)sizeof(rcacheheader_t))
+    {
+	fclose (f);
+	return;
+    }
+    base = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno (f), 0);
+    fclose (f);
+    if (base == MAP_FAILED)
+	return;
+
+    header = base;
+    if (memcmp (header->magic, RCACHE_MAGIC, 8)
+	|| header->key != W_Checksum ()
+	|| st.st_size != R_CacheSize (header->numtextures,
+				      header->numspritelumps,
+				      header->numcolumns))
+    {
+	fprintf (stderr, "[doom] R_InitData: %s is stale, rebuilding\n", rdatacache);
+	munmap (base, st.st_size);
+	return;
+    }
+    rcache = base;
+    rcachesize = st.st_size;
+}
+
+static void R_DropDataCache (void)
+{
+    munmap (rcache, rcachesize);
+    rcache = NULL;
+}
+
+//
+// R_WriteDataCache
+// Written to a temporary file and renamed so a crash mid-write
+//  never leaves a truncated cache behind.
+//
+static void R_WriteDataCache (void)
+{
+    rcacheheader_t	header;
+    char		tmp[1024];
+    FILE*		f;
+    int			i;
+    int			ok;
+
+    if (!rdatacache)
+	return;
+    // a negative width would desync the column layout
+    for (i=0 ; i<numtextures ; i++)
+	if (textures[i]->width < 0)
+	    return;
+    snprintf (tmp, sizeof(tmp), "%s.tmp", rdatacache);
+    if ( !(f = fopen (tmp, "wb")) )
+	return;
+
+    memset (&header, 0, sizeof(header));
+    memcpy (header.magic, RCACHE_MAGIC, 8);
+    header.key = W_Checksum ();
+    header.numtextures = numtextures;
+    header.numspritelumps = numspritelumps;
+    header.numcolumns = rcachecolumns;
+
+    ok = fwrite (&header, sizeof(header), 1, f) == 1;
+    ok &= fwrite (texturecompositesize, 4, numtextures, f) == numtextures;
+    ok &= fwrite (spritewidth, 4, numspritelumps, f) == numspritelumps;
+    ok &= fwrite (spriteoffset, 4, numspritelumps, f) == numspritelumps;
+    ok &= fwrite (spritetopoffset, 4, numspritelumps, f) == numspritelumps;
+    for (i=0 ; i<numtextures ; i++)
+	ok &= fwrite (texturecolumnlump[i], 2, textures[i]->width, f) == textures[i]->width;
+    for (i=0 ; i<numtextures ; i++)
+	ok &= fwrite (texturecolumnofs[i], 2, textures[i]->width, f) == textures[i]->width;
+    ok &= fclose (f) == 0;
+
+    if (ok && rename (tmp, rdatacache) == 0)
+	fprintf (stderr, "[doom] R_InitData: wrote %s\n", rdatacache);
+    else
+	remove (tmp);
+}
+
+//
+// R_LoadTextureCache
+// Points the texture column tables into the cache mapping.
+//
+static void R_LoadTextureCache (void)
+{
+    rcacheheader_t*	header = (rcacheheader_t *)rcache;
+    short*		collump;
+    unsigned short*	colofs;
+    int			i;
+
+    memcpy (texturecompositesize, rcache + sizeof(*header), numtextures*4);
+    collump = (short *)(rcache + sizeof(*header)
+			+ numtextures*4 + header->numspritelumps*4*3);
+    colofs = (unsigned short *)(collump + header->numcolumns);
+
+    for (i=0 ; i<numtextures ; i++)
+    {
+	texturecolumnlump[i] = collump;
+	texturecolumnofs[i] = colofs;
+	collump += textures[i]->width;
+	colofs += textures[i]->width;
+    }
+}
+
+
+//
+// R_HashName
+// Case-insensitive hash of an up-to-8-character name, stopping at
+//  the first NUL as strncasecmp does.
+//
+static unsigned R_HashName (const char* name)
+{
+    unsigned	h;
+    int		i;
+
+    h = 2166136261u;
+    for (i=0 ; i<8 && name[i] ; i++)
+	h = (h ^ toupper (name[i])) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+
+//
+// R_HashSize
+// Power of two bucket count for n names, under half full.
+//
+static unsigned R_HashSize (int n)
+{
+    unsigned	size;
+
+    for (size = 1 ; size < (unsigned)n*2 ; size <<= 1)
+	;
+    return size;
+}
 
 
 //
@@ -507,6 +1143,7 @@ void R_InitTextures (void)
 
     int			i;
     int			j;
+    unsigned		h;
 
     int*		maptex;
     int*		maptex2;
@@ -594,9 +1231,9 @@ void R_InitTextures (void)
     textures           = Z_Malloc (numtextures*sizeof(*textures),           PU_STATIC, 0);
     texturecolumnlump  = Z_Malloc (numtextures*sizeof(*texturecolumnlump),  PU_STATIC, 0);
     texturecolumnofs   = Z_Malloc (numtextures*sizeof(*texturecolumnofs),   PU_STATIC, 0);
-    texturecomposite   = Z_Malloc (numtextures*sizeof(*texturecomposite),   PU_STATIC, 0);
     texturecompositesize = Z_Malloc (numtextures*4, PU_STATIC, 0);
     texturewidthmask   = Z_Malloc (numtextures*4, PU_STATIC, 0);
+    texturepitchshift  = Z_Malloc (numtextures*4, PU_STATIC, 0);
     textureheight      = Z_Malloc (numtextures*4, PU_STATIC, 0);
 
     totalwidth = 0;
@@ -685,15 +1322,17 @@ void R_InitTextures (void)
 			" - skipping\n", texture->name);
 	    }
 	}		
-	texturecolumnlump[i] = Z_Malloc (texture->width*2, PU_STATIC,0);
-	texturecolumnofs[i] = Z_Malloc (texture->width*2, PU_STATIC,0);
-
 	j = 1;
 	while (j*2 <= texture->width)
 	    j<<=1;
 
 	texturewidthmask[i] = j-1;
 	textureheight[i] = texture->height<<FRACBITS;
+
+	// a composite column holds the texture's height, at least 128
+	for (j=7 ; (1<<j) < texture->height ; j++)
+	    ;
+	texturepitchshift[i] = j;
 		
 	totalwidth += texture->width;
     }
@@ -703,18 +1342,53 @@ void R_InitTextures (void)
     if (maptex2)
 	Z_Free (maptex2);
     
-    // Precalculate whatever possible.	
-    fprintf(stderr, "[doom] R_InitTextures: numtextures=%d, running R_GenerateLookup...\n",
-	    numtextures);
-    for (i=0 ; i<numtextures ; i++)
-	R_GenerateLookup (i);
-    fprintf(stderr, "[doom] R_InitTextures: R_GenerateLookup loop done\n");
+    rcachecolumns = totalwidth;
+    if (rcache)
+    {
+	rcacheheader_t* header = (rcacheheader_t *)rcache;
+	if (header->numtextures != numtextures || header->numcolumns != totalwidth)
+	    R_DropDataCache ();
+    }
+
+    if (rcache)
+    {
+	R_LoadTextureCache ();
+	fprintf(stderr, "[doom] R_InitTextures: column lookups from %s\n", rdatacache);
+    }
+    else
+    {
+	for (i=0 ; i<numtextures ; i++)
+	{
+	    texturecolumnlump[i] = Z_Malloc (textures[i]->width*2, PU_STATIC,0);
+	    texturecolumnofs[i] = Z_Malloc (textures[i]->width*2, PU_STATIC,0);
+	}
+
+	// Precalculate whatever possible.	
+	fprintf(stderr, "[doom] R_InitTextures: numtextures=%d, running R_GenerateLookup...\n",
+		numtextures);
+	for (i=0 ; i<numtextures ; i++)
+	    R_GenerateLookup (i);
+	fprintf(stderr, "[doom] R_InitTextures: R_GenerateLookup loop done\n");
+    }
 
     // Create translation table for global animation.
     texturetranslation = Z_Malloc ((numtextures+1)*4, PU_STATIC, 0);
     
     for (i=0 ; i<numtextures ; i++)
 	texturetranslation[i] = i;
+
+    // Index the names for R_CheckTextureNumForName, highest first so
+    //  each chain starts at the first texture of a name.
+    texturehashmask = R_HashSize (numtextures) - 1;
+    texturehash = Z_Malloc ((texturehashmask+1)*sizeof(*texturehash), PU_STATIC, 0);
+    texturenext = Z_Malloc ((numtextures+1)*sizeof(*texturenext), PU_STATIC, 0);
+    memset (texturehash, -1, (texturehashmask+1)*sizeof(*texturehash));
+    for (i=numtextures-1 ; i>=0 ; i--)
+    {
+	h = R_HashName (textures[i]->name) & texturehashmask;
+	texturenext[i] = texturehash[h];
+	texturehash[h] = i;
+    }
     fprintf(stderr, "[doom] R_InitTextures: complete\n");
 }
 
@@ -726,6 +1400,7 @@ void R_InitTextures (void)
 void R_InitFlats (void)
 {
     int		i;
+    unsigned	h;
 	
     firstflat = W_GetNumForName ("F_START") + 1;
     lastflat = W_GetNumForName ("F_END") - 1;
@@ -736,6 +1411,18 @@ void R_InitFlats (void)
     
     for (i=0 ; i<numflats ; i++)
 	flattranslation[i] = i;
+
+    // Index the names for R_FlatNumForName.
+    flathashmask = R_HashSize (numflats) - 1;
+    flathash = Z_Malloc ((flathashmask+1)*sizeof(*flathash), PU_STATIC, 0);
+    flatnext = Z_Malloc ((numflats+1)*sizeof(*flatnext), PU_STATIC, 0);
+    memset (flathash, -1, (flathashmask+1)*sizeof(*flathash));
+    for (i=0 ; i<numflats ; i++)
+    {
+	h = R_HashName (lumpinfo[firstflat+i].name) & flathashmask;
+	flatnext[i] = flathash[h];
+	flathash[h] = i;
+    }
 }
 
 
@@ -754,6 +1441,19 @@ void R_InitSpriteLumps (void)
     lastspritelump = W_GetNumForName ("S_END") - 1;
     
     numspritelumps = lastspritelump - firstspritelump + 1;
+
+    if (rcache && ((rcacheheader_t *)rcache)->numspritelumps == numspritelumps)
+    {
+	fixed_t* cached = (fixed_t *)(rcache + sizeof(rcacheheader_t) + numtextures*4);
+
+	spritewidth = cached;
+	spriteoffset = cached + numspritelumps;
+	spritetopoffset = cached + numspritelumps*2;
+	return;
+    }
+    if (rcache)
+	R_DropDataCache ();
+
     spritewidth = Z_Malloc (numspritelumps*4, PU_STATIC, 0);
     spriteoffset = Z_Malloc (numspritelumps*4, PU_STATIC, 0);
     spritetopoffset = Z_Malloc (numspritelumps*4, PU_STATIC, 0);
@@ -779,14 +1479,98 @@ void R_InitSpriteLumps (void)
 void R_InitColormaps (void)
 {
     int	lump, length;
+    int	i;
     
     // Load in the light tables, 
     //  256 byte align tables.
     lump = W_GetNumForName("COLORMAP"); 
-    length = W_LumpLength (lump) + 255; 
+    lumpcolormaps = W_LumpLength (lump) / 256;
+    length = (1+MAXTRANSLATIONS)*lumpcolormaps*256 + 255; 
     colormaps = Z_Malloc (length, PU_STATIC, 0); 
     colormaps = (byte *)( ((intptr_t)colormaps + 255)&~0xff); 
     W_ReadLump (lump,colormaps); 
+
+    translatedbuilt = Z_Malloc (MAXTRANSLATIONS*lumpcolormaps, PU_STATIC, 0);
+    memset (translatedbuilt, 0, MAXTRANSLATIONS*lumpcolormaps);
+
+    identitymap = colormaps;
+    for (i=0 ; i<256 ; i++)
+	if (colormaps[i] != i)
+	{
+	    identitymap = NULL;
+	    break;
+	}
+
+    numcolormaps = length - 255;
+    colormaps565 = Z_Malloc (numcolormaps*sizeof(*colormaps565), PU_STATIC, 0);
+    memset (colormaps565, 0, numcolormaps*sizeof(*colormaps565));
+}
+
+
+//
+// R_SetPalette565
+// lut: the RGB565 (big-endian) colour of every palette index as
+//  shown now.  Rebuilds colormaps565 and palette565 from it.
+//
+void R_SetPalette565 (const unsigned short* lut)
+{
+    int	i;
+
+    int	t;
+    int	map;
+
+    memcpy (palette565, lut, sizeof(palette565));
+    for (i=0 ; i<lumpcolormaps*256 ; i++)
+	colormaps565[i] = lut[colormaps[i]];
+    for (t=0 ; t<MAXTRANSLATIONS ; t++)
+	for (map=0 ; map<lumpcolormaps ; map++)
+	{
+	    if (!__atomic_load_n (&translatedbuilt[t*lumpcolormaps + map],
+				  __ATOMIC_ACQUIRE))
+		continue;
+	    for (i=((1+t)*lumpcolormaps + map)*256
+		     ; i<((1+t)*lumpcolormaps + map + 1)*256 ; i++)
+		colormaps565[i] = lut[colormaps[i]];
+	}
+}
+
+
+//
+// R_TranslatedColormap
+// The table that draws translation (1..MAXTRANSLATIONS, as in
+//  MF_TRANSLATION) lit through colormap, one of the lump's light
+//  tables; NULL for any other.  Safe on render threads.
+//
+lighttable_t* R_TranslatedColormap (int translation, lighttable_t* colormap)
+{
+    int			map = (colormap - colormaps) >> 8;
+    int			slot = (translation-1)*lumpcolormaps + map;
+    byte*		trans;
+    lighttable_t*	fused;
+    int			i;
+
+    if (translation < 1 || translation > MAXTRANSLATIONS
+	|| colormap < colormaps || map >= lumpcolormaps
+	|| colormap != colormaps + map*256)
+	return NULL;
+
+    fused = colormaps + (translation*lumpcolormaps + map)*256;
+    if (__atomic_load_n (&translatedbuilt[slot], __ATOMIC_ACQUIRE))
+	return fused;
+
+    pthread_mutex_lock (&translatedlock);
+    if (!translatedbuilt[slot])
+    {
+	trans = translationtables + (translation-1)*256;
+	for (i=0 ; i<256 ; i++)
+	{
+	    fused[i] = colormap[trans[i]];
+	    colormaps565[fused + i - colormaps] = palette565[fused[i]];
+	}
+	__atomic_store_n (&translatedbuilt[slot], 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock (&translatedlock);
+    return fused;
 }
 
 
@@ -799,6 +1583,8 @@ void R_InitColormaps (void)
 //
 void R_InitData (void)
 {
+    R_FreeComposites ();
+    R_MapDataCache ();
     R_InitTextures ();
     printf ("\nInitTextures");
     R_InitFlats ();
@@ -807,6 +1593,13 @@ void R_InitData (void)
     printf ("\nInitSprites");
     R_InitColormaps ();
     printf ("\nInitColormaps");
+    if (!rcache)
+	R_WriteDataCache ();
+
+    composites = calloc (numtextures, sizeof(*composites));
+    if (!composites)
+	I_Error ("R_InitData: no memory for %i composites", numtextures);
+    compositeslots = numtextures;
 }
 
 
@@ -820,6 +1613,11 @@ int R_FlatNumForName (char* name)
     int		i;
     char	namet[9];
 
+    for (i = flathash[R_HashName (name) & flathashmask] ; i != -1 ; i = flatnext[i])
+	if (!strncasecmp (lumpinfo[firstflat+i].name, name, 8))
+	    return i;
+
+    // Not between F_START and F_END: fall back on any lump of that name.
     i = W_CheckNumForName (name);
 
     if (i == -1)
@@ -847,7 +1645,7 @@ int	R_CheckTextureNumForName (char *name)
     if (name[0] == '-')		
 	return 0;
 		
-    for (i=0 ; i<numtextures ; i++)
+    for (i = texturehash[R_HashName (name) & texturehashmask] ; i != -1 ; i = texturenext[i])
 	if (!strncasecmp (textures[i]->name, name, 8) )
 	    return i;
 		
@@ -881,10 +1679,58 @@ int	R_TextureNumForName (char* name)
 //
 // R_PrecacheLevel
 // Preloads all relevant graphics for the level.
+// The lumps are collected here and paged in by the W_PrefetchLumps
+//  worker, so P_SetupLevel no longer stalls on them; the zone copies
+//  (if any) are still made on first use by the main thread.  The
+//  level's composites are built ahead by R_PrecacheComposites.
+// The sound effects its things and the player can make ride along
+//  (ubo_sfx_prefetch), as I_StartSound only loads them when played.
+// The intermission and finale screens the level ends on go last, so
+//  they are in memory long before the exit, wherever that comes.
 //
 int		flatmemory;
 int		texturememory;
 int		spritememory;
+int		soundmemory;
+int		levelendmemory;
+
+static const int playersounds[] =
+{
+    sfx_pistol, sfx_shotgn, sfx_dshtgn, sfx_punch, sfx_sawup, sfx_sawidl,
+    sfx_plasma, sfx_rlaunc, sfx_bfg, sfx_itemup, sfx_wpnup, sfx_getpow,
+    sfx_oof, sfx_noway, sfx_plpain, sfx_pldeth, sfx_doropn, sfx_dorcls,
+    sfx_bdopn, sfx_bdcls, sfx_swtchn, sfx_swtchx, sfx_pstart, sfx_pstop,
+    sfx_stnmov, sfx_telept
+};
+
+#define ENDLUMPS	512		// intermission and finale lumps listed
+
+static int*	precachelist;
+static int	numprecache;
+static byte*	precachepresent;
+
+static void R_PrecacheLump (int lump, int* memory)
+{
+    if (lump < 0 || lump >= numlumps || precachepresent[lump])
+	return;
+    precachepresent[lump] = 1;
+    precachelist[numprecache++] = lump;
+    *memory += lumpinfo[lump].size;
+}
+
+static void R_PrecacheSound (int id, int* memory)
+{
+    char	name[9];
+
+    if (id <= sfx_None || id >= NUMSFX)
+	return;
+    if (S_sfx[id].link)
+	id = S_sfx[id].link - S_sfx;
+    if (S_sfx[id].data)
+	return;
+    sprintf (name, "ds%s", S_sfx[id].name);
+    R_PrecacheLump (W_CheckNumForName (name), memory);
+}
 
 void R_PrecacheLevel (void)
 {
@@ -895,14 +1741,30 @@ void R_PrecacheLevel (void)
     int			i;
     int			j;
     int			k;
-    int			lump;
     
     texture_t*		texture;
     thinker_t*		th;
     spriteframe_t*	sf;
+    mobjinfo_t*		info;
+    int*		endlumps;
+    int			count;
+
+    // Last level's shared copies; the render threads are idle.
+    W_FlushSharedCache ();
 
     if (demoplayback)
 	return;
+
+    // Each lump is listed at most once.
+    precachelist = malloc (numlumps * sizeof(*precachelist));
+    precachepresent = calloc (numlumps, 1);
+    numprecache = 0;
+    if (!precachelist || !precachepresent)
+    {
+	free (precachelist);
+	free (precachepresent);
+	return;
+    }
     
     // Precache flats.
     flatpresent = alloca(numflats);
@@ -919,11 +1781,7 @@ void R_PrecacheLevel (void)
     for (i=0 ; i<numflats ; i++)
     {
 	if (flatpresent[i])
-	{
-	    lump = firstflat + i;
-	    flatmemory += lumpinfo[lump].size;
-	    W_CacheLumpNum(lump, PU_CACHE);
-	}
+	    R_PrecacheLump (firstflat + i, &flatmemory);
     }
     
     // Precache textures.
@@ -945,6 +1803,8 @@ void R_PrecacheLevel (void)
     //  name.
     texturepresent[skytexture] = 1;
 	
+    R_PrecacheComposites (texturepresent);
+
     texturememory = 0;
     for (i=0 ; i<numtextures ; i++)
     {
@@ -953,12 +1813,9 @@ void R_PrecacheLevel (void)
 
 	texture = textures[i];
 	
+	// missing patches were left as -1 by R_InitTextures
 	for (j=0 ; j<texture->patchcount ; j++)
-	{
-	    lump = texture->patches[j].patch;
-	    texturememory += lumpinfo[lump].size;
-	    W_CacheLumpNum(lump , PU_CACHE);
-	}
+	    R_PrecacheLump (texture->patches[j].patch, &texturememory);
     }
     
     // Precache sprites.
@@ -981,13 +1838,42 @@ void R_PrecacheLevel (void)
 	{
 	    sf = &sprites[i].spriteframes[j];
 	    for (k=0 ; k<8 ; k++)
-	    {
-		lump = firstspritelump + sf->lump[k];
-		spritememory += lumpinfo[lump].size;
-		W_CacheLumpNum(lump , PU_CACHE);
-	    }
+		R_PrecacheLump (firstspritelump + sf->lump[k], &spritememory);
+	}
+    }
+
+    // Precache sounds.
+    soundmemory = 0;
+    if (ubo_sfx_prefetch)
+    {
+	for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+	{
+	    if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+		continue;
+	    info = ((mobj_t *)th)->info;
+	    R_PrecacheSound (info->seesound, &soundmemory);
+	    R_PrecacheSound (info->attacksound, &soundmemory);
+	    R_PrecacheSound (info->painsound, &soundmemory);
+	    R_PrecacheSound (info->deathsound, &soundmemory);
+	    R_PrecacheSound (info->activesound, &soundmemory);
 	}
+	for (i=0 ; i<(int)(sizeof(playersounds)/sizeof(*playersounds)) ; i++)
+	    R_PrecacheSound (playersounds[i], &soundmemory);
     }
+
+    // The screens after the level: no intermission before a DOOM 1 victory.
+    levelendmemory = 0;
+    endlumps = alloca (ENDLUMPS * sizeof(*endlumps));
+    count = 0;
+    if (gamemode == commercial || gamemap != 8)
+	count = WI_ListLumps (gameepisode-1, endlumps, ENDLUMPS);
+    count += F_ListLumps (endlumps+count, ENDLUMPS-count);
+    for (i=0 ; i<count ; i++)
+	R_PrecacheLump (endlumps[i], &levelendmemory);
+
+    W_PrefetchLumps (precachelist, numprecache);
+    free (precachelist);
+    free (precachepresent);
 }
 
 
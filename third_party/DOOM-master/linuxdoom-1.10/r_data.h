@@ -37,9 +37,57 @@ R_GetColumn
 ( int		tex,
   int		col );
 
+// UBO: solid wall and sky columns.  R_GetTextureComposite is all of
+//  the texture's columns, built on first use and kept for at least
+//  the frame: column c starts (c & texturewidthmask) << pitchshift
+//  bytes in, on a cache-line boundary, and is a power of two no
+//  shorter than 128 long, so the drawers' &127 stays inside it.  Its
+//  bytes are the ones the drawers read from R_GetColumn, tutti-frutti
+//  included.  R_GetColumn still hands single patch columns out as the
+//  patch's posts, which masked textures need.
+extern int*	texturewidthmask;
+extern int*	texturepitchshift;
+
+byte* R_GetTextureComposite (int tex);
+byte* R_GetTextureColumn (int tex, int col);
+
+#define R_TEXTURECOLUMN(composite, tex, col) \
+    ((composite) + (((col) & texturewidthmask[tex]) << texturepitchshift[tex]))
+
+// W_CacheLumpNum for lumps the drawers read (safe on render threads).
+void* R_CacheLumpNum (int lump, int tag);
+
+// Composite texture cache: malloced, LRU by framecount, bounded
+//  by compositelimit bytes.  Hits count once per texture per frame.
+extern int		compositelimit;
+extern int		compositebytes;
+extern int		numcomposites;
+extern unsigned		compositehits;
+extern unsigned		compositemisses;	// built in R_GetColumn
+extern unsigned		compositeprebuilt;	// built by the level worker
+extern unsigned		compositeevictions;
+
+// Frees least recently drawn composites over the limit (between frames).
+void R_TrimComposites (void);
+// Joins the level worker and drops every composite.
+void R_FreeComposites (void);
+// Drops the built composites only; they are rebuilt as they are drawn.
+void R_PurgeComposites (void);
+// Unmaps rdatacache and the texture/sprite tables served from it.
+void R_FreeDataCache (void);
+
 
 // I/O, setting up the stuff.
+// rdatacache: path of the startup cache file (NULL disables it).
+extern char*	rdatacache;
 void R_InitData (void);
+
+// Fills colormaps565/palette565 for the palette lut shows.
+void R_SetPalette565 (const unsigned short* lut);
+// colormap with player translation (1..3, MF_TRANSLATION) applied
+//  first, built on first use; NULL unless colormap is a light table
+//  of the COLORMAP lump.  Render threads may call it.
+lighttable_t* R_TranslatedColormap (int translation, lighttable_t* colormap);
 void R_PrecacheLevel (void);
 
 
@@ -52,8 +52,14 @@
 #define SIL_TOP			2
 #define SIL_BOTH		3
 
+// Starting size of the growable drawseg pool (r_bsp.c).
 #define MAXDRAWSEGS		256
 
+// Per-frame refresh state (clip ranges, visplanes, drawsegs, vissprites
+// and the column/span drawer inputs) is thread local, so every render
+// thread (r_main.c) walks the BSP into its own copy.
+#define RTHREAD			__thread
+
 
 
 
@@ -117,6 +123,10 @@ typedef	struct
     // mapblock bounding box for height changes
     int		blockbox[4];
 
+    // UBO: bounding box of the sector's lines, so P_ChangeSector
+    //  can pass over things in the blockbox that can't touch it
+    fixed_t	bbox[4];
+
     // origin for any sounds played by the sector
     degenmobj_t	soundorg;
 
@@ -227,8 +237,8 @@ typedef struct line_s
 typedef struct subsector_s
 {
     sector_t*	sector;
-    short	numlines;
-    short	firstline;
+    int		numlines;
+    int		firstline;
     
 } subsector_t;
 
@@ -261,6 +271,8 @@ typedef struct
 
 //
 // BSP node.
+// One cache line each: the side test, the child to take and the
+//  back child's box are read together on every step down the tree.
 //
 typedef struct
 {
@@ -270,13 +282,13 @@ typedef struct
     fixed_t	dx;
     fixed_t	dy;
 
+    // If NF_SUBSECTOR its a subsector.
+    unsigned	children[2];
+
     // Bounding box for each child.
     fixed_t	bbox[2][4];
-
-    // If NF_SUBSECTOR its a subsector.
-    unsigned short children[2];
     
-} node_t;
+} __attribute__((aligned(64))) node_t;
 
 
 
@@ -313,6 +325,11 @@ typedef post_t	column_t;
 // Could even us emore than 32 levels.
 typedef byte	lighttable_t;	
 
+// UBO: direct565 does it for 16 bits: colormaps565 (r_data.c)
+//  holds the RGB565 colour, stored big-endian, each 8 bit entry
+//  shows as under the current palette.
+typedef unsigned short	lighttable565_t;
+
 
 
 
@@ -405,6 +422,9 @@ typedef struct vissprite_s
     lighttable_t*	colormap;
    
     int			mobjflags;
+
+    // UBO: what the label buffer gets under it (R_LABEL_*)
+    int			label;
     
 } vissprite_t;
 
@@ -464,6 +484,9 @@ typedef struct
   int			lightlevel;
   int			minx;
   int			maxx;
+
+  // next visplane (pool index) in its R_FindPlane hash chain, -1 ends
+  int			next;
   
   // leave pads for [minx-1]/[maxx+1]
   
@@ -29,6 +29,14 @@ rcsid[] = "$Id: r_draw.c,v 1.4 1997/02/03 16:47:55 b1 Exp $";
 
 
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "doomdef.h"
 
 #include "i_system.h"
@@ -83,18 +91,45 @@ byte		translations[3][256];
 // R_DrawColumn
 // Source is the top of the column to scale.
 //
-lighttable_t*		dc_colormap; 
-int			dc_x; 
-int			dc_yl; 
-int			dc_yh; 
-fixed_t			dc_iscale; 
-fixed_t			dc_texturemid;
+RTHREAD lighttable_t*		dc_colormap; 
+RTHREAD int			dc_x; 
+RTHREAD int			dc_yl; 
+RTHREAD int			dc_yh; 
+RTHREAD fixed_t			dc_iscale; 
+RTHREAD fixed_t			dc_texturemid;
 
 // first pixel in a column (possibly virtual) 
-byte*			dc_source;		
+RTHREAD byte*			dc_source;		
 
 // just for profiling 
-int			dccount;
+RTHREAD int			dccount;
+
+//
+// The mapping loop every column drawer below is built from, once
+//  through the light table and once for identitymap: the brightest
+//  level of the id COLORMAP leaves every index as it is, so full
+//  bright sprites and walls lit to level 0 are a plain texel copy.
+// Which loop runs is picked once per column.  source and colormap
+//  are locals because a byte store may alias the dc_* globals, and
+//  the compiler would otherwise reload them for every pixel.
+//
+#define LIT(texel)	colormap[texel]
+#define UNLIT(texel)	(texel)
+
+#define COLUMNLOOP(MAP, STEP)				\
+    do							\
+    {							\
+	*dest = MAP(source[(frac>>FRACBITS)&127]);	\
+	dest += (STEP);					\
+	frac += fracstep;				\
+    } while (count--)
+
+#define MAPCOLUMN(STEP)					\
+    if (colormap == identitymap)			\
+	COLUMNLOOP (UNLIT, STEP);			\
+    else						\
+	COLUMNLOOP (LIT, STEP)
+
 
 //
 // A column is a vertical slice/span from a wall texture that,
@@ -103,10 +138,13 @@ int			dccount;
 // Thus a special case loop for very fast rendering can
 //  be used. It has also been used with Wolfenstein 3D.
 // 
+#ifndef UNROLLCOLUMN
 void R_DrawColumn (void) 
 { 
     int			count; 
     byte*		dest; 
+    byte*		source;
+    lighttable_t*	colormap;
     fixed_t		frac;
     fixed_t		fracstep;	 
  
@@ -135,24 +173,50 @@ void R_DrawColumn (void)
 
     // Inner loop that does the actual texture mapping,
     //  e.g. a DDA-lile scaling.
-    // This is as fast as it gets.
-    do 
-    {
-	// Re-map color indices from wall texture column
-	//  using a lighting/special effects LUT.
-	*dest = dc_colormap[dc_source[(frac>>FRACBITS)&127]];
-	
-	dest += SCREENWIDTH; 
-	frac += fracstep;
-	
-    } while (count--); 
+    // Re-map color indices from wall texture column
+    //  using a lighting/special effects LUT.
+    source = dc_source;
+    colormap = dc_colormap;
+    MAPCOLUMN (SCREENWIDTH);
 } 
 
+#else
+
+// Loop unrolled (build with -DUNROLLCOLUMN).
+// The fraction is kept in the top bits (<<9) so >>25 is the &127
+//  texel index, and the wrap on overflow is harmless for the same
+//  reason.
+#define UNROLLEDLOOP(MAP)						\
+    do									\
+    {									\
+	while (count >= 8)						\
+	{								\
+	    dest[0] = MAP(source[frac>>25]);				\
+	    dest[SCREENWIDTH] = MAP(source[(frac+fracstep)>>25]);	\
+	    dest[SCREENWIDTH*2] = MAP(source[(frac+fracstep2)>>25]);	\
+	    dest[SCREENWIDTH*3] = MAP(source[(frac+fracstep3)>>25]);	\
+									\
+	    frac += fracstep4;						\
+									\
+	    dest[SCREENWIDTH*4] = MAP(source[frac>>25]);		\
+	    dest[SCREENWIDTH*5] = MAP(source[(frac+fracstep)>>25]);	\
+	    dest[SCREENWIDTH*6] = MAP(source[(frac+fracstep2)>>25]);	\
+	    dest[SCREENWIDTH*7] = MAP(source[(frac+fracstep3)>>25]);	\
+									\
+	    frac += fracstep4;						\
+	    dest += SCREENWIDTH*8;					\
+	    count -= 8;							\
+	}								\
+									\
+	while (count > 0)						\
+	{								\
+	    *dest = MAP(source[frac>>25]);				\
+	    dest += SCREENWIDTH;					\
+	    frac += fracstep;						\
+	    count--;							\
+	}								\
+    } while (0)
 
-
-// UNUSED.
-// Loop unrolled.
-#if 0
 void R_DrawColumn (void) 
 { 
     int			count; 
@@ -168,45 +232,161 @@ void R_DrawColumn (void)
  
     count = dc_yh - dc_yl + 1; 
 
+    // Zero length.
+    if (count <= 0)
+	return;
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT) 
+	I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+#endif 
+
     source = dc_source;
     colormap = dc_colormap;		 
     dest = ylookup[dc_yl] + columnofs[dc_x];  
 	 
-    fracstep = dc_iscale<<9; 
-    frac = (dc_texturemid + (dc_yl-centery)*dc_iscale)<<9; 
+    fracstep = (unsigned)dc_iscale<<9; 
+    frac = (unsigned)(dc_texturemid + (dc_yl-centery)*dc_iscale)<<9; 
  
     fracstep2 = fracstep+fracstep;
     fracstep3 = fracstep2+fracstep;
     fracstep4 = fracstep3+fracstep;
 	
-    while (count >= 8) 
-    { 
-	dest[0] = colormap[source[frac>>25]]; 
-	dest[SCREENWIDTH] = colormap[source[(frac+fracstep)>>25]]; 
-	dest[SCREENWIDTH*2] = colormap[source[(frac+fracstep2)>>25]]; 
-	dest[SCREENWIDTH*3] = colormap[source[(frac+fracstep3)>>25]];
-	
-	frac += fracstep4; 
+    if (colormap == identitymap)
+	UNROLLEDLOOP (UNLIT);
+    else
+	UNROLLEDLOOP (LIT);
+}
+#undef UNROLLEDLOOP
+#endif
 
-	dest[SCREENWIDTH*4] = colormap[source[frac>>25]]; 
-	dest[SCREENWIDTH*5] = colormap[source[(frac+fracstep)>>25]]; 
-	dest[SCREENWIDTH*6] = colormap[source[(frac+fracstep2)>>25]]; 
-	dest[SCREENWIDTH*7] = colormap[source[(frac+fracstep3)>>25]]; 
 
-	frac += fracstep4; 
-	dest += SCREENWIDTH*8; 
-	count -= 8;
-    } 
-	
-    while (count > 0)
-    { 
-	*dest = colormap[source[frac>>25]]; 
-	dest += SCREENWIDTH; 
-	frac += fracstep; 
-	count--;
-    } 
+
+//
+// R_DrawColumnQuad
+// Column quads: four neighbouring screen columns are drawn into
+//  quadbuf interleaved (stride 4), so the mapping loop walks one
+//  cache line per four rows instead of touching a new screen row
+//  each pixel.  R_FlushQuad copies the quad out a row at a time,
+//  whole words over the rows all four columns cover.
+// Callers of colfunc flush before anything else can touch the
+//  screen (end of a seg, sky, masked seg range or sprite).
+//
+#define QUADSPANS		32	// posts per column before an early flush
+
+int		colquads;
+
+static RTHREAD byte	quadbuf[MAXHEIGHT*4] __attribute__((aligned(4)));
+static RTHREAD int	quadx = -1;		// first screen column held, -1 = none
+static RTHREAD int	quadnum[4];
+static RTHREAD short	quadspan[4][QUADSPANS][2];
+
+
+void R_FlushQuad (void)
+{
+    int		c;
+    int		s;
+    int		y;
+    int		top;
+    int		bottom;
+    byte*	dest;
+    byte*	src;
+
+    if (quadx < 0)
+	return;
+
+    top = 0;
+    bottom = -1;
+    if (quadnum[0] == 1 && quadnum[1] == 1
+	&& quadnum[2] == 1 && quadnum[3] == 1)
+    {
+	// one post per column: the overlap goes out as words
+	top = quadspan[0][0][0];
+	bottom = quadspan[0][0][1];
+	for (c=1 ; c<4 ; c++)
+	{
+	    if (quadspan[c][0][0] > top)
+		top = quadspan[c][0][0];
+	    if (quadspan[c][0][1] < bottom)
+		bottom = quadspan[c][0][1];
+	}
+
+	for (y=top ; y<=bottom ; y++)
+	    memcpy (ylookup[y] + columnofs[quadx], quadbuf + y*4, 4);
+    }
+
+    if (top > bottom)
+    {
+	top = MAXHEIGHT;
+	bottom = -1;
+    }
+
+    // whatever the word copy did not cover, a byte at a time
+    for (c=0 ; c<4 ; c++)
+    {
+	for (s=0 ; s<quadnum[c] ; s++)
+	{
+	    dest = ylookup[quadspan[c][s][0]] + columnofs[quadx+c];
+	    src = quadbuf + quadspan[c][s][0]*4 + c;
+	    for (y=quadspan[c][s][0] ; y<=quadspan[c][s][1] ; y++)
+	    {
+		if (y < top || y > bottom)
+		    *dest = *src;
+		dest += SCREENWIDTH;
+		src += 4;
+	    }
+	}
+	quadnum[c] = 0;
+    }
+
+    quadx = -1;
 }
-#endif
+
+
+void R_DrawColumnQuad (void) 
+{ 
+    int			count; 
+    int			c;
+    byte*		dest; 
+    byte*		source;
+    lighttable_t*	colormap;
+    fixed_t		frac;
+    fixed_t		fracstep;	 
+ 
+    count = dc_yh - dc_yl; 
+
+    // Zero length, column does not exceed a pixel.
+    if (count < 0) 
+	return; 
+				 
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT) 
+	I_Error ("R_DrawColumnQuad: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+#endif 
+
+    c = dc_x & 3;
+    if (quadx != (dc_x & ~3) || quadnum[c] == QUADSPANS)
+    {
+	R_FlushQuad ();
+	quadx = dc_x & ~3;
+    }
+    quadspan[c][quadnum[c]][0] = dc_yl;
+    quadspan[c][quadnum[c]][1] = dc_yh;
+    quadnum[c]++;
+
+    dest = quadbuf + dc_yl*4 + c;
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    source = dc_source;
+    colormap = dc_colormap;
+    MAPCOLUMN (4);
+} 
 
 
 void R_DrawColumnLow (void) 
@@ -272,7 +452,12 @@ int	fuzzoffset[FUZZTABLE] =
     FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF 
 }; 
 
-int	fuzzpos = 0; 
+RTHREAD int	fuzzpos = 0; 
+
+// fuzzoffset as row directions, repeated past the tallest column:
+//  a column reads its run from fuzzpos on without the wraparound
+//  test, and fuzzpos is advanced once, when the column is done.
+static signed char	fuzzdir[FUZZTABLE+MAXHEIGHT];
 
 
 //
@@ -287,8 +472,8 @@ void R_DrawFuzzColumn (void)
 { 
     int			count; 
     byte*		dest; 
-    fixed_t		frac;
-    fixed_t		fracstep;	 
+    lighttable_t*	map;
+    signed char*	dir;
 
     // Adjust borders. Low... 
     if (!dc_yl) 
@@ -343,28 +528,23 @@ void R_DrawFuzzColumn (void)
     // Does not work with blocky mode.
     dest = ylookup[dc_yl] + columnofs[dc_x];
 
-    // Looks familiar.
-    fracstep = dc_iscale; 
-    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+    dir = fuzzdir + fuzzpos;
+    fuzzpos = (fuzzpos + count + 1) % FUZZTABLE;
 
     // Looks like an attempt at dithering,
     //  using the colormap #6 (of 0-31, a bit
     //  brighter than average).
+    // A pixel read from the row above is the one just written,
+    //  so the rows stay in order.
+    map = colormaps + 6*256;
     do 
     {
 	// Lookup framebuffer, and retrieve
-	//  a pixel that is either one column
-	//  left or right of the current one.
+	//  a pixel that is either one row
+	//  above or below the current one.
 	// Add index from colormap to index.
-	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]]]; 
-
-	// Clamp table lookup index.
-	if (++fuzzpos == FUZZTABLE) 
-	    fuzzpos = 0;
-	
+	*dest = map[dest[*dir++ * SCREENWIDTH]]; 
 	dest += SCREENWIDTH;
-
-	frac += fracstep; 
     } while (count--); 
 } 
  
@@ -380,7 +560,7 @@ void R_DrawFuzzColumn (void)
 //  of the BaronOfHell, the HellKnight, uses
 //  identical sprites, kinda brightened up.
 //
-byte*	dc_translation;
+RTHREAD byte*	dc_translation;
 byte*	translationtables;
 
 void R_DrawTranslatedColumn (void) 
@@ -498,22 +678,22 @@ void R_InitTranslationTables (void)
 // In consequence, flats are not stored by column (like walls),
 //  and the inner loop has to step in texture space u and v.
 //
-int			ds_y; 
-int			ds_x1; 
-int			ds_x2;
+RTHREAD int			ds_y; 
+RTHREAD int			ds_x1; 
+RTHREAD int			ds_x2;
 
-lighttable_t*		ds_colormap; 
+RTHREAD lighttable_t*		ds_colormap; 
 
-fixed_t			ds_xfrac; 
-fixed_t			ds_yfrac; 
-fixed_t			ds_xstep; 
-fixed_t			ds_ystep;
+RTHREAD fixed_t			ds_xfrac; 
+RTHREAD fixed_t			ds_yfrac; 
+RTHREAD fixed_t			ds_xstep; 
+RTHREAD fixed_t			ds_ystep;
 
 // start of a 64*64 tile image 
-byte*			ds_source;	
+RTHREAD byte*			ds_source;	
 
 // just for profiling
-int			dscount;
+RTHREAD int			dscount;
 
 
 //
@@ -638,6 +818,153 @@ void R_DrawSpan (void)
 #endif
 
 
+//
+// VECTOR SPANS
+// R_DrawSpanSimd is R_DrawSpan eight pixels a step.  The u,v
+//  steppers for all eight run in vector lanes and become flat
+//  offsets there; the texel and colormap lookups stay scalar (there
+//  are no gathers in NEON or SSE2) and the eight pixels go out in
+//  one store.  It takes the same fixed point steps as R_DrawSpan,
+//  so it draws the same pixels.  simdspans selects it (high detail).
+//
+int		simdspans;
+
+#ifdef R_SIMDSPANS
+void R_DrawSpanSimd (void) 
+{ 
+    fixed_t		xfrac;
+    fixed_t		yfrac; 
+    byte*		dest; 
+    byte*		source;
+    lighttable_t*	colormap;
+    int			count;
+    int			spot; 
+    unsigned short	spots[8];
+    byte		pixels[8];
+#if defined(__ARM_NEON)
+    int32x4_t		xlo, xhi, ylo, yhi;
+    int32x4_t		xstep8, ystep8;
+    int32x4_t		umask, vmask;
+    int32x4_t		lo, hi;
+#else
+    __m128i		xlo, xhi, ylo, yhi;
+    __m128i		xstep8, ystep8;
+    __m128i		umask, vmask;
+    __m128i		lo, hi;
+#endif
+	 
+#ifdef RANGECHECK 
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH  
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpanSimd: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif 
+
+    xfrac = ds_xfrac; 
+    yfrac = ds_yfrac; 
+    source = ds_source;
+    colormap = ds_colormap;
+	 
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+    count = ds_x2 - ds_x1 + 1; 
+
+    if (count >= 8)
+    {
+	// Lane k steps from frac + k*step, eight steps at a time.
+#if defined(__ARM_NEON)
+	{
+	    static const int32_t	lane[4] = { 0, 1, 2, 3 };
+	    int32x4_t			k = vld1q_s32 (lane);
+
+	    xlo = vmlaq_n_s32 (vdupq_n_s32 (xfrac), k, ds_xstep);
+	    ylo = vmlaq_n_s32 (vdupq_n_s32 (yfrac), k, ds_ystep);
+	    xhi = vaddq_s32 (xlo, vdupq_n_s32 (ds_xstep*4));
+	    yhi = vaddq_s32 (ylo, vdupq_n_s32 (ds_ystep*4));
+	    xstep8 = vdupq_n_s32 (ds_xstep*8);
+	    ystep8 = vdupq_n_s32 (ds_ystep*8);
+	    umask = vdupq_n_s32 (63);
+	    vmask = vdupq_n_s32 (63*64);
+	}
+#else
+	xlo = _mm_set_epi32 (xfrac + ds_xstep*3, xfrac + ds_xstep*2,
+			     xfrac + ds_xstep, xfrac);
+	ylo = _mm_set_epi32 (yfrac + ds_ystep*3, yfrac + ds_ystep*2,
+			     yfrac + ds_ystep, yfrac);
+	xhi = _mm_add_epi32 (xlo, _mm_set1_epi32 (ds_xstep*4));
+	yhi = _mm_add_epi32 (ylo, _mm_set1_epi32 (ds_ystep*4));
+	xstep8 = _mm_set1_epi32 (ds_xstep*8);
+	ystep8 = _mm_set1_epi32 (ds_ystep*8);
+	umask = _mm_set1_epi32 (63);
+	vmask = _mm_set1_epi32 (63*64);
+#endif
+
+	do
+	{
+	    // spot = ((yfrac>>(16-6))&(63*64)) + ((xfrac>>16)&63)
+#if defined(__ARM_NEON)
+	    lo = vaddq_s32 (vandq_s32 (vshrq_n_s32 (ylo, 16-6), vmask),
+			    vandq_s32 (vshrq_n_s32 (xlo, 16), umask));
+	    hi = vaddq_s32 (vandq_s32 (vshrq_n_s32 (yhi, 16-6), vmask),
+			    vandq_s32 (vshrq_n_s32 (xhi, 16), umask));
+	    vst1q_u16 (spots, vcombine_u16 (vmovn_u32 (vreinterpretq_u32_s32 (lo)),
+					    vmovn_u32 (vreinterpretq_u32_s32 (hi))));
+	    xlo = vaddq_s32 (xlo, xstep8);
+	    xhi = vaddq_s32 (xhi, xstep8);
+	    ylo = vaddq_s32 (ylo, ystep8);
+	    yhi = vaddq_s32 (yhi, ystep8);
+#else
+	    lo = _mm_add_epi32 (_mm_and_si128 (_mm_srai_epi32 (ylo, 16-6), vmask),
+				_mm_and_si128 (_mm_srai_epi32 (xlo, 16), umask));
+	    hi = _mm_add_epi32 (_mm_and_si128 (_mm_srai_epi32 (yhi, 16-6), vmask),
+				_mm_and_si128 (_mm_srai_epi32 (xhi, 16), umask));
+	    // Offsets are under 4096, so the signed pack is exact.
+	    _mm_storeu_si128 ((__m128i *)spots, _mm_packs_epi32 (lo, hi));
+	    xlo = _mm_add_epi32 (xlo, xstep8);
+	    xhi = _mm_add_epi32 (xhi, xstep8);
+	    ylo = _mm_add_epi32 (ylo, ystep8);
+	    yhi = _mm_add_epi32 (yhi, ystep8);
+#endif
+
+	    pixels[0] = colormap[source[spots[0]]];
+	    pixels[1] = colormap[source[spots[1]]];
+	    pixels[2] = colormap[source[spots[2]]];
+	    pixels[3] = colormap[source[spots[3]]];
+	    pixels[4] = colormap[source[spots[4]]];
+	    pixels[5] = colormap[source[spots[5]]];
+	    pixels[6] = colormap[source[spots[6]]];
+	    pixels[7] = colormap[source[spots[7]]];
+	    memcpy (dest, pixels, 8);
+
+	    dest += 8;
+	    count -= 8;
+	} while (count >= 8);
+
+	// Lane 0 is where the scalar tail picks up.
+#if defined(__ARM_NEON)
+	xfrac = vgetq_lane_s32 (xlo, 0);
+	yfrac = vgetq_lane_s32 (ylo, 0);
+#else
+	xfrac = _mm_cvtsi128_si32 (xlo);
+	yfrac = _mm_cvtsi128_si32 (ylo);
+#endif
+    }
+
+    while (count--)
+    {
+	spot = ((yfrac>>(16-6))&(63*64)) + ((xfrac>>16)&63);
+	*dest++ = colormap[source[spot]];
+
+	xfrac += ds_xstep; 
+	yfrac += ds_ystep;
+    }
+} 
+#endif
+
+
 //
 // Again..
 //
@@ -664,14 +991,16 @@ void R_DrawSpanLow (void)
     xfrac = ds_xfrac; 
     yfrac = ds_yfrac; 
 
+    // Two pixels per step: count before doubling, or the span
+    //  runs on past ds_x2 (into another render thread's strip).
+    count = ds_x2 - ds_x1; 
+
     // Blocky mode, need to multiply by 2.
     ds_x1 <<= 1;
     ds_x2 <<= 1;
     
     dest = ylookup[ds_y] + columnofs[ds_x1];
   
-    
-    count = ds_x2 - ds_x1; 
     do 
     { 
 	spot = ((yfrac>>(16-6))&(63*64)) + ((xfrac>>16)&63);
@@ -686,6 +1015,398 @@ void R_DrawSpanLow (void)
     } while (count--); 
 }
 
+
+
+//
+// TRANSPOSED VIEW
+// With transview set (high detail only) the 3D view is rendered
+//  into viewtrans column-major: pixel (x,y) is viewtrans[x*TPITCH+y].
+// Column drawers then step one byte per pixel and spans step TPITCH.
+// ylookup/columnofs point into viewtrans, so every caller of
+//  colfunc/spanfunc is unchanged; R_TransposeView copies the view
+//  into screens[0] once the 3D pass is done, before the status bar,
+//  HUD and menus are drawn over it.
+//
+#define TPITCH		SCREENHEIGHT
+
+int		transview;
+
+static byte	viewtrans[SCREENWIDTH*TPITCH];
+
+
+boolean R_ViewTransposed (void)
+{
+    return transview && !detailshift;
+}
+
+
+void R_DrawColumnT (void) 
+{ 
+    int			count; 
+    byte*		dest; 
+    byte*		source;
+    lighttable_t*	colormap;
+    fixed_t		frac;
+    fixed_t		fracstep;	 
+ 
+    count = dc_yh - dc_yl; 
+    if (count < 0) 
+	return; 
+				 
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT) 
+	I_Error ("R_DrawColumnT: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+#endif 
+
+    dest = ylookup[dc_yl] + columnofs[dc_x];  
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    source = dc_source;
+    colormap = dc_colormap;
+    MAPCOLUMN (1);
+} 
+
+
+void R_DrawFuzzColumnT (void) 
+{ 
+    int			count; 
+    byte*		dest; 
+    lighttable_t*	map;
+    signed char*	dir;
+
+    // Adjust borders. Low... 
+    if (!dc_yl) 
+	dc_yl = 1;
+
+    // .. and high.
+    if (dc_yh == viewheight-1) 
+	dc_yh = viewheight - 2; 
+		 
+    count = dc_yh - dc_yl; 
+    if (count < 0) 
+	return; 
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0 || dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ("R_DrawFuzzColumnT: %i to %i at %i",
+		 dc_yl, dc_yh, dc_x);
+    }
+#endif
+
+    dest = ylookup[dc_yl] + columnofs[dc_x];
+
+    dir = fuzzdir + fuzzpos;
+    fuzzpos = (fuzzpos + count + 1) % FUZZTABLE;
+
+    // the pixel above or below is the next or previous byte here
+    map = colormaps + 6*256;
+    do 
+    {
+	*dest = map[dest[*dir++]]; 
+	dest++;
+    } while (count--); 
+} 
+
+
+void R_DrawTranslatedColumnT (void) 
+{ 
+    int			count; 
+    byte*		dest; 
+    fixed_t		frac;
+    fixed_t		fracstep;	 
+ 
+    count = dc_yh - dc_yl; 
+    if (count < 0) 
+	return; 
+				 
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ( "R_DrawTranslatedColumnT: %i to %i at %i",
+		  dc_yl, dc_yh, dc_x);
+    }
+#endif 
+
+    dest = ylookup[dc_yl] + columnofs[dc_x]; 
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    do 
+    {
+	*dest++ = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
+	frac += fracstep; 
+    } while (count--); 
+} 
+
+
+void R_DrawSpanT (void) 
+{ 
+    fixed_t		xfrac;
+    fixed_t		yfrac; 
+    byte*		dest; 
+    int			count;
+    int			spot; 
+	 
+#ifdef RANGECHECK 
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH  
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpanT: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif 
+
+    xfrac = ds_xfrac; 
+    yfrac = ds_yfrac; 
+	 
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+    count = ds_x2 - ds_x1; 
+
+    do 
+    {
+	spot = ((yfrac>>(16-6))&(63*64)) + ((xfrac>>16)&63);
+	*dest = ds_colormap[ds_source[spot]];
+	dest += TPITCH;
+
+	xfrac += ds_xstep; 
+	yfrac += ds_ystep;
+    } while (count--); 
+} 
+
+
+//
+// R_TransposeView
+// viewtrans -> the view window of screens[0], in 8x8 tiles so
+//  both sides stay within a few cache lines per tile.
+//
+void R_TransposeView (void)
+{
+    int		x0;
+    int		y0;
+    int		x;
+    int		y;
+    int		xe;
+    int		ye;
+    byte*	src;
+    byte*	dest;
+
+    for (x0=0 ; x0<viewwidth ; x0+=8)
+    {
+	xe = x0+8 < viewwidth ? x0+8 : viewwidth;
+	for (y0=0 ; y0<viewheight ; y0+=8)
+	{
+	    ye = y0+8 < viewheight ? y0+8 : viewheight;
+	    for (y=y0 ; y<ye ; y++)
+	    {
+		dest = screens[0] + (viewwindowy+y)*SCREENWIDTH + viewwindowx;
+		src = viewtrans + y;
+		for (x=x0 ; x<xe ; x++)
+		    dest[x] = src[x*TPITCH];
+	    }
+	}
+    }
+}
+
+
+
+//
+// DIRECT RGB565 VIEW
+// With view565 set (direct565 on, high detail, not transposed) the
+//  3D view is drawn into screen565 as RGB565, stored big-endian the
+//  way the LCD frame wants it.  Each drawer takes its light table's
+//  twin in colormaps565, which already has the palette applied, so
+//  I_FinishUpdate copies the view window instead of converting it.
+// The stride is SCREENWIDTH and columnofs is shared, so a pixel sits
+//  at the same offset as in screens[0].
+//
+int		direct565;
+boolean		view565;
+
+unsigned short	screen565[SCREENWIDTH*SCREENHEIGHT];
+unsigned short*	ylookup565[MAXHEIGHT];
+
+// The twin in colormaps565 of a table in colormaps.
+#define MAP565(map)	(colormaps565 + ((map) - colormaps))
+
+//
+// R_Darken565
+// The spectre's colormap 6, near enough: each channel to 13/16.
+//
+static inline unsigned short R_Darken565 (unsigned short be)
+{
+    unsigned	v;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap16 (be);
+#else
+    v = be;
+#endif
+    v = ((v>>1)&0x7bef) + ((v>>2)&0x39e7) + ((v>>4)&0x0861);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap16 (v);
+#else
+    return v;
+#endif
+}
+
+
+void R_DrawColumn565 (void) 
+{ 
+    int			count; 
+    unsigned short*	dest; 
+    byte*		source;
+    lighttable565_t*	colormap;
+    fixed_t		frac;
+    fixed_t		fracstep;	 
+ 
+    count = dc_yh - dc_yl; 
+    if (count < 0) 
+	return; 
+				 
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT) 
+	I_Error ("R_DrawColumn565: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+#endif 
+
+    dest = ylookup565[dc_yl] + columnofs[dc_x];  
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    source = dc_source;
+    colormap = MAP565 (dc_colormap);
+    COLUMNLOOP (LIT, SCREENWIDTH);
+} 
+
+
+void R_DrawFuzzColumn565 (void) 
+{ 
+    int			count; 
+    unsigned short*	dest; 
+    signed char*	dir;
+
+    // Adjust borders. Low... 
+    if (!dc_yl) 
+	dc_yl = 1;
+
+    // .. and high.
+    if (dc_yh == viewheight-1) 
+	dc_yh = viewheight - 2; 
+		 
+    count = dc_yh - dc_yl; 
+    if (count < 0) 
+	return; 
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0 || dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ("R_DrawFuzzColumn565: %i to %i at %i",
+		 dc_yl, dc_yh, dc_x);
+    }
+#endif
+
+    dest = ylookup565[dc_yl] + columnofs[dc_x];
+
+    dir = fuzzdir + fuzzpos;
+    fuzzpos = (fuzzpos + count + 1) % FUZZTABLE;
+
+    do 
+    {
+	*dest = R_Darken565 (dest[*dir++ * SCREENWIDTH]); 
+	dest += SCREENWIDTH;
+    } while (count--); 
+} 
+
+
+void R_DrawTranslatedColumn565 (void) 
+{ 
+    int			count; 
+    unsigned short*	dest; 
+    lighttable565_t*	colormap;
+    fixed_t		frac;
+    fixed_t		fracstep;	 
+ 
+    count = dc_yh - dc_yl; 
+    if (count < 0) 
+	return; 
+				 
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ( "R_DrawTranslatedColumn565: %i to %i at %i",
+		  dc_yl, dc_yh, dc_x);
+    }
+#endif 
+
+    dest = ylookup565[dc_yl] + columnofs[dc_x]; 
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    colormap = MAP565 (dc_colormap);
+    do 
+    {
+	*dest = colormap[dc_translation[dc_source[frac>>FRACBITS]]];
+	dest += SCREENWIDTH;
+	frac += fracstep; 
+    } while (count--); 
+} 
+
+
+void R_DrawSpan565 (void) 
+{ 
+    fixed_t		xfrac;
+    fixed_t		yfrac; 
+    unsigned short*	dest; 
+    lighttable565_t*	colormap;
+    int			count;
+    int			spot; 
+	 
+#ifdef RANGECHECK 
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH  
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan565: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif 
+
+    xfrac = ds_xfrac; 
+    yfrac = ds_yfrac; 
+	 
+    dest = ylookup565[ds_y] + columnofs[ds_x1];
+    count = ds_x2 - ds_x1; 
+
+    colormap = MAP565 (ds_colormap);
+    do 
+    {
+	spot = ((yfrac>>(16-6))&(63*64)) + ((xfrac>>16)&63);
+	*dest++ = colormap[ds_source[spot]];
+
+	xfrac += ds_xstep; 
+	yfrac += ds_ystep;
+    } while (count--); 
+} 
+
+
 //
 // R_InitBuffer 
 // Creats lookup tables that avoid
@@ -700,24 +1421,38 @@ R_InitBuffer
 { 
     int		i; 
 
+    for (i=0 ; i<FUZZTABLE+MAXHEIGHT ; i++)
+	fuzzdir[i] = fuzzoffset[i%FUZZTABLE] > 0 ? 1 : -1;
+
     // Handle resize,
     //  e.g. smaller view windows
     //  with border and/or status bar.
-    viewwindowx = (SCREENWIDTH-width) >> 1; 
+    viewwindowx = (screenwidth-width) >> 1; 
 
     // Column offset. For windows.
     for (i=0 ; i<width ; i++) 
 	columnofs[i] = viewwindowx + i;
 
     // Samw with base row offset.
-    if (width == SCREENWIDTH) 
+    if (width == screenwidth) 
 	viewwindowy = 0; 
     else 
-	viewwindowy = (SCREENHEIGHT-SBARHEIGHT-height) >> 1; 
+	viewwindowy = (screenheight-V_SCALEY(SBARHEIGHT)-height) >> 1; 
 
     // Preclaculate all row offsets.
     for (i=0 ; i<height ; i++) 
 	ylookup[i] = screens[0] + (i+viewwindowy)*SCREENWIDTH; 
+    for (i=0 ; i<height ; i++) 
+	ylookup565[i] = screen565 + (i+viewwindowy)*SCREENWIDTH; 
+
+    // the same, into the column-major view buffer
+    if (R_ViewTransposed ())
+    {
+	for (i=0 ; i<width ; i++) 
+	    columnofs[i] = i*TPITCH;
+	for (i=0 ; i<height ; i++) 
+	    ylookup[i] = viewtrans + i;
+    }
 } 
  
  
@@ -735,6 +1470,10 @@ void R_FillBackScreen (void)
     byte*	dest; 
     int		x;
     int		y; 
+    int		vx;
+    int		vy;
+    int		vw;
+    int		vh;
     patch_t*	patch;
 
     // DOOM border patch.
@@ -745,7 +1484,7 @@ void R_FillBackScreen (void)
 
     char*	name;
 	
-    if (scaledviewwidth == 320)
+    if (scaledviewwidth == screenwidth)
 	return;
 	
     if ( gamemode == commercial)
@@ -771,42 +1510,48 @@ void R_FillBackScreen (void)
 	} 
     } 
 	
+    // the border patches are placed in 320x200 coordinates
+    vx = V_UNSCALEX(viewwindowx);
+    vy = V_UNSCALEY(viewwindowy);
+    vw = V_UNSCALEX(scaledviewwidth);
+    vh = V_UNSCALEY(viewheight);
+
     patch = W_CacheLumpName ("brdr_t",PU_CACHE);
 
-    for (x=0 ; x<scaledviewwidth ; x+=8)
-	V_DrawPatch (viewwindowx+x,viewwindowy-8,1,patch);
+    for (x=0 ; x<vw ; x+=8)
+	V_DrawPatch (vx+x,vy-8,1,patch);
     patch = W_CacheLumpName ("brdr_b",PU_CACHE);
 
-    for (x=0 ; x<scaledviewwidth ; x+=8)
-	V_DrawPatch (viewwindowx+x,viewwindowy+viewheight,1,patch);
+    for (x=0 ; x<vw ; x+=8)
+	V_DrawPatch (vx+x,vy+vh,1,patch);
     patch = W_CacheLumpName ("brdr_l",PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
-	V_DrawPatch (viewwindowx-8,viewwindowy+y,1,patch);
+    for (y=0 ; y<vh ; y+=8)
+	V_DrawPatch (vx-8,vy+y,1,patch);
     patch = W_CacheLumpName ("brdr_r",PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
-	V_DrawPatch (viewwindowx+scaledviewwidth,viewwindowy+y,1,patch);
+    for (y=0 ; y<vh ; y+=8)
+	V_DrawPatch (vx+vw,vy+y,1,patch);
 
 
     // Draw beveled edge. 
-    V_DrawPatch (viewwindowx-8,
-		 viewwindowy-8,
+    V_DrawPatch (vx-8,
+		 vy-8,
 		 1,
 		 W_CacheLumpName ("brdr_tl",PU_CACHE));
     
-    V_DrawPatch (viewwindowx+scaledviewwidth,
-		 viewwindowy-8,
+    V_DrawPatch (vx+vw,
+		 vy-8,
 		 1,
 		 W_CacheLumpName ("brdr_tr",PU_CACHE));
     
-    V_DrawPatch (viewwindowx-8,
-		 viewwindowy+viewheight,
+    V_DrawPatch (vx-8,
+		 vy+vh,
 		 1,
 		 W_CacheLumpName ("brdr_bl",PU_CACHE));
     
-    V_DrawPatch (viewwindowx+scaledviewwidth,
-		 viewwindowy+viewheight,
+    V_DrawPatch (vx+vw,
+		 vy+vh,
 		 1,
 		 W_CacheLumpName ("brdr_br",PU_CACHE));
 } 
@@ -848,22 +1593,23 @@ void R_DrawViewBorder (void)
     int		ofs;
     int		i; 
  
-    if (scaledviewwidth == SCREENWIDTH) 
+    if (scaledviewwidth == screenwidth) 
 	return; 
   
-    top = ((SCREENHEIGHT-SBARHEIGHT)-viewheight)/2; 
-    side = (SCREENWIDTH-scaledviewwidth)/2; 
+    top = ((screenheight-V_SCALEY(SBARHEIGHT))-viewheight)/2; 
+    side = (screenwidth-scaledviewwidth)/2; 
  
     // copy top and one line of left side 
     R_VideoErase (0, top*SCREENWIDTH+side); 
  
     // copy one line of right side and bottom 
-    ofs = (viewheight+top)*SCREENWIDTH-side; 
-    R_VideoErase (ofs, top*SCREENWIDTH+side); 
+    //  (and the unused columns right of a smaller picture)
+    ofs = (viewheight+top-1)*SCREENWIDTH+screenwidth-side; 
+    R_VideoErase (ofs, top*SCREENWIDTH+SCREENWIDTH-screenwidth+side); 
  
     // copy sides using wraparound 
-    ofs = top*SCREENWIDTH + SCREENWIDTH-side; 
-    side <<= 1;
+    ofs = top*SCREENWIDTH + screenwidth-side; 
+    side = (side<<1) + SCREENWIDTH-screenwidth;
     
     for (i=1 ; i<viewheight ; i++) 
     { 
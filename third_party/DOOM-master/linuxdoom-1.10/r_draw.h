@@ -29,15 +29,19 @@
 #endif
 
 
-extern lighttable_t*	dc_colormap;
-extern int		dc_x;
-extern int		dc_yl;
-extern int		dc_yh;
-extern fixed_t		dc_iscale;
-extern fixed_t		dc_texturemid;
+extern RTHREAD lighttable_t*	dc_colormap;
+extern RTHREAD int		dc_x;
+extern RTHREAD int		dc_yl;
+extern RTHREAD int		dc_yh;
+extern RTHREAD fixed_t		dc_iscale;
+extern RTHREAD fixed_t		dc_texturemid;
 
 // first pixel in a column
-extern byte*		dc_source;		
+extern RTHREAD byte*		dc_source;		
+
+// Screen address of view row y, column x: ylookup[y] + columnofs[x].
+extern byte*		ylookup[];
+extern int		columnofs[];
 
 
 // The span blitting interface.
@@ -46,6 +50,45 @@ extern byte*		dc_source;
 void 	R_DrawColumn (void);
 void 	R_DrawColumnLow (void);
 
+// Buffered R_DrawColumn for four adjacent columns at a time;
+//  whoever drives colfunc must R_FlushQuad before the screen is
+//  touched any other way.  Used for basecolfunc when colquads is
+//  set and detail is high.
+void	R_DrawColumnQuad (void);
+void	R_FlushQuad (void);
+extern int	colquads;
+
+// R_DrawSpan eight pixels a step with NEON or SSE2, where the build
+//  has either; R_ExecuteSetViewSize picks it when simdspans is set.
+#if defined(__ARM_NEON) || defined(__SSE2__)
+#define R_SIMDSPANS
+void	R_DrawSpanSimd (void);
+#endif
+extern int	simdspans;
+
+// Column-major 3D view (transview, high detail): the T drawers
+//  write viewtrans, R_TransposeView copies it into screens[0].
+void	R_DrawColumnT (void);
+void	R_DrawFuzzColumnT (void);
+void	R_DrawTranslatedColumnT (void);
+void	R_DrawSpanT (void);
+void	R_TransposeView (void);
+boolean	R_ViewTransposed (void);
+extern int	transview;
+
+// Direct RGB565 view (direct565, high detail, not transposed): the
+//  565 drawers write screen565 through colormaps565, and the LCD
+//  frame takes the view window from there.  view565 says this frame
+//  is drawn that way (R_SetView565, once per frame in D_Display).
+void	R_DrawColumn565 (void);
+void	R_DrawFuzzColumn565 (void);
+void	R_DrawTranslatedColumn565 (void);
+void	R_DrawSpan565 (void);
+extern unsigned short	screen565[];
+extern unsigned short*	ylookup565[];
+extern int	direct565;
+extern boolean	view565;
+
 // The Spectre/Invisibility effect.
 void 	R_DrawFuzzColumn (void);
 void 	R_DrawFuzzColumnLow (void);
@@ -61,22 +104,22 @@ R_VideoErase
 ( unsigned	ofs,
   int		count );
 
-extern int		ds_y;
-extern int		ds_x1;
-extern int		ds_x2;
+extern RTHREAD int		ds_y;
+extern RTHREAD int		ds_x1;
+extern RTHREAD int		ds_x2;
 
-extern lighttable_t*	ds_colormap;
+extern RTHREAD lighttable_t*	ds_colormap;
 
-extern fixed_t		ds_xfrac;
-extern fixed_t		ds_yfrac;
-extern fixed_t		ds_xstep;
-extern fixed_t		ds_ystep;
+extern RTHREAD fixed_t		ds_xfrac;
+extern RTHREAD fixed_t		ds_yfrac;
+extern RTHREAD fixed_t		ds_xstep;
+extern RTHREAD fixed_t		ds_ystep;
 
 // start of a 64*64 tile image
-extern byte*		ds_source;		
+extern RTHREAD byte*		ds_source;		
 
 extern byte*		translationtables;
-extern byte*		dc_translation;
+extern RTHREAD byte*		dc_translation;
 
 
 // Span blitting for rows, floor/ceiling.
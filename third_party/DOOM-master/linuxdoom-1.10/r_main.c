@@ -28,18 +28,29 @@ static const char rcsid[] = "$Id: r_main.c,v 1.5 1997/02/03 22:45:12 b1 Exp $";
 
 
 
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 
 #include "doomdef.h"
 #include "d_net.h"
+#include "i_system.h"
 
 #include "m_bbox.h"
+#include "v_video.h"
+#include "doomstat.h"
+#include "p_local.h"
 
 #include "r_local.h"
 #include "r_sky.h"
 
+#include "doom_api.h"
+#include "i_thread.h"
+
 
 
 
@@ -55,8 +66,8 @@ int			viewangleoffset;
 int			validcount = 1;		
 
 
-lighttable_t*		fixedcolormap;
-extern lighttable_t**	walllights;
+RTHREAD lighttable_t*	fixedcolormap;
+extern RTHREAD lighttable_t**	walllights;
 
 int			centerx;
 int			centery;
@@ -68,20 +79,22 @@ fixed_t			projection;
 // just for profiling purposes
 int			framecount;	
 
-int			sscount;
+RTHREAD int			sscount;
 int			linecount;
 int			loopcount;
 
-fixed_t			viewx;
-fixed_t			viewy;
-fixed_t			viewz;
+// The view being drawn, loaded from a render_context_t
+//  by every thread that draws part of it.
+RTHREAD fixed_t		viewx;
+RTHREAD fixed_t		viewy;
+RTHREAD fixed_t		viewz;
 
-angle_t			viewangle;
+RTHREAD angle_t		viewangle;
 
-fixed_t			viewcos;
-fixed_t			viewsin;
+RTHREAD fixed_t		viewcos;
+RTHREAD fixed_t		viewsin;
 
-player_t*		viewplayer;
+RTHREAD player_t*	viewplayer;
 
 // 0 = high, 1 = low
 int			detailshift;	
@@ -95,12 +108,12 @@ angle_t			clipangle;
 // maps the visible view angles to screen X coordinates,
 // flattening the arc to a flat projection plane.
 // There will be many angles mapped to the same X. 
-int			viewangletox[FINEANGLES/2];
+int*			viewangletox;
 
 // The xtoviewangleangle[] table maps a screen pixel
 // to the lowest viewangle that maps back to x ranges
 // from clipangle to -clipangle.
-angle_t			xtoviewangle[SCREENWIDTH+1];
+angle_t*		xtoviewangle;
 
 
 // UNUSED.
@@ -113,16 +126,16 @@ angle_t			xtoviewangle[SCREENWIDTH+1];
 fixed_t*		finecosine = &finesine[FINEANGLES/4];
 
 
-lighttable_t*		scalelight[LIGHTLEVELS][MAXLIGHTSCALE];
-lighttable_t*		scalelightfixed[MAXLIGHTSCALE];
+lighttable_t*		(*scalelight)[MAXLIGHTSCALE];
+RTHREAD lighttable_t*	scalelightfixed[MAXLIGHTSCALE];
 lighttable_t*		zlight[LIGHTLEVELS][MAXLIGHTZ];
 
 // bumped light from gun blasts
-int			extralight;			
+RTHREAD int		extralight;
 
 
 
-void (*colfunc) (void);
+RTHREAD void (*colfunc) (void);
 void (*basecolfunc) (void);
 void (*fuzzcolfunc) (void);
 void (*transcolfunc) (void);
@@ -282,10 +295,63 @@ R_PointOnSegSide
 //  the y (<=x) is scaled and divided by x to get a
 //  tangent (slope) value which is looked up in the
 //  tantoangle[] table.
-
+// The flip is table driven rather than eight branches: the octant
+//  index is (x<0)<<2 | (y<0)<<1 | (|x|<=|y|), and each octant turns
+//  the looked up angle into its own by a base and an optional
+//  negation.  The results are the vanilla ones bit for bit.
 //
 
+static const angle_t octantbase[8] =
+{
+    0,		ANG90-1,	// x>=0, y>=0
+    0,		ANG270,		// x>=0, y<0
+    ANG180-1,	ANG90,		// x<0, y>=0
+    ANG180,	ANG270-1	// x<0, y<0
+};
+
+// all ones where the tantoangle value is subtracted
+static const angle_t octantneg[8] =
+{
+    0,		~0u,
+    ~0u,	0,
+    ~0u,	0,
+    0,		~0u
+};
+
+static inline angle_t R_OctantAngle (fixed_t x, fixed_t y)
+{
+    fixed_t	ax;
+    fixed_t	ay;
+    unsigned	num;
+    unsigned	den;
+    unsigned	slope;
+    angle_t	t;
+    int		steep;
+    int		o;
+
+    if ( (!x) && (!y) )
+	return 0;
+
+    // negated through unsigned, so -MININT wraps as it did
+    ax = x < 0 ? (fixed_t)(0u - (unsigned)x) : x;
+    ay = y < 0 ? (fixed_t)(0u - (unsigned)y) : y;
+    steep = !(ax > ay);
+    o = (x < 0)<<2 | (y < 0)<<1 | steep;
+    num = steep ? ax : ay;
+    den = steep ? ay : ax;
+
+    // SlopeDiv
+    slope = SLOPERANGE;
+    if (den >= 512)
+    {
+	slope = (num<<3)/(den>>8);
+	if (slope > SLOPERANGE)
+	    slope = SLOPERANGE;
+    }
 
+    t = tantoangle[slope];
+    return octantbase[o] + ((t ^ octantneg[o]) - octantneg[o]);
+}
 
 
 angle_t
@@ -293,84 +359,27 @@ R_PointToAngle
 ( fixed_t	x,
   fixed_t	y )
 {	
-    x -= viewx;
-    y -= viewy;
-    
-    if ( (!x) && (!y) )
-	return 0;
+    return R_OctantAngle (x - viewx, y - viewy);
+}
 
-    if (x>= 0)
-    {
-	// x >=0
-	if (y>= 0)
-	{
-	    // y>= 0
-
-	    if (x>y)
-	    {
-		// octant 0
-		return tantoangle[ SlopeDiv(y,x)];
-	    }
-	    else
-	    {
-		// octant 1
-		return ANG90-1-tantoangle[ SlopeDiv(x,y)];
-	    }
-	}
-	else
-	{
-	    // y<0
-	    y = -y;
-
-	    if (x>y)
-	    {
-		// octant 8
-		return -tantoangle[SlopeDiv(y,x)];
-	    }
-	    else
-	    {
-		// octant 7
-		return ANG270+tantoangle[ SlopeDiv(x,y)];
-	    }
-	}
-    }
-    else
-    {
-	// x<0
-	x = -x;
 
-	if (y>= 0)
-	{
-	    // y>= 0
-	    if (x>y)
-	    {
-		// octant 3
-		return ANG180-1-tantoangle[ SlopeDiv(y,x)];
-	    }
-	    else
-	    {
-		// octant 2
-		return ANG90+ tantoangle[ SlopeDiv(x,y)];
-	    }
-	}
-	else
-	{
-	    // y<0
-	    y = -y;
-
-	    if (x>y)
-	    {
-		// octant 4
-		return ANG180+tantoangle[ SlopeDiv(y,x)];
-	    }
-	    else
-	    {
-		 // octant 5
-		return ANG270-1-tantoangle[ SlopeDiv(x,y)];
-	    }
-	}
-    }
-    return 0;
+//
+// R_PointToAngles
+// R_PointToAngle for count points at once.
+//
+void
+R_PointToAngles
+( const fixed_t*	x,
+  const fixed_t*	y,
+  angle_t*		angles,
+  int			count )
+{
+    fixed_t	vx = viewx;
+    fixed_t	vy = viewy;
+    int		i;
+
+    for (i=0 ; i<count ; i++)
+	angles[i] = R_OctantAngle (x[i] - vx, y[i] - vy);
 }
 
 
@@ -538,14 +547,45 @@ void R_InitTables (void)
 
 
 
+//
+// VIEW SIZE TABLES
+// UBO: the quality governor changes the detail level and the view
+//  size while playing.  The projection, plane and light tables of
+//  each size are built once into a viewtables_t and kept, so
+//  R_ExecuteSetViewSize only points viewangletox, xtoviewangle,
+//  yslope, distscale and scalelight at them.  Only the dimensions
+//  pick the tables; R_InitViewTables drops them all when a new
+//  R_Init brings new colormaps or a new screen size.
+//
+#define NUMVIEWSIZES	18		// setblocks 3-11 at both detail levels
+
+typedef struct
+{
+    int			width;		// viewwidth
+    int			height;		// viewheight
+    int			detail;		// detailshift
+    angle_t		clipangle;
+    int			viewangletox[FINEANGLES/2];
+    angle_t		xtoviewangle[SCREENWIDTH+1];
+    fixed_t		yslope[SCREENHEIGHT];
+    fixed_t		distscale[SCREENWIDTH];
+    lighttable_t*	scalelight[LIGHTLEVELS][MAXLIGHTSCALE];
+} viewtables_t;
+
+static viewtables_t	viewtables[NUMVIEWSIZES];
+static int		numviewtables;
+
+
 //
 // R_InitTextureMapping
 //
-void R_InitTextureMapping (void)
+static void R_InitTextureMapping (viewtables_t* vt)
 {
     int			i;
     int			x;
     int			t;
+    int			width = vt->width;
+    fixed_t		centerxfrac = (width/2)<<FRACBITS;
     fixed_t		focallength;
     
     // Use tangent table to generate viewangletox:
@@ -562,7 +602,7 @@ void R_InitTextureMapping (void)
 	if (finetangent[i] > FRACUNIT*2)
 	    t = -1;
 	else if (finetangent[i] < -FRACUNIT*2)
-	    t = viewwidth+1;
+	    t = width+1;
 	else
 	{
 	    t = FixedMul (finetangent[i], focallength);
@@ -570,36 +610,35 @@ void R_InitTextureMapping (void)
 
 	    if (t < -1)
 		t = -1;
-	    else if (t>viewwidth+1)
-		t = viewwidth+1;
+	    else if (t>width+1)
+		t = width+1;
 	}
-	viewangletox[i] = t;
+	vt->viewangletox[i] = t;
     }
     
     // Scan viewangletox[] to generate xtoviewangle[]:
     //  xtoviewangle will give the smallest view angle
     //  that maps to x.	
-    for (x=0;x<=viewwidth;x++)
+    // UBO: viewangletox[] never increases, so walking x down lets
+    //  one scan carry i instead of restarting at 0 for every column.
+    i = 0;
+    for (x=width;x>=0;x--)
     {
-	i = 0;
-	while (viewangletox[i]>x)
+	while (vt->viewangletox[i]>x)
 	    i++;
-	xtoviewangle[x] = (i<<ANGLETOFINESHIFT)-ANG90;
+	vt->xtoviewangle[x] = (i<<ANGLETOFINESHIFT)-ANG90;
     }
     
     // Take out the fencepost cases from viewangletox.
     for (i=0 ; i<FINEANGLES/2 ; i++)
     {
-	t = FixedMul (finetangent[i], focallength);
-	t = centerx - t;
-	
-	if (viewangletox[i] == -1)
-	    viewangletox[i] = 0;
-	else if (viewangletox[i] == viewwidth+1)
-	    viewangletox[i]  = viewwidth;
+	if (vt->viewangletox[i] == -1)
+	    vt->viewangletox[i] = 0;
+	else if (vt->viewangletox[i] == width+1)
+	    vt->viewangletox[i]  = width;
     }
 	
-    clipangle = xtoviewangle[0];
+    vt->clipangle = vt->xtoviewangle[0];
 }
 
 
@@ -615,20 +654,54 @@ void R_InitLightTables (void)
 {
     int		i;
     int		j;
+    
+    // The light levels to use for each level / distance
+    //  combination are constant, see tables.c.
+    for (i=0 ; i< LIGHTLEVELS ; i++)
+	for (j=0 ; j<MAXLIGHTZ ; j++)
+	    zlight[i][j] = colormaps + zlightlevels[i][j]*256;
+}
+
+
+
+//
+// R_BuildViewTables
+// The plane and light tables of vt's view size, and its texture
+//  mapping.
+//
+static void R_BuildViewTables (viewtables_t* vt)
+{
+    fixed_t	cosadj;
+    fixed_t	dy;
+    int		i;
+    int		j;
     int		level;
     int		startmap; 	
-    int		scale;
+
+    R_InitTextureMapping (vt);
+
+    // planes
+    for (i=0 ; i<vt->height ; i++)
+    {
+	dy = ((i-vt->height/2)<<FRACBITS)+FRACUNIT/2;
+	dy = abs(dy);
+	vt->yslope[i] = FixedDiv ( (vt->width<<vt->detail)/2*FRACUNIT, dy);
+    }
+	
+    for (i=0 ; i<vt->width ; i++)
+    {
+	cosadj = abs(finecosine[vt->xtoviewangle[i]>>ANGLETOFINESHIFT]);
+	vt->distscale[i] = FixedDiv (FRACUNIT,cosadj);
+    }
     
     // Calculate the light levels to use
-    //  for each level / distance combination.
+    //  for each level / scale combination.
     for (i=0 ; i< LIGHTLEVELS ; i++)
     {
 	startmap = ((LIGHTLEVELS-1-i)*2)*NUMCOLORMAPS/LIGHTLEVELS;
-	for (j=0 ; j<MAXLIGHTZ ; j++)
+	for (j=0 ; j<MAXLIGHTSCALE ; j++)
 	{
-	    scale = FixedDiv ((SCREENWIDTH/2*FRACUNIT), (j+1)<<LIGHTZSHIFT);
-	    scale >>= LIGHTSCALESHIFT;
-	    level = startmap - scale/DISTMAP;
+	    level = startmap - j*SCREENWIDTH/(vt->width<<vt->detail)/DISTMAP;
 	    
 	    if (level < 0)
 		level = 0;
@@ -636,12 +709,93 @@ void R_InitLightTables (void)
 	    if (level >= NUMCOLORMAPS)
 		level = NUMCOLORMAPS-1;
 
-	    zlight[i][j] = colormaps + level*256;
+	    vt->scalelight[i][j] = colormaps + level*256;
 	}
     }
 }
 
 
+//
+// R_ViewTables
+// The tables for a width x height view at detail, built the first
+//  time that size is asked for.
+//
+static viewtables_t* R_ViewTables (int width, int height, int detail)
+{
+    viewtables_t*	vt;
+    int			i;
+
+    for (i=0 ; i<numviewtables ; i++)
+    {
+	vt = &viewtables[i];
+	if (vt->width == width && vt->height == height && vt->detail == detail)
+	    return vt;
+    }
+
+    // only a screen size change without an R_Init fills every slot
+    if (numviewtables == NUMVIEWSIZES)
+	numviewtables = 0;
+    vt = &viewtables[numviewtables++];
+    vt->width = width;
+    vt->height = height;
+    vt->detail = detail;
+    R_BuildViewTables (vt);
+    return vt;
+}
+
+
+//
+// R_ViewDimensions
+// The scaled view width and the height setblocks blocks make.
+//
+static void
+R_ViewDimensions
+( int		blocks,
+  int*		width,
+  int*		height )
+{
+    // the window is sized in 320x200 pixels, then scaled
+    //  to the picture when that is smaller
+    if (blocks == 11)
+    {
+	*width = screenwidth;
+	*height = screenheight;
+    }
+    else
+    {
+	*width = V_SCALEX(blocks*32);
+	*height = V_SCALEY((blocks*168/10)&~7);
+    }
+}
+
+
+//
+// R_InitViewTables
+// Drops the tables of the last R_Init, then builds the ones of the
+//  view size in the config and of the sizes the quality governor
+//  steps down to from it (low detail, then two blocks smaller, see
+//  i_governor.h), so its first changes don't build any.
+//
+static void R_InitViewTables (int blocks, int detail)
+{
+    int		smaller;
+    int		width;
+    int		height;
+
+    numviewtables = 0;
+
+    R_ViewDimensions (blocks, &width, &height);
+    R_ViewTables (width>>detail, height, detail);
+    R_ViewTables (width>>1, height, 1);
+
+    smaller = (blocks > 10 ? 10 : blocks) - 2;
+    if (smaller < 3)
+	smaller = 3;
+    R_ViewDimensions (smaller, &width, &height);
+    R_ViewTables (width>>1, height, 1);
+}
+
+
 
 //
 // R_SetViewSize
@@ -666,45 +820,36 @@ R_SetViewSize
 
 
 //
-// R_ExecuteSetViewSize
+// R_SelectDrawers
+// The column and span drawers for the detail level, the view
+//  buffer and view565.
 //
-void R_ExecuteSetViewSize (void)
+static void R_SelectDrawers (void)
 {
-    fixed_t	cosadj;
-    fixed_t	dy;
-    int		i;
-    int		j;
-    int		level;
-    int		startmap; 	
-
-    setsizeneeded = false;
-
-    if (setblocks == 11)
+    if (view565)
     {
-	scaledviewwidth = SCREENWIDTH;
-	viewheight = SCREENHEIGHT;
+	colfunc = basecolfunc = R_DrawColumn565;
+	fuzzcolfunc = R_DrawFuzzColumn565;
+	transcolfunc = R_DrawTranslatedColumn565;
+	spanfunc = R_DrawSpan565;
     }
-    else
+    else if (R_ViewTransposed ())
     {
-	scaledviewwidth = setblocks*32;
-	viewheight = (setblocks*168/10)&~7;
+	colfunc = basecolfunc = R_DrawColumnT;
+	fuzzcolfunc = R_DrawFuzzColumnT;
+	transcolfunc = R_DrawTranslatedColumnT;
+	spanfunc = R_DrawSpanT;
     }
-    
-    detailshift = setdetail;
-    viewwidth = scaledviewwidth>>detailshift;
-	
-    centery = viewheight/2;
-    centerx = viewwidth/2;
-    centerxfrac = centerx<<FRACBITS;
-    centeryfrac = centery<<FRACBITS;
-    projection = centerxfrac;
-
-    if (!detailshift)
+    else if (!detailshift)
     {
-	colfunc = basecolfunc = R_DrawColumn;
+	colfunc = basecolfunc = colquads ? R_DrawColumnQuad : R_DrawColumn;
 	fuzzcolfunc = R_DrawFuzzColumn;
 	transcolfunc = R_DrawTranslatedColumn;
 	spanfunc = R_DrawSpan;
+#ifdef R_SIMDSPANS
+	if (simdspans)
+	    spanfunc = R_DrawSpanSimd;
+#endif
     }
     else
     {
@@ -713,10 +858,60 @@ void R_ExecuteSetViewSize (void)
 	transcolfunc = R_DrawTranslatedColumn;
 	spanfunc = R_DrawSpanLow;
     }
+}
+
+
+//
+// R_SetView565
+// Called by D_Display before each frame; on draws this frame's
+//  view into screen565 when the detail level and buffer allow.
+//
+void R_SetView565 (boolean on)
+{
+    on = on && direct565 && !detailshift && !R_ViewTransposed ();
+    if (on == view565)
+	return;
+    view565 = on;
+    R_SelectDrawers ();
+}
+
+
+//
+// R_ExecuteSetViewSize
+//
+void R_ExecuteSetViewSize (void)
+{
+    viewtables_t*	vt;
+    int			i;
+
+    setsizeneeded = false;
+
+    R_ViewDimensions (setblocks, &scaledviewwidth, &viewheight);
+    
+    detailshift = setdetail;
+    viewwidth = scaledviewwidth>>detailshift;
+	
+    centery = viewheight/2;
+    centerx = viewwidth/2;
+    centerxfrac = centerx<<FRACBITS;
+    centeryfrac = centery<<FRACBITS;
+    projection = centerxfrac;
+
+    if (detailshift || R_ViewTransposed ())
+	view565 = false;
+    R_SelectDrawers ();
 
     R_InitBuffer (scaledviewwidth, viewheight);
 	
-    R_InitTextureMapping ();
+    // UBO: the texture mapping, plane and light tables are the
+    //  size's cached ones, see R_ViewTables.
+    vt = R_ViewTables (viewwidth, viewheight, detailshift);
+    viewangletox = vt->viewangletox;
+    xtoviewangle = vt->xtoviewangle;
+    clipangle = vt->clipangle;
+    yslope = vt->yslope;
+    distscale = vt->distscale;
+    scalelight = vt->scalelight;
     
     // psprite scales
     pspritescale = FRACUNIT*viewwidth/SCREENWIDTH;
@@ -725,39 +920,280 @@ void R_ExecuteSetViewSize (void)
     // thing clipping
     for (i=0 ; i<viewwidth ; i++)
 	screenheightarray[i] = viewheight;
+}
+
+
+
+//
+// RENDER THREADS
+// The engine thread draws strip 0 and the workers the others, all
+//  from the render_context_t R_RenderView was handed.  rframe/rpending under
+//  rlock hand a frame out: workers wait for rframe to move on, draw
+//  their strip and count rpending down to the engine thread.
+//
+int			renderthreads = 1;
+int			numrenderthreads = 1;
+
+RTHREAD int		rstripx1;
+RTHREAD int		rstripx2;
+RTHREAD int*		rsectorstamp;
+
+static int		rstripx[MAXRENDERTHREADS+1];
+static int		rstripfailed[MAXRENDERTHREADS];
+static int*		rsectorstamps[MAXRENDERTHREADS];
+static int		rnumstamps;
+
+static pthread_t	rthreads[MAXRENDERTHREADS];
+static pthread_mutex_t	rlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	rstartcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	rdonecond = PTHREAD_COND_INITIALIZER;
+static unsigned		rframe;
+static int		rpending;
+static boolean		rquit;
+static render_context_t*	rcontext;	// the view being drawn
+
+
+//
+// R_NotePeak
+// Keeps the largest count any strip has reported.
+//
+static void R_NotePeak (int* peak, int count)
+{
+    int		seen;
+
+    seen = __atomic_load_n (peak, __ATOMIC_RELAXED);
+    while (count > seen
+	   && !__atomic_compare_exchange_n (peak, &seen, count, 0,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+	;
+}
+
+
+//
+// R_RenderStrip
+// Draws view columns rstripx[strip] to rstripx[strip+1]-1 into
+//  the calling thread's own clip, plane, drawseg and sprite state.
+//  Only the engine thread (strip 0) checks for commands and profiles.
+//
+static void R_RenderStrip (int strip)
+{
+    rstripx1 = rstripx[strip];
+    rstripx2 = rstripx[strip+1]-1;
+    rsectorstamp = rsectorstamps[strip];
+
+    R_LoadContext (rcontext);
+    colfunc = basecolfunc;
+
+    // Clear buffers.
+    R_ClearClipSegs ();
+    R_ClearDrawSegs ();
+    R_ClearPlanes ();
+    R_ClearSprites ();
     
-    // planes
-    for (i=0 ; i<viewheight ; i++)
+    // check for new console commands.
+    if (!strip)
+	NetUpdate ();
+
+    // The head node is the last node output.
+    if (!strip)
+	UBO_PROF_BEGIN(UBO_PROF_BSP);
+    R_RenderBSPNode (numnodes-1);
+    if (!strip)
+	UBO_PROF_END(UBO_PROF_BSP);
+    
+    // Check for new console commands.
+    if (!strip)
+	NetUpdate ();
+    
+    if (!strip)
+	UBO_PROF_BEGIN(UBO_PROF_PLANES);
+    R_DrawPlanes ();
+    if (!strip)
+	UBO_PROF_END(UBO_PROF_PLANES);
+    
+    // Check for new console commands.
+    if (!strip)
+	NetUpdate ();
+    
+    if (!strip)
+	UBO_PROF_BEGIN(UBO_PROF_MASKED);
+    R_DrawMasked ();
+    if (!strip)
+	UBO_PROF_END(UBO_PROF_MASKED);
+
+    R_NotePeak (&visplanepeak, lastvisplane - visplanes);
+    R_NotePeak (&drawsegpeak, ds_p - drawsegs);
+    R_NotePeak (&visspritepeak, vissprite_p - vissprites);
+}
+
+
+static void* R_RenderThread (void* arg)
+{
+    int		strip = (int)(intptr_t)arg;
+    unsigned	frame = 0;
+    boolean	quit;
+    jmp_buf	errorjmp;
+
+    for (;;)
     {
-	dy = ((i-viewheight/2)<<FRACBITS)+FRACUNIT/2;
-	dy = abs(dy);
-	yslope[i] = FixedDiv ( (viewwidth<<detailshift)/2*FRACUNIT, dy);
+	pthread_mutex_lock (&rlock);
+	while (rframe == frame && !rquit)
+	    pthread_cond_wait (&rstartcond, &rlock);
+	frame = rframe;
+	quit = rquit;
+	pthread_mutex_unlock (&rlock);
+	if (quit)
+	    break;
+	I_ThreadPoll (UBO_THREAD_RENDER);
+
+	// An I_Error in here fails the frame on the engine thread.
+	i_errorjmp = &errorjmp;
+	if (!setjmp (errorjmp))
+	    R_RenderStrip (strip);
+	else
+	    rstripfailed[strip] = 1;
+	i_errorjmp = NULL;
+
+	pthread_mutex_lock (&rlock);
+	if (--rpending == 0)
+	    pthread_cond_signal (&rdonecond);
+	pthread_mutex_unlock (&rlock);
     }
-	
-    for (i=0 ; i<viewwidth ; i++)
+
+    R_FreePlanes ();
+    R_FreeDrawSegs ();
+    R_FreeSprites ();
+    return NULL;
+}
+
+
+//
+// R_RenderThreadedView
+// Splits the view into numrenderthreads strips and waits for all
+//  of them, so the frame is complete before I_FinishUpdate.
+//
+static void R_RenderThreadedView (void)
+{
+    jmp_buf	errorjmp;
+    int*	stamps;
+    int		failed;
+    int		i;
+
+    // Strips start on 8 column boundaries, so a column quad
+    //  never straddles two threads.
+    for (i=1 ; i<numrenderthreads ; i++)
     {
-	cosadj = abs(finecosine[xtoviewangle[i]>>ANGLETOFINESHIFT]);
-	distscale[i] = FixedDiv (FRACUNIT,cosadj);
+	rstripx[i] = (viewwidth*i/numrenderthreads + 4) & ~7;
+	if (rstripx[i] > viewwidth)
+	    rstripx[i] = viewwidth;
     }
-    
-    // Calculate the light levels to use
-    //  for each level / scale combination.
-    for (i=0 ; i< LIGHTLEVELS ; i++)
+    rstripx[numrenderthreads] = viewwidth;
+
+    if (numsectors > rnumstamps)
     {
-	startmap = ((LIGHTLEVELS-1-i)*2)*NUMCOLORMAPS/LIGHTLEVELS;
-	for (j=0 ; j<MAXLIGHTSCALE ; j++)
+	for (i=0 ; i<numrenderthreads ; i++)
 	{
-	    level = startmap - j*SCREENWIDTH/(viewwidth<<detailshift)/DISTMAP;
-	    
-	    if (level < 0)
-		level = 0;
+	    stamps = realloc (rsectorstamps[i], numsectors*sizeof(*stamps));
+	    if (!stamps)
+		I_Error ("R_RenderThreadedView: no memory for %i sectors",
+			 numsectors);
+	    memset (stamps+rnumstamps, 0,
+		    (numsectors-rnumstamps)*sizeof(*stamps));
+	    rsectorstamps[i] = stamps;
+	}
+	rnumstamps = numsectors;
+    }
 
-	    if (level >= NUMCOLORMAPS)
-		level = NUMCOLORMAPS-1;
+    pthread_mutex_lock (&rlock);
+    rpending = numrenderthreads-1;
+    rframe++;
+    pthread_cond_broadcast (&rstartcond);
+    pthread_mutex_unlock (&rlock);
+
+    i_errorjmp = &errorjmp;
+    if (!setjmp (errorjmp))
+	R_RenderStrip (0);
+    else
+	rstripfailed[0] = 1;
+    i_errorjmp = NULL;
+
+    pthread_mutex_lock (&rlock);
+    while (rpending)
+	pthread_cond_wait (&rdonecond, &rlock);
+    pthread_mutex_unlock (&rlock);
+
+    failed = -1;
+    for (i=0 ; i<numrenderthreads ; i++)
+    {
+	if (rstripfailed[i] && failed < 0)
+	    failed = i;
+	rstripfailed[i] = 0;
+    }
+    if (failed >= 0)
+	I_Error ("R_RenderPlayerView: strip %i failed", failed);
+}
 
-	    scalelight[i][j] = colormaps + level*256;
+
+//
+// R_InitRenderThreads
+// Starts renderthreads-1 workers (none when it is 1).  Called again
+//  by a restarted engine, which keeps a pool of the right size.
+//
+static void R_InitRenderThreads (void)
+{
+    int		count = renderthreads;
+    int		i;
+
+    if (count > MAXRENDERTHREADS)
+	count = MAXRENDERTHREADS;
+    if (count < 1)
+	count = 1;
+    if (count == numrenderthreads)
+	return;
+
+    R_ShutdownRenderThreads ();
+    rquit = false;
+    rframe = 0;
+    for (i=1 ; i<count ; i++)
+    {
+	if (pthread_create (&rthreads[i], NULL, R_RenderThread,
+			    (void *)(intptr_t)i) != 0)
+	{
+	    fprintf (stderr, "[doom] R_Init: render thread %d failed to start\n", i);
+	    break;
 	}
+	numrenderthreads = i+1;
     }
+    fprintf (stderr, "[doom] R_Init: %d render threads\n", numrenderthreads);
+}
+
+
+//
+// R_ShutdownRenderThreads
+//
+void R_ShutdownRenderThreads (void)
+{
+    int		i;
+
+    if (numrenderthreads > 1)
+    {
+	pthread_mutex_lock (&rlock);
+	rquit = true;
+	pthread_cond_broadcast (&rstartcond);
+	pthread_mutex_unlock (&rlock);
+
+	for (i=1 ; i<numrenderthreads ; i++)
+	    pthread_join (rthreads[i], NULL);
+    }
+    numrenderthreads = 1;
+
+    for (i=0 ; i<MAXRENDERTHREADS ; i++)
+    {
+	free (rsectorstamps[i]);
+	rsectorstamps[i] = NULL;
+    }
+    rnumstamps = 0;
 }
 
 
@@ -770,10 +1206,9 @@ extern int	screenblocks;
 
 
 
+// UBO: R_InitData comes first, as an init phase of its own (D_InitPhase).
 void R_Init (void)
 {
-    R_InitData ();
-    printf ("\nR_InitData");
     R_InitPointToAngle ();
     printf ("\nR_InitPointToAngle");
     R_InitTables ();
@@ -784,11 +1219,13 @@ void R_Init (void)
     R_InitPlanes ();
     printf ("\nR_InitPlanes");
     R_InitLightTables ();
+    R_InitViewTables (screenblocks, detailLevel);
     printf ("\nR_InitLightTables");
     R_InitSkyMap ();
     printf ("\nR_InitSkyMap");
     R_InitTranslationTables ();
     printf ("\nR_InitTranslationsTables");
+    R_InitRenderThreads ();
 	
     framecount = 0;
 }
@@ -825,73 +1262,182 @@ R_PointInSubsector
 
 
 //
-// R_SetupFrame
+// Interpolation between tics (UBO_DOOM_INTERPOLATE).  Things keep the
+//  position they had at the start of the tic in oldx/oldy/oldz; the
+//  view height, which only the player code moves, is kept here.
 //
-void R_SetupFrame (player_t* player)
-{		
+int		interpolation = 1;
+fixed_t		interpfrac = FRACUNIT;
+
+static fixed_t	oldviewz[MAXPLAYERS];
+
+// Further than anything walks in a tic: a teleport, drawn where it ends.
+#define MAXINTERPMOVE	(128*FRACUNIT)
+
+void R_SaveInterpolation (void)
+{
+    thinker_t*	th;
+    mobj_t*	mo;
     int		i;
-    
-    viewplayer = player;
-    viewx = player->mo->x;
-    viewy = player->mo->y;
-    viewangle = player->mo->angle + viewangleoffset;
-    extralight = player->extralight;
 
-    viewz = player->viewz;
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+	    continue;
+	mo = (mobj_t *)th;
+	mo->oldx = mo->x;
+	mo->oldy = mo->y;
+	mo->oldz = mo->z;
+	mo->oldangle = mo->angle;
+    }
+    for (i=0 ; i<MAXPLAYERS ; i++)
+	oldviewz[i] = players[i].viewz;
+}
+
+//
+// R_InterpolateMobj
+// Where to draw a thing interpfrac of the way through the last tic.
+//  False if it is drawn where it is (no frame between tics, teleport).
+//
+boolean R_InterpolateMobj (const mobj_t* mo, fixed_t* x, fixed_t* y, fixed_t* z)
+{
+    fixed_t	dx = mo->x - mo->oldx;
+    fixed_t	dy = mo->y - mo->oldy;
+
+    if (interpfrac == FRACUNIT
+	|| abs(dx) > MAXINTERPMOVE || abs(dy) > MAXINTERPMOVE)
+    {
+	*x = mo->x;
+	*y = mo->y;
+	*z = mo->z;
+	return false;
+    }
+    *x = mo->oldx + FixedMul (dx, interpfrac);
+    *y = mo->oldy + FixedMul (dy, interpfrac);
+    *z = mo->oldz + FixedMul (mo->z - mo->oldz, interpfrac);
+    return true;
+}
+
+
+//
+// R_SetupContext
+//
+void R_SetupContext (render_context_t* ctx, player_t* player)
+{
+    mobj_t*	mo = player->mo;
+
+    ctx->viewplayer = player;
+    ctx->viewx = mo->x;
+    ctx->viewy = mo->y;
+    ctx->viewangle = mo->angle + viewangleoffset;
+    ctx->extralight = player->extralight;
+
+    ctx->viewz = player->viewz;
+
+    {
+	fixed_t	z;
+	fixed_t	oldz = oldviewz[player-players];
+
+	if (R_InterpolateMobj (mo, &ctx->viewx, &ctx->viewy, &z))
+	{
+	    ctx->viewangle = mo->oldangle + viewangleoffset
+		+ FixedMul ((int)(mo->angle - mo->oldangle), interpfrac);
+	    ctx->viewz = oldz + FixedMul (player->viewz - oldz, interpfrac);
+	}
+    }
     
-    viewsin = finesine[viewangle>>ANGLETOFINESHIFT];
-    viewcos = finecosine[viewangle>>ANGLETOFINESHIFT];
-	
-    sscount = 0;
+    ctx->viewsin = finesine[ctx->viewangle>>ANGLETOFINESHIFT];
+    ctx->viewcos = finecosine[ctx->viewangle>>ANGLETOFINESHIFT];
 	
     if (player->fixedcolormap)
-    {
-	fixedcolormap =
+	ctx->fixedcolormap =
 	    colormaps
 	    + player->fixedcolormap*256*sizeof(lighttable_t);
+    else
+	ctx->fixedcolormap = 0;
+}
+
+
+//
+// R_LoadContext
+//
+void R_LoadContext (render_context_t* ctx)
+{		
+    int		i;
+    
+    viewplayer = ctx->viewplayer;
+    viewx = ctx->viewx;
+    viewy = ctx->viewy;
+    viewz = ctx->viewz;
+    viewangle = ctx->viewangle;
+    viewsin = ctx->viewsin;
+    viewcos = ctx->viewcos;
+    extralight = ctx->extralight;
+    fixedcolormap = ctx->fixedcolormap;
 	
+    sscount = 0;
+	
+    if (fixedcolormap)
+    {
 	walllights = scalelightfixed;
 
 	for (i=0 ; i<MAXLIGHTSCALE ; i++)
 	    scalelightfixed[i] = fixedcolormap;
     }
-    else
-	fixedcolormap = 0;
+}
+
+
+
+//
+// R_RenderView
+//
+void R_RenderView (render_context_t* ctx)
+{
+    int		i;
+
+    rcontext = ctx;
+
+    // nothing is drawing yet, so composites can go
+    R_TrimComposites ();
+    R_UpdateSkyCache ();
 		
     framecount++;
     validcount++;
-}
 
+    // UBO: doom_set_aux_buffers
+    if (rdepth)
+	memset (rdepth, 0, viewwidth*sizeof(*rdepth));
+    if (rlabels)
+	for (i=0 ; i<viewheight ; i++)
+	    memset (rlabels + i*SCREENWIDTH, R_LABEL_NONE, viewwidth);
+
+    // every strip's things projected at once (R_PointToAngles
+    //  measures from the loaded view)
+    R_LoadContext (ctx);
+    R_ProjectThings (ctx);
+
+    if (numrenderthreads > 1)
+	R_RenderThreadedView ();
+    else
+    {
+	rstripx[1] = viewwidth;
+	R_RenderStrip (0);
+    }
+
+    if (R_ViewTransposed ())
+	R_TransposeView ();
+}
 
 
 //
-// R_RenderView
+// R_RenderPlayerView
 //
 void R_RenderPlayerView (player_t* player)
 {	
-    R_SetupFrame (player);
-
-    // Clear buffers.
-    R_ClearClipSegs ();
-    R_ClearDrawSegs ();
-    R_ClearPlanes ();
-    R_ClearSprites ();
-    
-    // check for new console commands.
-    NetUpdate ();
+    static render_context_t	playerview;
 
-    // The head node is the last node output.
-    R_RenderBSPNode (numnodes-1);
-    
-    // Check for new console commands.
-    NetUpdate ();
-    
-    R_DrawPlanes ();
-    
-    // Check for new console commands.
-    NetUpdate ();
-    
-    R_DrawMasked ();
+    R_SetupContext (&playerview, player);
+    R_RenderView (&playerview);
 
     // Check for new console commands.
     NetUpdate ();				
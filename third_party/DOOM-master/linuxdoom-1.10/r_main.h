@@ -35,8 +35,8 @@
 //
 // POV related.
 //
-extern fixed_t		viewcos;
-extern fixed_t		viewsin;
+extern RTHREAD fixed_t	viewcos;
+extern RTHREAD fixed_t	viewsin;
 
 extern int		viewwidth;
 extern int		viewheight;
@@ -53,6 +53,7 @@ extern fixed_t		centeryfrac;
 extern fixed_t		projection;
 
 extern int		validcount;
+extern int		framecount;
 
 extern int		linecount;
 extern int		loopcount;
@@ -74,12 +75,12 @@ extern int		loopcount;
 #define MAXLIGHTZ	       128
 #define LIGHTZSHIFT		20
 
-extern lighttable_t*	scalelight[LIGHTLEVELS][MAXLIGHTSCALE];
-extern lighttable_t*	scalelightfixed[MAXLIGHTSCALE];
+extern lighttable_t*	(*scalelight)[MAXLIGHTSCALE];	// [LIGHTLEVELS]
+extern RTHREAD lighttable_t*	scalelightfixed[MAXLIGHTSCALE];
 extern lighttable_t*	zlight[LIGHTLEVELS][MAXLIGHTZ];
 
-extern int		extralight;
-extern lighttable_t*	fixedcolormap;
+extern RTHREAD int	extralight;
+extern RTHREAD lighttable_t*	fixedcolormap;
 
 
 // Number of diminishing brightness levels.
@@ -97,9 +98,10 @@ extern	int		detailshift;
 // Function pointers to switch refresh/drawing functions.
 // Used to select shadow mode etc.
 //
-extern void		(*colfunc) (void);
+extern RTHREAD void	(*colfunc) (void);
 extern void		(*basecolfunc) (void);
 extern void		(*fuzzcolfunc) (void);
+extern void		(*transcolfunc) (void);
 // No shadow effects on floors.
 extern void		(*spanfunc) (void);
 
@@ -123,6 +125,14 @@ R_PointToAngle
 ( fixed_t	x,
   fixed_t	y );
 
+// R_PointToAngle of count points, into angles[].
+void
+R_PointToAngles
+( const fixed_t*	x,
+  const fixed_t*	y,
+  angle_t*		angles,
+  int			count );
+
 angle_t
 R_PointToAngle2
 ( fixed_t	x1,
@@ -156,14 +166,70 @@ R_AddPointToBox
 //
 
 // Called by G_Drawer.
+//
+// A view to draw.  R_SetupContext fills one in from a player and
+// every thread drawing part of it loads it into its own view
+// globals (viewx ... fixedcolormap) with R_LoadContext, so one can
+// be set up for the next frame, or for another camera, while the
+// last is still being drawn.
+//
+typedef struct
+{
+    player_t*		viewplayer;
+    fixed_t		viewx;
+    fixed_t		viewy;
+    fixed_t		viewz;
+    angle_t		viewangle;
+    fixed_t		viewcos;
+    fixed_t		viewsin;
+    int			extralight;
+    lighttable_t*	fixedcolormap;
+} render_context_t;
+
+void R_SetupContext (render_context_t* ctx, player_t* player);
+void R_LoadContext (render_context_t* ctx);
+
+// Draws ctx into the view window, on all the render threads.
+void R_RenderView (render_context_t* ctx);
+
 void R_RenderPlayerView (player_t *player);
 
+// Frames drawn between tics (doom_advance): interpfrac is how far into
+//  the tic after the last one the frame falls, FRACUNIT drawing things
+//  where the last tic left them.  R_SaveInterpolation is called by
+//  P_Ticker before each tic when interpolation is on.
+extern int		interpolation;
+extern fixed_t		interpfrac;
+
+void R_SaveInterpolation (void);
+boolean R_InterpolateMobj (const mobj_t* mo, fixed_t* x, fixed_t* y, fixed_t* z);
+
 // Called by startup code.
 void R_Init (void);
 
 // Called by M_Responder.
 void R_SetViewSize (int blocks, int detail);
 
+// UBO: whether this frame's view goes to screen565 (r_draw.h); only
+//  honoured with direct565 set, at high detail, not transposed.
+void R_SetView565 (boolean on);
+
+// Render threads: renderthreads (set before R_Init, 1 = off) splits
+// the view into that many vertical strips drawn in parallel, and
+// numrenderthreads is how many actually run.
+#define MAXRENDERTHREADS	8
+
+extern int		renderthreads;
+extern int		numrenderthreads;
+
+// View columns the calling thread draws, and its own sector marks
+// for R_AddSprites (NULL with one render thread: sector->validcount).
+extern RTHREAD int	rstripx1;
+extern RTHREAD int	rstripx2;
+extern RTHREAD int*	rsectorstamp;
+
+void R_ShutdownRenderThreads (void);
+
 #endif
 //-----------------------------------------------------------------------------
 //
@@ -49,16 +49,33 @@ planefunction_t		ceilingfunc;
 //
 
 // Here comes the obnoxious "visplane".
+// Each render thread has its own pool, MAXVISPLANES to start with,
+//  doubled by R_GrowVisplanes whenever a frame runs out and kept.
 #define MAXVISPLANES	128
-visplane_t		visplanes[MAXVISPLANES];
-visplane_t*		lastvisplane;
-visplane_t*		floorplane;
-visplane_t*		ceilingplane;
+RTHREAD visplane_t*		visplanes;
+RTHREAD visplane_t*		lastvisplane;
+RTHREAD visplane_t*		floorplane;
+RTHREAD visplane_t*		ceilingplane;
+static RTHREAD int		maxvisplanes;
+
+// Most visplanes a frame (strip) has used since the level started.
+int				visplanepeak;
+
+// R_FindPlane looks visplanes up by height/picnum/lightlevel here.
+//  Chains hold pool indices, so they survive R_GrowVisplanes, in
+//  pool order, so the first match is the one a linear scan found.
+#define VISPLANEHASH	128
+#define VISPLANEKEY(height,picnum,lightlevel) \
+    ((((unsigned)(height)>>FRACBITS)*7 + (picnum)*3 + (lightlevel)) \
+     & (VISPLANEHASH-1))
+
+static RTHREAD int		visplanehead[VISPLANEHASH];
+static RTHREAD int		visplanetail[VISPLANEHASH];
 
 // ?
 #define MAXOPENINGS	SCREENWIDTH*64
-short			openings[MAXOPENINGS];
-short*			lastopening;
+RTHREAD short			openings[MAXOPENINGS];
+RTHREAD short*			lastopening;
 
 
 //
@@ -66,31 +83,31 @@ short*			lastopening;
 //  floorclip starts out SCREENHEIGHT
 //  ceilingclip starts out -1
 //
-short			floorclip[SCREENWIDTH];
-short			ceilingclip[SCREENWIDTH];
+RTHREAD short			floorclip[SCREENWIDTH];
+RTHREAD short			ceilingclip[SCREENWIDTH];
 
 //
 // spanstart holds the start of a plane span
 // initialized to 0 at start
 //
-int			spanstart[SCREENHEIGHT];
-int			spanstop[SCREENHEIGHT];
+RTHREAD int			spanstart[SCREENHEIGHT];
+RTHREAD int			spanstop[SCREENHEIGHT];
 
 //
 // texture mapping
 //
-lighttable_t**		planezlight;
-fixed_t			planeheight;
+RTHREAD lighttable_t**		planezlight;
+RTHREAD fixed_t			planeheight;
 
-fixed_t			yslope[SCREENHEIGHT];
-fixed_t			distscale[SCREENWIDTH];
-fixed_t			basexscale;
-fixed_t			baseyscale;
+fixed_t*		yslope;
+fixed_t*		distscale;
+RTHREAD fixed_t			basexscale;
+RTHREAD fixed_t			baseyscale;
 
-fixed_t			cachedheight[SCREENHEIGHT];
-fixed_t			cacheddistance[SCREENHEIGHT];
-fixed_t			cachedxstep[SCREENHEIGHT];
-fixed_t			cachedystep[SCREENHEIGHT];
+RTHREAD fixed_t			cachedheight[SCREENHEIGHT];
+RTHREAD fixed_t			cacheddistance[SCREENHEIGHT];
+RTHREAD fixed_t			cachedxstep[SCREENHEIGHT];
+RTHREAD fixed_t			cachedystep[SCREENHEIGHT];
 
 
 
@@ -178,6 +195,42 @@ R_MapPlane
 }
 
 
+//
+// R_GrowVisplanes
+// Floorplane and ceilingplane are the only pointers kept into the
+//  pool while it fills, so they move along with lastvisplane.
+//
+static void R_GrowVisplanes (void)
+{
+    int		last;
+    int		floor;
+    int		ceiling;
+
+    last = lastvisplane - visplanes;
+    floor = floorplane ? floorplane - visplanes : -1;
+    ceiling = ceilingplane ? ceilingplane - visplanes : -1;
+
+    visplanes = I_GrowArray (visplanes, &maxvisplanes,
+			     sizeof(*visplanes), MAXVISPLANES, "visplanes");
+
+    lastvisplane = visplanes + last;
+    floorplane = floor < 0 ? NULL : visplanes + floor;
+    ceilingplane = ceiling < 0 ? NULL : visplanes + ceiling;
+}
+
+
+//
+// R_FreePlanes
+// Gives back the calling thread's pool.
+//
+void R_FreePlanes (void)
+{
+    free (visplanes);
+    visplanes = lastvisplane = floorplane = ceilingplane = NULL;
+    maxvisplanes = 0;
+}
+
+
 //
 // R_ClearPlanes
 // At begining of frame.
@@ -187,6 +240,9 @@ void R_ClearPlanes (void)
     int		i;
     angle_t	angle;
     
+    if (!maxvisplanes)
+	R_GrowVisplanes ();
+
     // opening / clipping determination
     for (i=0 ; i<viewwidth ; i++)
     {
@@ -196,6 +252,7 @@ void R_ClearPlanes (void)
 
     lastvisplane = visplanes;
     lastopening = openings;
+    memset (visplanehead, -1, sizeof(visplanehead));
     
     // texture calculation
     memset (cachedheight, 0, sizeof(cachedheight));
@@ -211,6 +268,27 @@ void R_ClearPlanes (void)
 
 
 
+//
+// R_HashPlane
+// Appends a new visplane to the tail of its chain.
+//
+static void R_HashPlane (visplane_t* pl)
+{
+    int		key;
+    int		num;
+
+    key = VISPLANEKEY(pl->height, pl->picnum, pl->lightlevel);
+    num = pl - visplanes;
+
+    pl->next = -1;
+    if (visplanehead[key] < 0)
+	visplanehead[key] = num;
+    else
+	visplanes[visplanetail[key]].next = num;
+    visplanetail[key] = num;
+}
+
+
 //
 // R_FindPlane
 //
@@ -221,6 +299,7 @@ R_FindPlane
   int		lightlevel )
 {
     visplane_t*	check;
+    int		i;
 	
     if (picnum == skyflatnum)
     {
@@ -228,30 +307,30 @@ R_FindPlane
 	lightlevel = 0;
     }
 	
-    for (check=visplanes; check<lastvisplane; check++)
+    for (i = visplanehead[VISPLANEKEY(height, picnum, lightlevel)] ;
+	 i >= 0 ;
+	 i = check->next)
     {
+	check = &visplanes[i];
 	if (height == check->height
 	    && picnum == check->picnum
 	    && lightlevel == check->lightlevel)
 	{
-	    break;
+	    return check;
 	}
     }
-    
-			
-    if (check < lastvisplane)
-	return check;
 		
-    if (lastvisplane - visplanes == MAXVISPLANES)
-	I_Error ("R_FindPlane: no more visplanes");
+    if (lastvisplane - visplanes == maxvisplanes)
+	R_GrowVisplanes ();
 		
-    lastvisplane++;
+    check = lastvisplane++;
 
     check->height = height;
     check->picnum = picnum;
     check->lightlevel = lightlevel;
     check->minx = SCREENWIDTH;
     check->maxx = -1;
+    R_HashPlane (check);
     
     memset (check->top,0xff,sizeof(check->top));
 		
@@ -310,6 +389,13 @@ R_CheckPlane
     }
 	
     // make a new visplane
+    if (lastvisplane - visplanes == maxvisplanes)
+    {
+	x = pl - visplanes;
+	R_GrowVisplanes ();
+	pl = visplanes + x;
+    }
+
     lastvisplane->height = pl->height;
     lastvisplane->picnum = pl->picnum;
     lastvisplane->lightlevel = pl->lightlevel;
@@ -317,6 +403,7 @@ R_CheckPlane
     pl = lastvisplane++;
     pl->minx = start;
     pl->maxx = stop;
+    R_HashPlane (pl);
 
     memset (pl->top,0xff,sizeof(pl->top));
 		
@@ -371,13 +458,16 @@ void R_DrawPlanes (void)
     int			x;
     int			stop;
     int			angle;
+    int			pitch;
+    byte*		source;
+    byte*		dest;
 				
 #ifdef RANGECHECK
-    if (ds_p - drawsegs > MAXDRAWSEGS)
+    if (ds_p - drawsegs > maxdrawsegs)
 	I_Error ("R_DrawPlanes: drawsegs overflow (%i)",
 		 ds_p - drawsegs);
     
-    if (lastvisplane - visplanes > MAXVISPLANES)
+    if (lastvisplane - visplanes > maxvisplanes)
 	I_Error ("R_DrawPlanes: visplane overflow (%i)",
 		 lastvisplane - visplanes);
     
@@ -395,32 +485,61 @@ void R_DrawPlanes (void)
 	// sky flat
 	if (pl->picnum == skyflatnum)
 	{
-	    dc_iscale = pspriteiscale>>detailshift;
-	    
 	    // Sky is allways drawn full bright,
 	    //  i.e. colormaps[0] is used.
 	    // Because of this hack, sky is not affected
 	    //  by INVUL inverse mapping.
-	    dc_colormap = colormaps;
-	    dc_texturemid = skytexturemid;
+	    // R_UpdateSkyCache has every column scaled and lit
+	    //  already, so each one is a plain copy.
+	    R_FlushQuad ();
+	    pitch = R_ViewTransposed () ? 1 : SCREENWIDTH;
 	    for (x=pl->minx ; x <= pl->maxx ; x++)
 	    {
-		dc_yl = pl->top[x];
-		dc_yh = pl->bottom[x];
+		int	yl = pl->top[x];
+		int	count = pl->bottom[x] - yl + 1;
+
+		if (count <= 0)
+		    continue;
 
-		if (dc_yl <= dc_yh)
+		angle = (viewangle + xtoviewangle[x])>>ANGLETOSKYSHIFT;
+		source = R_SkyColumn (angle) + yl;
+		if (view565)
+		{
+		    unsigned short*	dest565;
+
+		    dest565 = ylookup565[yl] + columnofs[x];
+		    do
+		    {
+			*dest565 = palette565[*source++];
+			dest565 += SCREENWIDTH;
+		    } while (--count);
+		    continue;
+		}
+		dest = ylookup[yl] + columnofs[x<<detailshift];
+		if (pitch == 1)
+		    memcpy (dest, source, count);
+		else if (detailshift)
+		{
+		    do
+		    {
+			dest[0] = dest[1] = *source++;
+			dest += pitch;
+		    } while (--count);
+		}
+		else
 		{
-		    angle = (viewangle + xtoviewangle[x])>>ANGLETOSKYSHIFT;
-		    dc_x = x;
-		    dc_source = R_GetColumn(skytexture, angle);
-		    colfunc ();
+		    do
+		    {
+			*dest = *source++;
+			dest += pitch;
+		    } while (--count);
 		}
 	    }
 	    continue;
 	}
 	
 	// regular flat
-	ds_source = W_CacheLumpNum(firstflat +
+	ds_source = R_CacheLumpNum(firstflat +
 				   flattranslation[pl->picnum],
 				   PU_STATIC);
 	
@@ -448,6 +567,7 @@ void R_DrawPlanes (void)
 			pl->bottom[x]);
 	}
 	
-	Z_ChangeTag (ds_source, PU_CACHE);
+	if (numrenderthreads <= 1)
+	    Z_ChangeTag (ds_source, PU_CACHE);
     }
 }
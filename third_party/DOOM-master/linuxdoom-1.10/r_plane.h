@@ -32,7 +32,11 @@
 
 
 // Visplane related.
-extern  short*		lastopening;
+extern RTHREAD short*		lastopening;
+
+extern RTHREAD visplane_t*	visplanes;
+extern RTHREAD visplane_t*	lastvisplane;
+extern int			visplanepeak;
 
 
 typedef void (*planefunction_t) (int top, int bottom);
@@ -40,14 +44,15 @@ typedef void (*planefunction_t) (int top, int bottom);
 extern planefunction_t	floorfunc;
 extern planefunction_t	ceilingfunc_t;
 
-extern short		floorclip[SCREENWIDTH];
-extern short		ceilingclip[SCREENWIDTH];
+extern RTHREAD short		floorclip[SCREENWIDTH];
+extern RTHREAD short		ceilingclip[SCREENWIDTH];
 
-extern fixed_t		yslope[SCREENHEIGHT];
-extern fixed_t		distscale[SCREENWIDTH];
+extern fixed_t*		yslope;		// [SCREENHEIGHT]
+extern fixed_t*		distscale;	// [SCREENWIDTH]
 
 void R_InitPlanes (void);
 void R_ClearPlanes (void);
+void R_FreePlanes (void);
 
 void
 R_MapPlane
@@ -42,57 +42,59 @@ rcsid[] = "$Id: r_segs.c,v 1.3 1997/01/29 20:10:19 b1 Exp $";
 
 // OPTIMIZE: closed two sided lines as single sided
 
+unsigned short*		rdepth;
+
 // True if any of the segs textures might be visible.
-boolean		segtextured;	
+RTHREAD boolean		segtextured;	
 
 // False if the back side is the same plane.
-boolean		markfloor;	
-boolean		markceiling;
+RTHREAD boolean		markfloor;	
+RTHREAD boolean		markceiling;
 
-boolean		maskedtexture;
-int		toptexture;
-int		bottomtexture;
-int		midtexture;
+RTHREAD boolean		maskedtexture;
+RTHREAD int		toptexture;
+RTHREAD int		bottomtexture;
+RTHREAD int		midtexture;
 
 
-angle_t		rw_normalangle;
+RTHREAD angle_t		rw_normalangle;
 // angle to line origin
-int		rw_angle1;	
+RTHREAD int		rw_angle1;	
 
 //
 // regular wall
 //
-int		rw_x;
-int		rw_stopx;
-angle_t		rw_centerangle;
-fixed_t		rw_offset;
-fixed_t		rw_distance;
-fixed_t		rw_scale;
-fixed_t		rw_scalestep;
-fixed_t		rw_midtexturemid;
-fixed_t		rw_toptexturemid;
-fixed_t		rw_bottomtexturemid;
+RTHREAD int		rw_x;
+RTHREAD int		rw_stopx;
+RTHREAD angle_t		rw_centerangle;
+RTHREAD fixed_t		rw_offset;
+RTHREAD fixed_t		rw_distance;
+RTHREAD fixed_t		rw_scale;
+RTHREAD fixed_t		rw_scalestep;
+RTHREAD fixed_t		rw_midtexturemid;
+RTHREAD fixed_t		rw_toptexturemid;
+RTHREAD fixed_t		rw_bottomtexturemid;
 
-int		worldtop;
-int		worldbottom;
-int		worldhigh;
-int		worldlow;
+RTHREAD int		worldtop;
+RTHREAD int		worldbottom;
+RTHREAD int		worldhigh;
+RTHREAD int		worldlow;
 
-fixed_t		pixhigh;
-fixed_t		pixlow;
-fixed_t		pixhighstep;
-fixed_t		pixlowstep;
+RTHREAD fixed_t		pixhigh;
+RTHREAD fixed_t		pixlow;
+RTHREAD fixed_t		pixhighstep;
+RTHREAD fixed_t		pixlowstep;
 
-fixed_t		topfrac;
-fixed_t		topstep;
+RTHREAD fixed_t		topfrac;
+RTHREAD fixed_t		topstep;
 
-fixed_t		bottomfrac;
-fixed_t		bottomstep;
+RTHREAD fixed_t		bottomfrac;
+RTHREAD fixed_t		bottomstep;
 
 
-lighttable_t**	walllights;
+RTHREAD lighttable_t**	walllights;
 
-short*		maskedtexturecol;
+RTHREAD short*		maskedtexturecol;
 
 
 
@@ -186,12 +188,28 @@ R_RenderMaskedSegRange
 	}
 	spryscale += rw_scalestep;
     }
-	
+    R_FlushQuad ();
 }
 
 
 
 
+//
+// R_MarkDepth
+// Walls are drawn front to back, so the first tier drawn
+//  in a column is the nearest one.
+//
+static void R_MarkDepth (void)
+{
+    fixed_t	dist;
+
+    if (rdepth[rw_x])
+	return;
+    dist = FixedDiv (projection, rw_scale) >> FRACBITS;
+    rdepth[rw_x] = dist < 1 ? 1 : dist > 0xffff ? 0xffff : dist;
+}
+
+
 //
 // R_RenderSegLoop
 // Draws zero, one, or two textures (and possibly a masked
@@ -213,8 +231,17 @@ void R_RenderSegLoop (void)
     fixed_t		texturecolumn;
     int			top;
     int			bottom;
+    byte*		midcomposite;
+    byte*		topcomposite;
+    byte*		bottomcomposite;
+
+    texturecolumn = 0;				// shut up compiler warning
 
-    //texturecolumn = 0;				// shut up compiler warning
+    // UBO: each tier's columns come out of its composite, once a seg.
+    midcomposite = midtexture ? R_GetTextureComposite (midtexture) : NULL;
+    topcomposite = toptexture ? R_GetTextureComposite (toptexture) : NULL;
+    bottomcomposite = bottomtexture
+		      ? R_GetTextureComposite (bottomtexture) : NULL;
 	
     for ( ; rw_x < rw_stopx ; rw_x++)
     {
@@ -283,8 +310,11 @@ void R_RenderSegLoop (void)
 	    dc_yl = yl;
 	    dc_yh = yh;
 	    dc_texturemid = rw_midtexturemid;
-	    dc_source = R_GetColumn(midtexture,texturecolumn);
+	    dc_source = R_TEXTURECOLUMN(midcomposite,midtexture,
+					 texturecolumn);
 	    colfunc ();
+	    if (rdepth && yl <= yh)
+		R_MarkDepth ();
 	    ceilingclip[rw_x] = viewheight;
 	    floorclip[rw_x] = -1;
 	}
@@ -305,8 +335,11 @@ void R_RenderSegLoop (void)
 		    dc_yl = yl;
 		    dc_yh = mid;
 		    dc_texturemid = rw_toptexturemid;
-		    dc_source = R_GetColumn(toptexture,texturecolumn);
+		    dc_source = R_TEXTURECOLUMN(topcomposite,toptexture,
+						 texturecolumn);
 		    colfunc ();
+		    if (rdepth)
+			R_MarkDepth ();
 		    ceilingclip[rw_x] = mid;
 		}
 		else
@@ -334,9 +367,12 @@ void R_RenderSegLoop (void)
 		    dc_yl = mid;
 		    dc_yh = yh;
 		    dc_texturemid = rw_bottomtexturemid;
-		    dc_source = R_GetColumn(bottomtexture,
-					    texturecolumn);
+		    dc_source = R_TEXTURECOLUMN(bottomcomposite,
+						bottomtexture,
+						texturecolumn);
 		    colfunc ();
+		    if (rdepth)
+			R_MarkDepth ();
 		    floorclip[rw_x] = mid;
 		}
 		else
@@ -361,6 +397,7 @@ void R_RenderSegLoop (void)
 	topfrac += topstep;
 	bottomfrac += bottomstep;
     }
+    R_FlushQuad ();
 }
 
 
@@ -382,9 +419,8 @@ R_StoreWallRange
     fixed_t		vtop;
     int			lightnum;
 
-    // don't overflow and crash
-    if (ds_p == &drawsegs[MAXDRAWSEGS])
-	return;		
+    if (ds_p - drawsegs == maxdrawsegs)
+	R_GrowDrawSegs ();
 		
 #ifdef RANGECHECK
     if (start >=viewwidth || start > stop)
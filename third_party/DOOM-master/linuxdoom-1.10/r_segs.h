@@ -29,6 +29,12 @@
 #endif
 
 
+// UBO: depth buffer (doom_set_aux_buffers), NULL when off: for each
+//  view column, the distance in map units to the nearest wall tier
+//  drawn in it, 0 where none was (sky, open space beyond the view).
+//  R_RenderView clears it first.
+extern unsigned short*	rdepth;
+
 void
 R_RenderMaskedSegRange
 ( drawseg_t*	ds,
@@ -29,12 +29,18 @@ static const char
 rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 
 
+#include <stdlib.h>
+
+#include "i_system.h"
+
 // Needed for FRACUNIT.
 #include "m_fixed.h"
 
 // Needed for Flat retrieval.
 #include "r_data.h"
 
+#include "r_local.h"
+
 
 #ifdef __GNUG__
 #pragma implementation "r_sky.h"
@@ -48,6 +54,22 @@ int			skyflatnum;
 int			skytexture;
 int			skytexturemid;
 
+extern int*		texturewidthmask;
+
+// Every sky texture column as R_DrawPlanes would draw it down the
+//  view: scaled to viewheight rows and lit through colormaps[0], so
+//  a sky column is a straight copy.  The rest is what it was built
+//  for; a different sky, view size or detail builds it again.
+static byte*		skycache;
+static int		skycachesize;
+static int		skycachetexture = -1;
+static int		skycachemask;
+static int		skycacheheight;
+static int		skycachecentery;
+static fixed_t		skycacheiscale;
+static fixed_t		skycachemid;
+static lighttable_t*	skycachemap;
+
 
 
 //
@@ -58,5 +80,72 @@ void R_InitSkyMap (void)
 {
   // skyflatnum = R_FlatNumForName ( SKYFLATNAME );
     skytexturemid = 100*FRACUNIT;
+    skycachetexture = -1;
+}
+
+
+//
+// R_UpdateSkyCache
+// Called before a view is drawn, while nothing else is rendering.
+//
+void R_UpdateSkyCache (void)
+{
+    fixed_t	iscale;
+    fixed_t	frac;
+    byte*	source;
+    byte*	dest;
+    int		width;
+    int		col;
+    int		y;
+
+    iscale = pspriteiscale>>detailshift;
+    if (skytexture == skycachetexture
+	&& viewheight == skycacheheight
+	&& centery == skycachecentery
+	&& iscale == skycacheiscale
+	&& skytexturemid == skycachemid
+	&& colormaps == skycachemap)
+	return;
+
+    width = texturewidthmask[skytexture]+1;
+    if (width*viewheight > skycachesize)
+    {
+	free (skycache);
+	skycachesize = width*viewheight;
+	skycache = malloc (skycachesize);
+	if (!skycache)
+	    I_Error ("R_UpdateSkyCache: no memory for %ix%i", width, viewheight);
+    }
+
+    dest = skycache;
+    for (col=0 ; col<width ; col++)
+    {
+	source = R_GetTextureColumn (skytexture, col);
+	frac = skytexturemid - centery*iscale;
+	for (y=0 ; y<viewheight ; y++)
+	{
+	    *dest++ = colormaps[source[(frac>>FRACBITS)&127]];
+	    frac += iscale;
+	}
+    }
+
+    skycachetexture = skytexture;
+    skycachemask = width-1;
+    skycacheheight = viewheight;
+    skycachecentery = centery;
+    skycacheiscale = iscale;
+    skycachemid = skytexturemid;
+    skycachemap = colormaps;
+}
+
+
+//
+// R_SkyColumn
+// The cached column for a sky angle (ANGLETOSKYSHIFT applied),
+//  viewheight rows from the top of the view.
+//
+byte* R_SkyColumn (int angle)
+{
+    return skycache + (angle & skycachemask)*skycacheheight;
 }
 
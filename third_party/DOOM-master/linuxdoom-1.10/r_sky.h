@@ -40,6 +40,10 @@ extern int		skytexturemid;
 // Called whenever the view size changes.
 void R_InitSkyMap (void);
 
+// Sky columns scaled to the view and lit, ready to copy.
+void R_UpdateSkyCache (void);
+byte* R_SkyColumn (int angle);
+
 #endif
 //-----------------------------------------------------------------------------
 //
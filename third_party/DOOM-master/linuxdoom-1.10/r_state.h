@@ -50,6 +50,9 @@ extern fixed_t*		spriteoffset;
 extern fixed_t*		spritetopoffset;
 
 extern lighttable_t*	colormaps;
+extern lighttable_t*	identitymap;
+extern lighttable565_t*	colormaps565;
+extern unsigned short	palette565[256];
 
 extern int		viewwidth;
 extern int		scaledviewwidth;
@@ -100,34 +103,35 @@ extern side_t*		sides;
 //
 // POV data.
 //
-extern fixed_t		viewx;
-extern fixed_t		viewy;
-extern fixed_t		viewz;
+extern RTHREAD fixed_t	viewx;
+extern RTHREAD fixed_t	viewy;
+extern RTHREAD fixed_t	viewz;
 
-extern angle_t		viewangle;
-extern player_t*	viewplayer;
+extern RTHREAD angle_t	viewangle;
+extern RTHREAD player_t*	viewplayer;
 
 
 // ?
 extern angle_t		clipangle;
 
-extern int		viewangletox[FINEANGLES/2];
-extern angle_t		xtoviewangle[SCREENWIDTH+1];
+// UBO: point into the view size's tables, see R_ExecuteSetViewSize.
+extern int*		viewangletox;		// [FINEANGLES/2]
+extern angle_t*		xtoviewangle;		// [SCREENWIDTH+1]
 //extern fixed_t		finetangent[FINEANGLES/2];
 
-extern fixed_t		rw_distance;
-extern angle_t		rw_normalangle;
+extern RTHREAD fixed_t		rw_distance;
+extern RTHREAD angle_t		rw_normalangle;
 
 
 
 // angle to line origin
-extern int		rw_angle1;
+extern RTHREAD int		rw_angle1;
 
 // Segs count?
-extern int		sscount;
+extern RTHREAD int		sscount;
 
-extern visplane_t*	floorplane;
-extern visplane_t*	ceilingplane;
+extern RTHREAD visplane_t*	floorplane;
+extern RTHREAD visplane_t*	ceilingplane;
 
 
 #endif
@@ -26,8 +26,10 @@ static const char
 rcsid[] = "$Id: r_things.c,v 1.5 1997/02/03 16:47:56 b1 Exp $";
 
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 #include "doomdef.h"
@@ -41,6 +43,8 @@ rcsid[] = "$Id: r_things.c,v 1.5 1997/02/03 16:47:56 b1 Exp $";
 
 #include "doomstat.h"
 
+#include "doom_api.h"
+
 
 
 #define MINZ				(FRACUNIT*4)
@@ -74,7 +78,7 @@ typedef struct
 fixed_t		pspritescale;
 fixed_t		pspriteiscale;
 
-lighttable_t**	spritelights;
+RTHREAD lighttable_t**	spritelights;
 
 // constant arrays
 //  used for psprite clipping and initializing clipping
@@ -185,6 +189,12 @@ void R_InitSpriteDefs (char** namelist)
     int		start;
     int		end;
     int		patched;
+    int*	spritehead;
+    int*	spritetail;
+    int*	lumpnext;
+    int*	slots;
+    unsigned	mask;
+    unsigned	h;
 		
     // count the number of sprite names
     check = namelist;
@@ -200,40 +210,73 @@ void R_InitSpriteDefs (char** namelist)
 	
     start = firstspritelump-1;
     end = lastspritelump+1;
-	
-    // scan all the lump names for each of the names,
-    //  noting the highest frame letter.
-    // Just compare 4 characters as ints
+
+    // UBO: one pass over the lumps chains each onto the sprite its
+    //  first 4 characters name (compared as ints), in lump order,
+    //  instead of scanning them all once per sprite.
+    for (mask = 1 ; mask < (unsigned)numsprites*2 ; mask <<= 1)
+	;
+    mask--;
+    slots = malloc ((mask+1) * sizeof(*slots));
+    spritehead = malloc (numsprites * sizeof(*spritehead));
+    spritetail = malloc (numsprites * sizeof(*spritetail));
+    lumpnext = malloc ((end-start) * sizeof(*lumpnext));
+    if (!slots || !spritehead || !spritetail || !lumpnext)
+	I_Error ("R_InitSpriteDefs: out of memory");
+    memset (slots, -1, (mask+1) * sizeof(*slots));
+    memset (spritehead, -1, numsprites * sizeof(*spritehead));
+    for (i=0 ; i<numsprites ; i++)
+    {
+	intname = *(int *)namelist[i];
+	for (h = ((unsigned)intname * 0x9e3779b1u) >> 7 & mask ;
+	     slots[h] >= 0 ; h = (h+1) & mask)
+	    ;
+	slots[h] = i;
+    }
+    for (l=start+1 ; l<end ; l++)
+    {
+	intname = *(int *)lumpinfo[l].name;
+	for (h = ((unsigned)intname * 0x9e3779b1u) >> 7 & mask ;
+	     slots[h] >= 0 ; h = (h+1) & mask)
+	    if (*(int *)namelist[slots[h]] == intname)
+		break;
+	if (slots[h] < 0)
+	    continue;
+	i = slots[h];
+	lumpnext[l-start] = -1;
+	if (spritehead[i] < 0)
+	    spritehead[i] = l;
+	else
+	    lumpnext[spritetail[i]-start] = l;
+	spritetail[i] = l;
+    }
+
+    // then each sprite's lumps, noting the highest frame letter
     for (i=0 ; i<numsprites ; i++)
     {
 	spritename = namelist[i];
 	memset (sprtemp,-1, sizeof(sprtemp));
 		
 	maxframe = -1;
-	intname = *(int *)namelist[i];
 	
-	// scan the lumps,
-	//  filling in the frames for whatever is found
-	for (l=start+1 ; l<end ; l++)
+	// filling in the frames for whatever is found
+	for (l=spritehead[i] ; l>=0 ; l=lumpnext[l-start])
 	{
-	    if (*(int *)lumpinfo[l].name == intname)
-	    {
-		frame = lumpinfo[l].name[4] - 'A';
-		rotation = lumpinfo[l].name[5] - '0';
+	    frame = lumpinfo[l].name[4] - 'A';
+	    rotation = lumpinfo[l].name[5] - '0';
 
-		if (modifiedgame)
-		    patched = W_GetNumForName (lumpinfo[l].name);
-		else
-		    patched = l;
+	    if (modifiedgame)
+		patched = W_GetNumForName (lumpinfo[l].name);
+	    else
+		patched = l;
 
-		R_InstallSpriteLump (patched, frame, rotation, false);
+	    R_InstallSpriteLump (patched, frame, rotation, false);
 
-		if (lumpinfo[l].name[6])
-		{
-		    frame = lumpinfo[l].name[6] - 'A';
-		    rotation = lumpinfo[l].name[7] - '0';
-		    R_InstallSpriteLump (l, frame, rotation, true);
-		}
+	    if (lumpinfo[l].name[6])
+	    {
+		frame = lumpinfo[l].name[6] - 'A';
+		rotation = lumpinfo[l].name[7] - '0';
+		R_InstallSpriteLump (l, frame, rotation, true);
 	    }
 	}
 	
@@ -278,6 +321,251 @@ void R_InitSpriteDefs (char** namelist)
 	memcpy (sprites[i].spriteframes, sprtemp, maxframe*sizeof(spriteframe_t));
     }
 
+    free (slots);
+    free (spritehead);
+    free (spritetail);
+    free (lumpnext);
+}
+
+
+
+//
+// DECODED SPRITES
+// A sprite lump is decoded the first time it is drawn into an
+//  rsprite_t: the first post of every column, then each post's top,
+//  length and pixel offset, then the pixels, all in one block.
+//  R_DrawVisSprite walks two small arrays instead of following
+//  columnofs and the post headers through the lump.  A miss decodes
+//  every rotation of the frame at once, so a thing's views sit next
+//  to each other.  Blocks are cache line aligned, bump allocated from
+//  chunks kept outside the zone and only freed with the sprite
+//  definitions.  Each post keeps the pad byte either side of its
+//  pixels, so the column drawers read the same bytes as from the lump.
+// Render threads may draw any sprite: decoding is done under
+//  spritelock and published with a release store.
+//
+#define SPRITECHUNK	(256*1024)
+#define SPRITEALIGN	64
+
+typedef struct
+{
+    int		ofs;		// first pixel in pixels[]
+    byte	topdelta;
+    byte	length;
+    short	pad;
+} rpost_t;
+
+typedef struct
+{
+    int		width;
+    int*	colpost;	// [width+1], column x is colpost[x]..colpost[x+1]-1
+    rpost_t*	posts;
+    byte*	pixels;
+} rsprite_t;
+
+typedef struct spritechunk_s
+{
+    struct spritechunk_s*	next;
+    int				size;	// payload bytes
+    int				used;
+} spritechunk_t;
+
+static pthread_mutex_t	spritelock = PTHREAD_MUTEX_INITIALIZER;
+static rsprite_t**	spritedata;	// per sprite lump, NULL until decoded
+static spriteframe_t**	spriteframeof;	// per sprite lump, a frame using it
+static spritechunk_t*	spritechunks;	// current chunk first
+
+
+static void* R_SpriteAlloc (int size)
+{
+    spritechunk_t*	chunk;
+    int			hdr;
+    byte*		p;
+
+    hdr = (sizeof(spritechunk_t) + SPRITEALIGN-1) & ~(SPRITEALIGN-1);
+    size = (size + SPRITEALIGN-1) & ~(SPRITEALIGN-1);
+
+    chunk = spritechunks;
+    if (!chunk || chunk->used + size > chunk->size)
+    {
+	// an oversized sprite gets a chunk of its own
+	if (posix_memalign ((void **)&chunk, SPRITEALIGN,
+			    hdr + (size > SPRITECHUNK ? size : SPRITECHUNK)))
+	    I_Error ("R_SpriteAlloc: failed on allocation of %i bytes", size);
+	chunk->size = size > SPRITECHUNK ? size : SPRITECHUNK;
+	chunk->used = 0;
+	chunk->next = spritechunks;
+	spritechunks = chunk;
+    }
+
+    p = (byte *)chunk + hdr + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+
+//
+// R_DecodeSprite
+// Called with spritelock held.  Posts running past the end of the
+//  lump end their column there.
+//
+static void R_DecodeSprite (int lump)
+{
+    patch_t*	patch;
+    byte*	raw;
+    rsprite_t*	rs;
+    rpost_t*	post;
+    byte*	dest;
+    int		len;
+    int		width;
+    int		x;
+    int		ofs;
+    int		numposts;
+    int		numpixels;
+    int		pass;
+    boolean	hdrok;
+
+    if (spritedata[lump])
+	return;
+
+    patch = R_CacheLumpNum (lump+firstspritelump, PU_CACHE);
+    raw = (byte *)patch;
+    len = W_LumpLength (lump+firstspritelump);
+    width = SHORT(patch->width);
+    if (width < 0)
+	width = 0;
+    hdrok = 8 + 4*width <= len;
+
+    // count, then fill
+    numposts = numpixels = 0;
+    rs = NULL;
+    post = NULL;
+    dest = NULL;
+    for (pass = 0 ; pass < 2 ; pass++)
+    {
+	if (pass)
+	{
+	    rs = R_SpriteAlloc (sizeof(*rs) + (width+1)*sizeof(int)
+				+ numposts*sizeof(rpost_t) + numpixels);
+	    rs->width = width;
+	    rs->colpost = (int *)(rs+1);
+	    rs->posts = (rpost_t *)(rs->colpost + width+1);
+	    rs->pixels = (byte *)(rs->posts + numposts);
+	    post = rs->posts;
+	    dest = rs->pixels;
+	}
+	
+	for (x = 0 ; x < width ; x++)
+	{
+	    if (pass)
+		rs->colpost[x] = post - rs->posts;
+	    
+	    ofs = hdrok ? LONG(patch->columnofs[x]) : -1;
+	    while (ofs >= 0 && ofs < len && raw[ofs] != 0xff)
+	    {
+		if (ofs + 4 > len || ofs + 4 + raw[ofs+1] > len)
+		    break;
+		
+		if (!pass)
+		{
+		    numposts++;
+		    numpixels += raw[ofs+1] + 2;
+		}
+		else
+		{
+		    // pad byte, pixels, pad byte
+		    memcpy (dest, raw + ofs + 2, raw[ofs+1] + 2);
+		    post->ofs = dest + 1 - rs->pixels;
+		    post->topdelta = raw[ofs];
+		    post->length = raw[ofs+1];
+		    post->pad = 0;
+		    post++;
+		    dest += raw[ofs+1] + 2;
+		}
+		ofs += raw[ofs+1] + 4;
+	    }
+	}
+    }
+    rs->colpost[width] = post - rs->posts;
+
+    __atomic_store_n (&spritedata[lump], rs, __ATOMIC_RELEASE);
+}
+
+
+static rsprite_t* R_GetSprite (int lump)
+{
+    rsprite_t*		rs;
+    spriteframe_t*	frame;
+    int			r;
+
+    rs = __atomic_load_n (&spritedata[lump], __ATOMIC_ACQUIRE);
+    if (rs)
+	return rs;
+
+    pthread_mutex_lock (&spritelock);
+    frame = spriteframeof[lump];
+    if (frame)
+    {
+	for (r = 0 ; r < 8 ; r++)
+	    R_DecodeSprite (frame->lump[r]);
+    }
+    R_DecodeSprite (lump);
+    rs = spritedata[lump];
+    pthread_mutex_unlock (&spritelock);
+    return rs;
+}
+
+
+//
+// R_FreeSpriteData
+// Drops every decoded sprite.  No frame may be drawing.
+//
+void R_FreeSpriteData (void)
+{
+    spritechunk_t*	chunk;
+
+    while (spritechunks)
+    {
+	chunk = spritechunks->next;
+	free (spritechunks);
+	spritechunks = chunk;
+    }
+    free (spritedata);
+    free (spriteframeof);
+    spritedata = NULL;
+    spriteframeof = NULL;
+}
+
+
+//
+// R_InitSpriteData
+// Maps each sprite lump to a frame it appears in.
+//
+static void R_InitSpriteData (void)
+{
+    int		i;
+    int		j;
+    int		r;
+    int		count;
+
+    R_FreeSpriteData ();
+
+    count = numspritelumps > 0 ? numspritelumps : 1;
+    spritedata = calloc (count, sizeof(*spritedata));
+    spriteframeof = calloc (count, sizeof(*spriteframeof));
+    if (!spritedata || !spriteframeof)
+	I_Error ("R_InitSpriteData: failed on allocation of %i sprites",
+		 count);
+
+    for (i=0 ; i<numsprites ; i++)
+	for (j=0 ; j<sprites[i].numframes ; j++)
+	    for (r=0 ; r<8 ; r++)
+	    {
+		if (sprites[i].spriteframes[j].lump[r] >= 0
+		    && sprites[i].spriteframes[j].lump[r] < numspritelumps)
+		    spriteframeof[sprites[i].spriteframes[j].lump[r]] =
+			&sprites[i].spriteframes[j];
+	    }
 }
 
 
@@ -286,9 +574,28 @@ void R_InitSpriteDefs (char** namelist)
 //
 // GAME FUNCTIONS
 //
-vissprite_t	vissprites[MAXVISSPRITES];
-vissprite_t*	vissprite_p;
-int		newvissprite;
+RTHREAD vissprite_t*	vissprites;
+RTHREAD vissprite_t*	vissprite_p;
+RTHREAD int		newvissprite;
+static RTHREAD int	maxvissprites;
+
+// R_SortVisSprites slots: two arrays of maxvsprorder.
+static RTHREAD vissprite_t**	vsprorder;
+static RTHREAD int	maxvsprorder;
+
+// Drawseg index for R_DrawSprite, see R_IndexDrawSegs.
+#define DSSLICESHIFT	5
+#define MAXDSSLICES	((SCREENWIDTH>>DSSLICESHIFT)+1)
+
+static RTHREAD int	dsslicestart[MAXDSSLICES+1];	// slice s: dsslice[start[s]..start[s+1])
+static RTHREAD int*	dsslice;
+static RTHREAD int	maxdsslice;
+
+// Most vissprites a frame (strip) has used since the level started.
+int			visspritepeak;
+
+int			plainshadows;
+#define PLAINSHADOWMAP		(NUMCOLORMAPS*3/4)
 
 
 
@@ -306,6 +613,7 @@ void R_InitSprites (char** namelist)
     }
 	
     R_InitSpriteDefs (namelist);
+    R_InitSpriteData ();
 }
 
 
@@ -321,14 +629,40 @@ void R_ClearSprites (void)
 
 
 //
-// R_NewVisSprite
+// R_FreeSprites
+// Gives back the calling thread's vissprite pool and sort slots.
 //
-vissprite_t	overflowsprite;
+void R_FreeSprites (void)
+{
+    free (vissprites);
+    vissprites = vissprite_p = NULL;
+    maxvissprites = 0;
+    free (vsprorder);
+    vsprorder = NULL;
+    maxvsprorder = 0;
+    free (dsslice);
+    dsslice = NULL;
+    maxdsslice = 0;
+}
+
 
+//
+// R_NewVisSprite
+// The pool starts at MAXVISSPRITES and doubles when a frame runs
+//  out.  Nothing keeps a vissprite pointer until R_SortVisSprites.
+//
 vissprite_t* R_NewVisSprite (void)
 {
-    if (vissprite_p == &vissprites[MAXVISSPRITES])
-	return &overflowsprite;
+    int		used;
+
+    if (vissprite_p - vissprites == maxvissprites)
+    {
+	used = vissprite_p - vissprites;
+	vissprites = I_GrowArray (vissprites, &maxvissprites,
+				  sizeof(*vissprites), MAXVISSPRITES,
+				  "vissprites");
+	vissprite_p = vissprites + used;
+    }
     
     vissprite_p++;
     return vissprite_p-1;
@@ -342,11 +676,26 @@ vissprite_t* R_NewVisSprite (void)
 // Masked means: partly transparent, i.e. stored
 //  in posts/runs of opaque pixels.
 //
-short*		mfloorclip;
-short*		mceilingclip;
+RTHREAD short*		mfloorclip;
+RTHREAD short*		mceilingclip;
+
+RTHREAD fixed_t		spryscale;
+RTHREAD fixed_t		sprtopscreen;
 
-fixed_t		spryscale;
-fixed_t		sprtopscreen;
+byte*			rlabels;
+static RTHREAD int	rlabel;
+
+static void R_LabelPost (int label)
+{
+    byte*	dest = rlabels + dc_yl*SCREENWIDTH + dc_x;
+    int		count = dc_yh - dc_yl;
+
+    do
+    {
+	*dest = label;
+	dest += SCREENWIDTH;
+    } while (count--);
+}
 
 void R_DrawMaskedColumn (column_t* column)
 {
@@ -380,6 +729,8 @@ void R_DrawMaskedColumn (column_t* column)
 	    // Drawn by either R_DrawColumn
 	    //  or (SHADOW) R_DrawFuzzColumn.
 	    colfunc ();	
+	    if (rlabels)
+		R_LabelPost (R_LABEL_NONE);
 	}
 	column = (column_t *)(  (byte *)column + column->length + 4);
     }
@@ -389,6 +740,50 @@ void R_DrawMaskedColumn (column_t* column)
 
 
 
+//
+// R_DrawSpriteColumn
+// R_DrawMaskedColumn over a decoded sprite column.
+//
+static void R_DrawSpriteColumn (rsprite_t* sprite, int col)
+{
+    rpost_t*	post;
+    rpost_t*	end;
+    int		topscreen;
+    int 	bottomscreen;
+    fixed_t	basetexturemid;
+	
+    basetexturemid = dc_texturemid;
+    post = sprite->posts + sprite->colpost[col];
+    end = sprite->posts + sprite->colpost[col+1];
+	
+    for ( ; post < end ; post++) 
+    {
+	topscreen = sprtopscreen + spryscale*post->topdelta;
+	bottomscreen = topscreen + spryscale*post->length;
+
+	dc_yl = (topscreen+FRACUNIT-1)>>FRACBITS;
+	dc_yh = (bottomscreen-1)>>FRACBITS;
+		
+	if (dc_yh >= mfloorclip[dc_x])
+	    dc_yh = mfloorclip[dc_x]-1;
+	if (dc_yl <= mceilingclip[dc_x])
+	    dc_yl = mceilingclip[dc_x]+1;
+
+	if (dc_yl <= dc_yh)
+	{
+	    dc_source = sprite->pixels + post->ofs;
+	    dc_texturemid = basetexturemid - (post->topdelta<<FRACBITS);
+	    colfunc ();	
+	    if (rlabels)
+		R_LabelPost (rlabel);
+	}
+    }
+	
+    dc_texturemid = basetexturemid;
+}
+
+
+
 //
 // R_DrawVisSprite
 //  mfloorclip and mceilingclip should also be set.
@@ -399,30 +794,44 @@ R_DrawVisSprite
   int			x1,
   int			x2 )
 {
-    column_t*		column;
     int			texturecolumn;
     fixed_t		frac;
-    patch_t*		patch;
+    rsprite_t*		sprite;
+    lighttable_t*	translated;
 	
 	
-    patch = W_CacheLumpNum (vis->patch+firstspritelump, PU_CACHE);
+    sprite = R_GetSprite (vis->patch);
 
     dc_colormap = vis->colormap;
     
-    if (!dc_colormap)
+    if (!dc_colormap && plainshadows)
+    {
+	// shadow drawn solid, with the basecolfunc
+	dc_colormap = colormaps + PLAINSHADOWMAP*256;
+    }
+    else if (!dc_colormap)
     {
 	// NULL colormap = shadow draw
 	colfunc = fuzzcolfunc;
     }
     else if (vis->mobjflags & MF_TRANSLATION)
     {
-	colfunc = R_DrawTranslatedColumn;
-	dc_translation = translationtables - 256 +
-	    ( (vis->mobjflags & MF_TRANSLATION) >> (MF_TRANSSHIFT-8) );
+	// UBO: a fused translation and light table draws like any other
+	translated = R_TranslatedColormap
+	    ((vis->mobjflags & MF_TRANSLATION) >> MF_TRANSSHIFT, dc_colormap);
+	if (translated)
+	    dc_colormap = translated;
+	else
+	{
+	    colfunc = transcolfunc;
+	    dc_translation = translationtables - 256 +
+		( (vis->mobjflags & MF_TRANSLATION) >> (MF_TRANSSHIFT-8) );
+	}
     }
 	
     dc_iscale = abs(vis->xiscale)>>detailshift;
     dc_texturemid = vis->texturemid;
+    rlabel = vis->label;
     frac = vis->startfrac;
     spryscale = vis->scale;
     sprtopscreen = centeryfrac - FixedMul(dc_texturemid,spryscale);
@@ -431,13 +840,12 @@ R_DrawVisSprite
     {
 	texturecolumn = frac>>FRACBITS;
 #ifdef RANGECHECK
-	if (texturecolumn < 0 || texturecolumn >= SHORT(patch->width))
+	if (texturecolumn < 0 || texturecolumn >= sprite->width)
 	    I_Error ("R_DrawSpriteRange: bad texturecolumn");
 #endif
-	column = (column_t *) ((byte *)patch +
-			       LONG(patch->columnofs[texturecolumn]));
-	R_DrawMaskedColumn (column);
+	R_DrawSpriteColumn (sprite, texturecolumn);
     }
+    R_FlushQuad ();
 
     colfunc = basecolfunc;
 }
@@ -445,121 +853,235 @@ R_DrawVisSprite
 
 
 //
-// R_ProjectSprite
-// Generates a vissprite for a thing
-//  if it might be visible.
+// SPRITE PROJECTION
+// UBO: R_ProjectThings transforms every thing in the level once a
+//  frame, before the strips start, into tables laid out sector by
+//  sector in thinglist order.  Things behind the view plane or too
+//  far off the side are rejected there, before any division or
+//  rotation lookup, and the rotation angles of the rest go through
+//  R_PointToAngles in one batch.  R_AddSprites then only clips a
+//  projection to its strip, so strips that see the same sector no
+//  longer each transform its things over again.
 //
-void R_ProjectSprite (mobj_t* thing)
+static int*	sectorproj;	// sector s: its first thing's slot
+static int	numsectorproj;
+
+static void*	projblock;	// the tables below, in one allocation
+static int	maxproj;
+
+static mobj_t**	projthing;
+static fixed_t*	projx;		// interpolated position
+static fixed_t*	projy;
+static fixed_t*	projz;
+static fixed_t*	projtx;		// view space offset from the centre
+static fixed_t*	projscale;	// 0 = rejected
+static int*	projx1;		// view columns, unclipped
+static int*	projx2;
+static int*	projlump;
+static byte*	projflip;
+
+// the rotating things, packed for R_PointToAngles
+static int*	rotslot;
+static fixed_t*	rotx;
+static fixed_t*	roty;
+static angle_t*	rotangle;
+
+#define PROJBYTES	(sizeof(mobj_t *) + 9*sizeof(fixed_t) + 2*sizeof(int) \
+			 + sizeof(angle_t) + sizeof(int) + 1)
+
+
+//
+// R_GrowProjections
+// Room for count things; the tables hold nothing between frames.
+//
+static void R_GrowProjections (int count)
+{
+    int		size;
+    byte*	p;
+
+    if (count <= maxproj)
+	return;
+    for (size = maxproj ? maxproj : MAXVISSPRITES ; size < count ; size *= 2)
+	;
+    free (projblock);
+    projblock = malloc (size*PROJBYTES);
+    if (!projblock)
+	I_Error ("R_ProjectThings: no memory for %i things", count);
+    maxproj = size;
+
+    p = projblock;
+    projthing = (mobj_t **)p;	p += size*sizeof(mobj_t *);
+    projx = (fixed_t *)p;	p += size*sizeof(fixed_t);
+    projy = (fixed_t *)p;	p += size*sizeof(fixed_t);
+    projz = (fixed_t *)p;	p += size*sizeof(fixed_t);
+    projtx = (fixed_t *)p;	p += size*sizeof(fixed_t);
+    projscale = (fixed_t *)p;	p += size*sizeof(fixed_t);
+    rotx = (fixed_t *)p;	p += size*sizeof(fixed_t);
+    roty = (fixed_t *)p;	p += size*sizeof(fixed_t);
+    projx1 = (int *)p;		p += size*sizeof(int);
+    projx2 = (int *)p;		p += size*sizeof(int);
+    projlump = (int *)p;	p += size*sizeof(int);
+    rotslot = (int *)p;		p += size*sizeof(int);
+    rotangle = (angle_t *)p;	p += size*sizeof(angle_t);
+    projflip = p;
+}
+
+
+//
+// R_ProjectThings
+// The frame's projections for ctx; R_RenderView, before the strips.
+//
+void R_ProjectThings (render_context_t* ctx)
 {
+    sector_t*		sec;
+    mobj_t*		thing;
+    spriteframe_t*	sprframe;
     fixed_t		tr_x;
     fixed_t		tr_y;
-    
-    fixed_t		gxt;
-    fixed_t		gyt;
-    
-    fixed_t		tx;
     fixed_t		tz;
-
+    fixed_t		tx;
     fixed_t		xscale;
-    
-    int			x1;
-    int			x2;
-
-    spritedef_t*	sprdef;
-    spriteframe_t*	sprframe;
-    int			lump;
-    
     unsigned		rot;
-    boolean		flip;
-    
-    int			index;
+    int			lump;
+    int			count;
+    int			numrot;
+    int			i;
+    int			n;
 
-    vissprite_t*	vis;
-    
-    angle_t		ang;
-    fixed_t		iscale;
-    
-    // transform the origin point
-    tr_x = thing->x - viewx;
-    tr_y = thing->y - viewy;
-	
-    gxt = FixedMul(tr_x,viewcos); 
-    gyt = -FixedMul(tr_y,viewsin);
-    
-    tz = gxt-gyt; 
+    if (numsectors > numsectorproj)
+    {
+	free (sectorproj);
+	sectorproj = malloc (numsectors*sizeof(*sectorproj));
+	if (!sectorproj)
+	    I_Error ("R_ProjectThings: no memory for %i sectors", numsectors);
+	numsectorproj = numsectors;
+    }
 
-    // thing is behind view plane?
-    if (tz < MINZ)
-	return;
-    
-    xscale = FixedDiv(projection, tz);
-	
-    gxt = -FixedMul(tr_x,viewsin); 
-    gyt = FixedMul(tr_y,viewcos); 
-    tx = -(gyt+gxt); 
+    count = 0;
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+	for (thing = sec->thinglist ; thing ; thing = thing->snext)
+	    count++;
+    R_GrowProjections (count);
 
-    // too far off the side?
-    if (abs(tx)>(tz<<2))
-	return;
-    
-    // decide which patch to use for sprite relative to player
-#ifdef RANGECHECK
-    if ((unsigned)thing->sprite >= numsprites)
-	I_Error ("R_ProjectSprite: invalid sprite number %i ",
-		 thing->sprite);
-#endif
-    sprdef = &sprites[thing->sprite];
+    // transform the origins, and reject what can't be seen
+    n = numrot = 0;
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	sectorproj[i] = n;
+	for (thing = sec->thinglist ; thing ; thing = thing->snext, n++)
+	{
+	    projthing[n] = thing;
+	    projscale[n] = 0;
+	    R_InterpolateMobj (thing, &projx[n], &projy[n], &projz[n]);
+
+	    tr_x = projx[n] - ctx->viewx;
+	    tr_y = projy[n] - ctx->viewy;
+	    tz = FixedMul(tr_x,ctx->viewcos) + FixedMul(tr_y,ctx->viewsin);
+
+	    // thing is behind view plane?
+	    if (tz < MINZ)
+		continue;
+
+	    tx = FixedMul(tr_x,ctx->viewsin) - FixedMul(tr_y,ctx->viewcos);
+
+	    // too far off the side?
+	    if (abs(tx)>(tz<<2))
+		continue;
+
+	    projtx[n] = tx;
+	    projscale[n] = FixedDiv(projection, tz);
+
+	    // decide which patch to use for sprite relative to player
 #ifdef RANGECHECK
-    if ( (thing->frame&FF_FRAMEMASK) >= sprdef->numframes )
-	I_Error ("R_ProjectSprite: invalid sprite frame %i : %i ",
-		 thing->sprite, thing->frame);
+	    if ((unsigned)thing->sprite >= numsprites)
+		I_Error ("R_ProjectSprite: invalid sprite number %i ",
+			 thing->sprite);
+	    if ( (thing->frame&FF_FRAMEMASK) >= sprites[thing->sprite].numframes )
+		I_Error ("R_ProjectSprite: invalid sprite frame %i : %i ",
+			 thing->sprite, thing->frame);
 #endif
-    sprframe = &sprdef->spriteframes[ thing->frame & FF_FRAMEMASK];
+	    sprframe = &sprites[thing->sprite].spriteframes[thing->frame & FF_FRAMEMASK];
+	    if (sprframe->rotate)
+	    {
+		rotslot[numrot] = n;
+		rotx[numrot] = projx[n];
+		roty[numrot] = projy[n];
+		numrot++;
+	    }
+	    else
+	    {
+		// use single rotation for all views
+		projlump[n] = sprframe->lump[0];
+		projflip[n] = sprframe->flip[0];
+	    }
+	}
+    }
 
-    if (sprframe->rotate)
+    // choose a different rotation based on player view
+    R_PointToAngles (rotx, roty, rotangle, numrot);
+    for (i=0 ; i<numrot ; i++)
     {
-	// choose a different rotation based on player view
-	ang = R_PointToAngle (thing->x, thing->y);
-	rot = (ang-thing->angle+(unsigned)(ANG45/2)*9)>>29;
-	lump = sprframe->lump[rot];
-	flip = (boolean)sprframe->flip[rot];
+	thing = projthing[rotslot[i]];
+	sprframe = &sprites[thing->sprite].spriteframes[thing->frame & FF_FRAMEMASK];
+	rot = (rotangle[i]-thing->angle+(unsigned)(ANG45/2)*9)>>29;
+	projlump[rotslot[i]] = sprframe->lump[rot];
+	projflip[rotslot[i]] = sprframe->flip[rot];
     }
-    else
+
+    // calculate edges of the shape
+    for (i=0 ; i<n ; i++)
     {
-	// use single rotation for all views
-	lump = sprframe->lump[0];
-	flip = (boolean)sprframe->flip[0];
+	xscale = projscale[i];
+	if (!xscale)
+	    continue;
+	lump = projlump[i];
+	tx = projtx[i] - spriteoffset[lump];
+	projx1[i] = (centerxfrac + FixedMul (tx,xscale) ) >>FRACBITS;
+	tx += spritewidth[lump];
+	projx2[i] = ((centerxfrac + FixedMul (tx,xscale) ) >>FRACBITS) - 1;
+
+	// off the view?
+	if (projx1[i] >= viewwidth || projx2[i] < 0)
+	    projscale[i] = 0;
     }
-    
-    // calculate edges of the shape
-    tx -= spriteoffset[lump];	
-    x1 = (centerxfrac + FixedMul (tx,xscale) ) >>FRACBITS;
+}
 
-    // off the right side?
-    if (x1 > viewwidth)
-	return;
-    
-    tx +=  spritewidth[lump];
-    x2 = ((centerxfrac + FixedMul (tx,xscale) ) >>FRACBITS) - 1;
 
-    // off the left side
-    if (x2 < 0)
+
+//
+// R_ProjectSprite
+// Generates a vissprite for a thing
+//  if it might be visible in the strip.
+//
+static void R_ProjectSprite (mobj_t* thing, int slot)
+{
+    fixed_t		xscale = projscale[slot];
+    int			x1 = projx1[slot];
+    int			x2 = projx2[slot];
+    int			lump = projlump[slot];
+    int			index;
+    vissprite_t*	vis;
+    fixed_t		iscale;
+
+    // off the strip?
+    if (x1 > rstripx2 || x2 < rstripx1)
 	return;
     
     // store information in a vissprite
     vis = R_NewVisSprite ();
     vis->mobjflags = thing->flags;
+    vis->label = thing->type + 1;
     vis->scale = xscale<<detailshift;
-    vis->gx = thing->x;
-    vis->gy = thing->y;
-    vis->gz = thing->z;
-    vis->gzt = thing->z + spritetopoffset[lump];
+    vis->gx = projx[slot];
+    vis->gy = projy[slot];
+    vis->gz = projz[slot];
+    vis->gzt = projz[slot] + spritetopoffset[lump];
     vis->texturemid = vis->gzt - viewz;
-    vis->x1 = x1 < 0 ? 0 : x1;
-    vis->x2 = x2 >= viewwidth ? viewwidth-1 : x2;	
+    vis->x1 = x1 < rstripx1 ? rstripx1 : x1;
+    vis->x2 = x2 > rstripx2 ? rstripx2 : x2;	
     iscale = FixedDiv (FRACUNIT, xscale);
 
-    if (flip)
+    if (projflip[slot])
     {
 	vis->startfrac = spritewidth[lump]-1;
 	vis->xiscale = -iscale;
@@ -614,16 +1136,27 @@ void R_AddSprites (sector_t* sec)
 {
     mobj_t*		thing;
     int			lightnum;
+    int			slot;
 
     // BSP is traversed by subsector.
     // A sector might have been split into several
     //  subsectors during BSP building.
     // Thus we check whether its already added.
-    if (sec->validcount == validcount)
-	return;		
+    // Render threads keep their own marks (r_main.c).
+    if (rsectorstamp)
+    {
+	if (rsectorstamp[sec-sectors] == validcount)
+	    return;
+	rsectorstamp[sec-sectors] = validcount;
+    }
+    else
+    {
+	if (sec->validcount == validcount)
+	    return;		
 
-    // Well, now it will be done.
-    sec->validcount = validcount;
+	// Well, now it will be done.
+	sec->validcount = validcount;
+    }
 	
     lightnum = (sec->lightlevel >> LIGHTSEGSHIFT)+extralight;
 
@@ -634,9 +1167,11 @@ void R_AddSprites (sector_t* sec)
     else
 	spritelights = scalelight[lightnum];
 
-    // Handle all things in sector.
-    for (thing = sec->thinglist ; thing ; thing = thing->snext)
-	R_ProjectSprite (thing);
+    // Handle all things in sector, as R_ProjectThings left them.
+    slot = sectorproj[sec-sectors];
+    for (thing = sec->thinglist ; thing ; thing = thing->snext, slot++)
+	if (projscale[slot])
+	    R_ProjectSprite (thing, slot);
 }
 
 
@@ -679,22 +1214,23 @@ void R_DrawPSprite (pspdef_t* psp)
     x1 = (centerxfrac + FixedMul (tx,pspritescale) ) >>FRACBITS;
 
     // off the right side
-    if (x1 > viewwidth)
+    if (x1 > rstripx2)
 	return;		
 
     tx +=  spritewidth[lump];
     x2 = ((centerxfrac + FixedMul (tx, pspritescale) ) >>FRACBITS) - 1;
 
     // off the left side
-    if (x2 < 0)
+    if (x2 < rstripx1)
 	return;
     
     // store information in a vissprite
     vis = &avis;
     vis->mobjflags = 0;
+    vis->label = R_LABEL_WEAPON;
     vis->texturemid = (BASEYCENTER<<FRACBITS)+FRACUNIT/2-(psp->sy-spritetopoffset[lump]);
-    vis->x1 = x1 < 0 ? 0 : x1;
-    vis->x2 = x2 >= viewwidth ? viewwidth-1 : x2;	
+    vis->x1 = x1 < rstripx1 ? rstripx1 : x1;
+    vis->x2 = x2 > rstripx2 ? rstripx2 : x2;	
     vis->scale = pspritescale<<detailshift;
     
     if (flip)
@@ -780,62 +1316,182 @@ void R_DrawPlayerSprites (void)
 
 //
 // R_SortVisSprites
+// Links the vissprites into vsprsortedhead by ascending scale, those
+//  of equal scale in the order they were projected, which is what the
+//  old selection sort did without its count squared compares.  Short
+//  lists are insertion sorted; longer ones take stable radix passes
+//  over the scale a byte at a time, skipping bytes every key shares.
 //
-vissprite_t	vsprsortedhead;
+#define VSPRINSERTION	32
+
+RTHREAD vissprite_t	vsprsortedhead;
 
 
 void R_SortVisSprites (void)
 {
     int			i;
+    int			j;
     int			count;
+    int			shift;
     vissprite_t*	ds;
-    vissprite_t*	best;
-    vissprite_t		unsorted;
-    fixed_t		bestscale;
+    vissprite_t**	order;
+    vissprite_t**	spare;
+    vissprite_t**	swap;
+    unsigned		key;
+    unsigned		diff;
+    int			counts[256];
 
     count = vissprite_p - vissprites;
 	
-    unsorted.next = unsorted.prev = &unsorted;
+    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
 
     if (!count)
 	return;
-		
-    for (ds=vissprites ; ds<vissprite_p ; ds++)
+
+    while (maxvsprorder < count)
+	vsprorder = I_GrowArray (vsprorder, &maxvsprorder,
+				 2*sizeof(*vsprorder), MAXVISSPRITES,
+				 "vissprite sort slots");
+    order = vsprorder;
+    spare = vsprorder + maxvsprorder;
+
+    for (i=0 ; i<count ; i++)
+	order[i] = &vissprites[i];
+	
+    if (count <= VSPRINSERTION)
     {
-	ds->next = ds+1;
-	ds->prev = ds-1;
+	for (i=1 ; i<count ; i++)
+	{
+	    ds = order[i];
+	    for (j=i ; j>0 && order[j-1]->scale > ds->scale ; j--)
+		order[j] = order[j-1];
+	    order[j] = ds;
+	}
     }
-    
-    vissprites[0].prev = &unsorted;
-    unsorted.next = &vissprites[0];
-    (vissprite_p-1)->next = &unsorted;
-    unsorted.prev = vissprite_p-1;
-    
-    // pull the vissprites out by scale
-    //best = 0;		// shut up the compiler warning
-    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
-    for (i=0 ; i<count ; i++)
+    else
     {
-	bestscale = MAXINT;
-	for (ds=unsorted.next ; ds!= &unsorted ; ds=ds->next)
+	// flipping the sign bit makes signed order unsigned order
+	diff = 0;
+	key = (unsigned)order[0]->scale;
+	for (i=1 ; i<count ; i++)
+	    diff |= (unsigned)order[i]->scale ^ key;
+	
+	for (shift=0 ; shift<32 ; shift+=8)
 	{
-	    if (ds->scale < bestscale)
+	    if (!((diff >> shift) & 0xff))
+		continue;
+	    
+	    memset (counts, 0, sizeof(counts));
+	    for (i=0 ; i<count ; i++)
+		counts[(((unsigned)order[i]->scale ^ 0x80000000) >> shift) & 0xff]++;
+	    for (i=0, j=0 ; i<256 ; i++)
 	    {
-		bestscale = ds->scale;
-		best = ds;
+		key = counts[i];
+		counts[i] = j;
+		j += key;
 	    }
+	    for (i=0 ; i<count ; i++)
+	    {
+		ds = order[i];
+		spare[counts[(((unsigned)ds->scale ^ 0x80000000) >> shift) & 0xff]++] = ds;
+	    }
+	    swap = order;
+	    order = spare;
+	    spare = swap;
 	}
-	best->next->prev = best->prev;
-	best->prev->next = best->next;
-	best->next = &vsprsortedhead;
-	best->prev = vsprsortedhead.prev;
-	vsprsortedhead.prev->next = best;
-	vsprsortedhead.prev = best;
     }
+
+    // link them up, back to front
+    for (i=0 ; i<count ; i++)
+    {
+	order[i]->prev = i ? order[i-1] : &vsprsortedhead;
+	order[i]->next = i<count-1 ? order[i+1] : &vsprsortedhead;
+    }
+    vsprsortedhead.next = order[0];
+    vsprsortedhead.prev = order[count-1];
 }
 
 
 
+//
+// R_IndexDrawSegs
+// Only drawsegs with a silhouette or a masked mid texture can
+//  matter to a sprite.  They are filed by the 32-column slices of
+//  the view they touch, each slice newest first as the drawseg scan
+//  in R_DrawSprite visits them, so a sprite only walks the slices
+//  under it instead of every drawseg of the frame.
+//
+static void R_IndexDrawSegs (void)
+{
+    drawseg_t*	ds;
+    int		fill[MAXDSSLICES];
+    int		total;
+    int		s;
+
+    memset (fill, 0, sizeof(fill));
+    total = 0;
+    for (ds=ds_p-1 ; ds >= drawsegs ; ds--)
+    {
+	if (!ds->silhouette && !ds->maskedtexturecol)
+	    continue;
+	for (s = ds->x1>>DSSLICESHIFT ; s <= ds->x2>>DSSLICESHIFT ; s++)
+	    fill[s]++;
+	total += (ds->x2>>DSSLICESHIFT) - (ds->x1>>DSSLICESHIFT) + 1;
+    }
+
+    while (maxdsslice < total)
+	dsslice = I_GrowArray (dsslice, &maxdsslice, sizeof(*dsslice),
+			       MAXDRAWSEGS, "drawseg slices");
+
+    dsslicestart[0] = 0;
+    for (s=0 ; s<MAXDSSLICES ; s++)
+    {
+	dsslicestart[s+1] = dsslicestart[s] + fill[s];
+	fill[s] = dsslicestart[s];
+    }
+
+    for (ds=ds_p-1 ; ds >= drawsegs ; ds--)
+    {
+	if (!ds->silhouette && !ds->maskedtexturecol)
+	    continue;
+	for (s = ds->x1>>DSSLICESHIFT ; s <= ds->x2>>DSSLICESHIFT ; s++)
+	    dsslice[fill[s]++] = ds - drawsegs;
+    }
+}
+
+
+//
+// R_NextDrawSeg
+// The newest drawseg left in the slices s1..s2, each cursor at the
+//  next entry of its slice, or NULL when they are all used up.  A
+//  drawseg across several slices is taken off all of them at once.
+//
+static drawseg_t* R_NextDrawSeg (int* cursor, int s1, int s2)
+{
+    int		best;
+    int		s;
+    int		c;
+
+    best = -1;
+    for (s=s1 ; s<=s2 ; s++)
+    {
+	c = cursor[s-s1];
+	if (c < dsslicestart[s+1] && dsslice[c] > best)
+	    best = dsslice[c];
+    }
+    if (best < 0)
+	return NULL;
+
+    for (s=s1 ; s<=s2 ; s++)
+    {
+	c = cursor[s-s1];
+	if (c < dsslicestart[s+1] && dsslice[c] == best)
+	    cursor[s-s1]++;
+    }
+    return drawsegs + best;
+}
+
+
 //
 // R_DrawSprite
 //
@@ -844,12 +1500,16 @@ void R_DrawSprite (vissprite_t* spr)
     drawseg_t*		ds;
     short		clipbot[SCREENWIDTH];
     short		cliptop[SCREENWIDTH];
+    int			cursor[MAXDSSLICES];
     int			x;
     int			r1;
     int			r2;
+    int			s1;
+    int			s2;
     fixed_t		scale;
     fixed_t		lowscale;
     int			silhouette;
+    boolean		visible;
 		
     for (x = spr->x1 ; x<=spr->x2 ; x++)
 	clipbot[x] = cliptop[x] = -2;
@@ -857,13 +1517,17 @@ void R_DrawSprite (vissprite_t* spr)
     // Scan drawsegs from end to start for obscuring segs.
     // The first drawseg that has a greater scale
     //  is the clip seg.
-    for (ds=ds_p-1 ; ds >= drawsegs ; ds--)
+    // Only the ones filed under the sprite's slices are looked at.
+    s1 = spr->x1>>DSSLICESHIFT;
+    s2 = spr->x2>>DSSLICESHIFT;
+    for (x=s1 ; x<=s2 ; x++)
+	cursor[x-s1] = dsslicestart[x];
+
+    while ( (ds = R_NextDrawSeg (cursor, s1, s2)) )
     {
 	// determine if the drawseg obscures the sprite
 	if (ds->x1 > spr->x2
-	    || ds->x2 < spr->x1
-	    || (!ds->silhouette
-		&& !ds->maskedtexturecol) )
+	    || ds->x2 < spr->x1)
 	{
 	    // does not cover sprite
 	    continue;
@@ -935,6 +1599,7 @@ void R_DrawSprite (vissprite_t* spr)
     // all clipping has been performed, so draw the sprite
 
     // check for unclipped columns
+    visible = false;
     for (x = spr->x1 ; x<=spr->x2 ; x++)
     {
 	if (clipbot[x] == -2)		
@@ -942,7 +1607,14 @@ void R_DrawSprite (vissprite_t* spr)
 
 	if (cliptop[x] == -2)
 	    cliptop[x] = -1;
+
+	if (clipbot[x] - cliptop[x] > 1)
+	    visible = true;
     }
+
+    // walls cover every column: no post could get a pixel out
+    if (!visible)
+	return;
 		
     mfloorclip = clipbot;
     mceilingclip = cliptop;
@@ -960,10 +1632,16 @@ void R_DrawMasked (void)
     vissprite_t*	spr;
     drawseg_t*		ds;
 	
+    if (!rstripx1)
+	UBO_PROF_BEGIN(UBO_PROF_SPRITESORT);
     R_SortVisSprites ();
+    if (!rstripx1)
+	UBO_PROF_END(UBO_PROF_SPRITESORT);
 
     if (vissprite_p > vissprites)
     {
+	R_IndexDrawSegs ();
+
 	// draw all vissprites back to front
 	for (spr = vsprsortedhead.next ;
 	     spr != &vsprsortedhead ;
@@ -23,16 +23,20 @@
 #ifndef __R_THINGS__
 #define __R_THINGS__
 
+#include "r_main.h"
+
 
 #ifdef __GNUG__
 #pragma interface
 #endif
 
+// Starting size of the growable vissprite pool.
 #define MAXVISSPRITES  	128
 
-extern vissprite_t	vissprites[MAXVISSPRITES];
-extern vissprite_t*	vissprite_p;
-extern vissprite_t	vsprsortedhead;
+extern RTHREAD vissprite_t*	vissprites;
+extern RTHREAD vissprite_t*	vissprite_p;
+extern int			visspritepeak;
+extern RTHREAD vissprite_t	vsprsortedhead;
 
 // Constant arrays used for psprite clipping
 //  and initializing clipping.
@@ -40,14 +44,28 @@ extern short		negonearray[SCREENWIDTH];
 extern short		screenheightarray[SCREENWIDTH];
 
 // vars for R_DrawMaskedColumn
-extern short*		mfloorclip;
-extern short*		mceilingclip;
-extern fixed_t		spryscale;
-extern fixed_t		sprtopscreen;
+extern RTHREAD short*		mfloorclip;
+extern RTHREAD short*		mceilingclip;
+extern RTHREAD fixed_t		spryscale;
+extern RTHREAD fixed_t		sprtopscreen;
 
 extern fixed_t		pspritescale;
 extern fixed_t		pspriteiscale;
 
+// Shadow sprites (spectres, invisible players) drawn solid through
+//  a dark colormap instead of fuzzed; the quality governor sets it.
+extern int		plainshadows;
+
+// UBO: label buffer (doom_set_aux_buffers), NULL when off.  Every sprite
+//  post drawn writes its vissprite's label over the view pixels it
+//  covers and every masked mid texture post writes R_LABEL_NONE, so at
+//  the end of the frame each pixel holds the sprite seen there.  Rows
+//  are SCREENWIDTH apart; R_RenderView clears the view first.
+#define R_LABEL_NONE	0	// no sprite: walls, flats, masked textures
+#define R_LABEL_WEAPON	255	// the player's own weapon sprite
+				// a thing: its mobjtype_t + 1
+extern byte*		rlabels;
+
 
 void R_DrawMaskedColumn (column_t* column);
 
@@ -55,10 +73,15 @@ void R_DrawMaskedColumn (column_t* column);
 void R_SortVisSprites (void);
 
 void R_AddSprites (sector_t* sec);
+// The frame's thing projections R_AddSprites draws on, made once for
+//  all the strips (R_RenderView, with ctx loaded).
+void R_ProjectThings (render_context_t* ctx);
 void R_AddPSprites (void);
 void R_DrawSprites (void);
 void R_InitSprites (char** namelist);
 void R_ClearSprites (void);
+void R_FreeSprites (void);
+void R_FreeSpriteData (void);
 void R_DrawMasked (void);
 
 void
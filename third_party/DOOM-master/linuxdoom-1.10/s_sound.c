@@ -76,6 +76,12 @@ const char snd_prefixen[]
 // percent attenuation from front to back
 #define S_IFRACVOL		30
 
+// S_UpdateSounds leaves a channel's params alone until the listener
+//  or the origin has moved or turned by more than this.  About one
+//  volume step and one stereo separation step.
+#define S_MOVE_THRESHOLD	(4*FRACUNIT)
+#define S_TURN_THRESHOLD	(ANG45/45)
+
 #define NA			0
 #define S_NUMCHANNELS		2
 
@@ -100,6 +106,15 @@ typedef struct
 
     // handle of the sound being played
     int		handle;
+
+    // listener and origin as of the last params update,
+    //  sfxvolume -1 until the first one
+    fixed_t	listenx;
+    fixed_t	listeny;
+    angle_t	listenangle;
+    fixed_t	originx;
+    fixed_t	originy;
+    int		sfxvolume;
     
 } channel_t;
 
@@ -120,6 +135,10 @@ int 		snd_MusicVolume = 15;
 // whether songs are mus_paused
 static boolean		mus_paused;	
 
+// UBO: S_SetQuiet state, and whether it did the pausing
+static boolean		s_quiet;
+static boolean		s_quietpaused;
+
 // music currently being played
 static musicinfo_t*	mus_playing=0;
 
@@ -186,6 +205,15 @@ void S_Init
   // no sounds are playing, and they are not mus_paused
   mus_paused = 0;
 
+  // A previous session's song went with its zone, and its lump
+  // numbers with its WAD directory.
+  mus_playing = 0;
+  for (i=1 ; i<NUMMUSIC ; i++)
+  {
+    S_music[i].lumpnum = 0;
+    S_music[i].data = 0;
+  }
+
   // Note that sounds have not been cached (yet).
   for (i=1 ; i<NUMSFX ; i++)
     S_sfx[i].lumpnum = S_sfx[i].usefulness = -1;
@@ -194,6 +222,19 @@ void S_Init
 
 
 
+//
+// Kills every playing sound effect.
+//
+void S_StopSounds(void)
+{
+  int cnum;
+
+  for (cnum=0 ; cnum<numChannels ; cnum++)
+    if (channels[cnum].sfxinfo)
+      S_StopChannel(cnum);
+}
+
+
 //
 // Per level startup code.
 // Kills playing sounds at start of level,
@@ -201,14 +242,11 @@ void S_Init
 //
 void S_Start(void)
 {
-  int cnum;
   int mnum;
 
   // kill all playing sounds at start of level
   //  (trust me - a good idea)
-  for (cnum=0 ; cnum<numChannels ; cnum++)
-    if (channels[cnum].sfxinfo)
-      S_StopChannel(cnum);
+  S_StopSounds();
   
   // start new music for the level
   mus_paused = 0;
@@ -276,6 +314,9 @@ S_StartSoundAtVolume
   // check for bogus sound #
   if (sfx_id < 1 || sfx_id > NUMSFX)
     I_Error("Bad sfx #: %d", sfx_id);
+
+  if (s_quiet)
+    return;
   
   sfx = &S_sfx[sfx_id];
   
@@ -327,7 +368,7 @@ S_StartSoundAtVolume
   if (sfx_id >= sfx_sawup
       && sfx_id <= sfx_sawhit)
   {	
-    pitch += 8 - (M_Random()&15);
+    pitch += 8 - (M_StreamRandom(rs_sound)&15);
     
     if (pitch<0)
       pitch = 0;
@@ -337,7 +378,7 @@ S_StartSoundAtVolume
   else if (sfx_id != sfx_itemup
 	   && sfx_id != sfx_tink)
   {
-    pitch += 16 - (M_Random()&31);
+    pitch += 16 - (M_StreamRandom(rs_sound)&31);
     
     if (pitch<0)
       pitch = 0;
@@ -364,21 +405,7 @@ S_StartSoundAtVolume
   if (sfx->lumpnum < 0)
     sfx->lumpnum = I_GetSfxLumpNum(sfx);
 
-#ifndef SNDSRV
-  // cache data if necessary
-  if (!sfx->data)
-  {
-    fprintf( stderr,
-	     "S_StartSoundAtVolume: 16bit and not pre-cached - wtf?\n");
-
-    // DOS remains, 8bit handling
-    //sfx->data = (void *) W_CacheLumpNum(sfx->lumpnum, PU_MUSIC);
-    // fprintf( stderr,
-    //	     "S_StartSoundAtVolume: loading %d (lump %d) : 0x%x\n",
-    //       sfx_id, sfx->lumpnum, (int)sfx->data );
-    
-  }
-#endif
+  // sfx->data is loaded by I_StartSound on first use.
   
   // increase the usefulness
   if (sfx->usefulness++ < 0)
@@ -503,6 +530,24 @@ void S_PauseSound(void)
     }
 }
 
+void S_SetQuiet(int quiet)
+{
+    quiet = quiet != 0;
+    if (quiet == s_quiet)
+	return;
+    s_quiet = quiet;
+    if (quiet)
+    {
+	s_quietpaused = mus_playing && !mus_paused;
+	S_PauseSound();
+    }
+    else if (s_quietpaused)
+    {
+	s_quietpaused = false;
+	S_ResumeSound();
+    }
+}
+
 void S_ResumeSound(void)
 {
     if (mus_playing && mus_paused)
@@ -513,9 +558,44 @@ void S_ResumeSound(void)
 }
 
 
+//
+// S_ChannelMoved
+// Whether the listener or the channel's origin moved or turned
+//  past the thresholds, or the sfx volume changed, since the
+//  channel's params were last set.
+//
+static boolean S_ChannelMoved(channel_t* c, mobj_t* listener)
+{
+    mobj_t*	source = (mobj_t*)c->origin;
+    angle_t	turn = listener->angle - c->listenangle;
+
+    if (c->sfxvolume != snd_SfxVolume)
+	return true;
+    if (turn > S_TURN_THRESHOLD && -turn > S_TURN_THRESHOLD)
+	return true;
+    return abs(listener->x - c->listenx) > S_MOVE_THRESHOLD
+	|| abs(listener->y - c->listeny) > S_MOVE_THRESHOLD
+	|| abs(source->x - c->originx) > S_MOVE_THRESHOLD
+	|| abs(source->y - c->originy) > S_MOVE_THRESHOLD;
+}
+
+static void S_ChannelSeen(channel_t* c, mobj_t* listener)
+{
+    mobj_t*	source = (mobj_t*)c->origin;
+
+    c->listenx = listener->x;
+    c->listeny = listener->y;
+    c->listenangle = listener->angle;
+    c->originx = source->x;
+    c->originy = source->y;
+    c->sfxvolume = snd_SfxVolume;
+}
+
+
 //
 // Updates music & sounds
 //
+//
 void S_UpdateSounds(void* listener_p)
 {
     int		audible;
@@ -583,6 +663,9 @@ void S_UpdateSounds(void* listener_p)
 		//  or modify their params
 		if (c->origin && listener_p != c->origin)
 		{
+		    if (!S_ChannelMoved(c, listener))
+			continue;
+
 		    audible = S_AdjustSoundParams(listener,
 						  c->origin,
 						  &volume,
@@ -594,7 +677,10 @@ void S_UpdateSounds(void* listener_p)
 			S_StopChannel(cnum);
 		    }
 		    else
+		    {
+			S_ChannelSeen(c, listener);
 			I_UpdateSoundParams(c->handle, volume, sep, pitch);
+		    }
 		}
 	    }
 	    else
@@ -870,6 +956,7 @@ S_getChannel
     // channel is decided to be cnum.
     c->sfxinfo = sfxinfo;
     c->origin = origin;
+    c->sfxvolume = -1;
 
     return cnum;
 }
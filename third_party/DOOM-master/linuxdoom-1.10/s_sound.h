@@ -91,6 +91,13 @@ void S_StopMusic(void);
 void S_PauseSound(void);
 void S_ResumeSound(void);
 
+// UBO: no new sound effects and music paused while true,
+//  for headless fast-forward (doom_simulate).
+void S_SetQuiet(int quiet);
+
+// Stops every playing effect (level start, doom_suspend).
+void S_StopSounds(void);
+
 
 //
 // Updates music & sounds
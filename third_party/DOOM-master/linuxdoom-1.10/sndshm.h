@@ -0,0 +1,57 @@
+#ifndef UBO_SNDSHM_H
+#define UBO_SNDSHM_H
+
+#include <stdint.h>
+
+// Shared memory between the engine and an out-of-process sndserver
+// (UBO_DOOM_SNDSERV).  The engine creates the block, unlinks its name and
+// hands the descriptor to the server as "-shmfd N".  Commands go one way,
+// engine to server, through a single-producer/single-consumer ring; the
+// server publishes what it is playing and its counters in the same block.
+// Both sides use the GCC __atomic builtins on head, tail and the flags.
+
+#define SNDSHM_MAGIC     0x534e4453u    // "SDNS"
+#define SNDSHM_VERSION   1
+#define SNDSHM_RING      256            // commands, a power of two
+#define SNDSHM_CHANNELS  8              // the server's mixer channels
+#define SNDSHM_SONGMAX   (128 * 1024)
+
+enum {
+    SNDCMD_PLAY = 1,        // a: sfx id, b: volume, c: separation, d: pitch, e: handle
+    SNDCMD_STOP,            // e: handle
+    SNDCMD_UPDATE,          // b, c, d as for PLAY, e: handle
+    SNDCMD_SONG,            // a: bytes of `song` holding a MUS lump
+    SNDCMD_SONGPLAY,        // a: looping
+    SNDCMD_SONGSTOP,
+    SNDCMD_SONGPAUSE,
+    SNDCMD_SONGRESUME,
+    SNDCMD_SONGFREE,
+    SNDCMD_MUSICVOLUME,     // a: 0..15
+    SNDCMD_QUIT,
+};
+
+typedef struct sndcmd_s {
+    int32_t op;
+    int32_t a, b, c, d, e;
+} sndcmd_t;
+
+typedef struct sndshm_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t head;                      // next free slot, engine
+    uint32_t tail;                      // next command to run, server
+    sndcmd_t cmd[SNDSHM_RING];
+
+    // written by the server
+    uint32_t ready;                     // the device is open
+    uint32_t heartbeat;                 // mix passes so far
+    uint32_t underruns;
+    int32_t rate;
+    int32_t playing[SNDSHM_CHANNELS];   // handles, 0 when idle
+    int32_t songplaying;
+
+    // written by the engine while the ring is empty
+    uint8_t song[SNDSHM_SONGMAX];
+} sndshm_t;
+
+#endif // UBO_SNDSHM_H
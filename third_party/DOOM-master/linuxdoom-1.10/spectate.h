@@ -0,0 +1,79 @@
+#ifndef UBO_SPECTATE_H
+#define UBO_SPECTATE_H
+
+#include <stdint.h>
+
+// Spectator mirroring over UDP (UBO_DOOM_MIRROR / UBO_DOOM_SPECTATE,
+// i_spectate_ubo.c).  Instead of frames, the game sends what d_net.c sends
+// between players: each tic's ticcmds, and once per session the state the
+// spectator starts it from.  The spectator runs the simulation and renders
+// it itself.  All fields are little-endian; every datagram is one
+// spectate_packet_t followed by `bytes` of payload.
+// - SPECTATE_START: a spectate_start_t.  A session is one G_InitNew on the
+//   game's side: a new game, a demo, or a savegame or rewind snapshot
+//   loaded (flagged SPECTATE_UNSYNCABLE, as a spectator can't rebuild it).
+//   Sent when the session begins, once a second after that, and ahead of
+//   any resend of tic 0.
+// - SPECTATE_TICS: `count` consecutive tics from `tic`, each
+//   SPECTATE_TIC_BYTES(players) long: a flags byte, then forwardmove,
+//   sidemove, angleturn (16 bits) and buttons for every player in the
+//   game, in player order.  Every tic goes out in SPECTATE_REDUNDANCY
+//   datagrams in a row, so a lost one costs nothing.  hash is
+//   P_StateHash() after tic hash_tic, the newest check point at or before
+//   the last tic in the datagram (hash_tic ~0u: none yet).
+// - SPECTATE_RESEND: from the spectator, to the address the game's
+//   datagrams came from: resend the session's tics from `tic` on (and the
+//   START, for tic 0).  The game keeps the last SPECTATE_HISTORY_TICS for
+//   this, so a spectator can join a session that is up to that old.
+
+#define SPECTATE_MAGIC          0x54424f55u     // "UBOT"
+#define SPECTATE_VERSION        1
+
+#define SPECTATE_REDUNDANCY     4
+#define SPECTATE_HASH_TICS      35              // a check point every second
+#define SPECTATE_HISTORY_TICS   (35 * 60 * 30)
+#define SPECTATE_MAX_PAYLOAD    1200            // under a typical path MTU
+#define SPECTATE_TIC_BYTES(players) (1 + 5 * (players))
+
+enum {
+    SPECTATE_START = 'S',
+    SPECTATE_TICS = 'T',
+    SPECTATE_RESEND = 'R',
+};
+
+// spectate_start_t.flags
+#define SPECTATE_UNSYNCABLE     1
+
+// per-tic flags byte
+#define SPECTATE_TIC_HELD       1       // the game's P_Ticker held for the menu
+
+typedef struct spectate_packet_s {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;               // SPECTATE_*
+    uint16_t bytes;             // payload that follows
+    uint32_t session;           // counts G_InitNew calls on the game's side
+    uint32_t tic;               // tics since the session began
+    uint16_t count;             // SPECTATE_TICS: tics in the payload
+    uint16_t pad;
+    uint32_t hash_tic;
+    uint32_t hash;
+} spectate_packet_t;
+
+typedef struct spectate_start_s {
+    uint8_t flags;              // SPECTATE_UNSYNCABLE
+    uint8_t skill;
+    uint8_t episode;
+    uint8_t map;
+    uint8_t deathmatch;
+    uint8_t respawn;
+    uint8_t fast;
+    uint8_t nomonsters;
+    uint8_t netgame;
+    uint8_t consoleplayer;
+    uint8_t playeringame[4];
+    uint16_t numlumps;          // a spectator on another WAD refuses the session
+    uint32_t prndindex;         // P_Random's index the level load starts at
+} spectate_start_t;
+
+#endif // UBO_SPECTATE_H
@@ -154,7 +154,13 @@ STlib_updateNum
 ( st_number_t*		n,
   boolean		refresh )
 {
-    if (*n->on) STlib_drawNum(n, refresh);
+    if (*n->on)
+    {
+	// numbers are redrawn every frame, but only a new one changes
+	if (refresh || n->oldnum != *n->num)
+	    st_changed = true;
+	STlib_drawNum(n, refresh);
+    }
 }
 
 
@@ -236,6 +242,7 @@ STlib_updateMultIcon
 	}
 	V_DrawPatch(mi->x, mi->y, FG, mi->p[*mi->inum]);
 	mi->oldinum = *mi->inum;
+	st_changed = true;
     }
 }
 
@@ -287,6 +294,7 @@ STlib_updateBinIcon
 	    V_CopyRect(x, y-ST_Y, BG, w, h, x, y, FG);
 
 	bi->oldval = *bi->val;
+	st_changed = true;
     }
 
 }
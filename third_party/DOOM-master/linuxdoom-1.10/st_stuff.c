@@ -272,6 +272,9 @@ static player_t*	plyr;
 // ST_Start() has just been called
 static boolean		st_firsttime;
 
+// something on the bar was drawn differently this frame
+boolean			st_changed;
+
 // used to execute ST_Init() only once
 static int		veryfirsttime = 1;
 
@@ -1110,6 +1113,7 @@ void ST_Drawer (boolean fullscreen, boolean refresh)
   
     st_statusbaron = (!fullscreen) || automapactive;
     st_firsttime = st_firsttime || refresh;
+    st_changed = st_firsttime;
 
     // Do red-/gold-shifts from damage/items
     ST_doPaletteStuff();
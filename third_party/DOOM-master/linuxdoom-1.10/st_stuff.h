@@ -47,6 +47,10 @@ void ST_Ticker (void);
 // Called by main loop.
 void ST_Drawer (boolean fullscreen, boolean refresh);
 
+// Set by ST_Drawer when it refreshed the bar or a widget showed a
+//  new value; otherwise the bar's rows are as the last frame left them.
+extern boolean st_changed;
+
 // Called when the console player is spawned on each level.
 void ST_Start (void);
 
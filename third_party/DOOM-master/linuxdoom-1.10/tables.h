@@ -83,6 +83,10 @@ typedef unsigned angle_t;
 //  without additional checking.
 extern angle_t		tantoangle[SLOPERANGE+1];
 
+// zlight colormap level for each light level / distance,
+//  [LIGHTLEVELS][MAXLIGHTZ] (r_main.h).
+extern const unsigned char	zlightlevels[16][128];
+
 
 // Utility function,
 //  called by R_PointToAngle.
@@ -0,0 +1,392 @@
+// ubodoom_bench: headless -timedemo runner for the libubodoom objects.
+//
+//   ubodoom_bench [-noconvert] [-o report.json] <iwad> [demo ...]
+//   ubodoom_bench -startup [-runs N] [-o report.json] <iwad>
+//
+// Plays each demo lump (default demo1 demo2 demo3) as fast as possible with
+// the RGB565 output path and the frame profiler enabled, then writes one JSON
+// report.  -noconvert skips I_FinishUpdate so the numbers cover the engine
+// alone.  Engine chatter goes to stderr; the report goes to stdout (or -o).
+//
+// -startup times doom_init() instead, end to end and per phase
+// (doom_init_phase_us()), each run in a fresh child process: N runs (default
+// 5) cold, with the IWAD, config and startup cache dropped from the page
+// cache first, and N warm, each with the ubodoom.rcache startup cache off and
+// on.  The config and cache live in a scratch directory, so the user's are
+// left alone.  Dropping the page cache takes root (/proc/sys/vm/drop_caches);
+// without it the files the engine reads are evicted with posix_fadvise, and
+// the report's "cold_method" says which.
+
+#include "doom_api.h"
+#include "ubodoom_tool.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_DEMOS 8
+
+#define STARTUP_MAX_RUNS 32
+#define STARTUP_MAX_PHASES 32
+#define STARTUP_MODES 4     // cold/warm x rcache off/on
+
+typedef struct bench_result_s {
+    const char* demo;
+    int ok;
+    ubo_timedemo_t timing;
+    double wall_s;
+    ubo_profile_t profile;
+} bench_result_t;
+
+static int bench_run_demo(bench_result_t* r, int blit)
+{
+    double t0;
+    int tics = 0;
+
+    if (doom_timedemo(r->demo, blit) != 0) return -1;
+    doom_reset_profile();
+
+    t0 = tool_now();
+    while (!doom_timedemo_result(&r->timing)) {
+        if (!doom_is_alive()) {
+            fprintf(stderr, "[bench] %s: engine died\n", r->demo);
+            return -1;
+        }
+        if (++tics > TOOL_MAX_TICS) {
+            fprintf(stderr, "[bench] %s: did not finish in %d tics\n", r->demo, TOOL_MAX_TICS);
+            return -1;
+        }
+        doom_tick();
+    }
+    r->wall_s = tool_now() - t0;
+    doom_get_profile(&r->profile);
+    r->ok = 1;
+    return 0;
+}
+
+static void bench_write_json(FILE* out, const char* iwad, int blit,
+                             const bench_result_t* res, int n)
+{
+    int i, s, b;
+
+    fprintf(out, "{\n  \"iwad\": \"%s\",\n  \"convert\": %s,\n  \"demos\": [",
+            iwad, blit ? "true" : "false");
+    for (i = 0; i < n; i++) {
+        const bench_result_t* r = &res[i];
+        double fps = r->timing.realtics ? r->timing.gametics * 35.0 / r->timing.realtics : 0.0;
+        double wall_fps = r->wall_s > 0 ? r->timing.gametics / r->wall_s : 0.0;
+
+        fprintf(out, "%s\n    {\"demo\": \"%s\", \"ok\": %s", i ? "," : "",
+                r->demo, r->ok ? "true" : "false");
+        if (!r->ok) {
+            fprintf(out, "}");
+            continue;
+        }
+        fprintf(out, ", \"gametics\": %u, \"realtics\": %u, \"fps\": %.2f,"
+                " \"wall_s\": %.3f, \"wall_fps\": %.2f,\n     \"stages\": {",
+                r->timing.gametics, r->timing.realtics, fps, r->wall_s, wall_fps);
+        for (s = 0; s < UBO_PROF_NUM_STAGES; s++) {
+            const ubo_prof_stat_t* st = &r->profile.stage[s];
+            double mean = st->calls ? (double)st->total_us / st->calls : 0.0;
+
+            fprintf(out, "%s\n       \"%s\": {\"calls\": %u, \"total_us\": %llu,"
+                    " \"mean_us\": %.1f, \"hist\": [",
+                    s ? "," : "", doom_prof_stage_name(s), st->calls,
+                    (unsigned long long)st->total_us, mean);
+            for (b = 0; b < UBO_PROF_BUCKETS; b++)
+                fprintf(out, "%s%u", b ? ", " : "", st->hist[b]);
+            fprintf(out, "]}");
+        }
+        fprintf(out, "}}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// One doom_init() timed in a child process.
+typedef struct startup_run_s {
+    int ok;
+    double init_ms;
+    int phase_us[STARTUP_MAX_PHASES];
+} startup_run_t;
+
+typedef struct startup_mode_s {
+    int cold;
+    int rcache;
+    int n;
+    startup_run_t runs[STARTUP_MAX_RUNS];
+} startup_mode_t;
+
+typedef struct startup_env_s {
+    const char* iwad;
+    char dir[64];
+    char config[128];
+    char rcache[128];
+    int nphases;
+} startup_env_t;
+
+static void startup_evict_file(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Returns the way the page cache was dropped: "drop_caches" or "fadvise".
+static const char* startup_drop_caches(const startup_env_t* env)
+{
+    int fd;
+
+    sync();
+    fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd >= 0) {
+        int ok = write(fd, "3", 1) == 1;
+
+        close(fd);
+        if (ok) return "drop_caches";
+    }
+    startup_evict_file(env->iwad);
+    startup_evict_file(env->config);
+    startup_evict_file(env->rcache);
+    return "fadvise";
+}
+
+static int startup_run(const startup_env_t* env, int rcache, startup_run_t* r)
+{
+    int fds[2];
+    pid_t pid;
+    int status;
+    ssize_t got;
+
+    memset(r, 0, sizeof(*r));
+    if (pipe(fds) != 0) return -1;
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        startup_run_t res;
+        double t0;
+
+        close(fds[0]);
+        memset(&res, 0, sizeof(res));
+        setenv("UBO_DOOM_CONFIG", env->config, 1);
+        setenv("UBO_DOOM_RCACHE", rcache ? "1" : "0", 1);
+        t0 = tool_now();
+        if (doom_init(env->iwad) == 0) {
+            res.init_ms = (tool_now() - t0) * 1000.0;
+            res.ok = 1;
+            for (int i = 0; i < env->nphases; i++)
+                res.phase_us[i] = doom_init_phase_us(i);
+        }
+        // shutting the engine down is not part of the start-up
+        _exit(write(fds[1], &res, sizeof(res)) == (ssize_t)sizeof(res) && res.ok ? 0 : 1);
+    }
+    close(fds[1]);
+    got = read(fds[0], r, sizeof(*r));
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    if (got != (ssize_t)sizeof(*r) || !r->ok) {
+        r->ok = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static int startup_cmp(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Median of the ok runs' values; sorts v.
+static double startup_median(double* v, int n)
+{
+    if (n == 0) return 0.0;
+    qsort(v, n, sizeof(*v), startup_cmp);
+    return n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+static void startup_write_json(FILE* out, const startup_env_t* env, const char* cold_method,
+                               int runs, const startup_mode_t* modes)
+{
+    double v[STARTUP_MAX_RUNS];
+
+    fprintf(out, "{\n  \"iwad\": \"%s\",\n  \"startup\": true,\n  \"runs\": %d,"
+            "\n  \"cold_method\": \"%s\",\n  \"modes\": [", env->iwad, runs, cold_method);
+    for (int m = 0; m < STARTUP_MODES; m++) {
+        const startup_mode_t* md = &modes[m];
+        int n = 0;
+
+        for (int i = 0; i < md->n; i++)
+            if (md->runs[i].ok)
+                v[n++] = md->runs[i].init_ms;
+        fprintf(out, "%s\n    {\"mode\": \"%s\", \"rcache\": %s, \"ok_runs\": %d",
+                m ? "," : "", md->cold ? "cold" : "warm", md->rcache ? "true" : "false", n);
+        if (n == 0) {
+            fprintf(out, "}");
+            continue;
+        }
+        {
+            double med = startup_median(v, n);
+
+            fprintf(out, ",\n     \"init_ms\": {\"median\": %.2f, \"min\": %.2f, \"max\": %.2f},"
+                    "\n     \"phases_ms\": {", med, v[0], v[n - 1]);
+        }
+        for (int p = 0; p < env->nphases; p++) {
+            n = 0;
+            for (int i = 0; i < md->n; i++)
+                if (md->runs[i].ok)
+                    v[n++] = md->runs[i].phase_us[p] / 1000.0;
+            fprintf(out, "%s\"%s\": %.2f", p ? ", " : "", doom_init_phase_name(p),
+                    startup_median(v, n));
+        }
+        fprintf(out, "}}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static int startup_bench(const char* iwad, int runs, const char* out_path, int report_fd)
+{
+    static startup_mode_t modes[STARTUP_MODES];
+    startup_env_t env;
+    const char* cold_method = "none";
+    startup_run_t prime;
+    int failed = 0;
+    FILE* out;
+
+    memset(&env, 0, sizeof(env));
+    env.iwad = iwad;
+    while (env.nphases < STARTUP_MAX_PHASES && doom_init_phase_name(env.nphases))
+        env.nphases++;
+    snprintf(env.dir, sizeof(env.dir), "/tmp/ubodoom-startup-XXXXXX");
+    if (!mkdtemp(env.dir)) {
+        fprintf(stderr, "[bench] cannot make a scratch directory\n");
+        return 1;
+    }
+    snprintf(env.config, sizeof(env.config), "%s/ubodoom.cfg", env.dir);
+    snprintf(env.rcache, sizeof(env.rcache), "%s/ubodoom.rcache", env.dir);
+
+    for (int m = 0; m < STARTUP_MODES; m++) {
+        startup_mode_t* md = &modes[m];
+
+        md->rcache = m >= 2;
+        md->cold = !(m & 1);
+        md->n = runs;
+        // an untimed run first writes the cache (or warms the page cache)
+        if (m == 0 || m == 2)
+            startup_run(&env, md->rcache, &prime);
+        for (int i = 0; i < runs; i++) {
+            startup_run_t* r = &md->runs[i];
+
+            if (md->cold)
+                cold_method = startup_drop_caches(&env);
+            if (startup_run(&env, md->rcache, r) != 0) {
+                fprintf(stderr, "[bench] startup: doom_init(%s) failed\n", iwad);
+                failed = 1;
+                continue;
+            }
+            fprintf(stderr, "[bench] startup %s rcache=%d: %.1f ms\n",
+                    md->cold ? "cold" : "warm", md->rcache, r->init_ms);
+        }
+    }
+
+    unlink(env.config);
+    unlink(env.rcache);
+    rmdir(env.dir);
+
+    out = out_path ? fopen(out_path, "w") : fdopen(report_fd, "w");
+    if (!out) {
+        fprintf(stderr, "[bench] cannot open %s\n", out_path ? out_path : "stdout");
+        return 1;
+    }
+    startup_write_json(out, &env, cold_method, runs, modes);
+    fclose(out);
+    return failed;
+}
+
+int main(int argc, char** argv)
+{
+    static const char* default_demos[] = { "demo1", "demo2", "demo3" };
+    bench_result_t res[BENCH_MAX_DEMOS];
+    const char* out_path = NULL;
+    const char* iwad = NULL;
+    int blit = 1;
+    int startup = 0;
+    int runs = 5;
+    int n = 0;
+    int failed = 0;
+    int report_fd;
+    FILE* out;
+    int i;
+
+    memset(res, 0, sizeof(res));
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-noconvert"))
+            blit = 0;
+        else if (!strcmp(argv[i], "-startup"))
+            startup = 1;
+        else if (!strcmp(argv[i], "-runs") && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else if (!iwad)
+            iwad = argv[i];
+        else if (n < BENCH_MAX_DEMOS)
+            res[n++].demo = argv[i];
+    }
+    if (!iwad || runs < 1 || runs > STARTUP_MAX_RUNS) {
+        fprintf(stderr, "usage: %s [-noconvert] [-o report.json] <iwad> [demo ...]\n"
+                "       %s -startup [-runs 1-%d] [-o report.json] <iwad>\n",
+                argv[0], argv[0], STARTUP_MAX_RUNS);
+        return 2;
+    }
+    if (n == 0)
+        for (n = 0; n < 3; n++)
+            res[n].demo = default_demos[n];
+
+    report_fd = tool_keep_stdout();
+
+    if (startup)
+        return startup_bench(iwad, runs, out_path, report_fd);
+
+    // time the full-quality frame unless told otherwise
+    setenv("UBO_DOOM_GOVERNOR", "0", 0);
+    doom_set_profile_enabled(1);
+    doom_set_output_format(UBO_OUTPUT_RGB565_BE);
+    if (doom_init(iwad) != 0) {
+        fprintf(stderr, "[bench] doom_init(%s) failed\n", iwad);
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (bench_run_demo(&res[i], blit) != 0) {
+            failed = 1;
+            if (!doom_is_alive()) break;
+            continue;
+        }
+        fprintf(stderr, "[bench] %s: %u gametics in %u realtics (%.3f s)\n",
+                res[i].demo, res[i].timing.gametics, res[i].timing.realtics, res[i].wall_s);
+    }
+
+    out = out_path ? fopen(out_path, "w") : fdopen(report_fd, "w");
+    if (!out) {
+        fprintf(stderr, "[bench] cannot open %s\n", out_path ? out_path : "stdout");
+        return 1;
+    }
+    bench_write_json(out, iwad, blit, res, n);
+    fclose(out);
+
+    doom_shutdown();
+    return failed;
+}
@@ -0,0 +1,483 @@
+// ubodoom_kbench: micro-benchmarks for the renderer and mixer kernels.
+//
+//   ubodoom_kbench [-cpu N] [-runs R] [-calls C] [-only NAME] [-o report.json] <iwad>
+//
+// Starts the engine on the IWAD (for its colormaps, textures, flats,
+// patches and effects), pins itself to one CPU (default: the highest one it
+// may run on; -cpu -1 leaves it unpinned), then times each kernel on its own:
+// a warmup run, then R runs (default 31) of C calls (default 4096).  Column
+// and span drawers get a synthetic source (random texels) and one cut from
+// the WAD, so a change that only pays off on real textures shows up.  Each
+// kernel reports the min and median ns per call and per output unit
+// (pixels, or frames for the mixer), plus CPU cycles from perf when the
+// kernel lets us count them.  -only runs the kernels whose name starts
+// with NAME.  Engine chatter goes to stderr; the report goes to stdout (or -o).
+
+#define _GNU_SOURCE                 // sched_setaffinity
+
+#include "doom_api.h"
+#include "ubodoom_tool.h"
+
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "i_sound.h"
+#include "i_video.h"
+#include "m_swap.h"
+#include "r_local.h"
+#include "sounds.h"
+#include "v_video.h"
+#include "w_wad.h"
+#include "z_zone.h"
+
+#define KBENCH_MAX_RUNS 255
+#define KBENCH_SAMPLES  512         // frames I_UpdateSound mixes per call (SAMPLECOUNT)
+#define KBENCH_CHANNELS 8           // UBO_DOOM_MIX_CHANNELS default
+#define KBENCH_PITCH    128         // NORM_PITCH
+
+extern boolean setsizeneeded;
+extern int numtextures;
+extern int numflats;
+extern unsigned char* channels[];    // i_sound_alsa.c mixer channels, 0 = free
+void R_ExecuteSetViewSize (void);
+
+typedef struct kbench_s kbench_t;
+
+struct kbench_s {
+    const char* name;
+    const char* input;              // "synthetic", or the lump the input came from
+    int (*setup)(kbench_t* k);      // -1 when the IWAD lacks the input
+    void (*step)(int i);
+    void (*kernel)(void);
+    void (*finish)(void);           // after each run of calls, outside the timing
+    const char* unit;
+    int per_call;                   // units per call, set by setup
+};
+
+typedef struct kbench_result_s {
+    const kbench_t* k;
+    int ok;
+    int per_call;
+    double ns_min;
+    double ns_median;
+    double cycles_min;              // < 0 without a cycle counter
+    double cycles_median;
+} kbench_result_t;
+
+static void (*g_kernel)(void);
+static byte g_column[128];          // synthetic column
+static byte g_flat[64 * 64];        // synthetic flat
+static byte* g_wadcolumn;
+static byte* g_wadflat;
+static patch_t* g_patch;
+static int g_patchx;
+static int g_patchy;
+static int g_cycles_fd = -1;
+
+// CPU cycles of this thread in user mode, through perf (the PMU cycle
+// counter on the Pi, the core clock on x86); -1 where perf is not allowed.
+static void kbench_open_cycles(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    g_cycles_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (g_cycles_fd < 0)
+        fprintf(stderr, "[kbench] no cycle counter (perf_event_open failed); ns only\n");
+}
+
+static int64_t kbench_cycles(void)
+{
+    uint64_t v;
+
+    if (g_cycles_fd < 0 || read(g_cycles_fd, &v, sizeof(v)) != sizeof(v))
+        return -1;
+    return (int64_t)v;
+}
+
+static int kbench_pin(int cpu)
+{
+    cpu_set_t set;
+    int i;
+
+    if (cpu == -1)
+        return -1;
+    if (cpu < -1) {
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            return -1;
+        for (i = CPU_SETSIZE - 1; i >= 0 && !CPU_ISSET(i, &set); i--)
+            ;
+        cpu = i;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fprintf(stderr, "[kbench] cannot pin to cpu %d; running unpinned\n", cpu);
+        return -1;
+    }
+    return cpu;
+}
+
+
+//
+// Inputs.
+//
+static void kbench_column_state(byte* source)
+{
+    dc_source = source;
+    dc_colormap = colormaps;
+    dc_translation = translationtables;
+    dc_yl = 0;
+    dc_yh = viewheight - 1;
+    // one texel per pixel from the top of the column (the drawers wrap at 128)
+    dc_iscale = FRACUNIT;
+    dc_texturemid = centery * FRACUNIT;
+}
+
+static int kbench_setup_columns(kbench_t* k)
+{
+    if (!strcmp(k->input, "synthetic"))
+        kbench_column_state(g_column);
+    else if (g_wadcolumn)
+        kbench_column_state(g_wadcolumn);
+    else
+        return -1;
+    g_kernel = k->kernel;
+    k->per_call = k->kernel == R_DrawFuzzColumn ? viewheight - 2 : viewheight;
+    return 0;
+}
+
+static int kbench_setup_spans(kbench_t* k)
+{
+    if (!strcmp(k->input, "synthetic"))
+        ds_source = g_flat;
+    else if (g_wadflat)
+        ds_source = g_wadflat;
+    else
+        return -1;
+    ds_colormap = colormaps;
+    ds_x1 = 0;
+    ds_x2 = viewwidth - 1;
+    // a floor seen at an angle: both coordinates move
+    ds_xfrac = 0;
+    ds_yfrac = 0;
+    ds_xstep = FRACUNIT * 3 / 4;
+    ds_ystep = FRACUNIT / 3;
+    g_kernel = k->kernel;
+    k->per_call = k->kernel == R_DrawSpanLow ? viewwidth / 2 * 2 : viewwidth;
+    return 0;
+}
+
+static int kbench_setup_finish(kbench_t* k)
+{
+    doom_set_output_format(!strcmp(k->name, "I_FinishUpdate_rgba")
+                           ? UBO_OUTPUT_RGBA8888 : UBO_OUTPUT_RGB565_BE);
+    noblit = false;
+    k->per_call = SCREENWIDTH * SCREENHEIGHT;
+    return 0;
+}
+
+static int kbench_setup_patch(kbench_t* k)
+{
+    int lump = W_CheckNumForName((char*)k->input);
+
+    if (lump < 0)
+        return -1;
+    g_patch = W_CacheLumpNum(lump, PU_STATIC);
+    g_patchx = (SCREENWIDTH - SHORT(g_patch->width)) / 2 + SHORT(g_patch->leftoffset);
+    g_patchy = (SCREENHEIGHT - SHORT(g_patch->height)) / 2 + SHORT(g_patch->topoffset);
+    k->per_call = SHORT(g_patch->width) * SHORT(g_patch->height);
+    return 0;
+}
+
+static int kbench_setup_sound(kbench_t* k)
+{
+    k->per_call = KBENCH_SAMPLES;
+    return 0;
+}
+
+
+//
+// Steps: one kernel call each, placed so consecutive calls walk the view.
+//
+static void kbench_step_column(int i)
+{
+    dc_x = i % viewwidth;
+    g_kernel();
+}
+
+static void kbench_step_column_low(int i)
+{
+    dc_x = i % (viewwidth / 2);
+    g_kernel();
+}
+
+static void kbench_step_fuzz(int i)
+{
+    // the fuzz drawers clip themselves to rows 1 .. viewheight-2 on each call
+    dc_yl = 0;
+    dc_yh = viewheight - 1;
+    dc_x = i % viewwidth;
+    g_kernel();
+}
+
+static void kbench_step_span(int i)
+{
+    ds_y = i % viewheight;
+    g_kernel();
+}
+
+static void kbench_step_span_low(int i)
+{
+    // R_DrawSpanLow doubles ds_x1 and ds_x2 in place
+    ds_x1 = 0;
+    ds_x2 = viewwidth / 2 - 1;
+    ds_y = i % viewheight;
+    g_kernel();
+}
+
+static void kbench_step_finish(int i)
+{
+    (void)i;
+    framestatic = false;
+    I_FinishUpdate();
+}
+
+static void kbench_step_patch(int i)
+{
+    (void)i;
+    V_DrawPatch(g_patchx, g_patchy, 0, g_patch);
+}
+
+static void kbench_step_sound(int i)
+{
+    // not sfx_pistol or sfx_stnmov: addsfx plays those one at a time
+    static const int effects[] = { sfx_bfg, sfx_plasma, sfx_shotgn, sfx_pldeth,
+                                   sfx_barexp, sfx_firsht, sfx_rlaunc, sfx_pstop };
+    int c;
+
+    // keep every mixer channel busy; addsfx takes the first free one
+    for (c = 0; c < KBENCH_CHANNELS; c++)
+        if (!channels[c])
+            I_StartSound(effects[(c + i) % 8], 127, 64 + c * 16, KBENCH_PITCH, 0);
+    I_UpdateSound();
+}
+
+static void kbench_flush_quad(void)
+{
+    R_FlushQuad();
+}
+
+static const kbench_t g_kernels[] = {
+    { "R_DrawColumn", "synthetic", kbench_setup_columns, kbench_step_column, R_DrawColumn, NULL, "pixel" },
+    { "R_DrawColumn", "texture", kbench_setup_columns, kbench_step_column, R_DrawColumn, NULL, "pixel" },
+    { "R_DrawColumnQuad", "synthetic", kbench_setup_columns, kbench_step_column, R_DrawColumnQuad, kbench_flush_quad, "pixel" },
+    { "R_DrawColumnQuad", "texture", kbench_setup_columns, kbench_step_column, R_DrawColumnQuad, kbench_flush_quad, "pixel" },
+    { "R_DrawColumnLow", "synthetic", kbench_setup_columns, kbench_step_column_low, R_DrawColumnLow, NULL, "pixel" },
+    { "R_DrawColumnLow", "texture", kbench_setup_columns, kbench_step_column_low, R_DrawColumnLow, NULL, "pixel" },
+    { "R_DrawFuzzColumn", "texture", kbench_setup_columns, kbench_step_fuzz, R_DrawFuzzColumn, NULL, "pixel" },
+    { "R_DrawTranslatedColumn", "synthetic", kbench_setup_columns, kbench_step_column, R_DrawTranslatedColumn, NULL, "pixel" },
+    { "R_DrawTranslatedColumn", "texture", kbench_setup_columns, kbench_step_column, R_DrawTranslatedColumn, NULL, "pixel" },
+    { "R_DrawSpan", "synthetic", kbench_setup_spans, kbench_step_span, R_DrawSpan, NULL, "pixel" },
+    { "R_DrawSpan", "flat", kbench_setup_spans, kbench_step_span, R_DrawSpan, NULL, "pixel" },
+#ifdef R_SIMDSPANS
+    { "R_DrawSpanSimd", "synthetic", kbench_setup_spans, kbench_step_span, R_DrawSpanSimd, NULL, "pixel" },
+    { "R_DrawSpanSimd", "flat", kbench_setup_spans, kbench_step_span, R_DrawSpanSimd, NULL, "pixel" },
+#endif
+    { "R_DrawSpanLow", "flat", kbench_setup_spans, kbench_step_span_low, R_DrawSpanLow, NULL, "pixel" },
+    { "I_FinishUpdate_rgb565", "screen", kbench_setup_finish, kbench_step_finish, NULL, NULL, "pixel" },
+    { "I_FinishUpdate_rgba", "screen", kbench_setup_finish, kbench_step_finish, NULL, NULL, "pixel" },
+    { "V_DrawPatch", "TITLEPIC", kbench_setup_patch, kbench_step_patch, NULL, NULL, "pixel" },
+    { "V_DrawPatch", "M_DOOM", kbench_setup_patch, kbench_step_patch, NULL, NULL, "pixel" },
+    { "I_UpdateSound", "effects", kbench_setup_sound, kbench_step_sound, NULL, NULL, "frame" },
+};
+#define KBENCH_NUM_KERNELS ((int)(sizeof(g_kernels) / sizeof(g_kernels[0])))
+
+static void kbench_make_inputs(void)
+{
+    int tex;
+    int flat;
+    unsigned seed = 0x1234567u;
+    size_t i;
+
+    for (i = 0; i < sizeof(g_column); i++) {
+        seed = seed * 1103515245u + 12345u;
+        g_column[i] = seed >> 24;
+    }
+    for (i = 0; i < sizeof(g_flat); i++) {
+        seed = seed * 1103515245u + 12345u;
+        g_flat[i] = seed >> 24;
+    }
+
+    // a wall texture and a flat every IWAD has, else the first of each
+    tex = R_CheckTextureNumForName("STARTAN3");
+    if (tex < 0 && numtextures > 1)
+        tex = 1;
+    if (tex > 0)
+        g_wadcolumn = R_GetTextureColumn(tex, 0);
+    flat = W_CheckNumForName("FLOOR4_8");
+    if (flat < 0 && numflats > 0)
+        flat = firstflat;
+    if (flat >= 0)
+        g_wadflat = W_CacheLumpNum(flat, PU_STATIC);
+}
+
+static int kbench_cmp(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void kbench_run(kbench_result_t* r, int runs, int calls)
+{
+    kbench_t k = *r->k;
+    double ns[KBENCH_MAX_RUNS];
+    double cy[KBENCH_MAX_RUNS];
+    double t0;
+    int64_t c0;
+    int64_t c1;
+    int run;
+    int i;
+
+    if (k.setup(&k) != 0) {
+        fprintf(stderr, "[kbench] %s (%s): input not in this IWAD, skipped\n", k.name, k.input);
+        return;
+    }
+    // run -1 is the warmup: caches, branch predictors, the CPU clock
+    for (run = -1; run < runs; run++) {
+        c0 = kbench_cycles();
+        t0 = tool_now();
+        for (i = 0; i < calls; i++)
+            k.step(i);
+        t0 = tool_now() - t0;
+        c1 = kbench_cycles();
+        if (k.finish)
+            k.finish();
+        if (run < 0)
+            continue;
+        ns[run] = t0 * 1e9 / calls;
+        cy[run] = c0 >= 0 && c1 >= 0 ? (double)(c1 - c0) / calls : -1;
+    }
+    qsort(ns, runs, sizeof(ns[0]), kbench_cmp);
+    qsort(cy, runs, sizeof(cy[0]), kbench_cmp);
+    r->ok = 1;
+    r->per_call = k.per_call;
+    r->ns_min = ns[0];
+    r->ns_median = ns[runs / 2];
+    r->cycles_min = cy[0];
+    r->cycles_median = cy[runs / 2];
+    fprintf(stderr, "[kbench] %-22s %-9s %10.1f ns/call %8.3f ns/%s\n", k.name, k.input,
+            r->ns_median, r->ns_median / k.per_call, k.unit);
+}
+
+static void kbench_write_json(FILE* out, const char* iwad, int cpu, int runs, int calls,
+                              const kbench_result_t* res, int n)
+{
+    int i;
+
+    fprintf(out, "{\n  \"iwad\": \"%s\",\n  \"cpu\": %d,\n  \"runs\": %d,\n"
+            "  \"calls\": %d,\n  \"cycles\": %s,\n  \"kernels\": [",
+            iwad, cpu, runs, calls, g_cycles_fd >= 0 ? "true" : "false");
+    for (i = 0; i < n; i++) {
+        const kbench_result_t* r = &res[i];
+
+        fprintf(out, "%s\n    {\"kernel\": \"%s\", \"input\": \"%s\", \"ok\": %s",
+                i ? "," : "", r->k->name, r->k->input, r->ok ? "true" : "false");
+        if (!r->ok) {
+            fprintf(out, "}");
+            continue;
+        }
+        fprintf(out, ", \"unit\": \"%s\", \"per_call\": %d,"
+                " \"ns_min\": %.1f, \"ns_median\": %.1f, \"ns_per_unit\": %.4f",
+                r->k->unit, r->per_call, r->ns_min, r->ns_median, r->ns_median / r->per_call);
+        if (r->cycles_median >= 0)
+            fprintf(out, ", \"cycles_min\": %.0f, \"cycles_median\": %.0f,"
+                    " \"cycles_per_unit\": %.3f",
+                    r->cycles_min, r->cycles_median, r->cycles_median / r->per_call);
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    kbench_result_t res[KBENCH_NUM_KERNELS];
+    const char* out_path = NULL;
+    const char* only = NULL;
+    const char* iwad = NULL;
+    int cpu = -2;
+    int runs = 31;
+    int calls = 4096;
+    int n = 0;
+    int report_fd;
+    FILE* out;
+    int i;
+
+    memset(res, 0, sizeof(res));
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-cpu") && i + 1 < argc)
+            cpu = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-runs") && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-calls") && i + 1 < argc)
+            calls = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-only") && i + 1 < argc)
+            only = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else if (!iwad)
+            iwad = argv[i];
+    }
+    if (!iwad || runs < 1 || runs > KBENCH_MAX_RUNS || calls < 1) {
+        fprintf(stderr, "usage: %s [-cpu N] [-runs 1..%d] [-calls C] [-only NAME]"
+                " [-o report.json] <iwad>\n", argv[0], KBENCH_MAX_RUNS);
+        return 2;
+    }
+
+    report_fd = tool_keep_stdout();
+
+    // mix on this thread, so I_UpdateSound is the mixer and nothing else
+    setenv("UBO_DOOM_AUDIO_THREAD", "0", 1);
+    if (doom_init(iwad) != 0) {
+        fprintf(stderr, "[kbench] doom_init(%s) failed\n", iwad);
+        return 1;
+    }
+    if (setsizeneeded)
+        R_ExecuteSetViewSize();
+    kbench_make_inputs();
+    cpu = kbench_pin(cpu);
+    kbench_open_cycles();
+
+    for (i = 0; i < KBENCH_NUM_KERNELS; i++) {
+        if (only && strncmp(g_kernels[i].name, only, strlen(only)))
+            continue;
+        res[n].k = &g_kernels[i];
+        kbench_run(&res[n++], runs, calls);
+    }
+
+    out = out_path ? fopen(out_path, "w") : fdopen(report_fd, "w");
+    if (!out) {
+        fprintf(stderr, "[kbench] cannot open %s\n", out_path ? out_path : "stdout");
+        return 1;
+    }
+    kbench_write_json(out, iwad, cpu, runs, calls, res, n);
+    fclose(out);
+
+    doom_shutdown();
+    return 0;
+}
@@ -0,0 +1,287 @@
+// _ubodoom: the CPython side of the per-tic calls DoomLib makes, built next
+// to libubodoom.so (make pymodule) and linked against it.  ctypes pays
+// argument conversion and a libffi call for each of them; here they are
+// plain METH_FASTCALL functions, and the tic calls drop the GIL while the
+// engine runs, so the Kivy thread keeps going.  The status struct and the
+// RGBA buffer are read-only memoryviews over the engine's own memory.
+// native/doom_lib.py loads it when it sits next to the library it opened,
+// and checks both really are the same library, else stays with ctypes.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "doom_api.h"
+
+#define PYMOD_EVENT_BATCH  64       // events converted per doom_post_events() call
+#define PYMOD_DIRTY_RECTS  8        // as DoomLib.dirty_rects()
+
+static int PyMod_Int(PyObject* o, int* out)
+{
+    long v = PyLong_AsLong(o);
+
+    if (v == -1 && PyErr_Occurred())
+        return -1;
+    *out = (int)v;
+    return 0;
+}
+
+static PyObject* PyMod_Tick(PyObject* self, PyObject* unused)
+{
+    (void)self;
+    (void)unused;
+    Py_BEGIN_ALLOW_THREADS
+    doom_tick();
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// tick_ex(*, run_sim=True, render=True)
+static PyObject* PyMod_TickEx(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    static char* kwlist[] = { "run_sim", "render", NULL };
+    int run_sim = 1;
+    int render = 1;
+
+    (void)self;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$pp:tick_ex", kwlist, &run_sim, &render))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    doom_tick_ex(run_sim, render);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// advance(elapsed_s, *, render=True) -> tics run
+static PyObject* PyMod_Advance(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    static char* kwlist[] = { "elapsed_s", "render", NULL };
+    double elapsed_s;
+    double us;
+    int render = 1;
+    int rc;
+
+    (void)self;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "d|$p:advance", kwlist, &elapsed_s, &render))
+        return NULL;
+    us = elapsed_s * 1000000.0;
+    us = us < 0.0 ? 0.0 : us > 4294967295.0 ? 4294967295.0 : us;
+    Py_BEGIN_ALLOW_THREADS
+    rc = doom_advance((uint32_t)us, render);
+    Py_END_ALLOW_THREADS
+    if (rc < 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "doom_advance: the native scheduler is running");
+        return NULL;
+    }
+    return PyLong_FromLong(rc);
+}
+
+static PyObject* PyMod_KeyDown(PyObject* self, PyObject* key)
+{
+    int k;
+
+    (void)self;
+    if (PyMod_Int(key, &k) < 0)
+        return NULL;
+    doom_key_down((ubo_key_t)k);
+    Py_RETURN_NONE;
+}
+
+static PyObject* PyMod_KeyUp(PyObject* self, PyObject* key)
+{
+    int k;
+
+    (void)self;
+    if (PyMod_Int(key, &k) < 0)
+        return NULL;
+    doom_key_up((ubo_key_t)k);
+    Py_RETURN_NONE;
+}
+
+// tap(key, hold_tics)
+static PyObject* PyMod_Tap(PyObject* self, PyObject* const* args, Py_ssize_t nargs)
+{
+    ubo_event_t ev;
+
+    (void)self;
+    if (nargs != 2)
+    {
+        PyErr_SetString(PyExc_TypeError, "tap(key, hold_tics)");
+        return NULL;
+    }
+    if (PyMod_Int(args[0], &ev.key) < 0 || PyMod_Int(args[1], &ev.hold_tics) < 0)
+        return NULL;
+    ev.down = 1;
+    doom_post_events(&ev, 1);
+    Py_RETURN_NONE;
+}
+
+// post_events([(key, down, hold_tics), ...]) -> count accepted
+static PyObject* PyMod_PostEvents(PyObject* self, PyObject* events)
+{
+    ubo_event_t batch[PYMOD_EVENT_BATCH];
+    PyObject* seq;
+    Py_ssize_t n;
+    long accepted = 0;
+    int full = 0;
+
+    (void)self;
+    seq = PySequence_Fast(events, "post_events: expected a sequence of (key, down, hold_tics)");
+    if (!seq)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(seq);
+    for (Py_ssize_t i = 0; i < n && !full; )
+    {
+        int count = 0;
+
+        for (; i < n && count < PYMOD_EVENT_BATCH; i++, count++)
+        {
+            PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+            ubo_event_t* ev = &batch[count];
+
+            if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 3)
+            {
+                PyErr_SetString(PyExc_TypeError, "post_events: expected (key, down, hold_tics) tuples");
+                Py_DECREF(seq);
+                return NULL;
+            }
+            if (PyMod_Int(PyTuple_GET_ITEM(item, 0), &ev->key) < 0
+                || PyMod_Int(PyTuple_GET_ITEM(item, 1), &ev->down) < 0
+                || PyMod_Int(PyTuple_GET_ITEM(item, 2), &ev->hold_tics) < 0)
+            {
+                Py_DECREF(seq);
+                return NULL;
+            }
+        }
+        int took = doom_post_events(batch, count);
+        accepted += took;
+        full = took < count;
+    }
+    Py_DECREF(seq);
+    return PyLong_FromLong(accepted);
+}
+
+static PyObject* PyMod_ReleaseAllKeys(PyObject* self, PyObject* unused)
+{
+    (void)self;
+    (void)unused;
+    doom_release_all_keys();
+    Py_RETURN_NONE;
+}
+
+// frame_into(dst, fmt=UBO_OUTPUT_RGB565_BE) -> bytes written
+static PyObject* PyMod_FrameInto(PyObject* self, PyObject* const* args, Py_ssize_t nargs)
+{
+    Py_buffer dst;
+    int fmt = UBO_OUTPUT_RGB565_BE;
+    int rc;
+
+    (void)self;
+    if (nargs < 1 || nargs > 2)
+    {
+        PyErr_SetString(PyExc_TypeError, "frame_into(dst, fmt=RGB565_BE)");
+        return NULL;
+    }
+    if (nargs == 2 && PyMod_Int(args[1], &fmt) < 0)
+        return NULL;
+    if (PyObject_GetBuffer(args[0], &dst, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) < 0)
+        return NULL;
+    rc = dst.len > INT_MAX ? -1 : doom_copy_frame_into(dst.buf, (int)dst.len, (ubo_output_format_t)fmt);
+    if (rc < 0)
+        PyErr_Format(PyExc_ValueError, "frame destination too small for format %d: %zd bytes",
+                     fmt, dst.len);
+    PyBuffer_Release(&dst);
+    return rc < 0 ? NULL : PyLong_FromLong(rc);
+}
+
+// dirty_rects() -> [(x0, y0, x1, y1), ...]
+static PyObject* PyMod_DirtyRects(PyObject* self, PyObject* unused)
+{
+    ubo_rect_t rects[PYMOD_DIRTY_RECTS];
+    int n = doom_get_dirty_rects(rects, PYMOD_DIRTY_RECTS);
+    PyObject* list;
+
+    (void)self;
+    (void)unused;
+    list = PyList_New(n);
+    if (!list)
+        return NULL;
+    for (int i = 0; i < n; i++)
+    {
+        PyObject* t = Py_BuildValue("(iiii)", rects[i].x0, rects[i].y0, rects[i].x1, rects[i].y1);
+
+        if (!t)
+        {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, t);
+    }
+    return list;
+}
+
+// The engine's live ubo_status_t (doom_get_status_ptr()), read-only.
+static PyObject* PyMod_StatusBuffer(PyObject* self, PyObject* unused)
+{
+    (void)self;
+    (void)unused;
+    return PyMemoryView_FromMemory((char*)doom_get_status_ptr(), sizeof(ubo_status_t), PyBUF_READ);
+}
+
+// ubo_rgba, read-only; its size follows the screen, so fetch it after init.
+static PyObject* PyMod_RgbaBuffer(PyObject* self, PyObject* unused)
+{
+    const uint8_t* rgba = doom_get_rgba_ptr();
+
+    (void)self;
+    (void)unused;
+    if (!rgba)
+        Py_RETURN_NONE;
+    return PyMemoryView_FromMemory((char*)rgba,
+                                   (Py_ssize_t)doom_get_rgba_width() * doom_get_rgba_height() * 4,
+                                   PyBUF_READ);
+}
+
+static PyMethodDef g_methods[] = {
+    { "tick", PyMod_Tick, METH_NOARGS, "doom_tick() without the GIL." },
+    { "tick_ex", (PyCFunction)(void (*)(void))PyMod_TickEx, METH_VARARGS | METH_KEYWORDS,
+      "tick_ex(*, run_sim=True, render=True): doom_tick_ex() without the GIL." },
+    { "advance", (PyCFunction)(void (*)(void))PyMod_Advance, METH_VARARGS | METH_KEYWORDS,
+      "advance(elapsed_s, *, render=True) -> tics run: doom_advance() without the GIL." },
+    { "key_down", PyMod_KeyDown, METH_O, "key_down(key)" },
+    { "key_up", PyMod_KeyUp, METH_O, "key_up(key)" },
+    { "tap", (PyCFunction)(void (*)(void))PyMod_Tap, METH_FASTCALL,
+      "tap(key, hold_tics): key down now, up after hold_tics tics." },
+    { "post_events", PyMod_PostEvents, METH_O,
+      "post_events([(key, down, hold_tics), ...]) -> count accepted." },
+    { "release_all_keys", PyMod_ReleaseAllKeys, METH_NOARGS, "release_all_keys()" },
+    { "frame_into", (PyCFunction)(void (*)(void))PyMod_FrameInto, METH_FASTCALL,
+      "frame_into(dst, fmt=RGB565_BE) -> bytes copied into the writable buffer dst." },
+    { "dirty_rects", PyMod_DirtyRects, METH_NOARGS,
+      "dirty_rects() -> inclusive (x0, y0, x1, y1) bands changed since the last call." },
+    { "status_buffer", PyMod_StatusBuffer, METH_NOARGS,
+      "status_buffer() -> read-only memoryview of the live ubo_status_t." },
+    { "rgba_buffer", PyMod_RgbaBuffer, METH_NOARGS,
+      "rgba_buffer() -> read-only memoryview of the RGBA frame." },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef g_module = {
+    PyModuleDef_HEAD_INIT, "_ubodoom",
+    "Hot-path libubodoom calls for DoomLib (native/doom_lib.py).", -1, g_methods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit__ubodoom(void)
+{
+    PyObject* m = PyModule_Create(&g_module);
+
+    // DoomLib compares it with its ctypes library's doom_get_status_ptr()
+    if (m && PyModule_AddObject(m, "status_address",
+                                PyLong_FromVoidPtr((void*)doom_get_status_ptr())) < 0)
+    {
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
@@ -0,0 +1,410 @@
+// ubodoom_replay: deterministic demo replay regression suite.
+//
+//   ubodoom_replay [-norender] [-frames | -save-frames] [-update] [-o report.json]
+//                  <iwad> <manifest>
+//
+// The manifest lists one demo file per line as `<file.lmp> <tics> <hash>`
+// (paths relative to the manifest, `#` starts a comment, `-` for a value not
+// recorded yet).  Each demo is played twice: once through doom_simulate(),
+// checking the tic count and the doom_state_hash() after its last tic, and
+// once rendering every tic, which must end on the same hash.  The JSON report
+// on stdout (or -o) carries tics/s and frames/s for each demo.  -update writes
+// the measured tics and hashes back into the manifest.  Exits 1 when any demo
+// differs from the manifest.
+//
+// -frames also checks the pixels: the rendering pass takes doom_get_frame_hash()
+// after every tic and compares it with the demo's golden file, <demo>.frames
+// next to it (one hash per line, tic order).  Record the golden files with the
+// plain drawers (-save-frames, or -frames -update along with the manifest),
+// then run a renderer variant against them with -frames; any tic it draws
+// differently fails the demo.
+
+#include "doom_api.h"
+#include "ubodoom_tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_MAX_DEMOS 32
+
+typedef struct replay_demo_s {
+    char file[256];
+    char path[512];
+    int want_tics;          // -1 = not in the manifest
+    int want_hash_set;
+    uint32_t want_hash;
+
+    int ok;
+    int tics;
+    uint32_t hash;
+    double sim_s;
+    int frames;
+    uint32_t render_hash;
+    double render_s;
+
+    char frames_path[520];
+    uint32_t* frame_hashes; // frames + 1 of them: the starting tic, then each played one
+    int golden_frames;      // -1 = no golden file
+    int frame_mismatches;
+    int first_mismatch;     // tic, -1 = none
+} replay_demo_t;
+
+// <demo>.lmp -> <demo>.frames
+static void replay_frames_path(replay_demo_t* d)
+{
+    char* dot;
+    char* slash;
+
+    snprintf(d->frames_path, sizeof(d->frames_path), "%s", d->path);
+    dot = strrchr(d->frames_path, '.');
+    slash = strrchr(d->frames_path, '/');
+    if (dot && (!slash || dot > slash))
+        *dot = 0;
+    strcat(d->frames_path, ".frames");
+}
+
+static int replay_load_manifest(const char* manifest, replay_demo_t* demos, int max)
+{
+    char line[512], tics[32], hash[32];
+    const char* slash = strrchr(manifest, '/');
+    int dirlen = slash ? (int)(slash - manifest) + 1 : 0;
+    FILE* f = fopen(manifest, "r");
+    int n = 0;
+
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f) && n < max) {
+        replay_demo_t* d = &demos[n];
+        char* hashmark = strchr(line, '#');
+        int fields;
+
+        if (hashmark) *hashmark = 0;
+        fields = sscanf(line, "%255s %31s %31s", d->file, tics, hash);
+        if (fields <= 0) continue;
+        if (dirlen + strlen(d->file) >= sizeof(d->path)) {
+            fprintf(stderr, "[replay] %s: path too long\n", d->file);
+            continue;
+        }
+        memcpy(d->path, manifest, dirlen);
+        strcpy(d->path + dirlen, d->file);
+        replay_frames_path(d);
+        d->golden_frames = -1;
+        d->want_tics = fields >= 2 && strcmp(tics, "-") ? atoi(tics) : -1;
+        d->want_hash_set = fields >= 3 && strcmp(hash, "-");
+        d->want_hash = d->want_hash_set ? (uint32_t)strtoul(hash, NULL, 16) : 0;
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static int replay_save_manifest(const char* manifest, const replay_demo_t* demos, int n)
+{
+    FILE* f = fopen(manifest, "w");
+    int i;
+
+    if (!f) return -1;
+    fprintf(f, "# ubodoom_replay manifest: <file.lmp> <tics> <hash>, see ubodoom_replay.c.\n");
+    for (i = 0; i < n; i++) {
+        if (demos[i].ok)
+            fprintf(f, "%s %d %08x\n", demos[i].file, demos[i].tics, demos[i].hash);
+        else
+            fprintf(f, "%s - -\n", demos[i].file);
+    }
+    return fclose(f);
+}
+
+// Compares d->frame_hashes with the golden file; -1 when there is none.
+static int replay_check_frames(replay_demo_t* d)
+{
+    char line[512];
+    FILE* f = fopen(d->frames_path, "r");
+    int count = d->frames + 1;
+    uint32_t want;
+    int n = 0;
+
+    d->golden_frames = -1;
+    d->frame_mismatches = 0;
+    d->first_mismatch = -1;
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        want = (uint32_t)strtoul(line, NULL, 16);
+        if (n >= count || d->frame_hashes[n] != want) {
+            if (d->first_mismatch < 0) d->first_mismatch = n;
+            d->frame_mismatches++;
+        }
+        n++;
+    }
+    fclose(f);
+    if (n < count) {
+        if (d->first_mismatch < 0) d->first_mismatch = n;
+        d->frame_mismatches += count - n;
+    }
+    d->golden_frames = n;
+    return 0;
+}
+
+static int replay_save_frames(const replay_demo_t* d)
+{
+    FILE* f = fopen(d->frames_path, "w");
+    int i;
+
+    if (!f) return -1;
+    fprintf(f, "# ubodoom_replay -frames: doom_get_frame_hash() after each tic of %s.\n", d->file);
+    for (i = 0; i <= d->frames; i++)
+        fprintf(f, "%08x\n", d->frame_hashes[i]);
+    return fclose(f);
+}
+
+// Queue the demo and run the tic that starts it.  Returns 0 once it plays.
+static int replay_start(const replay_demo_t* d, int render)
+{
+    if (doom_demo_play(d->path) != 0) {
+        fprintf(stderr, "[replay] %s: can't read %s\n", d->file, d->path);
+        return -1;
+    }
+    if (render)
+        doom_tick_ex(1, 1);
+    else
+        doom_simulate(1, NULL);
+    if (!doom_is_alive()) {
+        fprintf(stderr, "[replay] %s: engine died\n", d->file);
+        return -1;
+    }
+    if (doom_get_demo_state() != 2) {
+        fprintf(stderr, "[replay] %s: did not start (wrong version?)\n", d->file);
+        return -1;
+    }
+    return 0;
+}
+
+// Play to the end; *hash is the state after the last tic the demo drove.
+// With frames (room for TOOL_MAX_TICS + 1), frames[i] gets the frame hash
+// after tic i, the tic replay_start ran being tic 0.
+static int replay_play(const replay_demo_t* d, int render, uint32_t* hash, double* secs,
+                       uint32_t* frames)
+{
+    double t0 = tool_now();
+    uint32_t h = doom_state_hash();
+    int tics = 0;
+
+    if (frames)
+        frames[0] = doom_get_frame_hash();
+
+    while (doom_get_demo_state() == 2) {
+        if (tics > TOOL_MAX_TICS) {
+            fprintf(stderr, "[replay] %s: did not finish in %d tics\n", d->file, TOOL_MAX_TICS);
+            doom_demo_stop();
+            doom_simulate(1, NULL);
+            return -1;
+        }
+        if (render) {
+            doom_tick_ex(1, 1);
+            if (doom_get_demo_state() == 2)
+                h = doom_state_hash();
+            if (frames)
+                frames[tics + 1] = doom_get_frame_hash();
+        } else {
+            uint32_t next;
+            doom_simulate(1, &next);
+            if (doom_get_demo_state() == 2)
+                h = next;
+        }
+        tics++;
+    }
+    if (!doom_is_alive()) {
+        fprintf(stderr, "[replay] %s: engine died\n", d->file);
+        return -1;
+    }
+    *secs = tool_now() - t0;
+    *hash = h;
+    return tics;
+}
+
+// frames: 0 = no frame hashes, 1 = check them, 2 = record them (-update)
+static int replay_run(replay_demo_t* d, int render, int frames)
+{
+    if (replay_start(d, 0) != 0) return -1;
+    d->tics = replay_play(d, 0, &d->hash, &d->sim_s, NULL);
+    if (d->tics < 0) return -1;
+    d->ok = 1;
+
+    if (render) {
+        d->ok = 0;
+        if (frames && !d->frame_hashes) {
+            d->frame_hashes = malloc((TOOL_MAX_TICS + 2) * sizeof(*d->frame_hashes));
+            if (!d->frame_hashes) return -1;
+        }
+        if (replay_start(d, 1) != 0) return -1;
+        d->frames = replay_play(d, 1, &d->render_hash, &d->render_s,
+                                frames ? d->frame_hashes : NULL);
+        if (d->frames < 0) {
+            d->frames = 0;
+            return -1;
+        }
+        d->ok = 1;
+        if (frames == 1 && replay_check_frames(d) == 0 && d->frame_mismatches) {
+            fprintf(stderr, "[replay] %s: %d of %d frames differ from %s, first at tic %d\n",
+                    d->file, d->frame_mismatches, d->frames + 1, d->frames_path,
+                    d->first_mismatch);
+            d->ok = 0;
+        }
+        if (d->render_hash != d->hash || d->frames != d->tics) {
+            fprintf(stderr, "[replay] %s: rendering changed the playsim "
+                    "(%d tics %08x, simulated %d tics %08x)\n",
+                    d->file, d->frames, d->render_hash, d->tics, d->hash);
+            d->ok = 0;
+        }
+    }
+    return 0;
+}
+
+static int replay_matches(const replay_demo_t* d)
+{
+    return d->ok
+        && (d->want_tics < 0 || d->want_tics == d->tics)
+        && (!d->want_hash_set || d->want_hash == d->hash);
+}
+
+static void replay_write_json(FILE* out, const char* iwad, int render, int frames,
+                              const replay_demo_t* demos, int n)
+{
+    int i;
+
+    fprintf(out, "{\n  \"iwad\": \"%s\",\n  \"render\": %s,\n  \"demos\": [",
+            iwad, render ? "true" : "false");
+    for (i = 0; i < n; i++) {
+        const replay_demo_t* d = &demos[i];
+
+        fprintf(out, "%s\n    {\"demo\": \"%s\", \"ok\": %s", i ? "," : "",
+                d->file, replay_matches(d) ? "true" : "false");
+        if (d->want_hash_set)
+            fprintf(out, ", \"expected_hash\": \"%08x\"", d->want_hash);
+        if (!d->ok && !d->tics) {
+            fprintf(out, "}");
+            continue;
+        }
+        fprintf(out, ", \"tics\": %d, \"hash\": \"%08x\", \"sim_s\": %.3f,"
+                " \"tics_per_s\": %.1f",
+                d->tics, d->hash, d->sim_s, d->sim_s > 0 ? d->tics / d->sim_s : 0.0);
+        if (render)
+            fprintf(out, ", \"frames\": %d, \"render_s\": %.3f, \"fps\": %.1f",
+                    d->frames, d->render_s,
+                    d->render_s > 0 ? d->frames / d->render_s : 0.0);
+        if (render && frames && d->frames) {
+            if (d->golden_frames < 0)
+                fprintf(out, ", \"golden_frames\": null");
+            else
+                fprintf(out, ", \"golden_frames\": %d, \"frame_mismatches\": %d,"
+                        " \"first_mismatch\": %d",
+                        d->golden_frames, d->frame_mismatches, d->first_mismatch);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    static replay_demo_t demos[REPLAY_MAX_DEMOS];
+    const char* out_path = NULL;
+    const char* iwad = NULL;
+    const char* manifest = NULL;
+    int render = 1;
+    int frames = 0;
+    int update = 0;
+    int failed = 0;
+    int report_fd;
+    FILE* out;
+    int i, n;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-norender"))
+            render = 0;
+        else if (!strcmp(argv[i], "-frames"))
+            frames = frames ? frames : 1;
+        else if (!strcmp(argv[i], "-save-frames"))
+            frames = 2;
+        else if (!strcmp(argv[i], "-update"))
+            update = 1;
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else if (!iwad)
+            iwad = argv[i];
+        else if (!manifest)
+            manifest = argv[i];
+    }
+    if (!iwad || !manifest) {
+        fprintf(stderr, "usage: %s [-norender] [-frames | -save-frames] [-update]"
+                " [-o report.json] <iwad> <manifest>\n", argv[0]);
+        return 2;
+    }
+    if (frames && update)
+        frames = 2;
+    n = replay_load_manifest(manifest, demos, REPLAY_MAX_DEMOS);
+    if (n < 0) {
+        fprintf(stderr, "[replay] cannot read %s\n", manifest);
+        return 2;
+    }
+
+    report_fd = tool_keep_stdout();
+
+    // frame hashes only repeat at a fixed quality level
+    setenv("UBO_DOOM_GOVERNOR", "0", 0);
+    doom_set_output_format(UBO_OUTPUT_RGB565_BE);
+    if (doom_init(iwad) != 0) {
+        fprintf(stderr, "[replay] doom_init(%s) failed\n", iwad);
+        return 1;
+    }
+    // and level loads only take the same tics on the virtual clock
+    doom_set_time_source(UBO_TIME_VIRTUAL);
+    // Get past the first title tic so a queued demo is not cancelled by it.
+    doom_simulate(1, NULL);
+
+    for (i = 0; i < n; i++) {
+        replay_demo_t* d = &demos[i];
+
+        if (replay_run(d, render, frames) != 0 && !doom_is_alive())
+            break;
+        if (!replay_matches(d)) {
+            failed = 1;
+            fprintf(stderr, "[replay] %s: FAIL %d tics %08x, expected %d tics %08x\n",
+                    d->file, d->tics, d->hash, d->want_tics, d->want_hash);
+        } else {
+            fprintf(stderr, "[replay] %s: ok %d tics %08x\n", d->file, d->tics, d->hash);
+        }
+    }
+
+    out = out_path ? fopen(out_path, "w") : fdopen(report_fd, "w");
+    if (!out) {
+        fprintf(stderr, "[replay] cannot open %s\n", out_path ? out_path : "stdout");
+        return 1;
+    }
+    replay_write_json(out, iwad, render, frames, demos, n);
+    fclose(out);
+
+    if (update) {
+        if (replay_save_manifest(manifest, demos, n) != 0) {
+            fprintf(stderr, "[replay] cannot write %s\n", manifest);
+            return 1;
+        }
+        failed = 0;
+    }
+    for (i = 0; i < n && frames == 2 && render; i++) {
+        if (!demos[i].ok || !demos[i].frame_hashes)
+            continue;
+        if (replay_save_frames(&demos[i]) != 0) {
+            fprintf(stderr, "[replay] cannot write %s\n", demos[i].frames_path);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < n; i++)
+        free(demos[i].frame_hashes);
+
+    doom_shutdown();
+    return failed;
+}
@@ -0,0 +1,265 @@
+// ubodoom_soak: crash-recovery soak test for doom_reset() and doom_init().
+//
+//   ubodoom_soak [-cycles N] [-tics T] [-max-rss-kb K] [-o report.json] <iwad>
+//
+// Starts the engine, then N times (default 200): runs T tics (default 70) of
+// the title loop, forces an I_Error inside a tic (a demo lump that is not in
+// the WAD), checks the engine reports itself dead, then doom_reset()s,
+// doom_init()s again and ticks until the first frame is published, as
+// ubo_app recovers from a crash.  After each cycle it takes the RSS
+// (/proc/self/statm), the zone size, the open file descriptors with how many
+// of them are the IWAD and ALSA devices (/dev/snd), the doom_init() time and
+// the time from doom_init() to the first frame.  The JSON report carries
+// every cycle and a summary that compares the last cycle with the second
+// (the first still fills heap arenas and lazily built tables).  Exits 1 when
+// a cycle fails, the fd count grew or the RSS grew by more than K KB
+// (default 2048).  Engine chatter goes to stderr; the report goes to stdout
+// (or -o).
+
+#include "doom_api.h"
+#include "ubodoom_tool.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "d_event.h"
+
+extern char* defdemoname;       // g_game.c
+
+#define SOAK_MAX_CYCLES 100000
+#define SOAK_FRAME_TICS (35 * 10)   // give up on a first frame after 10 s of tics
+
+typedef struct soak_sample_s {
+    int ok;
+    long rss_kb;
+    long zone_kb;
+    int fds;
+    int wad_fds;
+    int snd_fds;
+    double init_ms;
+    double first_frame_ms;
+} soak_sample_t;
+
+static long soak_rss_kb(void)
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    long size, resident = 0;
+
+    if (!f) return -1;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+        resident = -1;
+    fclose(f);
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Open fds, and how many are the IWAD and ALSA devices.
+static void soak_count_fds(const char* wad, soak_sample_t* s)
+{
+    DIR* dir = opendir("/proc/self/fd");
+    struct dirent* e;
+    char link[300];
+    char target[PATH_MAX];
+    ssize_t n;
+
+    s->fds = s->wad_fds = s->snd_fds = 0;
+    if (!dir) return;
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] == '.' || atoi(e->d_name) == dirfd(dir))
+            continue;
+        s->fds++;
+        snprintf(link, sizeof(link), "/proc/self/fd/%s", e->d_name);
+        n = readlink(link, target, sizeof(target) - 1);
+        if (n <= 0) continue;
+        target[n] = '\0';
+        if (!strcmp(target, wad))
+            s->wad_fds++;
+        else if (!strncmp(target, "/dev/snd/", 9))
+            s->snd_fds++;
+    }
+    closedir(dir);
+}
+
+// doom_init(), then tics until a frame is published; 0 once it is.
+static int soak_start(const char* iwad, soak_sample_t* s)
+{
+    double t0 = tool_now();
+    uint32_t seq;
+    int tics;
+
+    if (doom_init(iwad) != 0) {
+        fprintf(stderr, "[soak] doom_init(%s) failed\n", iwad);
+        return -1;
+    }
+    s->init_ms = (tool_now() - t0) * 1000.0;
+    seq = doom_get_frame_seq();
+    for (tics = 0; tics < SOAK_FRAME_TICS && doom_get_frame_seq() == seq; tics++)
+        doom_tick();
+    if (doom_get_frame_seq() == seq) {
+        fprintf(stderr, "[soak] no frame within %d tics of doom_init()\n", SOAK_FRAME_TICS);
+        return -1;
+    }
+    s->first_frame_ms = (tool_now() - t0) * 1000.0;
+    return 0;
+}
+
+// Runs tics tics, then an I_Error mid-tic; 0 if the engine died of it.
+static int soak_crash(int tics)
+{
+    for (int i = 0; i < tics; i++)
+        doom_tick();
+    if (!doom_is_alive()) {
+        fprintf(stderr, "[soak] the engine died before the forced crash\n");
+        return -1;
+    }
+    // G_DeferedPlayDemo() stays on the title screen in library mode, so
+    // queue the lump demo by hand: W_CacheLumpName() I_Errors on the next tic
+    defdemoname = "UBOSOAK";
+    gameaction = ga_playdemo;
+    for (int i = 0; i < 2 && doom_is_alive(); i++)
+        doom_tick();
+    if (doom_is_alive()) {
+        fprintf(stderr, "[soak] the forced I_Error did not kill the engine\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void soak_sample(const char* wad, soak_sample_t* s)
+{
+    ubo_zone_stats_t zs;
+
+    s->rss_kb = soak_rss_kb();
+    s->zone_kb = doom_get_zone_stats(&zs) == 0 ? (long)(zs.size / 1024) : -1;
+    soak_count_fds(wad, s);
+}
+
+static void soak_write_json(FILE* out, const char* iwad, int tics, long max_rss_kb,
+                            const soak_sample_t* s, int n, int ok)
+{
+    const soak_sample_t* base = &s[n > 1 ? 1 : 0];
+    const soak_sample_t* last = &s[n - 1];
+    double first_min = 0.0, first_max = 0.0, first_sum = 0.0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        double f = s[i].first_frame_ms;
+
+        first_min = i == 0 || f < first_min ? f : first_min;
+        first_max = i == 0 || f > first_max ? f : first_max;
+        first_sum += f;
+    }
+    fprintf(out, "{\n  \"iwad\": \"%s\",\n  \"cycles\": %d,\n  \"tics\": %d,\n  \"ok\": %s,\n",
+            iwad, n, tics, ok ? "true" : "false");
+    fprintf(out, "  \"summary\": {\"rss_kb_first\": %ld, \"rss_kb_base\": %ld, \"rss_kb_last\": %ld,"
+            " \"rss_growth_kb\": %ld, \"max_rss_growth_kb\": %ld,\n"
+            "              \"fds_base\": %d, \"fds_last\": %d, \"wad_fds_last\": %d,"
+            " \"snd_fds_last\": %d, \"zone_kb_last\": %ld,\n"
+            "              \"first_frame_ms\": {\"min\": %.2f, \"mean\": %.2f, \"max\": %.2f}},\n"
+            "  \"samples\": [",
+            s[0].rss_kb, base->rss_kb, last->rss_kb, last->rss_kb - base->rss_kb, max_rss_kb,
+            base->fds, last->fds, last->wad_fds, last->snd_fds, last->zone_kb,
+            first_min, n ? first_sum / n : 0.0, first_max);
+    for (i = 0; i < n; i++)
+        fprintf(out, "%s\n    {\"cycle\": %d, \"ok\": %s, \"rss_kb\": %ld, \"zone_kb\": %ld,"
+                " \"fds\": %d, \"wad_fds\": %d, \"snd_fds\": %d, \"init_ms\": %.2f,"
+                " \"first_frame_ms\": %.2f}",
+                i ? "," : "", i, s[i].ok ? "true" : "false", s[i].rss_kb, s[i].zone_kb,
+                s[i].fds, s[i].wad_fds, s[i].snd_fds, s[i].init_ms, s[i].first_frame_ms);
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* out_path = NULL;
+    const char* iwad = NULL;
+    char wad[PATH_MAX];
+    int cycles = 200;
+    int tics = 70;
+    long max_rss_kb = 2048;
+    soak_sample_t* samples;
+    int report_fd;
+    int ok = 1;
+    int n = 0;
+    FILE* out;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-cycles") && i + 1 < argc)
+            cycles = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-tics") && i + 1 < argc)
+            tics = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-max-rss-kb") && i + 1 < argc)
+            max_rss_kb = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else if (!iwad)
+            iwad = argv[i];
+    }
+    if (!iwad || cycles < 1 || cycles > SOAK_MAX_CYCLES || tics < 0) {
+        fprintf(stderr, "usage: %s [-cycles 1-%d] [-tics T] [-max-rss-kb K] [-o report.json] <iwad>\n",
+                argv[0], SOAK_MAX_CYCLES);
+        return 2;
+    }
+    if (!realpath(iwad, wad)) {
+        fprintf(stderr, "[soak] cannot find %s\n", iwad);
+        return 2;
+    }
+    samples = calloc(cycles, sizeof(*samples));
+    if (!samples) return 1;
+
+    report_fd = tool_keep_stdout();
+
+    // the RGB565 path is the one that publishes frames (doom_get_frame_seq)
+    doom_set_output_format(UBO_OUTPUT_RGB565_BE);
+    if (soak_start(iwad, &samples[0]) != 0)
+        return 1;
+    for (n = 0; n < cycles; n++) {
+        soak_sample_t* s = &samples[n];
+
+        if (soak_crash(tics) != 0)
+            break;
+        doom_reset();
+        if (soak_start(iwad, s) != 0)
+            break;
+        soak_sample(wad, s);
+        s->ok = 1;
+        if (n % 50 == 49)
+            fprintf(stderr, "[soak] cycle %d: rss %ld KB, %d fds, first frame %.1f ms\n",
+                    n + 1, s->rss_kb, s->fds, s->first_frame_ms);
+    }
+    if (n < cycles) {
+        ok = 0;
+        n++;                        // report the cycle that failed
+    } else if (n > 1) {
+        const soak_sample_t* base = &samples[1];
+        const soak_sample_t* last = &samples[n - 1];
+
+        if (last->fds > base->fds) {
+            fprintf(stderr, "[soak] FAIL: open fds grew from %d to %d\n", base->fds, last->fds);
+            ok = 0;
+        }
+        if (last->rss_kb - base->rss_kb > max_rss_kb) {
+            fprintf(stderr, "[soak] FAIL: RSS grew %ld KB (limit %ld)\n",
+                    last->rss_kb - base->rss_kb, max_rss_kb);
+            ok = 0;
+        }
+    }
+
+    out = out_path ? fopen(out_path, "w") : fdopen(report_fd, "w");
+    if (!out) {
+        fprintf(stderr, "[soak] cannot open %s\n", out_path ? out_path : "stdout");
+        return 1;
+    }
+    soak_write_json(out, iwad, tics, max_rss_kb, samples, n, ok);
+    fclose(out);
+
+    if (doom_is_alive())
+        doom_shutdown();
+    free(samples);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+#ifndef UBO_TOOL_H
+#define UBO_TOOL_H
+
+#include <time.h>
+#include <unistd.h>
+
+// Scaffolding the headless tools (ubodoom_bench, ubodoom_replay,
+// ubodoom_kbench, ubodoom_soak) share around the libubodoom objects.
+
+// Give up on a demo that has not finished after 30 minutes of game time.
+#define TOOL_MAX_TICS (35 * 60 * 30)
+
+// Monotonic wall clock, in seconds.
+static inline double tool_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// D_DoomMain prints its banner to stdout; keep stdout for the report.  Points
+// stdout at stderr and returns a descriptor for the original one.
+static inline int tool_keep_stdout(void)
+{
+    int report_fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    return report_fd;
+}
+
+#endif
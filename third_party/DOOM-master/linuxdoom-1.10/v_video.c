@@ -28,6 +28,9 @@ static const char
 rcsid[] = "$Id: v_video.c,v 1.5 1997/02/03 22:45:13 b1 Exp $";
 
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #include "i_system.h"
 #include "r_local.h"
 
@@ -38,10 +41,14 @@ rcsid[] = "$Id: v_video.c,v 1.5 1997/02/03 22:45:13 b1 Exp $";
 #include "m_swap.h"
 
 #include "v_video.h"
+#include "w_wad.h"
 
 
 // Each screen is [SCREENWIDTH*SCREENHEIGHT]; 
 byte*				screens[5];	
+
+int				screenwidth = SCREENWIDTH;
+int				screenheight = SCREENHEIGHT;
  
 int				dirtybox[4]; 
 
@@ -183,6 +190,17 @@ V_CopyRect
     }
 #endif 
     V_MarkRect (destx, desty, width, height); 
+
+    if (screenwidth != SCREENWIDTH)
+    {
+	// the pixels V_DrawPatch covered for the same rectangle
+	width = V_SCALEX(srcx+width) - V_SCALEX(srcx);
+	height = V_SCALEY(srcy+height) - V_SCALEY(srcy);
+	srcx = V_SCALEX(srcx);
+	srcy = V_SCALEY(srcy);
+	destx = V_SCALEX(destx);
+	desty = V_SCALEY(desty);
+    }
 	 
     src = screens[srcscrn]+SCREENWIDTH*srcy+srcx; 
     dest = screens[destscrn]+SCREENWIDTH*desty+destx; 
@@ -196,6 +214,291 @@ V_CopyRect
 } 
  
 
+//
+// V_DrawPatchColumn
+// Column col of a patch, nearest-sampled down to screenheight
+//  rows.  x is a picture column, y the 320x200 row of the
+//  patch top.
+//
+void
+V_DrawPatchColumn
+( int		x,
+  int		y,
+  int		scrn,
+  patch_t*	patch,
+  int		col )
+{
+    column_t*	column;
+    byte*	source;
+    byte*	dest;
+    int		top;
+    int		dy;
+    int		count;
+    fixed_t	frac;
+    fixed_t	fracstep;
+
+    fracstep = (SCREENHEIGHT<<FRACBITS)/screenheight;
+    column = (column_t *)((byte *)patch + LONG(patch->columnofs[col]));
+
+    while (column->topdelta != 0xff )
+    {
+	source = (byte *)column + 3;
+	top = y + column->topdelta;
+	dy = V_SCALEY(top);
+	count = V_SCALEY(top + column->length) - dy;
+	dest = screens[scrn] + dy*SCREENWIDTH + x;
+	frac = ((dy*SCREENHEIGHT - top*screenheight)<<FRACBITS)/screenheight;
+
+	while (count-- > 0)
+	{
+	    *dest = source[frac>>FRACBITS];
+	    dest += SCREENWIDTH;
+	    frac += fracstep;
+	}
+	column = (column_t *)(  (byte *)column + column->length 
+				+ 4 ); 
+    }
+}
+
+
+//
+// V_DrawPatchScaled
+// V_DrawPatch onto a picture smaller than 320x200.
+//
+static void
+V_DrawPatchScaled
+( int		x,
+  int		y,
+  int		scrn,
+  patch_t*	patch,
+  boolean	flip )
+{
+    int		w;
+    int		dx;
+    int		stop;
+    int		col;
+
+    w = SHORT(patch->width);
+    stop = V_SCALEX(x+w);
+
+    for (dx = V_SCALEX(x) ; dx<stop ; dx++)
+    {
+	col = dx*SCREENWIDTH/screenwidth - x;
+	V_DrawPatchColumn (dx, y, scrn, patch, flip ? w-1-col : col);
+    }
+}
+
+
+//
+// V_DrawPatch565
+// UBO: a patch drawn over a view that went to screen565 (view565)
+//  goes there as well, or the HUD messages would not show.  Walks
+//  the posts the way V_DrawPatchColumn does, at any picture size.
+//
+static void
+V_DrawPatch565
+( int		x,
+  int		y,
+  patch_t*	patch,
+  boolean	flip )
+{
+    column_t*		column;
+    byte*		source;
+    unsigned short*	dest;
+    int			w;
+    int			dx;
+    int			stop;
+    int			col;
+    int			top;
+    int			dy;
+    int			count;
+    fixed_t		frac;
+    fixed_t		fracstep;
+
+    w = SHORT(patch->width);
+    stop = V_SCALEX(x+w);
+    fracstep = (SCREENHEIGHT<<FRACBITS)/screenheight;
+
+    for (dx = V_SCALEX(x) ; dx<stop ; dx++)
+    {
+	col = dx*SCREENWIDTH/screenwidth - x;
+	if (flip)
+	    col = w-1-col;
+	column = (column_t *)((byte *)patch + LONG(patch->columnofs[col]));
+
+	while (column->topdelta != 0xff )
+	{
+	    source = (byte *)column + 3;
+	    top = y + column->topdelta;
+	    dy = V_SCALEY(top);
+	    count = V_SCALEY(top + column->length) - dy;
+	    dest = screen565 + dy*SCREENWIDTH + dx;
+	    frac = ((dy*SCREENHEIGHT - top*screenheight)<<FRACBITS)/screenheight;
+
+	    while (count-- > 0)
+	    {
+		*dest = palette565[source[frac>>FRACBITS]];
+		dest += SCREENWIDTH;
+		frac += fracstep;
+	    }
+	    column = (column_t *)(  (byte *)column + column->length 
+				    + 4 ); 
+	}
+    }
+}
+
+
+//
+// UBO: patches served from the WAD mapping keep their address for the
+//  session, so V_DrawPatch remembers them flattened to rows.  Opaque
+//  patches (menu and intermission pictures, status bar numbers) are a
+//  memcpy per row; the rest (hu_font glyphs and the like) select their
+//  posts' pixels through a byte mask.  The glyphs end up in this table
+//  like an atlas, without HUlib having to know about it.
+//
+#define PATCHCACHESIZE		512		// power of two
+#define PATCHCACHEBYTES		(1024*1024)
+#define PATCHPROBES		8
+
+typedef struct
+{
+    const patch_t*	patch;
+    int			width;
+    int			height;
+    byte*		pixels;		// width*height rows, NULL = draw by post
+    byte*		mask;		// 0xff where a post covers, NULL = opaque
+} flatpatch_t;
+
+static flatpatch_t	patchcache[PATCHCACHESIZE];
+static int		patchcachebytes;
+
+void V_FlushPatches (void)
+{
+    int		i;
+
+    for (i=0 ; i<PATCHCACHESIZE ; i++)
+	free (patchcache[i].pixels);
+    memset (patchcache, 0, sizeof(patchcache));
+    patchcachebytes = 0;
+}
+
+//
+// V_FlattenPatch
+// Rows of the patch, or NULL pixels if a post runs past its height
+//  (vanilla draws those below the patch) or it is not worth keeping.
+//
+static void V_FlattenPatch (flatpatch_t* fp, const patch_t* patch)
+{
+    const column_t*	column;
+    const byte*		source;
+    int			w, h, col, i, top, covered;
+    byte*		pixels;
+    byte*		mask;
+
+    w = SHORT(patch->width);
+    h = SHORT(patch->height);
+    fp->patch = patch;
+    fp->width = w;
+    fp->height = h;
+    fp->pixels = fp->mask = NULL;
+    if (w <= 0 || h <= 0 || w > SCREENWIDTH || h > SCREENHEIGHT)
+	return;
+
+    pixels = malloc (w*h*2);
+    if (!pixels)
+	return;
+    mask = pixels + w*h;
+    memset (mask, 0, w*h);
+    covered = 0;
+
+    for (col=0 ; col<w ; col++)
+    {
+	column = (const column_t *)((const byte *)patch
+				    + LONG(patch->columnofs[col]));
+	while (column->topdelta != 0xff)
+	{
+	    top = column->topdelta;
+	    if (top + column->length > h)
+	    {
+		free (pixels);
+		return;
+	    }
+	    source = (const byte *)column + 3;
+	    for (i=0 ; i<column->length ; i++)
+	    {
+		pixels[(top+i)*w+col] = source[i];
+		covered += !mask[(top+i)*w+col];
+		mask[(top+i)*w+col] = 0xff;
+	    }
+	    column = (const column_t *)((const byte *)column
+					+ column->length + 4);
+	}
+    }
+
+    if (covered == w*h)
+    {
+	mask = NULL;
+	pixels = realloc (pixels, w*h);
+    }
+    fp->pixels = pixels;
+    fp->mask = mask;
+    patchcachebytes += mask ? w*h*2 : w*h;
+}
+
+//
+// V_FlatPatch
+// The flattened patch, or NULL to draw it by post.
+//
+static flatpatch_t* V_FlatPatch (const patch_t* patch)
+{
+    flatpatch_t*	fp;
+    unsigned		slot;
+    int			i;
+
+    if (!W_IsMappedPtr (patch))
+	return NULL;
+
+    slot = (unsigned)(((uintptr_t)patch >> 2) * 2654435761u);
+    for (i=0 ; i<PATCHPROBES ; i++)
+    {
+	fp = &patchcache[(slot + i) & (PATCHCACHESIZE-1)];
+	if (fp->patch == patch)
+	    return fp->pixels ? fp : NULL;
+	if (!fp->patch)
+	    break;
+    }
+    if (i == PATCHPROBES || patchcachebytes > PATCHCACHEBYTES)
+    {
+	V_FlushPatches ();
+	fp = &patchcache[slot & (PATCHCACHESIZE-1)];
+    }
+    V_FlattenPatch (fp, patch);
+    return fp->pixels ? fp : NULL;
+}
+
+static void V_DrawFlatPatch (byte* desttop, const flatpatch_t* fp)
+{
+    const byte*	src;
+    const byte*	mask;
+    int		w, x, y;
+
+    w = fp->width;
+    src = fp->pixels;
+    mask = fp->mask;
+    for (y=0 ; y<fp->height ; y++, desttop += SCREENWIDTH, src += w)
+    {
+	if (!mask)
+	{
+	    memcpy (desttop, src, w);
+	    continue;
+	}
+	for (x=0 ; x<w ; x++)
+	    desttop[x] = (src[x] & mask[x]) | (desttop[x] & ~mask[x]);
+	mask += w;
+    }
+}
+
+
 //
 // V_DrawPatch
 // Masks a column based masked pic to the screen. 
@@ -215,6 +518,7 @@ V_DrawPatch
     byte*	dest;
     byte*	source; 
     int		w; 
+    flatpatch_t* fp;
 	 
     y -= SHORT(patch->topoffset); 
     x -= SHORT(patch->leftoffset); 
@@ -234,6 +538,21 @@ V_DrawPatch
  
     if (!scrn)
 	V_MarkRect (x, y, SHORT(patch->width), SHORT(patch->height)); 
+    if (!scrn && view565)
+	V_DrawPatch565 (x, y, patch, false);
+
+    if (screenwidth != SCREENWIDTH)
+    {
+	V_DrawPatchScaled (x, y, scrn, patch, false);
+	return;
+    }
+
+    fp = V_FlatPatch (patch);
+    if (fp)
+    {
+	V_DrawFlatPatch (screens[scrn]+y*SCREENWIDTH+x, fp);
+	return;
+    }
 
     col = 0; 
     desttop = screens[scrn]+y*SCREENWIDTH+x; 
@@ -299,6 +618,14 @@ V_DrawPatchFlipped
  
     if (!scrn)
 	V_MarkRect (x, y, SHORT(patch->width), SHORT(patch->height)); 
+    if (!scrn && view565)
+	V_DrawPatch565 (x, y, patch, true);
+
+    if (screenwidth != SCREENWIDTH)
+    {
+	V_DrawPatchScaled (x, y, scrn, patch, true);
+	return;
+    }
 
     col = 0; 
     desttop = screens[scrn]+y*SCREENWIDTH+x; 
@@ -476,6 +803,22 @@ V_GetBlock
 
 
 
+//
+// V_Shutdown
+// Frees the buffer screens and the flattened patches.
+//
+void V_Shutdown (void)
+{
+    int		i;
+
+    V_FlushPatches ();
+    // screens 0-3 are one I_AllocLow block; 4 is in the zone
+    free (screens[0]);
+    for (i=0 ; i<4 ; i++)
+	screens[i] = NULL;
+}
+
+
 //
 // V_Init
 // 
@@ -486,6 +829,9 @@ void V_Init (void)
 		
     // stick these in low dos memory on PCs
 
+    // a new WAD mapping may reuse the old addresses
+    V_Shutdown ();
+
     base = I_AllocLow (SCREENWIDTH*SCREENHEIGHT*4);
 
     for (i=0 ; i<4 ; i++)
@@ -46,6 +46,19 @@
 
 extern	byte*		screens[5];
 
+// Size of the picture in screens[]: SCREENWIDTH x SCREENHEIGHT, or
+//  smaller to draw straight at the LCD resolution.  Rows keep the
+//  SCREENWIDTH pitch either way.  Patch and rectangle coordinates
+//  stay 320x200; V_SCALEX/V_SCALEY round them up onto the picture,
+//  V_UNSCALEX/V_UNSCALEY take picture pixels back.
+extern	int		screenwidth;
+extern	int		screenheight;
+
+#define V_SCALEX(x)	(((x)*screenwidth+SCREENWIDTH-1)/SCREENWIDTH)
+#define V_SCALEY(y)	(((y)*screenheight+SCREENHEIGHT-1)/SCREENHEIGHT)
+#define V_UNSCALEX(x)	((x)*SCREENWIDTH/screenwidth)
+#define V_UNSCALEY(y)	((y)*SCREENHEIGHT/screenheight)
+
 extern  int	dirtybox[4];
 
 extern	byte	gammatable[5][256];
@@ -55,6 +68,10 @@ extern	int	usegamma;
 
 // Allocates buffer screens, call before R_Init.
 void V_Init (void);
+// Frees them again (doom_shutdown).
+void V_Shutdown (void);
+// Frees the flattened patches; V_DrawPatch flattens them again.
+void V_FlushPatches (void);
 
 
 void
@@ -82,6 +99,15 @@ V_DrawPatchDirect
   int		scrn,
   patch_t*	patch );
 
+// One patch column at picture column x, top at (unscaled) row y.
+void
+V_DrawPatchColumn
+( int		x,
+  int		y,
+  int		scrn,
+  patch_t*	patch,
+  int		col );
+
 
 // Draw a linear block of pixels into the view buffer.
 void
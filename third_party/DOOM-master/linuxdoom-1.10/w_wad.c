@@ -34,13 +34,24 @@ rcsid[] = "$Id: w_wad.c,v 1.5 1997/02/03 16:47:57 b1 Exp $";
 #include <malloc.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <alloca.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
 #define O_BINARY		0
 #endif
 
+#ifdef UBO_ZLIB
+#include <zlib.h>
+#endif
+
 #include "doomtype.h"
 #include "m_swap.h"
 #include "i_system.h"
+#include "i_log.h"
+#include "i_trace.h"
 #include "z_zone.h"
 
 #ifdef __GNUG__
@@ -63,6 +74,61 @@ int			numlumps;
 
 void**			lumpcache;
 
+int			wad_mmap;
+
+// Files mapped by W_MapFile, unmapped when the directory is rebuilt.
+#define MAXMAPPEDFILES		20
+
+typedef struct
+{
+    void*	base;
+    int		size;
+} wadmap_t;
+
+static wadmap_t		wadmaps[MAXMAPPEDFILES];
+static int		numwadmaps;
+
+// Name lookup: lumphash[bucket] is the newest lump with that hash,
+//  lumpnext[lump] the next older one, -1 ends a chain.
+static int*		lumphash;
+static int*		lumpnext;
+static unsigned		lumphashmask;
+
+// Background prefetch (W_PrefetchLumps).
+static pthread_t	prefetchthread;
+static int		prefetchrunning;
+static atomic_int	prefetchcancel;
+static int*		prefetchlist;
+static int		numprefetch;
+
+// Shared lump cache (W_CacheLumpShared): a lump's shard is lump
+//  modulo SHAREDSHARDS, its copy lives in that shard's chunks.
+#define SHAREDSHARDS		16
+#define SHAREDCHUNK		(64*1024)
+
+typedef struct sharedchunk_s
+{
+    struct sharedchunk_s*	next;
+    int				size;	// bytes after the header
+    int				used;
+} sharedchunk_t;
+
+#define SHAREDHEADER		((sizeof(sharedchunk_t)+15) & ~15)
+
+typedef struct
+{
+    pthread_mutex_t	lock;
+    sharedchunk_t*	chunks;		// the one being filled first
+} sharedshard_t;
+
+static void**		sharedcache;	// per lump, NULL until copied
+static sharedshard_t	sharedshards[SHAREDSHARDS] =
+{
+    [0 ... SHAREDSHARDS-1] = { PTHREAD_MUTEX_INITIALIZER, NULL }
+};
+int			sharedcachebytes;
+unsigned		sharedcachemisses;
+
 
 #define strcmpi	strcasecmp
 
@@ -117,6 +183,553 @@ ExtractFileBase
 
 
 
+//
+// W_MapFile
+// Maps a whole file privately and points its lumps into the mapping.
+// Writable copy-on-write so any in-place fixups
+//  still work; untouched pages stay shared with the page cache.
+// Lumps that are misaligned or run past the end of the file keep
+//  going through W_ReadLump into the zone.
+//
+static void W_MapFile (int handle, int startlump)
+{
+    int		size;
+    byte*	base;
+    int		i;
+    lumpinfo_t*	lump_p;
+
+    size = filelength (handle);
+    if (size <= 0 || numwadmaps == MAXMAPPEDFILES)
+	return;
+
+    base = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, handle, 0);
+    if (base == MAP_FAILED)
+    {
+	printf (" mmap failed, reading lumps instead\n");
+	return;
+    }
+
+    // Start readahead now so level loads page in from RAM.
+    madvise (base, size, MADV_WILLNEED);
+
+    wadmaps[numwadmaps].base = base;
+    wadmaps[numwadmaps].size = size;
+    numwadmaps++;
+
+    for (i=startlump, lump_p=&lumpinfo[startlump] ; i<numlumps ; i++, lump_p++)
+    {
+	if (lump_p->position < 0 || lump_p->size < 0
+	    || (long)lump_p->position + lump_p->size > size
+	    || (lump_p->position & 3))
+	    continue;
+	lump_p->mapped = base + lump_p->position;
+    }
+}
+
+
+//
+// W_ReleasePages
+// Asks the kernel to reclaim the mapped WADs' resident pages; clean
+//  ones are dropped and read back from the file when next touched.
+//
+void W_ReleasePages (void)
+{
+    int		i;
+
+    for (i=0 ; i<numwadmaps ; i++)
+    {
+#ifdef MADV_PAGEOUT
+	if (!madvise (wadmaps[i].base, wadmaps[i].size, MADV_PAGEOUT))
+	    continue;
+#endif
+#ifdef MADV_COLD
+	madvise (wadmaps[i].base, wadmaps[i].size, MADV_COLD);
+#endif
+    }
+}
+
+
+//
+// W_ResidentBytes
+// The mapped WADs' pages in RAM, shared with the page cache or not.
+//
+int W_ResidentBytes (void)
+{
+    int		resident = 0;
+    int		i;
+
+    for (i=0 ; i<numwadmaps ; i++)
+	resident += I_ResidentBytes (wadmaps[i].base, wadmaps[i].size);
+    return resident;
+}
+
+
+//
+// W_IsMappedPtr
+// Derived data can be keyed by the address of a mapped lump: it stays
+//  put until the directory is rebuilt.
+//
+int W_IsMappedPtr (const void* ptr)
+{
+    int		i;
+
+    for (i=0 ; i<numwadmaps ; i++)
+	if ((const byte*)ptr >= (byte*)wadmaps[i].base
+	    && (const byte*)ptr < (byte*)wadmaps[i].base + wadmaps[i].size)
+	    return 1;
+    return 0;
+}
+
+
+//
+// W_MappedBytes
+//
+int W_MappedBytes (const void* ptr)
+{
+    int		i;
+
+    for (i=0 ; i<numwadmaps ; i++)
+	if ((const byte*)ptr >= (byte*)wadmaps[i].base
+	    && (const byte*)ptr < (byte*)wadmaps[i].base + wadmaps[i].size)
+	    return (byte*)wadmaps[i].base + wadmaps[i].size - (const byte*)ptr;
+    return 0;
+}
+
+
+//
+// ZIP / PK3 CONTAINERS
+// UBO: a .pk3 or .zip adds its files as lumps named by their base
+//  name, like single lump files.  Files under flats/ and sprites/
+//  come after the rest, between F_START/F_END and S_START/S_END
+//  markers of their own, and a maps/*.wad adds that WAD's lumps.
+//  W_AddFile reads only the central directory; a member's local
+//  header is read, and the member inflated, when first used.
+// Inflated members are kept in a cache outside the zone of up to
+//  zipcachelimit bytes, least recently read evicted first, so a lump
+//  purged from the zone or the next lump of a map WAD costs no second
+//  inflate.  Members over a quarter of the limit that are one lump go
+//  straight into the caller's buffer and are not kept.
+//
+#define ZIP_EOCD		0x06054b50
+#define ZIP_CENTRAL		0x02014b50
+#define ZIP_LOCAL		0x04034b50
+#define ZIP_STORED		0
+#define ZIP_DEFLATED		8
+#define ZIP_MAXCOMMENT		65535
+
+typedef struct
+{
+    int		handle;
+    int		header;		// local header offset in the file
+    int		position;	// data offset, -1 until the header is read
+    int		method;
+    int		csize;
+    int		size;
+    unsigned	crc;
+    byte*	data;		// inflated, NULL unless cached
+    unsigned	lastuse;
+} zipmember_t;
+
+int			zipcachelimit = 2*1024*1024;	// UBO_DOOM_PK3_CACHE_MB
+int			zipcachebytes;
+unsigned		zipinflates;
+
+static zipmember_t*	zipmembers;
+static int		numzipmembers;
+static unsigned		zipclock;
+// lumps may be read from render threads (R_CacheLumpNum)
+static pthread_mutex_t	ziplock = PTHREAD_MUTEX_INITIALIZER;
+
+static int		lumpslots;	// lumpinfo entries allocated
+
+
+static unsigned W_Zip16 (const byte* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned W_Zip32 (const byte* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+
+//
+// W_NewLump
+// Appends a lump to lumpinfo, growing it as needed.
+//
+static lumpinfo_t* W_NewLump (const char* name, int handle, int member)
+{
+    lumpinfo_t*	lump_p;
+    int		i;
+
+    if (numlumps == lumpslots)
+    {
+	lumpslots = lumpslots < 64 ? 64 : lumpslots*2;
+	lumpinfo = realloc (lumpinfo, lumpslots*sizeof(lumpinfo_t));
+	if (!lumpinfo)
+	    I_Error ("Couldn't realloc lumpinfo");
+    }
+    lump_p = &lumpinfo[numlumps++];
+    memset (lump_p, 0, sizeof(*lump_p));
+    for (i=0 ; i<8 && name[i] ; i++)
+	lump_p->name[i] = name[i];
+    lump_p->handle = handle;
+    lump_p->member = member;
+    return lump_p;
+}
+
+
+//
+// W_ZipMemberName
+// The lump name of a member path, or 0 if it makes none: directories,
+//  and base names longer than eight characters.
+//
+static int W_ZipMemberName (const char* path, int length, char* name)
+{
+    const char*	base = path;
+    int		i;
+
+    if (!length || path[length-1] == '/')
+	return 0;
+    for (i=0 ; i<length ; i++)
+	if (path[i] == '/')
+	    base = path + i + 1;
+    memset (name, 0, 8);
+    for (i=0 ; base + i < path + length && base[i] != '.' ; i++)
+    {
+	if (i == 8)
+	    return 0;
+	name[i] = toupper (base[i]);
+    }
+    return i > 0;
+}
+
+
+//
+// W_ZipRead
+// Inflates member m into dest, which holds m->size bytes.
+//
+static void W_ZipRead (zipmember_t* m, byte* dest)
+{
+    byte	local[30];
+    byte*	packed;
+
+    if (m->position < 0)
+    {
+	if (pread (m->handle, local, sizeof(local), m->header) != sizeof(local)
+	    || W_Zip32 (local) != ZIP_LOCAL)
+	    I_Error ("W_ZipRead: bad local header at %i", m->header);
+	m->position = m->header + sizeof(local)
+	    + W_Zip16 (local+26) + W_Zip16 (local+28);
+    }
+
+    if (m->method == ZIP_STORED)
+    {
+	if (pread (m->handle, dest, m->size, m->position) != m->size)
+	    I_Error ("W_ZipRead: short read at %i", m->position);
+	return;
+    }
+
+#ifdef UBO_ZLIB
+    {
+	z_stream	zs;
+	int		err;
+
+	packed = malloc (m->csize ? m->csize : 1);
+	if (!packed)
+	    I_Error ("W_ZipRead: failed on allocation of %i bytes", m->csize);
+	if (pread (m->handle, packed, m->csize, m->position) != m->csize)
+	    I_Error ("W_ZipRead: short read at %i", m->position);
+
+	UBO_TRACE_BEGIN ("inflate_lump");
+	memset (&zs, 0, sizeof(zs));
+	if (inflateInit2 (&zs, -MAX_WBITS) != Z_OK)
+	    I_Error ("W_ZipRead: inflateInit failed");
+	zs.next_in = packed;
+	zs.avail_in = m->csize;
+	zs.next_out = dest;
+	zs.avail_out = m->size;
+	err = inflate (&zs, Z_FINISH);
+	inflateEnd (&zs);
+	free (packed);
+	UBO_TRACE_END ();
+
+	if (err != Z_STREAM_END || zs.total_out != (uLong)m->size
+	    || crc32 (0, dest, m->size) != m->crc)
+	    I_Error ("W_ZipRead: corrupt member at %i (%i)", m->header, err);
+	zipinflates++;
+    }
+#else
+    (void)packed;
+    I_Error ("W_ZipRead: built without zlib (ZLIB=0)");
+#endif
+}
+
+
+//
+// W_ZipCache
+// Hands an inflated member to the cache, evicting the least recently
+//  read ones to make room; frees it instead if it can never fit.
+//
+static void W_ZipCache (zipmember_t* m, byte* data)
+{
+    zipmember_t*	lru;
+    int			i;
+
+    if (m->size > zipcachelimit)
+    {
+	free (data);
+	return;
+    }
+    while (zipcachebytes + m->size > zipcachelimit)
+    {
+	lru = NULL;
+	for (i=0 ; i<numzipmembers ; i++)
+	    if (zipmembers[i].data
+		&& (!lru || zipmembers[i].lastuse < lru->lastuse))
+		lru = &zipmembers[i];
+	if (!lru)
+	    break;
+	free (lru->data);
+	lru->data = NULL;
+	zipcachebytes -= lru->size;
+    }
+    m->data = data;
+    m->lastuse = ++zipclock;
+    zipcachebytes += m->size;
+}
+
+
+//
+// W_ReadZipLump
+// Copies lump l out of its member: from the cache, straight from an
+//  inflate, or through the cache.
+//
+static void W_ReadZipLump (lumpinfo_t* l, void* dest)
+{
+    zipmember_t*	m = &zipmembers[l->member];
+    byte*		data;
+
+    pthread_mutex_lock (&ziplock);
+    if (m->data)
+    {
+	m->lastuse = ++zipclock;
+	memcpy (dest, m->data + l->position, l->size);
+	pthread_mutex_unlock (&ziplock);
+	return;
+    }
+    if (l->position == 0 && l->size == m->size
+	&& m->size > zipcachelimit/4)
+    {
+	W_ZipRead (m, dest);
+	pthread_mutex_unlock (&ziplock);
+	return;
+    }
+
+    data = malloc (m->size ? m->size : 1);
+    if (!data)
+	I_Error ("W_ReadZipLump: failed on allocation of %i bytes", m->size);
+    W_ZipRead (m, data);
+    memcpy (dest, data + l->position, l->size);
+    W_ZipCache (m, data);
+    pthread_mutex_unlock (&ziplock);
+}
+
+
+//
+// W_FlushZipCache
+// Frees every cached member (doom_suspend, over the memory budget).
+//
+void W_FlushZipCache (void)
+{
+    int		i;
+
+    pthread_mutex_lock (&ziplock);
+    for (i=0 ; i<numzipmembers ; i++)
+    {
+	free (zipmembers[i].data);
+	zipmembers[i].data = NULL;
+    }
+    zipcachebytes = 0;
+    pthread_mutex_unlock (&ziplock);
+}
+
+
+//
+// W_AddZipWad
+// The lumps of a WAD inside the zip: its directory is read out of the
+//  inflated member, which is then cached for the level load.
+//
+static void W_AddZipWad (int member, const char* path)
+{
+    zipmember_t*	m = &zipmembers[member];
+    byte*		data;
+    filelump_t*		fileinfo;
+    lumpinfo_t*		lump_p;
+    int			count;
+    int			offset;
+    int			i;
+
+    data = malloc (m->size ? m->size : 1);
+    if (!data)
+	I_Error ("W_AddZipWad: failed on allocation of %i bytes", m->size);
+    W_ZipRead (m, data);
+
+    count = m->size >= 12 ? LONG(*(int *)(data+4)) : -1;
+    offset = m->size >= 12 ? LONG(*(int *)(data+8)) : -1;
+    if ((memcmp (data, "IWAD", 4) && memcmp (data, "PWAD", 4))
+	|| count < 0 || offset < 0
+	|| (long long)offset + (long long)count*sizeof(filelump_t) > m->size)
+    {
+	printf (" %s: not a WAD, skipped\n", path);
+	free (data);
+	return;
+    }
+
+    fileinfo = (filelump_t *)(data + offset);
+    for (i=0 ; i<count ; i++, fileinfo++)
+    {
+	lump_p = W_NewLump (fileinfo->name, m->handle, member);
+	lump_p->position = LONG(fileinfo->filepos);
+	lump_p->size = LONG(fileinfo->size);
+	if (lump_p->position < 0 || lump_p->size < 0
+	    || (long long)lump_p->position + lump_p->size > m->size)
+	    I_Error ("W_AddZipWad: lump %.8s of %s out of range",
+		     fileinfo->name, path);
+    }
+    W_ZipCache (m, data);
+}
+
+
+//
+// W_AddZipFile
+// Adds the members of a zip/pk3 as lumps.
+//
+static void W_AddZipFile (int handle, const char* filename)
+{
+    static const char*	spaces[3][3] = {
+	{ NULL, NULL, NULL },
+	{ "flats/", "F_START", "F_END" },
+	{ "sprites/", "S_START", "S_END" },
+    };
+    byte*	tail;
+    byte*	central;
+    byte*	p;
+    int		size = filelength (handle);
+    int		tailsize;
+    int		entries;
+    int		cdsize;
+    int		cdoffset;
+    int		pass;
+    int		start;
+    int		i;
+    int		n;
+    char	name[8];
+
+    tailsize = size < ZIP_MAXCOMMENT+22 ? size : ZIP_MAXCOMMENT+22;
+    tail = malloc (tailsize ? tailsize : 1);
+    if (!tail || pread (handle, tail, tailsize, size - tailsize) != tailsize)
+	I_Error ("W_AddZipFile: couldn't read %s", filename);
+    for (p = tail + tailsize - 22 ; p >= tail ; p--)
+	if (W_Zip32 (p) == ZIP_EOCD)
+	    break;
+    if (p < tail)
+	I_Error ("W_AddZipFile: %s is not a zip file", filename);
+    entries = W_Zip16 (p+10);
+    cdsize = W_Zip32 (p+12);
+    cdoffset = W_Zip32 (p+16);
+    free (tail);
+    if (entries == 0xffff || cdsize < 0 || cdoffset < 0
+	|| (long long)cdoffset + cdsize > size)
+	I_Error ("W_AddZipFile: %s: zip64 or a broken directory", filename);
+
+    central = malloc (cdsize ? cdsize : 1);
+    if (!central || pread (handle, central, cdsize, cdoffset) != cdsize)
+	I_Error ("W_AddZipFile: couldn't read the directory of %s", filename);
+
+    // one member per entry, whether or not it makes a lump
+    zipmembers = realloc (zipmembers,
+			  (numzipmembers+entries)*sizeof(zipmember_t));
+    if (!zipmembers)
+	I_Error ("W_AddZipFile: couldn't realloc the members");
+
+    // the rest first, then each marker namespace
+    for (pass=0 ; pass<3 ; pass++)
+    {
+	start = numlumps;
+	if (spaces[pass][1])
+	    W_NewLump (spaces[pass][1], handle, -1);
+
+	for (i=0, p=central ; i<entries ; i++, p += 46 + n + W_Zip16 (p+30) + W_Zip16 (p+32))
+	{
+	    zipmember_t*	m = &zipmembers[numzipmembers+i];
+	    const char*		path = (const char *)p + 46;
+	    int			space = 0;
+	    int			wad;
+
+	    if (p + 46 > central + cdsize || W_Zip32 (p) != ZIP_CENTRAL)
+		I_Error ("W_AddZipFile: %s: broken directory", filename);
+	    n = W_Zip16 (p+28);
+	    if (p + 46 + n > central + cdsize)
+		I_Error ("W_AddZipFile: %s: broken directory", filename);
+
+	    if (pass == 0)
+	    {
+		memset (m, 0, sizeof(*m));
+		m->handle = handle;
+		m->header = W_Zip32 (p+42);
+		m->position = -1;
+		m->method = W_Zip16 (p+10);
+		m->crc = W_Zip32 (p+16);
+		m->csize = W_Zip32 (p+20);
+		m->size = W_Zip32 (p+24);
+	    }
+
+	    if (!strncasecmp (path, spaces[1][0], 6))
+		space = 1;
+	    else if (!strncasecmp (path, spaces[2][0], 8))
+		space = 2;
+	    if (space != pass || !W_ZipMemberName (path, n, name))
+		continue;
+
+	    if ((m->method != ZIP_STORED && m->method != ZIP_DEFLATED)
+		|| m->csize < 0 || m->size < 0)
+	    {
+		printf (" %s: %.*s: method %i not supported, skipped\n",
+			filename, n, path, m->method);
+		continue;
+	    }
+#ifndef UBO_ZLIB
+	    if (m->method == ZIP_DEFLATED)
+	    {
+		printf (" %s: %.*s: built without zlib, skipped\n",
+			filename, n, path);
+		continue;
+	    }
+#endif
+
+	    wad = n > 9 && !strncasecmp (path, "maps/", 5)
+		&& !strncasecmp (path + n - 4, ".wad", 4);
+	    if (wad)
+		W_AddZipWad (numzipmembers+i, path);
+	    else
+		W_NewLump (name, handle, numzipmembers+i)->size = m->size;
+	}
+
+	if (!spaces[pass][1])
+	    continue;
+	if (numlumps == start+1)
+	    numlumps--;		// nothing in it, drop the start marker
+	else
+	    W_NewLump (spaces[pass][2], handle, -1);
+    }
+
+    numzipmembers += entries;
+    free (central);
+}
+
+
 //
 // LUMP BASED ROUTINES.
 //
@@ -129,6 +742,7 @@ ExtractFileBase
 //  with multiple lumps.
 // Other files are single lumps with the base filename
 //  for the lump name.
+// UBO: .pk3 and .zip files are zip containers (W_AddZipFile).
 //
 // If filename starts with a tilde, the file is handled
 //  specially to allow map reloads.
@@ -168,6 +782,15 @@ void W_AddFile (char *filename)
 
     printf (" adding %s\n",filename);
     startlump = numlumps;
+
+    if (!strcmpi (filename+strlen(filename)-3, "pk3")
+	|| !strcmpi (filename+strlen(filename)-3, "zip"))
+    {
+	W_AddZipFile (handle, filename);
+	if (numlumps == startlump)
+	    close (handle);
+	return;
+    }
 	
     if (strcmpi (filename+strlen(filename)-3 , "wad" ) )
     {
@@ -208,6 +831,7 @@ void W_AddFile (char *filename)
 
     if (!lumpinfo)
 	I_Error ("Couldn't realloc lumpinfo");
+    lumpslots = numlumps;
 
     lump_p = &lumpinfo[startlump];
 	
@@ -219,10 +843,14 @@ void W_AddFile (char *filename)
 	lump_p->position = LONG(fileinfo->filepos);
 	lump_p->size = LONG(fileinfo->size);
 	strncpy (lump_p->name, fileinfo->name, 8);
+	lump_p->mapped = NULL;
+	lump_p->member = -1;
     }
 	
     if (reloadname)
 	close (handle);
+    else if (wad_mmap)
+	W_MapFile (handle, startlump);
 }
 
 
@@ -256,6 +884,7 @@ void W_Reload (void)
     fileinfo = alloca (length);
     lseek (handle, header.infotableofs, SEEK_SET);
     read (handle, fileinfo, length);
+    W_FlushSharedCache ();
     
     // Fill in lumpinfo
     lump_p = &lumpinfo[reloadlump];
@@ -276,6 +905,455 @@ void W_Reload (void)
 
 
 
+//
+// W_HashName
+// Hash of a name already packed into two ints as W_CheckNumForName does.
+//
+static unsigned W_HashName (int v1, int v2)
+{
+    unsigned	h;
+
+    h = (unsigned)v1 * 0x9e3779b1u;
+    h ^= (unsigned)v2 * 0x85ebca77u;
+    return (h ^ (h >> 15)) & lumphashmask;
+}
+
+
+//
+// W_BuildHash
+// Lumps are chained in file order, each new one in front, so a lookup
+//  still finds the last-added lump of a name first.
+//
+static void W_BuildHash (void)
+{
+    unsigned	size;
+    unsigned	h;
+    int		i;
+
+    for (size = 1 ; size < (unsigned)numlumps*2 ; size <<= 1)
+	;
+    lumphashmask = size - 1;
+
+    free (lumphash);
+    free (lumpnext);
+    lumphash = malloc (size * sizeof(*lumphash));
+    lumpnext = malloc (numlumps * sizeof(*lumpnext));
+    if (!lumphash || !lumpnext)
+	I_Error ("Couldn't allocate lump hash");
+
+    memset (lumphash, -1, size * sizeof(*lumphash));
+    for (i=0 ; i<numlumps ; i++)
+    {
+	h = W_HashName (*(int *)lumpinfo[i].name, *(int *)&lumpinfo[i].name[4]);
+	lumpnext[i] = lumphash[h];
+	lumphash[h] = i;
+    }
+}
+
+
+//
+// W_PrefetchThread
+// Faults each lump's pages in: mapped lumps by reading one byte per
+//  page, read-path lumps by a WILLNEED hint on their file range.
+//  Never touches the zone, which is not thread-safe.
+//
+static void* W_PrefetchThread (void* arg)
+{
+    long		pagesize = sysconf (_SC_PAGESIZE);
+    volatile byte	sink;
+    lumpinfo_t*		l;
+    byte*		p;
+    byte*		end;
+    int			i;
+
+    (void)arg;
+    for (i=0 ; i<numprefetch && !atomic_load (&prefetchcancel) ; i++)
+    {
+	if (prefetchlist[i] < 0 || prefetchlist[i] >= numlumps)
+	    continue;
+	l = &lumpinfo[prefetchlist[i]];
+	if (l->size <= 0)
+	    continue;
+
+	if (l->mapped)
+	{
+	    p = l->mapped;
+	    end = p + l->size;
+	    sink = *p;
+	    p = (byte *)(((uintptr_t)p + pagesize) & ~(uintptr_t)(pagesize-1));
+	    for ( ; p < end ; p += pagesize)
+		sink = *p;
+	}
+	else if (l->handle >= 0 && l->member < 0)
+	    posix_fadvise (l->handle, l->position, l->size, POSIX_FADV_WILLNEED);
+    }
+    (void)sink;
+    return NULL;
+}
+
+
+//
+// W_CancelPrefetch
+// Stops and joins the prefetch worker, if any.
+//
+void W_CancelPrefetch (void)
+{
+    if (!prefetchrunning)
+	return;
+    atomic_store (&prefetchcancel, 1);
+    pthread_join (prefetchthread, NULL);
+    prefetchrunning = 0;
+    free (prefetchlist);
+    prefetchlist = NULL;
+    numprefetch = 0;
+}
+
+
+//
+// W_PrefetchLumps
+// Pages the given lumps in on a worker thread so their first
+//  W_CacheLumpNum does not stall a tic on storage.  A new request
+//  replaces the one still running.
+//
+void W_PrefetchLumps (const int* lumps, int count)
+{
+    W_CancelPrefetch ();
+    if (count <= 0)
+	return;
+
+    prefetchlist = malloc (count * sizeof(*prefetchlist));
+    if (!prefetchlist)
+	return;
+    memcpy (prefetchlist, lumps, count * sizeof(*prefetchlist));
+    numprefetch = count;
+
+    atomic_store (&prefetchcancel, 0);
+    if (pthread_create (&prefetchthread, NULL, W_PrefetchThread, NULL) != 0)
+    {
+	free (prefetchlist);
+	prefetchlist = NULL;
+	numprefetch = 0;
+	return;
+    }
+    prefetchrunning = 1;
+}
+
+
+//
+// MAP ACCESS PROFILES
+// UBO: the first load of a map records the order in which it caches
+//  lumps (map lumps, textures, flats, sprites and sounds alike) into
+//  a file per map in lumpprofile.  The next load of that map hands the
+//  list, sorted by file position, to W_PrefetchLumps as soon as
+//  G_DoLoadLevel starts, so the reads P_SetupLevel is about to make
+//  arrive in one sequential sweep while it works.  Keyed on
+//  W_Checksum, as the lump numbers are only good for one directory.
+//
+// Layout: header, then the lump numbers in the order first cached.
+//
+char*		lumpprofile;
+
+#define LPROF_MAGIC	"UBOLPF01"
+#define MAXPROFILELUMPS	4096
+
+typedef struct
+{
+    char		magic[8];
+    unsigned long long	key;		// W_Checksum()
+    int			numlumps;
+    int			pad;
+} lprofheader_t;
+
+static int		profiling;
+static byte*		profileseen;
+static int*		profilelumps;
+static int		numprofilelumps;
+static unsigned long long profilekey;
+static char		profilepath[1024];
+
+static void W_FreeProfile (void)
+{
+    profiling = 0;
+    free (profileseen);
+    free (profilelumps);
+    profileseen = NULL;
+    profilelumps = NULL;
+    numprofilelumps = 0;
+}
+
+// file order within a file; files in directory order
+static int W_ComparePosition (const void* a, const void* b)
+{
+    const lumpinfo_t*	la = &lumpinfo[*(const int *)a];
+    const lumpinfo_t*	lb = &lumpinfo[*(const int *)b];
+
+    if (la->handle != lb->handle)
+	return *(const int *)a < *(const int *)b ? -1 : 1;
+    if (la->position != lb->position)
+	return la->position < lb->position ? -1 : 1;
+    return 0;
+}
+
+//
+// W_StartMapProfile
+// Prefetches what the last load of mapname read, or starts recording
+//  when there is no profile for this directory yet.
+//
+void W_StartMapProfile (char* mapname)
+{
+    lprofheader_t	header;
+    FILE*		f;
+    int*		lumps;
+    int			count;
+    int			i;
+
+    W_FreeProfile ();
+    if (!lumpprofile)
+	return;
+    snprintf (profilepath, sizeof(profilepath), "%s/%.8s", lumpprofile, mapname);
+    profilekey = W_Checksum ();
+
+    if ( (f = fopen (profilepath, "rb")) )
+    {
+	lumps = NULL;
+	count = 0;
+	if (fread (&header, sizeof(header), 1, f) == 1
+	    && !memcmp (header.magic, LPROF_MAGIC, 8)
+	    && header.key == profilekey
+	    && header.numlumps > 0 && header.numlumps <= MAXPROFILELUMPS
+	    && (lumps = malloc (header.numlumps * sizeof(*lumps)))
+	    && fread (lumps, sizeof(*lumps), header.numlumps, f) == header.numlumps)
+	{
+	    for (i=0 ; i<header.numlumps ; i++)
+		if (lumps[i] >= 0 && lumps[i] < numlumps)
+		    lumps[count++] = lumps[i];
+	}
+	fclose (f);
+	if (count)
+	{
+	    qsort (lumps, count, sizeof(*lumps), W_ComparePosition);
+	    W_PrefetchLumps (lumps, count);
+	    free (lumps);
+	    return;
+	}
+	free (lumps);
+	UBO_LOG (UBO_LOG_INFO, "[doom] G_DoLoadLevel: %s is stale, recording\n", profilepath);
+    }
+
+    profileseen = calloc (numlumps, 1);
+    profilelumps = malloc (MAXPROFILELUMPS * sizeof(*profilelumps));
+    if (!profileseen || !profilelumps)
+    {
+	W_FreeProfile ();
+	return;
+    }
+    profiling = 1;
+}
+
+static void W_ProfileLump (int lump)
+{
+    profileseen[lump] = 1;
+    if (numprofilelumps < MAXPROFILELUMPS)
+	profilelumps[numprofilelumps++] = lump;
+}
+
+//
+// W_FinishMapProfile
+// Writes what was recorded since W_StartMapProfile, through a
+//  temporary file and a rename as P_WriteLevelCache does.
+//
+void W_FinishMapProfile (void)
+{
+    lprofheader_t	header;
+    char		tmp[1040];
+    FILE*		f;
+    int			ok;
+
+    if (!profiling || !numprofilelumps)
+    {
+	W_FreeProfile ();
+	return;
+    }
+    profiling = 0;
+
+    // a first write makes the directory; failing that, fopen fails
+    mkdir (lumpprofile, 0755);
+    snprintf (tmp, sizeof(tmp), "%s.tmp", profilepath);
+    if ( (f = fopen (tmp, "wb")) )
+    {
+	memset (&header, 0, sizeof(header));
+	memcpy (header.magic, LPROF_MAGIC, 8);
+	header.key = profilekey;
+	header.numlumps = numprofilelumps;
+	ok = fwrite (&header, sizeof(header), 1, f) == 1;
+	ok &= fwrite (profilelumps, sizeof(*profilelumps), numprofilelumps, f)
+	    == numprofilelumps;
+	ok &= fclose (f) == 0;
+	if (ok && rename (tmp, profilepath) == 0)
+	    UBO_LOG (UBO_LOG_INFO, "[doom] G_DoLoadLevel: wrote %s (%i lumps)\n",
+		     profilepath, numprofilelumps);
+	else
+	    remove (tmp);
+    }
+    W_FreeProfile ();
+}
+
+
+//
+// W_MergeNamespaces
+// UBO: the sprites and flats of every file end up between one pair of
+//  markers, as R_InitSpriteLumps and R_InitFlats expect.  Each later
+//  S_START/SS_START .. S_END/SS_END block is folded into the first: a
+//  lump whose name the first already has replaces it in place, the
+//  others go at its end, and the later markers (and inner ones such
+//  as F1_START) drop out; flats likewise with F_/FF_.  One pass over
+//  the directory with the block's names hashed, so any number of
+//  PWADs costs O(lumps).  With one block, as with the IWAD alone, the
+//  directory is left exactly as it was.
+//
+static const char*	spritemarks[4] = { "S_START", "SS_START", "S_END", "SS_END" };
+static const char*	flatmarks[4] = { "F_START", "FF_START", "F_END", "FF_END" };
+
+static int W_IsMarker (const lumpinfo_t* l, const char** marks)
+{
+    return !strncasecmp (l->name, marks[0], 8)
+	|| !strncasecmp (l->name, marks[1], 8);
+}
+
+static int W_IsInnerMarker (const lumpinfo_t* l)
+{
+    char	name[9];
+    int		n;
+
+    if (l->size)
+	return false;
+    memcpy (name, l->name, 8);
+    name[8] = 0;
+    n = strlen (name);
+    return (n > 6 && !strcasecmp (name+n-6, "_START"))
+	|| (n > 4 && !strcasecmp (name+n-4, "_END"));
+}
+
+static unsigned W_MergeKey (const char* name)
+{
+    unsigned	h = 2166136261u;
+    int		i;
+
+    for (i=0 ; i<8 && name[i] ; i++)
+	h = (h ^ toupper (name[i])) * 16777619u;
+    return h;
+}
+
+static void W_SetName (lumpinfo_t* l, const char* name)
+{
+    memset (l->name, 0, 8);
+    memcpy (l->name, name, strlen (name));
+}
+
+static void W_MergeNamespace (const char** marks)
+{
+    lumpinfo_t*	merged;
+    int*	block;		// lumps of the merged block
+    int*	slots;		// hash of their names, indexes into block
+    unsigned	mask;
+    unsigned	h;
+    int		numblock;
+    int		blocks;
+    int		inside;
+    int		count;
+    int		i;
+    int		j;
+
+    for (i=0, blocks=0, inside=0 ; i<numlumps ; i++)
+    {
+	if (W_IsMarker (&lumpinfo[i], marks))
+	{
+	    blocks++;
+	    inside = 1;
+	}
+	else if (inside && W_IsMarker (&lumpinfo[i], marks+2))
+	    inside = 0;
+    }
+    if (blocks <= 1)
+	return;
+
+    for (mask = 1 ; mask < (unsigned)numlumps*2 ; mask <<= 1)
+	;
+    mask--;
+    block = malloc (numlumps * sizeof(*block));
+    slots = malloc ((mask+1) * sizeof(*slots));
+    merged = malloc (numlumps * sizeof(*merged));
+    if (!block || !slots || !merged)
+	I_Error ("W_MergeNamespace: out of memory");
+    memset (slots, -1, (mask+1) * sizeof(*slots));
+
+    // the first block as it is, then the others over it
+    numblock = 0;
+    for (i=0, blocks=0, inside=0 ; i<numlumps ; i++)
+    {
+	if (W_IsMarker (&lumpinfo[i], marks))
+	{
+	    blocks++;
+	    inside = 1;
+	    continue;
+	}
+	if (!inside)
+	    continue;
+	if (W_IsMarker (&lumpinfo[i], marks+2))
+	{
+	    inside = 0;
+	    continue;
+	}
+	if (blocks > 1 && W_IsInnerMarker (&lumpinfo[i]))
+	    continue;
+
+	for (h = W_MergeKey (lumpinfo[i].name) & mask ;
+	     slots[h] >= 0 ; h = (h+1) & mask)
+	    if (!strncasecmp (lumpinfo[block[slots[h]]].name, lumpinfo[i].name, 8))
+		break;
+	if (blocks > 1 && slots[h] >= 0)
+	{
+	    block[slots[h]] = i;
+	    continue;
+	}
+	slots[h] = numblock;
+	block[numblock++] = i;
+    }
+
+    // everything else in order, the merged block where the first was
+    count = 0;
+    for (i=0, blocks=0, inside=0 ; i<numlumps ; i++)
+    {
+	if (W_IsMarker (&lumpinfo[i], marks))
+	{
+	    if (!blocks++)
+	    {
+		merged[count] = lumpinfo[i];
+		W_SetName (&merged[count++], marks[0]);
+		for (j=0 ; j<numblock ; j++)
+		    merged[count++] = lumpinfo[block[j]];
+		merged[count] = lumpinfo[i];
+		W_SetName (&merged[count++], marks[2]);
+	    }
+	    inside = 1;
+	}
+	else if (inside && W_IsMarker (&lumpinfo[i], marks+2))
+	    inside = 0;
+	else if (!inside)
+	    merged[count++] = lumpinfo[i];
+    }
+
+    printf (" merged %i %s blocks into %i lumps\n",
+	    blocks, marks[0], numblock);
+    free (block);
+    free (slots);
+    free (lumpinfo);
+    lumpinfo = merged;
+    numlumps = count;
+    lumpslots = numlumps;
+}
+
+
 //
 // W_InitMultipleFiles
 // Pass a null terminated list of files to use.
@@ -293,8 +1371,8 @@ void W_InitMultipleFiles (char** filenames)
 {	
     int		size;
     
-    // open all the files, load headers, and count lumps
-    numlumps = 0;
+    // drop the files of a previous init (doom_reset)
+    W_Shutdown ();
 
     // will be realloced as lumps are added
     lumpinfo = malloc(1);	
@@ -304,6 +1382,13 @@ void W_InitMultipleFiles (char** filenames)
 
     if (!numlumps)
 	I_Error ("W_InitFiles: no files found");
+
+    // W_Reload finds the reloadable file's lumps by number
+    if (!reloadname)
+    {
+	W_MergeNamespace (spritemarks);
+	W_MergeNamespace (flatmarks);
+    }
     
     // set up caching
     size = numlumps * sizeof(*lumpcache);
@@ -313,6 +1398,64 @@ void W_InitMultipleFiles (char** filenames)
 	I_Error ("Couldn't allocate lumpcache");
 
     memset (lumpcache,0, size);
+
+    sharedcache = calloc (numlumps, sizeof(*sharedcache));
+    if (!sharedcache)
+	I_Error ("Couldn't allocate the shared lump cache");
+
+    W_BuildHash ();
+}
+
+
+
+
+//
+// W_Shutdown
+// Closes the files and frees the directory, the mappings and the
+//  lump cache, leaving no lumps.
+//
+void W_Shutdown (void)
+{
+    int		i;
+    int		lasthandle = -1;
+
+    // the prefetch worker reads lumpinfo and the mappings
+    W_CancelPrefetch ();
+    W_FreeProfile ();
+
+    for ( ; numwadmaps > 0 ; numwadmaps--)
+	munmap (wadmaps[numwadmaps-1].base, wadmaps[numwadmaps-1].size);
+
+    // a file's lumps are consecutive and share its handle
+    for (i=0 ; i<numlumps ; i++)
+    {
+	if (lumpinfo[i].handle == lasthandle)
+	    continue;
+	lasthandle = lumpinfo[i].handle;
+	if (lasthandle >= 0)
+	    close (lasthandle);
+    }
+
+    W_FlushZipCache ();
+    W_FlushSharedCache ();
+    // an I_Error on a worker may have left a shard locked
+    for (i=0 ; i<SHAREDSHARDS ; i++)
+	pthread_mutex_init (&sharedshards[i].lock, NULL);
+    free (sharedcache);
+    sharedcache = NULL;
+    free (zipmembers);
+    zipmembers = NULL;
+    numzipmembers = 0;
+
+    free (lumpinfo);
+    free (lumpcache);
+    free (lumphash);
+    free (lumpnext);
+    lumpinfo = NULL;
+    lumpcache = NULL;
+    lumphash = lumpnext = NULL;
+    numlumps = 0;
+    lumpslots = 0;
 }
 
 
@@ -358,6 +1501,7 @@ int W_CheckNumForName (char* name)
     
     int		v1;
     int		v2;
+    int		i;
     lumpinfo_t*	lump_p;
 
     // make the name into two integers for easy compares
@@ -373,15 +1517,14 @@ int W_CheckNumForName (char* name)
     v2 = name8.x[1];
 
 
-    // scan backwards so patch lump files take precedence
-    lump_p = lumpinfo + numlumps;
-
-    while (lump_p-- != lumpinfo)
+    // chains run newest first so patch lump files take precedence
+    for (i = lumphash[W_HashName (v1, v2)] ; i != -1 ; i = lumpnext[i])
     {
+	lump_p = &lumpinfo[i];
 	if ( *(int *)lump_p->name == v1
 	     && *(int *)&lump_p->name[4] == v2)
 	{
-	    return lump_p - lumpinfo;
+	    return i;
 	}
     }
 
@@ -436,12 +1579,35 @@ W_ReadLump
     int		c;
     lumpinfo_t*	l;
     int		handle;
+    void*	data;
 	
     if (lump >= numlumps)
 	I_Error ("W_ReadLump: %i >= numlumps",lump);
 
     l = lumpinfo+lump;
 	
+    UBO_TRACE_BEGIN ("read_lump");
+    if (l->mapped)
+    {
+	memcpy (dest, l->mapped, l->size);
+	UBO_TRACE_END ();
+	return;
+    }
+    // a worker already read it in
+    if (sharedcache
+	&& (data = __atomic_load_n (&sharedcache[lump], __ATOMIC_ACQUIRE)))
+    {
+	memcpy (dest, data, l->size);
+	UBO_TRACE_END ();
+	return;
+    }
+    if (l->member >= 0)
+    {
+	W_ReadZipLump (l, dest);
+	UBO_TRACE_END ();
+	return;
+    }
+
     // ??? I_BeginRead ();
 	
     if (l->handle == -1)
@@ -453,8 +1619,8 @@ W_ReadLump
     else
 	handle = l->handle;
 		
-    lseek (handle, l->position, SEEK_SET);
-    c = read (handle, dest, l->size);
+    // UBO: pread, as worker threads read lumps from the same handles
+    c = pread (handle, dest, l->size, l->position);
 
     if (c < l->size)
 	I_Error ("W_ReadLump: only read %i of %i on lump %i",
@@ -462,6 +1628,7 @@ W_ReadLump
 
     if (l->handle == -1)
 	close (handle);
+    UBO_TRACE_END ();
 		
     // ??? I_EndRead ();
 }
@@ -469,6 +1636,104 @@ W_ReadLump
 
 
 
+//
+// W_Checksum
+// FNV-1a over the lump directory and the size/mtime of every open file.
+// Cheap enough to run at every startup; content edits that keep the
+//  directory identical still change the mtime.
+//
+static unsigned long long W_HashBytes (unsigned long long h, const void* p, int n)
+{
+    const byte*	b = p;
+
+    while (n--)
+    {
+	h ^= *b++;
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+unsigned long long W_Checksum (void)
+{
+    return W_LumpsChecksum (0, numlumps);
+}
+
+unsigned long long W_LumpsChecksum (int first, int count)
+{
+    unsigned long long	h = 0xcbf29ce484222325ULL;
+    struct stat		st;
+    long long		stamp[2];
+    int			lasthandle = -2;
+    int			i;
+
+    for (i=first ; i<first+count && i<numlumps ; i++)
+    {
+	h = W_HashBytes (h, lumpinfo[i].name, 8);
+	h = W_HashBytes (h, &lumpinfo[i].position, sizeof(int));
+	h = W_HashBytes (h, &lumpinfo[i].size, sizeof(int));
+
+	if (lumpinfo[i].handle == lasthandle)
+	    continue;
+	lasthandle = lumpinfo[i].handle;
+	if (lasthandle < 0 || fstat (lasthandle, &st) == -1)
+	    continue;
+	stamp[0] = st.st_size;
+	stamp[1] = st.st_mtime;
+	h = W_HashBytes (h, stamp, sizeof(stamp));
+    }
+    return h;
+}
+
+
+//
+// W_Inflate
+//
+void* W_Inflate (const void* data, int size, int* outsize)
+{
+#ifdef UBO_ZLIB
+    z_stream	zs;
+    byte*	buf = NULL;
+    byte*	grown;
+    int		room = size*4 + 4096;
+    int		err;
+
+    memset (&zs, 0, sizeof(zs));
+    if (inflateInit (&zs) != Z_OK)
+	I_Error ("W_Inflate: inflateInit failed");
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = size;
+    do
+    {
+	grown = realloc (buf, room);
+	if (!grown)
+	{
+	    free (buf);
+	    inflateEnd (&zs);
+	    I_Error ("W_Inflate: failed on allocation of %i bytes", room);
+	}
+	buf = grown;
+	zs.next_out = buf + zs.total_out;
+	zs.avail_out = room - zs.total_out;
+	err = inflate (&zs, Z_NO_FLUSH);
+	room *= 2;
+    } while (err == Z_OK && zs.avail_out == 0);
+
+    *outsize = zs.total_out;
+    inflateEnd (&zs);
+    if (err != Z_STREAM_END)
+    {
+	free (buf);
+	I_Error ("W_Inflate: corrupt zlib stream (%i)", err);
+    }
+    return buf;
+#else
+    I_Error ("W_Inflate: built without zlib (ZLIB=0)");
+    return NULL;
+#endif
+}
+
+
 //
 // W_CacheLumpNum
 //
@@ -482,12 +1747,20 @@ W_CacheLumpNum
     if ((unsigned)lump >= numlumps)
 	I_Error ("W_CacheLumpNum: %i >= numlumps",lump);
 		
+    if (profiling && !profileseen[lump])
+	W_ProfileLump (lump);
+
+    // mapped lumps are never copied, cached or purged
+    if (lumpinfo[lump].mapped)
+	return lumpinfo[lump].mapped;
+
     if (!lumpcache[lump])
     {
 	// read the lump in
 	
 	//printf ("cache miss on lump %i\n",lump);
-	ptr = Z_Malloc (W_LumpLength (lump), tag, &lumpcache[lump]);
+	ptr = Z_MallocLump (W_LumpLength (lump), tag, &lumpcache[lump],
+			    lumpinfo[lump].name);
 	W_ReadLump (lump, lumpcache[lump]);
     }
     else
@@ -513,6 +1786,118 @@ W_CacheLumpName
 }
 
 
+
+//
+// SHARED LUMP CACHE
+// UBO: W_CacheLumpNum and the zone under it belong to the engine
+//  thread.  W_CacheLumpShared is the lump cache for any thread: a
+//  resident lump costs one acquire load, and a miss takes only the
+//  lock of the lump's shard, so misses on different shards read in
+//  parallel.  The copies are bump allocated from each shard's chunks
+//  outside the zone, and stay put until W_FlushSharedCache.
+//
+
+//
+// W_SharedAlloc
+// Room for size bytes in the shard, whose lock is held.  A lump too
+//  big for a chunk gets one of its own, behind the one being filled.
+//
+static void* W_SharedAlloc (sharedshard_t* shard, int size)
+{
+    sharedchunk_t*	chunk = shard->chunks;
+    int			need = (size + 15) & ~15;
+    int			room;
+
+    if (!chunk || chunk->used + need > chunk->size)
+    {
+	room = SHAREDCHUNK - SHAREDHEADER;
+	if (need > room)
+	    room = need;
+	chunk = malloc (SHAREDHEADER + room);
+	if (!chunk)
+	    return NULL;
+	chunk->size = room;
+	chunk->used = 0;
+	if (room == need && shard->chunks)
+	{
+	    chunk->next = shard->chunks->next;
+	    shard->chunks->next = chunk;
+	}
+	else
+	{
+	    chunk->next = shard->chunks;
+	    shard->chunks = chunk;
+	}
+	__atomic_add_fetch (&sharedcachebytes, SHAREDHEADER + room,
+			    __ATOMIC_RELAXED);
+    }
+    chunk->used += need;
+    return (byte *)chunk + SHAREDHEADER + chunk->used - need;
+}
+
+
+//
+// W_CacheLumpShared
+//
+void* W_CacheLumpShared (int lump)
+{
+    sharedshard_t*	shard;
+    void*		data;
+
+    if ((unsigned)lump >= numlumps)
+	I_Error ("W_CacheLumpShared: %i >= numlumps",lump);
+
+    if (lumpinfo[lump].mapped)
+	return lumpinfo[lump].mapped;
+
+    data = __atomic_load_n (&sharedcache[lump], __ATOMIC_ACQUIRE);
+    if (data)
+	return data;
+
+    shard = &sharedshards[lump % SHAREDSHARDS];
+    pthread_mutex_lock (&shard->lock);
+    data = sharedcache[lump];
+    if (!data)
+    {
+	data = W_SharedAlloc (shard, lumpinfo[lump].size);
+	if (!data)
+	{
+	    pthread_mutex_unlock (&shard->lock);
+	    I_Error ("W_CacheLumpShared: failed on allocation of %i bytes",
+		     lumpinfo[lump].size);
+	}
+	W_ReadLump (lump, data);
+	__atomic_add_fetch (&sharedcachemisses, 1, __ATOMIC_RELAXED);
+	__atomic_store_n (&sharedcache[lump], data, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock (&shard->lock);
+    return data;
+}
+
+
+//
+// W_FlushSharedCache
+// Frees every copy; no other thread may be reading from the cache.
+//
+void W_FlushSharedCache (void)
+{
+    sharedchunk_t*	chunk;
+    int			i;
+
+    if (sharedcache)
+	memset (sharedcache, 0, numlumps * sizeof(*sharedcache));
+    for (i=0 ; i<SHAREDSHARDS ; i++)
+    {
+	while ((chunk = sharedshards[i].chunks))
+	{
+	    sharedshards[i].chunks = chunk->next;
+	    free (chunk);
+	}
+    }
+    sharedcachebytes = 0;
+}
+
+
 //
 // W_Profile
 //
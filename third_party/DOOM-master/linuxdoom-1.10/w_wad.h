@@ -59,6 +59,8 @@ typedef struct
     int		handle;
     int		position;
     int		size;
+    void*	mapped;		// lump data inside an mmap'd WAD, or NULL
+    int		member;		// zip member holding it, -1 = at position
 } lumpinfo_t;
 
 
@@ -66,7 +68,13 @@ extern	void**		lumpcache;
 extern	lumpinfo_t*	lumpinfo;
 extern	int		numlumps;
 
+// Set before W_InitMultipleFiles to serve lumps straight from a private
+// mmap of each file instead of reading copies into the zone.
+extern	int		wad_mmap;
+
 void    W_InitMultipleFiles (char** filenames);
+// Closes the WADs and frees the directory (doom_shutdown).
+void    W_Shutdown (void);
 void    W_Reload (void);
 
 int	W_CheckNumForName (char* name);
@@ -75,9 +83,58 @@ int	W_GetNumForName (char* name);
 int	W_LumpLength (int lump);
 void    W_ReadLump (int lump, void *dest);
 
+// Identity of the loaded directory (lump names/offsets/sizes plus each
+// file's size and mtime), for keying derived on-disk caches.
+unsigned long long W_Checksum (void);
+// The same for count lumps from first on, e.g. the lumps of one map.
+unsigned long long W_LumpsChecksum (int first, int count);
+
+// Inflates a zlib stream (e.g. ZDBSP compressed nodes) into a
+//  malloc'd buffer; I_Error when corrupt or built with ZLIB=0.
+void*	W_Inflate (const void* data, int size, int* outsize);
+
+// Page lumps in on a background thread ahead of their first use.
+void	W_PrefetchLumps (const int* lumps, int count);
+void	W_CancelPrefetch (void);
+
+// Per-map lump access profiles in the directory lumpprofile (NULL = off).
+// Start, from G_DoLoadLevel, prefetches what the last load of the map
+// read, in file order, or records the lumps cached from there on until
+// Finish writes them.
+extern	char*		lumpprofile;
+void	W_StartMapProfile (char* mapname);
+void	W_FinishMapProfile (void);
+
 void*	W_CacheLumpNum (int lump, int tag);
 void*	W_CacheLumpName (char* name, int tag);
 
+// The lump cache for threads other than the engine's (render
+// workers, loaders): a lump read in once, outside the zone, and kept
+// until W_FlushSharedCache.  Mapped lumps come straight from the WAD.
+// Safe from any thread; W_ReadLump copies a lump from here when a
+// worker already has it.  The flush, like W_Shutdown, needs every
+// other thread out of the cache (between frames and levels).
+void*	W_CacheLumpShared (int lump);
+void	W_FlushSharedCache (void);
+extern	int		sharedcachebytes;
+extern	unsigned	sharedcachemisses;
+
+// True if ptr is inside an mmap'd WAD, where lump data never moves.
+int	W_IsMappedPtr (const void* ptr);
+// Bytes from ptr to the end of its mapping, 0 outside every mapping.
+int	W_MappedBytes (const void* ptr);
+// Lets the kernel reclaim the mappings' pages (doom_suspend).
+void	W_ReleasePages (void);
+// Bytes of the mappings resident in RAM now.
+int	W_ResidentBytes (void);
+
+// .pk3/.zip files: members are inflated on first read and kept, up to
+// zipcachelimit bytes, outside the zone.
+extern	int		zipcachelimit;
+extern	int		zipcachebytes;
+extern	unsigned	zipinflates;
+void	W_FlushZipCache (void);
+
 
 
 
@@ -1535,6 +1535,107 @@ void WI_Ticker(void)
 
 }
 
+//
+// WI_ListLumps
+// UBO: the lumps WI_loadData caches for episode epsd (0 based), for
+//  R_PrecacheLevel to page in behind the level's own, so the
+//  intermission does not open with a row of reads.  Fills up to max
+//  of lumps and returns the count; missing names come back as -1.
+//
+static char*	wi_sharedlumps[] =
+{
+    "WIMINUS", "WIPCNT", "WIF", "WIENTER", "WIOSTK", "WIOSTS",
+    "WISCRT2", "WIOSTI", "WIFRGS", "WICOLON", "WITIME", "WISUCKS",
+    "WIPAR", "WIKILRS", "WIVCTMS", "WIMSTT", "STFST01", "STFDEAD0"
+};
+
+static int
+WI_ListLump
+( char*		name,
+  int*		lumps,
+  int		count,
+  int		max )
+{
+    if (count < max)
+	lumps[count++] = W_CheckNumForName (name);
+    return count;
+}
+
+int
+WI_ListLumps
+( int		epsd,
+  int*		lumps,
+  int		max )
+{
+    int		i;
+    int		j;
+    int		count;
+    char	name[40];	// "WIA%d%.2d%.2d" at its widest
+
+    count = 0;
+    if (gamemode == commercial || (gamemode == retail && epsd == 3))
+	count = WI_ListLump ("INTERPIC", lumps, count, max);
+    else
+    {
+	snprintf (name, sizeof(name), "WIMAP%d", epsd);
+	count = WI_ListLump (name, lumps, count, max);
+    }
+
+    if (gamemode == commercial)
+    {
+	for (i=0 ; i<32 ; i++)
+	{
+	    snprintf (name, sizeof(name), "CWILV%2.2d", i);
+	    count = WI_ListLump (name, lumps, count, max);
+	}
+    }
+    else
+    {
+	for (i=0 ; i<NUMMAPS ; i++)
+	{
+	    snprintf (name, sizeof(name), "WILV%d%d", epsd, i);
+	    count = WI_ListLump (name, lumps, count, max);
+	}
+	count = WI_ListLump ("WIURH0", lumps, count, max);
+	count = WI_ListLump ("WIURH1", lumps, count, max);
+	count = WI_ListLump ("WISPLAT", lumps, count, max);
+
+	if (epsd >= 0 && epsd < 3)
+	{
+	    for (j=0 ; j<NUMANIMS[epsd] ; j++)
+	    {
+		// epsd 1 anim 8 borrows anim 4's patches
+		if (epsd == 1 && j == 8)
+		    continue;
+		for (i=0 ; i<anims[epsd][j].nanims ; i++)
+		{
+		    snprintf (name, sizeof(name), "WIA%d%.2d%.2d", epsd, j, i);
+		    count = WI_ListLump (name, lumps, count, max);
+		}
+	    }
+	}
+    }
+
+    for (i=0 ; i<10 ; i++)
+    {
+	snprintf (name, sizeof(name), "WINUM%d", i);
+	count = WI_ListLump (name, lumps, count, max);
+    }
+    for (i=0 ; i<(int)(sizeof(wi_sharedlumps)/sizeof(*wi_sharedlumps)) ; i++)
+	count = WI_ListLump (wi_sharedlumps[i], lumps, count, max);
+    if (french)
+	count = WI_ListLump ("WIOBJ", lumps, count, max);
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+	snprintf (name, sizeof(name), "STPB%d", i);
+	count = WI_ListLump (name, lumps, count, max);
+	snprintf (name, sizeof(name), "WIBP%d", i+1);
+	count = WI_ListLump (name, lumps, count, max);
+    }
+    return count;
+}
+
 void WI_loadData(void)
 {
     int		i;
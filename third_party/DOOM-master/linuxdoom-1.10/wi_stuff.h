@@ -46,6 +46,10 @@ void WI_Drawer (void);
 // Setup for an intermission screen.
 void WI_Start(wbstartstruct_t*	 wbstartstruct);
 
+// The lumps WI_Start loads for episode epsd (0 based), up to max;
+//  returns the count.  For R_PrecacheLevel.
+int WI_ListLumps (int epsd, int* lumps, int max);
+
 #endif
 //-----------------------------------------------------------------------------
 //
@@ -25,8 +25,15 @@ static const char
 rcsid[] = "$Id: z_zone.c,v 1.4 1997/02/03 16:47:58 b1 Exp $";
 
 #include "z_zone.h"
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "i_system.h"
+#include "i_log.h"
 #include "doomdef.h"
 
 
@@ -42,6 +49,7 @@ rcsid[] = "$Id: z_zone.c,v 1.4 1997/02/03 16:47:58 b1 Exp $";
 // 
  
 #define ZONEID	0x1d4a11
+#define SLABID	0x1d4a12
 
 
 typedef struct
@@ -61,6 +69,658 @@ typedef struct
 memzone_t*	mainzone;
 
 
+//
+// CHAINED ZONES
+// When nothing fits in the zones we have, even after purging, another
+//  zone of at least ZONEGROW bytes is chained on, up to zonemaxsize
+//  bytes in all.  Blocks never span zones; each keeps its own rover.
+// Z_Init reuses the zones of a previous session (doom_reset) instead
+//  of leaking them, and Z_Shutdown hands them back.
+//
+#define MAXZONES	16
+#define ZONEGROW	(4*1024*1024)
+
+int		zonesize;	// base zone bytes, 0 = mb_used
+int		zonemaxsize;	// all zones, 0 = never grow
+
+static memzone_t*	zones[MAXZONES];
+static int		numzones;
+
+static int		zoneused;
+static int		zonehighwater;
+static int		zonepurges;
+static int		zonegrows;
+
+
+static memzone_t* Z_ZoneFor (void* ptr)
+{
+    int		i;
+
+    for (i=0 ; i<numzones ; i++)
+	if ((byte *)ptr > (byte *)zones[i]
+	    && (byte *)ptr < (byte *)zones[i] + zones[i]->size)
+	    return zones[i];
+    return NULL;
+}
+
+
+static int Z_TotalSize (void)
+{
+    int		i;
+    int		total = 0;
+
+    for (i=0 ; i<numzones ; i++)
+	total += zones[i]->size;
+    return total;
+}
+
+
+//
+// SLABS
+// Small PU_LEVEL/PU_LEVSPEC allocations without an owner (mobjs and
+//  the door/plat/light thinkers) come from per-size-class slabs.
+// A slab is an ordinary PU_LEVEL zone block cut into equal slots;
+//  each slot starts with a memblock_t (id SLABID, next = its slab,
+//  prev = free list link) so Z_Free/Z_ChangeTag take the same pointers.
+// Alloc and free are a free list pop/push.  Slabs go back to the zone
+//  with the rest of the level in Z_FreeTags.
+//
+#define SLABBYTES	8192
+#define SLABQUANTUM	16
+#define SLABCLASSES	16		// payloads up to 256 bytes
+
+typedef struct slab_s
+{
+    struct slab_s*	next;		// all slabs, for Z_ZoneStats
+    int			slotsize;	// memblock_t + payload
+    int			used;
+} slab_t;
+
+int		zoneslabs;
+
+static slab_t*		slabs;
+static memblock_t*	slabfree[SLABCLASSES];
+
+
+static void* Z_SlabMalloc (int size, int tag)
+{
+    int		cls = (size + SLABQUANTUM-1) / SLABQUANTUM - 1;
+    slab_t*	slab;
+    memblock_t*	slot;
+    byte*	p;
+    int		slotsize;
+    int		count;
+    int		i;
+
+    if (!slabfree[cls])
+    {
+	// carve a new slab into free slots
+	slotsize = sizeof(memblock_t) + (cls+1)*SLABQUANTUM;
+	slab = Z_Malloc (SLABBYTES, PU_LEVEL, 0);
+	slab->slotsize = slotsize;
+	slab->used = 0;
+	slab->next = slabs;
+	slabs = slab;
+
+	count = (SLABBYTES - sizeof(slab_t)) / slotsize;
+	p = (byte *)slab + sizeof(slab_t);
+	for (i=0 ; i<count ; i++, p += slotsize)
+	{
+	    slot = (memblock_t *)p;
+	    slot->size = slotsize;
+	    slot->user = NULL;
+	    slot->tag = 0;
+	    slot->id = SLABID;
+	    slot->next = (memblock_t *)slab;
+	    slot->prev = slabfree[cls];
+	    slabfree[cls] = slot;
+	}
+    }
+
+    slot = slabfree[cls];
+    slabfree[cls] = slot->prev;
+    slot->prev = NULL;
+    slot->user = (void *)2;
+    slot->tag = tag;
+    ((slab_t *)slot->next)->used++;
+
+    return (byte *)slot + sizeof(memblock_t);
+}
+
+
+static void Z_SlabFree (memblock_t* slot)
+{
+    slab_t*	slab = (slab_t *)slot->next;
+    int		cls = (slab->slotsize - sizeof(memblock_t)) / SLABQUANTUM - 1;
+
+    if (!slot->user)
+	I_Error ("Z_Free: slab slot freed twice");
+
+    slot->user = NULL;
+    slot->tag = 0;
+    slot->prev = slabfree[cls];
+    slabfree[cls] = slot;
+    slab->used--;
+}
+
+
+
+//
+// LEVEL ARENA
+// Level geometry (vertexes, segs, lines, sides, sectors, nodes,
+//  subsectors, the blockmap and the sector line lists) is bump
+//  allocated from chunks kept outside the zone, so it sits in one
+//  contiguous run and never splits the heap around cached lumps.
+// Nothing in the arena is freed on its own; Z_FreeTags rewinds the
+//  whole arena with the level and the chunks are reused by the next.
+//
+#define ARENACHUNK	(256*1024)
+
+typedef struct arenachunk_s
+{
+    struct arenachunk_s*	next;
+    int				size;	// payload bytes
+    int				used;
+} arenachunk_t;
+
+int		zonearena;
+
+static arenachunk_t*	arenachunks;
+static arenachunk_t*	arenacur;
+
+
+void* Z_LevelMalloc (int size)
+{
+    arenachunk_t*	chunk;
+    arenachunk_t**	link;
+    byte*		p;
+
+    if (!zonearena)
+	return Z_Malloc (size, PU_LEVEL, 0);
+
+    size = (size + 7) & ~7;
+
+    // first chunk with room at or after the current one
+    chunk = arenacur ? arenacur : arenachunks;
+    while (chunk && chunk->used + size > chunk->size)
+	chunk = chunk->next;
+
+    if (!chunk)
+    {
+	for (link = &arenachunks ; *link ; link = &(*link)->next)
+	    ;
+	chunk = malloc (sizeof(arenachunk_t)
+			+ (size > ARENACHUNK ? size : ARENACHUNK));
+	if (!chunk)
+	    I_Error ("Z_LevelMalloc: failed on allocation of %i bytes", size);
+	chunk->next = NULL;
+	chunk->size = size > ARENACHUNK ? size : ARENACHUNK;
+	chunk->used = 0;
+	*link = chunk;
+    }
+
+    arenacur = chunk;
+    p = (byte *)chunk + sizeof(arenachunk_t) + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+
+static void Z_ResetArena (void)
+{
+    arenachunk_t*	chunk;
+
+    for (chunk = arenachunks ; chunk ; chunk = chunk->next)
+	chunk->used = 0;
+    arenacur = arenachunks;
+}
+
+
+
+//
+// ZONE PROFILER
+// zsites holds one record per call site (file and line, or a lump
+//  name with line -1), found by hashing the pointer and line; zlive
+//  maps every block allocated while profiling to its site and birth
+//  tic, open addressed on the block pointer with backward-shift
+//  deletion.  Both are plain malloc, so the zone's contents and
+//  layout are the same with the profiler on or off.
+//
+#define ZPROF_SITES	1024		// power of two
+#define ZPROF_TAGS	128
+
+typedef struct
+{
+    const char*	file;		// NULL = unused
+    int		line;		// -1: file is a lump name
+    int		tag;		// of the latest block
+    int		allocs;
+    int		frees;
+    int		purges;		// freed to make room
+    int		live;
+    int		livebytes;
+    int		peakbytes;
+    long long	totalbytes;
+    long long	lifetics;	// summed over frees and purges
+    int		maxlife;
+} zsite_t;
+
+typedef struct
+{
+    memblock_t*	block;		// NULL = empty
+    short	site;
+    byte	tag;
+    byte	slab;		// a slab slot
+    int		size;
+    int		born;		// I_GetTime ()
+} zlive_t;
+
+int		zoneprofile;
+
+static zsite_t		zsites[ZPROF_SITES];
+static int		zsiteslost;	// allocs past a full site table
+static zlive_t*		zlive;
+static int		zlivemask = -1;	// table size - 1
+static int		zlivecount;
+static int		ztagallocs[ZPROF_TAGS];
+static int		ztagpurges[ZPROF_TAGS];
+static boolean		zonepurging;	// Z_Free called to purge
+static int		zonesamplepeak;	// most used since Z_ProfileLog
+static int		zonesamplepurges;
+
+
+static void Z_ProfileClear (void)
+{
+    memset (zsites, 0, sizeof(zsites));
+    zsiteslost = 0;
+    free (zlive);
+    zlive = NULL;
+    zlivemask = -1;
+    zlivecount = 0;
+    memset (ztagallocs, 0, sizeof(ztagallocs));
+    memset (ztagpurges, 0, sizeof(ztagpurges));
+    zonesamplepeak = zoneused;
+    zonesamplepurges = zonepurges;
+}
+
+
+void Z_SetProfile (int on)
+{
+    if (on && !zoneprofile)
+	Z_ProfileClear ();
+    zoneprofile = on != 0;
+}
+
+
+static unsigned Z_LiveHash (memblock_t* block)
+{
+    uintptr_t	p = (uintptr_t)block >> 3;
+
+    return (unsigned)(p ^ p >> 29) * 0x9e3779b1u;
+}
+
+
+static zlive_t* Z_LiveFind (memblock_t* block)
+{
+    unsigned	i;
+
+    if (!zlive)
+	return NULL;
+    for (i = Z_LiveHash (block) & zlivemask ; zlive[i].block ; i = (i+1) & zlivemask)
+	if (zlive[i].block == block)
+	    return &zlive[i];
+    return NULL;
+}
+
+
+static boolean Z_LiveGrow (void)
+{
+    zlive_t*	old = zlive;
+    int		oldsize = zlivemask+1;
+    int		size = oldsize ? oldsize*2 : 4096;
+    unsigned	j;
+    int		i;
+
+    zlive = calloc (size, sizeof(*zlive));
+    if (!zlive)
+    {
+	zlive = old;
+	return false;
+    }
+    zlivemask = size-1;
+    for (i=0 ; i<oldsize ; i++)
+    {
+	if (!old[i].block)
+	    continue;
+	for (j = Z_LiveHash (old[i].block) & zlivemask ; zlive[j].block ; j = (j+1) & zlivemask)
+	    ;
+	zlive[j] = old[i];
+    }
+    free (old);
+    return true;
+}
+
+
+static void Z_LiveRemove (zlive_t* entry)
+{
+    unsigned	hole = entry - zlive;
+    unsigned	i;
+    unsigned	home;
+
+    // shift back any later entry whose probe run crosses the hole
+    for (i = (hole+1) & zlivemask ; zlive[i].block ; i = (i+1) & zlivemask)
+    {
+	home = Z_LiveHash (zlive[i].block) & zlivemask;
+	if (((i - home) & zlivemask) >= ((i - hole) & zlivemask))
+	{
+	    zlive[hole] = zlive[i];
+	    hole = i;
+	}
+    }
+    zlive[hole].block = NULL;
+    zlivecount--;
+}
+
+
+static int Z_SiteFor (const char* file, int line)
+{
+    uintptr_t	p = (uintptr_t)file;
+    unsigned	i;
+    int		n;
+
+    i = (unsigned)(p ^ p >> 32 ^ (uintptr_t)line * 0x85ebca77u) * 0x9e3779b1u;
+    for (n=0 ; n<ZPROF_SITES ; n++, i++)
+    {
+	i &= ZPROF_SITES-1;
+	if (!zsites[i].file)
+	{
+	    zsites[i].file = file;
+	    zsites[i].line = line;
+	    return i;
+	}
+	if (zsites[i].file == file && zsites[i].line == line)
+	    return i;
+    }
+    return -1;
+}
+
+
+static void
+Z_ProfileAlloc
+( void*		ptr,
+  int		tag,
+  const char*	file,
+  int		line )
+{
+    memblock_t*	block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
+    zsite_t*	site;
+    zlive_t*	entry;
+    unsigned	i;
+    int		s;
+
+    ztagallocs[tag & (ZPROF_TAGS-1)]++;
+    s = Z_SiteFor (file, line);
+    if (s < 0
+	|| ((zlivecount+1)*2 > zlivemask+1 && !Z_LiveGrow ()))
+    {
+	zsiteslost++;
+	return;
+    }
+
+    site = &zsites[s];
+    site->tag = tag;
+    site->allocs++;
+    site->live++;
+    site->livebytes += block->size;
+    site->totalbytes += block->size;
+    if (site->livebytes > site->peakbytes)
+	site->peakbytes = site->livebytes;
+
+    for (i = Z_LiveHash (block) & zlivemask ; zlive[i].block ; i = (i+1) & zlivemask)
+	;
+    entry = &zlive[i];
+    entry->block = block;
+    entry->site = s;
+    entry->tag = tag;
+    entry->slab = block->id == SLABID;
+    entry->size = block->size;
+    entry->born = I_GetTime ();
+    zlivecount++;
+}
+
+
+static void Z_ProfileRelease (zlive_t* entry, boolean purged)
+{
+    zsite_t*	site = &zsites[entry->site];
+    int		life = I_GetTime () - entry->born;
+
+    if (purged)
+    {
+	site->purges++;
+	ztagpurges[entry->tag & (ZPROF_TAGS-1)]++;
+    }
+    else
+	site->frees++;
+    site->live--;
+    site->livebytes -= entry->size;
+    site->lifetics += life;
+    if (life > site->maxlife)
+	site->maxlife = life;
+    Z_LiveRemove (entry);
+}
+
+
+static void Z_ProfileFree (memblock_t* block)
+{
+    zlive_t*	entry = Z_LiveFind (block);
+
+    // blocks from before the profiler started aren't known
+    if (entry)
+	Z_ProfileRelease (entry, zonepurging);
+}
+
+
+//
+// Z_ProfileMove
+// Z_Compact moved a block: its entry follows it.
+//
+static void Z_ProfileMove (memblock_t* from, memblock_t* to)
+{
+    zlive_t*	entry = Z_LiveFind (from);
+    zlive_t	moved;
+    unsigned	i;
+
+    if (!entry)
+	return;
+    moved = *entry;
+    Z_LiveRemove (entry);
+    moved.block = to;
+    for (i = Z_LiveHash (to) & zlivemask ; zlive[i].block ; i = (i+1) & zlivemask)
+	;
+    zlive[i] = moved;
+}
+
+
+//
+// Z_ProfileSweepSlabs
+// Slab slots go with their slabs, not one by one.
+//
+static void Z_ProfileSweepSlabs (void)
+{
+    unsigned	i;
+
+    if (!zlive)
+	return;
+    for (i=0 ; i<=(unsigned)zlivemask ; )
+    {
+	if (zlive[i].block && zlive[i].slab)
+	    Z_ProfileRelease (&zlive[i], false);	// may shift the next one here
+	else
+	    i++;
+    }
+}
+
+
+//
+// Z_ProfileReport
+//
+typedef struct
+{
+    char*	buf;
+    int		size;
+    int		len;
+} zjson_t;
+
+static void Z_Json (zjson_t* j, const char* fmt, ...)
+{
+    va_list	ap;
+    int		n;
+
+    va_start (ap, fmt);
+    n = vsnprintf (j->len < j->size ? j->buf + j->len : NULL,
+		   j->len < j->size ? j->size - j->len : 0, fmt, ap);
+    va_end (ap);
+    if (n > 0)
+	j->len += n;
+}
+
+// Call site as a JSON string body: "file.c:123" or "lump NAME".
+static void Z_JsonSite (zjson_t* j, zsite_t* site)
+{
+    char	name[9];
+    int		i;
+
+    if (site->line >= 0)
+    {
+	Z_Json (j, "%s:%d", site->file, site->line);
+	return;
+    }
+    for (i=0 ; i<8 && site->file[i] ; i++)
+	name[i] = site->file[i] == '"' || site->file[i] == '\\'
+	    || (unsigned char)site->file[i] < 0x20 ? '?' : site->file[i];
+    name[i] = 0;
+    Z_Json (j, "lump %s", name);
+}
+
+static zsite_t*	zsortsites;
+
+static int Z_CompareSites (const void* a, const void* b)
+{
+    const zsite_t*	s1 = &zsortsites[*(const short *)a];
+    const zsite_t*	s2 = &zsortsites[*(const short *)b];
+
+    if (s1->purges != s2->purges)
+	return s2->purges - s1->purges;
+    if (s1->totalbytes != s2->totalbytes)
+	return s1->totalbytes < s2->totalbytes ? 1 : -1;
+    return 0;
+}
+
+int Z_ProfileReport (char* buf, int size)
+{
+    static const struct { int tag; const char* name; } tags[] =
+    {
+	{ PU_STATIC, "static" }, { PU_SOUND, "sound" }, { PU_MUSIC, "music" },
+	{ PU_DAVE, "dave" }, { PU_LEVEL, "level" }, { PU_LEVSPEC, "levspec" },
+	{ PU_PURGELEVEL, "purgelevel" }, { PU_CACHE, "cache" },
+    };
+    zjson_t		j = { buf, size, 0 };
+    zonestats_t		stats;
+    memblock_t*		block;
+    short		order[ZPROF_SITES];
+    zsite_t*		site;
+    int			blocks;
+    int			bytes;
+    int			count;
+    int			t;
+    int			i;
+
+    Z_ZoneStats (&stats);
+    Z_Json (&j, "{\"profiling\":%d,\"size\":%d,\"zones\":%d,\"used\":%d,"
+	    "\"highwater\":%d,\"free\":%d,\"free_blocks\":%d,\"largest_free\":%d,"
+	    "\"purgable\":%d,\"purges\":%d,\"grows\":%d,\"arena_size\":%d,"
+	    "\"arena_used\":%d,\"untracked\":%d,\"tags\":[",
+	    zoneprofile, stats.size, stats.zones, stats.used, stats.highwater,
+	    stats.free, stats.freeblocks, stats.largestfree, stats.purgable,
+	    stats.purges, stats.grows, stats.arenasize, stats.arenaused,
+	    zsiteslost);
+
+    for (t=0 ; t<(int)(sizeof(tags)/sizeof(tags[0])) ; t++)
+    {
+	blocks = bytes = 0;
+	for (i=0 ; i<numzones ; i++)
+	    for (block = zones[i]->blocklist.next ;
+		 block != &zones[i]->blocklist;
+		 block = block->next)
+		if (block->user && block->tag == tags[t].tag)
+		{
+		    blocks++;
+		    bytes += block->size;
+		}
+	Z_Json (&j, "%s{\"tag\":%d,\"name\":\"%s\",\"blocks\":%d,\"bytes\":%d,"
+		"\"allocs\":%d,\"purges\":%d}", t ? "," : "", tags[t].tag,
+		tags[t].name, blocks, bytes, ztagallocs[tags[t].tag],
+		ztagpurges[tags[t].tag]);
+    }
+
+    // most purged first, then the most bytes allocated
+    count = 0;
+    for (i=0 ; i<ZPROF_SITES ; i++)
+	if (zsites[i].file)
+	    order[count++] = i;
+    zsortsites = zsites;
+    qsort (order, count, sizeof(order[0]), Z_CompareSites);
+
+    Z_Json (&j, "],\"sites\":[");
+    for (i=0 ; i<count ; i++)
+    {
+	site = &zsites[order[i]];
+	Z_Json (&j, "%s{\"site\":\"", i ? "," : "");
+	Z_JsonSite (&j, site);
+	Z_Json (&j, "\",\"tag\":%d,\"allocs\":%d,\"frees\":%d,\"purges\":%d,"
+		"\"live\":%d,\"live_bytes\":%d,\"peak_bytes\":%d,\"total_bytes\":%lld,"
+		"\"avg_life\":%lld,\"max_life\":%d}",
+		site->tag, site->allocs, site->frees, site->purges, site->live,
+		site->livebytes, site->peakbytes, site->totalbytes,
+		site->frees + site->purges
+		? site->lifetics / (site->frees + site->purges) : 0,
+		site->maxlife);
+    }
+    Z_Json (&j, "]}");
+    return j.len;
+}
+
+
+//
+// Z_ProfileLog
+// The sampling mode's line: use and purges since the last one.
+//
+void Z_ProfileLog (void)
+{
+    zsite_t*	worst = NULL;
+    char	name[64];
+    zjson_t	j = { name, sizeof(name), 0 };
+    int		i;
+
+    for (i=0 ; i<ZPROF_SITES ; i++)
+	if (zsites[i].file && zsites[i].purges
+	    && (!worst || zsites[i].purges > worst->purges))
+	    worst = &zsites[i];
+    if (worst)
+	Z_JsonSite (&j, worst);
+    else
+	strcpy (name, "none");
+
+    UBO_LOG (UBO_LOG_INFO, "[doom] zone: %d KB used, peak %d KB since the last"
+	     " sample (%d KB ever) of %d KB, %d purges; most purged: %s (%d)\n",
+	     zoneused >> 10, zonesamplepeak >> 10, zonehighwater >> 10,
+	     Z_TotalSize () >> 10, zonepurges - zonesamplepurges, name,
+	     worst ? worst->purges : 0);
+    zonesamplepeak = zoneused;
+    zonesamplepurges = zonepurges;
+}
+
+
 
 //
 // Z_ClearZone
@@ -88,35 +748,88 @@ void Z_ClearZone (memzone_t* zone)
 
 
 
+static void Z_FreeZone (memzone_t* zone)
+{
+    I_ZoneFree ((byte *)zone, zone->size);
+}
+
+
 //
 // Z_Init
 //
 void Z_Init (void)
 {
-    memblock_t*	block;
     int		size;
 
-    mainzone = (memzone_t *)I_ZoneBase (&size);
-    mainzone->size = size;
+    size = zonesize > 0 ? zonesize : I_GetHeapSize ();
 
-    fprintf(stderr, "[doom] Z_Init: sizeof(memblock_t)=%zu sizeof(memzone_t)=%zu zone=%p size=%d\n",
-	    sizeof(memblock_t), sizeof(memzone_t), (void*)mainzone, size);
+    // a previous session's chained zones go back; its base zone is
+    //  reused when the size still matches
+    while (numzones > 1)
+	Z_FreeZone (zones[--numzones]);
+    if (numzones && zones[0]->size != size)
+	Z_FreeZone (zones[--numzones]);
 
-    // set the entire zone to one free block
-    mainzone->blocklist.next =
-	mainzone->blocklist.prev =
-	block = (memblock_t *)( (byte *)mainzone + sizeof(memzone_t) );
+    if (!numzones)
+    {
+	mainzone = (memzone_t *)I_ZoneBase (&size);
+	if (!mainzone)
+	    I_Error ("Z_Init: failed to allocate a %i byte zone", size);
+	mainzone->size = size;
+	zones[numzones++] = mainzone;
+    }
+    mainzone = zones[0];
+    Z_ClearZone (mainzone);
 
-    mainzone->blocklist.user = (void *)mainzone;
-    mainzone->blocklist.tag = PU_STATIC;
-    mainzone->rover = block;
-	
-    block->prev = block->next = &mainzone->blocklist;
+    slabs = NULL;
+    memset (slabfree, 0, sizeof(slabfree));
+    Z_ResetArena ();
 
-    // NULL indicates a free block.
-    block->user = NULL;
-    
-    block->size = mainzone->size - sizeof(memzone_t);
+    zoneused = zonehighwater = 0;
+    zonepurges = zonegrows = 0;
+    Z_ProfileClear ();
+
+    UBO_LOG(UBO_LOG_DEBUG, "[doom] Z_Init: sizeof(memblock_t)=%zu sizeof(memzone_t)=%zu zone=%p size=%d max=%d\n",
+	    sizeof(memblock_t), sizeof(memzone_t), (void*)mainzone, size,
+	    zonemaxsize > size ? zonemaxsize : size);
+}
+
+
+
+//
+// Z_Shutdown
+// Hands every zone and the level arena back to the system.
+//
+void Z_Shutdown (void)
+{
+    arenachunk_t*	chunk;
+
+    while (numzones)
+	Z_FreeZone (zones[--numzones]);
+    mainzone = NULL;
+
+    while (arenachunks)
+    {
+	chunk = arenachunks;
+	arenachunks = chunk->next;
+	free (chunk);
+    }
+    arenacur = NULL;
+
+    slabs = NULL;
+    memset (slabfree, 0, sizeof(slabfree));
+    Z_ProfileClear ();
+}
+
+
+//
+// Z_IsZonePtr
+// False for lumps handed out straight from a mapped WAD (w_wad.c);
+//  Z_Free and Z_ChangeTag leave those alone.
+//
+int Z_IsZonePtr (void* ptr)
+{
+    return Z_ZoneFor (ptr) != NULL;
 }
 
 
@@ -125,11 +838,25 @@ void Z_Init (void)
 //
 void Z_Free (void* ptr)
 {
+    memzone_t*		zone;
     memblock_t*		block;
     memblock_t*		other;
 	
+    zone = Z_ZoneFor (ptr);
+    if (!zone)
+	return;
+
     block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
 
+    if (zoneprofile && (block->id == SLABID || block->id == ZONEID))
+	Z_ProfileFree (block);
+
+    if (block->id == SLABID)
+    {
+	Z_SlabFree (block);
+	return;
+    }
+
     if (block->id != ZONEID)
 	I_Error ("Z_Free: freed a pointer without ZONEID");
 		
@@ -143,6 +870,7 @@ void Z_Free (void* ptr)
     }
 
     // mark as free
+    zoneused -= block->size;
     block->user = NULL;	
     block->tag = 0;
     block->id = 0;
@@ -156,8 +884,8 @@ void Z_Free (void* ptr)
 	other->next = block->next;
 	other->next->prev = other;
 
-	if (block == mainzone->rover)
-	    mainzone->rover = other;
+	if (block == zone->rover)
+	    zone->rover = other;
 
 	block = other;
     }
@@ -170,8 +898,8 @@ void Z_Free (void* ptr)
 	block->next = other->next;
 	block->next->prev = block;
 
-	if (other == mainzone->rover)
-	    mainzone->rover = block;
+	if (other == zone->rover)
+	    zone->rover = block;
     }
 }
 
@@ -184,9 +912,15 @@ void Z_Free (void* ptr)
 #define MINFRAGMENT		64
 
 
-void*
-Z_Malloc
-( int		size,
+//
+// Z_ZoneMalloc
+// First fit in one zone, purging cache blocks along the way.
+// Returns NULL if nothing fits there.  size includes the header.
+//
+static void*
+Z_ZoneMalloc
+( memzone_t*	zone,
+  int		size,
   int		tag,
   void*		user )
 {
@@ -196,24 +930,14 @@ Z_Malloc
     memblock_t* newblock;
     memblock_t*	base;
 
-    // Align to 8 bytes (pointer alignment on 64-bit).
-    // Original code used 4-byte alignment which was sufficient for 32-bit DOS/Linux,
-    // but on aarch64 sizeof(memblock_t)=40 and pointer fields require 8-byte alignment.
-    // 4-byte-only alignment causes newblock to land at a misaligned address, corrupting
-    // the next/prev pointer fields of the carved-out block.
-    size = (size + 7) & ~7;
-
     // scan through the block list,
     // looking for the first free block
     // of sufficient size,
     // throwing out any purgable blocks along the way.
 
-    // account for size of block header
-    size += sizeof(memblock_t);
-    
     // if there is a free block behind the rover,
     //  back up over them
-    base = mainzone->rover;
+    base = zone->rover;
     
     if (!base->prev->user)
 	base = base->prev;
@@ -226,7 +950,7 @@ Z_Malloc
 	if (rover == start)
 	{
 	    // scanned all the way around the list
-	    I_Error ("Z_Malloc: failed on allocation of %i bytes", size);
+	    return NULL;
 	}
 	
 	if (rover->user)
@@ -243,7 +967,10 @@ Z_Malloc
 
 		// the rover can be the base block
 		base = base->prev;
+		zonepurging = true;
 		Z_Free ((byte *)rover+sizeof(memblock_t));
+		zonepurging = false;
+		zonepurges++;
 		base = base->next;
 		rover = base->next;
 	    }
@@ -281,23 +1008,126 @@ Z_Malloc
     }
     else
     {
-	if (tag >= PU_PURGELEVEL)
-	    I_Error ("Z_Malloc: an owner is required for purgable blocks");
-
 	// mark as in use, but unowned	
 	base->user = (void *)2;		
     }
     base->tag = tag;
 
     // next allocation will start looking here
-    mainzone->rover = base->next;	
+    zone->rover = base->next;	
 	
     base->id = ZONEID;
+
+    zoneused += base->size;
+    if (zoneused > zonehighwater)
+	zonehighwater = zoneused;
+    if (zoneused > zonesamplepeak)
+	zonesamplepeak = zoneused;
     
     return (void *) ((byte *)base + sizeof(memblock_t));
 }
 
 
+//
+// Z_GrowZone
+// Chains on a zone big enough for size (header included).
+//
+static memzone_t* Z_GrowZone (int size)
+{
+    memzone_t*	zone;
+    int		grow;
+
+    grow = size + sizeof(memzone_t) + MINFRAGMENT;
+    if (grow < ZONEGROW)
+	grow = ZONEGROW;
+    if (zonemaxsize - Z_TotalSize () < grow)
+	grow = zonemaxsize - Z_TotalSize ();
+
+    if (numzones == MAXZONES
+	|| grow < size + (int)sizeof(memzone_t))
+	return NULL;
+
+    zone = (memzone_t *)I_ZoneBase (&grow);
+    if (!zone)
+	return NULL;
+    zone->size = grow;
+    Z_ClearZone (zone);
+    zones[numzones++] = zone;
+    zonegrows++;
+
+    UBO_LOG (UBO_LOG_INFO, "[doom] Z_Malloc: chained a %d KB zone (%d KB in %d zones)\n",
+	     grow >> 10, Z_TotalSize () >> 10, numzones);
+    return zone;
+}
+
+
+void*
+Z_MallocAt
+( int		size,
+  int		tag,
+  void*		user,
+  const char*	file,
+  int		line )
+{
+    memzone_t*	zone;
+    void*	ptr;
+    int		i;
+
+    // Align to 8 bytes (pointer alignment on 64-bit).
+    // Original code used 4-byte alignment which was sufficient for 32-bit DOS/Linux,
+    // but on aarch64 sizeof(memblock_t)=40 and pointer fields require 8-byte alignment.
+    // 4-byte-only alignment causes newblock to land at a misaligned address, corrupting
+    // the next/prev pointer fields of the carved-out block.
+    size = (size + 7) & ~7;
+
+    if (zoneslabs && !user
+	&& (tag == PU_LEVEL || tag == PU_LEVSPEC)
+	&& size > 0 && size <= SLABCLASSES*SLABQUANTUM)
+    {
+	ptr = Z_SlabMalloc (size, tag);
+	if (zoneprofile)
+	    Z_ProfileAlloc (ptr, tag, file, line);
+	return ptr;
+    }
+
+    if (!user && tag >= PU_PURGELEVEL)
+	I_Error ("Z_Malloc: an owner is required for purgable blocks");
+
+    // account for size of block header
+    size += sizeof(memblock_t);
+
+    ptr = NULL;
+    for (i=0 ; i<numzones && !ptr ; i++)
+	ptr = Z_ZoneMalloc (zones[i], size, tag, user);
+
+    if (!ptr)
+    {
+	zone = Z_GrowZone (size);
+	if (!zone || !(ptr = Z_ZoneMalloc (zone, size, tag, user)))
+	    I_Error ("Z_Malloc: failed on allocation of %i bytes", size);
+    }
+    if (zoneprofile)
+	Z_ProfileAlloc (ptr, tag, file, line);
+    return ptr;
+}
+
+
+//
+// Z_MallocLump
+// Z_Malloc for a lump cache: the profiler charges the block to the
+//  lump (its 8 character name, kept by pointer) instead of the line.
+//
+void*
+Z_MallocLump
+( int		size,
+  int		tag,
+  void*		user,
+  const char*	name )
+{
+    return Z_MallocAt (size, tag, user, name, -1);
+}
+
+
 
 //
 // Z_FreeTags
@@ -309,24 +1139,288 @@ Z_FreeTags
 {
     memblock_t*	block;
     memblock_t*	next;
+    int		i;
 	
-    for (block = mainzone->blocklist.next ;
-	 block != &mainzone->blocklist ;
-	 block = next)
+    for (i=0 ; i<numzones ; i++)
     {
-	// get link before freeing
-	next = block->next;
+	for (block = zones[i]->blocklist.next ;
+	     block != &zones[i]->blocklist ;
+	     block = next)
+	{
+	    // get link before freeing
+	    next = block->next;
 
-	// free block?
-	if (!block->user)
-	    continue;
+	    // free block?
+	    if (!block->user)
+		continue;
 	
-	if (block->tag >= lowtag && block->tag <= hightag)
-	    Z_Free ( (byte *)block+sizeof(memblock_t));
+	    if (block->tag >= lowtag && block->tag <= hightag)
+		Z_Free ( (byte *)block+sizeof(memblock_t));
+	}
+    }
+
+    // the slabs (PU_LEVEL blocks) just went with everything in them
+    if (lowtag <= PU_LEVEL && hightag >= PU_LEVEL)
+    {
+	if (zoneprofile)
+	    Z_ProfileSweepSlabs ();
+	slabs = NULL;
+	memset (slabfree, 0, sizeof(slabfree));
+	Z_ResetArena ();
+    }
+}
+
+
+
+//
+// ZONE COMPACTION
+// Z_Compact moves the purgable blocks that have an owner down over
+//  the free space in front of them, so the holes cached lumps leave
+//  between the static blocks close up and the free space gathers in
+//  one block at the top of each zone.  Where a block that can't move
+//  follows a hole, later movable blocks that fit are moved into it.
+//  The owner's pointer follows the block.  A purgable block is only
+//  good until the next Z_Malloc, so nothing else may still point at
+//  one; P_SetupLevel runs it once the last level has been freed.
+//
+int		zonecompact;
+
+static int	compactmoved;
+static int	compactbytes;
+
+
+static boolean Z_Movable (memblock_t* block)
+{
+    return block->id == ZONEID
+	&& block->user > (void **)0x100
+	&& block->tag >= PU_PURGELEVEL;
+}
+
+
+//
+// Z_Relocated
+// The bookkeeping once block's contents went from `from`.
+//
+static void Z_Relocated (memblock_t* block, memblock_t* from)
+{
+    *block->user = (byte *)block + sizeof(memblock_t);
+    if (zoneprofile)
+	Z_ProfileMove (from, block);
+    compactmoved++;
+    compactbytes += block->size;
+}
+
+
+//
+// Z_SlideDown
+// hole is free and the block after it movable: the block goes to the
+//  hole's address and the free space after it, merged with any that
+//  follows.  Returns the free block.
+//
+static memblock_t* Z_SlideDown (memzone_t* zone, memblock_t* hole)
+{
+    memblock_t*	block = hole->next;
+    memblock_t*	prev = hole->prev;
+    memblock_t*	after = block->next;
+    int		holesize = hole->size;
+    int		size = block->size;
+    memblock_t*	moved = hole;
+    memblock_t*	rest;
+
+    // header and contents; the hole's header is overwritten
+    memmove (moved, block, size);
+    moved->prev = prev;
+    prev->next = moved;
+
+    rest = (memblock_t *)((byte *)moved + size);
+    rest->size = holesize;
+    rest->user = NULL;
+    rest->tag = 0;
+    rest->id = 0;
+    rest->prev = moved;
+    rest->next = after;
+    moved->next = rest;
+    after->prev = rest;
+    if (!after->user)
+    {
+	rest->size += after->size;
+	rest->next = after->next;
+	rest->next->prev = rest;
+    }
+
+    Z_Relocated (moved, block);
+    zone->rover = rest;
+    return rest;
+}
+
+
+//
+// Z_MoveInto
+// Moves block into the free block hole, below it, and frees its old
+//  place.  A remainder too small to stand alone stays with block.
+//
+static void Z_MoveInto (memzone_t* zone, memblock_t* hole, memblock_t* block)
+{
+    memblock_t*	rest;
+    memblock_t*	other;
+    int		extra = hole->size - block->size;
+
+    if (extra > MINFRAGMENT)
+    {
+	rest = (memblock_t *)((byte *)hole + block->size);
+	rest->size = extra;
+	rest->user = NULL;
+	rest->tag = 0;
+	rest->id = 0;
+	rest->prev = hole;
+	rest->next = hole->next;
+	rest->next->prev = rest;
+	hole->next = rest;
+	hole->size = block->size;
     }
+    zoneused += hole->size - block->size;
+
+    memcpy ((byte *)hole + sizeof(memblock_t), (byte *)block + sizeof(memblock_t),
+	    block->size - sizeof(memblock_t));
+    hole->user = block->user;
+    hole->tag = block->tag;
+    hole->id = ZONEID;
+    Z_Relocated (hole, block);
+
+    // the old place goes free, merged as Z_Free would
+    block->user = NULL;
+    block->tag = 0;
+    block->id = 0;
+    other = block->prev;
+    if (!other->user)
+    {
+	other->size += block->size;
+	other->next = block->next;
+	other->next->prev = other;
+	block = other;
+    }
+    other = block->next;
+    if (!other->user)
+    {
+	block->size += other->size;
+	block->next = other->next;
+	block->next->prev = block;
+    }
+    zone->rover = block;
+}
+
+
+void Z_Compact (void)
+{
+    memzone_t*	zone;
+    memblock_t*	block;
+    memblock_t*	fit;
+    int		largest = 0;
+    int		before;
+    int		i;
+
+    if (!zonecompact)
+	return;
+    before = Z_FreeMemory ();
+    compactmoved = compactbytes = 0;
+
+    for (i=0 ; i<numzones ; i++)
+    {
+	zone = zones[i];
+	for (block = zone->blocklist.next ;
+	     block != &zone->blocklist ;
+	     block = block->next)
+	{
+	    if (block->user)
+		continue;
+
+	    // slide what can move down into the hole...
+	    while (block->next != &zone->blocklist && Z_Movable (block->next))
+		block = Z_SlideDown (zone, block);
+
+	    // ...and fill it from above where something can't
+	    for (fit = block->next ;
+		 fit != &zone->blocklist && !block->user ;
+		 fit = fit->next)
+	    {
+		if (!Z_Movable (fit) || fit->size > block->size)
+		    continue;
+		Z_MoveInto (zone, block, fit);
+		if (block->next->user)
+		    break;
+		block = block->next;	// the remainder
+		fit = block;
+	    }
+	}
+
+	// next allocation starts at the gathered free space
+	zone->rover = zone->blocklist.next;
+	for (block = zone->blocklist.next ;
+	     block != &zone->blocklist ;
+	     block = block->next)
+	    if (!block->user && block->size > largest)
+	    {
+		largest = block->size;
+		zone->rover = block;
+	    }
+    }
+
+    if (compactmoved)
+	UBO_LOG (UBO_LOG_INFO, "[doom] Z_Compact: moved %d cache blocks (%d KB),"
+		 " largest free block now %d KB of %d KB free\n",
+		 compactmoved, compactbytes >> 10, largest >> 10, before >> 10);
+}
+
+
+
+//
+// Z_ReleaseFree
+// Hands the whole pages inside free blocks back to the system; they
+//  read as zeros when next allocated.  Block headers stay put.
+//  Returns the bytes released.
+//
+int Z_ReleaseFree (void)
+{
+    memblock_t*	block;
+    uintptr_t	page = (uintptr_t)sysconf (_SC_PAGESIZE);
+    uintptr_t	start;
+    uintptr_t	end;
+    int		released = 0;
+    int		i;
+
+    for (i=0 ; i<numzones ; i++)
+    {
+	for (block = zones[i]->blocklist.next ;
+	     block != &zones[i]->blocklist;
+	     block = block->next)
+	{
+	    if (block->user)
+		continue;
+	    start = ((uintptr_t)block + sizeof(memblock_t) + page-1) & ~(page-1);
+	    end = ((uintptr_t)block + block->size) & ~(page-1);
+	    if (end > start && !madvise ((void *)start, end-start, MADV_DONTNEED))
+		released += end-start;
+	}
+    }
+    return released;
 }
 
 
+//
+// Z_ResidentBytes
+// The zones' bytes in RAM: what Z_ReleaseFree gave back, or pages
+//  never touched, don't count.
+//
+int Z_ResidentBytes (void)
+{
+    int		resident = 0;
+    int		i;
+
+    for (i=0 ; i<numzones ; i++)
+	resident += I_ResidentBytes (zones[i], zones[i]->size);
+    return resident;
+}
+
 
 //
 // Z_DumpHeap
@@ -338,33 +1432,39 @@ Z_DumpHeap
   int		hightag )
 {
     memblock_t*	block;
+    memzone_t*	zone;
+    int		i;
 	
-    printf ("zone size: %i  location: %p\n",
-	    mainzone->size,mainzone);
-    
     printf ("tag range: %i to %i\n",
 	    lowtag, hightag);
 	
-    for (block = mainzone->blocklist.next ; ; block = block->next)
+    for (i=0 ; i<numzones ; i++)
     {
-	if (block->tag >= lowtag && block->tag <= hightag)
-	    printf ("block:%p    size:%7i    user:%p    tag:%3i\n",
-		    block, block->size, block->user, block->tag);
-		
-	if (block->next == &mainzone->blocklist)
+	zone = zones[i];
+	printf ("zone size: %i  location: %p\n",
+		zone->size,zone);
+    
+	for (block = zone->blocklist.next ; ; block = block->next)
 	{
-	    // all blocks have been hit
-	    break;
-	}
+	    if (block->tag >= lowtag && block->tag <= hightag)
+		printf ("block:%p    size:%7i    user:%p    tag:%3i\n",
+			block, block->size, block->user, block->tag);
+		
+	    if (block->next == &zone->blocklist)
+	    {
+		// all blocks have been hit
+		break;
+	    }
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
-	    printf ("ERROR: block size does not touch the next block\n");
+	    if ( (byte *)block + block->size != (byte *)block->next)
+		printf ("ERROR: block size does not touch the next block\n");
 
-	if ( block->next->prev != block)
-	    printf ("ERROR: next block doesn't have proper back link\n");
+	    if ( block->next->prev != block)
+		printf ("ERROR: next block doesn't have proper back link\n");
 
-	if (!block->user && !block->next->user)
-	    printf ("ERROR: two consecutive free blocks\n");
+	    if (!block->user && !block->next->user)
+		printf ("ERROR: two consecutive free blocks\n");
+	}
     }
 }
 
@@ -375,28 +1475,34 @@ Z_DumpHeap
 void Z_FileDumpHeap (FILE* f)
 {
     memblock_t*	block;
+    memzone_t*	zone;
+    int		i;
 	
-    fprintf (f,"zone size: %i  location: %p\n",mainzone->size,mainzone);
-	
-    for (block = mainzone->blocklist.next ; ; block = block->next)
+    for (i=0 ; i<numzones ; i++)
     {
-	fprintf (f,"block:%p    size:%7i    user:%p    tag:%3i\n",
-		 block, block->size, block->user, block->tag);
-		
-	if (block->next == &mainzone->blocklist)
+	zone = zones[i];
+	fprintf (f,"zone size: %i  location: %p\n",zone->size,zone);
+	
+	for (block = zone->blocklist.next ; ; block = block->next)
 	{
-	    // all blocks have been hit
-	    break;
-	}
+	    fprintf (f,"block:%p    size:%7i    user:%p    tag:%3i\n",
+		     block, block->size, block->user, block->tag);
+		
+	    if (block->next == &zone->blocklist)
+	    {
+		// all blocks have been hit
+		break;
+	    }
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
-	    fprintf (f,"ERROR: block size does not touch the next block\n");
+	    if ( (byte *)block + block->size != (byte *)block->next)
+		fprintf (f,"ERROR: block size does not touch the next block\n");
 
-	if ( block->next->prev != block)
-	    fprintf (f,"ERROR: next block doesn't have proper back link\n");
+	    if ( block->next->prev != block)
+		fprintf (f,"ERROR: next block doesn't have proper back link\n");
 
-	if (!block->user && !block->next->user)
-	    fprintf (f,"ERROR: two consecutive free blocks\n");
+	    if (!block->user && !block->next->user)
+		fprintf (f,"ERROR: two consecutive free blocks\n");
+	}
     }
 }
 
@@ -408,23 +1514,29 @@ void Z_FileDumpHeap (FILE* f)
 void Z_CheckHeap (void)
 {
     memblock_t*	block;
+    memzone_t*	zone;
+    int		i;
 	
-    for (block = mainzone->blocklist.next ; ; block = block->next)
+    for (i=0 ; i<numzones ; i++)
     {
-	if (block->next == &mainzone->blocklist)
+	zone = zones[i];
+	for (block = zone->blocklist.next ; ; block = block->next)
 	{
-	    // all blocks have been hit
-	    break;
-	}
+	    if (block->next == &zone->blocklist)
+	    {
+		// all blocks have been hit
+		break;
+	    }
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
-	    I_Error ("Z_CheckHeap: block size does not touch the next block\n");
+	    if ( (byte *)block + block->size != (byte *)block->next)
+		I_Error ("Z_CheckHeap: block size does not touch the next block\n");
 
-	if ( block->next->prev != block)
-	    I_Error ("Z_CheckHeap: next block doesn't have proper back link\n");
+	    if ( block->next->prev != block)
+		I_Error ("Z_CheckHeap: next block doesn't have proper back link\n");
 
-	if (!block->user && !block->next->user)
-	    I_Error ("Z_CheckHeap: two consecutive free blocks\n");
+	    if (!block->user && !block->next->user)
+		I_Error ("Z_CheckHeap: two consecutive free blocks\n");
+	}
     }
 }
 
@@ -441,11 +1553,23 @@ Z_ChangeTag2
 {
     memblock_t*	block;
 	
+    if (!Z_IsZonePtr (ptr))
+	return;
+
     block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
 
-    if (block->id != ZONEID)
+    if (block->id != ZONEID && block->id != SLABID)
 	I_Error ("Z_ChangeTag: freed a pointer without ZONEID");
 
+    // slab slots are never purged; only level tags live there
+    if (block->id == SLABID)
+    {
+	if (tag >= PU_PURGELEVEL)
+	    I_Error ("Z_ChangeTag: slab blocks can't be purgable");
+	block->tag = tag;
+	return;
+    }
+
     if (tag >= PU_PURGELEVEL && (unsigned)block->user < 0x100)
 	I_Error ("Z_ChangeTag: an owner is required for purgable blocks");
 
@@ -454,6 +1578,65 @@ Z_ChangeTag2
 
 
 
+//
+// Z_ZoneStats
+// Fragmentation picture of the zone: free/purgable totals, the number
+//  and largest of the free fragments, and slab occupancy.
+//
+void Z_ZoneCounters (zonestats_t* stats)
+{
+    memset (stats, 0, sizeof(*stats));
+    stats->size = Z_TotalSize ();
+    stats->zones = numzones;
+    stats->used = zoneused;
+    stats->highwater = zonehighwater;
+    stats->purges = zonepurges;
+    stats->grows = zonegrows;
+}
+
+void Z_ZoneStats (zonestats_t* stats)
+{
+    memblock_t*		block;
+    slab_t*		slab;
+    arenachunk_t*	chunk;
+    int			i;
+
+    Z_ZoneCounters (stats);
+
+    for (i=0 ; i<numzones ; i++)
+    {
+	for (block = zones[i]->blocklist.next ;
+	     block != &zones[i]->blocklist;
+	     block = block->next)
+	{
+	    if (!block->user)
+	    {
+		stats->free += block->size;
+		stats->freeblocks++;
+		if (block->size > stats->largestfree)
+		    stats->largestfree = block->size;
+	    }
+	    else if (block->tag >= PU_PURGELEVEL)
+		stats->purgable += block->size;
+	}
+    }
+
+    for (slab = slabs ; slab ; slab = slab->next)
+    {
+	stats->slabs++;
+	stats->slabused += slab->used;
+	stats->slabfree += (SLABBYTES - sizeof(slab_t)) / slab->slotsize - slab->used;
+    }
+
+    for (chunk = arenachunks ; chunk ; chunk = chunk->next)
+    {
+	stats->arenasize += chunk->size;
+	stats->arenaused += chunk->used;
+    }
+}
+
+
+
 //
 // Z_FreeMemory
 //
@@ -461,15 +1644,19 @@ int Z_FreeMemory (void)
 {
     memblock_t*		block;
     int			free;
+    int			i;
 	
     free = 0;
     
-    for (block = mainzone->blocklist.next ;
-	 block != &mainzone->blocklist;
-	 block = block->next)
+    for (i=0 ; i<numzones ; i++)
     {
-	if (!block->user || block->tag >= PU_PURGELEVEL)
-	    free += block->size;
+	for (block = zones[i]->blocklist.next ;
+	     block != &zones[i]->blocklist;
+	     block = block->next)
+	{
+	    if (!block->user || block->tag >= PU_PURGELEVEL)
+		free += block->size;
+	}
     }
     return free;
 }
@@ -45,7 +45,8 @@
 
 
 void	Z_Init (void);
-void*	Z_Malloc (int size, int tag, void *ptr);
+void	Z_Shutdown (void);
+void*	Z_MallocAt (int size, int tag, void *ptr, const char* file, int line);
 void    Z_Free (void *ptr);
 void    Z_FreeTags (int lowtag, int hightag);
 void    Z_DumpHeap (int lowtag, int hightag);
@@ -53,6 +54,69 @@ void    Z_FileDumpHeap (FILE *f);
 void    Z_CheckHeap (void);
 void    Z_ChangeTag2 (void *ptr, int tag);
 int     Z_FreeMemory (void);
+// Returns the pages of free blocks to the system (doom_suspend).
+int     Z_ReleaseFree (void);
+int     Z_ResidentBytes (void);
+int     Z_IsZonePtr (void *ptr);
+
+typedef struct
+{
+    int		size;		// all zones, headers included
+    int		zones;		// base zone plus chained ones
+    int		used;		// bytes in allocated blocks, headers included
+    int		highwater;	// most bytes ever allocated at once
+    int		purges;		// cache blocks thrown out to make room
+    int		grows;		// zones chained on since Z_Init
+    int		free;		// bytes in free fragments
+    int		freeblocks;	// number of free fragments
+    int		largestfree;	// biggest single free fragment
+    int		purgable;	// bytes in blocks tagged >= PU_PURGELEVEL
+    int		slabs;		// slab blocks (zoneslabs)
+    int		slabused;	// live slab slots
+    int		slabfree;	// empty slab slots
+    int		arenasize;	// level arena chunk bytes (zonearena)
+    int		arenaused;	// bytes handed out this level
+} zonestats_t;
+
+void    Z_ZoneStats (zonestats_t* stats);
+// Only the running totals (size to grows), without Z_ZoneStats' walk,
+//  cheap enough for every tic.
+void    Z_ZoneCounters (zonestats_t* stats);
+
+// Allocation profiler (UBO_DOOM_ZONE_PROFILE, doom_zone_report).  While
+// zoneprofile is set, every block is charged to the Z_Malloc call that
+// made it, or to the lump a lump cache read into it; frees, purges and
+// lifetimes (in I_GetTime tics) are booked against the same site.
+// Turning it on starts over.  Z_ProfileReport writes per-tag and
+// per-site totals as JSON into buf, snprintf style: the length it needed.
+// Z_ProfileLog logs the zone use since the last call in one line.
+extern int	zoneprofile;
+void    Z_SetProfile (int on);
+int     Z_ProfileReport (char* buf, int size);
+void    Z_ProfileLog (void);
+void*   Z_MallocLump (int size, int tag, void *ptr, const char* name);
+
+// Serve small ownerless PU_LEVEL/PU_LEVSPEC allocations from
+// per-size-class slabs (O(1) alloc/free, no heap fragmentation).
+extern int	zoneslabs;
+
+// Moves the owned purgable blocks down over the free space between the
+// blocks that stay, so it gathers in one block at each zone's top.
+// Only safe while nothing holds a cache pointer but its owner: the
+// level load, once the last level is freed (zonecompact).
+void    Z_Compact (void);
+extern int	zonecompact;
+
+// Level-lifetime storage with no owner and no Z_Free: bump allocated
+// outside the zone, rewound by Z_FreeTags when PU_LEVEL goes.
+// Falls back to Z_Malloc(size, PU_LEVEL, 0) when zonearena is clear.
+void*   Z_LevelMalloc (int size);
+extern int	zonearena;
+
+// Base zone bytes (0 = mb_used MB) and the most all zones may grow to
+// (0 = never chain another zone; Z_Malloc failure is fatal as before).
+extern int	zonesize;
+extern int	zonemaxsize;
 
 
 typedef struct memblock_s
@@ -69,11 +133,21 @@ typedef struct memblock_s
 // This is used to get the local FILE:LINE info from CPP
 // prior to really call the function in question.
 //
+#define Z_Malloc(size,tag,ptr) Z_MallocAt (size, tag, ptr, __FILE__, __LINE__)
+
+//
+// Lumps served from a mapped WAD (w_wad.c) live outside the zone; tag
+// changes on them are no-ops.
+//
 #define Z_ChangeTag(p,t) \
 { \
-      if (( (memblock_t *)( (byte *)(p) - sizeof(memblock_t)))->id!=0x1d4a11) \
+    if (Z_IsZonePtr(p)) \
+    { \
+      if (( (memblock_t *)( (byte *)(p) - sizeof(memblock_t)))->id!=0x1d4a11 \
+	  && ( (memblock_t *)( (byte *)(p) - sizeof(memblock_t)))->id!=0x1d4a12) \
 	  I_Error("Z_CT at "__FILE__":%i",__LINE__); \
 	  Z_ChangeTag2(p,t); \
+    } \
 };
 
 
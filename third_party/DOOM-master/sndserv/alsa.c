@@ -0,0 +1,126 @@
+// Emacs style mode select   -*- C++ -*- 
+//-----------------------------------------------------------------------------
+//
+// $Id: linux.c,v 1.3 1997/01/26 07:45:01 b1 Exp $
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+//
+// $Log: linux.c,v $
+// Revision 1.3  1997/01/26 07:45:01  b1
+// 2nd formatting run, fixed a few warnings as well.
+//
+// Revision 1.2  1997/01/21 19:00:01  b1
+// First formatting run:
+//  using Emacs cc-mode.el indentation for C++ now.
+//
+// Revision 1.1  1997/01/19 17:22:45  b1
+// Initial check in DOOM sources as of Jan. 10th, 1997
+//
+//
+// DESCRIPTION:
+//	UNIX, soundserver for Linux, ALSA output.
+//	Was OSS (/dev/dsp), which current kernels and boards lack.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <alsa/asoundlib.h>
+
+#include "soundsrv.h"
+
+static snd_pcm_t*	pcm;
+
+// device write failures that found it run dry
+unsigned		underruns;
+
+int			outputrate = SPEED;
+
+
+void
+I_InitSound
+( int	samplerate,
+  int	samplesize )
+{
+    const char*	device;
+    const char*	env;
+    int		latency;
+    int		err;
+
+    device = getenv("UBO_DOOM_ALSA_DEVICE");
+    if (!device || !device[0])
+	device = "default";
+
+    // small: the engine runs ahead of us no more than a mix pass
+    env = getenv("UBO_DOOM_ALSA_BUFFER_US");
+    latency = env && env[0] ? atoi(env) : 40000;
+    if (latency < 5000)
+	latency = 5000;
+
+    err = snd_pcm_open(&pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0)
+    {
+	fprintf(stderr, "Could not open ALSA device %s: %s\n",
+		device, snd_strerror(err));
+	pcm = NULL;
+	return;
+    }
+
+    err = snd_pcm_set_params(pcm,
+			     SND_PCM_FORMAT_S16_LE,
+			     SND_PCM_ACCESS_RW_INTERLEAVED,
+			     2,
+			     samplerate,
+			     1,
+			     latency);
+    if (err < 0)
+    {
+	fprintf(stderr, "Could not play signed 16 data: %s\n",
+		snd_strerror(err));
+	snd_pcm_close(pcm);
+	pcm = NULL;
+	return;
+    }
+    outputrate = samplerate;
+}
+
+int I_SoundReady(void)
+{
+    return pcm != NULL;
+}
+
+void
+I_SubmitOutputBuffer
+( void*	samples,
+  int	samplecount )
+{
+    snd_pcm_sframes_t	frames;
+
+    frames = snd_pcm_writei(pcm, samples, samplecount);
+    if (frames == -EPIPE)
+	underruns++;
+    if (frames < 0)
+	snd_pcm_recover(pcm, (int)frames, 1);
+}
+
+void I_ShutdownSound(void)
+{
+    if (pcm)
+    {
+	snd_pcm_drain(pcm);
+	snd_pcm_close(pcm);
+	pcm = NULL;
+    }
+}
@@ -50,10 +50,14 @@ static const char rcsid[] = "$Id: soundsrv.c,v 1.3 1997/01/29 22:40:44 b1 Exp $"
 #include <malloc.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <sched.h>
 
 #include "sounds.h"
 #include "soundsrv.h"
 #include "wadread.h"
+#include "sndshm.h"
 
 
 
@@ -129,6 +133,12 @@ int		channelids[8];
 
 int		snd_verbose=1;
 
+// engine's shared memory (-shmfd), else commands come on stdin
+sndshm_t*	shm;
+
+// SCHED_FIFO priority (-rtprio), 0 for none
+int		rtprio;
+
 int		steptable[256];
 
 int		vol_lookup[128*256];
@@ -300,6 +310,41 @@ int mix(void)
 
 
 
+//
+// attachshm
+// Maps the block the engine created (linuxdoom-1.10/sndshm.h).
+//
+void attachshm(int fd)
+{
+    shm = mmap(0, sizeof(sndshm_t), PROT_READ|PROT_WRITE,
+	       MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED
+	|| shm->magic != SNDSHM_MAGIC
+	|| shm->version != SNDSHM_VERSION)
+	derror("bad shared memory from the engine");
+}
+
+
+//
+// setrealtime
+// Mixing must not wait behind the engine's process.
+//  Failing (no CAP_SYS_NICE or rtprio limit) is not fatal.
+//
+void setrealtime(void)
+{
+    struct sched_param	param;
+
+    if (rtprio <= 0)
+	return;
+    param.sched_priority = rtprio;
+    if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+	fprintf(stderr, "sndserver: no real-time priority %d\n", rtprio);
+    else
+	mlockall(MCL_CURRENT|MCL_FUTURE);
+}
+
+
 void
 grabdata
 ( int		c,
@@ -343,18 +388,27 @@ grabdata
     //	sprintf(basedefault, "%s/.doomrc", home);
 
 
+    name = 0;
     for (i=1 ; i<c ; i++)
     {
 	if (!strcmp(v[i], "-quiet"))
 	{
 	    snd_verbose = 0;
 	}
+	else if (!strcmp(v[i], "-wad") && i+1 < c)
+	    name = v[++i];
+	else if (!strcmp(v[i], "-shmfd") && i+1 < c)
+	    attachshm(atoi(v[++i]));
+	else if (!strcmp(v[i], "-rtprio") && i+1 < c)
+	    rtprio = atoi(v[++i]);
     }
 
     numsounds = NUMSFX;
     longsound = 0;
 
-    if (! access(doom2fwad, R_OK) )
+    if (name)
+	;
+    else if (! access(doom2fwad, R_OK) )
 	name = doom2fwad;
     else if (! access(doom2wad, R_OK) )
 	name = doom2wad;
@@ -387,7 +441,7 @@ grabdata
 	    if (longsound < lengths[i]) longsound = lengths[i];
 	} else {
 	    S_sfx[i].data = S_sfx[i].link->data;
-	    lengths[i] = lengths[(S_sfx[i].link - S_sfx)/sizeof(sfxinfo_t)];
+	    lengths[i] = lengths[S_sfx[i].link - S_sfx];
 	}
 	// test only
 	//  {
@@ -409,10 +463,61 @@ static struct timezone		whocares;
 
 void updatesounds(void)
 {
+    int		i;
 
     mix();
+    I_MusicRender(mixbuffer, SAMPLECOUNT);
     I_SubmitOutputBuffer(mixbuffer, SAMPLECOUNT);
 
+    if (shm)
+    {
+	for (i=0 ; i<8 ; i++)
+	    __atomic_store_n(&shm->playing[i],
+			     channels[i] ? channelhandles[i] : 0,
+			     __ATOMIC_RELAXED);
+	__atomic_store_n(&shm->underruns, underruns, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&shm->heartbeat, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+//
+// setvolume
+// Picks the channel's volume lookups from volume and seperation.
+//
+void
+setvolume
+( int		slot,
+  int		volume,
+  int		seperation )
+{
+    int		rightvol;
+    int		leftvol;
+
+    // (range: 1 - 256)
+    seperation += 1;
+
+    // (x^2 seperation)
+    leftvol =
+	volume - (volume*seperation*seperation)/(256*256);
+
+    seperation = seperation - 257;
+
+    // (x^2 seperation)
+    rightvol =
+	volume - (volume*seperation*seperation)/(256*256);	
+
+    // sanity check
+    if (rightvol < 0 || rightvol > 127)
+	derror("rightvol out of bounds");
+    
+    if (leftvol < 0 || leftvol > 127)
+	derror("leftvol out of bounds");
+    
+    // get the proper lookup table piece
+    //  for this volume level
+    channelleftvol_lookup[slot] = &vol_lookup[leftvol*256];
+    channelrightvol_lookup[slot] = &vol_lookup[rightvol*256];
 }
 
 int
@@ -420,7 +525,8 @@ addsfx
 ( int		sfxid,
   int		volume,
   int		step,
-  int		seperation )
+  int		seperation,
+  int		handle )
 {
     static unsigned short	handlenums = 0;
  
@@ -430,8 +536,10 @@ addsfx
     int		oldest = mytime;
     int		oldestnum = 0;
     int		slot;
-    int		rightvol;
-    int		leftvol;
+
+    // not in this wad
+    if (sfxid <= 0 || sfxid >= NUMSFX || !S_sfx[sfxid].data)
+	return rc;
 
     // play these sound effects
     //  only one at a time
@@ -472,40 +580,115 @@ addsfx
     if (!handlenums)
 	handlenums = 100;
     
-    channelhandles[slot] = rc = handlenums++;
+    // the engine numbers its own over shared memory
+    if (handle <= 0)
+	handle = handlenums++;
+    channelhandles[slot] = rc = handle;
     channelstep[slot] = step;
     channelstepremainder[slot] = 0;
     channelstart[slot] = mytime;
 
-    // (range: 1 - 256)
-    seperation += 1;
+    setvolume(slot, volume, seperation);
 
-    // (x^2 seperation)
-    leftvol =
-	volume - (volume*seperation*seperation)/(256*256);
+    channelids[slot] = sfxid;
 
-    seperation = seperation - 257;
+    return rc;
 
-    // (x^2 seperation)
-    rightvol =
-	volume - (volume*seperation*seperation)/(256*256);	
+}
 
-    // sanity check
-    if (rightvol < 0 || rightvol > 127)
-	derror("rightvol out of bounds");
-    
-    if (leftvol < 0 || leftvol > 127)
-	derror("leftvol out of bounds");
-    
-    // get the proper lookup table piece
-    //  for this volume level
-    channelleftvol_lookup[slot] = &vol_lookup[leftvol*256];
-    channelrightvol_lookup[slot] = &vol_lookup[rightvol*256];
 
-    channelids[slot] = sfxid;
+static int findhandle(int handle)
+{
+    int		i;
+
+    for (i=0 ; i<8 ; i++)
+	if (channels[i] && channelhandles[i] == handle)
+	    return i;
+    return -1;
+}
 
-    return rc;
 
+static int clampvol(int v, int max)
+{
+    return v < 0 ? 0 : v > max ? max : v;
+}
+
+
+//
+// runcommands
+// Everything the engine posted to the ring since the last pass.
+//  Returns 0 on SNDCMD_QUIT.
+//
+int runcommands(void)
+{
+    unsigned	tail;
+    sndcmd_t*	cmd;
+    int		slot;
+    int		done = 0;
+
+    tail = shm->tail;
+    while (!done && tail != __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE))
+    {
+	cmd = &shm->cmd[tail & (SNDSHM_RING-1)];
+	switch (cmd->op)
+	{
+	  case SNDCMD_PLAY:
+	    addsfx(cmd->a, clampvol(cmd->b, 127),
+		   steptable[cmd->d & 255], clampvol(cmd->c, 255), cmd->e);
+	    break;
+	  case SNDCMD_STOP:
+	    if ((slot = findhandle(cmd->e)) >= 0)
+		channels[slot] = 0;
+	    break;
+	  case SNDCMD_UPDATE:
+	    if ((slot = findhandle(cmd->e)) >= 0)
+	    {
+		setvolume(slot, clampvol(cmd->b, 127), clampvol(cmd->c, 255));
+		channelstep[slot] = steptable[cmd->d & 255];
+	    }
+	    break;
+	  case SNDCMD_SONG:
+	    if (cmd->a > 0 && cmd->a <= SNDSHM_SONGMAX)
+		I_RegisterSong(shm->song);
+	    break;
+	  case SNDCMD_SONGPLAY:
+	    I_PlaySong(1, cmd->a);
+	    break;
+	  case SNDCMD_SONGSTOP:
+	    I_StopSong(1);
+	    break;
+	  case SNDCMD_SONGPAUSE:
+	    I_PauseSong(1);
+	    break;
+	  case SNDCMD_SONGRESUME:
+	    I_ResumeSong(1);
+	    break;
+	  case SNDCMD_SONGFREE:
+	    I_UnRegisterSong(1);
+	    break;
+	  case SNDCMD_MUSICVOLUME:
+	    I_SetMusicVolume(cmd->a);
+	    break;
+	  case SNDCMD_QUIT:
+	  default:
+	    done = 1;
+	    break;
+	}
+	tail++;
+	__atomic_store_n(&shm->tail, tail, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&shm->songplaying, I_QrySongPlaying(1), __ATOMIC_RELAXED);
+    return !done;
+}
+
+
+//
+// The synth forwards its calls to a sound server when the engine runs
+//  one.  This is the server.
+//
+int I_SndServMusic(int op, const void* data, int arg)
+{
+    return 0;
 }
 
 
@@ -616,6 +799,24 @@ main
     I_InitSound(11025, 16);
 
     I_InitMusic();
+    I_MusicSetRate(outputrate);
+
+    setrealtime();
+
+    if (shm)
+    {
+	pid_t	parent = getppid();
+
+	if (!I_SoundReady())
+	    quit();
+	shm->rate = outputrate;
+	__atomic_store_n(&shm->ready, 1, __ATOMIC_RELEASE);
+
+	// paced by the blocking writes; ends with the engine
+	while (runcommands() && getppid() == parent)
+	    updatesounds();
+	quit();
+    }
 
     if (snd_verbose)
 	fprintf(stderr, "ready\n");
@@ -686,7 +887,7 @@ main
 			    vol = (commandbuf[4]<<4) + commandbuf[5];
 			    sep = (commandbuf[6]<<4) + commandbuf[7];
 
-			    handle = addsfx(sndnum, vol, step, sep);
+			    handle = addsfx(sndnum, vol, step, sep, 0);
 			    // returns the handle
 			    //	outputushort(handle);
 			    break;
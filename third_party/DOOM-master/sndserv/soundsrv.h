@@ -35,12 +35,25 @@
 #ifndef __SNDSERVER_H__
 #define __SNDSERVER_H__
 
-#define SAMPLECOUNT		512
+// Frames per mix pass; commands are picked up between passes,
+//  so this is also the added latency (about 12 ms).
+#define SAMPLECOUNT		128
 #define MIXBUFFERSIZE	(SAMPLECOUNT*2*2)
 #define SPEED			11025
 
 
+// The music synth, linuxdoom-1.10/i_music_ubo.c.
 void I_InitMusic(void);
+void I_MusicSetRate(int rate);
+void I_MusicRender(signed short* out, int count);
+void I_SetMusicVolume(int volume);
+int I_RegisterSong(void* data);
+void I_PlaySong(int handle, int looping);
+void I_PauseSong(int handle);
+void I_ResumeSong(int handle);
+void I_StopSong(int handle);
+void I_UnRegisterSong(int handle);
+int I_QrySongPlaying(int handle);
 
 void
 I_InitSound
@@ -55,4 +68,9 @@ I_SubmitOutputBuffer
 void I_ShutdownSound(void);
 void I_ShutdownMusic(void);
 
+// alsa.c
+int I_SoundReady(void);
+extern unsigned	underruns;
+extern int	outputrate;
+
 #endif
@@ -243,6 +243,12 @@ getsfx
     sprintf(name, "ds%s", sfxname);
 
     sfx = (unsigned char *) loadlump(name, &size);
+    if (!sfx)
+    {
+	// shareware lacks the registered sounds
+	*len = 0;
+	return 0;
+    }
 
     // pad the sound effect out to the mixing buffer size
     paddedsize = ((size-8 + (SAMPLECOUNT-1)) / SAMPLECOUNT) * SAMPLECOUNT;
@@ -0,0 +1,178 @@
+"""
+ubo_service/070-doom/display_cadence.py
+
+Picks how often the tick loop sends a frame to the LCD.
+
+No Kivy, DoomLib, or ubo_app dependencies — fully unit-testable.
+
+The ST7789's SPI DMA shares the RPi4 AXI bus with the WiFi SDIO controller,
+and each slows the other down.  Instead of a fixed every-other-iteration
+rule, DoomPage times what each frame it sends costs (the pixel conversion
+plus the render_block calls) and DisplayCadence turns that into a divisor
+of the loop rate, re-picked once a second:
+
+  - the smallest of 1/2/3 iterations whose time covers the cost, with the
+    display held to DISPLAY_SHARE of the loop so the tics keep theirs;
+  - one slower than that while WiFi moves more than wifi_busy_bps;
+  - a slower cadence takes effect at once, a faster one step by step, each
+    only after RELAX_EVALS seconds in a row in which it would have fit
+    with RELAX_MARGIN to spare, so the cadence doesn't flap at a boundary.
+
+DoomPage owns one instance, used only on the tick thread.
+"""
+
+from __future__ import annotations
+
+import time
+from typing import Callable, Final, Optional
+
+MIN_DIVISOR: Final[int] = 1
+MAX_DIVISOR: Final[int] = 3
+# The every-other-iteration cadence used until there is a measurement.
+DEFAULT_DIVISOR: Final[int] = 2
+# Most of the loop time the display may take.
+DISPLAY_SHARE: Final[float] = 0.5
+EVAL_S: Final[float] = 1.0
+# Weight of the newest frame in the cost average.
+COST_ALPHA: Final[float] = 0.2
+RELAX_EVALS: Final[int] = 3
+RELAX_MARGIN: Final[float] = 1.25
+
+PROC_NET_DEV: Final[str] = "/proc/net/dev"
+
+
+def read_wifi_bytes(path: str = PROC_NET_DEV) -> Optional[int]:
+    """Bytes received plus sent on the wl* interfaces, or None without any."""
+    total = 0
+    found = False
+    try:
+        with open(path, encoding="ascii") as f:
+            for line in f:
+                name, sep, counters = line.partition(":")
+                if not sep or not name.strip().startswith("wl"):
+                    continue
+                fields = counters.split()
+                if len(fields) < 9:
+                    continue
+                total += int(fields[0]) + int(fields[8])
+                found = True
+    except (OSError, ValueError):
+        return None
+    return total if found else None
+
+
+def _fit(cost_s: float, interval_s: float) -> int:
+    """Smallest divisor whose share of the loop time covers cost_s."""
+    for divisor in range(MIN_DIVISOR, MAX_DIVISOR):
+        if cost_s <= DISPLAY_SHARE * divisor * interval_s:
+            return divisor
+    return MAX_DIVISOR
+
+
+class DisplayCadence:
+    """
+    Send-every-Nth-iteration scheduler for the LCD.
+
+    Args:
+        interval_s: the tick loop's period
+        fixed: 1..3 holds that divisor (UBO_DOOM_LCD_CADENCE); 0 adapts
+        wifi_busy_bps: WiFi bytes/s above which the cadence backs off
+        wifi_bytes: counter source, read_wifi_bytes() by default
+        clock: monotonic seconds, time.monotonic by default
+    """
+
+    def __init__(
+        self,
+        interval_s: float,
+        *,
+        fixed: int = 0,
+        wifi_busy_bps: float = 256 * 1024,
+        wifi_bytes: Callable[[], Optional[int]] = read_wifi_bytes,
+        clock: Callable[[], float] = time.monotonic,
+    ) -> None:
+        self._interval = interval_s
+        self._fixed = min(max(fixed, MIN_DIVISOR), MAX_DIVISOR) if fixed else 0
+        self._wifi_busy_bps = wifi_busy_bps
+        self._wifi_bytes = wifi_bytes
+        self._clock = clock
+        self._divisor = self._fixed or DEFAULT_DIVISOR
+        self._count = 0
+        self._cost_s: Optional[float] = None
+        self._relax = 0
+        now = clock()
+        self._next_eval = now + EVAL_S
+        self._wifi_t = now
+        self._wifi_last = wifi_bytes()
+        self._wifi_bps = 0.0
+
+    @property
+    def divisor(self) -> int:
+        return self._divisor
+
+    @property
+    def cost_s(self) -> Optional[float]:
+        """Average time a sent frame took, None before the first one."""
+        return self._cost_s
+
+    @property
+    def wifi_bps(self) -> float:
+        return self._wifi_bps
+
+    def due(self) -> bool:
+        """Called once per loop iteration; True when this one sends a frame."""
+        self._count += 1
+        if self._count < self._divisor:
+            return False
+        self._count = 0
+        return True
+
+    def record(self, convert_s: float, send_s: float) -> None:
+        """What the frame just sent took: converting it, then render_block."""
+        cost = convert_s + send_s
+        if self._cost_s is None:
+            self._cost_s = cost
+        else:
+            self._cost_s += COST_ALPHA * (cost - self._cost_s)
+
+    def _sample_wifi(self, now: float) -> None:
+        count = self._wifi_bytes()
+        if count is not None and self._wifi_last is not None and now > self._wifi_t:
+            self._wifi_bps = max(0, count - self._wifi_last) / (now - self._wifi_t)
+        else:
+            self._wifi_bps = 0.0
+        self._wifi_last = count
+        self._wifi_t = now
+
+    def update(self) -> bool:
+        """Re-pick the divisor once a second; True when it changed."""
+        now = self._clock()
+        if now < self._next_eval:
+            return False
+        self._next_eval = now + EVAL_S
+        self._sample_wifi(now)
+        if self._fixed or self._cost_s is None:
+            return False
+
+        busy = self._wifi_bps > self._wifi_busy_bps
+        want = _fit(self._cost_s, self._interval)
+        relaxed = _fit(self._cost_s * RELAX_MARGIN, self._interval)
+        if busy:
+            want = min(want + 1, MAX_DIVISOR)
+            relaxed = min(relaxed + 1, MAX_DIVISOR)
+
+        if want > self._divisor:
+            self._set(want)
+            return True
+        if relaxed < self._divisor:
+            self._relax += 1
+            if self._relax >= RELAX_EVALS:
+                self._set(self._divisor - 1)
+                return True
+            return False
+        self._relax = 0
+        return False
+
+    def _set(self, divisor: int) -> None:
+        self._divisor = divisor
+        self._count = 0
+        self._relax = 0
@@ -6,7 +6,8 @@ Pure-Python state machine for Doom input routing.
 No Kivy, DoomLib, or ubo_app dependencies — fully unit-testable.
 
 DoomPage owns one instance and:
-  - calls update_game_state() from the tick thread after each doom.tick()
+  - seeds it with update_game_state() when the tick loop starts, then feeds
+    it on_game_event() from the doom-events thread as the engine posts them
   - calls go_up/go_down/go_back/btn_l2/btn_l3/toggle_mode from the Kivy main thread
   - provides a tap_fn that enqueues key events for the tick thread
 
@@ -39,7 +40,7 @@ from __future__ import annotations
 from typing import Callable
 
 # Import only the enum — no .so is loaded at import time; see native/doom_lib.py.
-from native.doom_lib import UboKey
+from native.doom_lib import GameEvent, UboKey
 
 # GS_LEVEL constant — keep in sync with doomstat.h
 GS_LEVEL: int = 0
@@ -50,7 +51,8 @@ class DoomController:
     Input routing and mode state for the Doom service page.
 
     All public methods are thread-safe under CPython's GIL:
-      - update_game_state() is called from the tick thread
+      - update_game_state() and on_game_event() are called from one
+        engine-side thread (tick or doom-events) at a time
       - all other methods are called from the Kivy main thread
       - state reads/writes are single bool assignments (GIL-atomic in CPython)
 
@@ -62,6 +64,7 @@ class DoomController:
         self._tap_fn = tap_fn
         # These bools are written by tick thread, read by main thread.
         # Single-assignment reads/writes are atomic under CPython's GIL.
+        self._level: bool = False     # GS_LEVEL, menu or not
         self._in_level: bool = False
         self._menu_active: bool = False
         # This bool is written and read only on the Kivy main thread.
@@ -103,14 +106,31 @@ class DoomController:
         Returns True if the game *just left* a level (was in-level, now not).
         DoomPage uses this signal to call exit_level() on the main thread.
         """
-        menu_active = menuactive if alive else False
-        in_level = alive and gamestate == GS_LEVEL and not menu_active
-        was_in_level = self._in_level
-        # Write both together — in_level was derived from menu_active,
-        # so they are always mutually consistent.
-        self._menu_active = menu_active
-        self._in_level = in_level
-        return was_in_level and not in_level
+        self._level = alive and gamestate == GS_LEVEL
+        return self._set_menu(menuactive if alive else False)
+
+    def on_game_event(self, event: int) -> bool:
+        """
+        Apply one engine game event (a GameEvent value).
+
+        Returns True if the game *just left* a level, as update_game_state().
+        Events that don't move the routing state (intermission, death, save)
+        return False.
+        """
+        if event == GameEvent.LEVEL_START:
+            self._level = True
+        elif event == GameEvent.LEVEL_EXIT:
+            self._level = False
+        elif event == GameEvent.MENU_OPEN:
+            return self._set_menu(True)
+        elif event == GameEvent.MENU_CLOSE:
+            return self._set_menu(False)
+        elif event == GameEvent.ENGINE_DIED:
+            self._level = False
+            return self._set_menu(False)
+        else:
+            return False
+        return self._set_menu(self._menu_active)
 
     # ------------------------------------------------------------------ #
     # Main-thread input handlers
@@ -203,5 +223,14 @@ class DoomController:
     # Internal
     # ------------------------------------------------------------------ #
 
+    def _set_menu(self, menu_active: bool) -> bool:
+        in_level = self._level and not menu_active
+        was_in_level = self._in_level
+        # Write both together — in_level was derived from menu_active,
+        # so they are always mutually consistent.
+        self._menu_active = menu_active
+        self._in_level = in_level
+        return was_in_level and not in_level
+
     def _tap(self, key: UboKey, hold_ticks: int = 2) -> None:
         self._tap_fn(key, hold_ticks)
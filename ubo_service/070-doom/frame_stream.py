@@ -0,0 +1,183 @@
+"""
+ubo_service/070-doom/frame_stream.py
+
+Viewer end of the remote framebuffer stream (UBO_DOOM_STREAM; the wire
+format is in third_party/DOOM-master/linuxdoom-1.10/framestream.h).
+
+No Kivy, DoomLib, or ubo_app dependencies — fully unit-testable.
+
+FrameStreamDecoder takes the TCP byte stream in whatever pieces recv()
+returns and gives back each frame as palette indices and RGB24.  Run as a
+script it is the support person's side of the link and writes raw RGB24
+frames to stdout:
+
+    # the unit listens (UBO_DOOM_STREAM=tcp::5731)
+    python3 frame_stream.py unit.local:5731 | ffplay -f rawvideo \\
+        -pixel_format rgb24 -video_size 320x200 -i -
+    # the unit connects out (UBO_DOOM_STREAM=tcp:support-host:5731)
+    python3 frame_stream.py --listen 5731 | ffplay ...
+
+The frame size is printed to stderr when the stream starts.
+"""
+
+from __future__ import annotations
+
+import struct
+from dataclasses import dataclass
+from typing import Final, List, Optional
+
+MAGIC: Final[int] = 0x534F4255        # "UBOS"
+VERSION: Final[int] = 1
+PALETTE: Final[int] = ord("P")
+KEY: Final[int] = ord("K")
+DELTA: Final[int] = ord("D")
+
+HELLO: Final[struct.Struct] = struct.Struct("<IHHHH")
+MSG: Final[struct.Struct] = struct.Struct("<B3xIII")
+PALETTE_BYTES: Final[int] = 256 * 3
+
+
+class StreamError(ValueError):
+    """The bytes are not a frame stream, or it lost sync."""
+
+
+def unpack_rle(data: bytes, size: int) -> bytes:
+    """Decode the stream's RLE into exactly size bytes."""
+    out = bytearray()
+    i = 0
+    end = len(data)
+    while i < end:
+        c = data[i]
+        i += 1
+        if c < 0x80:
+            n = c + 1
+            if i + n > end:
+                raise StreamError("literal run past the end of the payload")
+            out += data[i:i + n]
+            i += n
+        else:
+            if i >= end:
+                raise StreamError("repeat run without its byte")
+            out += data[i:i + 1] * (c - 0x7E)
+            i += 1
+        if len(out) > size:
+            raise StreamError(f"payload decodes past {size} bytes")
+    if len(out) != size:
+        raise StreamError(f"payload decodes to {len(out)} bytes, not {size}")
+    return bytes(out)
+
+
+def to_rgb(indices: bytes, palette: bytes) -> bytes:
+    """Palette indices to packed RGB24."""
+    out = bytearray(3 * len(indices))
+    for c in range(3):
+        out[c::3] = indices.translate(palette[c::3])
+    return bytes(out)
+
+
+@dataclass(frozen=True)
+class Frame:
+    seq: int            # a gap since the last one: frames dropped on the unit
+    time_ms: int        # the unit's CLOCK_MONOTONIC, wrapping at 2**32
+    key: bool
+    indices: bytes      # width*height palette indices
+    rgb: bytes          # the same as RGB24
+
+
+class FrameStreamDecoder:
+    """Incremental decoder for one connection."""
+
+    def __init__(self) -> None:
+        self._buf = bytearray()
+        self._started = False
+        self._palette: Optional[bytes] = None
+        self._indices: Optional[bytes] = None
+        self.width = 0
+        self.height = 0
+
+    def feed(self, data: bytes) -> List[Frame]:
+        """Add received bytes; returns the frames they completed."""
+        self._buf += data
+        frames: List[Frame] = []
+        if not self._started:
+            if len(self._buf) < HELLO.size:
+                return frames
+            magic, version, self.width, self.height, _ = HELLO.unpack_from(self._buf)
+            if magic != MAGIC or version != VERSION:
+                raise StreamError("not a version 1 frame stream")
+            del self._buf[:HELLO.size]
+            self._started = True
+
+        while len(self._buf) >= MSG.size:
+            kind, seq, time_ms, size = MSG.unpack_from(self._buf)
+            if len(self._buf) < MSG.size + size:
+                break
+            payload = bytes(self._buf[MSG.size:MSG.size + size])
+            del self._buf[:MSG.size + size]
+            frame = self._message(kind, seq, time_ms, payload)
+            if frame is not None:
+                frames.append(frame)
+        return frames
+
+    def _message(self, kind: int, seq: int, time_ms: int, payload: bytes) -> Optional[Frame]:
+        if kind == PALETTE:
+            if len(payload) != PALETTE_BYTES:
+                raise StreamError(f"palette of {len(payload)} bytes")
+            self._palette = payload
+            return None
+        if kind not in (KEY, DELTA):
+            raise StreamError(f"unknown message type {kind:#x}")
+        pixels = self.width * self.height
+        indices = unpack_rle(payload, pixels)
+        if kind == DELTA:
+            if self._indices is None:
+                raise StreamError("delta frame before a key frame")
+            indices = (int.from_bytes(indices, "little")
+                       ^ int.from_bytes(self._indices, "little")).to_bytes(pixels, "little")
+        if self._palette is None:
+            raise StreamError("frame before its palette")
+        self._indices = indices
+        return Frame(seq, time_ms, kind == KEY, indices, to_rgb(indices, self._palette))
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    import argparse
+    import socket
+    import sys
+
+    parser = argparse.ArgumentParser(description="Write a unit's streamed frames to stdout as RGB24.")
+    parser.add_argument("unit", nargs="?", help="host:port of a unit started with UBO_DOOM_STREAM=tcp::port")
+    parser.add_argument("--listen", type=int, metavar="PORT",
+                        help="wait for a unit started with UBO_DOOM_STREAM=tcp:this-host:PORT")
+    args = parser.parse_args(argv)
+    if (args.unit is None) == (args.listen is None):
+        parser.error("give either host:port or --listen PORT")
+
+    if args.listen is not None:
+        server = socket.create_server(("", args.listen))
+        conn, peer = server.accept()
+        server.close()
+        print(f"unit {peer[0]} connected", file=sys.stderr)
+    else:
+        host, _, port = args.unit.rpartition(":")
+        conn = socket.create_connection((host, int(port)))
+
+    decoder = FrameStreamDecoder()
+    out = sys.stdout.buffer
+    with conn:
+        while True:
+            data = conn.recv(65536)
+            if not data:
+                return 0
+            started = decoder.width
+            frames = decoder.feed(data)
+            if not started and decoder.width:
+                print(f"{decoder.width}x{decoder.height} rgb24", file=sys.stderr)
+            for frame in frames:
+                out.write(frame.rgb)
+            if frames:
+                out.flush()
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -0,0 +1,276 @@
+"""
+ubo_service/070-doom/metrics_export.py
+
+OpenMetrics text exposition of the engine's performance counters
+(UBO_DOOM_METRICS), for the service infrastructure to scrape.
+
+No Kivy, DoomLib, or ubo_app dependencies — fully unit-testable: the
+samples are any objects with the field names of UboStatus, UboProfStat
+and UboAudioStats in native/doom_lib.py.
+
+render_metrics() turns one sample into the exposition:
+  - tic time, and each profiler stage's (render stages included), as a
+    summary: 0.5/0.9/0.99 quantiles from the engine's recent histogram,
+    sum and count since the profile started;
+  - the last tic, the longest one and its phases, and the late tics;
+  - the LCD cadence DoomPage's DisplayCadence picked, what a frame cost
+    to send, and the frames sent;
+  - audio underruns, write errors and ring overruns, the mix time;
+  - zone size, use and high water, cache purges;
+  - level loads with the last and the longest load time;
+  - crashes recovered from and doom_reset() calls.
+
+MetricsExporter publishes it to the UBO_DOOM_METRICS target:
+  - a path: rewritten every interval_s through a temporary file renamed
+    over it, so a reader never sees half of one (a textfile collector);
+  - "unix:PATH": a stream socket; every connection is sent a fresh
+    exposition and closed.
+"""
+
+from __future__ import annotations
+
+import os
+import select
+import socket
+import threading
+from dataclasses import dataclass
+from typing import Callable, Final, Iterable, Optional
+
+PREFIX: Final[str] = "ubodoom_"
+QUANTILES: Final[tuple[float, ...]] = (0.5, 0.9, 0.99)
+UNIX_PREFIX: Final[str] = "unix:"
+DEFAULT_INTERVAL_S: Final[float] = 10.0
+# Longest a served connection may take to read the exposition.
+SEND_TIMEOUT_S: Final[float] = 1.0
+
+
+@dataclass(frozen=True)
+class LcdSample:
+    """What DoomPage's LCD path did: DisplayCadence state and frames sent."""
+    divisor: int
+    cost_s: Optional[float]
+    frames: int
+
+
+def bucket_bounds(index: int, buckets: int, max_us: int) -> tuple[float, float]:
+    """Microsecond range of profiler histogram bucket index (UBO_PROF_BUCKETS).
+
+    Bucket 0 is under 1 us, bucket i [2^(i-1), 2^i), the last everything
+    from there up, which ends at the largest time seen.
+    """
+    if index == 0:
+        return 0.0, 1.0
+    lo = float(1 << (index - 1))
+    hi = float(1 << index) if index < buckets - 1 else max(lo, float(max_us))
+    # The bucket can't reach past the largest time seen.
+    if lo <= max_us < hi:
+        hi = float(max_us)
+    return lo, hi
+
+
+def hist_quantile(hist: Iterable[int], q: float, max_us: int) -> float:
+    """The q quantile in microseconds, interpolated inside its bucket."""
+    counts = list(hist)
+    total = sum(counts)
+    if total == 0:
+        return 0.0
+    rank = q * total
+    seen = 0
+    for i, n in enumerate(counts):
+        if n and seen + n >= rank:
+            lo, hi = bucket_bounds(i, len(counts), max_us)
+            return lo + (hi - lo) * (rank - seen) / n
+        seen += n
+    return float(max_us)
+
+
+def _num(value: float) -> str:
+    if isinstance(value, int):
+        return str(value)
+    return repr(float(value))
+
+
+def _labels(labels: Optional[dict[str, str]]) -> str:
+    if not labels:
+        return ""
+    inner = ",".join(f'{k}="{v}"' for k, v in labels.items())
+    return "{" + inner + "}"
+
+
+class _Exposition:
+    """Metric families in OpenMetrics text, one TYPE/HELP header each."""
+
+    def __init__(self) -> None:
+        self._lines: list[str] = []
+        self._declared: set[str] = set()
+
+    def _family(self, name: str, kind: str, help_text: str, unit: str = "") -> str:
+        full = PREFIX + name
+        if full not in self._declared:
+            self._declared.add(full)
+            self._lines.append(f"# TYPE {full} {kind}")
+            if unit:
+                self._lines.append(f"# UNIT {full} {unit}")
+            self._lines.append(f"# HELP {full} {help_text}")
+        return full
+
+    def gauge(self, name: str, help_text: str, value: float,
+              labels: Optional[dict[str, str]] = None, unit: str = "") -> None:
+        full = self._family(name, "gauge", help_text, unit)
+        self._lines.append(f"{full}{_labels(labels)} {_num(value)}")
+
+    def counter(self, name: str, help_text: str, value: float,
+                labels: Optional[dict[str, str]] = None) -> None:
+        full = self._family(name, "counter", help_text)
+        self._lines.append(f"{full}_total{_labels(labels)} {_num(value)}")
+
+    def summary(self, name: str, help_text: str, quantiles: dict[float, float],
+                total: float, count: int, labels: Optional[dict[str, str]] = None,
+                unit: str = "") -> None:
+        full = self._family(name, "summary", help_text, unit)
+        base = dict(labels or {})
+        for q, v in quantiles.items():
+            self._lines.append(f"{full}{_labels({**base, 'quantile': repr(q)})} {_num(v)}")
+        self._lines.append(f"{full}_sum{_labels(base)} {_num(total)}")
+        self._lines.append(f"{full}_count{_labels(base)} {_num(count)}")
+
+    def text(self) -> str:
+        return "\n".join(self._lines + ["# EOF"]) + "\n"
+
+
+def render_metrics(status, profile=None, audio=None, lcd: Optional[LcdSample] = None) -> str:
+    """The exposition for one sample.
+
+    status: a UboStatus (None before the engine exists); profile: the
+    DoomLib.profile() dict, stages that never ran are left out; audio: a
+    UboAudioStats or None; lcd: None while libubodoom drives the LCD.
+    """
+    out = _Exposition()
+    out.gauge("up", "1 while the engine runs, 0 after a crash or before init",
+              1 if status is not None and status.alive else 0)
+    if status is None:
+        return out.text()
+
+    for name, stat in (profile or {}).items():
+        if not stat.calls:
+            continue
+        out.summary(
+            "stage_seconds",
+            "Profiler stage time (tic = a whole tic); quantiles over recent tics",
+            {q: hist_quantile(stat.hist, q, stat.max_us) / 1e6 for q in QUANTILES},
+            stat.total_us / 1e6, stat.calls, {"stage": name}, unit="seconds",
+        )
+
+    out.gauge("tic_last_seconds", "Wall time of the last tic", status.last_tic_us / 1e6,
+              unit="seconds")
+    out.counter("deadline_tics", "Tics checked against their deadline", status.deadline_tics)
+    out.counter("deadline_misses", "Tics that ended after the next one was due",
+                status.deadline_misses)
+    for phase, us in (("tic", status.worst_tic_us), ("sim", status.worst_sim_us),
+                      ("render", status.worst_render_us), ("sound", status.worst_sound_us)):
+        out.gauge("worst_tic_seconds", "The longest tic since the deadline stats were reset, by phase",
+                  us / 1e6, {"phase": phase}, unit="seconds")
+    out.gauge("quality_level", "Quality governor level, 0 = full", status.quality_level)
+
+    if lcd is not None:
+        out.gauge("lcd_cadence_divisor", "LCD frames sent every Nth loop iteration", lcd.divisor)
+        out.gauge("lcd_frame_cost_seconds", "What sending one LCD frame costs, recent average",
+                  lcd.cost_s or 0.0, unit="seconds")
+        out.counter("lcd_frames", "Frames sent to the LCD", lcd.frames)
+
+    if audio is not None:
+        out.counter("audio_underruns", "ALSA writes that found the device run dry", audio.underruns)
+        out.counter("audio_errors", "Other failed ALSA writes", audio.errors)
+        out.counter("audio_overruns", "Tics whose mix did not fit in the ring", audio.overruns)
+        out.gauge("audio_mix_seconds", "Mixing time per tic, recent average", audio.mix_avg_us / 1e6,
+                  unit="seconds")
+
+    for kind, value in (("size", status.zone_size), ("used", status.zone_used),
+                        ("high_water", status.zone_high_water)):
+        out.gauge("zone_bytes", "Zone memory: all zones, allocated, most ever allocated",
+                  value, {"kind": kind}, unit="bytes")
+    out.counter("zone_purges", "Cache blocks purged to make room", status.zone_purges)
+
+    out.counter("level_loads", "Levels loaded", status.level_loads)
+    out.gauge("level_load_last_seconds", "What the last level load took", status.last_load_us / 1e6,
+              unit="seconds")
+    out.gauge("level_load_max_seconds", "The longest level load", status.max_load_us / 1e6,
+              unit="seconds")
+
+    out.counter("crashes", "Crashes the engine recovered from", status.crash_count)
+    out.counter("resets", "doom_reset() calls", status.reset_count)
+    return out.text()
+
+
+class MetricsExporter:
+    """
+    Publishes collect()'s exposition to a file or a unix socket.
+
+    Args:
+        target: a file path, or "unix:PATH" to serve a socket
+        collect: returns the exposition; called on the exporter's thread
+        interval_s: how often the file is rewritten
+    """
+
+    def __init__(self, target: str, collect: Callable[[], str],
+                 interval_s: float = DEFAULT_INTERVAL_S) -> None:
+        self._collect = collect
+        self._interval_s = interval_s if interval_s > 0 else DEFAULT_INTERVAL_S
+        self._socket_path: Optional[str] = None
+        self._path: Optional[str] = None
+        if target.startswith(UNIX_PREFIX):
+            self._socket_path = target[len(UNIX_PREFIX):]
+        else:
+            self._path = target
+
+    def write(self) -> None:
+        """Rewrite the file target in one rename."""
+        if self._path is None:
+            return
+        tmp = f"{self._path}.tmp"
+        with open(tmp, "w", encoding="utf-8") as f:
+            f.write(self._collect())
+        os.replace(tmp, self._path)
+
+    def _listen(self) -> socket.socket:
+        path = self._socket_path
+        try:
+            os.unlink(path)         # left over from an earlier run
+        except FileNotFoundError:
+            pass
+        server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        server.bind(path)
+        server.listen(4)
+        return server
+
+    def _serve_one(self, server: socket.socket) -> None:
+        try:
+            conn, _addr = server.accept()
+        except OSError:
+            return
+        with conn:
+            conn.settimeout(SEND_TIMEOUT_S)
+            try:
+                conn.sendall(self._collect().encode("utf-8"))
+            except OSError:
+                pass                # the scraper went away; the next one still gets served
+
+    def run(self, stop: threading.Event) -> None:
+        """The exporter thread: publish until stop is set, then once more."""
+        if self._socket_path is None:
+            while not stop.is_set():
+                self.write()
+                stop.wait(self._interval_s)
+            self.write()
+            return
+        server = self._listen()
+        try:
+            while not stop.is_set():
+                if select.select([server], [], [], min(self._interval_s, 0.25))[0]:
+                    self._serve_one(server)
+        finally:
+            server.close()
+            try:
+                os.unlink(self._socket_path)
+            except FileNotFoundError:
+                pass
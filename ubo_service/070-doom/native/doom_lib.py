@@ -1,10 +1,14 @@
 from __future__ import annotations
 
 import ctypes
+import importlib.util
+import json
+import os
+import sysconfig
 from dataclasses import dataclass
 from enum import IntEnum
 from pathlib import Path
-from typing import Final
+from typing import Callable, Final, Iterable
 
 
 class UboKey(IntEnum):
@@ -22,6 +26,7 @@ class UboKey(IntEnum):
       UBO_KEY_FIRE = 5     (maps to KEY_RCTRL / Ctrl — KEY_ENTER avoided: stolen by HU_MSGREFRESH)
       UBO_KEY_USE = 6      (maps to Space)
       UBO_KEY_ESCAPE = 7   (maps to Esc)
+      UBO_KEY_MAP = 9      (maps to Tab: automap, or its overlay)
     """
     UP = 1
     DOWN = 2
@@ -31,6 +36,422 @@ class UboKey(IntEnum):
     USE = 6
     ESCAPE = 7
     MENU_SELECT = 8  # maps to KEY_ENTER — only safe for menus (not in-game: stolen by HU_MSGREFRESH)
+    MAP = 9          # maps to Tab — the automap, or its overlay (UBO_DOOM_AUTOMAP_OVERLAY=1)
+
+
+class OutputFormat(IntEnum):
+    """Mirror of ubo_output_format_t in doom_api.h."""
+    RGBA8888 = 0      # ubo_rgba, 320x200x4
+    RGB565_BE = 1     # ubo_rgb565, 240x240x2 letterboxed, big-endian
+    INDEX8 = 2        # ubo_index8, 320x200x1 palette indices (palette565_into())
+
+
+class ScaleFilter(IntEnum):
+    """Mirror of ubo_scale_filter_t in doom_api.h (320x200 -> 240x150)."""
+    NEAREST = 0   # nearest neighbour
+    AREA2 = 1     # 2-tap average per axis
+    BOX = 2       # exact 4:3 box filter
+
+
+class Rotation(IntEnum):
+    """Mirror of ubo_rotation_t in doom_api.h (clockwise, RGB565 output)."""
+    R0 = 0
+    R90 = 1
+    R180 = 2
+    R270 = 3
+
+
+class UboThread(IntEnum):
+    """Mirror of ubo_thread_t in doom_api.h (doom_set_thread_policy)."""
+    TIC = 0       # the native scheduler, or the thread calling tick()/advance()
+    AUDIO = 1     # the ALSA writer
+    DISPLAY = 2   # the native LCD sink
+    RENDER = 3    # the view strip workers
+
+
+class TimeSource(IntEnum):
+    """Mirror of ubo_time_source_t in doom_api.h (set_time_source)."""
+    MONOTONIC = 0  # CLOCK_MONOTONIC
+    VIRTUAL = 1    # one tic per tic run, plus advance_time()
+
+
+class GameEvent(IntEnum):
+    """Mirror of ubo_game_event_type_t in doom_api.h (poll_game_events)."""
+    LEVEL_START = 1    # data0 episode, data1 map
+    LEVEL_EXIT = 2     # data0 the gamestate it left for
+    INTERMISSION = 3   # data0 episode, data1 map just finished
+    MENU_OPEN = 4
+    MENU_CLOSE = 5
+    PLAYER_DEATH = 6   # data0 the player
+    SAVE_DONE = 7      # data0 1 = written, 0 = failed
+    ENGINE_DIED = 8    # data0 the crash cause
+
+
+class EnvDone(IntEnum):
+    """Mirror of ubo_env_done_t in doom_api.h (env_step_batch)."""
+    RUNNING = 0
+    DIED = 1      # the player died
+    EXITED = 2    # the level was finished
+    LOST = 3      # the worker's engine died or the worker exited
+
+
+# UBO_AUX_* buffers for set_aux_buffers(); labels are mobjtype + 1, 0 for
+# none and AUX_LABEL_WEAPON for the player's weapon.
+AUX_INDEX: Final[int] = 1
+AUX_DEPTH: Final[int] = 2
+AUX_LABELS: Final[int] = 4
+AUX_LABEL_WEAPON: Final[int] = 255
+
+# UBO_TICCMD_* button bits for UboTiccmd.buttons.
+TICCMD_ATTACK: Final[int] = 1
+TICCMD_USE: Final[int] = 2
+
+
+# Size of the native RGB565 LCD frame (240x240x2), see UBO_LCD_* in doom_api.h.
+RGB565_FRAME_BYTES: Final[int] = 240 * 240 * 2
+
+
+class UboEvent(ctypes.Structure):
+    """Mirror of ubo_event_t in doom_api.h."""
+    _fields_ = [
+        ("key", ctypes.c_int),
+        ("down", ctypes.c_int),
+        ("hold_tics", ctypes.c_int),
+    ]
+
+
+class UboTiccmd(ctypes.Structure):
+    """Mirror of ubo_ticcmd_t in doom_api.h (set_ticcmd, env_step_batch)."""
+    _fields_ = [
+        ("forwardmove", ctypes.c_int8),   # -50..50
+        ("sidemove", ctypes.c_int8),
+        ("angleturn", ctypes.c_int16),    # 1/65536 turns, positive = left
+        ("buttons", ctypes.c_uint8),      # TICCMD_*
+        ("weapon", ctypes.c_uint8),       # 1..8, 0 = keep
+    ]
+
+
+class UboAuxFrame(ctypes.Structure):
+    """Mirror of ubo_aux_frame_t in doom_api.h (aux_frame)."""
+    _fields_ = [
+        ("seq", ctypes.c_uint32),
+        ("mask", ctypes.c_int),
+        ("index", ctypes.c_void_p),
+        ("index_width", ctypes.c_int),
+        ("index_height", ctypes.c_int),
+        ("view_x", ctypes.c_int),
+        ("view_y", ctypes.c_int),
+        ("view_width", ctypes.c_int),
+        ("view_height", ctypes.c_int),
+        ("view_detail", ctypes.c_int),
+        ("depth", ctypes.c_void_p),
+        ("labels", ctypes.c_void_p),
+        ("label_stride", ctypes.c_int),
+    ]
+
+
+class UboEnvConfig(ctypes.Structure):
+    """Mirror of ubo_env_config_t in doom_api.h; 0 fields take the defaults."""
+    _fields_ = [
+        ("obs_width", ctypes.c_int),
+        ("obs_height", ctypes.c_int),
+        ("channels", ctypes.c_int),
+        ("frame_skip", ctypes.c_int),
+        ("skill", ctypes.c_int),
+        ("episode", ctypes.c_int),
+        ("map", ctypes.c_int),
+    ]
+
+
+class UboEnvResult(ctypes.Structure):
+    """Mirror of ubo_env_result_t in doom_api.h."""
+    _fields_ = [
+        ("done", ctypes.c_int),           # EnvDone
+        ("health", ctypes.c_int),
+        ("armor", ctypes.c_int),
+        ("weapon", ctypes.c_int),
+        ("ammo", ctypes.c_int),
+        ("kills", ctypes.c_int),
+        ("items", ctypes.c_int),
+        ("secrets", ctypes.c_int),
+        ("x", ctypes.c_int),
+        ("y", ctypes.c_int),
+        ("angle", ctypes.c_int),
+        ("tics", ctypes.c_int),
+    ]
+
+
+class UboStatus(ctypes.Structure):
+    """Mirror of ubo_status_t in doom_api.h (refreshed after every tic)."""
+    _fields_ = [
+        ("version", ctypes.c_uint32),
+        ("alive", ctypes.c_int),
+        ("gamestate", ctypes.c_int),
+        ("menuactive", ctypes.c_int),
+        ("paused", ctypes.c_int),
+        ("automapactive", ctypes.c_int),
+        ("gametic", ctypes.c_uint32),
+        ("frame_seq", ctypes.c_uint32),
+        ("health", ctypes.c_int),
+        ("armor", ctypes.c_int),
+        ("ready_weapon", ctypes.c_int),
+        ("ready_ammo", ctypes.c_int),
+        ("last_tic_us", ctypes.c_uint32),
+        ("audio_underruns", ctypes.c_uint32),
+        ("audio_mix_us", ctypes.c_uint32),
+        ("input_lag_us", ctypes.c_uint32),
+        ("crash_cause", ctypes.c_int),
+        ("crash_gametic", ctypes.c_uint32),
+        ("crash_gamestate", ctypes.c_int),
+        ("crash_episode", ctypes.c_int),
+        ("crash_map", ctypes.c_int),
+        ("deadline_tics", ctypes.c_uint32),
+        ("deadline_misses", ctypes.c_uint32),
+        ("worst_tic_us", ctypes.c_uint32),
+        ("worst_sim_us", ctypes.c_uint32),
+        ("worst_render_us", ctypes.c_uint32),
+        ("worst_sound_us", ctypes.c_uint32),
+        ("worst_gametic", ctypes.c_uint32),
+        ("worst_gamestate", ctypes.c_int),
+        ("worst_episode", ctypes.c_int),
+        ("worst_map", ctypes.c_int),
+        ("episode", ctypes.c_int),
+        ("map", ctypes.c_int),
+        ("quality_level", ctypes.c_int),
+        ("frame_load_pct", ctypes.c_int),
+        ("cpu_temp_mc", ctypes.c_int),
+        ("idle", ctypes.c_int),
+        ("catchup_backlog_tics", ctypes.c_uint32),
+        ("catchup_dropped_tics", ctypes.c_uint32),
+        ("load_pct", ctypes.c_int),
+        ("zone_size", ctypes.c_int),
+        ("zone_used", ctypes.c_int),
+        ("zone_high_water", ctypes.c_int),
+        ("zone_purges", ctypes.c_uint32),
+        ("level_loads", ctypes.c_uint32),
+        ("last_load_us", ctypes.c_uint32),
+        ("max_load_us", ctypes.c_uint32),
+        ("crash_count", ctypes.c_uint32),
+        ("reset_count", ctypes.c_uint32),
+    ]
+
+
+class UboRect(ctypes.Structure):
+    """Mirror of ubo_rect_t in doom_api.h (inclusive coordinates)."""
+    _fields_ = [
+        ("x0", ctypes.c_int),
+        ("y0", ctypes.c_int),
+        ("x1", ctypes.c_int),
+        ("y1", ctypes.c_int),
+    ]
+
+
+class UboFrame(ctypes.Structure):
+    """Mirror of ubo_frame_t in doom_api.h."""
+    _fields_ = [
+        ("data", ctypes.c_void_p),
+        ("size", ctypes.c_int),
+        ("width", ctypes.c_int),
+        ("height", ctypes.c_int),
+        ("seq", ctypes.c_uint32),
+    ]
+
+
+class UboFrameInfo(ctypes.Structure):
+    """Mirror of ubo_frame_info_t in doom_api.h; valid only during the callback."""
+    _fields_ = [
+        ("format", ctypes.c_int),
+        ("data", ctypes.c_void_p),
+        ("width", ctypes.c_int),
+        ("height", ctypes.c_int),
+        ("stride", ctypes.c_int),
+        ("seq", ctypes.c_uint32),
+        ("num_rects", ctypes.c_int),
+        ("rects", ctypes.POINTER(UboRect)),
+    ]
+
+
+# void (*ubo_frame_callback_t)(const ubo_frame_info_t* frame, void* user);
+FrameCallback = ctypes.CFUNCTYPE(None, ctypes.POINTER(UboFrameInfo), ctypes.c_void_p)
+
+
+class UboStateEvent(ctypes.Structure):
+    """Mirror of ubo_state_event_t in doom_api.h."""
+    _fields_ = [
+        ("alive", ctypes.c_int),
+        ("gamestate", ctypes.c_int),
+        ("menuactive", ctypes.c_int),
+        ("gametic", ctypes.c_uint32),
+    ]
+
+
+class UboGameEvent(ctypes.Structure):
+    """Mirror of ubo_game_event_t in doom_api.h."""
+    _fields_ = [
+        ("type", ctypes.c_int),
+        ("data0", ctypes.c_int),
+        ("data1", ctypes.c_int),
+        ("gametic", ctypes.c_uint32),
+    ]
+
+
+# Mirrors ubo_prof_stage_t / UBO_PROF_BUCKETS in doom_api.h.
+PROFILE_STAGES: Final[tuple[str, ...]] = (
+    "tic", "ticker", "bsp", "planes", "masked", "sprite_sort",
+    "statusbar", "finish_update", "update_sound", "submit_sound",
+)
+PROFILE_BUCKETS: Final[int] = 16
+
+
+class UboProfStat(ctypes.Structure):
+    """Mirror of ubo_prof_stat_t in doom_api.h (times in microseconds)."""
+    _fields_ = [
+        ("calls", ctypes.c_uint32),
+        ("last_us", ctypes.c_uint32),
+        ("avg_us", ctypes.c_uint32),
+        ("max_us", ctypes.c_uint32),
+        ("total_us", ctypes.c_uint64),
+        ("hist", ctypes.c_uint32 * PROFILE_BUCKETS),
+    ]
+
+
+class UboProfile(ctypes.Structure):
+    """Mirror of ubo_profile_t in doom_api.h."""
+    _fields_ = [
+        ("version", ctypes.c_uint32),
+        ("enabled", ctypes.c_int),
+        ("tics", ctypes.c_uint32),
+        ("stage", UboProfStat * len(PROFILE_STAGES)),
+    ]
+
+
+class UboZoneStats(ctypes.Structure):
+    """Mirror of ubo_zone_stats_t in doom_api.h (bytes / counts)."""
+    _fields_ = [
+        ("size", ctypes.c_int),
+        ("free", ctypes.c_int),
+        ("free_blocks", ctypes.c_int),
+        ("largest_free", ctypes.c_int),
+        ("purgable", ctypes.c_int),
+        ("slabs", ctypes.c_int),
+        ("slab_used", ctypes.c_int),
+        ("slab_free", ctypes.c_int),
+        ("arena_size", ctypes.c_int),
+        ("arena_used", ctypes.c_int),
+    ]
+
+
+class UboMemStats(ctypes.Structure):
+    """Mirror of ubo_memstats_t in doom_api.h (bytes / counts)."""
+    _fields_ = [
+        ("zone_bytes", ctypes.c_int),
+        ("max_bytes", ctypes.c_int),
+        ("zones", ctypes.c_int),
+        ("used", ctypes.c_int),
+        ("high_water", ctypes.c_int),
+        ("purges", ctypes.c_int),
+        ("largest_free", ctypes.c_int),
+        ("free", ctypes.c_int),
+        ("budget", ctypes.c_int),
+        ("footprint", ctypes.c_int),
+        ("zone_resident", ctypes.c_int),
+        ("wad_resident", ctypes.c_int),
+        ("composite_bytes", ctypes.c_int),
+        ("arena_bytes", ctypes.c_int),
+        ("process_rss", ctypes.c_int),
+        ("trims", ctypes.c_int),
+    ]
+
+
+class UboPoolStats(ctypes.Structure):
+    """Mirror of ubo_pool_stats_t in doom_api.h (peak counts this level)."""
+    _fields_ = [
+        ("visplanes", ctypes.c_int),
+        ("drawsegs", ctypes.c_int),
+        ("vissprites", ctypes.c_int),
+        ("intercepts", ctypes.c_int),
+        ("spechits", ctypes.c_int),
+    ]
+
+
+class UboCompositeStats(ctypes.Structure):
+    """Mirror of ubo_composite_stats_t in doom_api.h (counts since init)."""
+    _fields_ = [
+        ("textures", ctypes.c_int),
+        ("bytes", ctypes.c_int),
+        ("limit", ctypes.c_int),
+        ("hits", ctypes.c_uint32),
+        ("misses", ctypes.c_uint32),
+        ("prebuilt", ctypes.c_uint32),
+        ("evictions", ctypes.c_uint32),
+    ]
+
+
+class UboSpectateStats(ctypes.Structure):
+    """Mirror of ubo_spectate_stats_t in doom_api.h (counts this session unless noted)."""
+    _fields_ = [
+        ("role", ctypes.c_int),
+        ("following", ctypes.c_int),
+        ("session", ctypes.c_uint32),
+        ("tics", ctypes.c_uint32),
+        ("behind", ctypes.c_uint32),
+        ("packets", ctypes.c_uint32),
+        ("bytes", ctypes.c_uint32),
+        ("resends", ctypes.c_uint32),
+        ("hash_checks", ctypes.c_uint32),
+        ("desyncs", ctypes.c_uint32),
+        ("desync_tic", ctypes.c_uint32),
+    ]
+
+
+class UboAudioStats(ctypes.Structure):
+    """Mirror of ubo_audio_stats_t in doom_api.h (frames at `rate`, counts since init/reset)."""
+    _fields_ = [
+        ("active", ctypes.c_int),
+        ("threaded", ctypes.c_int),
+        ("rate", ctypes.c_int),
+        ("period_frames", ctypes.c_int),
+        ("buffer_frames", ctypes.c_int),
+        ("underruns", ctypes.c_uint32),
+        ("errors", ctypes.c_uint32),
+        ("overruns", ctypes.c_uint32),
+        ("writes", ctypes.c_uint32),
+        ("frames_written", ctypes.c_uint64),
+        ("delay_frames", ctypes.c_int),
+        ("delay_max", ctypes.c_int),
+        ("ring_frames", ctypes.c_int),
+        ("ring_max", ctypes.c_int),
+        ("lead_frames", ctypes.c_int),
+        ("mix_us", ctypes.c_uint32),
+        ("mix_avg_us", ctypes.c_uint32),
+        ("mix_max_us", ctypes.c_uint32),
+    ]
+
+
+# Upper bound on state events drained per doom_poll_state_events() call.
+MAX_STATE_EVENTS: Final[int] = 16
+
+# Upper bound on game events drained per doom_poll_game_events() call.
+MAX_GAME_EVENTS: Final[int] = 16
+
+# Upper bound on rects requested per doom_get_dirty_rects() call.
+MAX_DIRTY_RECTS: Final[int] = 8
+
+
+@dataclass(frozen=True)
+class AuxBuffers:
+    """The last frame's auxiliary buffers, read in place: valid until the
+    next rendered tic.  A buffer that is off, or depth/labels while no 3D
+    view was drawn (view_width 0), is None."""
+    seq: int
+    index: memoryview | None    # index_height rows of index_width bytes
+    index_width: int
+    index_height: int
+    view: tuple[int, int, int, int]   # x, y, width, height in view pixels
+    view_detail: int
+    depth: memoryview | None    # view_width uint16, map units, 0 = no wall
+    labels: memoryview | None   # view_height rows of label_stride bytes
+    label_stride: int
 
 
 @dataclass(frozen=True)
@@ -40,6 +461,40 @@ class DoomFramebufferInfo:
     bytes_per_pixel: int = 4  # RGBA8888
 
 
+# DoomLib methods _ubodoom replaces, with the same signatures and results.
+EXTENSION_METHODS: Final[tuple[str, ...]] = (
+    "tick", "tick_ex", "advance", "key_down", "key_up", "tap", "post_events",
+    "release_all_keys", "frame_into", "dirty_rects",
+)
+
+
+def _load_extension(lib_path: Path, status_address: int):
+    """The _ubodoom module next to lib_path, or None to stay with ctypes.
+
+    UBO_DOOM_PYEXT=0 skips it.  It is only used if it resolved to the same
+    libubodoom.so as ctypes did (one engine, one status struct).
+    """
+    if os.environ.get("UBO_DOOM_PYEXT", "1") == "0":
+        return None
+    path = lib_path.with_name("_ubodoom" + (sysconfig.get_config_var("EXT_SUFFIX") or ".so"))
+    if not path.exists():
+        return None
+    spec = importlib.util.spec_from_file_location("_ubodoom", path)
+    if spec is None or spec.loader is None:
+        return None
+    try:
+        module = importlib.util.module_from_spec(spec)
+        spec.loader.exec_module(module)
+    except ImportError as e:
+        print(f"[doom] {path.name} not loaded, using ctypes: {e}", flush=True)
+        return None
+    if module.status_address != status_address:
+        print(f"[doom] {path.name} is linked to another libubodoom.so, using ctypes",
+              flush=True)
+        return None
+    return module
+
+
 class DoomLib:
     """
     ctypes wrapper for libubodoom.so built from the pre-modified
@@ -47,15 +502,126 @@ class DoomLib:
 
         Exported C API:
       int  doom_init(const char* iwad_path);
+      int  doom_prewarm(const char* iwad_path);
+      int  doom_is_prewarmed(void);
+      int  doom_init_begin(const char* iwad_path);
+      int  doom_init_step(int budget_ms);
+      const char* doom_init_phase_name(int phase);
+      int  doom_init_phase_us(int phase);
+      int  doom_suspend(void);
+      int  doom_resume(void);
+      int  doom_is_suspended(void);
       void doom_tick(void);
+      void doom_tick_ex(int run_sim, int render);
+      void doom_set_render_divisor(int divisor);
+      void doom_set_quality_level(int level);
+      int  doom_get_quality_level(void);
+      int  doom_set_thread_policy(int thread, uint64_t cpus, int priority);
+      int  doom_advance(uint32_t elapsed_us, int render);
+      int  doom_set_catchup(int max_tics, int backlog_tics);
+      int  doom_set_load_budget(int budget_ms);
+      void doom_set_interpolation(int enabled);
+      int  doom_set_time_source(ubo_time_source_t source);
+      int  doom_advance_time(uint32_t us);
+      uint64_t doom_get_time_us(void);
       void doom_shutdown(void);
 
       void doom_key_down(ubo_key_t key);
       void doom_key_up(ubo_key_t key);
+      int  doom_post_events(const ubo_event_t* evs, int n);
+      void doom_release_all_keys(void);
+      void doom_set_ticcmd(const ubo_ticcmd_t* cmd);
+      void doom_set_log_level(int level);
+      int  doom_read_log(char* buf, int size);
 
       const uint8_t* doom_get_rgba_ptr(void);
       int  doom_get_rgba_width(void);   // expected 320
       int  doom_get_rgba_height(void);  // expected 200
+
+      void doom_set_output_format(ubo_output_format_t fmt);
+      const uint8_t* doom_get_rgb565_ptr(void);
+      int  doom_get_rgb565_size(void);  // expected 240*240*2
+      int  doom_copy_rgb565(uint8_t* dst, int dst_size);
+      int  doom_copy_frame_into(void* dst, int dst_size, ubo_output_format_t fmt);
+      uint32_t doom_get_palette_version(void);
+      int  doom_copy_palette565(void* dst, int dst_size);
+      void doom_set_scale_filter(ubo_scale_filter_t filter);
+      void doom_set_lcd_orientation(ubo_rotation_t rotation, int mirror);
+      ubo_rotation_t doom_get_lcd_rotation(void);
+      int  doom_get_lcd_mirror(void);
+      void doom_set_direct565(int enabled);
+      int  doom_get_direct565(void);
+      int  doom_get_dirty_rects(ubo_rect_t* out, int max);
+      void doom_invalidate_dirty(void);
+      void doom_set_frame_callback(ubo_frame_callback_t fn, void* user);
+      int  doom_acquire_frame(ubo_frame_t* out);
+      void doom_release_frame(void);
+      uint32_t doom_get_frame_seq(void);
+      int  doom_lcd_open(const char* device);
+      void doom_lcd_close(void);
+      int  doom_lcd_active(void);
+      int  doom_capture_start(const char* output);
+      void doom_capture_stop(void);
+      int  doom_capture_active(void);
+      int  doom_stream_start(const char* output);
+      void doom_stream_stop(void);
+      int  doom_stream_active(void);
+      int  doom_mirror_start(const char* target);
+      int  doom_spectate_start(const char* source);
+      void doom_spectate_stop(void);
+      int  doom_get_spectate_stats(ubo_spectate_stats_t* out);
+      int  doom_hdmi_open(const char* device);
+      void doom_hdmi_close(void);
+      int  doom_hdmi_active(void);
+      int  doom_run_async(int hz);
+      void doom_stop_async(void);
+      int  doom_poll_state_events(ubo_state_event_t* out, int max);
+      int  doom_game_event_fd(void);
+      int  doom_poll_game_events(ubo_game_event_t* out, int max);
+      void doom_get_status(ubo_status_t* out);
+      const ubo_status_t* doom_get_status_ptr(void);
+      void doom_reset_deadline_stats(void);
+      void doom_get_profile(ubo_profile_t* out);
+      void doom_set_profile_enabled(int enabled);
+      void doom_reset_profile(void);
+      void doom_set_trace_enabled(int events);
+      int  doom_trace_dump(const char* path);
+      int  doom_get_zone_stats(ubo_zone_stats_t* out);
+      void doom_set_zone_limits(int base_mb, int max_mb);
+      void doom_set_memory_budget(int mb);
+      int  doom_add_pwad(const char* path);
+      void doom_set_zone_profile(int every);
+      int  doom_zone_report(char* buf, int size);
+      int  doom_zone_dump(const char* path);
+      int  doom_set_config(const char* key, const char* value);
+      int  doom_get_config(const char* key, char* buf, int size);
+      int  doom_get_memstats(ubo_memstats_t* out);
+      int  doom_get_pool_stats(ubo_pool_stats_t* out);
+      int  doom_get_composite_stats(ubo_composite_stats_t* out);
+      int  doom_get_audio_stats(ubo_audio_stats_t* out);
+      void doom_reset_audio_stats(void);
+      int  doom_simulate(int tics, uint32_t* hashes);
+      uint32_t doom_state_hash(void);
+      uint32_t doom_get_frame_hash(void);
+      void doom_set_aux_buffers(int mask, int index_width, int index_height);
+      int  doom_get_aux_frame(ubo_aux_frame_t* out);
+      int  doom_env_open(const char* iwad_path, const ubo_env_config_t* cfg, int count);
+      int  doom_env_obs_size(void);
+      const uint8_t* doom_env_obs(int index);
+      int  doom_env_step_batch(const ubo_ticcmd_t* actions, int n, uint8_t* obs,
+                               ubo_env_result_t* results);
+      int  doom_env_reset(int index);
+      void doom_env_close(void);
+      int  doom_get_save_status(uint32_t* seq);
+      int  doom_screenshot(const char* path, int lcd);
+      int  doom_get_screenshot_status(uint32_t* seq);
+      int  doom_rewind(int seconds);
+      int  doom_snapshot_save(void);
+      int  doom_snapshot_load(void);
+      int  doom_demo_record(const char* path);
+      int  doom_demo_play(const char* path);
+      int  doom_demo_stop(void);
+      int  doom_get_demo_state(void);
     """
 
     def __init__(self, lib_path: Path) -> None:
@@ -63,15 +629,94 @@ class DoomLib:
             raise FileNotFoundError(f"libubodoom.so not found: {lib_path}")
 
         self._lib = ctypes.CDLL(str(lib_path))
+        # Buffer last passed to frame_into() and its ctypes view.
+        self._into_buf: bytearray | memoryview | None = None
+        self._into_c: ctypes.Array | None = None
+        self._palette_buf: bytearray | memoryview | None = None
+        self._palette_c: ctypes.Array | None = None
 
         # int doom_init(const char* iwad_path);
         self._lib.doom_init.argtypes = [ctypes.c_char_p]
         self._lib.doom_init.restype = ctypes.c_int
 
+        # int doom_prewarm(const char* iwad_path);
+        self._lib.doom_prewarm.argtypes = [ctypes.c_char_p]
+        self._lib.doom_prewarm.restype = ctypes.c_int
+
+        # int doom_is_prewarmed(void);
+        self._lib.doom_is_prewarmed.argtypes = []
+        self._lib.doom_is_prewarmed.restype = ctypes.c_int
+
+        # int doom_init_begin(const char* iwad_path); int doom_init_step(int budget_ms);
+        self._lib.doom_init_begin.argtypes = [ctypes.c_char_p]
+        self._lib.doom_init_begin.restype = ctypes.c_int
+        self._lib.doom_init_step.argtypes = [ctypes.c_int]
+        self._lib.doom_init_step.restype = ctypes.c_int
+
+        # const char* doom_init_phase_name(int phase); int doom_init_phase_us(int phase);
+        self._lib.doom_init_phase_name.argtypes = [ctypes.c_int]
+        self._lib.doom_init_phase_name.restype = ctypes.c_char_p
+        self._lib.doom_init_phase_us.argtypes = [ctypes.c_int]
+        self._lib.doom_init_phase_us.restype = ctypes.c_int
+
+        # int doom_suspend(void); int doom_resume(void); int doom_is_suspended(void);
+        self._lib.doom_suspend.argtypes = []
+        self._lib.doom_suspend.restype = ctypes.c_int
+        self._lib.doom_resume.argtypes = []
+        self._lib.doom_resume.restype = ctypes.c_int
+        self._lib.doom_is_suspended.argtypes = []
+        self._lib.doom_is_suspended.restype = ctypes.c_int
+
         # void doom_tick(void);
         self._lib.doom_tick.argtypes = []
         self._lib.doom_tick.restype = None
 
+        # void doom_tick_ex(int run_sim, int render);
+        self._lib.doom_tick_ex.argtypes = [ctypes.c_int, ctypes.c_int]
+        self._lib.doom_tick_ex.restype = None
+
+        # void doom_set_render_divisor(int divisor);
+        self._lib.doom_set_render_divisor.argtypes = [ctypes.c_int]
+        self._lib.doom_set_render_divisor.restype = None
+
+        # void doom_set_quality_level(int level);
+        self._lib.doom_set_quality_level.argtypes = [ctypes.c_int]
+        self._lib.doom_set_quality_level.restype = None
+
+        # int doom_get_quality_level(void);
+        self._lib.doom_get_quality_level.argtypes = []
+        self._lib.doom_get_quality_level.restype = ctypes.c_int
+
+        # int doom_set_thread_policy(int thread, uint64_t cpus, int priority);
+        self._lib.doom_set_thread_policy.argtypes = [ctypes.c_int, ctypes.c_uint64, ctypes.c_int]
+        self._lib.doom_set_thread_policy.restype = ctypes.c_int
+
+        # int doom_advance(uint32_t elapsed_us, int render);
+        self._lib.doom_advance.argtypes = [ctypes.c_uint32, ctypes.c_int]
+        self._lib.doom_advance.restype = ctypes.c_int
+
+        # int doom_set_catchup(int max_tics, int backlog_tics);
+        self._lib.doom_set_catchup.argtypes = [ctypes.c_int, ctypes.c_int]
+        self._lib.doom_set_catchup.restype = ctypes.c_int
+
+        # int doom_set_load_budget(int budget_ms);
+        self._lib.doom_set_load_budget.argtypes = [ctypes.c_int]
+        self._lib.doom_set_load_budget.restype = ctypes.c_int
+
+        # void doom_set_interpolation(int enabled);
+        self._lib.doom_set_interpolation.argtypes = [ctypes.c_int]
+        self._lib.doom_set_interpolation.restype = None
+
+        # int doom_set_time_source(ubo_time_source_t source);
+        self._lib.doom_set_time_source.argtypes = [ctypes.c_int]
+        self._lib.doom_set_time_source.restype = ctypes.c_int
+        # int doom_advance_time(uint32_t us);
+        self._lib.doom_advance_time.argtypes = [ctypes.c_uint32]
+        self._lib.doom_advance_time.restype = ctypes.c_int
+        # uint64_t doom_get_time_us(void);
+        self._lib.doom_get_time_us.argtypes = []
+        self._lib.doom_get_time_us.restype = ctypes.c_uint64
+
         # void doom_shutdown(void);
         self._lib.doom_shutdown.argtypes = []
         self._lib.doom_shutdown.restype = None
@@ -84,6 +729,185 @@ class DoomLib:
         self._lib.doom_key_up.argtypes = [ctypes.c_int]
         self._lib.doom_key_up.restype = None
 
+        # int doom_post_events(const ubo_event_t* evs, int n);
+        self._lib.doom_post_events.argtypes = [ctypes.POINTER(UboEvent), ctypes.c_int]
+        self._lib.doom_post_events.restype = ctypes.c_int
+
+        # void doom_release_all_keys(void);
+        self._lib.doom_release_all_keys.argtypes = []
+        self._lib.doom_release_all_keys.restype = None
+
+        # void doom_set_ticcmd(const ubo_ticcmd_t* cmd);
+        self._lib.doom_set_ticcmd.argtypes = [ctypes.POINTER(UboTiccmd)]
+        self._lib.doom_set_ticcmd.restype = None
+
+        # void doom_set_log_level(int level);
+        self._lib.doom_set_log_level.argtypes = [ctypes.c_int]
+        self._lib.doom_set_log_level.restype = None
+        # int doom_read_log(char* buf, int size);
+        self._lib.doom_read_log.argtypes = [ctypes.c_char_p, ctypes.c_int]
+        self._lib.doom_read_log.restype = ctypes.c_int
+        self._log_buf = ctypes.create_string_buffer(16384)
+
+        # void doom_get_status(ubo_status_t* out);
+        self._lib.doom_get_status.argtypes = [ctypes.POINTER(UboStatus)]
+        self._lib.doom_get_status.restype = None
+
+        # const ubo_status_t* doom_get_status_ptr(void);
+        self._lib.doom_get_status_ptr.argtypes = []
+        self._lib.doom_get_status_ptr.restype = ctypes.c_void_p
+
+        # void doom_reset_deadline_stats(void);
+        self._lib.doom_reset_deadline_stats.argtypes = []
+        self._lib.doom_reset_deadline_stats.restype = None
+
+        # void doom_get_profile(ubo_profile_t* out);
+        self._lib.doom_get_profile.argtypes = [ctypes.POINTER(UboProfile)]
+        self._lib.doom_get_profile.restype = None
+
+        # void doom_set_profile_enabled(int enabled);
+        self._lib.doom_set_profile_enabled.argtypes = [ctypes.c_int]
+        self._lib.doom_set_profile_enabled.restype = None
+
+        # void doom_reset_profile(void);
+        self._lib.doom_reset_profile.argtypes = []
+        self._lib.doom_reset_profile.restype = None
+
+        # void doom_set_trace_enabled(int events);
+        self._lib.doom_set_trace_enabled.argtypes = [ctypes.c_int]
+        self._lib.doom_set_trace_enabled.restype = None
+
+        # int doom_trace_dump(const char* path);
+        self._lib.doom_trace_dump.argtypes = [ctypes.c_char_p]
+        self._lib.doom_trace_dump.restype = ctypes.c_int
+
+        # int doom_get_zone_stats(ubo_zone_stats_t* out);
+        self._lib.doom_get_zone_stats.argtypes = [ctypes.POINTER(UboZoneStats)]
+        self._lib.doom_get_zone_stats.restype = ctypes.c_int
+
+        # void doom_set_zone_limits(int base_mb, int max_mb);
+        self._lib.doom_set_zone_limits.argtypes = [ctypes.c_int, ctypes.c_int]
+        self._lib.doom_set_zone_limits.restype = None
+
+        # void doom_set_memory_budget(int mb);
+        self._lib.doom_set_memory_budget.argtypes = [ctypes.c_int]
+        self._lib.doom_set_memory_budget.restype = None
+
+        # int doom_add_pwad(const char* path);
+        self._lib.doom_add_pwad.argtypes = [ctypes.c_char_p]
+        self._lib.doom_add_pwad.restype = ctypes.c_int
+
+        # void doom_set_zone_profile(int every);
+        self._lib.doom_set_zone_profile.argtypes = [ctypes.c_int]
+        self._lib.doom_set_zone_profile.restype = None
+
+        # int doom_zone_report(char* buf, int size);
+        self._lib.doom_zone_report.argtypes = [ctypes.c_char_p, ctypes.c_int]
+        self._lib.doom_zone_report.restype = ctypes.c_int
+
+        # int doom_zone_dump(const char* path);
+        self._lib.doom_zone_dump.argtypes = [ctypes.c_char_p]
+        self._lib.doom_zone_dump.restype = ctypes.c_int
+
+        # int doom_set_config(const char* key, const char* value);
+        # int doom_get_config(const char* key, char* buf, int size);
+        self._lib.doom_set_config.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+        self._lib.doom_set_config.restype = ctypes.c_int
+        self._lib.doom_get_config.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int]
+        self._lib.doom_get_config.restype = ctypes.c_int
+
+        # int doom_get_memstats(ubo_memstats_t* out);
+        self._lib.doom_get_memstats.argtypes = [ctypes.POINTER(UboMemStats)]
+        self._lib.doom_get_memstats.restype = ctypes.c_int
+
+        # int doom_get_pool_stats(ubo_pool_stats_t* out);
+        self._lib.doom_get_pool_stats.argtypes = [ctypes.POINTER(UboPoolStats)]
+        self._lib.doom_get_pool_stats.restype = ctypes.c_int
+
+        # int doom_get_composite_stats(ubo_composite_stats_t* out);
+        self._lib.doom_get_composite_stats.argtypes = [ctypes.POINTER(UboCompositeStats)]
+        self._lib.doom_get_composite_stats.restype = ctypes.c_int
+
+        # int doom_get_audio_stats(ubo_audio_stats_t* out);
+        self._lib.doom_get_audio_stats.argtypes = [ctypes.POINTER(UboAudioStats)]
+        self._lib.doom_get_audio_stats.restype = ctypes.c_int
+
+        # void doom_reset_audio_stats(void);
+        self._lib.doom_reset_audio_stats.argtypes = []
+        self._lib.doom_reset_audio_stats.restype = None
+
+        # int doom_simulate(int tics, uint32_t* hashes);  uint32_t doom_state_hash(void);
+        self._lib.doom_simulate.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_uint32)]
+        self._lib.doom_simulate.restype = ctypes.c_int
+        self._lib.doom_state_hash.argtypes = []
+        self._lib.doom_state_hash.restype = ctypes.c_uint32
+        # uint32_t doom_get_frame_hash(void);
+        self._lib.doom_get_frame_hash.argtypes = []
+        self._lib.doom_get_frame_hash.restype = ctypes.c_uint32
+
+        # void doom_set_aux_buffers(int mask, int index_width, int index_height);
+        self._lib.doom_set_aux_buffers.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_int]
+        self._lib.doom_set_aux_buffers.restype = None
+        # int doom_get_aux_frame(ubo_aux_frame_t* out);
+        self._lib.doom_get_aux_frame.argtypes = [ctypes.POINTER(UboAuxFrame)]
+        self._lib.doom_get_aux_frame.restype = ctypes.c_int
+        self._aux = UboAuxFrame()
+
+        # int doom_env_open(const char* iwad_path, const ubo_env_config_t* cfg, int count);
+        self._lib.doom_env_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(UboEnvConfig), ctypes.c_int]
+        self._lib.doom_env_open.restype = ctypes.c_int
+        # int doom_env_obs_size(void);  const uint8_t* doom_env_obs(int index);
+        self._lib.doom_env_obs_size.argtypes = []
+        self._lib.doom_env_obs_size.restype = ctypes.c_int
+        self._lib.doom_env_obs.argtypes = [ctypes.c_int]
+        self._lib.doom_env_obs.restype = ctypes.c_void_p
+        # int doom_env_step_batch(const ubo_ticcmd_t* actions, int n, uint8_t* obs,
+        #                         ubo_env_result_t* results);
+        self._lib.doom_env_step_batch.argtypes = [
+            ctypes.POINTER(UboTiccmd), ctypes.c_int, ctypes.c_void_p, ctypes.POINTER(UboEnvResult),
+        ]
+        self._lib.doom_env_step_batch.restype = ctypes.c_int
+        # int doom_env_reset(int index);  void doom_env_close(void);
+        self._lib.doom_env_reset.argtypes = [ctypes.c_int]
+        self._lib.doom_env_reset.restype = ctypes.c_int
+        self._lib.doom_env_close.argtypes = []
+        self._lib.doom_env_close.restype = None
+
+        # int doom_get_save_status(uint32_t* seq);
+        self._lib.doom_get_save_status.argtypes = [ctypes.POINTER(ctypes.c_uint32)]
+        self._lib.doom_get_save_status.restype = ctypes.c_int
+
+        # int doom_screenshot(const char* path, int lcd);  int doom_get_screenshot_status(uint32_t* seq);
+        self._lib.doom_screenshot.argtypes = [ctypes.c_char_p, ctypes.c_int]
+        self._lib.doom_screenshot.restype = ctypes.c_int
+        self._lib.doom_get_screenshot_status.argtypes = [ctypes.POINTER(ctypes.c_uint32)]
+        self._lib.doom_get_screenshot_status.restype = ctypes.c_int
+
+        # int doom_rewind(int seconds);  int doom_snapshot_save/load(void);
+        self._lib.doom_rewind.argtypes = [ctypes.c_int]
+        self._lib.doom_rewind.restype = ctypes.c_int
+        self._lib.doom_snapshot_save.argtypes = []
+        self._lib.doom_snapshot_save.restype = ctypes.c_int
+        self._lib.doom_snapshot_load.argtypes = []
+        self._lib.doom_snapshot_load.restype = ctypes.c_int
+
+        # int doom_demo_record/play(const char* path);  int doom_demo_stop(void);
+        self._lib.doom_demo_record.argtypes = [ctypes.c_char_p]
+        self._lib.doom_demo_record.restype = ctypes.c_int
+        self._lib.doom_demo_play.argtypes = [ctypes.c_char_p]
+        self._lib.doom_demo_play.restype = ctypes.c_int
+        self._lib.doom_demo_stop.argtypes = []
+        self._lib.doom_demo_stop.restype = ctypes.c_int
+        self._lib.doom_get_demo_state.argtypes = []
+        self._lib.doom_get_demo_state.restype = ctypes.c_int
+
+        # Live view of the engine's status struct: reading a field costs no
+        # ctypes call.  Only consistent when read from the tic thread.
+        self.status_view = UboStatus.from_address(self._lib.doom_get_status_ptr())
+
+        # Reused by tap() so a single tap allocates no ctypes objects.
+        self._tap_event = UboEvent()
+
         # int doom_is_alive(void);
         self._lib.doom_is_alive.argtypes = []
         self._lib.doom_is_alive.restype = ctypes.c_int
@@ -112,6 +936,188 @@ class DoomLib:
         self._lib.doom_get_rgba_height.argtypes = []
         self._lib.doom_get_rgba_height.restype = ctypes.c_int
 
+        # void doom_set_output_format(ubo_output_format_t fmt);
+        self._lib.doom_set_output_format.argtypes = [ctypes.c_int]
+        self._lib.doom_set_output_format.restype = None
+
+        # ubo_output_format_t doom_get_output_format(void);
+        self._lib.doom_get_output_format.argtypes = []
+        self._lib.doom_get_output_format.restype = ctypes.c_int
+
+        # const uint8_t* doom_get_rgb565_ptr(void);
+        self._lib.doom_get_rgb565_ptr.argtypes = []
+        self._lib.doom_get_rgb565_ptr.restype = ctypes.c_void_p
+
+        # int doom_get_rgb565_size(void);
+        self._lib.doom_get_rgb565_size.argtypes = []
+        self._lib.doom_get_rgb565_size.restype = ctypes.c_int
+
+        # int doom_copy_rgb565(uint8_t* dst, int dst_size);
+        self._lib.doom_copy_rgb565.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        self._lib.doom_copy_rgb565.restype = ctypes.c_int
+
+        # int doom_copy_frame_into(void* dst, int dst_size, ubo_output_format_t fmt);
+        self._lib.doom_copy_frame_into.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+        self._lib.doom_copy_frame_into.restype = ctypes.c_int
+
+        # uint32_t doom_get_palette_version(void);
+        self._lib.doom_get_palette_version.argtypes = []
+        self._lib.doom_get_palette_version.restype = ctypes.c_uint32
+
+        # int doom_copy_palette565(void* dst, int dst_size);
+        self._lib.doom_copy_palette565.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        self._lib.doom_copy_palette565.restype = ctypes.c_int
+
+        # void doom_set_scale_filter(ubo_scale_filter_t filter);
+        self._lib.doom_set_scale_filter.argtypes = [ctypes.c_int]
+        self._lib.doom_set_scale_filter.restype = None
+
+        # ubo_scale_filter_t doom_get_scale_filter(void);
+        self._lib.doom_get_scale_filter.argtypes = []
+        self._lib.doom_get_scale_filter.restype = ctypes.c_int
+
+        # void doom_set_lcd_orientation(ubo_rotation_t rotation, int mirror);
+        self._lib.doom_set_lcd_orientation.argtypes = [ctypes.c_int, ctypes.c_int]
+        self._lib.doom_set_lcd_orientation.restype = None
+
+        # ubo_rotation_t doom_get_lcd_rotation(void);
+        self._lib.doom_get_lcd_rotation.argtypes = []
+        self._lib.doom_get_lcd_rotation.restype = ctypes.c_int
+
+        # int doom_get_lcd_mirror(void);
+        self._lib.doom_get_lcd_mirror.argtypes = []
+        self._lib.doom_get_lcd_mirror.restype = ctypes.c_int
+
+        # void doom_set_direct565(int enabled);
+        self._lib.doom_set_direct565.argtypes = [ctypes.c_int]
+        self._lib.doom_set_direct565.restype = None
+
+        # int doom_get_direct565(void);
+        self._lib.doom_get_direct565.argtypes = []
+        self._lib.doom_get_direct565.restype = ctypes.c_int
+
+        # int doom_get_dirty_rects(ubo_rect_t* out, int max);
+        self._lib.doom_get_dirty_rects.argtypes = [ctypes.POINTER(UboRect), ctypes.c_int]
+        self._lib.doom_get_dirty_rects.restype = ctypes.c_int
+
+        # void doom_invalidate_dirty(void);
+        self._lib.doom_invalidate_dirty.argtypes = []
+        self._lib.doom_invalidate_dirty.restype = None
+
+        # void doom_set_frame_callback(ubo_frame_callback_t fn, void* user);
+        self._lib.doom_set_frame_callback.argtypes = [FrameCallback, ctypes.c_void_p]
+        self._lib.doom_set_frame_callback.restype = None
+        self._frame_callback: FrameCallback | None = None
+
+        # int doom_lcd_open(const char* device);
+        self._lib.doom_lcd_open.argtypes = [ctypes.c_char_p]
+        self._lib.doom_lcd_open.restype = ctypes.c_int
+
+        # void doom_lcd_close(void);
+        self._lib.doom_lcd_close.argtypes = []
+        self._lib.doom_lcd_close.restype = None
+
+        # int doom_lcd_active(void);
+        self._lib.doom_lcd_active.argtypes = []
+        self._lib.doom_lcd_active.restype = ctypes.c_int
+
+        # int doom_capture_start(const char* output);
+        self._lib.doom_capture_start.argtypes = [ctypes.c_char_p]
+        self._lib.doom_capture_start.restype = ctypes.c_int
+
+        # void doom_capture_stop(void);
+        self._lib.doom_capture_stop.argtypes = []
+        self._lib.doom_capture_stop.restype = None
+
+        # int doom_capture_active(void);
+        self._lib.doom_capture_active.argtypes = []
+        self._lib.doom_capture_active.restype = ctypes.c_int
+
+        # int doom_stream_start(const char* output);
+        self._lib.doom_stream_start.argtypes = [ctypes.c_char_p]
+        self._lib.doom_stream_start.restype = ctypes.c_int
+
+        # void doom_stream_stop(void);
+        self._lib.doom_stream_stop.argtypes = []
+        self._lib.doom_stream_stop.restype = None
+
+        # int doom_stream_active(void);
+        self._lib.doom_stream_active.argtypes = []
+        self._lib.doom_stream_active.restype = ctypes.c_int
+
+        # int doom_mirror_start(const char* target);
+        self._lib.doom_mirror_start.argtypes = [ctypes.c_char_p]
+        self._lib.doom_mirror_start.restype = ctypes.c_int
+
+        # int doom_spectate_start(const char* source);
+        self._lib.doom_spectate_start.argtypes = [ctypes.c_char_p]
+        self._lib.doom_spectate_start.restype = ctypes.c_int
+
+        # void doom_spectate_stop(void);
+        self._lib.doom_spectate_stop.argtypes = []
+        self._lib.doom_spectate_stop.restype = None
+
+        # int doom_get_spectate_stats(ubo_spectate_stats_t* out);
+        self._lib.doom_get_spectate_stats.argtypes = [ctypes.POINTER(UboSpectateStats)]
+        self._lib.doom_get_spectate_stats.restype = ctypes.c_int
+
+        # int doom_hdmi_open(const char* device);
+        self._lib.doom_hdmi_open.argtypes = [ctypes.c_char_p]
+        self._lib.doom_hdmi_open.restype = ctypes.c_int
+
+        # void doom_hdmi_close(void);
+        self._lib.doom_hdmi_close.argtypes = []
+        self._lib.doom_hdmi_close.restype = None
+
+        # int doom_hdmi_active(void);
+        self._lib.doom_hdmi_active.argtypes = []
+        self._lib.doom_hdmi_active.restype = ctypes.c_int
+
+        # int doom_acquire_frame(ubo_frame_t* out);
+        self._lib.doom_acquire_frame.argtypes = [ctypes.POINTER(UboFrame)]
+        self._lib.doom_acquire_frame.restype = ctypes.c_int
+
+        # void doom_release_frame(void);
+        self._lib.doom_release_frame.argtypes = []
+        self._lib.doom_release_frame.restype = None
+
+        # uint32_t doom_get_frame_seq(void);
+        self._lib.doom_get_frame_seq.argtypes = []
+        self._lib.doom_get_frame_seq.restype = ctypes.c_uint32
+
+        self._frame = UboFrame()
+
+        # int doom_run_async(int hz);
+        self._lib.doom_run_async.argtypes = [ctypes.c_int]
+        self._lib.doom_run_async.restype = ctypes.c_int
+
+        # void doom_stop_async(void);
+        self._lib.doom_stop_async.argtypes = []
+        self._lib.doom_stop_async.restype = None
+
+        # int doom_is_async(void);
+        self._lib.doom_is_async.argtypes = []
+        self._lib.doom_is_async.restype = ctypes.c_int
+
+        # int doom_poll_state_events(ubo_state_event_t* out, int max);
+        self._lib.doom_poll_state_events.argtypes = [ctypes.POINTER(UboStateEvent), ctypes.c_int]
+        self._lib.doom_poll_state_events.restype = ctypes.c_int
+
+        self._state_buf = (UboStateEvent * MAX_STATE_EVENTS)()
+
+        # int doom_game_event_fd(void);
+        self._lib.doom_game_event_fd.argtypes = []
+        self._lib.doom_game_event_fd.restype = ctypes.c_int
+
+        # int doom_poll_game_events(ubo_game_event_t* out, int max);
+        self._lib.doom_poll_game_events.argtypes = [ctypes.POINTER(UboGameEvent), ctypes.c_int]
+        self._lib.doom_poll_game_events.restype = ctypes.c_int
+
+        self._game_event_buf = (UboGameEvent * MAX_GAME_EVENTS)()
+
+        # Reused by dirty_rects() so polling allocates no ctypes arrays.
+        self._dirty_buf = (UboRect * MAX_DIRTY_RECTS)()
+
         # Optional globals exported by the patch:
         #   extern int ubo_library_mode;
         #   extern uint8_t ubo_rgba[320 * 200 * 4];
@@ -126,26 +1132,446 @@ class DoomLib:
         except Exception:
             self.ubo_rgba = None
 
+        # The calls made every tic or keypress go through _ubodoom when it
+        # was built next to the library (make pymodule): no ctypes argument
+        # conversion, and the tic itself runs without the GIL.
+        self.ext = _load_extension(lib_path, int(self._lib.doom_get_status_ptr()))
+        if self.ext is not None:
+            for name in EXTENSION_METHODS:
+                setattr(self, name, getattr(self.ext, name))
+
     def init(self, iwad_path: str) -> None:
         rc = int(self._lib.doom_init(iwad_path.encode("utf-8")))
         if rc != 0:
             raise RuntimeError(f"doom_init failed rc={rc} (iwad_path={iwad_path!r})")
 
+    def init_begin(self, iwad_path: str) -> None:
+        """Start init() in steps; init_step() runs the engine start-up phases."""
+        rc = int(self._lib.doom_init_begin(iwad_path.encode("utf-8")))
+        if rc != 0:
+            raise RuntimeError(f"doom_init_begin failed rc={rc} (iwad_path={iwad_path!r})")
+
+    def init_step(self, budget_ms: int) -> int:
+        """Run start-up phases for about budget_ms (0 = all); percent done, 100 when up."""
+        rc = int(self._lib.doom_init_step(int(budget_ms)))
+        if rc < 0:
+            raise RuntimeError("doom_init_step failed")
+        return rc
+
+    def init_phases(self) -> list[tuple[str, int]]:
+        """(phase, microseconds) for each start-up phase; -1 for one not run yet."""
+        phases = []
+        while (name := self._lib.doom_init_phase_name(len(phases))) is not None:
+            phases.append((name.decode(), int(self._lib.doom_init_phase_us(len(phases)))))
+        return phases
+
+    def prewarm(self, iwad_path: str) -> None:
+        """Start the engine ahead of init() without opening sound or the sinks."""
+        rc = int(self._lib.doom_prewarm(iwad_path.encode("utf-8")))
+        if rc != 0:
+            raise RuntimeError(f"doom_prewarm failed rc={rc} (iwad_path={iwad_path!r})")
+
+    def is_prewarmed(self) -> bool:
+        """True between prewarm() and the init() that takes the engine over."""
+        return bool(self._lib.doom_is_prewarmed())
+
+    def suspend(self) -> bool:
+        """Close the PCM and drop the caches while the page is away (tick loop stopped)."""
+        return int(self._lib.doom_suspend()) == 0
+
+    def resume(self) -> bool:
+        """Undo suspend(); init() on a suspended engine does this too."""
+        return int(self._lib.doom_resume()) == 0
+
+    def is_suspended(self) -> bool:
+        return bool(self._lib.doom_is_suspended())
+
     def shutdown(self) -> None:
         self._lib.doom_shutdown()
 
     def tick(self) -> None:
         self._lib.doom_tick()
 
+    def tick_ex(self, *, run_sim: bool = True, render: bool = True) -> None:
+        """One tic with simulation and/or rendering (D_Display) independently."""
+        self._lib.doom_tick_ex(int(run_sim), int(render))
+
+    def set_render_divisor(self, divisor: int) -> None:
+        """Render only every Nth tic in tick() and the native scheduler."""
+        self._lib.doom_set_render_divisor(int(divisor))
+
+    def set_quality_level(self, level: int) -> None:
+        """Hold governor level 0 (full) .. 4, or -1 to let it govern again."""
+        self._lib.doom_set_quality_level(int(level))
+
+    def quality_level(self) -> int:
+        """The quality level the governor holds, 0 = full quality."""
+        return int(self._lib.doom_get_quality_level())
+
+    def set_thread_policy(self, thread: UboThread, cpus: Iterable[int] = (), priority: int = 0) -> bool:
+        """Pin a class of engine threads to cpus (empty = any CPU) and run
+        them SCHED_FIFO at priority 1..99, or SCHED_OTHER with 0.  The
+        threads move at their next loop; False for a bad argument."""
+        mask = 0
+        for cpu in cpus:
+            mask |= 1 << int(cpu)
+        return self._lib.doom_set_thread_policy(int(thread), mask, int(priority)) == 0
+
+    def advance(self, elapsed_s: float, *, render: bool = True) -> int:
+        """Run the 35 Hz tics elapsed_s of wall time covers, then render.
+
+        The library keeps the leftover fraction of a tic for the next call
+        and, with interpolation on, draws the frame that far between the
+        last two tics.  After a stall it runs at most the catch-up limit
+        and owes the rest to the calls after (set_catchup).  Returns the
+        number of tics run.
+        """
+        elapsed_us = min(max(0, int(elapsed_s * 1_000_000)), 0xFFFFFFFF)
+        rc = int(self._lib.doom_advance(elapsed_us, int(render)))
+        if rc < 0:
+            raise RuntimeError("doom_advance: the native scheduler is running")
+        return rc
+
+    def set_catchup(self, max_tics: int, backlog_tics: int) -> bool:
+        """advance(): tics per call and tics of owed time kept (UBO_DOOM_CATCHUP).
+
+        False for max_tics outside 1..35 or backlog_tics outside 0..350.
+        """
+        return self._lib.doom_set_catchup(int(max_tics), int(backlog_tics)) == 0
+
+    def set_load_budget(self, budget_ms: int) -> bool:
+        """Build a new level at most budget_ms per tic (UBO_DOOM_LOAD_BUDGET_MS).
+
+        0 loads in one go.  False outside 0..1000.
+        """
+        return self._lib.doom_set_load_budget(int(budget_ms)) == 0
+
+    def set_interpolation(self, enabled: bool) -> None:
+        """Draw advance() frames between tics (UBO_DOOM_INTERPOLATE)."""
+        self._lib.doom_set_interpolation(int(enabled))
+
+    def set_time_source(self, source: TimeSource | int) -> bool:
+        """Run timing-dependent behaviour on the monotonic or a virtual clock.
+
+        On TimeSource.VIRTUAL the clock moves one tic with each tic run
+        (plus advance_time()), so a benchmark or regression run can go
+        faster than real time and time the same way every run.  False for
+        another value or while run_async() owns the engine.
+        """
+        return self._lib.doom_set_time_source(int(source)) == 0
+
+    def advance_time(self, elapsed_s: float) -> bool:
+        """Move the virtual clock on without running a tic; False on the monotonic one."""
+        us = min(max(0, int(elapsed_s * 1_000_000)), 0xFFFFFFFF)
+        return self._lib.doom_advance_time(us) == 0
+
+    def time_us(self) -> int:
+        """The engine clock in microseconds."""
+        return int(self._lib.doom_get_time_us())
+
     def key_down(self, key: UboKey | int) -> None:
         self._lib.doom_key_down(int(key))
 
     def key_up(self, key: UboKey | int) -> None:
         self._lib.doom_key_up(int(key))
 
+    def tap(self, key: UboKey | int, hold_tics: int) -> None:
+        """Press key now; the engine releases it after hold_tics tics."""
+        ev = self._tap_event
+        ev.key = int(key)
+        ev.down = 1
+        ev.hold_tics = int(hold_tics)
+        self._lib.doom_post_events(ctypes.byref(ev), 1)
+
+    def post_events(self, events: list[tuple[UboKey | int, int, int]]) -> int:
+        """Queue (key, down, hold_tics) events in one call; returns count accepted."""
+        arr = (UboEvent * len(events))(*[UboEvent(int(k), int(d), int(h)) for k, d, h in events])
+        return int(self._lib.doom_post_events(arr, len(events)))
+
+    def release_all_keys(self) -> None:
+        """Queue a key-up for every key the engine considers held."""
+        self._lib.doom_release_all_keys()
+
+    def set_ticcmd(self, cmd: UboTiccmd | None) -> None:
+        """Drive the console player with cmd every tic; None goes back to the keys.
+
+        Call between tics, from the thread running them.
+        """
+        self._lib.doom_set_ticcmd(ctypes.byref(cmd) if cmd is not None else None)
+
+    def set_log_level(self, level: int) -> None:
+        """0 = errors, 1 = info, 2 = per-event debug (see UBO_DOOM_LOG_LEVEL)."""
+        self._lib.doom_set_log_level(int(level))
+
+    def read_log(self) -> list[str]:
+        """Drain the engine's log ring; the first call stops its own stderr output."""
+        lines: list[str] = []
+        while True:
+            n = int(self._lib.doom_read_log(self._log_buf, len(self._log_buf)))
+            if n <= 0:
+                return lines
+            lines.extend(self._log_buf.raw[:n].decode("utf-8", "replace").splitlines())
+
     def is_alive(self) -> bool:
         return bool(self._lib.doom_is_alive())
 
+    def status(self) -> UboStatus:
+        """Consistent snapshot copy of the engine status (safe from any thread)."""
+        st = UboStatus()
+        self._lib.doom_get_status(ctypes.byref(st))
+        return st
+
+    def reset_deadline_stats(self) -> None:
+        """Zero the missed-deadline count and the longest tic (from the next tic)."""
+        self._lib.doom_reset_deadline_stats()
+
+    def profile(self) -> dict[str, UboProfStat]:
+        """Per-stage frame profiler snapshot keyed by PROFILE_STAGES name."""
+        prof = UboProfile()
+        self._lib.doom_get_profile(ctypes.byref(prof))
+        return {name: prof.stage[i] for i, name in enumerate(PROFILE_STAGES)}
+
+    def set_profile_enabled(self, enabled: bool) -> None:
+        """Same as UBO_DOOM_PROFILE=1; takes effect at the next tic."""
+        self._lib.doom_set_profile_enabled(int(enabled))
+
+    def reset_profile(self) -> None:
+        self._lib.doom_reset_profile()
+
+    def set_trace_enabled(self, events: int) -> None:
+        """Same as UBO_DOOM_TRACE: 0 stops, 1 = default ring, N = events kept per thread."""
+        self._lib.doom_set_trace_enabled(int(events))
+
+    def trace_dump(self, path: str) -> int:
+        """Write the recorded timeline as Chrome trace JSON; events written, -1 on error."""
+        return int(self._lib.doom_trace_dump(path.encode("utf-8")))
+
+    def zone_stats(self) -> UboZoneStats | None:
+        """Zone heap fragmentation snapshot; call from the tic thread. None before init."""
+        zs = UboZoneStats()
+        if self._lib.doom_get_zone_stats(ctypes.byref(zs)) != 0:
+            return None
+        return zs
+
+    def set_zone_limits(self, base_mb: int, max_mb: int) -> None:
+        """Zone size and growth limit in MB for the next init()."""
+        self._lib.doom_set_zone_limits(int(base_mb), int(max_mb))
+
+    def set_memory_budget(self, mb: int) -> None:
+        """Same as UBO_DOOM_MEMORY_MB, for the next init(); 0 = none."""
+        self._lib.doom_set_memory_budget(int(mb))
+
+    def add_pwad(self, path: str | None) -> int:
+        """Queue a PWAD for the next init(); None clears. Count queued, or -1."""
+        return int(self._lib.doom_add_pwad(path.encode("utf-8") if path is not None else None))
+
+    def set_zone_profile(self, every: int) -> None:
+        """Same as UBO_DOOM_ZONE_PROFILE: 0 off, 1 record, N also logs every N tics."""
+        self._lib.doom_set_zone_profile(int(every))
+
+    def zone_report(self) -> dict | None:
+        """Zone profiler report (per tag and call site) parsed from JSON. None before init."""
+        size = int(self._lib.doom_zone_report(None, 0))
+        if size < 0:
+            return None
+        buf = ctypes.create_string_buffer(size + 1)
+        if self._lib.doom_zone_report(buf, len(buf)) < 0:
+            return None
+        return json.loads(buf.value.decode("utf-8", "replace"))
+
+    def zone_dump(self, path: str) -> bool:
+        """Write Z_FileDumpHeap's block list to path."""
+        return self._lib.doom_zone_dump(path.encode("utf-8")) == 0
+
+    def set_config(self, key: str, value: str | int | None) -> bool:
+        """Set a config setting for the next init(); the engine then reads no config file.
+
+        value None unsets it. False for an unknown key, a non-number for a
+        number setting, or while the engine runs.
+        """
+        raw = None if value is None else str(value).encode("utf-8")
+        return self._lib.doom_set_config(key.encode("utf-8"), raw) == 0
+
+    def clear_config(self) -> None:
+        """Drop every set_config() setting, so the next init() reads the config file again."""
+        self._lib.doom_set_config(None, None)
+
+    def get_config(self, key: str) -> str | None:
+        """Current value of a config setting as text; None for an unknown key."""
+        buf = ctypes.create_string_buffer(256)
+        if self._lib.doom_get_config(key.encode("utf-8"), buf, len(buf)) < 0:
+            return None
+        return buf.value.decode("utf-8", "replace")
+
+    def memstats(self) -> UboMemStats | None:
+        """Zone budget, high-water mark and resident footprint; None before init."""
+        ms = UboMemStats()
+        if self._lib.doom_get_memstats(ctypes.byref(ms)) != 0:
+            return None
+        return ms
+
+    def pool_stats(self) -> UboPoolStats | None:
+        """Peak visplane/drawseg/vissprite/intercept/spechit use this level; None before init."""
+        ps = UboPoolStats()
+        if self._lib.doom_get_pool_stats(ctypes.byref(ps)) != 0:
+            return None
+        return ps
+
+    def composite_stats(self) -> UboCompositeStats | None:
+        """Composite texture cache residency, hits/misses and evictions; None before init."""
+        cs = UboCompositeStats()
+        if self._lib.doom_get_composite_stats(ctypes.byref(cs)) != 0:
+            return None
+        return cs
+
+    def audio_stats(self) -> UboAudioStats | None:
+        """ALSA underruns, device delay, ring fill and mixing time; None before init."""
+        au = UboAudioStats()
+        if self._lib.doom_get_audio_stats(ctypes.byref(au)) != 0:
+            return None
+        return au
+
+    def reset_audio_stats(self) -> None:
+        """Zero the audio counters and maxima (levels keep going)."""
+        self._lib.doom_reset_audio_stats()
+
+    def simulate(self, tics: int) -> list[int]:
+        """Run `tics` tics headless (no rendering or sound) and return the
+        state hash after each one; shorter if the engine died."""
+        hashes = (ctypes.c_uint32 * max(int(tics), 1))()
+        n = int(self._lib.doom_simulate(int(tics), hashes))
+        return [int(h) for h in hashes[:max(n, 0)]]
+
+    def state_hash(self) -> int:
+        """FNV-1a hash of the playsim state, for spotting desyncs."""
+        return int(self._lib.doom_state_hash())
+
+    def frame_hash(self) -> int:
+        """FNV-1a hash of the last rendered 8-bit frame (screens[0])."""
+        return int(self._lib.doom_get_frame_hash())
+
+    def set_aux_buffers(self, mask: int, index_width: int = 0, index_height: int = 0) -> None:
+        """Turn the AUX_* buffers on or off from the next rendered frame;
+        a 0 index size keeps the current one (80x50 to start with)."""
+        self._lib.doom_set_aux_buffers(int(mask), int(index_width), int(index_height))
+
+    def aux_frame(self) -> AuxBuffers | None:
+        """The last rendered frame's AUX_* buffers; None until one is drawn.
+
+        Call between tics on the thread running them.
+        """
+        f = self._aux
+        if self._lib.doom_get_aux_frame(ctypes.byref(f)) < 0:
+            return None
+
+        def view(addr: int | None, size: int, fmt: str = "B") -> memoryview | None:
+            if not addr or size <= 0:
+                return None
+            return memoryview((ctypes.c_uint8 * size).from_address(addr)).cast(fmt)
+
+        drawn = f.view_width > 0
+        return AuxBuffers(
+            seq=int(f.seq),
+            index=view(f.index, f.index_width * f.index_height),
+            index_width=int(f.index_width),
+            index_height=int(f.index_height),
+            view=(int(f.view_x), int(f.view_y), int(f.view_width), int(f.view_height)),
+            view_detail=int(f.view_detail),
+            depth=view(f.depth, 2 * f.view_width, "H") if drawn else None,
+            labels=view(f.labels, f.label_stride * f.view_height) if drawn else None,
+            label_stride=int(f.label_stride),
+        )
+
+    def env_open(self, iwad_path: Path, count: int, config: UboEnvConfig | None = None) -> int:
+        """Fork `count` environment workers (see doom_env_open); -1 on failure.
+
+        Call before this process starts threads of its own or calls init().
+        """
+        cfg = ctypes.byref(config) if config is not None else None
+        return int(self._lib.doom_env_open(str(iwad_path).encode("utf-8"), cfg, int(count)))
+
+    def env_obs(self, index: int) -> memoryview | None:
+        """Environment index's latest observation, read in place from shared
+        memory; valid until its next step or reset."""
+        size = int(self._lib.doom_env_obs_size())
+        addr = self._lib.doom_env_obs(int(index))
+        if not size or not addr:
+            return None
+        return memoryview((ctypes.c_uint8 * size).from_address(addr)).cast("B")
+
+    def env_step_batch(self, actions: list[UboTiccmd]) -> tuple[int, list[UboEnvResult]]:
+        """Step environments 0..len(actions)-1 in parallel.
+
+        Returns (rc, results): rc is len(actions), or -1 if a worker was
+        lost.  Read the observations with env_obs(i).
+        """
+        n = len(actions)
+        arr = (UboTiccmd * n)(*actions)
+        results = (UboEnvResult * n)()
+        rc = int(self._lib.doom_env_step_batch(arr, n, None, results))
+        return rc, list(results)
+
+    def env_reset(self, index: int = -1) -> int:
+        """Start a new episode in environment index, -1 for all."""
+        return int(self._lib.doom_env_reset(int(index)))
+
+    def env_close(self) -> None:
+        """Stop and reap every environment worker."""
+        self._lib.doom_env_close()
+
+    def save_status(self) -> tuple[int, int]:
+        """Return (state, seq) of the last savegame write.
+
+        state: 0 = none yet, 1 = writing, 2 = saved, 3 = failed; seq counts
+        finished writes, so a change means one just completed.
+        """
+        seq = ctypes.c_uint32()
+        state = int(self._lib.doom_get_save_status(ctypes.byref(seq)))
+        return state, int(seq.value)
+
+    def screenshot(self, path: Path | str, lcd: bool = False) -> bool:
+        """Queue a PNG of the next frame shown, encoded off the tick thread.
+
+        lcd=False writes the 8-bit picture with its palette, lcd=True the
+        240x240 letterboxed frame as the panel gets it. False while another
+        shot is pending or being written.
+        """
+        return self._lib.doom_screenshot(str(path).encode("utf-8"), 1 if lcd else 0) == 0
+
+    def screenshot_status(self) -> tuple[int, int]:
+        """Return (state, seq) of the last screenshot, as save_status()."""
+        seq = ctypes.c_uint32()
+        state = int(self._lib.doom_get_screenshot_status(ctypes.byref(seq)))
+        return state, int(seq.value)
+
+    def rewind(self, seconds: int) -> bool:
+        """Queue a jump back to the in-memory snapshot about `seconds` old."""
+        return self._lib.doom_rewind(int(seconds)) == 0
+
+    def snapshot_save(self) -> bool:
+        """Queue a quick save to memory (no SD card write)."""
+        return self._lib.doom_snapshot_save() == 0
+
+    def snapshot_load(self) -> bool:
+        """Queue loading the memory quick save back."""
+        return self._lib.doom_snapshot_load() == 0
+
+    def demo_record(self, path: Path | str) -> bool:
+        """Queue recording a demo to `path`, restarting the current map."""
+        return self._lib.doom_demo_record(str(path).encode("utf-8")) == 0
+
+    def demo_play(self, path: Path | str) -> bool:
+        """Queue playing a demo file; False if it can't be read."""
+        return self._lib.doom_demo_play(str(path).encode("utf-8")) == 0
+
+    def demo_stop(self) -> bool:
+        """Queue finishing the demo being recorded or played."""
+        return self._lib.doom_demo_stop() == 0
+
+    def demo_state(self) -> int:
+        """0 = no demo, 1 = recording, 2 = playing."""
+        return int(self._lib.doom_get_demo_state())
+
     def gamestate(self) -> int:
         """Return current gamestate integer.
 
@@ -168,3 +1594,268 @@ class DoomLib:
 
     def rgba_ptr(self) -> ctypes.POINTER(ctypes.c_uint8):
         return self._lib.doom_get_rgba_ptr()
+
+    def set_output_format(self, fmt: OutputFormat | int) -> None:
+        """Select which buffer I_FinishUpdate writes (RGBA8888, RGB565 BE or INDEX8)."""
+        self._lib.doom_set_output_format(int(fmt))
+
+    def output_format(self) -> OutputFormat:
+        return OutputFormat(int(self._lib.doom_get_output_format()))
+
+    def rgb565_ptr(self) -> int:
+        """Address of the 240x240 big-endian RGB565 LCD frame."""
+        return int(self._lib.doom_get_rgb565_ptr())
+
+    def rgb565_size(self) -> int:
+        return int(self._lib.doom_get_rgb565_size())
+
+    def rgb565_frame(self) -> bytes:
+        """Copy the current native RGB565 frame out as bytes for render_block."""
+        return ctypes.string_at(self.rgb565_ptr(), self.rgb565_size())
+
+    def copy_rgb565_into(self, dst: bytearray) -> None:
+        """Copy the native RGB565 frame into a caller-owned, preallocated buffer.
+
+        Unlike rgb565_frame() this allocates nothing per call.
+        """
+        self.frame_into(dst, OutputFormat.RGB565_BE)
+
+    def frame_into(
+        self, dst: bytearray | memoryview, fmt: OutputFormat | int = OutputFormat.RGB565_BE
+    ) -> int:
+        """Copy the current frame in `fmt` into a writable, preallocated buffer.
+
+        Returns the bytes written.  The buffer's address is resolved once and
+        kept (which also stops a bytearray from being resized), so passing the
+        same buffer every frame allocates nothing.
+        """
+        if dst is not self._into_buf:
+            self._into_c = (ctypes.c_char * len(dst)).from_buffer(dst)
+            self._into_buf = dst
+        c_dst = self._into_c
+        rc = int(self._lib.doom_copy_frame_into(ctypes.addressof(c_dst), len(c_dst), int(fmt)))
+        if rc < 0:
+            raise ValueError(f"frame destination too small for format {int(fmt)}: {len(c_dst)} bytes")
+        return rc
+
+    def palette_version(self) -> int:
+        """Counts the palette changes of the INDEX8 frames (0 before the first)."""
+        return int(self._lib.doom_get_palette_version())
+
+    def palette565_into(self, dst: bytearray | memoryview) -> int:
+        """Copy the last INDEX8 frame's palette, 256 big-endian RGB565 entries.
+
+        Returns the bytes written (512).  Like frame_into() the buffer's
+        address is kept, so refreshing the same one allocates nothing.
+        """
+        if dst is not self._palette_buf:
+            self._palette_c = (ctypes.c_char * len(dst)).from_buffer(dst)
+            self._palette_buf = dst
+        c_dst = self._palette_c
+        rc = int(self._lib.doom_copy_palette565(ctypes.addressof(c_dst), len(c_dst)))
+        if rc < 0:
+            raise ValueError(f"palette destination too small: {len(c_dst)} bytes")
+        return rc
+
+    def dirty_rects(self) -> list[tuple[int, int, int, int]]:
+        """Row bands of the RGB565 frame changed since the previous call.
+
+        Returns inclusive (x0, y0, x1, y1) tuples; empty means nothing changed.
+        """
+        n = int(self._lib.doom_get_dirty_rects(self._dirty_buf, MAX_DIRTY_RECTS))
+        return [(r.x0, r.y0, r.x1, r.y1) for r in self._dirty_buf[:n]]
+
+    def invalidate_dirty(self) -> None:
+        """Make the next dirty_rects() report the full LCD."""
+        self._lib.doom_invalidate_dirty()
+
+    def set_frame_callback(self, fn: Callable[[UboFrameInfo], None] | None) -> None:
+        """Have fn(frame) called with each newly shown frame, on the tic thread.
+
+        frame.data, frame.rects and frame itself are only valid until fn
+        returns; copy out what must outlive it (ctypes.string_at()).  rects
+        are the bands changed since fn's previous frame.  None removes it,
+        waiting for a call in flight.
+        """
+        if fn is None:
+            self._lib.doom_set_frame_callback(FrameCallback(), None)
+            self._frame_callback = None
+            return
+        callback = FrameCallback(lambda frame, _user: fn(frame.contents))
+        self._lib.doom_set_frame_callback(callback, None)
+        self._frame_callback = callback     # ctypes calls it until replaced
+
+    def lcd_open(self, device: str) -> bool:
+        """Let libubodoom drive the LCD itself (/dev/fbN or /dev/spidevB.C).
+
+        While it does, frames must not be acquired or pushed from Python.
+        Returns False (and logs why) if the device can't be used.
+        """
+        return int(self._lib.doom_lcd_open(device.encode("utf-8"))) == 0
+
+    def lcd_close(self) -> None:
+        """Stop the native display sink; no-op if it isn't running."""
+        self._lib.doom_lcd_close()
+
+    def lcd_active(self) -> bool:
+        """False once the sink is closed or a write to the device failed."""
+        return bool(self._lib.doom_lcd_active())
+
+    def capture_start(self, output: str) -> bool:
+        """Record/stream gameplay as H.264 through the V4L2 encoder.
+
+        `output` is a file, a FIFO or "udp:host:port".  Returns False (and
+        logs why) if the encoder can't be set up.
+        """
+        return int(self._lib.doom_capture_start(output.encode("utf-8"))) == 0
+
+    def capture_stop(self) -> None:
+        """Flush the encoder and close the output; no-op if not capturing."""
+        self._lib.doom_capture_stop()
+
+    def capture_active(self) -> bool:
+        """False once capture is stopped or writing its output failed."""
+        return bool(self._lib.doom_capture_active())
+
+    def stream_start(self, output: str) -> bool:
+        """Send the shown palette frames to a remote viewer (frame_stream.py).
+
+        `output` is "tcp:host:port" to connect out or "tcp::port" to listen.
+        Returns False (and logs why) if it is malformed or the port is taken.
+        """
+        return int(self._lib.doom_stream_start(output.encode("utf-8"))) == 0
+
+    def stream_stop(self) -> None:
+        """Close the viewer connection; no-op if not streaming."""
+        self._lib.doom_stream_stop()
+
+    def stream_active(self) -> bool:
+        """False once the stream is stopped."""
+        return bool(self._lib.doom_stream_active())
+
+    def mirror_start(self, target: str) -> bool:
+        """Send each tic's ticcmds to spectators, from the next new game or demo.
+
+        `target` is "udp:host:port"; a broadcast address reaches every
+        spectator on the network.  Returns False (and logs why) if it is
+        malformed or a spectator is running.
+        """
+        return int(self._lib.doom_mirror_start(target.encode("utf-8"))) == 0
+
+    def spectate_start(self, source: str) -> bool:
+        """Follow a mirrored game, simulating and rendering it locally.
+
+        `source` is "udp::port".  Returns False (and logs why) if it is
+        malformed, the port is taken or this engine is mirroring.
+        """
+        return int(self._lib.doom_spectate_start(source.encode("utf-8"))) == 0
+
+    def spectate_stop(self) -> None:
+        """Stop mirroring or spectating; no-op if neither runs."""
+        self._lib.doom_spectate_stop()
+
+    def spectate_stats(self) -> UboSpectateStats | None:
+        """Role, session, traffic, resends and state hash check points / desyncs."""
+        st = UboSpectateStats()
+        if self._lib.doom_get_spectate_stats(ctypes.byref(st)) != 0:
+            return None
+        return st
+
+    def hdmi_open(self, device: str = "/dev/dri/card0") -> bool:
+        """Mirror the game on the connected HDMI display through KMS (docked mode).
+
+        Returns False (and logs why) if there is no connected display, another
+        process holds the display, or the library was built without DRM.
+        """
+        return int(self._lib.doom_hdmi_open(device.encode("utf-8"))) == 0
+
+    def hdmi_close(self) -> None:
+        """Give the display back its console mode; no-op if not open."""
+        self._lib.doom_hdmi_close()
+
+    def hdmi_active(self) -> bool:
+        """False once closed, or if page flipping failed."""
+        return bool(self._lib.doom_hdmi_active())
+
+    def run_async(self, hz: int = 35) -> None:
+        """Start the native tick scheduler; doom.tick() becomes a no-op."""
+        rc = int(self._lib.doom_run_async(int(hz)))
+        if rc != 0:
+            raise RuntimeError(f"doom_run_async failed rc={rc}")
+
+    def stop_async(self) -> None:
+        """Stop the native scheduler and wait for its thread to exit."""
+        self._lib.doom_stop_async()
+
+    def is_async(self) -> bool:
+        return bool(self._lib.doom_is_async())
+
+    def poll_state_events(self) -> list[UboStateEvent]:
+        """Drain state-change events posted by the native scheduler."""
+        n = int(self._lib.doom_poll_state_events(self._state_buf, MAX_STATE_EVENTS))
+        # Copy out: the buffer is reused by the next poll.
+        return [UboStateEvent.from_buffer_copy(ev) for ev in self._state_buf[:n]]
+
+    def game_event_fd(self) -> int:
+        """eventfd that is readable while game events wait; -1 if none.
+
+        Wait on it with select/poll or loop.add_reader(), then call
+        poll_game_events().  Owned by the library: never read or close it.
+        """
+        return int(self._lib.doom_game_event_fd())
+
+    def poll_game_events(self) -> list[UboGameEvent]:
+        """Drain pending game events, oldest first (single consumer)."""
+        events: list[UboGameEvent] = []
+        while True:
+            n = int(self._lib.doom_poll_game_events(self._game_event_buf, MAX_GAME_EVENTS))
+            events.extend(UboGameEvent.from_buffer_copy(ev) for ev in self._game_event_buf[:n])
+            if n < MAX_GAME_EVENTS:
+                return events
+
+    def acquire_frame(self) -> UboFrame | None:
+        """Pin the newest RGB565 frame for reading from any thread.
+
+        Returns None if no frame newer than the last acquired one exists.
+        The returned struct is reused; call release_frame() when done.
+        """
+        rc = int(self._lib.doom_acquire_frame(ctypes.byref(self._frame)))
+        if rc < 0:
+            raise RuntimeError("doom_acquire_frame: previous frame not released")
+        return self._frame if rc == 1 else None
+
+    def release_frame(self) -> None:
+        self._lib.doom_release_frame()
+
+    def frame_seq(self) -> int:
+        """Sequence number of the most recently published RGB565 frame."""
+        return int(self._lib.doom_get_frame_seq())
+
+    def set_scale_filter(self, filt: ScaleFilter | int) -> None:
+        """Select the 320x200 -> 240x150 downscale filter for RGB565 output."""
+        self._lib.doom_set_scale_filter(int(filt))
+
+    def scale_filter(self) -> ScaleFilter:
+        return ScaleFilter(int(self._lib.doom_get_scale_filter()))
+
+    def set_lcd_orientation(self, rotation: Rotation | int, *, mirror: bool = False) -> None:
+        """Turn the RGB565 frame for the panel's mounting (UBO_DOOM_LCD_ROTATION).
+
+        Applied while scaling, so it costs nothing extra; mirror flips left
+        and right before the clockwise rotation.
+        """
+        self._lib.doom_set_lcd_orientation(int(rotation), int(mirror))
+
+    def lcd_orientation(self) -> tuple[Rotation, bool]:
+        return Rotation(int(self._lib.doom_get_lcd_rotation())), bool(self._lib.doom_get_lcd_mirror())
+
+    def set_direct565(self, enabled: bool) -> None:
+        """Draw plain level views straight into RGB565 (UBO_DOOM_DIRECT565).
+
+        Only frames with RGB565 output, the nearest filter (or LCD
+        resolution) and nothing reading the 8-bit screen go that way.
+        """
+        self._lib.doom_set_direct565(int(enabled))
+
+    def direct565(self) -> bool:
+        return bool(self._lib.doom_get_direct565())
@@ -6,9 +6,13 @@ External ubo service that runs classic Doom (linuxdoom-1.10) embedded as a share
 library (`libubodoom.so`) without forking ubo_app.
 
 Video:
-- Doom exports an RGBA8888 framebuffer (expected 320x200) via the patch API.
-- This service scales it to 240x150 and letterboxes to 240x240 (45px top/bottom).
-- Converts to RGB565 (big-endian) and writes directly to the LCD via:
+- By default libubodoom.so writes a ready-to-blit 240x240 letterboxed RGB565
+  big-endian frame itself (doom_set_output_format(UBO_OUTPUT_RGB565_BE)).
+- Fallback (UBO_DOOM_NATIVE_VIDEO=0): Doom exports its 8-bit frame
+  (expected 320x200 palette indices) and the RGB565 palette it goes with;
+  this service scales it to 240x150, letterboxes to 240x240 (45px
+  top/bottom) and looks the pixels up in that palette in numpy.
+- Either way the frame is written directly to the LCD via:
     ubo_app.display.display.render_block(..., bypass_pause=True)
 
 Audio:
@@ -33,8 +37,94 @@ Input:
 
 Environment:
 - UBO_DOOM_LIB  : path to libubodoom.so (default: ~/doom/libubodoom.so)
-- UBO_DOOM_IWAD : path to IWAD (.wad)   (default: ~/doom/doom2.wad)
-- UBO_DOOM_FPS  : target fps (default: 30)
+- UBO_DOOM_PYEXT : 0 = ignore the _ubodoom extension next to it, all calls through ctypes (default 1)
+- UBO_DOOM_IWAD : path to IWAD (.wad, or .pk3/.zip)   (default: ~/doom/doom2.wad)
+- UBO_DOOM_FPS  : tick loop rate, the LCD gets every 1st-3rd frame; the game runs 35 Hz regardless (default: 30)
+- UBO_DOOM_LCD_CADENCE : auto = pick 1/2/3 from the measured conversion + SPI time and WiFi load (default), N = every Nth frame
+- UBO_DOOM_WIFI_BUSY_KBPS : WiFi KB/s above which the auto cadence backs off a step (default 256)
+- UBO_DOOM_TIC_POLICY / _AUDIO_ / _DISPLAY_ / _RENDER_POLICY : "CPUS[:PRIO]" affinity and SCHED_FIFO priority per engine thread class (default: inherit)
+- UBO_DOOM_INTERPOLATE : 1 = draw frames between the last two tics (default), 0 = show the last tic as is
+- UBO_DOOM_NATIVE_VIDEO : 1 = RGB565 conversion in C (default), 0 = numpy palette lookup of the 8-bit frame
+- UBO_DOOM_SCALE_FILTER : nearest (default) | area | box  (native path only)
+- UBO_DOOM_LCD_ROTATION : 0 (default) | 90 | 180 | 270, clockwise, for how the panel is mounted (native path only)
+- UBO_DOOM_LCD_MIRROR   : 1 = flip the frame left to right before the rotation (default 0)
+- UBO_DOOM_LCD_RES      : 1 = engine draws at 240x150, no downscale (default 0)
+- UBO_DOOM_LCD_DEVICE   : /dev/fbN (fbtft) or /dev/spidevB.C = libubodoom sends frames to the LCD itself (default unset)
+- UBO_DOOM_FRAMESHM     : shm_open name frames are exported to for other processes (frameshm.h; default unset)
+- UBO_DOOM_CAPTURE      : file, FIFO or udp:host:port libubodoom writes H.264 gameplay to (default unset)
+- UBO_DOOM_CAPTURE_DEVICE : V4L2 M2M H.264 encoder (default /dev/video11)
+- UBO_DOOM_CAPTURE_FPS / _KBPS / _GOP : capture frame rate cap, bitrate, key frame interval (35 / 1500 / 2*fps)
+- UBO_DOOM_STREAM       : tcp::port or tcp:host:port, delta-coded palette frames for a remote viewer (frame_stream.py; default unset)
+- UBO_DOOM_STREAM_FPS   : most frames per second sent to the viewer (default 35)
+- UBO_DOOM_MIRROR       : udp:host:port, send each tic's ticcmds to spectators (spectate.h; default unset)
+- UBO_DOOM_SPECTATE     : udp::port, follow a mirrored game and simulate it locally (default unset)
+- UBO_DOOM_HDMI         : /dev/dri/cardN = also show the game on its connected HDMI display, page-flipped (default unset)
+- UBO_DOOM_HDMI_MODE    : WIDTHxHEIGHT mode for UBO_DOOM_HDMI (default the display's preferred mode)
+- UBO_DOOM_NATIVE_TICK  : 1 = tick on a native pthread at 35 Hz (doom_run_async), 0 = Python-paced (default)
+- UBO_DOOM_CATCHUP : TICS[:BACKLOG], tics one tick loop iteration may run after a stall and tics of owed time kept for the next ones (default 4:35)
+- UBO_DOOM_LOAD_BUDGET_MS : ms per tic spent building a new level, with a progress bar meanwhile (default 10, 0 = in one go)
+- UBO_DOOM_IDLE_HZ : loop wakes per second in the menu, paused or on a title page, a tap wakes it at once (default 10, 0 = off)
+- UBO_DOOM_INPUT_EARLY_MS : native tick only; start a tic up to this many ms early when input is waiting (default 8, 0 = off)
+- UBO_DOOM_WAD_MMAP     : 1 = lumps served from an mmap of the WAD (default), 0 = zone copies
+- UBO_DOOM_PWADS        : ':'-separated PWADs loaded after the IWAD, later ones overriding earlier
+- UBO_DOOM_PK3_CACHE_MB : MB of inflated .pk3/.zip members kept outside the zone (default 2)
+- UBO_DOOM_RCACHE       : 1 = cache R_InitData tables in ubodoom.rcache next to the config (default), 0 = off
+- UBO_DOOM_LUMP_PROFILE : 1 = record each map's lump reads in ubodoom.lprof/ and prefetch them on reload (default), 0 = off
+- UBO_DOOM_LEVEL_CACHE  : 1 = cache each map's blockmap/sector lines/built REJECT in ubodoom.lcache/ (default), 0 = off
+- UBO_DOOM_COLUMN_QUADS : 1 = draw columns four at a time through a row-wise buffer (default), 0 = vanilla
+- UBO_DOOM_TRANSPOSED_VIEW : 1 = column-major 3D view buffer, transposed once per frame (default 0)
+- UBO_DOOM_DIRECT565    : 1 = level views drawn straight into RGB565, copied into the LCD frame (default 0)
+- UBO_DOOM_RENDER_THREADS : N = draw the 3D view as N vertical strips on parallel threads (default 1, max 8)
+- UBO_DOOM_SIMD         : 1 = NEON/SSE2 palette conversion and spans when the CPU has it (default), 0 = C
+- UBO_DOOM_AUTOMAP_OVERLAY : 1 = the map key overlays the automap on the view, 0 = full automap (default)
+- UBO_DOOM_WIPE         : 1 = screen melt between game states, one step per frame (default), 0 = cut
+- UBO_DOOM_GOVERNOR     : 1 = shed detail, view size, frames and fuzz under load or heat (default), 0 = off
+- UBO_DOOM_GOVERNOR_TEMP : CPU temperature in C the governor sheds quality at (default 75)
+- UBO_DOOM_STATUSBAR_CACHE : 1 = reuse the converted status bar rows while the bar is unchanged (default), 0 = off
+- UBO_DOOM_BORDER_CACHE : 1 = reuse the converted border rows around a shrunk view while they are unchanged (default), 0 = off
+- UBO_DOOM_SKIP_STATIC  : 1 = publish no new frame while a menu/pause/intermission screen is unchanged (default), 0 = off
+- UBO_DOOM_MEMORY_MB    : engine memory budget MB; sizes the zone and caches, trims them when over (default 0 = none)
+- UBO_DOOM_ZONE_MB      : zone heap MB allocated at init (default 32)
+- UBO_DOOM_ZONE_MAX_MB  : total MB the zone may grow to by chaining zones (default 2x base)
+- UBO_DOOM_ZONE_MMAP    : 1 = zone on huge pages, faulted in at init, 0 = malloc (default)
+- UBO_DOOM_ZONE_MLOCK   : 1 = also mlock the zone (default 0)
+- UBO_DOOM_ZONE_PROFILE : 1 = zone allocation profiler per tag and call site (doom_zone_report), N = also log a sample every N tics, 0 = off (default)
+- UBO_DOOM_ZONE_SLABS   : 1 = size-class slabs for small level objects in the zone (default), 0 = first-fit only
+- UBO_DOOM_ZONE_COMPACT : 1 = compact the zone's cache blocks at level load (default), 0 = leave them
+- UBO_DOOM_LEVEL_ARENA  : 1 = level geometry from a bump arena outside the zone (default), 0 = zone
+- UBO_DOOM_SIGHT_CACHE  : 1 = reuse P_CheckSight results while nothing on the line moved (default), 0 = off
+- UBO_DOOM_SIGHT_THREADS : threads tracing the tic's likely sight checks ahead of the thinkers (default 1 = off)
+- UBO_DOOM_LOAD_THREADS : threads converting the map lumps at level load (default 1 = off)
+- UBO_DOOM_SETTINGS     : "name=value;..." engine config settings (screenblocks, sfx_volume, ...) sent with doom_set_config; no doomrc.cfg is read
+- UBO_DOOM_ASYNC_SAVE   : 1 = savegames written by an I/O thread via temp file + rename (default), 0 = on the tic
+- UBO_DOOM_SAVE_COMPRESS : 1 = savegames written zlib packed (default), 0 = plain .dsg; loads read both
+- UBO_DOOM_NET          : "<player> <host[:port]>... [options]" = UDP netgame with those devices (default unset)
+- UBO_DOOM_SUSPEND_ON_CLOSE : 1 = doom_suspend when the page closes: PCM closed, caches dropped, game kept (default), 0 = keep all
+- UBO_DOOM_RELEASE_ON_CLOSE : 1 = doom_shutdown when the page closes, returning the engine's memory (default 0 = stay warm and resume)
+- UBO_DOOM_PREWARM      : seconds after ubo_app start to pre-initialise the engine so Doom opens at once (default unset = off)
+- UBO_DOOM_NET_TIMEOUT  : seconds doom_init waits for the other netgame players (default 30)
+- UBO_DOOM_JOURNAL_MINUTES : minutes of ticcmds written as the ubodoom-crash.lmp demo when a tic crashes (default 10, 0 = off)
+- UBO_DOOM_REWIND_SECONDS : seconds of once-a-second in-memory snapshots for doom_rewind (default 30, 0 = off)
+- UBO_DOOM_SECTOR_CLIP  : 1 = moving sectors re-clip only things touching them (default), 0 = whole blockbox
+- UBO_DOOM_RANDOM_STREAMS: 1 = wipe/sound pitch draw from their own random streams (default), 0 = shared M_Random
+- UBO_DOOM_COMPOSITE_MB : MB of composite wall textures cached outside the zone (default 4)
+- UBO_DOOM_PROFILE      : 1 = per-subsystem frame profiler in libubodoom (doom_get_profile), 0 = off (default)
+- UBO_DOOM_TRACE        : 1 = per-thread timeline of engine phases and I/O, N = events kept per thread, dumped as Chrome JSON by doom_trace_dump(path); 0 = off (default)
+- UBO_DOOM_METRICS      : OpenMetrics counters (tic/stage quantiles, LCD cadence, audio, zone, level loads, crashes) to a file, or "unix:PATH" served per connection; turns the profiler on (default unset: off)
+- UBO_DOOM_METRICS_INTERVAL : seconds between rewrites of the UBO_DOOM_METRICS file (default 10)
+- UBO_DOOM_AUDIO_THREAD : 1 = ALSA writes on their own thread, mixing by wall clock (default), 0 = blocking writes per tic
+- UBO_DOOM_SFX_PRECACHE : 1 = load all sound effects at startup, 0 = on first use (default)
+- UBO_DOOM_SFX_PREFETCH : 1 = page the level's sound lumps in with its graphics (default), 0 = off
+- UBO_DOOM_MIX_CHANNELS : effects mixed at once, 1..32 (default 8)
+- UBO_DOOM_ALSA_RATE : device rate, 11025 default; 44100/48000 upsample in the mixer (audio thread only)
+- UBO_DOOM_SFX_UPSAMPLE : 1 = effects pre-filtered to the device rate at start (default), 0 = interpolate while mixing
+- UBO_DOOM_ALSA_PERIOD_US : ALSA period time, 10000 default
+- UBO_DOOM_ALSA_BUFFER_US : ALSA buffer time, 40000 default (500000 without the audio thread)
+- UBO_DOOM_SNDSERV : path to sndserver; effects and music are then mixed in that process (default unset: in-process)
+- UBO_DOOM_SNDSERV_RTPRIO : SCHED_FIFO priority for sndserver, 10 default, 0 = none
+- UBO_DOOM_MUSIC : 1 = MUS music on the software synth (default), 0 = off
+- UBO_DOOM_MUSIC_QUALITY : 0 = 8 voices, 1 = 16 interpolated (default), 2 = 32
+- UBO_DOOM_MUSIC_BUDGET : percent of real time the synth may use before dropping voices (default 5)
 
 This file is aligned with the exported symbols from the pre-modified
 `third_party/DOOM-master/linuxdoom-1.10` source build,
@@ -45,12 +135,15 @@ as wrapped by `ubo_service/070-doom/native/doom_lib.py`:
   - doom_key_down / doom_key_up   (takes ubo_key_t / UboKey)
   - doom_get_rgba_ptr
   - doom_get_rgba_width / doom_get_rgba_height
+  - doom_set_output_format / doom_get_rgb565_ptr / doom_get_rgb565_size
+  - doom_copy_frame_into          (every format, into preallocated buffers)
+  - doom_get_palette_version / doom_copy_palette565   (the INDEX8 frames' palette)
 """
 
 from __future__ import annotations
 
 import os
-import queue
+import select
 import sys
 import threading
 import time
@@ -76,20 +169,90 @@ from ubo_app.utils.gui import UboPageWidget
 _SERVICE_DIR = os.path.dirname(os.path.abspath(__file__))
 if _SERVICE_DIR not in sys.path:
     sys.path.insert(0, _SERVICE_DIR)
+from display_cadence import DisplayCadence
 from doom_controller import DoomController
-from native.doom_lib import DoomLib, UboKey
+from metrics_export import LcdSample, MetricsExporter, render_metrics
+from native.doom_lib import RGB565_FRAME_BYTES, DoomLib, OutputFormat, ScaleFilter, UboKey, UboStatus
 
 
 # LCD geometry (ubo display uses inclusive rectangle coords: (x0,y0,x1,y1))
 OUT_W: Final[int] = 240
 OUT_H: Final[int] = 240
 RECT_FULL: Final[tuple[int, int, int, int]] = (0, 0, OUT_W - 1, OUT_H - 1)
+LCD_ROW_BYTES: Final[int] = OUT_W * 2  # RGB565
+
+# Doom's TICRATE; rate of the native scheduler in UBO_DOOM_NATIVE_TICK mode.
+NATIVE_TICRATE: Final[int] = 35
+
+# Longest the doom-events thread waits on the event fd before it looks at
+# the stop signal again.
+EVENT_WAIT_S: Final[float] = 0.25
+
+# How long after a tap the tick loop keeps its full rate, as libubodoom's
+# idle mode does (UBO_IDLE_GRACE_US).
+IDLE_GRACE_S: Final[float] = 1.0
+
+# Engine start-up time between progress reports (doom_init_step).
+INIT_STEP_MS: Final[int] = 100
 
 # Letterbox parameters for 320x200 -> 240x150 centered
 ACTIVE_H: Final[int] = 150
 PAD_TOP: Final[int] = (OUT_H - ACTIVE_H) // 2  # 45
 
 
+_SCALE_FILTERS: Final[dict[str, ScaleFilter]] = {
+    "nearest": ScaleFilter.NEAREST,
+    "area": ScaleFilter.AREA2,
+    "box": ScaleFilter.BOX,
+}
+
+
+def _resolve_scale_filter(raw: str) -> ScaleFilter:
+    """Map UBO_DOOM_SCALE_FILTER to a ScaleFilter; unknown values fall back to nearest."""
+    filt = _SCALE_FILTERS.get(raw.strip().lower())
+    if filt is None:
+        if raw.strip():
+            print(f"[doom] unknown UBO_DOOM_SCALE_FILTER={raw!r}, using nearest", flush=True)
+        return ScaleFilter.NEAREST
+    return filt
+
+
+# Config settings handed to libubodoom with doom_set_config() before doom_init(),
+# so the engine reads and writes no config file on the SD card: the bindings
+# the controller relies on (fire on KEY_RCTRL, since KEY_ENTER is stolen by
+# HU_MSGREFRESH; no run key), then whatever UBO_DOOM_SETTINGS adds.
+_BASE_SETTINGS: Final[dict[str, str]] = {
+    "key_fire": str(0x80 + 0x1D),   # KEY_RCTRL
+    "key_right": str(0xAE),
+    "key_left": str(0xAC),
+    "key_up": str(0xAD),
+    "key_down": str(0xAF),
+    "key_speed": "0",
+}
+
+
+def _resolve_settings(raw: str) -> dict[str, str]:
+    """Parse UBO_DOOM_SETTINGS ("name=value;name=value") over _BASE_SETTINGS."""
+    settings = dict(_BASE_SETTINGS)
+    for item in raw.split(";"):
+        name, sep, value = item.partition("=")
+        if not sep or not name.strip():
+            if item.strip():
+                print(f"[doom] ignoring UBO_DOOM_SETTINGS entry {item.strip()!r}", flush=True)
+            continue
+        settings[name.strip()] = value.strip().strip('"')
+    return settings
+
+
+def _send_settings(doom: DoomLib) -> None:
+    """Give the engine its config settings unless it is already running with them."""
+    if doom.is_alive():
+        return
+    for name, value in _resolve_settings(os.environ.get("UBO_DOOM_SETTINGS", "")).items():
+        if not doom.set_config(name, value):
+            print(f"[doom] ignoring config setting {name}={value!r}", flush=True)
+
+
 def _resolve_launch_paths(iwad_path_raw: str) -> tuple[str, str, str]:
     """Resolve canonical Doom launch paths.
 
@@ -113,63 +276,108 @@ def _resolve_launch_paths(iwad_path_raw: str) -> tuple[str, str, str]:
     return str(iwad_path), str(launch_cwd), str(config_path)
 
 
+def _apply_launch_env() -> tuple[Path, str, str, str]:
+    """Resolve the library and launch paths and export them for libubodoom.
+
+    Returns:
+        (lib_path, iwad_path_abs, launch_cwd_abs, config_path_abs)
+    """
+    lib_path = Path(os.environ.get("UBO_DOOM_LIB", str(Path.home() / "doom" / "libubodoom.so")))
+    iwad_default = os.environ.get("UBO_DOOM_IWAD", str(Path.home() / "doom" / "doom2.wad"))
+    iwad_path, launch_cwd, config_path = _resolve_launch_paths(iwad_default)
+
+    # Enforce a single canonical config location and launch cwd for libubodoom.
+    Path(launch_cwd).mkdir(parents=True, exist_ok=True)
+    Path(config_path).parent.mkdir(parents=True, exist_ok=True)
+    os.environ["UBO_DOOM_CWD"] = launch_cwd
+    os.environ["UBO_DOOM_CONFIG"] = config_path
+    return lib_path, iwad_path, launch_cwd, config_path
+
+
+def _prewarm_doom(delay_s: float) -> None:
+    """Start the engine in the background so opening Doom only has to open sound.
+
+    doom_init() from DoomPage later reuses it (the same dlopen handle), or waits
+    for it when the page is opened while this is still running.
+    """
+    time.sleep(delay_s)
+    try:
+        lib_path, iwad_path, _launch_cwd, _config_path = _apply_launch_env()
+        start = time.monotonic()
+        doom = DoomLib(lib_path)
+        _send_settings(doom)
+        doom.prewarm(iwad_path)
+        print(f"[doom] engine prewarmed in {time.monotonic() - start:.2f}s", flush=True)
+    except Exception:
+        print("[doom] prewarm FAILED:\n" + traceback.format_exc(), flush=True)
+
+
 @dataclass
 class _VideoPipe:
     """
-    Converts Doom RGBA (src_w x src_h) -> 240x240 RGB565 (big-endian), letterboxed.
+    Converts Doom's 8-bit frame (src_w x src_h palette indices) -> 240x240
+    RGB565 (big-endian), letterboxed.
 
-    Uses numpy views + precomputed nearest-neighbor index maps.
+    A precomputed nearest-neighbor gather picks the samples and a second one
+    through the engine's RGB565 palette turns them into pixels, both into
+    arrays allocated here once, so a frame costs no new buffers.  The
+    palette is copied in again only when its version moves.
     """
 
     src_w: int
     src_h: int
-    x_src: np.ndarray
-    y_src: np.ndarray
-    out_rgb: np.ndarray
-    out_rgb565: np.ndarray
+    src_idx: np.ndarray
+    scaled: np.ndarray
+    palette: bytearray
+    lut565: np.ndarray
+    palette_version: int
+    out_bytes: bytearray
+    out_active: np.ndarray
+    out_view: memoryview
 
     @classmethod
     def create(cls, *, src_w: int, src_h: int) -> "_VideoPipe":
         # Nearest-neighbor mapping indices:
         #  - 240 samples across width
         #  - 150 samples across height
-        x_src = (np.arange(OUT_W, dtype=np.int32) * src_w) // OUT_W
-        y_src = (np.arange(ACTIVE_H, dtype=np.int32) * src_h) // ACTIVE_H
-
-        out_rgb = np.zeros((OUT_H, OUT_W, 3), dtype=np.uint8)      # RGB888
-        out_rgb565 = np.zeros((OUT_H, OUT_W), dtype=np.uint16)     # RGB565
+        x_src = (np.arange(OUT_W, dtype=np.intp) * src_w) // OUT_W
+        y_src = (np.arange(ACTIVE_H, dtype=np.intp) * src_h) // ACTIVE_H
+        # ...as one pixel index per output pixel, for np.take(out=).
+        src_idx = y_src[:, None] * src_w + x_src[None, :]
+
+        scaled = np.zeros((ACTIVE_H, OUT_W), dtype=np.uint8)    # palette indices
+        # The engine's entries are already big-endian bytes: they are moved
+        # as plain 16-bit words, never swapped.
+        palette = bytearray(256 * 2)
+        lut565 = np.frombuffer(palette, dtype=np.uint16)
+        # Letterbox bars are never written, so they stay black.
+        out_bytes = bytearray(OUT_W * OUT_H * 2)
+        out_words = np.frombuffer(out_bytes, dtype=np.uint16).reshape((OUT_H, OUT_W))
 
         return cls(
             src_w=src_w,
             src_h=src_h,
-            x_src=x_src,
-            y_src=y_src,
-            out_rgb=out_rgb,
-            out_rgb565=out_rgb565,
+            src_idx=src_idx,
+            scaled=scaled,
+            palette=palette,
+            lut565=lut565,
+            palette_version=0,
+            out_bytes=out_bytes,
+            out_active=out_words[PAD_TOP:PAD_TOP + ACTIVE_H],
+            out_view=memoryview(out_bytes),
         )
 
-    def rgba_to_rgb565_be(self, rgba_view: np.ndarray) -> bytes:
+    def index_to_rgb565_be(self, index_pixels: np.ndarray) -> memoryview:
         """
-        rgba_view: numpy view shaped (src_h, src_w, 4) uint8
+        index_pixels: flat 8-bit frame, src_w*src_h palette indices
 
-        Returns bytes length = 240*240*2, RGB565 big-endian, ready for render_block.
+        Returns a view of the 240*240*2 byte RGB565 big-endian frame, ready for
+        render_block; it is overwritten by the next call.
         """
-        # clear to black (letterbox bars)
-        self.out_rgb.fill(0)
-
-        # scale + place active region
-        scaled_rgb = rgba_view[self.y_src[:, None], self.x_src[None, :], :3]  # (150,240,3)
-        self.out_rgb[PAD_TOP:PAD_TOP + ACTIVE_H, :, :] = scaled_rgb
-
-        # pack to RGB565
-        r = self.out_rgb[:, :, 0].astype(np.uint16)
-        g = self.out_rgb[:, :, 1].astype(np.uint16)
-        b = self.out_rgb[:, :, 2].astype(np.uint16)
-
-        self.out_rgb565[:, :] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
-
-        # ST7789 expects big-endian bytes
-        return self.out_rgb565.byteswap().tobytes()
+        # mode="clip" (the indices are in range anyway): "raise" buffers out=.
+        np.take(index_pixels, self.src_idx, out=self.scaled, mode="clip")
+        np.take(self.lut565, self.scaled, out=self.out_active, mode="clip")
+        return self.out_view
 
 
 class DoomPage(UboPageWidget):
@@ -178,8 +386,6 @@ class DoomPage(UboPageWidget):
     """
 
     def __init__(self, **kwargs: object) -> None:
-        # _key_queue must exist before any _tap call; create it before _controller.
-        self._key_queue: queue.Queue[tuple[UboKey, int]] = queue.Queue()
         # Controller owns all input-routing state; DoomPage is a thin shell.
         self._controller = DoomController(tap_fn=self._tap)
         # Footer: L1=mode toggle, L2/L3 depend on mode (alt_mode starts False).
@@ -187,24 +393,45 @@ class DoomPage(UboPageWidget):
         super().__init__(**kwargs)
 
         self._fps = float(os.environ.get("UBO_DOOM_FPS", "30"))
+        cadence = os.environ.get("UBO_DOOM_LCD_CADENCE", "auto").strip()
+        self._lcd_cadence = int(cadence) if cadence.isdigit() else 0
+        self._wifi_busy_bps = float(os.environ.get("UBO_DOOM_WIFI_BUSY_KBPS", "256")) * 1024
+        # Built by each tick loop; _push_frame reports what frames cost to it.
+        self._cadence: DisplayCadence | None = None
+        self._native_video = os.environ.get("UBO_DOOM_NATIVE_VIDEO", "1").strip() != "0"
+        self._native_tick = os.environ.get("UBO_DOOM_NATIVE_TICK", "0").strip() == "1"
+        self._scale_filter = _resolve_scale_filter(os.environ.get("UBO_DOOM_SCALE_FILTER", ""))
+        self._lcd_device = os.environ.get("UBO_DOOM_LCD_DEVICE", "").strip()
+        self._release_on_close = os.environ.get("UBO_DOOM_RELEASE_ON_CLOSE", "0").strip() == "1"
+        self._suspend_on_close = os.environ.get("UBO_DOOM_SUSPEND_ON_CLOSE", "1").strip() != "0"
+        # Loop period while the engine reports idle (menu, pause, title page).
+        idle_hz = float(os.environ.get("UBO_DOOM_IDLE_HZ", "10") or 0)
+        self._idle_interval = 1.0 / idle_hz if idle_hz > 0 else 0.0
+        # Set by every tap so an idle wait ends at once.
+        self._input_evt = threading.Event()
+        self._last_tap = 0.0
+        # True while libubodoom drives the LCD itself and _push_frame has nothing to do.
+        self._native_lcd = False
+        # Reused every rendered frame so the native path allocates nothing per frame.
+        self._lcd_frame = bytearray(RGB565_FRAME_BYTES)
+        self._lcd_view = memoryview(self._lcd_frame)
         self._doom: DoomLib | None = None
         self._video: _VideoPipe | None = None
-        self._rgba_view: "np.ndarray | None" = None
-        # Held-key countdown dict — only accessed by the tick thread.
-        self._held: dict[UboKey, int] = {}
-        # Stop signal and thread handle for the tick loop.
+        self._index_frame: bytearray | None = None
+        self._index_pixels: "np.ndarray | None" = None
+        # Stop signal and thread handles for the tick loop and the game
+        # event listener it starts.
         self._stop_evt = threading.Event()
         self._thread: threading.Thread | None = None
+        self._events: threading.Thread | None = None
+        # UBO_DOOM_METRICS: where the doom-metrics thread publishes the
+        # counters, see metrics_export.py; frames sent for its LCD numbers.
+        self._metrics_target = os.environ.get("UBO_DOOM_METRICS", "").strip()
+        self._metrics_interval = float(os.environ.get("UBO_DOOM_METRICS_INTERVAL", "10") or 0)
+        self._metrics: threading.Thread | None = None
+        self._lcd_frames = 0
 
-        self._lib_path = Path(os.environ.get("UBO_DOOM_LIB", str(Path.home() / "doom" / "libubodoom.so")))
-        iwad_default = os.environ.get("UBO_DOOM_IWAD", str(Path.home() / "doom" / "doom2.wad"))
-        self._iwad_path, self._launch_cwd, self._config_path = _resolve_launch_paths(iwad_default)
-
-        # Enforce a single canonical config location and launch cwd for libubodoom.
-        Path(self._launch_cwd).mkdir(parents=True, exist_ok=True)
-        Path(self._config_path).parent.mkdir(parents=True, exist_ok=True)
-        os.environ["UBO_DOOM_CWD"] = self._launch_cwd
-        os.environ["UBO_DOOM_CONFIG"] = self._config_path
+        self._lib_path, self._iwad_path, self._launch_cwd, self._config_path = _apply_launch_env()
 
         # Pause ubo display so it doesn't interfere with Doom's LCD output.
         # We intentionally do NOT mute OUTPUT audio here — muting the hardware
@@ -221,16 +448,39 @@ class DoomPage(UboPageWidget):
                 flush=True,
             )
             self._doom = DoomLib(self._lib_path)
-            self._doom.init(self._iwad_path)
-
-            fb = self._doom.framebuffer_info()
-            if fb.width <= 0 or fb.height <= 0:
-                raise RuntimeError(f"Invalid Doom framebuffer size: {fb.width}x{fb.height}")
-
-            rgba_ptr = self._doom.rgba_ptr()
-            flat = np.ctypeslib.as_array(rgba_ptr, shape=(fb.width * fb.height * 4,))
-            self._rgba_view = flat.reshape((fb.height, fb.width, 4))
-            self._video = _VideoPipe.create(src_w=fb.width, src_h=fb.height)
+            _send_settings(self._doom)
+            # In steps, so the log shows how far start-up got; a prewarmed
+            # engine is up after the first one.
+            self._doom.init_begin(self._iwad_path)
+            pct = 0
+            while pct < 100:
+                pct = self._doom.init_step(INIT_STEP_MS)
+                print(f"[doom] engine start-up {pct}%", flush=True)
+
+            if self._native_video:
+                # libubodoom scales, letterboxes and packs RGB565 BE itself;
+                # the tick thread only copies the finished frame out.
+                size = self._doom.rgb565_size()
+                if size != RGB565_FRAME_BYTES:
+                    raise RuntimeError(f"Invalid Doom RGB565 frame size: {size} bytes")
+                self._doom.set_scale_filter(self._scale_filter)
+                self._doom.set_output_format(OutputFormat.RGB565_BE)
+                # ubo's own UI owned the LCD until now; repaint all of it.
+                self._doom.invalidate_dirty()
+                if self._lcd_device:
+                    # Falls back to pushing frames from here if the device won't open.
+                    self._native_lcd = self._doom.lcd_open(self._lcd_device)
+            else:
+                fb = self._doom.framebuffer_info()
+                if fb.width <= 0 or fb.height <= 0:
+                    raise RuntimeError(f"Invalid Doom framebuffer size: {fb.width}x{fb.height}")
+
+                # Each frame is copied into this with frame_into(), then
+                # looked up; the RGB565 result is the pipe's own buffer.
+                self._index_frame = bytearray(fb.width * fb.height)
+                self._index_pixels = np.frombuffer(self._index_frame, dtype=np.uint8)
+                self._video = _VideoPipe.create(src_w=fb.width, src_h=fb.height)
+                self._doom.set_output_format(OutputFormat.INDEX8)
 
             # Schedule tick start back on the Kivy main thread.
             Clock.schedule_once(lambda _dt: self._start_tick(), 0)
@@ -294,96 +544,278 @@ class DoomPage(UboPageWidget):
         self._controller.btn_l3()
 
     def _tap(self, key: UboKey, hold_ticks: int = 2) -> None:
-        # Non-blocking: enqueue the event for the tick thread to process.
-        # The tick thread calls key_down and manages the hold countdown.
+        # Non-blocking: libubodoom queues the tap (lock-free) and runs the
+        # hold countdown itself, one tic at a time.  The queue takes posts
+        # from any thread, so this needs no hop through the Kivy clock.
         if self._doom is None:
             return
-        self._key_queue.put_nowait((key, hold_ticks))
+        self._doom.tap(key, hold_ticks)
+        self._last_tap = time.monotonic()
+        self._input_evt.set()
+
+    def _nap(self, status: UboStatus, remaining: float) -> None:
+        """Sleep out the loop period, or the longer idle one the engine is in.
+
+        An idle wait ends at the first tap, and the loop then keeps its full
+        rate for IDLE_GRACE_S, so menu navigation isn't held back.
+        """
+        if (
+            status.idle
+            and self._idle_interval > remaining
+            and time.monotonic() - self._last_tap >= IDLE_GRACE_S
+        ):
+            self._input_evt.wait(self._idle_interval)
+            self._input_evt.clear()
+        elif remaining > 0:
+            time.sleep(remaining)
 
     # ----------
     # Tick thread
     # ----------
+    def _apply_game_state(self, *, alive: bool, gamestate: int, menuactive: bool) -> None:
+        """Update the controller; schedule exit_level() when a level was just left."""
+        just_left_level = self._controller.update_game_state(
+            alive=alive,
+            gamestate=gamestate if alive else -1,
+            menuactive=menuactive if alive else False,
+        )
+        if just_left_level:
+            Clock.schedule_once(lambda _dt: self._exit_level(), 0)
+
+    def _sync_game_state(self, doom: DoomLib) -> None:
+        """Seed the controller from the engine before the tick loop starts.
+
+        No tic runs yet, so events still queued from an earlier visit are
+        older than the status and are dropped.
+        """
+        doom.poll_game_events()
+        status = doom.status_view
+        self._apply_game_state(
+            alive=bool(status.alive),
+            gamestate=status.gamestate,
+            menuactive=bool(status.menuactive),
+        )
+
+    def _event_loop(self, doom: DoomLib) -> None:
+        """Runs on the doom-events thread: routing state follows the engine's
+        game events as they are posted, so no loop polls it per tick."""
+        fd = doom.game_event_fd()
+        while not self._stop_evt.is_set():
+            if fd >= 0:
+                if not select.select([fd], [], [], EVENT_WAIT_S)[0]:
+                    continue
+            else:
+                time.sleep(EVENT_WAIT_S)
+            for ev in doom.poll_game_events():
+                if self._controller.on_game_event(ev.type):
+                    Clock.schedule_once(lambda _dt: self._exit_level(), 0)
+
+    def _start_events(self, doom: DoomLib) -> None:
+        self._sync_game_state(doom)
+        self._events = threading.Thread(
+            target=self._event_loop, args=(doom,), daemon=True, name="doom-events"
+        )
+        self._events.start()
+
+    def _collect_metrics(self) -> str:
+        """Runs on the doom-metrics thread; every call it makes is thread-safe."""
+        doom = self._doom
+        if doom is None:
+            return render_metrics(None)
+        cadence = self._cadence
+        lcd = None
+        if cadence is not None and not self._native_lcd:
+            lcd = LcdSample(divisor=cadence.divisor, cost_s=cadence.cost_s, frames=self._lcd_frames)
+        return render_metrics(doom.status(), doom.profile(), doom.audio_stats(), lcd)
+
+    def _metrics_loop(self, exporter: MetricsExporter) -> None:
+        try:
+            exporter.run(self._stop_evt)
+        except OSError as exc:
+            print(f"[doom] metrics export to {self._metrics_target} stopped: {exc}", flush=True)
+
+    def _start_metrics(self, doom: DoomLib) -> None:
+        if not self._metrics_target:
+            return
+        # The tic and stage quantiles come from the frame profiler.
+        doom.set_profile_enabled(True)
+        exporter = MetricsExporter(self._metrics_target, self._collect_metrics, self._metrics_interval)
+        self._metrics = threading.Thread(
+            target=self._metrics_loop, args=(exporter,), daemon=True, name="doom-metrics"
+        )
+        self._metrics.start()
+
+    def _handle_death(self, doom: DoomLib) -> None:
+        doom.reset()
+        Clock.schedule_once(lambda _dt: self._on_doom_died(), 0)
+
+    def _push_frame(self, doom: DoomLib) -> None:
+        """Blit the latest Doom frame to the LCD."""
+        if self._native_lcd:
+            if doom.lcd_active():
+                return  # libubodoom's display thread sends it
+            self._native_lcd = False
+            doom.lcd_close()
+            doom.invalidate_dirty()
+        t0 = time.monotonic()
+        if self._native_video:
+            frame = doom.acquire_frame()
+            if frame is None:
+                return  # already pushed this one
+            try:
+                # Only push the row bands that changed since the last
+                # blit; static menu/intermission screens cost ~nothing.
+                rects = doom.dirty_rects()
+                if not rects:
+                    return
+                doom.frame_into(self._lcd_frame, OutputFormat.RGB565_BE)
+            finally:
+                doom.release_frame()
+            t1 = time.monotonic()
+            frame_view = self._lcd_view
+            for rect in rects:
+                _x0, y0, _x1, y1 = rect
+                lcd_display.render_block(
+                    rectangle=rect,
+                    data_bytes=frame_view[y0 * LCD_ROW_BYTES:(y1 + 1) * LCD_ROW_BYTES],
+                    bypass_pause=True,
+                )
+        else:
+            video = self._video
+            doom.frame_into(self._index_frame, OutputFormat.INDEX8)
+            version = doom.palette_version()
+            if version != video.palette_version:
+                doom.palette565_into(video.palette)
+                video.palette_version = version
+            rgb565_be = video.index_to_rgb565_be(self._index_pixels)
+            t1 = time.monotonic()
+            lcd_display.render_block(
+                rectangle=RECT_FULL,
+                data_bytes=rgb565_be,
+                bypass_pause=True,
+            )
+        self._lcd_frames += 1
+        if self._cadence is not None:
+            self._cadence.record(t1 - t0, time.monotonic() - t1)
+
+    def _start_cadence(self) -> DisplayCadence:
+        self._cadence = DisplayCadence(
+            1.0 / self._fps,
+            fixed=self._lcd_cadence,
+            wifi_busy_bps=self._wifi_busy_bps,
+        )
+        return self._cadence
+
+    def _update_cadence(self, cadence: DisplayCadence) -> bool:
+        """Re-pick the LCD cadence; True (and a log line) when it changed."""
+        if not cadence.update():
+            return False
+        cost_ms = (cadence.cost_s or 0.0) * 1000
+        print(
+            f"[doom] LCD cadence: every {cadence.divisor} frame(s)"
+            f" (frame {cost_ms:.1f} ms, wifi {cadence.wifi_bps / 1024:.0f} KB/s)",
+            flush=True,
+        )
+        return True
+
     def _tick_loop(self) -> None:
         """Runs entirely on the doom-tick background thread."""
         doom = self._doom
-        video = self._video
-        rgba_view = self._rgba_view
-        if doom is None or video is None or rgba_view is None:
+        if doom is None:
+            return
+        if not self._native_video and (self._video is None or self._index_pixels is None):
+            return
+        self._start_events(doom)
+        self._start_metrics(doom)
+        if self._native_tick:
+            self._present_loop(doom)
             return
 
         interval = 1.0 / self._fps
-        frame = 0
-        _MOVEMENT_OPPOSITE: dict[UboKey, UboKey] = {
-            UboKey.UP: UboKey.DOWN,
-            UboKey.DOWN: UboKey.UP,
-        }
+        cadence = self._start_cadence()
+        status = doom.status_view
+        last = time.monotonic()
         while not self._stop_evt.is_set():
             t0 = time.monotonic()
 
-            # Drain key events posted by the main thread.
-            while True:
-                try:
-                    key, hold_ticks = self._key_queue.get_nowait()
-                    # Cancel the opposite movement direction immediately so
-                    # a lingering hold_ticks countdown can't cause both UP
-                    # and DOWN to be active in gamekeydown simultaneously.
-                    opposite = _MOVEMENT_OPPOSITE.get(key)
-                    if opposite is not None and opposite in self._held:
-                        doom.key_up(opposite)
-                        del self._held[opposite]
-                    if key not in self._held:
-                        doom.key_down(key)
-                    self._held[key] = hold_ticks  # (re)set countdown
-                except queue.Empty:
-                    break
-
-            # Release any held keys whose countdown has expired.
-            # Runs BEFORE doom.tick() so key_up is in the event queue when
-            # D_ProcessEvents drains it on this same tick.
-            for key in list(self._held):
-                self._held[key] -= 1
-                if self._held[key] <= 0:
-                    doom.key_up(key)
-                    del self._held[key]
-
-            doom.tick()
-            frame += 1
-
-            # Update controller's cached state (tick thread → main-thread reads).
-            # update_game_state() returns True when the game just left a level,
-            # which triggers an exit_level() call on the Kivy main thread.
-            alive = doom.is_alive()
-            just_left_level = self._controller.update_game_state(
-                alive=alive,
-                gamestate=doom.gamestate() if alive else -1,
-                menuactive=bool(doom.menuactive()) if alive else False,
-            )
-            if just_left_level:
-                Clock.schedule_once(lambda _dt: self._exit_level(), 0)
+            # Render to the LCD every 1st, 2nd or 3rd loop iteration, as
+            # DisplayCadence picks from what sending frames has cost and
+            # from WiFi traffic: SPI DMA contends with the WiFi SDIO
+            # controller on the RPi4 AXI bus (known SPI/SDIO DMA conflict).
+            # Iterations that won't be shown skip D_Display entirely.
+            self._update_cadence(cadence)
+            render = cadence.due()
+
+            # The library turns wall time into 35 Hz tics whatever the loop
+            # rate, and draws the frame between the last two of them.  After
+            # a stall (GC, WiFi reconnect) it catches up a few tics per call
+            # (UBO_DOOM_CATCHUP) instead of drawing every one.
+            # Queued taps and expired holds are applied inside the tics.
+            doom.advance(t0 - last, render=render)
+            last = t0
 
             # If I_Error or SIGSEGV fired mid-tick the engine marks itself dead.
-            if not doom.is_alive():
-                self._held.clear()
-                doom.reset()
-                Clock.schedule_once(lambda _dt: self._on_doom_died(), 0)
+            # status_view is the engine's live status struct; we are on the
+            # tic thread, so reading it needs no ctypes call and no locking.
+            # The routing state comes from the doom-events thread.
+            if not status.alive:
+                self._handle_death(doom)
                 return
 
-            # Render to LCD every other game tick (~15fps LCD vs 30fps physics).
-            # This halves SPI DMA bandwidth, reducing contention with the WiFi
-            # SDIO controller on the RPi4 AXI bus (known SPI/SDIO DMA conflict).
-            if frame % 2 == 0:
-                rgb565_be = video.rgba_to_rgb565_be(rgba_view)
-                lcd_display.render_block(
-                    rectangle=RECT_FULL,
-                    data_bytes=rgb565_be,
-                    bypass_pause=True,
-                )
+            if render:
+                self._push_frame(doom)
+
+            # Sleep for whatever is left of the frame budget, or longer
+            # while the menu, the pause screen or a title page sits still.
+            self._nap(status, interval - (time.monotonic() - t0))
 
-            # Sleep for whatever is left of the frame budget.
-            elapsed = time.monotonic() - t0
-            remaining = interval - elapsed
-            if remaining > 0:
-                time.sleep(remaining)
+    def _present_loop(self, doom: DoomLib) -> None:
+        """UBO_DOOM_NATIVE_TICK=1: libubodoom ticks on its own pthread at 35 Hz.
+
+        This thread only pushes finished frames (the doom-events thread
+        follows the game state), so GIL/GC pauses no longer delay tics.
+        """
+        interval = 1.0 / self._fps
+        cadence = self._start_cadence()
+        status = doom.status_view
+        # Draw only the tics the LCD will show.
+        doom.set_render_divisor(cadence.divisor)
+        doom.run_async(NATIVE_TICRATE)
+        try:
+            while not self._stop_evt.is_set():
+                t0 = time.monotonic()
+
+                # alive is one int the scheduler thread writes; a torn read
+                # of the rest of the struct doesn't matter here.
+                if not status.alive:
+                    self._handle_death(doom)
+                    return
+
+                # Same adaptive LCD cadence as the sync loop.
+                if self._update_cadence(cadence):
+                    doom.set_render_divisor(cadence.divisor)
+                if cadence.due():
+                    self._push_frame(doom)
+
+                self._nap(status, interval - (time.monotonic() - t0))
+        finally:
+            doom.stop_async()
+
+    def _log_deadlines(self, doom: DoomLib) -> None:
+        """Report this session's late tics and its longest one, then start over."""
+        st = doom.status()
+        if st.deadline_tics == 0:
+            return
+        minutes = st.deadline_tics / NATIVE_TICRATE / 60.0
+        where = f"E{st.worst_episode}M{st.worst_map}" if st.worst_map else f"gamestate {st.worst_gamestate}"
+        print(
+            f"[doom] deadlines: {st.deadline_misses} of {st.deadline_tics} tics late"
+            f" ({st.deadline_misses / minutes:.1f}/min); longest tic {st.worst_tic_us / 1000:.1f} ms"
+            f" at tic {st.worst_gametic} in {where} (sim {st.worst_sim_us / 1000:.1f},"
+            f" render {st.worst_render_us / 1000:.1f}, sound {st.worst_sound_us / 1000:.1f} ms)",
+            flush=True,
+        )
+        doom.reset_deadline_stats()
 
     def _on_doom_died(self) -> None:
         """Called on the Kivy main thread when the engine dies mid-tick."""
@@ -394,31 +826,46 @@ class DoomPage(UboPageWidget):
     def on_close(self) -> None:
         # Signal the tick thread to stop and wait briefly for it to exit.
         self._stop_evt.set()
+        tick_stopped = True
         if self._thread is not None:
             self._thread.join(timeout=1.0)
+            tick_stopped = not self._thread.is_alive()
             self._thread = None
-        # Release every held key in Doom before clearing our tracking dict.
-        # The tick thread may have exited while a key was still held, leaving
-        # gamekeydown[key] = true in the C engine permanently.  Sending
-        # key_up() for each held key here resets that state so re-entering
-        # Doom doesn't inherit stale pressed keys (e.g. perpetual UP/forward).
+        # The listener wakes within EVENT_WAIT_S; a restarted tick loop
+        # clears the stop signal, so it must be gone before then.
+        if self._events is not None:
+            self._events.join(timeout=1.0)
+            self._events = None
+        if self._metrics is not None:
+            self._metrics.join(timeout=1.0)
+            self._metrics = None
+        # Release every held key in Doom.  The tick thread may have exited
+        # while a key was still held, leaving gamekeydown[key] = true in the
+        # C engine permanently.  The queued release-all is applied on the
+        # first tic after re-entering, so Doom doesn't inherit stale pressed
+        # keys (e.g. perpetual UP/forward).
         if self._doom is not None:
-            for key in list(self._held):
-                self._doom.key_up(key)
-        self._held.clear()
-        # Drain any queued key events so they don't linger across re-opens.
-        while not self._key_queue.empty():
-            try:
-                self._key_queue.get_nowait()
-            except queue.Empty:
-                break
+            self._doom.release_all_keys()
+            if tick_stopped:
+                self._log_deadlines(self._doom)
+            # Hand the LCD back before ubo's display resumes.
+            if self._native_lcd:
+                self._doom.lcd_close()
+                self._native_lcd = False
+            # UBO_DOOM_RELEASE_ON_CLOSE=1: free the zone, WADs and buffers now;
+            # the next DoomPage starts a fresh engine with doom_init().
+            if self._release_on_close and tick_stopped:
+                self._doom.shutdown()
+                self._doom = None
+            elif self._suspend_on_close and tick_stopped:
+                # Hand the sound device and the caches back; the next
+                # doom_init() resumes where the user left off.
+                self._doom.suspend()
 
         # Restore ubo display so the rest of the UI works normally while Doom
-        # is not visible.  We do NOT call doom_shutdown here because the Doom
-        # engine is not designed to be re-initialised within the same process
-        # (it re-adds WAD lumps and corrupts zone/tic state on second init).
-        # Leaving it warm means re-entering Doom just restarts the tick loop
-        # and resumes from where the user left off.
+        # is not visible.  By default the engine stays warm, so re-entering
+        # Doom just restarts the tick loop and resumes from where the user
+        # left off.
         store.dispatch(DisplayResumeAction())
 
 
@@ -437,3 +884,9 @@ def init_service() -> None:
             ),
         ),
     )
+
+    # UBO_DOOM_PREWARM=<seconds>: pre-initialise the engine that long after
+    # start-up, once ubo_app itself has settled.
+    prewarm = os.environ.get("UBO_DOOM_PREWARM", "").strip()
+    if prewarm:
+        threading.Thread(target=_prewarm_doom, args=(float(prewarm),), daemon=True).start()
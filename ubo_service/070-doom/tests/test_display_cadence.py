@@ -0,0 +1,152 @@
+"""
+tests/test_display_cadence.py
+
+Unit tests for DisplayCadence — the LCD send-every-Nth-frame scheduler.
+
+Run from the ubo_service/070-doom/ directory:
+    pytest
+
+No Kivy, no .so, no ubo_app imports required.  Every test drives a
+DisplayCadence with a fake clock and a fake WiFi byte counter.
+"""
+
+from __future__ import annotations
+
+import pytest
+
+from display_cadence import (
+    DEFAULT_DIVISOR,
+    EVAL_S,
+    RELAX_EVALS,
+    DisplayCadence,
+    read_wifi_bytes,
+)
+
+# ------------------------------------------------------------------ #
+# Helper / fixtures
+# ------------------------------------------------------------------ #
+
+INTERVAL = 1.0 / 30   # UBO_DOOM_FPS=30
+
+
+class Fake:
+    """A clock and a WiFi counter the tests move by hand."""
+
+    def __init__(self) -> None:
+        self.now = 100.0
+        self.wifi: int | None = 0
+
+    def clock(self) -> float:
+        return self.now
+
+    def wifi_bytes(self) -> int | None:
+        return self.wifi
+
+
+@pytest.fixture
+def fake() -> Fake:
+    return Fake()
+
+
+def make(fake: Fake, **kwargs) -> DisplayCadence:
+    return DisplayCadence(INTERVAL, wifi_bytes=fake.wifi_bytes, clock=fake.clock, **kwargs)
+
+
+def second(fake: Fake, cadence: DisplayCadence, cost_s: float, wifi_bps: int = 0) -> bool:
+    """One evaluation period in which every sent frame cost cost_s."""
+    for _ in range(10):
+        cadence.record(cost_s / 2, cost_s / 2)
+    fake.now += EVAL_S
+    if fake.wifi is not None:
+        fake.wifi += int(wifi_bps * EVAL_S)
+    return cadence.update()
+
+
+# ------------------------------------------------------------------ #
+# Cadence
+# ------------------------------------------------------------------ #
+
+
+class TestDue:
+    def test_starts_every_other_frame(self, fake):
+        cadence = make(fake)
+        assert cadence.divisor == DEFAULT_DIVISOR
+        assert [cadence.due() for _ in range(6)] == [False, True] * 3
+
+    def test_fixed_divisor_never_changes(self, fake):
+        cadence = make(fake, fixed=3)
+        assert [cadence.due() for _ in range(6)] == [False, False, True] * 2
+        for _ in range(2 * RELAX_EVALS):
+            assert not second(fake, cadence, 0.001)
+        assert cadence.divisor == 3
+
+    def test_no_measurement_keeps_default(self, fake):
+        cadence = make(fake)
+        fake.now += 10 * EVAL_S
+        assert not cadence.update()
+        assert cadence.divisor == DEFAULT_DIVISOR
+
+
+class TestAdapt:
+    def test_cheap_frames_speed_up_after_relax_period(self, fake):
+        cadence = make(fake)
+        for _ in range(RELAX_EVALS - 1):
+            assert not second(fake, cadence, 0.002)
+        assert second(fake, cadence, 0.002)
+        assert cadence.divisor == 1
+
+    def test_slow_frames_back_off_at_once(self, fake):
+        cadence = make(fake)
+        assert second(fake, cadence, 0.040)
+        assert cadence.divisor == 3
+
+    def test_boundary_cost_does_not_speed_up(self, fake):
+        # Fits every frame (half the loop is 16.7 ms) but not with margin.
+        cadence = make(fake)
+        for _ in range(2 * RELAX_EVALS):
+            assert not second(fake, cadence, 0.015)
+        assert cadence.divisor == DEFAULT_DIVISOR
+
+    def test_busy_wifi_adds_a_step(self, fake):
+        cadence = make(fake, wifi_busy_bps=100_000)
+        for _ in range(2 * RELAX_EVALS):
+            second(fake, cadence, 0.002, wifi_bps=500_000)
+        assert cadence.divisor == 2
+        assert cadence.wifi_bps == pytest.approx(500_000)
+        assert second(fake, cadence, 0.040, wifi_bps=500_000)
+        assert cadence.divisor == 3
+
+    def test_quiet_wifi_recovers(self, fake):
+        cadence = make(fake, wifi_busy_bps=100_000)
+        second(fake, cadence, 0.012, wifi_bps=500_000)
+        assert cadence.divisor == 2
+        for _ in range(RELAX_EVALS):
+            second(fake, cadence, 0.002)
+        assert cadence.divisor == 1
+
+    def test_missing_wifi_counts_as_quiet(self, fake):
+        fake.wifi = None
+        cadence = make(fake)
+        for _ in range(RELAX_EVALS):
+            second(fake, cadence, 0.002)
+        assert cadence.wifi_bps == 0.0
+        assert cadence.divisor == 1
+
+
+class TestReadWifiBytes:
+    def test_sums_wireless_interfaces(self, tmp_path):
+        dev = tmp_path / "dev"
+        dev.write_text(
+            "Inter-|   Receive                                                |  Transmit\n"
+            " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets\n"
+            "    lo: 500 5 0 0 0 0 0 0 500 5 0 0 0 0 0 0\n"
+            "  eth0: 100 1 0 0 0 0 0 0 200 2 0 0 0 0 0 0\n"
+            " wlan0: 1000 10 0 0 0 0 0 0 3000 30 0 0 0 0 0 0\n"
+        )
+        assert read_wifi_bytes(str(dev)) == 4000
+
+    def test_none_without_wireless(self, tmp_path):
+        dev = tmp_path / "dev"
+        dev.write_text("  eth0: 100 1 0 0 0 0 0 0 200 2 0 0 0 0 0 0\n")
+        assert read_wifi_bytes(str(dev)) is None
+        assert read_wifi_bytes(str(tmp_path / "missing")) is None
@@ -18,7 +18,7 @@ from __future__ import annotations
 import pytest
 
 from doom_controller import DoomController, GS_LEVEL
-from native.doom_lib import UboKey
+from native.doom_lib import GameEvent, UboKey
 
 # ------------------------------------------------------------------ #
 # Helper / fixtures
@@ -521,3 +521,52 @@ class TestAltModeLifecycle:
         assert just_left is True
         ctrl.exit_level()
         assert ctrl.alt_mode is False
+
+
+# ------------------------------------------------------------------ #
+# on_game_event — the same state, driven by engine events
+# ------------------------------------------------------------------ #
+
+class TestOnGameEvent:
+    def test_level_start_enters_level(self, ctrl: DoomController) -> None:
+        assert ctrl.on_game_event(GameEvent.LEVEL_START) is False
+        assert ctrl.in_level is True
+        assert ctrl.menu_active is False
+
+    def test_menu_over_level_leaves_and_returns(self, ctrl: DoomController) -> None:
+        ctrl.on_game_event(GameEvent.LEVEL_START)
+        assert ctrl.on_game_event(GameEvent.MENU_OPEN) is True
+        assert ctrl.in_level is False
+        assert ctrl.menu_active is True
+        assert ctrl.on_game_event(GameEvent.MENU_CLOSE) is False
+        assert ctrl.in_level is True
+
+    def test_level_start_under_open_menu_stays_in_menu(self, ctrl: DoomController) -> None:
+        ctrl.on_game_event(GameEvent.MENU_OPEN)
+        ctrl.on_game_event(GameEvent.LEVEL_START)
+        assert ctrl.in_level is False
+        assert ctrl.on_game_event(GameEvent.MENU_CLOSE) is False
+        assert ctrl.in_level is True
+
+    def test_level_exit_returns_true_once(self, ctrl: DoomController) -> None:
+        ctrl.on_game_event(GameEvent.LEVEL_START)
+        assert ctrl.on_game_event(GameEvent.LEVEL_EXIT) is True
+        assert ctrl.on_game_event(GameEvent.INTERMISSION) is False
+        assert ctrl.in_level is False
+
+    def test_engine_died_clears_everything(self, ctrl: DoomController) -> None:
+        ctrl.on_game_event(GameEvent.LEVEL_START)
+        assert ctrl.on_game_event(GameEvent.ENGINE_DIED) is True
+        assert ctrl.in_level is False
+        assert ctrl.menu_active is False
+
+    def test_other_events_change_nothing(self, ctrl: DoomController) -> None:
+        _set_in_level(ctrl)
+        for event in (GameEvent.PLAYER_DEATH, GameEvent.SAVE_DONE, 99):
+            assert ctrl.on_game_event(event) is False
+            assert ctrl.in_level is True
+
+    def test_continues_from_seeded_state(self, ctrl: DoomController) -> None:
+        _set_menu_open(ctrl)
+        assert ctrl.on_game_event(GameEvent.MENU_CLOSE) is False
+        assert ctrl.in_level is True
@@ -0,0 +1,141 @@
+"""
+tests/test_frame_stream.py
+
+Unit tests for FrameStreamDecoder — the viewer end of UBO_DOOM_STREAM.
+
+Run from the ubo_service/070-doom/ directory:
+    pytest
+
+No Kivy, no .so, no ubo_app imports required.  Every test feeds the decoder
+hand-built stream bytes in the layout framestream.h describes.
+"""
+
+from __future__ import annotations
+
+import pytest
+
+from frame_stream import (
+    DELTA,
+    HELLO,
+    KEY,
+    MAGIC,
+    MSG,
+    PALETTE,
+    VERSION,
+    FrameStreamDecoder,
+    StreamError,
+    to_rgb,
+    unpack_rle,
+)
+
+# ------------------------------------------------------------------ #
+# Helper / fixtures
+# ------------------------------------------------------------------ #
+
+W, H = 4, 2
+
+
+def hello(width: int = W, height: int = H, magic: int = MAGIC) -> bytes:
+    return HELLO.pack(magic, VERSION, width, height, 0)
+
+
+def msg(kind: int, payload: bytes, seq: int = 1, time_ms: int = 0) -> bytes:
+    return MSG.pack(kind, seq, time_ms, len(payload)) + payload
+
+
+def literal(data: bytes) -> bytes:
+    """data as literal ops, the way the engine codes bytes without runs."""
+    out = bytearray()
+    for i in range(0, len(data), 128):
+        chunk = data[i:i + 128]
+        out += bytes((len(chunk) - 1,)) + chunk
+    return bytes(out)
+
+
+def grey_palette(shift: int = 0) -> bytes:
+    return bytes(((i + shift) & 0xFF) for i in range(256) for _ in range(3))
+
+
+# ------------------------------------------------------------------ #
+# RLE
+# ------------------------------------------------------------------ #
+
+
+class TestUnpackRle:
+    def test_literal_and_repeat_ops(self):
+        # 3 literals, then 0x80 = 2 copies, then 0xFF = 129 copies
+        data = bytes((2, 1, 2, 3, 0x80, 9, 0xFF, 0))
+        assert unpack_rle(data, 3 + 2 + 129) == bytes((1, 2, 3, 9, 9)) + bytes(129)
+
+    def test_long_literal_split_in_128s(self):
+        raw = bytes(range(200))
+        assert unpack_rle(literal(raw), 200) == raw
+
+    def test_wrong_size_is_an_error(self):
+        with pytest.raises(StreamError):
+            unpack_rle(bytes((0x81, 5)), 4)
+        with pytest.raises(StreamError):
+            unpack_rle(bytes((0x81, 5)), 2)
+
+    def test_truncated_ops_are_errors(self):
+        with pytest.raises(StreamError):
+            unpack_rle(bytes((3, 1, 2)), 4)
+        with pytest.raises(StreamError):
+            unpack_rle(bytes((0x80,)), 2)
+
+
+def test_to_rgb_looks_up_each_channel():
+    palette = bytearray(768)
+    palette[3:6] = b"\x10\x20\x30"
+    assert to_rgb(b"\x01\x00", bytes(palette)) == b"\x10\x20\x30\x00\x00\x00"
+
+
+# ------------------------------------------------------------------ #
+# Decoder
+# ------------------------------------------------------------------ #
+
+
+class TestDecoder:
+    def test_key_then_delta(self):
+        key = bytes((1, 2, 3, 4, 5, 6, 7, 8))
+        delta = bytes(6) + bytes((1 ^ 7, 0))      # pixel 6 becomes 1
+        stream = (hello() + msg(PALETTE, grey_palette())
+                  + msg(KEY, literal(key), seq=1, time_ms=40)
+                  + msg(DELTA, bytes((0x84, 0)) + literal(delta[6:]), seq=3))
+        decoder = FrameStreamDecoder()
+        frames = decoder.feed(stream)
+        assert (decoder.width, decoder.height) == (W, H)
+        assert [(f.seq, f.key) for f in frames] == [(1, True), (3, False)]
+        assert frames[0].time_ms == 40
+        assert frames[0].indices == key
+        assert frames[1].indices == bytes((1, 2, 3, 4, 5, 6, 1, 8))
+        assert frames[1].rgb[18:21] == b"\x01\x01\x01"
+
+    def test_any_split_of_the_bytes(self):
+        stream = (hello() + msg(PALETTE, grey_palette())
+                  + msg(KEY, bytes((0x86, 7))) + msg(DELTA, bytes((0x86, 0))))
+        decoder = FrameStreamDecoder()
+        frames = []
+        for b in stream:
+            frames += decoder.feed(bytes((b,)))
+        assert [f.indices for f in frames] == [bytes((7,)) * 8] * 2
+
+    def test_palette_change_applies_to_the_next_frame(self):
+        stream = (hello() + msg(PALETTE, grey_palette()) + msg(KEY, bytes((0x86, 7)))
+                  + msg(PALETTE, grey_palette(1)) + msg(DELTA, bytes((0x86, 0))))
+        frames = FrameStreamDecoder().feed(stream)
+        assert frames[0].rgb[:3] == b"\x07\x07\x07"
+        assert frames[1].rgb[:3] == b"\x08\x08\x08"
+
+    def test_bad_magic(self):
+        with pytest.raises(StreamError):
+            FrameStreamDecoder().feed(hello(magic=0x12345678))
+
+    def test_delta_before_key(self):
+        with pytest.raises(StreamError):
+            FrameStreamDecoder().feed(hello() + msg(PALETTE, grey_palette())
+                                      + msg(DELTA, bytes((0x86, 0))))
+
+    def test_frame_before_palette(self):
+        with pytest.raises(StreamError):
+            FrameStreamDecoder().feed(hello() + msg(KEY, bytes((0x86, 7))))
@@ -0,0 +1,228 @@
+"""
+tests/test_metrics_export.py
+
+Unit tests for metrics_export — the UBO_DOOM_METRICS OpenMetrics export.
+
+Run from the ubo_service/070-doom/ directory:
+    pytest
+
+No Kivy, no .so, no ubo_app imports required.  The samples are plain
+namespaces with the UboStatus / UboProfStat / UboAudioStats field names.
+"""
+
+from __future__ import annotations
+
+import os
+import socket
+import threading
+import time
+from types import SimpleNamespace
+
+from metrics_export import (
+    LcdSample,
+    MetricsExporter,
+    bucket_bounds,
+    hist_quantile,
+    render_metrics,
+)
+
+# ------------------------------------------------------------------ #
+# Helper / fixtures
+# ------------------------------------------------------------------ #
+
+BUCKETS = 16   # UBO_PROF_BUCKETS
+
+STATUS_FIELDS = (
+    "last_tic_us", "deadline_tics", "deadline_misses", "worst_tic_us", "worst_sim_us",
+    "worst_render_us", "worst_sound_us", "quality_level", "zone_size", "zone_used",
+    "zone_high_water", "zone_purges", "level_loads", "last_load_us", "max_load_us",
+    "crash_count", "reset_count",
+)
+
+
+def status(**fields) -> SimpleNamespace:
+    values = {name: 0 for name in STATUS_FIELDS}
+    values["alive"] = 1
+    values.update(fields)
+    return SimpleNamespace(**values)
+
+
+def prof_stat(hist: dict[int, int], max_us: int, total_us: int = 0) -> SimpleNamespace:
+    counts = [hist.get(i, 0) for i in range(BUCKETS)]
+    return SimpleNamespace(calls=sum(counts), max_us=max_us, total_us=total_us, hist=counts)
+
+
+def audio(**fields) -> SimpleNamespace:
+    values = {"underruns": 0, "errors": 0, "overruns": 0, "mix_avg_us": 0}
+    values.update(fields)
+    return SimpleNamespace(**values)
+
+
+def samples(text: str) -> dict[str, str]:
+    """Sample lines as name{labels} -> value."""
+    out = {}
+    for line in text.splitlines():
+        if line and not line.startswith("#"):
+            name, value = line.rsplit(" ", 1)
+            out[name] = value
+    return out
+
+
+def wait_for(predicate, timeout_s: float = 2.0) -> bool:
+    deadline = time.monotonic() + timeout_s
+    while time.monotonic() < deadline:
+        if predicate():
+            return True
+        time.sleep(0.01)
+    return False
+
+
+# ------------------------------------------------------------------ #
+# Histogram quantiles
+# ------------------------------------------------------------------ #
+
+class TestQuantiles:
+    def test_bucket_bounds_are_powers_of_two(self) -> None:
+        assert bucket_bounds(0, BUCKETS, 100000) == (0.0, 1.0)
+        assert bucket_bounds(1, BUCKETS, 100000) == (1.0, 2.0)
+        assert bucket_bounds(11, BUCKETS, 100000) == (1024.0, 2048.0)
+
+    def test_last_bucket_ends_at_the_max(self) -> None:
+        assert bucket_bounds(BUCKETS - 1, BUCKETS, 40000) == (16384.0, 40000.0)
+
+    def test_bucket_is_cut_at_the_max(self) -> None:
+        assert bucket_bounds(11, BUCKETS, 1500) == (1024.0, 1500.0)
+
+    def test_empty_histogram_is_zero(self) -> None:
+        assert hist_quantile([0] * BUCKETS, 0.5, 0) == 0.0
+
+    def test_median_interpolates_inside_its_bucket(self) -> None:
+        # 10 samples in [1024, 2048): the median is half way through
+        hist = prof_stat({11: 10}, max_us=2047).hist
+        assert abs(hist_quantile(hist, 0.5, 4096) - 1536.0) < 1e-9
+
+    def test_tail_quantile_lands_in_the_slow_bucket(self) -> None:
+        # 99 fast tics, one of 20 ms
+        hist = prof_stat({10: 99, BUCKETS - 1: 1}, max_us=20000).hist
+        assert hist_quantile(hist, 0.5, 20000) < 1024
+        assert 16384 <= hist_quantile(hist, 0.999, 20000) <= 20000
+
+
+# ------------------------------------------------------------------ #
+# Exposition
+# ------------------------------------------------------------------ #
+
+class TestRender:
+    def test_ends_with_eof(self) -> None:
+        assert render_metrics(status()).endswith("# EOF\n")
+
+    def test_no_engine_is_only_up(self) -> None:
+        s = samples(render_metrics(None))
+        assert s == {"ubodoom_up": "0"}
+
+    def test_dead_engine_is_down(self) -> None:
+        assert samples(render_metrics(status(alive=0)))["ubodoom_up"] == "0"
+
+    def test_counters_carry_total_suffix(self) -> None:
+        text = render_metrics(status(crash_count=3, reset_count=2, level_loads=5))
+        s = samples(text)
+        assert s["ubodoom_crashes_total"] == "3"
+        assert s["ubodoom_resets_total"] == "2"
+        assert s["ubodoom_level_loads_total"] == "5"
+        assert "# TYPE ubodoom_crashes counter" in text
+
+    def test_each_family_is_declared_once(self) -> None:
+        text = render_metrics(status())
+        types = [line for line in text.splitlines() if line.startswith("# TYPE ubodoom_worst_tic_seconds")]
+        assert len(types) == 1
+        assert 'ubodoom_worst_tic_seconds{phase="render"}' in samples(text)
+
+    def test_times_are_seconds(self) -> None:
+        s = samples(render_metrics(status(last_tic_us=12500, max_load_us=250000)))
+        assert float(s["ubodoom_tic_last_seconds"]) == 0.0125
+        assert float(s["ubodoom_level_load_max_seconds"]) == 0.25
+
+    def test_zone_bytes_by_kind(self) -> None:
+        s = samples(render_metrics(status(zone_size=1 << 25, zone_used=1 << 20, zone_purges=7)))
+        assert s['ubodoom_zone_bytes{kind="size"}'] == str(1 << 25)
+        assert s['ubodoom_zone_bytes{kind="used"}'] == str(1 << 20)
+        assert s["ubodoom_zone_purges_total"] == "7"
+
+    def test_stage_summary(self) -> None:
+        profile = {
+            "tic": prof_stat({11: 10}, max_us=4000, total_us=15000),
+            "bsp": prof_stat({}, max_us=0),          # never ran: left out
+        }
+        s = samples(render_metrics(status(), profile))
+        assert float(s['ubodoom_stage_seconds{stage="tic",quantile="0.5"}']) == 0.001536
+        assert s['ubodoom_stage_seconds_count{stage="tic"}'] == "10"
+        assert float(s['ubodoom_stage_seconds_sum{stage="tic"}']) == 0.015
+        assert not any('stage="bsp"' in name for name in s)
+
+    def test_audio_and_lcd_only_when_given(self) -> None:
+        s = samples(render_metrics(status()))
+        assert "ubodoom_audio_underruns_total" not in s
+        assert "ubodoom_lcd_frames_total" not in s
+        s = samples(render_metrics(status(), audio=audio(underruns=4),
+                                   lcd=LcdSample(divisor=2, cost_s=None, frames=900)))
+        assert s["ubodoom_audio_underruns_total"] == "4"
+        assert s["ubodoom_lcd_cadence_divisor"] == "2"
+        assert float(s["ubodoom_lcd_frame_cost_seconds"]) == 0.0
+        assert s["ubodoom_lcd_frames_total"] == "900"
+
+
+# ------------------------------------------------------------------ #
+# Publishing
+# ------------------------------------------------------------------ #
+
+class TestExporter:
+    def test_file_replaced_whole(self, tmp_path) -> None:
+        path = tmp_path / "doom.prom"
+        exporter = MetricsExporter(str(path), lambda: render_metrics(status(reset_count=1)))
+        exporter.write()
+        assert samples(path.read_text())["ubodoom_resets_total"] == "1"
+        assert not os.path.exists(f"{path}.tmp")
+
+    def test_file_written_at_start_and_stop(self, tmp_path) -> None:
+        path = tmp_path / "doom.prom"
+        calls = []
+
+        def collect() -> str:
+            calls.append(1)
+            return render_metrics(status(reset_count=len(calls)))
+
+        stop = threading.Event()
+        thread = threading.Thread(target=MetricsExporter(str(path), collect, 60.0).run, args=(stop,))
+        thread.start()
+        assert wait_for(path.exists)
+        stop.set()
+        thread.join(timeout=2.0)
+        assert not thread.is_alive()
+        assert len(calls) == 2
+        assert samples(path.read_text())["ubodoom_resets_total"] == "2"
+
+    def test_socket_serves_each_connection(self, tmp_path) -> None:
+        path = tmp_path / "doom.sock"
+        calls = []
+
+        def collect() -> str:
+            calls.append(1)
+            return render_metrics(status(crash_count=len(calls)))
+
+        stop = threading.Event()
+        thread = threading.Thread(target=MetricsExporter(f"unix:{path}", collect).run, args=(stop,))
+        thread.start()
+        try:
+            assert wait_for(path.exists)
+            for expected in ("1", "2"):
+                with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as client:
+                    client.connect(str(path))
+                    data = b""
+                    while chunk := client.recv(65536):
+                        data += chunk
+                assert samples(data.decode())["ubodoom_crashes_total"] == expected
+        finally:
+            stop.set()
+            thread.join(timeout=2.0)
+        assert not thread.is_alive()
+        assert not path.exists()